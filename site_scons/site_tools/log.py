@@ -33,6 +33,16 @@ def generate(env, **kwargs):
     if GetOption("log_level"):
         env["LOG_LEVEL_DEFAULT"] = "LOG_LEVEL_" + GetOption("log_level").upper()
 
+    # Optionally compile out logging above a level, e.g. DEBUG and VERBOSE for
+    # release builds, so it costs nothing at run time
+    AddOption("--log-max-level",
+            help=("Highest log level compiled in (options: NONE, ERROR, "
+                    "WARN, INFO, DEBUG, VERBOSE (default))"))
+    if GetOption("log_max_level"):
+        env.Append(CCFLAGS=[
+            "-DLOG_LEVEL_COMPILED=LOG_LEVEL_" + GetOption("log_max_level").upper()
+        ])
+
     # Create the flags to convey the logging config into the build
     env.Append(CCFLAGS=[
         # Source file name
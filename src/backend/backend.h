@@ -29,6 +29,35 @@ typedef void (*mmsm_backend_monitor_callback_t)(
     mmsm_backend_intf_t *intf, mmsm_data_item_t *received);
 
 
+/**
+ * The backend request completion callback.
+ *
+ * Used by backends that support non-blocking requests (see req_submit) to hand the
+ * response back to whoever submitted the request.
+ *
+ * @param arg The argument given alongside the callback to req_submit
+ * @param err MMSM_SUCCESS if a response was received, otherwise an appropriate
+ *            error code
+ * @param result The response. Ownership passes to the callback. May be NULL.
+ */
+typedef void (*mmsm_backend_completion_fn_t)(
+    void *arg, mmsm_error_code err, mmsm_data_item_t *result);
+
+
+/**
+ * Counters a backend keeps of its connection, see get_counters.
+ */
+typedef struct mmsm_backend_counters_t
+{
+    /** Number of times a connection was closed after failing, to be reopened on next use */
+    uint64_t reconnects;
+    /** Number of requests or notifications that failed to be sent or received */
+    uint64_t errors;
+    /** Number of times notifications were lost, e.g. to a full receive buffer */
+    uint64_t events_lost;
+} mmsm_backend_counters_t;
+
+
 /**
  * The backend interface
  *
@@ -40,11 +69,17 @@ typedef void (*mmsm_backend_monitor_callback_t)(
  * register_callback, start, and stop APIs.
  *
  * Additionally, if the interface supports asynchronous requests, it will
- * provide the above APIs, as well as the req_async API.
+ * provide the above APIs, as well as the req_async API. Interfaces that can
+ * hand their notification socket to the engine's event loop also provide
+ * monitor_get_fd and monitor_recv.
  *
  * If the interface supports blocking requests, it will provide the req_blocking
  * API.
  *
+ * If the interface can have requests in flight without blocking the caller, it
+ * will provide the req_submit API. The engine uses it for mmsm_request_async, and
+ * falls back to running req_blocking on a worker thread for interfaces without it.
+ *
  * All APIs are passed the interface struct itself as the first member to allow
  * multiple instantiations of backends and to allow them to manage their own
  * data. All APIs must be called in the following way:
@@ -72,6 +107,80 @@ typedef struct mmsm_backend_intf_t
                                  mmsm_data_item_t **result);
 
 
+    /**
+     * Gets the file descriptor that notifications are received on.
+     *
+     * Opens the notification connection if it isn't already open. The engine
+     * waits for the descriptor to become readable and then calls monitor_recv,
+     * so a single thread can service every backend.
+     *
+     * This API is optional and may be NULL, in which case the engine only uses
+     * req_async for this interface.
+     *
+     * @param intf The interface object
+     *
+     * @returns the file descriptor, or -1 if the connection couldn't be opened
+     */
+    int (*monitor_get_fd)(mmsm_backend_intf_t *intf);
+
+
+    /**
+     * Receives a pending notification.
+     *
+     * Only called once the descriptor from monitor_get_fd is readable, so
+     * must not wait for data to arrive.
+     *
+     * @param intf The interface object
+     * @param result The parsed notification that goes back to the engine for
+     *        pattern matching. May be left NULL if nothing was parsed.
+     *
+     * @returns an appropriate error code
+     */
+    mmsm_error_code (*monitor_recv)(mmsm_backend_intf_t *intf,
+                                    mmsm_data_item_t **result);
+
+
+    /**
+     * Checks whether another notification is waiting to be received.
+     *
+     * After each notification it delivers, the engine keeps calling
+     * monitor_recv while this returns true, so a burst of notifications is
+     * drained in one wake up rather than one wake up per notification.
+     *
+     * This API is optional and may be NULL. Must not wait for data to arrive.
+     *
+     * @param intf The interface object
+     *
+     * @returns true if monitor_recv has a notification to receive
+     */
+    bool (*monitor_pending)(mmsm_backend_intf_t *intf);
+
+
+    /**
+     * Restricts the notifications received to those a pattern monitor can match.
+     *
+     * The engine calls this whenever the pattern monitors on the interface
+     * change, with the command of every monitor (as formatted by
+     * process_request_args). The backend may then discard notifications that
+     * none of the commands can match before parsing them, e.g. with a socket
+     * filter. It may let through notifications that match none of them, but
+     * must not discard any that match one.
+     *
+     * This API is optional and may be NULL. May be called from any thread,
+     * before or after monitor_get_fd.
+     *
+     * @param intf The interface object
+     * @param commands The commands of the monitors
+     * @param count Number of commands, 0 if there are no monitors
+     *
+     * @returns an appropriate error code. On failure, no notifications are
+     *          discarded until the next call.
+     */
+    mmsm_error_code (*monitor_filter)(mmsm_backend_intf_t *intf,
+                                      mmsm_data_item_t *const *commands,
+                                      size_t count);
+
+
     /**
      * Sends a blocking request on the backend.
      *
@@ -89,6 +198,30 @@ typedef struct mmsm_backend_intf_t
                                     mmsm_data_item_t **result);
 
 
+    /**
+     * Sends a non-blocking request on the backend.
+     *
+     * The request is sent and this API returns straight away. When the matching
+     * response arrives (or the request fails), the backend calls done exactly
+     * once, from whichever thread it receives responses on.
+     *
+     * This API is optional and may be NULL.
+     *
+     * @param intf The interface object
+     * @param command The command to send. Remains valid until done is called.
+     * @param done The completion callback
+     * @param arg Argument to provide back on the completion callback
+     *
+     * @returns MMSM_SUCCESS if the request was sent, in which case done will be
+     *          called. Otherwise an appropriate error code, and done is not
+     *          called.
+     */
+    mmsm_error_code (*req_submit)(mmsm_backend_intf_t *intf,
+                                  mmsm_data_item_t *command,
+                                  mmsm_backend_completion_fn_t done,
+                                  void *arg);
+
+
     /**
      * Reads the command information requested byt the user and formats it
      * into something that will be accepted by the backend.
@@ -104,6 +237,18 @@ typedef struct mmsm_backend_intf_t
      */
     mmsm_data_item_t* (*process_request_args)(mmsm_backend_intf_t *intf,
                                               va_list args);
+
+
+    /**
+     * Reads the counters the backend keeps of its connection.
+     *
+     * This API is optional and may be NULL. May be called from any thread, and
+     * must not wait on the backend.
+     *
+     * @param intf The interface object
+     * @param counters Filled in with the counters
+     */
+    void (*get_counters)(mmsm_backend_intf_t *intf, mmsm_backend_counters_t *counters);
 } mmsm_backend_intf_t;
 
 
@@ -128,6 +273,61 @@ mmsm_backend_intf_t *
 mmsm_backend_hostapd_ctrl_create(const char *control_sock);
 
 
+/**
+ * Creates a hostapd ctrl interface backend for one of several BSSes, as
+ * @ref mmsm_backend_hostapd_ctrl_create, but writing the hostapd datalog to
+ * "hostapd_<instance>.log", so the backends of other BSSes don't write over it.
+ *
+ * @param control_sock The path to the control socket to attach to
+ * @param instance The name of the BSS, or NULL for the same datalog as
+ *                 @ref mmsm_backend_hostapd_ctrl_create
+ *
+ * @returns the created backend interface instance
+ */
+mmsm_backend_intf_t *
+mmsm_backend_hostapd_ctrl_create_instance(const char *control_sock, const char *instance);
+
+
+/**
+ * Sends a command to hostapd and returns only the items for the given keys.
+ *
+ * The reply is tokenized in a single pass and items are only built for lines
+ * whose key is listed, which is much cheaper than @ref mmsm_request for
+ * replies such as STATUS when only a few of their keys are needed. The
+ * items are in the order of the reply. The request goes straight to the
+ * backend, bypassing the request cache and statistics.
+ *
+ * @param handle The hostapd control interface backend
+ * @param command The command, as passed to @ref mmsm_request
+ * @param keys The keys to return, terminated by NULL
+ *
+ * @returns the items found, to be freed with mmsm_data_item_free, or NULL if
+ *          none were found or the request failed
+ */
+mmsm_data_item_t *
+mmsm_backend_hostapd_ctrl_request_keys(mmsm_backend_intf_t *handle,
+                                       const char *command,
+                                       const char *const *keys);
+
+
+/**
+ * Parses a reply or notification received from hostapd, as the hostapd backend does.
+ *
+ * Used to measure parsing offline, e.g. by the benchmarks, without a hostapd to talk to. The
+ * buffer is modified, its lines being terminated in place.
+ *
+ * @param out Buffer holding the reply, nul terminated. The values of the items returned point
+ *        into it.
+ * @param len Length of the reply
+ * @param keys If not NULL, the keys to build items for, terminated by NULL, as for
+ *        @ref mmsm_backend_hostapd_ctrl_request_keys
+ *
+ * @returns the items parsed, to be freed with mmsm_data_item_free, or NULL if none were
+ */
+mmsm_data_item_t *
+mmsm_backend_hostapd_ctrl_parse(mmsm_data_buf_t *out, size_t len, const char *const *keys);
+
+
 /**
  * Destroys a hostapd control interface backend.
  *
@@ -145,6 +345,10 @@ mmsm_backend_hostapd_ctrl_destroy(mmsm_backend_intf_t *handle);
  * a Smart Manager application to access configurations within cfg80211 and the
  * WLAN driver.
  *
+ * Requests sent with req_submit (e.g. from mmsm_request_async and batches)
+ * share one socket and are matched to their replies by sequence number, so
+ * several can be in flight at once.
+ *
  * @returns the created backend interface instance
  */
 mmsm_backend_intf_t *
@@ -159,17 +363,515 @@ mmsm_backend_nl80211_create(void);
 void
 mmsm_backend_nl80211_destroy(mmsm_backend_intf_t *handle);
 
+
+/**
+ * Command of the notification the nl80211 backend raises when notifications
+ * may have been lost.
+ *
+ * Raised when the monitor socket's receive buffer has overflowed, e.g. during a
+ * burst of events, after which the kernel has discarded notifications. Monitors
+ * that keep state from notifications (e.g. the current channel) should register
+ * for it, and query the state again when it arrives:
+ *
+ *     mmsm_monitor_pattern(nl80211, "", callback, context,
+ *                          MMSM_BACKEND_NL80211_EVENTS_LOST, 0, -1);
+ *
+ * The value of the notification is the uint64_t number of overflows so far, as
+ * from @ref mmsm_backend_nl80211_get_events_lost. It is outside the range of
+ * nl80211 commands, so is never sent by the kernel.
+ */
+#define MMSM_BACKEND_NL80211_EVENTS_LOST (0x10000)
+
+
+/**
+ * Sets the receive buffer sizes of the nl80211 backend's sockets.
+ *
+ * Larger monitor buffers make bursts of notifications less likely to overflow
+ * them (see @ref MMSM_BACKEND_NL80211_EVENTS_LOST). Only applies to sockets
+ * opened afterwards, so call before @ref mmsm_start and the first request.
+ * Sizes are limited by the kernel's net.core.rmem_max.
+ *
+ * @param handle The nl80211 backend
+ * @param monitor_bytes Receive buffer of the notification socket, or 0 for
+ *        the kernel's default
+ * @param request_bytes Receive buffer of the request sockets, or 0 for the
+ *        default
+ */
+void
+mmsm_backend_nl80211_set_rx_buffers(mmsm_backend_intf_t *handle,
+                                    int monitor_bytes,
+                                    int request_bytes);
+
+
+/**
+ * Gets the number of times notifications were lost, see
+ * @ref MMSM_BACKEND_NL80211_EVENTS_LOST.
+ *
+ * @param handle The nl80211 backend
+ *
+ * @returns the number of times the monitor socket's receive buffer overflowed
+ */
+uint64_t
+mmsm_backend_nl80211_get_events_lost(mmsm_backend_intf_t *handle);
+
+
+struct nl_msg;
+
+
+/**
+ * Parses a message received from nl80211, as the nl80211 backend does its replies and
+ * notifications.
+ *
+ * Used to measure parsing offline, e.g. by the benchmarks, on messages built or captured
+ * beforehand.
+ *
+ * @param msg The message. Values of the items returned may refer to it, taking a reference.
+ *
+ * @returns the message as one item keyed by its command, as in the result of mmsm_request, to be
+ *          freed with mmsm_data_item_free, or NULL on failure
+ */
+mmsm_data_item_t *
+mmsm_backend_nl80211_parse(struct nl_msg *msg);
+
+
+/**
+ * Called with each batch of messages of a dump streamed by
+ * @ref mmsm_backend_nl80211_dump.
+ *
+ * @param context The context given to mmsm_backend_nl80211_dump
+ * @param items The messages, one item each as in the result of mmsm_request.
+ *        Freed once the callback returns, unless a reference is taken with
+ *        mmsm_data_item_retain.
+ */
+typedef void (*mmsm_backend_nl80211_dump_fn_t)(void *context,
+                                               mmsm_data_item_t *items);
+
+
+/**
+ * Sends a dump request and provides the messages of the reply as they arrive.
+ *
+ * Rather than building the whole reply before returning, as @ref mmsm_request
+ * does, the messages are handed to the callback in batches as they are
+ * received. Only one batch is held in memory at a time, whatever the size of
+ * the dump, e.g. a station, survey or scan dump on a busy AP. Blocks until the
+ * dump has finished, and calls the callback on the calling thread. The request
+ * goes straight to the backend, bypassing the request cache and statistics.
+ *
+ * @param handle The nl80211 backend
+ * @param batch_size Number of messages per batch (0 is treated as 1). The last
+ *        batch may be smaller.
+ * @param fn Callback for each batch
+ * @param context Passed to fn
+ * @param ... The command, as passed to @ref mmsm_request. NLM_F_DUMP is added
+ *        to the flags.
+ *
+ * @returns MMSM_SUCCESS once the whole dump has been delivered, otherwise an
+ *          appropriate error code, in which case any batches delivered before
+ *          the failure are all that were received
+ */
+mmsm_error_code
+mmsm_backend_nl80211_dump(mmsm_backend_intf_t *handle,
+                          size_t batch_size,
+                          mmsm_backend_nl80211_dump_fn_t fn,
+                          void *context,
+                          ...);
+
+
+/**
+ * Sends several requests back to back on one socket, then gathers their
+ * replies.
+ *
+ * Every request is written before any reply is read, so the replies queue up
+ * in the socket's receive buffer (see @ref mmsm_backend_nl80211_set_rx_buffers)
+ * and all of them cost a single round-trip. Blocks until every request has
+ * been answered. The requests go straight to the backend, bypassing the
+ * request cache and statistics.
+ *
+ * @param handle The nl80211 backend
+ * @param commands The requests, each formatted by the backend's
+ *        process_request_args. Dumps aren't supported, as the kernel only runs
+ *        one dump at a time per socket.
+ * @param count Number of requests
+ * @param results Set to the reply of each request, as the result of
+ *        mmsm_request, or NULL if it failed or had no reply. To be freed by the
+ *        caller.
+ *
+ * @returns MMSM_SUCCESS if every request succeeded, otherwise an appropriate
+ *          error code
+ */
+mmsm_error_code
+mmsm_backend_nl80211_request_many(mmsm_backend_intf_t *handle,
+                                  mmsm_data_item_t *const *commands,
+                                  size_t count,
+                                  mmsm_data_item_t **results);
+
 /**
  * @brief Create a morsectrl backend. Creates & uses a nl80211 backend under the hood.
  *
+ * The commands of a request sent with req_submit are all submitted to the
+ * nl80211 backend at once, rather than one after another. The commands of a
+ * blocking request are sent back to back on one socket.
+ *
  * @param ifname The name of the interface, eg. "wlan0"
  * @return the created morsectrl backend instance
  */
 mmsm_backend_intf_t *mmsm_backend_morsectrl_create(const char *ifname);
 
+/**
+ * @brief Create a morsectrl backend on an existing nl80211 backend
+ *
+ * Lets the morsectrl backends of several interfaces share one nl80211 backend,
+ * and so one socket receiving notifications. Vendor events for other
+ * interfaces are ignored. The nl80211 backend must outlive the morsectrl
+ * backend, and is not destroyed with it.
+ *
+ * @param ifname The name of the interface, eg. "wlan0"
+ * @param nl80211_intf The nl80211 backend to use
+ * @return the created morsectrl backend instance
+ */
+mmsm_backend_intf_t *mmsm_backend_morsectrl_create_with_nl80211(const char *ifname,
+                                                                mmsm_backend_intf_t *nl80211_intf);
+
 /**
  * @brief Destroy a morsectrl backend instance
  *
+ * Requests made with @ref mmsm_backend_morsectrl_request_async that are still
+ * pending are cancelled, without their callbacks being called.
+ *
  * @param handle The handle to the backend to destroy.
  */
 void mmsm_backend_morsectrl_destroy(mmsm_backend_intf_t *handle);
+
+/**
+ * Passed to @ref mmsm_backend_morsectrl_request_async for a command that
+ * completes with its confirm, rather than with a later vendor event.
+ */
+#define MMSM_MORSECTRL_NO_EVENT (-1)
+
+/**
+ * An asynchronous morsectrl request, see @ref mmsm_backend_morsectrl_request_async
+ */
+typedef struct mmsm_morsectrl_async mmsm_morsectrl_async_t;
+
+/**
+ * @brief Called once an asynchronous morsectrl request has completed
+ *
+ * Called exactly once per request unless it is cancelled, from whichever thread
+ * completed it (the nl80211 backend's, the engine's monitor dispatch or the
+ * morsectrl backend's own timeout thread), so must not block for long.
+ *
+ * @param context The context given to @ref mmsm_backend_morsectrl_request_async
+ * @param err MMSM_SUCCESS if the command was confirmed and its event (if any)
+ *            was received, MMSM_COMMAND_FAILED if the chip rejected the command,
+ *            otherwise an appropriate error code, including when the confirm or
+ *            event didn't arrive in time
+ * @param confirm The command's response, as in the result of req_blocking, or
+ *                NULL if none was received
+ * @param event The vendor event, as provided to a pattern monitor on nl80211,
+ *              or NULL if none was waited for or received
+ *
+ * confirm and event are freed once the callback returns, unless a reference is
+ * taken with mmsm_data_item_retain.
+ */
+typedef void (*mmsm_morsectrl_async_fn_t)(void *context, mmsm_error_code err,
+                                          mmsm_data_item_t *confirm, mmsm_data_item_t *event);
+
+/**
+ * @brief Called with a vendor event to check it is for a request, see
+ *        @ref mmsm_backend_morsectrl_request_async_match
+ *
+ * Called with the backend's lock held, so must not block or call into the
+ * morsectrl backend.
+ *
+ * @param context The context given with the request
+ * @param event The vendor event, as provided to a pattern monitor on nl80211
+ * @param age_us Microseconds since the request was sent
+ * @return true if the event may be for the request, false if it must be for an
+ *         earlier request that has already completed
+ */
+typedef bool (*mmsm_morsectrl_async_match_fn_t)(void *context, mmsm_data_item_t *event,
+                                                uint64_t age_us);
+
+/**
+ * @brief Send a morsectrl command without waiting for it to complete
+ *
+ * For commands that start an operation the chip reports on with a later vendor
+ * event, such as MORSE_CMD_ID_OCS_DRIVER and MORSE_VENDOR_EVENT_OCS_DONE, the
+ * request only completes once that event has arrived too. Vendor events don't
+ * say which command they are for, so an event completes the oldest request
+ * waiting for it (see @ref mmsm_backend_morsectrl_request_async_match to
+ * reject events for requests that have already timed out). Several requests
+ * can be in flight at once, so vendor operations can overlap.
+ *
+ * @param handle The morsectrl backend
+ * @param event The MORSE_VENDOR_EVENT_* that completes the command, or
+ *              MMSM_MORSECTRL_NO_EVENT
+ * @param timeout_ms How long to wait for the confirm and event, or 0 to wait
+ *                   for the event indefinitely
+ * @param fn Called once the request has completed
+ * @param context Passed to fn
+ * @param command_id The MORSE_CMD_ID_* of the command
+ * @param len Length of the command body
+ * @param data The command body, copied before returning
+ * @return the request, valid until fn has returned or the request is cancelled,
+ *         or NULL if it couldn't be sent, in which case fn is not called
+ */
+mmsm_morsectrl_async_t *mmsm_backend_morsectrl_request_async(mmsm_backend_intf_t *handle,
+                                                             int event, uint32_t timeout_ms,
+                                                             mmsm_morsectrl_async_fn_t fn,
+                                                             void *context, int command_id,
+                                                             uint16_t len, const void *data);
+
+/**
+ * @brief Send a morsectrl command without waiting for it to complete, checking
+ *        the vendor events that could complete it
+ *
+ * As @ref mmsm_backend_morsectrl_request_async, except that the oldest request
+ * waiting for an event is first passed it with match. If match returns false,
+ * the event arrived too late for a request that has already completed (e.g.
+ * timed out), so it is dropped rather than completing this or any later
+ * request.
+ *
+ * @param match Checks events before they complete the request
+ * @see mmsm_backend_morsectrl_request_async for the other parameters
+ */
+mmsm_morsectrl_async_t *mmsm_backend_morsectrl_request_async_match(
+        mmsm_backend_intf_t *handle, int event, mmsm_morsectrl_async_match_fn_t match,
+        uint32_t timeout_ms, mmsm_morsectrl_async_fn_t fn, void *context, int command_id,
+        uint16_t len, const void *data);
+
+/**
+ * @brief Cancel an asynchronous morsectrl request
+ *
+ * Unless called from within the request's callback, the callback is not
+ * running and will not be called once this returns. If the callback is
+ * running on another thread, waits for it to return. Must not be called once
+ * the callback has returned.
+ *
+ * @param handle The morsectrl backend
+ * @param request The request
+ */
+void mmsm_backend_morsectrl_cancel(mmsm_backend_intf_t *handle, mmsm_morsectrl_async_t *request);
+
+/**
+ * A reusable morsectrl command, see @ref mmsm_backend_morsectrl_cmd_create
+ */
+typedef struct mmsm_morsectrl_cmd mmsm_morsectrl_cmd_t;
+
+/**
+ * @brief Create a reusable morsectrl command
+ *
+ * The command, and the nl80211 vendor command carrying it, are built once, so
+ * sending it again, e.g. on every poll, doesn't format, allocate or copy
+ * anything at the morsectrl level. The payload is edited in place between
+ * sends. MORSECTRL_CMD_CREATE in backend/morsectrl/command.h takes the payload
+ * size from the command's request type.
+ *
+ * @param handle The morsectrl backend
+ * @param command_id The MORSE_CMD_ID_* of the command
+ * @param len Length of the payload, which starts zeroed
+ * @return the command, or NULL on failure
+ */
+mmsm_morsectrl_cmd_t *mmsm_backend_morsectrl_cmd_create(mmsm_backend_intf_t *handle,
+                                                        uint16_t command_id, uint16_t len);
+
+/**
+ * @brief Get the payload of a reusable morsectrl command, to fill in before sending
+ */
+void *mmsm_backend_morsectrl_cmd_payload(mmsm_morsectrl_cmd_t *cmd);
+
+/**
+ * @brief Send reusable morsectrl commands, and block until they have completed
+ *
+ * The commands are sent back to back, as for a blocking request with several
+ * commands. They go straight to the backend, bypassing the request cache and
+ * statistics. A command must only be sent by one thread at a time.
+ *
+ * @param cmds The commands, all created on the same backend
+ * @param count Number of commands
+ * @param result Set to the responses, as for a blocking request, to be freed
+ *               by the caller
+ * @return MMSM_SUCCESS on success, MMSM_COMMAND_FAILED if the chip rejected a
+ *         command, otherwise an appropriate error code
+ */
+mmsm_error_code mmsm_backend_morsectrl_cmd_send(mmsm_morsectrl_cmd_t *const *cmds, size_t count,
+                                                mmsm_data_item_t **result);
+
+/**
+ * @brief Destroy a reusable morsectrl command
+ *
+ * @param cmd The command (may be NULL)
+ */
+void mmsm_backend_morsectrl_cmd_destroy(mmsm_morsectrl_cmd_t *cmd);
+
+
+/**
+ * Settings of a mock backend, see @ref mmsm_backend_mock_create
+ */
+typedef struct mmsm_backend_mock_config_t
+{
+    /** Time each request takes to answer, in microseconds */
+    uint32_t latency_us;
+    /** Up to this many more microseconds are added to each request's latency, at random */
+    uint32_t latency_jitter_us;
+    /** Number of "key<n>=<n>" items answering commands without a canned response, at least 1 */
+    uint32_t response_items;
+    /** Notifications raised per second, in bursts every millisecond at high rates. 0 for none. */
+    uint32_t event_rate;
+    /** The notification raised, as hostapd would send it. NULL for "<3>MOCK-EVENT". */
+    const char *event;
+    /**
+     * If not 0, each notification is followed by a station address, cycling through this many,
+     * eg. "<3>AP-STA-CONNECTED 02:00:00:00:00:01", so monitors can each match their own
+     */
+    uint32_t event_stations;
+} mmsm_backend_mock_config_t;
+
+
+/**
+ * Counters of a mock backend, see @ref mmsm_backend_mock_get_counters
+ */
+typedef struct mmsm_backend_mock_counters_t
+{
+    /** Requests answered */
+    uint64_t requests;
+    /** Notifications raised, by the rate or injected */
+    uint64_t events_raised;
+    /** Notifications the engine has received */
+    uint64_t events_received;
+} mmsm_backend_mock_counters_t;
+
+
+/**
+ * Creates a mock backend, which answers requests and raises notifications in memory, for load
+ * testing the engine without hostapd or a radio.
+ *
+ * Commands are C strings, as for the hostapd backend, and answered with their canned response
+ * (see @ref mmsm_backend_mock_set_response) after the configured latency. Responses and
+ * notifications are hostapd style text, parsed as the hostapd backend parses what it receives.
+ * Notifications are received on a thread of their own or on the event loop, as for the other
+ * backends.
+ *
+ * @param config The settings, copied. NULL for the defaults: no latency, a single item in
+ *        each response and no notifications.
+ *
+ * @returns the created backend interface instance, or NULL on failure
+ */
+mmsm_backend_intf_t *
+mmsm_backend_mock_create(const mmsm_backend_mock_config_t *config);
+
+
+/**
+ * Sets the response to a command of a mock backend.
+ *
+ * @param handle The mock backend
+ * @param command The command, eg. "STATUS"
+ * @param response The response, as hostapd would send it, eg. "state=ENABLED\nfreq=5180\n".
+ *        Copied. Replaces the command's response if it already has one.
+ *
+ * @returns an appropriate error code
+ */
+mmsm_error_code
+mmsm_backend_mock_set_response(mmsm_backend_intf_t *handle,
+                               const char *command,
+                               const char *response);
+
+
+/**
+ * Raises notifications on a mock backend straight away, on top of those raised at its rate, to
+ * test bursts.
+ *
+ * @param handle The mock backend
+ * @param count Number of notifications to raise
+ */
+void
+mmsm_backend_mock_inject(mmsm_backend_intf_t *handle, uint32_t count);
+
+
+/**
+ * Gets the counters of a mock backend.
+ *
+ * @param handle The mock backend
+ * @param counters Filled in with the counters
+ */
+void
+mmsm_backend_mock_get_counters(mmsm_backend_intf_t *handle,
+                               mmsm_backend_mock_counters_t *counters);
+
+
+/**
+ * Destroys a mock backend.
+ *
+ * Monitors added on the backend must have been removed, or the engine stopped.
+ *
+ * @param handle The mock backend (may be NULL)
+ */
+void
+mmsm_backend_mock_destroy(mmsm_backend_intf_t *handle);
+
+
+/**
+ * Gets the shared instance of a backend, creating it on first use.
+ *
+ * Modules that get the same backend share one instance, and so its sockets,
+ * notification and request threads, datalog and request cache. Each instance
+ * is destroyed once it has been put back as many times as it was got.
+ *
+ * @param name The backend, "nl80211"
+ *
+ * @returns the shared instance, to be released with @ref mmsm_backend_put, or
+ *          NULL if it couldn't be created or there is no such backend
+ */
+mmsm_backend_intf_t *
+mmsm_backend_get(const char *name);
+
+
+/**
+ * Gets the shared hostapd control interface backend of a control socket, as
+ * for @ref mmsm_backend_get. Its hostapd datalog is written per BSS, named
+ * after the control socket, eg. hostapd_wlan0.log.
+ *
+ * @param control_sock The path to the control socket to attach to
+ *
+ * @returns the shared instance, or NULL if it couldn't be created
+ */
+mmsm_backend_intf_t *
+mmsm_backend_get_hostapd(const char *control_sock);
+
+
+/**
+ * Gets the shared morsectrl backend of an interface, as for
+ * @ref mmsm_backend_get. It uses the shared nl80211 backend.
+ *
+ * @param ifname The name of the interface, eg. "wlan0"
+ *
+ * @returns the shared instance, or NULL if it couldn't be created
+ */
+mmsm_backend_intf_t *
+mmsm_backend_get_morsectrl(const char *ifname);
+
+
+/**
+ * Describes a shared backend instance, e.g. "hostapd:/var/run/hostapd_s1g/wlan0".
+ *
+ * @param intf The backend
+ * @param buf Where to write the description
+ * @param size Size of buf
+ *
+ * @returns true if the backend is a shared instance and was described, else false
+ */
+bool
+mmsm_backend_get_name(mmsm_backend_intf_t *intf, char *buf, size_t size);
+
+
+/**
+ * Releases a backend got with @ref mmsm_backend_get or its variants,
+ * destroying it if nothing else is using it. Commands registered on it with
+ * @ref mmsm_request_cache_command are unregistered first.
+ *
+ * Monitors the caller added on the backend must have been removed.
+ *
+ * @param intf The backend (may be NULL)
+ */
+void
+mmsm_backend_put(mmsm_backend_intf_t *intf);
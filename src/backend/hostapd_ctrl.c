@@ -4,13 +4,18 @@
  */
 
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 
@@ -21,9 +26,63 @@
 #include "helpers.h"
 #include "logging.h"
 #include "datalog.h"
+#include "trace.h"
+#include "probes.h"
 #include "mmsm_data.h"
 
 
+/** Timeout waiting for the reply to a request, as used by wpa_ctrl_request */
+#define HOSTAPD_REPLY_TIMEOUT_MS (10000)
+
+/** Number of request connections kept open to the control socket */
+#define HOSTAPD_CTRL_POOL_SIZE (4)
+
+
+/**
+ * A request sent with req_submit
+ */
+typedef struct hostapd_ctrl_submit_t
+{
+    /** The request, valid until done is called */
+    const char *cmd;
+
+    /** Called with the reply */
+    mmsm_backend_completion_fn_t done;
+
+    /** Passed to done */
+    void *arg;
+
+    /** When to give up waiting for the reply, see @ref hostapd_ctrl_now_us */
+    uint64_t deadline_us;
+
+    /** Whether the request was written to the datalog, so its reply is too */
+    bool logged;
+
+    /** When the request was sent, for the flight recorder */
+    uint64_t started_us;
+
+    /** Next request in the queue */
+    struct hostapd_ctrl_submit_t *next;
+} hostapd_ctrl_submit_t;
+
+
+/**
+ * A request connection to the control socket
+ */
+typedef struct hostapd_ctrl_conn_t
+{
+    /** The connection, or NULL if it is yet to be opened */
+    struct wpa_ctrl *wpa_ctrl;
+
+    /** Whether a request is using the connection */
+    bool busy;
+
+    /** The submitted request waiting for its reply on the connection. Only used by the submit
+     *  thread. */
+    hostapd_ctrl_submit_t *submit;
+} hostapd_ctrl_conn_t;
+
+
 typedef struct backend_hostapd_ctrl_t
 {
     /** The interface */
@@ -37,22 +96,90 @@ typedef struct backend_hostapd_ctrl_t
 
     /** The wpa_ctrl structure that is used in the pattern monitor */
     struct wpa_ctrl *monitor_wpa_ctrl;
+
+    /** Request connections, opened on first use and kept open between requests */
+    hostapd_ctrl_conn_t conns[HOSTAPD_CTRL_POOL_SIZE];
+
+    /** Protects conns */
+    pthread_mutex_t conns_mutex;
+
+    /** Signalled when a connection is no longer busy */
+    pthread_cond_t conns_cond;
+
+    /** Submitted requests waiting for a connection, protected by conns_mutex */
+    hostapd_ctrl_submit_t *submit_head;
+    hostapd_ctrl_submit_t **submit_tail;
+
+    /** Sends submitted requests and receives their replies, started on the first one */
+    pthread_t submit_thread;
+    bool submit_started;
+
+    /** Set to stop the submit thread, protected by conns_mutex */
+    bool submit_stopping;
+
+    /** eventfd used to wake the submit thread */
+    int submit_wake_fd;
+
+    /** Counters of failed connections, updated with relaxed atomics */
+    mmsm_backend_counters_t counters;
 } backend_hostapd_ctrl_t;
 
 
 /** Mutex to wrap wpa_ctrl_open, which relies on static memory */
 pthread_mutex_t wpa_ctrl_open_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/**
+ * Keys that appear in most hostapd responses and events. They are interned when the first
+ * backend is created, so parsing shares their atoms rather than allocating a copy per line.
+ */
+static const char *const hostapd_known_keys[] = {
+    "state", "phy", "freq", "channel", "secondary_channel", "ieee80211n", "ieee80211ac",
+    "ieee80211ax", "beacon_int", "dtim_period", "max_txpower", "supported_rates",
+    "cac_time_seconds", "cac_time_left_seconds", "bss[0]", "bssid[0]", "ssid[0]", "num_sta[0]",
+    "s1g_freq", "s1g_bw", "s1g_prim_chwidth", "s1g_prim_1mhz_chan_index",
+    "flags", "aid", "capability", "listen_interval", "connected_time", "inactive_msec",
+    "signal", "rx_packets", "tx_packets", "rx_bytes", "tx_bytes", "timeout_next",
+    "OK", "FAIL", "AP-STA-CONNECTED", "AP-STA-DISCONNECTED", "AP-CSA-FINISHED",
+    "CTRL-EVENT-STARTED-CHANNEL-SWITCH",
+};
+
+static pthread_once_t hostapd_known_keys_once = PTHREAD_ONCE_INIT;
+
+static void
+hostapd_intern_known_keys(void)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(hostapd_known_keys); i++)
+        mmsm_key_intern(hostapd_known_keys[i]);
+}
+
 
 static mmsm_error_code
 backend_hostapd_ctrl_command(mmsm_backend_intf_t *intf,
                              mmsm_data_item_t *command,
                              mmsm_data_item_t **result);
 
+static mmsm_error_code
+backend_hostapd_ctrl_submit(mmsm_backend_intf_t *intf,
+                            mmsm_data_item_t *command,
+                            mmsm_backend_completion_fn_t done,
+                            void *arg);
+
 static mmsm_error_code
 backend_hostapd_ctrl_monitor(mmsm_backend_intf_t *intf,
                              mmsm_data_item_t **result);
 
+static int
+backend_hostapd_ctrl_monitor_get_fd(mmsm_backend_intf_t *intf);
+
+static mmsm_error_code
+backend_hostapd_ctrl_monitor_recv(mmsm_backend_intf_t *intf,
+                                  mmsm_data_item_t **result);
+
+static bool
+backend_hostapd_ctrl_monitor_pending(mmsm_backend_intf_t *intf);
+
 /**
  * Reads the command information requested byt the user and formats it
  * into something that will be accepted by the backend.
@@ -69,90 +196,308 @@ static mmsm_data_item_t *
 backend_hostapd_process_request_args(mmsm_backend_intf_t *intf,
                                      va_list args);
 
+static void
+backend_hostapd_ctrl_get_counters(mmsm_backend_intf_t *intf, mmsm_backend_counters_t *counters);
+
 
 
 static const mmsm_backend_intf_t intf = {
     .req_blocking = backend_hostapd_ctrl_command,
+    .req_submit = backend_hostapd_ctrl_submit,
     .req_async = backend_hostapd_ctrl_monitor,
+    .monitor_get_fd = backend_hostapd_ctrl_monitor_get_fd,
+    .monitor_recv = backend_hostapd_ctrl_monitor_recv,
+    .monitor_pending = backend_hostapd_ctrl_monitor_pending,
     .process_request_args = backend_hostapd_process_request_args,
+    .get_counters = backend_hostapd_ctrl_get_counters,
 };
 
 
-static int
-parse_item(char *line, mmsm_data_item_t *item)
+/**
+ * Splits a line into its key and value in a single pass, terminating both in place.
+ *
+ * The key is the first run of characters other than '=' and ' ', less any "<level>" prefix of an
+ * event, and the value is what follows up to the next '='.
+ *
+ * @param line The line, nul terminated
+ * @param key Set to the key
+ * @param value Set to the value, or NULL if the line has none
+ * @return true on success, or false if the line has no key
+ */
+static bool
+hostapd_tokenize_line(char *line, char **key, char **value)
 {
-    char *save_ptr = NULL;
-    char *token;
+    char *start = line + strspn(line, "= ");
+    char *end;
 
-    token = strtok_r(line, "= ", &save_ptr);
-    if (token)
+    if (!*start)
+        return false;
+
+    end = start + strcspn(start, "= ");
+    if (*start == '<')
     {
-        if (*token == '<')
-        {
-            while (*token != '>')
-            {
-                token++;
-            }
-            token++;
-        }
-        mmsm_data_item_set_key_str(item, token);
-        token = strtok_r(NULL, "=", &save_ptr);
-        if (token)
-        {
-            mmsm_data_item_set_val_string(item, token);
-        }
-        return 0;
+        char *level_end = memchr(start, '>', end - start);
+
+        start = level_end ? level_end + 1 : end;
+    }
+
+    *key = start;
+    *value = NULL;
+    if (!*end)
+        return true;
+
+    *end++ = '\0';
+    end += strspn(end, "=");
+    if (*end)
+    {
+        *value = end;
+        end += strcspn(end, "=");
+        *end = '\0';
     }
-    return 1;
+
+    return true;
 }
 
 
-static mmsm_data_item_t *
-parse_output(char *buf)
+/**
+ * Fills in an item from a key and value tokenized from a line in a buffer.
+ */
+static void
+parse_item(char *key, char *value, mmsm_data_item_t *item, mmsm_data_buf_t *out)
+{
+    mmsm_data_item_set_key_str(item, key);
+    if (value)
+    {
+        /* The value is terminated in place, so can be used straight from the buffer */
+        mmsm_data_item_set_val_ref(item, out, (uint8_t *)value, strlen(value) + 1);
+        mmsm_data_item_set_typed_from_string(item);
+    }
+}
+
+
+/**
+ * State of parsing a response line by line
+ */
+typedef struct hostapd_parser_t
+{
+    /** The buffer the response is in, which item values point into */
+    mmsm_data_buf_t *out;
+
+    /** The arena the items are allocated from */
+    mmsm_data_arena_t *arena;
+
+    /** The first item parsed */
+    mmsm_data_item_t *head;
+
+    /** The last item parsed */
+    mmsm_data_item_t *tail;
+
+    /** If not NULL, the keys to build items for, terminated by NULL. Other lines are skipped. */
+    const char *const *keys;
+
+    /** Set once a line fails to parse, after which the response is discarded */
+    bool failed;
+} hostapd_parser_t;
+
+
+static void
+hostapd_parser_init(hostapd_parser_t *parser, mmsm_data_buf_t *out, const char *const *keys)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->out = out;
+    parser->keys = keys;
+    /* The whole response is freed at once, so allocate it in one arena */
+    parser->arena = mmsm_data_arena_create();
+}
+
+
+/**
+ * Checks whether the parser builds items for a key.
+ */
+static bool
+hostapd_parser_wants(const hostapd_parser_t *parser, const char *key)
 {
-    char *save_ptr = NULL;
-    char *token;
-    mmsm_data_item_t *previous = NULL, *head = NULL;
+    const char *const *wanted;
 
-    token = strtok_r(buf, "\n", &save_ptr);
-    while (token != NULL)
+    if (!parser->keys)
+        return true;
+
+    for (wanted = parser->keys; *wanted; wanted++)
     {
-        if (!previous)
-        {
-            previous = mmsm_data_item_alloc();
-            head = previous;
-        }
-        else
-        {
-            previous = mmsm_data_item_alloc_next(previous);
-        }
-        if (previous == NULL)
-        {
-            mmsm_data_item_free(head);
-            return NULL;
-        }
-        previous->mmsm_next = NULL;
+        if (strcmp(*wanted, key) == 0)
+            return true;
+    }
 
-        if (parse_item(token, previous))
+    return false;
+}
+
+
+/**
+ * Parses one line, terminated in place, and appends its item.
+ */
+static void
+hostapd_parser_line(hostapd_parser_t *parser, char *line)
+{
+    mmsm_data_item_t *item;
+    char *key;
+    char *value;
+
+    if (parser->failed || !*line)
+        return;
+
+    if (!hostapd_tokenize_line(line, &key, &value))
+    {
+        parser->failed = true;
+        return;
+    }
+
+    if (!hostapd_parser_wants(parser, key))
+        return;
+
+    if (parser->tail)
+        item = mmsm_data_item_alloc_next(parser->tail);
+    else
+        item = mmsm_data_item_alloc_in(parser->arena);
+
+    if (!item)
+    {
+        parser->failed = true;
+        return;
+    }
+
+    parse_item(key, value, item, parser->out);
+
+    item->mmsm_next = NULL;
+    if (!parser->head)
+        parser->head = item;
+    parser->tail = item;
+}
+
+
+/**
+ * Parses every complete line of newly arrived data. The data must be within the parser's buffer.
+ *
+ * @param parser The parser
+ * @param data The data
+ * @param len Length of data
+ * @param last Whether this is the end of the response, so a trailing partial line is complete
+ * @return the number of bytes consumed. The rest, a partial line, must be passed in again along
+ *         with the data that follows it.
+ */
+static size_t
+hostapd_parser_feed(hostapd_parser_t *parser, char *data, size_t len, bool last)
+{
+    size_t consumed = 0;
+
+    while (consumed < len)
+    {
+        char *line = data + consumed;
+        char *eol = memchr(line, '\n', len - consumed);
+
+        if (!eol)
         {
-            mmsm_data_item_free(head);
-            return NULL;
+            if (!last)
+                break;
+
+            /* The response is terminated just past its end */
+            hostapd_parser_line(parser, line);
+            return len;
         }
-        token = strtok_r(NULL, "\n", &save_ptr);
+
+        *eol = '\0';
+        hostapd_parser_line(parser, line);
+        consumed = eol + 1 - data;
     }
 
+    return consumed;
+}
+
+
+/**
+ * Ends parsing.
+ *
+ * @return the items parsed, or NULL if there were none or parsing failed
+ */
+static mmsm_data_item_t *
+hostapd_parser_finish(hostapd_parser_t *parser)
+{
+    mmsm_data_item_t *head = parser->head;
+
+    if (parser->failed && head)
+    {
+        mmsm_data_item_free(head);
+        head = NULL;
+    }
+    mmsm_data_arena_put(parser->arena);
+
     return head;
 }
 
 
-static mmsm_error_code
-backend_hostapd_ctrl_monitor(mmsm_backend_intf_t *handle,
-                             struct mmsm_data_item_t **result)
+/**
+ * Parses a response held in a buffer. The values of the items returned point into the buffer.
+ *
+ * @param out The buffer
+ * @param len Length of the response
+ * @param keys If not NULL, the keys to build items for, terminated by NULL
+ */
+static mmsm_data_item_t *
+parse_output(mmsm_data_buf_t *out, size_t len, const char *const *keys)
+{
+    hostapd_parser_t parser;
+
+    hostapd_parser_init(&parser, out, keys);
+    hostapd_parser_feed(&parser, mmsm_data_buf_data(out), len, true);
+
+    return hostapd_parser_finish(&parser);
+}
+
+
+/**
+ * Receives a whole datagram from a control socket into a buffer sized to fit it, so that long
+ * replies such as STA dumps or scan results are never truncated.
+ *
+ * @param fd The socket
+ * @param out Set to the buffer, nul terminated, to be released with mmsm_data_buf_put
+ * @param out_len Set to the length of the datagram
+ * @return 0 on success, or -1 with errno set
+ */
+static int
+hostapd_ctrl_recv(int fd, mmsm_data_buf_t **out, size_t *out_len)
+{
+    ssize_t len;
+    char *buf;
+
+    /* MSG_TRUNC gives the full length of the datagram waiting, whatever the buffer size */
+    len = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (len < 0)
+        return -1;
+
+    *out = mmsm_data_buf_alloc(len + 1);
+    if (!*out)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    buf = mmsm_data_buf_data(*out);
+
+    len = recv(fd, buf, len, 0);
+    if (len < 0)
+    {
+        mmsm_data_buf_put(*out);
+        return -1;
+    }
+
+    buf[len] = '\0';
+    *out_len = len;
+    return 0;
+}
+
+
+static int
+backend_hostapd_ctrl_monitor_get_fd(mmsm_backend_intf_t *handle)
 {
-    int ret;
     backend_hostapd_ctrl_t *hostapd = get_container_from_intf(hostapd, handle);
-    char out_buf[2048];
-    size_t out_buf_len = sizeof(out_buf) - 1;
 
     if (hostapd->monitor_wpa_ctrl == NULL)
     {
@@ -163,17 +508,63 @@ backend_hostapd_ctrl_monitor(mmsm_backend_intf_t *handle,
         if (hostapd->monitor_wpa_ctrl == NULL)
         {
             LOG_ERROR("Failed to open control interface\n");
-            return MMSM_UNKNOWN_ERROR;
+            return -1;
         }
         else
         {
             wpa_ctrl_attach(hostapd->monitor_wpa_ctrl);
         }
     }
+
+    return wpa_ctrl_get_fd(hostapd->monitor_wpa_ctrl);
+}
+
+
+static mmsm_error_code
+backend_hostapd_ctrl_monitor_recv(mmsm_backend_intf_t *handle,
+                                  struct mmsm_data_item_t **result)
+{
+    backend_hostapd_ctrl_t *hostapd = get_container_from_intf(hostapd, handle);
+    mmsm_data_buf_t *out;
+    size_t out_len;
+
+    if (hostapd_ctrl_recv(wpa_ctrl_get_fd(hostapd->monitor_wpa_ctrl), &out, &out_len) != 0)
+    {
+        __atomic_fetch_add(&hostapd->counters.errors, 1, __ATOMIC_RELAXED);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    LOG_VERBOSE("RX: \n");
+    LOG_DATA(LOG_LEVEL_VERBOSE, (uint8_t *)mmsm_data_buf_data(out), out_len);
+    MMSM_PROBE1(hostapd__event, mmsm_data_buf_data(out));
+    *result = parse_output(out, out_len, NULL);
+    mmsm_data_buf_put(out);
+
+    return MMSM_SUCCESS;
+}
+
+
+static bool
+backend_hostapd_ctrl_monitor_pending(mmsm_backend_intf_t *handle)
+{
+    backend_hostapd_ctrl_t *hostapd = get_container_from_intf(hostapd, handle);
+
+    return hostapd->monitor_wpa_ctrl && wpa_ctrl_pending(hostapd->monitor_wpa_ctrl) > 0;
+}
+
+
+static mmsm_error_code
+backend_hostapd_ctrl_monitor(mmsm_backend_intf_t *handle,
+                             struct mmsm_data_item_t **result)
+{
     struct timeval tv;
     int res;
-    int sock = wpa_ctrl_get_fd(hostapd->monitor_wpa_ctrl);
+    int sock = backend_hostapd_ctrl_monitor_get_fd(handle);
     fd_set rfds;
+
+    if (sock < 0)
+        return MMSM_UNKNOWN_ERROR;
+
     tv.tv_sec = 1;
     tv.tv_usec = 0;
     FD_ZERO(&rfds);
@@ -181,16 +572,516 @@ backend_hostapd_ctrl_monitor(mmsm_backend_intf_t *handle,
     res = select(sock + 1, &rfds, NULL, NULL, &tv);
     if (res < 0)
         return MMSM_UNKNOWN_ERROR;
-    ret = wpa_ctrl_recv(hostapd->monitor_wpa_ctrl, out_buf, &out_buf_len);
-    if (ret == 0)
+    if (res == 0)
+        return MMSM_SUCCESS;
+
+    return backend_hostapd_ctrl_monitor_recv(handle, result);
+}
+
+
+/**
+ * Takes a free request connection from the pool, preferring one that is already open. Must be
+ * called with conns_mutex held.
+ *
+ * @return the connection, or NULL if every connection is busy
+ */
+static hostapd_ctrl_conn_t *
+hostapd_ctrl_conn_take(backend_hostapd_ctrl_t *hostapd)
+{
+    hostapd_ctrl_conn_t *conn = NULL;
+    size_t i;
+
+    for (i = 0; i < HOSTAPD_CTRL_POOL_SIZE; i++)
     {
-        out_buf[out_buf_len] = 0;
-        LOG_VERBOSE("RX: \n");
-        LOG_DATA(LOG_LEVEL_VERBOSE, (uint8_t *)out_buf, out_buf_len);
-        *result = parse_output(out_buf);
+        if (hostapd->conns[i].busy)
+            continue;
+
+        if (!conn || (!conn->wpa_ctrl && hostapd->conns[i].wpa_ctrl))
+            conn = &hostapd->conns[i];
     }
 
-    return ret == 0 ? MMSM_SUCCESS : MMSM_UNKNOWN_ERROR;
+    if (conn)
+        conn->busy = true;
+
+    return conn;
+}
+
+
+/**
+ * Wakes the submit thread.
+ */
+static void
+hostapd_ctrl_submit_wake(backend_hostapd_ctrl_t *hostapd)
+{
+    uint64_t one = 1;
+
+    if (write(hostapd->submit_wake_fd, &one, sizeof(one)) < 0)
+        LOG_ERROR("Failed to wake hostapd submit thread: %d\n", errno);
+}
+
+
+/**
+ * Takes a request connection from the pool, waiting for one if every connection is busy.
+ */
+static hostapd_ctrl_conn_t *
+hostapd_ctrl_conn_get(backend_hostapd_ctrl_t *hostapd)
+{
+    hostapd_ctrl_conn_t *conn;
+
+    MMSM_ASSERT(pthread_mutex_lock(&hostapd->conns_mutex) == 0);
+    while (!(conn = hostapd_ctrl_conn_take(hostapd)))
+        MMSM_ASSERT(pthread_cond_wait(&hostapd->conns_cond, &hostapd->conns_mutex) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&hostapd->conns_mutex) == 0);
+
+    return conn;
+}
+
+
+/**
+ * Returns a request connection to the pool.
+ */
+static void
+hostapd_ctrl_conn_put(backend_hostapd_ctrl_t *hostapd, hostapd_ctrl_conn_t *conn)
+{
+    MMSM_ASSERT(pthread_mutex_lock(&hostapd->conns_mutex) == 0);
+    conn->busy = false;
+    MMSM_ASSERT(pthread_cond_signal(&hostapd->conns_cond) == 0);
+    /* Submitted requests waiting for a connection can now have this one */
+    if (hostapd->submit_head)
+        hostapd_ctrl_submit_wake(hostapd);
+    MMSM_ASSERT(pthread_mutex_unlock(&hostapd->conns_mutex) == 0);
+}
+
+
+/**
+ * Closes a request connection, so the next request on it reconnects.
+ */
+static void
+hostapd_ctrl_conn_close(hostapd_ctrl_conn_t *conn)
+{
+    if (conn->wpa_ctrl)
+        wpa_ctrl_close(conn->wpa_ctrl);
+    conn->wpa_ctrl = NULL;
+}
+
+
+/**
+ * Closes a request connection that failed, so the next request on it reconnects.
+ */
+static void
+hostapd_ctrl_conn_fail(backend_hostapd_ctrl_t *hostapd, hostapd_ctrl_conn_t *conn)
+{
+    hostapd_ctrl_conn_close(conn);
+    __atomic_fetch_add(&hostapd->counters.errors, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hostapd->counters.reconnects, 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Sends a request on a control socket.
+ *
+ * @return 0 on success, -1 on failure, or -2 on timeout
+ */
+static int
+hostapd_ctrl_send(int fd, const char *cmd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+    /* The socket is non-blocking, so wait for room if the send buffer is full */
+    while (send(fd, cmd, strlen(cmd), 0) < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+
+        if (poll(&pfd, 1, HOSTAPD_REPLY_TIMEOUT_MS) == 0)
+            return -2;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Receives a message from a control socket with data waiting, skipping unsolicited events.
+ *
+ * @return 0 if the reply was received, 1 if the message was an event and was skipped, or -1 on
+ *         failure
+ */
+static int
+hostapd_ctrl_recv_reply(int fd, mmsm_data_buf_t **reply, size_t *reply_len)
+{
+    const char *data;
+
+    if (hostapd_ctrl_recv(fd, reply, reply_len) != 0)
+        return -1;
+
+    data = mmsm_data_buf_data(*reply);
+    if (data[0] == '<' || strncmp(data, "IFNAME=", 7) == 0)
+    {
+        mmsm_data_buf_put(*reply);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Sends a request and receives its reply, much as wpa_ctrl_request does but without limiting the
+ * size of the reply.
+ *
+ * @return 0 on success, -1 if sending or receiving failed, or -2 on timeout
+ */
+static int
+hostapd_ctrl_request(struct wpa_ctrl *wpa_ctrl, const char *cmd,
+                     mmsm_data_buf_t **reply, size_t *reply_len)
+{
+    struct pollfd pfd = { .fd = wpa_ctrl_get_fd(wpa_ctrl), .events = POLLIN };
+    int res;
+
+    res = hostapd_ctrl_send(pfd.fd, cmd);
+    if (res != 0)
+        return res;
+
+    while (true)
+    {
+        res = poll(&pfd, 1, HOSTAPD_REPLY_TIMEOUT_MS);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0)
+            return -1;
+        if (res == 0)
+            return -2;
+
+        res = hostapd_ctrl_recv_reply(pfd.fd, reply, reply_len);
+        if (res <= 0)
+            return res;
+    }
+}
+
+
+/**
+ * Opens a request connection if it isn't open already.
+ *
+ * @return true if the connection is open
+ */
+static bool
+hostapd_ctrl_conn_open(backend_hostapd_ctrl_t *hostapd, hostapd_ctrl_conn_t *conn)
+{
+    if (conn->wpa_ctrl)
+        return true;
+
+    MMSM_ASSERT(pthread_mutex_lock(&wpa_ctrl_open_mutex) == 0);
+    conn->wpa_ctrl = wpa_ctrl_open(hostapd->control_sock);
+    MMSM_ASSERT(pthread_mutex_unlock(&wpa_ctrl_open_mutex) == 0);
+    if (!conn->wpa_ctrl)
+    {
+        LOG_ERROR("Failed to open control interface\n");
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Sends a request on a connection from the pool, opening it first if needed.
+ *
+ * A connection that was open before may have been left dangling by hostapd restarting, so a
+ * failure to send on one is retried once on a fresh connection.
+ *
+ * @param hostapd The backend
+ * @param conn The connection
+ * @param cmd The request
+ * @param reply If not NULL, wait for the reply and set this to it. After a timeout the reply may
+ *              still arrive and be mistaken for the reply to the next request, so the connection
+ *              is closed.
+ * @param reply_len Set to the length of the reply
+ *
+ * @return 0 on success, -1 on failure, or -2 on timeout
+ */
+static int
+hostapd_ctrl_conn_request(backend_hostapd_ctrl_t *hostapd, hostapd_ctrl_conn_t *conn,
+                          const char *cmd, mmsm_data_buf_t **reply, size_t *reply_len)
+{
+    bool reused = conn->wpa_ctrl != NULL;
+    int ret;
+
+    while (true)
+    {
+        if (!hostapd_ctrl_conn_open(hostapd, conn))
+            return -1;
+
+        if (reply)
+            ret = hostapd_ctrl_request(conn->wpa_ctrl, cmd, reply, reply_len);
+        else
+            ret = hostapd_ctrl_send(wpa_ctrl_get_fd(conn->wpa_ctrl), cmd);
+        if (ret == 0)
+            return 0;
+
+        hostapd_ctrl_conn_fail(hostapd, conn);
+        if (ret != -1 || !reused)
+            return ret;
+
+        LOG_INFO("Reconnecting to control interface\n");
+        reused = false;
+    }
+}
+
+
+/**
+ * Logs and parses a reply.
+ *
+ * @param logged Whether the request was written to the datalog, see @ref datalog_sample
+ */
+static mmsm_data_item_t *
+hostapd_ctrl_reply(backend_hostapd_ctrl_t *hostapd, mmsm_data_buf_t *out, size_t out_len,
+                   const char *const *keys, bool logged)
+{
+    mmsm_data_item_t *result;
+
+    LOG_VERBOSE("RX:\n%s\n", (char *)mmsm_data_buf_data(out));
+    if (logged)
+        datalog_write_string(hostapd->datalog, "Rx\n%s\n", (char *)mmsm_data_buf_data(out));
+
+    result = parse_output(out, out_len, keys);
+    mmsm_data_buf_put(out);
+
+    return result;
+}
+
+
+/**
+ * Sends a request and parses its reply.
+ *
+ * @param hostapd The backend
+ * @param cmd The request
+ * @param keys If not NULL, the keys to build items for, terminated by NULL
+ * @param result Set to the parsed reply
+ */
+static mmsm_error_code
+hostapd_ctrl_command(backend_hostapd_ctrl_t *hostapd, const char *cmd,
+                     const char *const *keys, mmsm_data_item_t **result)
+{
+    int ret;
+    mmsm_data_buf_t *out;
+    size_t out_len;
+    hostapd_ctrl_conn_t *conn;
+    uint64_t started_us;
+    uint32_t latency_us;
+    bool logged = datalog_sample(hostapd->datalog, cmd);
+
+    if (logged)
+        datalog_write_string(hostapd->datalog, "Tx %s\n", cmd);
+
+    conn = hostapd_ctrl_conn_get(hostapd);
+    started_us = trace_begin(TRACE_HOSTAPD, conn - hostapd->conns, trace_name(cmd));
+    MMSM_PROBE2(hostapd__request__start, conn - hostapd->conns, cmd);
+    ret = hostapd_ctrl_conn_request(hostapd, conn, cmd, &out, &out_len);
+    latency_us = trace_end(TRACE_HOSTAPD, conn - hostapd->conns, ret != 0, started_us);
+    MMSM_PROBE3(hostapd__request__done, conn - hostapd->conns, ret, latency_us);
+    hostapd_ctrl_conn_put(hostapd, conn);
+
+    if (ret != 0)
+        return MMSM_UNKNOWN_ERROR;
+
+    *result = hostapd_ctrl_reply(hostapd, out, out_len, keys, logged);
+
+    return MMSM_SUCCESS;
+}
+
+
+/**
+ * Gets the time on the monotonic clock, in microseconds.
+ */
+static uint64_t
+hostapd_ctrl_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Finishes a submitted request waiting on a connection, and returns the connection to the pool.
+ */
+static void
+hostapd_ctrl_submit_complete(backend_hostapd_ctrl_t *hostapd, hostapd_ctrl_conn_t *conn,
+                             mmsm_error_code err, mmsm_data_item_t *result)
+{
+    hostapd_ctrl_submit_t *submit = conn->submit;
+    uint32_t latency_us;
+
+    latency_us = trace_end(TRACE_HOSTAPD, conn - hostapd->conns, err, submit->started_us);
+    MMSM_PROBE3(hostapd__request__done, conn - hostapd->conns, err, latency_us);
+    conn->submit = NULL;
+    if (err != MMSM_SUCCESS)
+        hostapd_ctrl_conn_close(conn);
+    hostapd_ctrl_conn_put(hostapd, conn);
+
+    submit->done(submit->arg, err, result);
+    free(submit);
+}
+
+
+/**
+ * Sends queued requests on every free connection.
+ */
+static void
+hostapd_ctrl_submit_start(backend_hostapd_ctrl_t *hostapd)
+{
+    while (true)
+    {
+        hostapd_ctrl_submit_t *submit;
+        hostapd_ctrl_conn_t *conn = NULL;
+
+        MMSM_ASSERT(pthread_mutex_lock(&hostapd->conns_mutex) == 0);
+        submit = hostapd->submit_head;
+        if (submit && (conn = hostapd_ctrl_conn_take(hostapd)))
+        {
+            hostapd->submit_head = submit->next;
+            if (!hostapd->submit_head)
+                hostapd->submit_tail = &hostapd->submit_head;
+        }
+        MMSM_ASSERT(pthread_mutex_unlock(&hostapd->conns_mutex) == 0);
+
+        if (!conn)
+            return;
+
+        conn->submit = submit;
+        submit->deadline_us = hostapd_ctrl_now_us() + HOSTAPD_REPLY_TIMEOUT_MS * 1000ull;
+        submit->logged = datalog_sample(hostapd->datalog, submit->cmd);
+        if (submit->logged)
+            datalog_write_string(hostapd->datalog, "Tx %s\n", submit->cmd);
+        submit->started_us = trace_begin(TRACE_HOSTAPD, conn - hostapd->conns,
+                                         trace_name(submit->cmd));
+        MMSM_PROBE2(hostapd__request__start, conn - hostapd->conns, submit->cmd);
+        if (hostapd_ctrl_conn_request(hostapd, conn, submit->cmd, NULL, NULL) != 0)
+            hostapd_ctrl_submit_complete(hostapd, conn, MMSM_UNKNOWN_ERROR, NULL);
+    }
+}
+
+
+/**
+ * Receives the reply to the submitted request waiting on a connection with data ready.
+ */
+static void
+hostapd_ctrl_submit_recv(backend_hostapd_ctrl_t *hostapd, hostapd_ctrl_conn_t *conn)
+{
+    mmsm_data_buf_t *out;
+    size_t out_len;
+    int ret = hostapd_ctrl_recv_reply(wpa_ctrl_get_fd(conn->wpa_ctrl), &out, &out_len);
+
+    if (ret < 0)
+    {
+        hostapd_ctrl_conn_fail(hostapd, conn);
+        hostapd_ctrl_submit_complete(hostapd, conn, MMSM_UNKNOWN_ERROR, NULL);
+    }
+    else if (ret == 0)
+        hostapd_ctrl_submit_complete(hostapd, conn, MMSM_SUCCESS,
+                                     hostapd_ctrl_reply(hostapd, out, out_len, NULL,
+                                                        conn->submit->logged));
+}
+
+
+/**
+ * Sends submitted requests as connections become free, spreading them over the pool so that
+ * several are in flight at once, and hands back their replies as they arrive.
+ */
+static void *
+hostapd_ctrl_submit_thread_fn(void *arg)
+{
+    backend_hostapd_ctrl_t *hostapd = (backend_hostapd_ctrl_t *)arg;
+    struct pollfd pfds[HOSTAPD_CTRL_POOL_SIZE + 1];
+    hostapd_ctrl_conn_t *polled[HOSTAPD_CTRL_POOL_SIZE];
+    hostapd_ctrl_submit_t *submit;
+    bool stopping = false;
+    size_t i;
+
+    while (!stopping)
+    {
+        uint64_t now;
+        uint64_t wake;
+        size_t num = 0;
+        int timeout_ms = -1;
+        int remaining_ms;
+
+        hostapd_ctrl_submit_start(hostapd);
+
+        now = hostapd_ctrl_now_us();
+        for (i = 0; i < HOSTAPD_CTRL_POOL_SIZE; i++)
+        {
+            hostapd_ctrl_conn_t *conn = &hostapd->conns[i];
+
+            if (!conn->submit)
+                continue;
+
+            if (conn->submit->deadline_us <= now)
+            {
+                LOG_ERROR("Timed out waiting for reply to %s\n", conn->submit->cmd);
+                hostapd_ctrl_conn_fail(hostapd, conn);
+                hostapd_ctrl_submit_complete(hostapd, conn, MMSM_UNKNOWN_ERROR, NULL);
+                continue;
+            }
+
+            remaining_ms = (conn->submit->deadline_us - now + 999) / 1000;
+            if (timeout_ms < 0 || remaining_ms < timeout_ms)
+                timeout_ms = remaining_ms;
+
+            pfds[num].fd = wpa_ctrl_get_fd(conn->wpa_ctrl);
+            pfds[num].events = POLLIN;
+            polled[num++] = conn;
+        }
+
+        pfds[num].fd = hostapd->submit_wake_fd;
+        pfds[num].events = POLLIN;
+
+        if (poll(pfds, num + 1, timeout_ms) < 0)
+        {
+            if (errno != EINTR)
+                LOG_ERROR("hostapd submit poll failed: %d\n", errno);
+            continue;
+        }
+
+        if (pfds[num].revents && read(hostapd->submit_wake_fd, &wake, sizeof(wake)) < 0)
+            LOG_ERROR("Failed to clear hostapd submit wake up: %d\n", errno);
+
+        for (i = 0; i < num; i++)
+        {
+            if (pfds[i].revents)
+                hostapd_ctrl_submit_recv(hostapd, polled[i]);
+        }
+
+        MMSM_ASSERT(pthread_mutex_lock(&hostapd->conns_mutex) == 0);
+        stopping = hostapd->submit_stopping;
+        MMSM_ASSERT(pthread_mutex_unlock(&hostapd->conns_mutex) == 0);
+    }
+
+    /* Fail whatever is left, in flight or queued */
+    for (i = 0; i < HOSTAPD_CTRL_POOL_SIZE; i++)
+    {
+        if (hostapd->conns[i].submit)
+            hostapd_ctrl_submit_complete(hostapd, &hostapd->conns[i], MMSM_UNKNOWN_ERROR, NULL);
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&hostapd->conns_mutex) == 0);
+    submit = hostapd->submit_head;
+    hostapd->submit_head = NULL;
+    hostapd->submit_tail = &hostapd->submit_head;
+    MMSM_ASSERT(pthread_mutex_unlock(&hostapd->conns_mutex) == 0);
+
+    while (submit)
+    {
+        hostapd_ctrl_submit_t *next = submit->next;
+
+        submit->done(submit->arg, MMSM_UNKNOWN_ERROR, NULL);
+        free(submit);
+        submit = next;
+    }
+
+    return NULL;
 }
 
 
@@ -199,36 +1090,77 @@ backend_hostapd_ctrl_command(mmsm_backend_intf_t *handle,
                              mmsm_data_item_t *command,
                              mmsm_data_item_t **result)
 {
-    int ret;
     backend_hostapd_ctrl_t *hostapd = get_container_from_intf(hostapd, handle);
-    char out_buf[2048];
-    size_t out_buf_len = sizeof(out_buf) - 1;
-    struct wpa_ctrl *wpa_ctrl = NULL;
 
-    datalog_write_string(hostapd->datalog, "Tx %s\n", command->mmsm_value);
+    return hostapd_ctrl_command(hostapd, (char *)command->mmsm_value, NULL, result);
+}
 
-    MMSM_ASSERT(pthread_mutex_lock(&wpa_ctrl_open_mutex) == 0);
-    wpa_ctrl = wpa_ctrl_open(hostapd->control_sock);
-    MMSM_ASSERT(pthread_mutex_unlock(&wpa_ctrl_open_mutex) == 0);
-    if (wpa_ctrl == NULL)
-    {
-        LOG_ERROR("Failed to open control interface\n");
+
+static mmsm_error_code
+backend_hostapd_ctrl_submit(mmsm_backend_intf_t *handle,
+                            mmsm_data_item_t *command,
+                            mmsm_backend_completion_fn_t done,
+                            void *arg)
+{
+    backend_hostapd_ctrl_t *hostapd = get_container_from_intf(hostapd, handle);
+    hostapd_ctrl_submit_t *submit = calloc(1, sizeof(*submit));
+    mmsm_error_code err = MMSM_SUCCESS;
+
+    if (!submit)
         return MMSM_UNKNOWN_ERROR;
+
+    submit->cmd = (const char *)command->mmsm_value;
+    submit->done = done;
+    submit->arg = arg;
+
+    MMSM_ASSERT(pthread_mutex_lock(&hostapd->conns_mutex) == 0);
+    if (!hostapd->submit_started)
+    {
+        hostapd->submit_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (hostapd->submit_wake_fd < 0 ||
+            pthread_create(&hostapd->submit_thread, NULL, hostapd_ctrl_submit_thread_fn,
+                           hostapd) != 0)
+        {
+            LOG_ERROR("Failed to start hostapd submit thread\n");
+            if (hostapd->submit_wake_fd >= 0)
+                close(hostapd->submit_wake_fd);
+            err = MMSM_UNKNOWN_ERROR;
+            goto exit;
+        }
+        hostapd->submit_started = true;
     }
 
-    ret = wpa_ctrl_request(wpa_ctrl, (char *)command->mmsm_value,
-                           strlen((char *)command->mmsm_value),
-                           out_buf, &out_buf_len, NULL);
-    out_buf[out_buf_len] = 0;
+    *hostapd->submit_tail = submit;
+    hostapd->submit_tail = &submit->next;
+    hostapd_ctrl_submit_wake(hostapd);
+    submit = NULL;
+
+exit:
+    MMSM_ASSERT(pthread_mutex_unlock(&hostapd->conns_mutex) == 0);
+    free(submit);
+    return err;
+}
+
+
+mmsm_data_item_t *
+mmsm_backend_hostapd_ctrl_request_keys(mmsm_backend_intf_t *handle,
+                                       const char *command,
+                                       const char *const *keys)
+{
+    backend_hostapd_ctrl_t *hostapd = get_container_from_intf(hostapd, handle);
+    mmsm_data_item_t *result = NULL;
 
-    LOG_VERBOSE("RX:\n%s\n", out_buf);
-    datalog_write_string(hostapd->datalog, "Rx\n%s\n", out_buf);
+    if (hostapd_ctrl_command(hostapd, command, keys, &result) != MMSM_SUCCESS)
+        return NULL;
 
-    *result = parse_output(out_buf);
+    return result;
+}
 
-    wpa_ctrl_close(wpa_ctrl);
 
-    return ret == 0 ? MMSM_SUCCESS : MMSM_UNKNOWN_ERROR;
+mmsm_data_item_t *
+mmsm_backend_hostapd_ctrl_parse(mmsm_data_buf_t *out, size_t len, const char *const *keys)
+{
+    return parse_output(out, len, keys);
 }
 
 
@@ -237,22 +1169,41 @@ backend_hostapd_process_request_args(mmsm_backend_intf_t *intf,
                                      va_list args)
 {
     mmsm_data_item_t *arg = mmsm_data_item_alloc();
-    char *val = strdup(va_arg(args, char *));
+    const char *cmd = va_arg(args, char *);
 
-    mmsm_data_item_set_key_str(arg, val);
-
-    arg->mmsm_value = (uint8_t *)val;
-    arg->mmsm_value_len = strlen((char *)arg->mmsm_value) + 1;
+    /* Short commands, such as "STATUS", are held in the item itself */
+    mmsm_data_item_set_key_str(arg, cmd);
+    mmsm_data_item_set_val_string(arg, cmd);
     return arg;
 }
 
 
+static void
+backend_hostapd_ctrl_get_counters(mmsm_backend_intf_t *handle, mmsm_backend_counters_t *counters)
+{
+    backend_hostapd_ctrl_t *hostapd = get_container_from_intf(hostapd, handle);
+
+    counters->reconnects = __atomic_load_n(&hostapd->counters.reconnects, __ATOMIC_RELAXED);
+    counters->errors = __atomic_load_n(&hostapd->counters.errors, __ATOMIC_RELAXED);
+    counters->events_lost = 0;
+}
+
+
 mmsm_backend_intf_t *
 mmsm_backend_hostapd_ctrl_create(const char *control_sock)
+{
+    return mmsm_backend_hostapd_ctrl_create_instance(control_sock, NULL);
+}
+
+
+mmsm_backend_intf_t *
+mmsm_backend_hostapd_ctrl_create_instance(const char *control_sock, const char *instance)
 {
     backend_hostapd_ctrl_t *module;
 
-    LOG_INFO("Instantiating hostapd control backend\n");
+    LOG_INFO("Instantiating hostapd control backend on %s\n", control_sock);
+
+    MMSM_ASSERT(pthread_once(&hostapd_known_keys_once, hostapd_intern_known_keys) == 0);
 
     module = calloc(1, sizeof(*module));
     if (!module)
@@ -267,7 +1218,11 @@ mmsm_backend_hostapd_ctrl_create(const char *control_sock)
     strncpy(module->control_sock, control_sock, sizeof(module->control_sock));
     module->control_sock[sizeof(module->control_sock) - 1] = '\0';
     module->intf = intf;
-    module->datalog = datalog_create("hostapd");
+    module->datalog = datalog_create_instance("hostapd", instance);
+    MMSM_ASSERT(pthread_mutex_init(&module->conns_mutex, NULL) == 0);
+    MMSM_ASSERT(pthread_cond_init(&module->conns_cond, NULL) == 0);
+    module->submit_tail = &module->submit_head;
+    module->submit_wake_fd = -1;
 
     return &module->intf;
 }
@@ -277,11 +1232,23 @@ void
 mmsm_backend_hostapd_ctrl_destroy(mmsm_backend_intf_t *handle)
 {
     backend_hostapd_ctrl_t *hostapd;
+    size_t i;
 
     if (!handle)
         return;
 
     hostapd = get_container_from_intf(hostapd, handle);
+
+    if (hostapd->submit_started)
+    {
+        MMSM_ASSERT(pthread_mutex_lock(&hostapd->conns_mutex) == 0);
+        hostapd->submit_stopping = true;
+        hostapd_ctrl_submit_wake(hostapd);
+        MMSM_ASSERT(pthread_mutex_unlock(&hostapd->conns_mutex) == 0);
+        MMSM_ASSERT(pthread_join(hostapd->submit_thread, NULL) == 0);
+        close(hostapd->submit_wake_fd);
+    }
+
     datalog_close(hostapd->datalog);
     hostapd->datalog = NULL;
     if (hostapd->monitor_wpa_ctrl)
@@ -289,5 +1256,9 @@ mmsm_backend_hostapd_ctrl_destroy(mmsm_backend_intf_t *handle)
         wpa_ctrl_detach(hostapd->monitor_wpa_ctrl);
         wpa_ctrl_close(hostapd->monitor_wpa_ctrl);
     }
+    for (i = 0; i < HOSTAPD_CTRL_POOL_SIZE; i++)
+        hostapd_ctrl_conn_close(&hostapd->conns[i]);
+    MMSM_ASSERT(pthread_cond_destroy(&hostapd->conns_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&hostapd->conns_mutex) == 0);
     free(hostapd);
 }
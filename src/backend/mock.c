@@ -0,0 +1,534 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "backend.h"
+#include "utils.h"
+#include "helpers.h"
+#include "logging.h"
+#include "mmsm_data.h"
+
+
+#define MOCK_DEFAULT_EVENT "<3>MOCK-EVENT"
+
+/** How long req_async waits for a notification before returning, so the engine can stop */
+#define MOCK_MONITOR_TIMEOUT_MS (1000)
+
+/** Shortest time between raising notifications, which are raised in bursts at higher rates */
+#define MOCK_MIN_PERIOD_NS (1000000ull)
+
+
+/**
+ * A canned response
+ */
+typedef struct mock_response_t
+{
+    char *command;
+    char *text;
+    size_t len;
+    struct mock_response_t *next;
+} mock_response_t;
+
+
+typedef struct backend_mock_t
+{
+    mmsm_backend_intf_t intf;
+
+    mmsm_backend_mock_config_t config;
+
+    /** Copy of the notification raised */
+    char *event;
+
+    /** Answers commands without a canned response */
+    mock_response_t generated;
+
+    /** Protects responses */
+    pthread_mutex_t mutex;
+    mock_response_t *responses;
+
+    /**
+     * Counts the notifications raised and not yet received. A semaphore, so each read receives
+     * one, and it stays readable for the engine while any are left.
+     */
+    int event_fd;
+
+    /** Raises notifications at the configured rate */
+    pthread_t generator;
+    bool has_generator;
+    pthread_mutex_t generator_mutex;
+    pthread_cond_t generator_cond;
+    bool generator_stopping;
+
+    uint64_t requests;
+    uint64_t events_raised;
+    uint64_t events_received;
+} backend_mock_t;
+
+
+static mmsm_error_code
+backend_mock_monitor(mmsm_backend_intf_t *intf, mmsm_data_item_t **result);
+
+static int
+backend_mock_monitor_get_fd(mmsm_backend_intf_t *intf);
+
+static mmsm_error_code
+backend_mock_monitor_recv(mmsm_backend_intf_t *intf, mmsm_data_item_t **result);
+
+static bool
+backend_mock_monitor_pending(mmsm_backend_intf_t *intf);
+
+static mmsm_error_code
+backend_mock_command(mmsm_backend_intf_t *intf, mmsm_data_item_t *command,
+                     mmsm_data_item_t **result);
+
+static mmsm_data_item_t *
+backend_mock_process_request_args(mmsm_backend_intf_t *intf, va_list args);
+
+
+static const mmsm_backend_intf_t mock_intf = {
+    .req_blocking = backend_mock_command,
+    .req_async = backend_mock_monitor,
+    .monitor_get_fd = backend_mock_monitor_get_fd,
+    .monitor_recv = backend_mock_monitor_recv,
+    .monitor_pending = backend_mock_monitor_pending,
+    .process_request_args = backend_mock_process_request_args,
+};
+
+
+/**
+ * Copies text into a buffer of its own, as if received
+ */
+static mmsm_data_buf_t *
+mock_receive(const char *text, size_t len)
+{
+    mmsm_data_buf_t *buf = mmsm_data_buf_alloc(len + 1);
+
+    if (buf)
+    {
+        memcpy(mmsm_data_buf_data(buf), text, len);
+        ((char *)mmsm_data_buf_data(buf))[len] = '\0';
+    }
+
+    return buf;
+}
+
+
+/**
+ * Parses what was received as the hostapd backend does, and releases the buffer
+ */
+static mmsm_data_item_t *
+mock_parse(mmsm_data_buf_t *buf, size_t len)
+{
+    mmsm_data_item_t *result;
+
+    if (!buf)
+        return NULL;
+
+    result = mmsm_backend_hostapd_ctrl_parse(buf, len, NULL);
+    mmsm_data_buf_put(buf);
+
+    return result;
+}
+
+
+static void
+mock_sleep_us(uint64_t us)
+{
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+
+static void
+mock_raise(backend_mock_t *mock, uint64_t count)
+{
+    if (!count)
+        return;
+
+    if (write(mock->event_fd, &count, sizeof(count)) != sizeof(count))
+    {
+        LOG_WARN("Failed to raise %llu mock notifications\n", (unsigned long long)count);
+        return;
+    }
+    __atomic_fetch_add(&mock->events_raised, count, __ATOMIC_RELAXED);
+}
+
+
+static uint64_t
+mock_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+
+/**
+ * Raises the notifications due at the configured rate, as of each period
+ */
+static void *
+mock_generator_thread_fn(void *arg)
+{
+    backend_mock_t *mock = arg;
+    uint64_t rate = mock->config.event_rate;
+    uint64_t period_ns = MAX(1000000000ull / rate, MOCK_MIN_PERIOD_NS);
+    uint64_t start_ns = mock_now_ns();
+    uint64_t raised = 0;
+    uint64_t next_ns = start_ns;
+
+    MMSM_ASSERT(pthread_mutex_lock(&mock->generator_mutex) == 0);
+    while (!mock->generator_stopping)
+    {
+        struct timespec deadline;
+        uint64_t now_ns = mock_now_ns();
+        uint64_t due;
+
+        if (now_ns < next_ns)
+        {
+            deadline.tv_sec = next_ns / 1000000000ull;
+            deadline.tv_nsec = next_ns % 1000000000ull;
+            pthread_cond_timedwait(&mock->generator_cond, &mock->generator_mutex, &deadline);
+            continue;
+        }
+
+        /* Catch up on any periods overslept, so the rate is kept on average */
+        due = (now_ns - start_ns) * rate / 1000000000ull - raised;
+        MMSM_ASSERT(pthread_mutex_unlock(&mock->generator_mutex) == 0);
+        mock_raise(mock, due);
+        raised += due;
+        MMSM_ASSERT(pthread_mutex_lock(&mock->generator_mutex) == 0);
+
+        next_ns += period_ns;
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&mock->generator_mutex) == 0);
+
+    return NULL;
+}
+
+
+static int
+backend_mock_monitor_get_fd(mmsm_backend_intf_t *handle)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+
+    return mock->event_fd;
+}
+
+
+static mmsm_error_code
+backend_mock_monitor_recv(mmsm_backend_intf_t *handle, mmsm_data_item_t **result)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+    uint64_t seq;
+    uint64_t one;
+    char text[160];
+    int len;
+
+    if (read(mock->event_fd, &one, sizeof(one)) != sizeof(one))
+        return errno == EAGAIN ? MMSM_SUCCESS : MMSM_UNKNOWN_ERROR;
+
+    seq = __atomic_fetch_add(&mock->events_received, 1, __ATOMIC_RELAXED);
+    if (mock->config.event_stations)
+    {
+        uint32_t station = seq % mock->config.event_stations + 1;
+
+        len = snprintf(text, sizeof(text), "%s 02:00:00:%02x:%02x:%02x", mock->event,
+                       (station >> 16) & 0xff, (station >> 8) & 0xff, station & 0xff);
+    }
+    else
+    {
+        len = snprintf(text, sizeof(text), "%s", mock->event);
+    }
+
+    len = MIN((size_t)len, sizeof(text) - 1);
+    *result = mock_parse(mock_receive(text, len), len);
+
+    return MMSM_SUCCESS;
+}
+
+
+static bool
+backend_mock_monitor_pending(mmsm_backend_intf_t *handle)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+    struct pollfd pfd = { .fd = mock->event_fd, .events = POLLIN };
+
+    return poll(&pfd, 1, 0) > 0;
+}
+
+
+static mmsm_error_code
+backend_mock_monitor(mmsm_backend_intf_t *handle, mmsm_data_item_t **result)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+    struct pollfd pfd = { .fd = mock->event_fd, .events = POLLIN };
+    int res = poll(&pfd, 1, MOCK_MONITOR_TIMEOUT_MS);
+
+    if (res < 0)
+        return errno == EINTR ? MMSM_SUCCESS : MMSM_UNKNOWN_ERROR;
+    if (res == 0)
+        return MMSM_SUCCESS;
+
+    return backend_mock_monitor_recv(handle, result);
+}
+
+
+static mmsm_error_code
+backend_mock_command(mmsm_backend_intf_t *handle, mmsm_data_item_t *command,
+                     mmsm_data_item_t **result)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+    static __thread unsigned int seed;
+    const char *cmd = (const char *)command->mmsm_value;
+    mock_response_t *response;
+    mmsm_data_buf_t *buf;
+    size_t len;
+    uint64_t latency_us = mock->config.latency_us;
+
+    if (mock->config.latency_jitter_us)
+    {
+        if (!seed)
+            seed = (unsigned int)(uintptr_t)&seed ^ (unsigned int)mock_now_ns();
+        latency_us += rand_r(&seed) % (mock->config.latency_jitter_us + 1);
+    }
+    if (latency_us)
+        mock_sleep_us(latency_us);
+
+    MMSM_ASSERT(pthread_mutex_lock(&mock->mutex) == 0);
+    for (response = mock->responses; response; response = response->next)
+    {
+        if (strcmp(response->command, cmd) == 0)
+            break;
+    }
+    if (!response)
+        response = &mock->generated;
+    buf = mock_receive(response->text, response->len);
+    len = response->len;
+    MMSM_ASSERT(pthread_mutex_unlock(&mock->mutex) == 0);
+
+    *result = mock_parse(buf, len);
+
+    __atomic_fetch_add(&mock->requests, 1, __ATOMIC_RELAXED);
+
+    return MMSM_SUCCESS;
+}
+
+
+static mmsm_data_item_t *
+backend_mock_process_request_args(mmsm_backend_intf_t *intf, va_list args)
+{
+    mmsm_data_item_t *arg = mmsm_data_item_alloc();
+    const char *cmd = va_arg(args, char *);
+
+    UNUSED(intf);
+
+    if (!arg)
+        return NULL;
+
+    mmsm_data_item_set_key_str(arg, cmd);
+    mmsm_data_item_set_val_string(arg, cmd);
+    if (!arg->mmsm_value)
+    {
+        mmsm_data_item_free(arg);
+        return NULL;
+    }
+    return arg;
+}
+
+
+/**
+ * Builds the response to commands without a canned one
+ */
+static int
+mock_generate_response(backend_mock_t *mock, uint32_t items)
+{
+    size_t size = 0;
+    size_t len = 0;
+
+    for (uint32_t i = 0; i < items; i++)
+        size += snprintf(NULL, 0, "key%u=%u\n", i, i);
+
+    mock->generated.text = malloc(size + 1);
+    if (!mock->generated.text)
+        return -ENOMEM;
+
+    for (uint32_t i = 0; i < items; i++)
+        len += snprintf(mock->generated.text + len, size + 1 - len, "key%u=%u\n", i, i);
+    mock->generated.len = len;
+
+    return 0;
+}
+
+
+mmsm_backend_intf_t *
+mmsm_backend_mock_create(const mmsm_backend_mock_config_t *config)
+{
+    backend_mock_t *mock;
+    pthread_condattr_t attr;
+
+    LOG_INFO("Instantiating mock backend\n");
+
+    mock = calloc(1, sizeof(*mock));
+    if (!mock)
+        return NULL;
+
+    memcpy(&mock->intf, &mock_intf, sizeof(mock->intf));
+    if (config)
+        mock->config = *config;
+    mock->event = strdup(mock->config.event ? mock->config.event : MOCK_DEFAULT_EVENT);
+    mock->config.event = NULL;
+    mock->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+
+    if (!mock->event || mock->event_fd < 0 ||
+        mock_generate_response(mock, MAX(mock->config.response_items, 1)) != 0)
+    {
+        LOG_ERROR("Failed to create mock backend\n");
+        if (mock->event_fd >= 0)
+            close(mock->event_fd);
+        free(mock->generated.text);
+        free(mock->event);
+        free(mock);
+        return NULL;
+    }
+
+    MMSM_ASSERT(pthread_mutex_init(&mock->mutex, NULL) == 0);
+    MMSM_ASSERT(pthread_mutex_init(&mock->generator_mutex, NULL) == 0);
+
+    /* Time out on the monotonic clock, to keep the rate whatever the wall clock does */
+    MMSM_ASSERT(pthread_condattr_init(&attr) == 0);
+    MMSM_ASSERT(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+    MMSM_ASSERT(pthread_cond_init(&mock->generator_cond, &attr) == 0);
+    MMSM_ASSERT(pthread_condattr_destroy(&attr) == 0);
+
+    if (mock->config.event_rate)
+    {
+        MMSM_ASSERT(pthread_create(&mock->generator, NULL, mock_generator_thread_fn, mock) == 0);
+        mock->has_generator = true;
+    }
+
+    return &mock->intf;
+}
+
+
+mmsm_error_code
+mmsm_backend_mock_set_response(mmsm_backend_intf_t *handle,
+                               const char *command,
+                               const char *response)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+    mock_response_t *entry;
+    char *text = strdup(response);
+
+    if (!text)
+        return MMSM_UNKNOWN_ERROR;
+
+    MMSM_ASSERT(pthread_mutex_lock(&mock->mutex) == 0);
+    for (entry = mock->responses; entry; entry = entry->next)
+    {
+        if (strcmp(entry->command, command) == 0)
+            break;
+    }
+
+    if (!entry)
+    {
+        entry = calloc(1, sizeof(*entry));
+        if (entry)
+            entry->command = strdup(command);
+        if (!entry || !entry->command)
+        {
+            MMSM_ASSERT(pthread_mutex_unlock(&mock->mutex) == 0);
+            free(entry);
+            free(text);
+            return MMSM_UNKNOWN_ERROR;
+        }
+        entry->next = mock->responses;
+        mock->responses = entry;
+    }
+
+    free(entry->text);
+    entry->text = text;
+    entry->len = strlen(text);
+    MMSM_ASSERT(pthread_mutex_unlock(&mock->mutex) == 0);
+
+    return MMSM_SUCCESS;
+}
+
+
+void
+mmsm_backend_mock_inject(mmsm_backend_intf_t *handle, uint32_t count)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+
+    mock_raise(mock, count);
+}
+
+
+void
+mmsm_backend_mock_get_counters(mmsm_backend_intf_t *handle,
+                               mmsm_backend_mock_counters_t *counters)
+{
+    backend_mock_t *mock = get_container_from_intf(mock, handle);
+
+    counters->requests = __atomic_load_n(&mock->requests, __ATOMIC_RELAXED);
+    counters->events_raised = __atomic_load_n(&mock->events_raised, __ATOMIC_RELAXED);
+    counters->events_received = __atomic_load_n(&mock->events_received, __ATOMIC_RELAXED);
+}
+
+
+void
+mmsm_backend_mock_destroy(mmsm_backend_intf_t *handle)
+{
+    backend_mock_t *mock;
+    mock_response_t *entry;
+
+    if (!handle)
+        return;
+
+    mock = get_container_from_intf(mock, handle);
+
+    if (mock->has_generator)
+    {
+        MMSM_ASSERT(pthread_mutex_lock(&mock->generator_mutex) == 0);
+        mock->generator_stopping = true;
+        MMSM_ASSERT(pthread_cond_signal(&mock->generator_cond) == 0);
+        MMSM_ASSERT(pthread_mutex_unlock(&mock->generator_mutex) == 0);
+        MMSM_ASSERT(pthread_join(mock->generator, NULL) == 0);
+    }
+
+    while ((entry = mock->responses) != NULL)
+    {
+        mock->responses = entry->next;
+        free(entry->command);
+        free(entry->text);
+        free(entry);
+    }
+
+    close(mock->event_fd);
+    MMSM_ASSERT(pthread_cond_destroy(&mock->generator_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&mock->generator_mutex) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&mock->mutex) == 0);
+    free(mock->generated.text);
+    free(mock->event);
+    free(mock);
+}
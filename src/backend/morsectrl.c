@@ -3,9 +3,14 @@
  * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
  *
  */
+#include <errno.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
 #include <netlink/genl/genl.h>
 #include <linux/nl80211.h>
+#include <linux/rtnetlink.h>
 #include <net/if.h>
 #include <endian.h>
 
@@ -16,6 +21,8 @@
 #include "logging.h"
 #include "helpers.h"
 #include "datalog.h"
+#include "trace.h"
+#include "probes.h"
 
 #include "backend/morsectrl/command.h"
 #include "backend/morsectrl/vendor.h"
@@ -29,14 +36,423 @@ typedef struct backend_morsectrl_t
 
     mmsm_backend_intf_t *nl80211_intf;
 
+    /** Whether nl80211_intf was created by this backend, rather than shared with others */
+    bool owns_nl80211;
+
     char *ifname;
 
+    /** Index of the interface, or 0 if it needs resolving again */
+    uint32_t ifindex;
+
+    /** Socket receiving link notifications, which keep ifindex up to date, or NULL */
+    struct nl_sock *link_sock;
+
+    /** Protects ifindex and link_sock */
+    pthread_mutex_t ifindex_mutex;
+
+    /** Protects the asynchronous requests and the fields below */
+    pthread_mutex_t async_mutex;
+
+    /** Signalled when a request's callback returns, and to wake the timeout thread */
+    pthread_cond_t async_cond;
+
+    /** Asynchronous requests that haven't completed, oldest first */
+    mmsm_morsectrl_async_t *async_head;
+
+    /** Expires requests that wait too long, started on the first request */
+    pthread_t async_thread;
+    bool async_started;
+
+    /** Set to stop the timeout thread */
+    bool async_stopping;
+
+    /** Whether vendor events are being monitored, from the first request that waits for one */
+    bool async_monitoring;
+
+    /**
+     * Number of commands submitted to nl80211 whose completion hasn't returned. Signalled on
+     * async_cond when it drops to 0.
+     */
+    unsigned int submits_in_flight;
+
     struct datalog *datalog;
 } backend_morsectrl_t;
 
+/** Number of commands a blocking request can have before its bookkeeping is allocated */
+#define MORSECTRL_INLINE_CMDS (8)
+
+typedef struct morsectrl_submit_t morsectrl_submit_t;
+
+/**
+ * One of the commands of a request sent with req_submit
+ */
+typedef struct morsectrl_submit_cmd_t
+{
+    /** The request the command is part of */
+    morsectrl_submit_t *submit;
+
+    /** The vendor command sent to nl80211 */
+    mmsm_data_item_t *nl80211_cmd;
+
+    /** The nl80211 reply, or NULL */
+    mmsm_data_item_t *resp;
+
+    /** Whether a reply was received */
+    mmsm_error_code err;
+} morsectrl_submit_cmd_t;
+
+/**
+ * A request sent with req_submit. Each of its commands is submitted to nl80211 straight away,
+ * so they are all in flight at once.
+ */
+struct morsectrl_submit_t
+{
+    /** The backend the request was submitted on */
+    backend_morsectrl_t *morsectrl;
+
+    /** Called with the responses of every command, once they have all completed */
+    mmsm_backend_completion_fn_t done;
+
+    /** Passed to done */
+    void *arg;
+
+    /** Number of commands yet to complete, plus one while they are being submitted */
+    size_t remaining;
+
+    /** Number of commands */
+    size_t num_cmds;
+
+    /** The first command's id, and when the request was submitted, for the flight recorder */
+    uint16_t trace_id;
+    uint64_t started_us;
+
+    /** The commands, in the order of the request */
+    morsectrl_submit_cmd_t cmds[];
+};
+
+/**
+ * An asynchronous request. Held by the list of pending requests until it completes or is
+ * cancelled, and by its command until the confirm arrives.
+ */
+struct mmsm_morsectrl_async
+{
+    backend_morsectrl_t *morsectrl;
+
+    /** Called once the request has completed */
+    mmsm_morsectrl_async_fn_t fn;
+
+    /** Passed to fn */
+    void *context;
+
+    /** The vendor event that completes the request, or MMSM_MORSECTRL_NO_EVENT */
+    int event;
+
+    /** Checks the vendor events that could complete the request, or NULL */
+    mmsm_morsectrl_async_match_fn_t match;
+
+    /** When the request was queued to be sent, see @ref morsectrl_now_us */
+    uint64_t sent_us;
+
+    /** When to give up, see @ref morsectrl_now_us, or 0 to wait indefinitely */
+    uint64_t deadline_us;
+
+    /** The command, valid until the confirm arrives */
+    mmsm_data_item_t *command;
+
+    /** Set once the confirm has arrived, or the request has failed */
+    bool confirmed;
+    mmsm_error_code err;
+    mmsm_data_item_t *confirm;
+
+    /** The vendor event received, or NULL */
+    mmsm_data_item_t *event_item;
+
+    /** Set while the request is in the list of pending requests */
+    bool pending;
+
+    /** Set while fn is being called, by completing_thread */
+    bool completing;
+    pthread_t completing_thread;
+
+    /** Number of references, see above */
+    unsigned int refs;
+
+    struct mmsm_morsectrl_async *next;
+};
+
+/**
+ * A reusable command, whose nl80211 vendor command is built once and updated in place
+ */
+struct mmsm_morsectrl_cmd
+{
+    backend_morsectrl_t *morsectrl;
+
+    /** The nl80211 vendor command sent */
+    mmsm_data_item_t *nl80211_cmd;
+
+    /** The vendor command's NL80211_ATTR_IFINDEX, updated if the interface index changes */
+    mmsm_data_item_t *ifindex_attr;
+
+    /** The request carried in the vendor command's NL80211_ATTR_VENDOR_DATA */
+    struct request *request;
+};
+
+/**
+ * @brief Append the response carried by an nl80211 vendor reply to a morsectrl result
+ *
+ * @param resp_item The nl80211 reply
+ * @param result The start of the result, set if it is empty
+ * @param iter The last item of the result, updated to the appended item
+ * @return MMSM_SUCCESS, or MMSM_COMMAND_FAILED if the command failed
+ */
+static mmsm_error_code
+morsectrl_append_response(mmsm_data_item_t *resp_item, mmsm_data_item_t **result,
+                          mmsm_data_item_t **iter)
+{
+    mmsm_key_t vendor_key = { .type = MMSM_KEY_TYPE_U32, .d.u32 = NL80211_ATTR_VENDOR_DATA };
+    mmsm_data_item_t *vendor_item;
+    struct response *resp;
+    int16_t ret;
+
+    vendor_item = mmsm_find_key(resp_item->mmsm_sub_values, &vendor_key);
+    resp = vendor_item ? (struct response *)vendor_item->mmsm_value : NULL;
+
+    if (!resp)
+    {
+        LOG_ERROR("No vendor data in response\n");
+        return MMSM_SUCCESS;
+    }
+
+    if (*iter == NULL)
+    {
+        *iter = mmsm_data_item_alloc();
+        *result = *iter;
+    }
+    else
+    {
+        *iter = mmsm_data_item_alloc_next(*iter);
+    }
+
+    mmsm_data_item_set_key_u32(*iter, le16toh(resp->hdr.message_id));
+
+    ret = le16toh(resp->status);
+
+    if (ret)
+    {
+        LOG_WARN("morsectrl command %u failed %d\n", resp->hdr.message_id, ret);
+        return MMSM_COMMAND_FAILED;
+    }
+
+    /* Point into the received message rather than copying, if it is shared */
+    if (vendor_item->mmsm_value_buf)
+        mmsm_data_item_set_val_ref(*iter, vendor_item->mmsm_value_buf, resp->data,
+                                   le16toh(resp->hdr.len));
+    else
+        mmsm_data_item_set_val_bytes(*iter, resp->data, le16toh(resp->hdr.len));
+
+    return MMSM_SUCCESS;
+}
+
+/**
+ * @brief Apply a link notification to the cached interface index
+ */
+static int
+morsectrl_link_callback(struct nl_msg *msg, void *arg)
+{
+    backend_morsectrl_t *morsectrl = arg;
+    struct nlmsghdr *hdr = nlmsg_hdr(msg);
+    struct ifinfomsg *ifi;
+    struct nlattr *name;
+
+    if (hdr->nlmsg_type != RTM_NEWLINK && hdr->nlmsg_type != RTM_DELLINK)
+        return NL_SKIP;
+
+    if (!nlmsg_valid_hdr(hdr, sizeof(*ifi)))
+        return NL_SKIP;
+
+    ifi = nlmsg_data(hdr);
+    name = nlmsg_find_attr(hdr, sizeof(*ifi), IFLA_IFNAME);
+
+    if (hdr->nlmsg_type == RTM_DELLINK)
+    {
+        if ((uint32_t)ifi->ifi_index == morsectrl->ifindex)
+            morsectrl->ifindex = 0;
+    }
+    else if (name && nla_strcmp(name, morsectrl->ifname) == 0)
+    {
+        morsectrl->ifindex = ifi->ifi_index;
+    }
+    else if (name && (uint32_t)ifi->ifi_index == morsectrl->ifindex)
+    {
+        /* Renamed away from our interface */
+        morsectrl->ifindex = 0;
+    }
+
+    return NL_SKIP;
+}
+
+/**
+ * @brief Open the socket receiving link notifications for the interface index cache
+ *
+ * @return the socket, or NULL if notifications aren't available
+ */
+static struct nl_sock *
+morsectrl_link_sock_open(backend_morsectrl_t *morsectrl)
+{
+    struct nl_sock *sock = nl_socket_alloc();
+
+    if (!sock)
+        return NULL;
+
+    if (nl_connect(sock, NETLINK_ROUTE) < 0)
+    {
+        nl_socket_free(sock);
+        return NULL;
+    }
+
+    if (nl_socket_add_membership(sock, RTNLGRP_LINK) < 0 ||
+        nl_socket_set_nonblocking(sock) < 0)
+    {
+        nl_close(sock);
+        nl_socket_free(sock);
+        return NULL;
+    }
+
+    nl_socket_disable_seq_check(sock);
+    nl_socket_modify_cb(sock, NL_CB_VALID, NL_CB_CUSTOM, morsectrl_link_callback, morsectrl);
+
+    return sock;
+}
+
+/**
+ * @brief Get the index of the interface
+ *
+ * The index is cached, and kept up to date from the link notifications received since the last
+ * call, so it is only resolved by name when the interface has appeared, been renamed or been
+ * removed, or notifications were lost. Without notifications, it is resolved on every call.
+ *
+ * @return the index, or 0 if the interface doesn't exist
+ */
+static uint32_t
+morsectrl_get_ifindex(backend_morsectrl_t *morsectrl)
+{
+    uint32_t ifindex;
+    int ret = 0;
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->ifindex_mutex) == 0);
+    if (morsectrl->link_sock)
+    {
+        struct nl_cb *cb = nl_socket_get_cb(morsectrl->link_sock);
+
+        do
+        {
+            ret = nl_recvmsgs_report(morsectrl->link_sock, cb);
+        } while (ret > 0);
+        nl_cb_put(cb);
+
+        if (ret == -NLE_NOMEM)
+            LOG_WARN("Link notifications lost, resolving %s again\n", morsectrl->ifname);
+    }
+
+    if (!morsectrl->link_sock || ret < 0 || !morsectrl->ifindex)
+        morsectrl->ifindex = if_nametoindex(morsectrl->ifname);
+
+    ifindex = morsectrl->ifindex;
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->ifindex_mutex) == 0);
+
+    return ifindex;
+}
+
+/**
+ * @brief Format an nl80211 command, with arguments as for @ref mmsm_request on nl80211
+ */
+static mmsm_data_item_t *
+morsectrl_nl80211_command(backend_morsectrl_t *morsectrl, ...)
+{
+    mmsm_data_item_t *command;
+    va_list args;
+
+    va_start(args, morsectrl);
+    command = morsectrl->nl80211_intf->process_request_args(morsectrl->nl80211_intf, args);
+    va_end(args);
+
+    return command;
+}
+
+/**
+ * @brief Get the id of the first command of a request, for the flight recorder
+ */
+static uint16_t
+morsectrl_trace_id(mmsm_data_item_t *command)
+{
+    const struct request *request;
+
+    if (!command || command->mmsm_value_len < sizeof(*request))
+        return 0;
+
+    request = (const struct request *)command->mmsm_value;
+    return le16toh(request->hdr.message_id);
+}
+
+/**
+ * @brief Format the nl80211 vendor command carrying a morsectrl command
+ */
+static mmsm_data_item_t *
+morsectrl_vendor_command(backend_morsectrl_t *morsectrl, uint32_t ifnum, mmsm_data_item_t *item)
+{
+    return morsectrl_nl80211_command(morsectrl, NL80211_CMD_VENDOR, 0,
+        NL80211_ATTR_IFINDEX, NLA_U32, ifnum,
+        NL80211_ATTR_VENDOR_ID, NLA_U32, MORSE_OUI,
+        NL80211_ATTR_VENDOR_SUBCMD, NLA_U32, MORSE_VENDOR_CMD_TO_MORSE,
+        NL80211_ATTR_VENDOR_DATA, NLA_BINARY, item->mmsm_value_len, item->mmsm_value, -1);
+}
+
+/**
+ * @brief Exchange nl80211 vendor commands and build the morsectrl result from their replies
+ *
+ * @param morsectrl morsectrl instance
+ * @param nl80211_cmds The vendor commands, in the order of the request
+ * @param num Number of commands
+ * @param resps Space for the reply to each command, which is freed before returning
+ * @param result location to store the data_items containing the result
+ * @return MMSM_SUCCESS on success, otherwise error code
+ */
+static mmsm_error_code
+morsectrl_exchange(backend_morsectrl_t *morsectrl, mmsm_data_item_t *const *nl80211_cmds,
+                   size_t num, mmsm_data_item_t **resps, mmsm_data_item_t **result)
+{
+    mmsm_data_item_t *iter = NULL;
+    mmsm_error_code err = MMSM_SUCCESS;
+    size_t i;
+
+    /* Failures are reported per command below, in the order of the request */
+    mmsm_backend_nl80211_request_many(morsectrl->nl80211_intf, nl80211_cmds, num, resps);
+
+    for (i = 0; i < num; i++)
+    {
+        if (!resps[i])
+        {
+            LOG_ERROR("Failed to execute vendor command\n");
+            err = MMSM_UNKNOWN_ERROR;
+            break;
+        }
+
+        if (morsectrl_append_response(resps[i], result, &iter) != MMSM_SUCCESS)
+            err = MMSM_COMMAND_FAILED;
+    }
+
+    for (i = 0; i < num; i++)
+        mmsm_data_item_free(resps[i]);
+
+    return err;
+}
+
 /**
  * @brief Perform the morsectrl command over netlink
  *
+ * The commands are sent back to back on one socket, and their replies gathered once they have
+ * all been sent.
+ *
  * @param intf morsectrl instance
  * @param command data_item containing the command/s
  * @param result location to store the data_items containing the result
@@ -48,66 +464,324 @@ backend_morsectrl_sync_command(mmsm_backend_intf_t *intf,
                              mmsm_data_item_t **result)
 {
     backend_morsectrl_t *morsectrl = get_container_from_intf(morsectrl, intf);
+    mmsm_data_item_t *inline_cmds[MORSECTRL_INLINE_CMDS] = { NULL };
+    mmsm_data_item_t *inline_resps[MORSECTRL_INLINE_CMDS];
+    mmsm_data_item_t **nl80211_cmds = inline_cmds;
+    mmsm_data_item_t **resps = inline_resps;
     mmsm_data_item_t *item;
-    mmsm_data_item_t *resp_item, *iter = NULL;
-    struct response *resp;
-    int16_t ret;
     mmsm_error_code err = MMSM_SUCCESS;
+    uint64_t started_us;
+    uint32_t latency_us;
+    size_t num = 0;
+    size_t i = 0;
+    uint32_t ifnum;
 
-    uint32_t ifnum = if_nametoindex(morsectrl->ifname);
+    for_each_data_item(item, command)
+        num++;
 
+    if (num > MORSECTRL_INLINE_CMDS)
+    {
+        nl80211_cmds = calloc(num, sizeof(*nl80211_cmds));
+        resps = calloc(num, sizeof(*resps));
+        if (!nl80211_cmds || !resps)
+        {
+            err = MMSM_UNKNOWN_ERROR;
+            goto exit;
+        }
+    }
+
+    ifnum = morsectrl_get_ifindex(morsectrl);
     for_each_data_item(item, command)
     {
-        resp_item = mmsm_request(morsectrl->nl80211_intf, NL80211_CMD_VENDOR, 0,
-            NL80211_ATTR_IFINDEX, NLA_U32, ifnum,
-            NL80211_ATTR_VENDOR_ID, NLA_U32, MORSE_OUI,
-            NL80211_ATTR_VENDOR_SUBCMD, NLA_U32, MORSE_VENDOR_CMD_TO_MORSE,
-            NL80211_ATTR_VENDOR_DATA, NLA_BINARY, item->mmsm_value_len, item->mmsm_value, -1);
+        nl80211_cmds[i] = morsectrl_vendor_command(morsectrl, ifnum, item);
+        if (!nl80211_cmds[i++])
+        {
+            err = MMSM_UNKNOWN_ERROR;
+            goto exit;
+        }
+    }
+
+    started_us = trace_begin(TRACE_MORSECTRL, morsectrl_trace_id(command), num);
+    MMSM_PROBE2(morsectrl__request__start, morsectrl_trace_id(command), num);
+    err = morsectrl_exchange(morsectrl, nl80211_cmds, num, resps, result);
+    latency_us = trace_end(TRACE_MORSECTRL, morsectrl_trace_id(command), err, started_us);
+    MMSM_PROBE3(morsectrl__request__done, morsectrl_trace_id(command), err, latency_us);
+
+exit:
+    for (i = 0; nl80211_cmds && i < num; i++)
+        mmsm_data_item_free(nl80211_cmds[i]);
+    if (nl80211_cmds != inline_cmds)
+        free(nl80211_cmds);
+    if (resps != inline_resps)
+        free(resps);
+
+    return err;
+}
+
+mmsm_morsectrl_cmd_t *
+mmsm_backend_morsectrl_cmd_create(mmsm_backend_intf_t *handle, uint16_t command_id, uint16_t len)
+{
+    backend_morsectrl_t *morsectrl = get_container_from_intf(morsectrl, handle);
+    mmsm_key_t ifindex_key = { .type = MMSM_KEY_TYPE_U32, .d.u32 = NL80211_ATTR_IFINDEX };
+    mmsm_key_t vendor_key = { .type = MMSM_KEY_TYPE_U32, .d.u32 = NL80211_ATTR_VENDOR_DATA };
+    mmsm_morsectrl_cmd_t *cmd;
+    mmsm_data_item_t *vendor_item;
+    struct request *request;
+
+    cmd = calloc(1, sizeof(*cmd));
+    request = calloc(1, sizeof(*request) + len);
+    if (!cmd || !request)
+    {
+        free(cmd);
+        free(request);
+        return NULL;
+    }
+
+    request->hdr.message_id = htole16(command_id);
+    request->hdr.len = htole16(len);
+    request->hdr.flags = htole16(MORSE_CMD_TYPE_REQ);
+
+    cmd->morsectrl = morsectrl;
+    cmd->nl80211_cmd = morsectrl_nl80211_command(morsectrl, NL80211_CMD_VENDOR, 0,
+        NL80211_ATTR_IFINDEX, NLA_U32, morsectrl_get_ifindex(morsectrl),
+        NL80211_ATTR_VENDOR_ID, NLA_U32, MORSE_OUI,
+        NL80211_ATTR_VENDOR_SUBCMD, NLA_U32, MORSE_VENDOR_CMD_TO_MORSE,
+        NL80211_ATTR_VENDOR_DATA, NLA_BINARY, sizeof(*request) + len, request, -1);
+    free(request);
+    if (!cmd->nl80211_cmd)
+    {
+        free(cmd);
+        return NULL;
+    }
+
+    /* Keep the attributes, so sending only needs to update them in place */
+    cmd->ifindex_attr = mmsm_find_key(cmd->nl80211_cmd->mmsm_next, &ifindex_key);
+    vendor_item = mmsm_find_key(cmd->nl80211_cmd->mmsm_next, &vendor_key);
+    MMSM_ASSERT(cmd->ifindex_attr && vendor_item);
+    cmd->request = (struct request *)vendor_item->mmsm_value;
+
+    return cmd;
+}
+
+void *
+mmsm_backend_morsectrl_cmd_payload(mmsm_morsectrl_cmd_t *cmd)
+{
+    return cmd->request->data;
+}
 
-        if (!resp_item)
+mmsm_error_code
+mmsm_backend_morsectrl_cmd_send(mmsm_morsectrl_cmd_t *const *cmds, size_t count,
+                                mmsm_data_item_t **result)
+{
+    mmsm_data_item_t *inline_cmds[MORSECTRL_INLINE_CMDS];
+    mmsm_data_item_t *inline_resps[MORSECTRL_INLINE_CMDS];
+    mmsm_data_item_t **nl80211_cmds = inline_cmds;
+    mmsm_data_item_t **resps = inline_resps;
+    backend_morsectrl_t *morsectrl;
+    mmsm_error_code err;
+    uint32_t ifnum;
+    size_t i;
+
+    *result = NULL;
+    if (!count)
+        return MMSM_SUCCESS;
+
+    morsectrl = cmds[0]->morsectrl;
+    if (count > MORSECTRL_INLINE_CMDS)
+    {
+        nl80211_cmds = calloc(count, sizeof(*nl80211_cmds));
+        resps = calloc(count, sizeof(*resps));
+        if (!nl80211_cmds || !resps)
         {
-            LOG_ERROR("Failed to execute vendor command\n");
+            free(nl80211_cmds);
+            free(resps);
             return MMSM_UNKNOWN_ERROR;
         }
+    }
+
+    ifnum = morsectrl_get_ifindex(morsectrl);
+    for (i = 0; i < count; i++)
+    {
+        memcpy(cmds[i]->ifindex_attr->mmsm_value, &ifnum, sizeof(ifnum));
+        nl80211_cmds[i] = cmds[i]->nl80211_cmd;
+    }
+
+    err = morsectrl_exchange(morsectrl, nl80211_cmds, count, resps, result);
+
+    if (nl80211_cmds != inline_cmds)
+        free(nl80211_cmds);
+    if (resps != inline_resps)
+        free(resps);
+
+    return err;
+}
+
+void
+mmsm_backend_morsectrl_cmd_destroy(mmsm_morsectrl_cmd_t *cmd)
+{
+    if (!cmd)
+        return;
+
+    mmsm_data_item_free(cmd->nl80211_cmd);
+    free(cmd);
+}
 
-        resp = (struct response *)mmsm_find_value_by_intkey(
-                    resp_item->mmsm_sub_values, NL80211_ATTR_VENDOR_DATA);
+/**
+ * @brief Complete a command of a submitted request, and the request if it was the last
+ */
+static void
+morsectrl_submit_put(morsectrl_submit_t *submit)
+{
+    mmsm_data_item_t *result = NULL;
+    mmsm_data_item_t *iter = NULL;
+    mmsm_error_code err = MMSM_SUCCESS;
+    uint32_t latency_us;
+    size_t i;
+
+    if (__atomic_sub_fetch(&submit->remaining, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    for (i = 0; i < submit->num_cmds; i++)
+    {
+        morsectrl_submit_cmd_t *cmd = &submit->cmds[i];
 
-        if (resp)
+        if (cmd->err != MMSM_SUCCESS || !cmd->resp)
         {
-            if (iter == NULL)
-            {
-                iter = mmsm_data_item_alloc();
-                *result = iter;
-            }
-            else
-            {
-                iter = mmsm_data_item_alloc_next(iter);
-            }
+            /* As for a blocking request, a command that went unanswered fails the request */
+            LOG_ERROR("Failed to execute vendor command\n");
+            err = MMSM_UNKNOWN_ERROR;
+        }
+        else if (err == MMSM_SUCCESS &&
+                 morsectrl_append_response(cmd->resp, &result, &iter) != MMSM_SUCCESS)
+        {
+            err = MMSM_COMMAND_FAILED;
+        }
 
-            mmsm_data_item_set_key_u32(iter, le16toh(resp->hdr.message_id));
+        mmsm_data_item_free(cmd->resp);
+        mmsm_data_item_free(cmd->nl80211_cmd);
+    }
 
-            ret = le16toh(resp->status);
+    latency_us = trace_end(TRACE_MORSECTRL, submit->trace_id, err, submit->started_us);
+    MMSM_PROBE3(morsectrl__request__done, submit->trace_id, err, latency_us);
+    submit->done(submit->arg, err, result);
+    free(submit);
+}
 
-            if (!ret)
-            {
-                mmsm_data_item_set_val_bytes(iter, resp->data, le16toh(resp->hdr.len));
-            }
-            else
-            {
-                LOG_WARN("morsectrl command %u failed %d\n", resp->hdr.message_id, ret);
-                err = MMSM_COMMAND_FAILED;
-            }
+/**
+ * @brief Count a command submitted to nl80211 as no longer in flight, once nothing more of its
+ * completion touches the backend
+ */
+static void
+morsectrl_submit_end(backend_morsectrl_t *morsectrl)
+{
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    if (--morsectrl->submits_in_flight == 0)
+        MMSM_ASSERT(pthread_cond_broadcast(&morsectrl->async_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+}
+
+static void
+morsectrl_submit_cmd_done(void *arg, mmsm_error_code err, mmsm_data_item_t *result)
+{
+    morsectrl_submit_cmd_t *cmd = arg;
+    backend_morsectrl_t *morsectrl = cmd->submit->morsectrl;
+
+    cmd->err = err;
+    cmd->resp = result;
+    morsectrl_submit_put(cmd->submit);
+    morsectrl_submit_end(morsectrl);
+}
+
+/**
+ * @brief Submit the commands of a morsectrl request to nl80211 without waiting for their replies
+ *
+ * @param intf morsectrl instance
+ * @param command data_item containing the command/s
+ * @param done called with the responses, once every command has completed
+ * @param arg passed to done
+ * @return MMSM_SUCCESS if any command was submitted, otherwise error code
+ */
+static mmsm_error_code
+backend_morsectrl_submit(mmsm_backend_intf_t *intf,
+                         mmsm_data_item_t *command,
+                         mmsm_backend_completion_fn_t done,
+                         void *arg)
+{
+    backend_morsectrl_t *morsectrl = get_container_from_intf(morsectrl, intf);
+    mmsm_backend_intf_t *nl80211_intf = morsectrl->nl80211_intf;
+    morsectrl_submit_t *submit;
+    mmsm_data_item_t *item;
+    size_t submitted = 0;
+    size_t num = 0;
+    size_t i = 0;
+    uint32_t ifnum;
+
+    if (!nl80211_intf->req_submit)
+        return MMSM_UNKNOWN_ERROR;
+
+    for_each_data_item(item, command)
+        num++;
+
+    submit = calloc(1, sizeof(*submit) + num * sizeof(submit->cmds[0]));
+    if (!submit)
+        return MMSM_UNKNOWN_ERROR;
+
+    submit->morsectrl = morsectrl;
+    submit->done = done;
+    submit->arg = arg;
+    submit->num_cmds = num;
+    /* Hold the request open until every command has been submitted */
+    submit->remaining = num + 1;
+    submit->trace_id = morsectrl_trace_id(command);
+    submit->started_us = trace_begin(TRACE_MORSECTRL, submit->trace_id, num);
+    MMSM_PROBE2(morsectrl__request__start, submit->trace_id, num);
+
+    ifnum = morsectrl_get_ifindex(morsectrl);
+    for_each_data_item(item, command)
+    {
+        morsectrl_submit_cmd_t *cmd = &submit->cmds[i++];
+
+        cmd->submit = submit;
+        cmd->err = MMSM_UNKNOWN_ERROR;
+        cmd->nl80211_cmd = morsectrl_vendor_command(morsectrl, ifnum, item);
+        if (!cmd->nl80211_cmd)
+        {
+            __atomic_sub_fetch(&submit->remaining, 1, __ATOMIC_ACQ_REL);
+            continue;
+        }
+
+        /* Counted before submitting, as the completion may run straight away */
+        MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+        morsectrl->submits_in_flight++;
+        MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
+        if (nl80211_intf->req_submit(nl80211_intf, cmd->nl80211_cmd, morsectrl_submit_cmd_done,
+                                     cmd) == MMSM_SUCCESS)
+        {
+            submitted++;
         }
         else
         {
-            LOG_ERROR("No vendor data in response\n");
+            __atomic_sub_fetch(&submit->remaining, 1, __ATOMIC_ACQ_REL);
+            morsectrl_submit_end(morsectrl);
         }
+    }
 
-        mmsm_data_item_free(resp_item);
+    if (!submitted)
+    {
+        /* Nothing is in flight, so done must not be called */
+        uint32_t latency_us = trace_end(TRACE_MORSECTRL, submit->trace_id, MMSM_UNKNOWN_ERROR,
+                                        submit->started_us);
+
+        MMSM_PROBE3(morsectrl__request__done, submit->trace_id, MMSM_UNKNOWN_ERROR, latency_us);
+        for (i = 0; i < num; i++)
+            mmsm_data_item_free(submit->cmds[i].nl80211_cmd);
+        free(submit);
+        return MMSM_UNKNOWN_ERROR;
     }
 
-    return err;
+    morsectrl_submit_put(submit);
+    return MMSM_SUCCESS;
 }
 
 
@@ -176,20 +850,401 @@ backend_morsectrl_process_request_args(mmsm_backend_intf_t *intf,
     return first;
 }
 
+static uint64_t
+morsectrl_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Format a morsectrl command, with arguments as for @ref mmsm_request on morsectrl
+ */
+static mmsm_data_item_t *
+morsectrl_command(mmsm_backend_intf_t *intf, ...)
+{
+    mmsm_data_item_t *command;
+    va_list args;
+
+    va_start(args, intf);
+    command = backend_morsectrl_process_request_args(intf, args);
+    va_end(args);
+
+    return command;
+}
+
+/**
+ * @brief Drop a reference to an asynchronous request. Called with async_mutex held.
+ */
+static void
+morsectrl_async_put(mmsm_morsectrl_async_t *req)
+{
+    if (--req->refs)
+        return;
+
+    mmsm_data_item_free(req->command);
+    mmsm_data_item_free(req->confirm);
+    mmsm_data_item_release(req->event_item);
+    free(req);
+}
+
+/**
+ * @brief Remove a request from the list of pending requests. Called with async_mutex held.
+ */
+static void
+morsectrl_async_unlink(backend_morsectrl_t *morsectrl, mmsm_morsectrl_async_t *req)
+{
+    mmsm_morsectrl_async_t **iter;
+
+    for (iter = &morsectrl->async_head; *iter; iter = &(*iter)->next)
+    {
+        if (*iter == req)
+        {
+            *iter = req->next;
+            break;
+        }
+    }
+
+    req->pending = false;
+    morsectrl_async_put(req);
+}
+
+static bool
+morsectrl_async_is_pending(backend_morsectrl_t *morsectrl, mmsm_morsectrl_async_t *req)
+{
+    mmsm_morsectrl_async_t *iter;
+
+    for (iter = morsectrl->async_head; iter; iter = iter->next)
+    {
+        if (iter == req)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Call a pending request's callback and remove it from the list
+ *
+ * Called with async_mutex held, which is released while the callback runs.
+ */
+static void
+morsectrl_async_complete(backend_morsectrl_t *morsectrl, mmsm_morsectrl_async_t *req)
+{
+    req->completing = true;
+    req->completing_thread = pthread_self();
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
+    req->fn(req->context, req->err, req->confirm, req->event_item);
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    req->completing = false;
+    morsectrl_async_unlink(morsectrl, req);
+    MMSM_ASSERT(pthread_cond_broadcast(&morsectrl->async_cond) == 0);
+}
+
+/**
+ * @brief Complete a pending request if it has everything it waits for. Called with async_mutex
+ * held.
+ */
+static void
+morsectrl_async_check(backend_morsectrl_t *morsectrl, mmsm_morsectrl_async_t *req)
+{
+    if (!req->pending || req->completing || !req->confirmed)
+        return;
+
+    if (req->err != MMSM_SUCCESS || req->event == MMSM_MORSECTRL_NO_EVENT || req->event_item)
+        morsectrl_async_complete(morsectrl, req);
+}
+
+static void
+morsectrl_async_confirm_done(void *arg, mmsm_error_code err, mmsm_data_item_t *result)
+{
+    mmsm_morsectrl_async_t *req = arg;
+    backend_morsectrl_t *morsectrl = req->morsectrl;
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    mmsm_data_item_free(req->command);
+    req->command = NULL;
+
+    if (req->pending && !req->confirmed)
+    {
+        req->confirmed = true;
+        req->err = err;
+        req->confirm = result;
+        result = NULL;
+        morsectrl_async_check(morsectrl, req);
+    }
+
+    /* The request timed out or was cancelled first */
+    mmsm_data_item_free(result);
+    morsectrl_async_put(req);
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+}
+
+/**
+ * @brief Pattern monitor callback for Morse vendor events, which completes the oldest request
+ * waiting for the event
+ */
+static void
+morsectrl_async_event(void *arg, mmsm_backend_intf_t *intf, mmsm_data_item_t *result)
+{
+    backend_morsectrl_t *morsectrl = arg;
+    mmsm_morsectrl_async_t *req;
+    uint32_t subcmd;
+    uint32_t ifindex;
+    uint8_t *data;
+
+    data = mmsm_find_by_nested_intkeys(result, NL80211_CMD_VENDOR,
+                                       NL80211_ATTR_VENDOR_SUBCMD, -1);
+    if (!data)
+        return;
+    memcpy(&subcmd, data, sizeof(subcmd));
+
+    /* The nl80211 backend may be shared with the backends of other interfaces */
+    data = mmsm_find_by_nested_intkeys(result, NL80211_CMD_VENDOR, NL80211_ATTR_IFINDEX, -1);
+    if (data)
+    {
+        memcpy(&ifindex, data, sizeof(ifindex));
+        if (ifindex != morsectrl_get_ifindex(morsectrl))
+            return;
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    for (req = morsectrl->async_head; req; req = req->next)
+    {
+        if (req->completing || req->event_item || req->event != (int)subcmd)
+            continue;
+
+        /* Later requests were sent later still, so the event can't be for them either */
+        if (req->match && !req->match(req->context, result, morsectrl_now_us() - req->sent_us))
+        {
+            LOG_WARN("Dropping vendor event %u for a request that has already completed\n",
+                     subcmd);
+            break;
+        }
+
+        req->event_item = mmsm_data_item_retain(result);
+        morsectrl_async_check(morsectrl, req);
+        break;
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+}
+
+/**
+ * @brief Fails requests whose deadline has passed
+ */
+static void *
+morsectrl_async_thread_fn(void *arg)
+{
+    backend_morsectrl_t *morsectrl = arg;
+    mmsm_morsectrl_async_t *req;
+    mmsm_morsectrl_async_t *expired;
+    uint64_t next_us;
+    uint64_t now;
+    struct timespec ts;
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    while (!morsectrl->async_stopping)
+    {
+        now = morsectrl_now_us();
+        next_us = 0;
+        expired = NULL;
+
+        for (req = morsectrl->async_head; req; req = req->next)
+        {
+            if (req->completing || !req->deadline_us)
+                continue;
+
+            if (req->deadline_us <= now)
+            {
+                expired = req;
+                break;
+            }
+
+            if (!next_us || req->deadline_us < next_us)
+                next_us = req->deadline_us;
+        }
+
+        if (expired)
+        {
+            LOG_WARN("morsectrl command timed out waiting for %s\n",
+                     expired->confirmed ? "its event" : "its confirm");
+            /* A confirm arriving from now on is dropped */
+            expired->confirmed = true;
+            expired->err = MMSM_UNKNOWN_ERROR;
+            morsectrl_async_complete(morsectrl, expired);
+            continue;
+        }
+
+        if (!next_us)
+        {
+            MMSM_ASSERT(pthread_cond_wait(&morsectrl->async_cond,
+                                          &morsectrl->async_mutex) == 0);
+            continue;
+        }
+
+        ts.tv_sec = next_us / 1000000;
+        ts.tv_nsec = (next_us % 1000000) * 1000;
+        pthread_cond_timedwait(&morsectrl->async_cond, &morsectrl->async_mutex, &ts);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
+    return NULL;
+}
+
+mmsm_morsectrl_async_t *
+mmsm_backend_morsectrl_request_async(mmsm_backend_intf_t *handle, int event, uint32_t timeout_ms,
+                                     mmsm_morsectrl_async_fn_t fn, void *context, int command_id,
+                                     uint16_t len, const void *data)
+{
+    return mmsm_backend_morsectrl_request_async_match(handle, event, NULL, timeout_ms, fn,
+                                                      context, command_id, len, data);
+}
+
+mmsm_morsectrl_async_t *
+mmsm_backend_morsectrl_request_async_match(mmsm_backend_intf_t *handle, int event,
+                                           mmsm_morsectrl_async_match_fn_t match,
+                                           uint32_t timeout_ms, mmsm_morsectrl_async_fn_t fn,
+                                           void *context, int command_id, uint16_t len,
+                                           const void *data)
+{
+    backend_morsectrl_t *morsectrl = get_container_from_intf(morsectrl, handle);
+    mmsm_morsectrl_async_t *req;
+    mmsm_morsectrl_async_t **tail;
+    mmsm_data_item_t *command;
+
+    req = calloc(1, sizeof(*req));
+    if (!req)
+        return NULL;
+
+    command = morsectrl_command(handle, command_id, len, data, -1);
+    if (!command)
+    {
+        free(req);
+        return NULL;
+    }
+
+    req->morsectrl = morsectrl;
+    req->fn = fn;
+    req->context = context;
+    req->event = event;
+    req->match = match;
+    req->command = command;
+    req->pending = true;
+    /* One reference for the list, one for the command and one until this returns */
+    req->refs = 3;
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    if (event != MMSM_MORSECTRL_NO_EVENT && !morsectrl->async_monitoring)
+    {
+        if (mmsm_monitor_pattern(morsectrl->nl80211_intf, "", morsectrl_async_event, morsectrl,
+                                 NL80211_CMD_VENDOR, 0,
+                                 NL80211_ATTR_VENDOR_ID, NLA_U32, MORSE_OUI, -1) != MMSM_SUCCESS)
+        {
+            LOG_ERROR("Failed to monitor vendor events\n");
+            goto fail;
+        }
+        morsectrl->async_monitoring = true;
+    }
+
+    if (!morsectrl->async_started)
+    {
+        if (pthread_create(&morsectrl->async_thread, NULL, morsectrl_async_thread_fn,
+                           morsectrl) != 0)
+        {
+            LOG_ERROR("Failed to start morsectrl timeout thread\n");
+            goto fail;
+        }
+        morsectrl->async_started = true;
+    }
+
+    /* Queue the request before sending it, as the confirm may arrive straight away */
+    req->sent_us = morsectrl_now_us();
+    for (tail = &morsectrl->async_head; *tail;)
+        tail = &(*tail)->next;
+    *tail = req;
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
+    if (backend_morsectrl_submit(handle, command, morsectrl_async_confirm_done, req)
+            != MMSM_SUCCESS)
+    {
+        /* Without a confirm or a deadline, the request can't have completed */
+        MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+        /* done won't be called, so drop the command's reference here */
+        req->refs--;
+        morsectrl_async_unlink(morsectrl, req);
+        morsectrl_async_put(req);
+        MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+        return NULL;
+    }
+
+    /* Only start the clock once sent, so a request that fails to send never times out */
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    if (timeout_ms && req->pending)
+    {
+        req->deadline_us = morsectrl_now_us() + timeout_ms * 1000ull;
+        MMSM_ASSERT(pthread_cond_broadcast(&morsectrl->async_cond) == 0);
+    }
+    morsectrl_async_put(req);
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
+    return req;
+
+fail:
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+    mmsm_data_item_free(command);
+    free(req);
+    return NULL;
+}
+
+void
+mmsm_backend_morsectrl_cancel(mmsm_backend_intf_t *handle, mmsm_morsectrl_async_t *request)
+{
+    backend_morsectrl_t *morsectrl = get_container_from_intf(morsectrl, handle);
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    while (morsectrl_async_is_pending(morsectrl, request))
+    {
+        if (!request->completing)
+        {
+            morsectrl_async_unlink(morsectrl, request);
+            break;
+        }
+
+        if (pthread_equal(request->completing_thread, pthread_self()))
+            break;
+
+        MMSM_ASSERT(pthread_cond_wait(&morsectrl->async_cond, &morsectrl->async_mutex) == 0);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+}
+
 /**
  * Morsectrl backend interface instance
  */
 static const mmsm_backend_intf_t morsectrl_intf =
 {
     .req_blocking = backend_morsectrl_sync_command,
+    .req_submit = backend_morsectrl_submit,
     .req_async = NULL,
     .process_request_args = backend_morsectrl_process_request_args,
 };
 
-mmsm_backend_intf_t *
-mmsm_backend_morsectrl_create(const char *ifname)
+/**
+ * @brief Create a morsectrl backend on an nl80211 backend
+ *
+ * @param ifname The name of the interface
+ * @param nl80211_intf The nl80211 backend to use, or NULL to create one
+ * @return the created morsectrl backend instance
+ */
+static mmsm_backend_intf_t *
+morsectrl_create(const char *ifname, mmsm_backend_intf_t *nl80211_intf)
 {
     backend_morsectrl_t *module;
+    pthread_condattr_t condattr;
     LOG_INFO("Instantiating morsectrl backend\n");
 
     module = calloc(1, sizeof(*module));
@@ -197,13 +1252,49 @@ mmsm_backend_morsectrl_create(const char *ifname)
         return NULL;
 
     memcpy(&module->intf, &morsectrl_intf, sizeof(module->intf));
-    module->datalog = datalog_create("morsectrl");
-    module->nl80211_intf = mmsm_backend_nl80211_create();
+    if (nl80211_intf)
+    {
+        /* Other interfaces' backends will be logging too */
+        module->datalog = datalog_create_instance("morsectrl", ifname);
+        module->nl80211_intf = nl80211_intf;
+    }
+    else
+    {
+        module->datalog = datalog_create("morsectrl");
+        module->nl80211_intf = mmsm_backend_nl80211_create();
+        module->owns_nl80211 = true;
+    }
     module->ifname = strdup(ifname);
+    MMSM_ASSERT(pthread_mutex_init(&module->ifindex_mutex, NULL) == 0);
+    MMSM_ASSERT(pthread_mutex_init(&module->async_mutex, NULL) == 0);
+    MMSM_ASSERT(pthread_condattr_init(&condattr) == 0);
+    /* Deadlines are measured on the monotonic clock */
+    MMSM_ASSERT(pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC) == 0);
+    MMSM_ASSERT(pthread_cond_init(&module->async_cond, &condattr) == 0);
+    MMSM_ASSERT(pthread_condattr_destroy(&condattr) == 0);
+
+    /* Subscribe before resolving, so no change in between is missed */
+    module->link_sock = morsectrl_link_sock_open(module);
+    if (!module->link_sock)
+        LOG_WARN("Link notifications unavailable, resolving %s on every request\n", ifname);
+    module->ifindex = if_nametoindex(ifname);
 
     return &module->intf;
 }
 
+mmsm_backend_intf_t *
+mmsm_backend_morsectrl_create(const char *ifname)
+{
+    return morsectrl_create(ifname, NULL);
+}
+
+mmsm_backend_intf_t *
+mmsm_backend_morsectrl_create_with_nl80211(const char *ifname, mmsm_backend_intf_t *nl80211_intf)
+{
+    MMSM_ASSERT(nl80211_intf != NULL);
+    return morsectrl_create(ifname, nl80211_intf);
+}
+
 
 void
 mmsm_backend_morsectrl_destroy(mmsm_backend_intf_t *handle)
@@ -214,12 +1305,55 @@ mmsm_backend_morsectrl_destroy(mmsm_backend_intf_t *handle)
         return;
 
     morsectrl = get_container_from_intf(morsectrl, handle);
+
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    morsectrl->async_stopping = true;
+    MMSM_ASSERT(pthread_cond_broadcast(&morsectrl->async_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
+    if (morsectrl->async_started)
+        MMSM_ASSERT(pthread_join(morsectrl->async_thread, NULL) == 0);
+    if (morsectrl->async_monitoring)
+        mmsm_monitor_pattern_remove(morsectrl->nl80211_intf, morsectrl_async_event, morsectrl);
+
+    /* Cancel whatever is pending, once any callback still running on nl80211's thread returns */
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    while (morsectrl->async_head)
+    {
+        if (morsectrl->async_head->completing)
+            MMSM_ASSERT(pthread_cond_wait(&morsectrl->async_cond,
+                                          &morsectrl->async_mutex) == 0);
+        else
+            morsectrl_async_unlink(morsectrl, morsectrl->async_head);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
+    if (morsectrl->nl80211_intf && morsectrl->owns_nl80211)
+    {
+        /* Fails the commands still in flight */
+        mmsm_backend_nl80211_destroy(morsectrl->nl80211_intf);
+    }
+
+    /*
+     * A shared nl80211 backend carries on, so wait for it to complete the commands still in
+     * flight, as their completions lock async_mutex
+     */
+    MMSM_ASSERT(pthread_mutex_lock(&morsectrl->async_mutex) == 0);
+    while (morsectrl->submits_in_flight)
+        MMSM_ASSERT(pthread_cond_wait(&morsectrl->async_cond, &morsectrl->async_mutex) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&morsectrl->async_mutex) == 0);
+
     datalog_close(morsectrl->datalog);
     morsectrl->datalog = NULL;
-    if (morsectrl->nl80211_intf)
+    if (morsectrl->link_sock)
     {
-        mmsm_backend_nl80211_destroy(morsectrl->nl80211_intf);
+        nl_close(morsectrl->link_sock);
+        nl_socket_free(morsectrl->link_sock);
     }
+    MMSM_ASSERT(pthread_mutex_destroy(&morsectrl->ifindex_mutex) == 0);
+    /* Only now that no completion of a command submitted to nl80211 can be running */
+    MMSM_ASSERT(pthread_cond_destroy(&morsectrl->async_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&morsectrl->async_mutex) == 0);
     free(morsectrl->ifname);
     free(morsectrl);
 }
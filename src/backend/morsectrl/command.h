@@ -48,3 +48,25 @@ struct PACKED response
     /** An opaque data pointer */
     uint8_t data[0];
 };
+
+/**
+ * Request payload type of each command, for @ref MORSECTRL_CMD_CREATE and
+ * @ref MORSECTRL_CMD_PAYLOAD
+ */
+#define MORSE_CMD_REQ_TYPE_MORSE_CMD_ID_SET_CHANNEL         struct morse_cmd_req_set_channel
+#define MORSE_CMD_REQ_TYPE_MORSE_CMD_ID_GET_VERSION         struct morse_cmd_req_get_version
+#define MORSE_CMD_REQ_TYPE_MORSE_CMD_ID_OCS_DRIVER          struct morse_cmd_req_ocs_driver
+#define MORSE_CMD_REQ_TYPE_MORSE_CMD_ID_CONFIG_BSS_STATS    struct morse_cmd_req_config_bss_stats
+
+/**
+ * Create a reusable morsectrl command (see mmsm_backend_morsectrl_cmd_create) whose payload
+ * is the command's request type, e.g. MORSECTRL_CMD_CREATE(intf, MORSE_CMD_ID_OCS_DRIVER).
+ */
+#define MORSECTRL_CMD_CREATE(_intf, _id) \
+        mmsm_backend_morsectrl_cmd_create(_intf, _id, sizeof(MORSE_CMD_REQ_TYPE_##_id))
+
+/**
+ * Get the payload of a command created with @ref MORSECTRL_CMD_CREATE, as its request type
+ */
+#define MORSECTRL_CMD_PAYLOAD(_cmd, _id) \
+        ((MORSE_CMD_REQ_TYPE_##_id *)mmsm_backend_morsectrl_cmd_payload(_cmd))
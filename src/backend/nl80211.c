@@ -3,12 +3,19 @@
  * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
  */
 
+#include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <poll.h>
 #include <signal.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/family.h>
@@ -21,57 +28,283 @@
 #include "mmsm_data.h"
 #include "helpers.h"
 #include "datalog.h"
+#include "trace.h"
+#include "probes.h"
 
 
-typedef struct backend_nl80211_t
+/** Number of request sockets kept open per backend, so requests from several threads can run
+ * at once */
+#define NL80211_REQ_POOL_SIZE (4)
+
+
+/** Most submitted requests waiting for their replies on the submit socket at once */
+#define NL80211_SUBMIT_MAX_IN_FLIGHT (16)
+
+/** How long to wait for the reply to a submitted request */
+#define NL80211_SUBMIT_TIMEOUT_MS (5000)
+
+/** Receive buffer size of the submit socket, which may hold the replies of every request in
+ * flight */
+#define NL80211_SUBMIT_RX_BUFFER_SIZE (256 * 1024)
+
+
+/** Most vendor events told apart by the monitor filter, beyond which every vendor event is let
+ * through */
+#define NL80211_FILTER_MAX_VENDOR (16)
+
+
+typedef struct backend_nl80211_t backend_nl80211_t;
+
+
+/**
+ * A vendor event wanted by a pattern monitor
+ */
+typedef struct nl80211_filter_vendor_t
 {
-    /** The interface */
-    mmsm_backend_intf_t intf;
+    /** Whether the monitor matches on NL80211_ATTR_VENDOR_ID, and the ID it matches */
+    bool has_id;
+    uint32_t id;
 
-    /** The data log file handler */
-    struct datalog *datalog;
+    /** Whether the monitor matches on NL80211_ATTR_VENDOR_SUBCMD, and the subcmd it matches */
+    bool has_subcmd;
+    uint32_t subcmd;
+} nl80211_filter_vendor_t;
 
-    /** The nl socket structure that is used in the pattern monitor */
+
+/**
+ * The notifications the pattern monitors can match, see @ref backend_nl80211_monitor_filter
+ */
+typedef struct nl80211_filter_t
+{
+    /** Set if every notification is let through */
+    bool all;
+
+    /** Bit per command, set if a monitor matches it */
+    uint64_t cmds[4];
+
+    /** Vendor events wanted, unless any_vendor is set */
+    bool any_vendor;
+    size_t num_vendor;
+    nl80211_filter_vendor_t vendor[NL80211_FILTER_MAX_VENDOR];
+} nl80211_filter_t;
+
+
+/**
+ * A request socket, kept connected between requests
+ */
+typedef struct nl80211_req_sock_t
+{
+    /** The socket, or NULL if it isn't connected */
     struct nl_sock *sock;
-} backend_nl80211_t;
+
+    /** Set while a request is using the socket */
+    bool busy;
+} nl80211_req_sock_t;
 
 
 typedef struct nl80211_params_t
 {
     backend_nl80211_t *backend;
     mmsm_data_item_t **result;
+    /** The last item of the result */
+    mmsm_data_item_t *tail;
+    /** Arena the result is allocated from, or NULL to use the heap */
+    mmsm_data_arena_t *arena;
+
+    /** If not NULL, called with each batch of messages instead of building one result */
+    mmsm_backend_nl80211_dump_fn_t stream_fn;
+    void *stream_context;
+    /** Number of messages per batch */
+    size_t stream_batch;
+    /** Number of messages in the result */
+    size_t stream_count;
+
+    /** Whether the request was written to the datalog, so its replies are too */
+    bool logged;
 } nl80211_params_t;
 
 
+/**
+ * A request sent with req_submit
+ */
+typedef struct nl80211_submit_t
+{
+    /** The request, valid until done is called */
+    mmsm_data_item_t *command;
+
+    /** Called with the reply */
+    mmsm_backend_completion_fn_t done;
+
+    /** Passed to done */
+    void *arg;
+
+    /** The reply received so far */
+    mmsm_data_item_t *result;
+
+    /** Where the reply is built, as for a blocking request */
+    nl80211_params_t params;
+
+    /** Sequence number the request was sent with, which its replies carry */
+    uint32_t seq;
+
+    /** Whether the request is a dump. The kernel only runs one dump at a time per socket. */
+    bool dump;
+
+    /** When to give up waiting for the reply, see @ref nl80211_now_us */
+    uint64_t deadline_us;
+
+    /** The NL80211_CMD_* sent, and when, for the flight recorder. started_us is 0 until sent. */
+    uint16_t cmd;
+    uint64_t started_us;
+
+    /** Next request in the queue or in flight */
+    struct nl80211_submit_t *next;
+} nl80211_submit_t;
+
+
+struct backend_nl80211_t
+{
+    /** The interface */
+    mmsm_backend_intf_t intf;
+
+    /** The data log file handler */
+    struct datalog *datalog;
+
+    /** The nl socket structure that is used in the pattern monitor */
+    struct nl_sock *sock;
+
+    /** Callback argument for notifications received on @ref sock */
+    nl80211_params_t monitor_params;
+
+    /** Protects monitor_filter and monitor_fd */
+    pthread_mutex_t monitor_filter_mutex;
+
+    /** The notifications let through to be parsed */
+    nl80211_filter_t monitor_filter;
+
+    /** Descriptor of @ref sock once it has joined its groups, or -1, so the kernel side of
+     * monitor_filter can be updated from any thread */
+    int monitor_fd;
+
+    /** Receive buffer sizes, see @ref mmsm_backend_nl80211_set_rx_buffers */
+    int monitor_rx_buffer;
+    int request_rx_buffer;
+
+    /** Number of times @ref sock's receive buffer overflowed */
+    uint64_t events_lost;
+
+    /** Number of netlink send and receive failures, and of sockets closed after one */
+    uint64_t errors;
+    uint64_t reconnects;
+
+    /** The nl80211 family ID, resolved by the first request, or 0 */
+    int family_id;
+
+    /** Request sockets, connected on first use */
+    nl80211_req_sock_t req_socks[NL80211_REQ_POOL_SIZE];
+
+    /** Protects req_socks */
+    pthread_mutex_t req_socks_mutex;
+
+    /** Signalled when a request socket is no longer busy */
+    pthread_cond_t req_socks_cond;
+
+    /**
+     * The socket submitted requests are sent on, with their replies matched to them by sequence
+     * number so that several can be in flight. Only used by the submit thread.
+     */
+    struct nl_sock *submit_sock;
+
+    /** Callbacks for replies received on @ref submit_sock */
+    struct nl_cb *submit_cb;
+
+    /** Submitted requests sent and waiting for their replies. Only used by the submit thread. */
+    nl80211_submit_t *in_flight;
+    size_t num_in_flight;
+
+    /** Protects the submit queue and submit_stopping */
+    pthread_mutex_t submit_mutex;
+
+    /** Submitted requests waiting to be sent */
+    nl80211_submit_t *submit_head;
+    nl80211_submit_t **submit_tail;
+
+    /** Sends submitted requests and receives their replies, started on the first one */
+    pthread_t submit_thread;
+    bool submit_started;
+
+    /** Set to stop the submit thread */
+    bool submit_stopping;
+
+    /** eventfd used to wake the submit thread */
+    int submit_wake_fd;
+};
+
+
 static mmsm_error_code
 backend_nl80211_ctrl_monitor(mmsm_backend_intf_t *intf,
                              mmsm_data_item_t **result);
 
 
+static int
+backend_nl80211_monitor_get_fd(mmsm_backend_intf_t *intf);
+
+
+static mmsm_error_code
+backend_nl80211_monitor_recv(mmsm_backend_intf_t *intf,
+                             mmsm_data_item_t **result);
+
+
 static mmsm_error_code
 backend_nl80211_sync_command(mmsm_backend_intf_t *intf,
                              mmsm_data_item_t *command,
                              mmsm_data_item_t **result);
 
 
+static mmsm_error_code
+backend_nl80211_submit(mmsm_backend_intf_t *intf,
+                       mmsm_data_item_t *command,
+                       mmsm_backend_completion_fn_t done,
+                       void *arg);
+
+
+static mmsm_error_code
+backend_nl80211_monitor_filter(mmsm_backend_intf_t *intf,
+                               mmsm_data_item_t *const *commands,
+                               size_t count);
+
+
 static mmsm_data_item_t *
 backend_nl80211_process_request_args(mmsm_backend_intf_t *intf,
                                      va_list args);
 
 
+static void
+backend_nl80211_get_counters(mmsm_backend_intf_t *intf,
+                             mmsm_backend_counters_t *counters);
+
+
 static const mmsm_backend_intf_t nl80211_intf =
 {
     .req_blocking = backend_nl80211_sync_command,
+    .req_submit = backend_nl80211_submit,
     .req_async = backend_nl80211_ctrl_monitor,
+    .monitor_get_fd = backend_nl80211_monitor_get_fd,
+    .monitor_recv = backend_nl80211_monitor_recv,
+    .monitor_filter = backend_nl80211_monitor_filter,
     .process_request_args = backend_nl80211_process_request_args,
+    .get_counters = backend_nl80211_get_counters,
 };
 
 
 /**
- * Creates and connects an nl80211 socket, and provides the ID.
+ * Creates and connects an nl80211 socket.
+ *
+ * @param rx_buffer Receive buffer size, or 0 for the kernel's default
+ * @param id If not NULL, set to the nl80211 family ID, which is resolved with the socket
  */
 static struct nl_sock *
-backend_nl80211_socket_connect(int *id)
+backend_nl80211_socket_connect(int rx_buffer, int *id)
 {
     struct nl_sock *sock;
 
@@ -81,7 +314,6 @@ backend_nl80211_socket_connect(int *id)
         LOG_ERROR("Failed to allocate netlink socket.\n");
         return NULL;
     }
-    nl_socket_set_buffer_size(sock, 8192, 8192);
 
     if (genl_connect(sock))
     {
@@ -91,6 +323,13 @@ backend_nl80211_socket_connect(int *id)
         return NULL;
     }
 
+    /* Only possible once connected */
+    if (rx_buffer > 0 && nl_socket_set_buffer_size(sock, rx_buffer, 0) < 0)
+        LOG_WARN("Failed to set netlink receive buffer to %d\n", rx_buffer);
+
+    if (!id)
+        return sock;
+
     *id = genl_ctrl_resolve(sock, "nl80211");
     if (*id < 0)
     {
@@ -104,8 +343,245 @@ backend_nl80211_socket_connect(int *id)
 }
 
 
+/**
+ * Takes a request socket from the pool, waiting for one if every socket is busy, and connects
+ * it if needed. The nl80211 family ID is only resolved for the first socket connected.
+ *
+ * @param id Set to the nl80211 family ID
+ * @return the request socket, to be returned with @ref backend_nl80211_req_sock_put, or NULL if
+ *         it couldn't be connected
+ */
+static nl80211_req_sock_t *
+backend_nl80211_req_sock_get(backend_nl80211_t *nl80211, int *id)
+{
+    nl80211_req_sock_t *req_sock = NULL;
+    size_t i;
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->req_socks_mutex) == 0);
+    while (true)
+    {
+        for (i = 0; i < NL80211_REQ_POOL_SIZE; i++)
+        {
+            if (nl80211->req_socks[i].busy)
+                continue;
+
+            /* Prefer a socket that is already connected */
+            if (!req_sock || (!req_sock->sock && nl80211->req_socks[i].sock))
+                req_sock = &nl80211->req_socks[i];
+        }
+
+        if (req_sock)
+            break;
+
+        MMSM_ASSERT(pthread_cond_wait(&nl80211->req_socks_cond,
+                                      &nl80211->req_socks_mutex) == 0);
+    }
+    req_sock->busy = true;
+    *id = nl80211->family_id;
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->req_socks_mutex) == 0);
+
+    if (!req_sock->sock)
+    {
+        req_sock->sock = backend_nl80211_socket_connect(nl80211->request_rx_buffer,
+                                                        *id ? NULL : id);
+        if (!req_sock->sock)
+        {
+            MMSM_ASSERT(pthread_mutex_lock(&nl80211->req_socks_mutex) == 0);
+            req_sock->busy = false;
+            MMSM_ASSERT(pthread_cond_signal(&nl80211->req_socks_cond) == 0);
+            MMSM_ASSERT(pthread_mutex_unlock(&nl80211->req_socks_mutex) == 0);
+            return NULL;
+        }
+
+        MMSM_ASSERT(pthread_mutex_lock(&nl80211->req_socks_mutex) == 0);
+        nl80211->family_id = *id;
+        MMSM_ASSERT(pthread_mutex_unlock(&nl80211->req_socks_mutex) == 0);
+    }
+
+    return req_sock;
+}
+
+
+/**
+ * Returns a request socket to the pool.
+ *
+ * @param broken Whether the socket may have been left mid-exchange, in which case it is closed
+ *               so that no stale messages are read by the next request
+ */
+static void
+backend_nl80211_req_sock_put(backend_nl80211_t *nl80211, nl80211_req_sock_t *req_sock,
+                             bool broken)
+{
+    if (broken)
+    {
+        __atomic_fetch_add(&nl80211->errors, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&nl80211->reconnects, 1, __ATOMIC_RELAXED);
+        nl_close(req_sock->sock);
+        nl_socket_free(req_sock->sock);
+        req_sock->sock = NULL;
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->req_socks_mutex) == 0);
+    req_sock->busy = false;
+    MMSM_ASSERT(pthread_cond_signal(&nl80211->req_socks_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->req_socks_mutex) == 0);
+}
+
+
+/**
+ * Describes which attributes of a set of attributes are nested attributes themselves, in the
+ * style of a struct nla_policy, so received messages are decoded from what the attributes are
+ * rather than from what their data happens to look like.
+ */
+typedef struct nl80211_schema_t nl80211_schema_t;
+struct nl80211_schema_t
+{
+    /** Number of entries in nested */
+    size_t count;
+
+    /** The schema of the attributes nested in each attribute, indexed by attribute type. A NULL
+     * entry (or an attribute past the end) means the attribute's value is kept as it is. */
+    const nl80211_schema_t *const *nested;
+
+    /** If not NULL, the set is a list, e.g. of bands or of frequencies, and every attribute in
+     * it is nested with this schema whatever its type */
+    const nl80211_schema_t *element;
+};
+
+
+#define NL80211_SCHEMA(_nested) { .count = ARRAY_SIZE(_nested), .nested = (_nested) }
+#define NL80211_SCHEMA_LIST(_element) { .element = (_element) }
+
+
+/** Attributes that are all kept as they are */
+static const nl80211_schema_t nl80211_schema_flat = { 0 };
+
+/** A list of sets of attributes that are all kept as they are */
+static const nl80211_schema_t nl80211_schema_flat_list =
+    NL80211_SCHEMA_LIST(&nl80211_schema_flat);
+
+
+static const nl80211_schema_t *const nl80211_tid_stats_nested[] = {
+    [NL80211_TID_STATS_TXQ_STATS] = &nl80211_schema_flat,
+};
+static const nl80211_schema_t nl80211_tid_stats_schema = NL80211_SCHEMA(nl80211_tid_stats_nested);
+static const nl80211_schema_t nl80211_tid_stats_list =
+    NL80211_SCHEMA_LIST(&nl80211_tid_stats_schema);
+
+static const nl80211_schema_t *const nl80211_sta_info_nested[] = {
+    [NL80211_STA_INFO_TX_BITRATE] = &nl80211_schema_flat,
+    [NL80211_STA_INFO_RX_BITRATE] = &nl80211_schema_flat,
+    [NL80211_STA_INFO_BSS_PARAM] = &nl80211_schema_flat,
+    [NL80211_STA_INFO_CHAIN_SIGNAL] = &nl80211_schema_flat,
+    [NL80211_STA_INFO_CHAIN_SIGNAL_AVG] = &nl80211_schema_flat,
+    [NL80211_STA_INFO_TID_STATS] = &nl80211_tid_stats_list,
+};
+static const nl80211_schema_t nl80211_sta_info_schema = NL80211_SCHEMA(nl80211_sta_info_nested);
+
+static const nl80211_schema_t *const nl80211_band_iftype_nested[] = {
+    [NL80211_BAND_IFTYPE_ATTR_IFTYPES] = &nl80211_schema_flat,
+};
+static const nl80211_schema_t nl80211_band_iftype_schema =
+    NL80211_SCHEMA(nl80211_band_iftype_nested);
+static const nl80211_schema_t nl80211_band_iftype_list =
+    NL80211_SCHEMA_LIST(&nl80211_band_iftype_schema);
+
+static const nl80211_schema_t *const nl80211_band_nested[] = {
+    [NL80211_BAND_ATTR_FREQS] = &nl80211_schema_flat_list,
+    [NL80211_BAND_ATTR_RATES] = &nl80211_schema_flat_list,
+    [NL80211_BAND_ATTR_IFTYPE_DATA] = &nl80211_band_iftype_list,
+};
+static const nl80211_schema_t nl80211_band_schema = NL80211_SCHEMA(nl80211_band_nested);
+static const nl80211_schema_t nl80211_band_list = NL80211_SCHEMA_LIST(&nl80211_band_schema);
+
+static const nl80211_schema_t *const nl80211_iface_limit_nested[] = {
+    [NL80211_IFACE_LIMIT_TYPES] = &nl80211_schema_flat,
+};
+static const nl80211_schema_t nl80211_iface_limit_schema =
+    NL80211_SCHEMA(nl80211_iface_limit_nested);
+static const nl80211_schema_t nl80211_iface_limit_list =
+    NL80211_SCHEMA_LIST(&nl80211_iface_limit_schema);
+
+static const nl80211_schema_t *const nl80211_iface_comb_nested[] = {
+    [NL80211_IFACE_COMB_LIMITS] = &nl80211_iface_limit_list,
+};
+static const nl80211_schema_t nl80211_iface_comb_schema = NL80211_SCHEMA(nl80211_iface_comb_nested);
+static const nl80211_schema_t nl80211_iface_comb_list =
+    NL80211_SCHEMA_LIST(&nl80211_iface_comb_schema);
+
+
+/** The nested attributes found at the top level of nl80211 messages */
+#define NL80211_ATTR_NESTED_ENTRIES \
+    [NL80211_ATTR_STA_INFO] = &nl80211_sta_info_schema, \
+    [NL80211_ATTR_SURVEY_INFO] = &nl80211_schema_flat, \
+    [NL80211_ATTR_BSS] = &nl80211_schema_flat, \
+    [NL80211_ATTR_KEY] = &nl80211_schema_flat, \
+    [NL80211_ATTR_MPATH_INFO] = &nl80211_schema_flat, \
+    [NL80211_ATTR_CQM] = &nl80211_schema_flat, \
+    [NL80211_ATTR_TXQ_STATS] = &nl80211_schema_flat, \
+    [NL80211_ATTR_SCAN_FREQUENCIES] = &nl80211_schema_flat, \
+    [NL80211_ATTR_SCAN_SSIDS] = &nl80211_schema_flat, \
+    [NL80211_ATTR_SUPPORTED_IFTYPES] = &nl80211_schema_flat, \
+    [NL80211_ATTR_SOFTWARE_IFTYPES] = &nl80211_schema_flat, \
+    [NL80211_ATTR_SUPPORTED_COMMANDS] = &nl80211_schema_flat, \
+    [NL80211_ATTR_WIPHY_BANDS] = &nl80211_band_list, \
+    [NL80211_ATTR_INTERFACE_COMBINATIONS] = &nl80211_iface_comb_list, \
+    [NL80211_ATTR_REG_RULES] = &nl80211_schema_flat_list
+
+static const nl80211_schema_t *const nl80211_attr_nested[] = {
+    NL80211_ATTR_NESTED_ENTRIES,
+};
+static const nl80211_schema_t nl80211_attr_schema = NL80211_SCHEMA(nl80211_attr_nested);
+
+/** Vendor commands and events, whose vendor data Morse Micro devices fill with attributes of
+ * their own (see morse_vendor_attributes) */
+static const nl80211_schema_t *const nl80211_vendor_attr_nested[] = {
+    NL80211_ATTR_NESTED_ENTRIES,
+    [NL80211_ATTR_VENDOR_DATA] = &nl80211_schema_flat,
+};
+static const nl80211_schema_t nl80211_vendor_attr_schema =
+    NL80211_SCHEMA(nl80211_vendor_attr_nested);
+
+
+/**
+ * Gets the schema of the top level attributes of a message
+ *
+ * @param cmd The command of the message
+ */
+static const nl80211_schema_t *
+nl80211_command_schema(uint8_t cmd)
+{
+    switch (cmd)
+    {
+    case NL80211_CMD_VENDOR:
+        return &nl80211_vendor_attr_schema;
+    default:
+        return &nl80211_attr_schema;
+    }
+}
+
+
+/**
+ * Gets the schema of the attributes nested in an attribute, or NULL if it isn't nested
+ */
+static const nl80211_schema_t *
+nl80211_schema_nested(const nl80211_schema_t *schema, int attr)
+{
+    if (schema->element)
+        return schema->element;
+
+    if (attr < 0 || (size_t)attr >= schema->count)
+        return NULL;
+
+    return schema->nested[attr];
+}
+
+
+/**
+ * Checks that data holds a whole number of well formed attributes
+ */
 static bool
-attr_looks_nested(struct nlattr *iter, int attr_len)
+attrs_well_formed(struct nlattr *iter, int attr_len)
 {
     while (nla_ok(iter, attr_len))
     {
@@ -118,9 +594,13 @@ attr_looks_nested(struct nlattr *iter, int attr_len)
 
 /**
  * Navigates the provided attribute data, filling mmsm_data_item_t structure
+ *
+ * Only attributes the schema describes as nested are decoded further, and only if their data is
+ * well formed. Any other attribute's value is kept as it is, with no sub values.
  */
 static mmsm_data_item_t *
-navigate_attrs(struct nlattr *attr_data, int attr_len)
+navigate_attrs(mmsm_data_arena_t *arena, mmsm_data_buf_t *msg_buf,
+               const nl80211_schema_t *schema, struct nlattr *attr_data, int attr_len)
 {
     struct nlattr *nla;
     int remaining;
@@ -134,284 +614,1576 @@ navigate_attrs(struct nlattr *attr_data, int attr_len)
         int attr = nla_type(nla);
         int length = nla_len(nla);
         uint8_t *data = (uint8_t *)nla_data(nla);
+        const nl80211_schema_t *nested = nl80211_schema_nested(schema, attr);
+
+        if (iter != NULL)
+        {
+            iter = mmsm_data_item_alloc_next(iter);
+        }
+        else
+        {
+            head = mmsm_data_item_alloc_in(arena);
+            iter = head;
+        }
+
+        mmsm_data_item_set_key_u32(iter, attr);
+        if (msg_buf)
+            mmsm_data_item_set_val_ref(iter, msg_buf, data, length);
+        else
+            mmsm_data_item_set_val_bytes(iter, data, length);
+
+        if (nested && attrs_well_formed((struct nlattr *)data, length))
+        {
+            iter->mmsm_sub_values = navigate_attrs(arena, msg_buf, nested,
+                                                   (struct nlattr *)data,
+                                                   length);
+        }
+    }
+
+    return head;
+}
+
+
+static void
+nl80211_msg_release(void *ctx)
+{
+    nlmsg_free((struct nl_msg *)ctx);
+}
+
+
+/**
+ * Wraps a received message in a buffer, so that response values can point into its attributes
+ * rather than copying them. Returns NULL on failure, in which case the values are copied.
+ */
+static mmsm_data_buf_t *
+nl80211_msg_buf(struct nl_msg *msg)
+{
+    mmsm_data_buf_t *msg_buf = mmsm_data_buf_create(nl80211_msg_release, msg);
+
+    if (msg_buf)
+        nlmsg_get(msg);
+
+    return msg_buf;
+}
+
+
+/**
+ * Builds the item of a received message in an arena, with its attributes as its command's schema
+ * describes.
+ *
+ * @return the item, with its key left for the caller to set, or NULL on failure
+ */
+static mmsm_data_item_t *
+nl80211_msg_parse(mmsm_data_arena_t *arena, struct nl_msg *msg)
+{
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    mmsm_data_item_t *entry = mmsm_data_item_alloc_in(arena);
+    mmsm_data_buf_t *msg_buf;
+
+    if (!entry)
+        return NULL;
+
+    msg_buf = nl80211_msg_buf(msg);
+    entry->mmsm_sub_values = navigate_attrs(arena, msg_buf, nl80211_command_schema(gnlh->cmd),
+                                            genlmsg_attrdata(gnlh, 0),
+                                            genlmsg_attrlen(gnlh, 0));
+    mmsm_data_buf_put(msg_buf);
+
+    return entry;
+}
+
+
+/**
+ * Provides the messages received so far of a streamed dump to the callback, and starts the next
+ * batch.
+ */
+static void
+nl80211_stream_flush(nl80211_params_t *params)
+{
+    if (!*params->result)
+        return;
+
+    params->stream_fn(params->stream_context, *params->result);
+    mmsm_data_item_free(*params->result);
+    *params->result = NULL;
+    params->tail = NULL;
+    params->stream_count = 0;
+
+    /* Start the next batch in an arena of its own, so the last one's memory is released now */
+    mmsm_data_arena_put(params->arena);
+    params->arena = mmsm_data_arena_create();
+}
+
+
+/**
+ * Decides whether to write a message to the datalog, keyed by its nl80211 command number, see
+ * @ref datalog_sample.
+ */
+static bool
+nl80211_datalog_sample(backend_nl80211_t *nl80211, struct nl_msg *msg)
+{
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    char key[8];
+
+    if (!nl80211->datalog)
+        return false;
+
+    snprintf(key, sizeof(key), "%u", gnlh->cmd);
+    return datalog_sample(nl80211->datalog, key);
+}
+
+
+static int
+sync_callback(struct nl_msg *msg, void *arg)
+{
+    nl80211_params_t *params = (nl80211_params_t *)arg;
+
+    LOG_VERBOSE("RX: \n");
+    LOG_DATA(LOG_LEVEL_VERBOSE,
+             (uint8_t *)nlmsg_hdr(msg),
+             nlmsg_get_max_size(msg));
+    if (params->logged)
+    {
+        datalog_write_string(params->backend->datalog, "Rx\n");
+        datalog_write_data(params->backend->datalog,
+            (uint8_t *)nlmsg_hdr(msg), nlmsg_get_max_size(msg));
+    }
+
+    mmsm_data_item_t **result = params->result;
+    mmsm_data_item_t *entry = nl80211_msg_parse(params->arena, msg);
+
+    if (!entry)
+        return NL_STOP;
+
+    if (*result == NULL)
+    {
+        *result = entry;
+    }
+    else
+    {
+        if (!params->tail)
+        {
+            for (params->tail = *result; params->tail->mmsm_next;)
+                params->tail = params->tail->mmsm_next;
+        }
+        params->tail->mmsm_next = entry;
+    }
+    /* Keep the end of the list, so a long dump isn't walked for every message */
+    params->tail = entry;
+
+    if (params->stream_fn && ++params->stream_count >= params->stream_batch)
+        nl80211_stream_flush(params);
+
+    return NL_OK;
+}
+
+
+static int sync_finish_handler(struct nl_msg *msg, void *arg)
+{
+    int *ret = arg;
+    *ret = 0;
+
+    return NL_SKIP;
+}
+
+static int ack_handler(struct nl_msg *msg, void *arg)
+{
+    int *ret = arg;
+    *ret = 0;
+
+    return NL_STOP;
+}
+
+static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+    int *ret = arg;
+
+    if (err->error > 0)
+    {
+        *ret = err->error;
+    }
+    else
+    {
+        *ret = -EPROTO;
+    }
+    LOG_ERROR("Error in NL command %d\n", err->error);
+    return NL_STOP;
+}
+
+
+/**
+ * Adds the notifications a pattern monitor can match to a filter.
+ *
+ * @param command The monitor's command, as formatted by @ref backend_nl80211_process_request_args
+ */
+static void
+nl80211_filter_add(nl80211_filter_t *filter, mmsm_data_item_t *command)
+{
+    nl80211_filter_vendor_t vendor = { 0 };
+    mmsm_data_item_t *item;
+    uint32_t cmd = command->mmsm_key.d.u32;
+
+    /* Raised by the backend itself, so never filtered */
+    if (command->mmsm_key.type == MMSM_KEY_TYPE_U32 && cmd == MMSM_BACKEND_NL80211_EVENTS_LOST)
+        return;
+
+    if (command->mmsm_key.type != MMSM_KEY_TYPE_U32 || cmd >= 64 * ARRAY_SIZE(filter->cmds))
+    {
+        filter->all = true;
+        return;
+    }
+
+    filter->cmds[cmd / 64] |= 1ULL << (cmd % 64);
+    if (cmd != NL80211_CMD_VENDOR)
+        return;
+
+    /* Attributes given without a value match any value, so don't narrow the filter */
+    for (item = command->mmsm_next; item; item = item->mmsm_next)
+    {
+        if (item->mmsm_value_len != sizeof(uint32_t))
+            continue;
+
+        if (item->mmsm_key.d.u32 == NL80211_ATTR_VENDOR_ID)
+        {
+            memcpy(&vendor.id, item->mmsm_value, sizeof(vendor.id));
+            vendor.has_id = true;
+        }
+        else if (item->mmsm_key.d.u32 == NL80211_ATTR_VENDOR_SUBCMD)
+        {
+            memcpy(&vendor.subcmd, item->mmsm_value, sizeof(vendor.subcmd));
+            vendor.has_subcmd = true;
+        }
+    }
+
+    if ((!vendor.has_id && !vendor.has_subcmd) || filter->num_vendor == NL80211_FILTER_MAX_VENDOR)
+        filter->any_vendor = true;
+    else
+        filter->vendor[filter->num_vendor++] = vendor;
+}
+
+
+/**
+ * Checks a vendor attribute of a notification against the value a monitor matches on.
+ */
+static bool
+nl80211_filter_vendor_attr_matches(struct nlattr *attr, bool has_value, uint32_t value)
+{
+    if (!has_value)
+        return true;
+
+    return attr && nla_len(attr) >= (int)sizeof(uint32_t) && nla_get_u32(attr) == value;
+}
+
+
+/**
+ * Checks whether a notification is let through by a filter, from its header and, for vendor
+ * events, its vendor ID and subcmd, without parsing the rest of it.
+ */
+static bool
+nl80211_filter_wants(const nl80211_filter_t *filter, struct genlmsghdr *gnlh)
+{
+    struct nlattr *attrs = genlmsg_attrdata(gnlh, 0);
+    int len = genlmsg_attrlen(gnlh, 0);
+    struct nlattr *id, *subcmd;
+    size_t i;
+
+    if (filter->all)
+        return true;
+
+    if (!(filter->cmds[gnlh->cmd / 64] & (1ULL << (gnlh->cmd % 64))))
+        return false;
+
+    if (gnlh->cmd != NL80211_CMD_VENDOR || filter->any_vendor)
+        return true;
+
+    id = nla_find(attrs, len, NL80211_ATTR_VENDOR_ID);
+    subcmd = nla_find(attrs, len, NL80211_ATTR_VENDOR_SUBCMD);
+    for (i = 0; i < filter->num_vendor; i++)
+    {
+        const nl80211_filter_vendor_t *vendor = &filter->vendor[i];
+
+        if (nl80211_filter_vendor_attr_matches(id, vendor->has_id, vendor->id) &&
+            nl80211_filter_vendor_attr_matches(subcmd, vendor->has_subcmd, vendor->subcmd))
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Installs a socket filter on the monitor socket that discards, in the kernel, notifications for
+ * commands the filter doesn't let through. Vendor events are only told apart once received.
+ *
+ * @returns 0 on success, otherwise -errno
+ */
+static int
+nl80211_filter_attach(int fd, const nl80211_filter_t *filter)
+{
+    /* Loading the command, a jump per command, then a return for each outcome */
+    struct sock_filter code[1 + 64 * ARRAY_SIZE(filter->cmds) + 2];
+    struct sock_fprog prog = { .filter = code };
+    unsigned int num_cmds = 0;
+    unsigned int cmd;
+    int unused = 0;
+
+    for (cmd = 0; cmd < 64 * ARRAY_SIZE(filter->cmds); cmd++)
+    {
+        if (filter->cmds[cmd / 64] & (1ULL << (cmd % 64)))
+            num_cmds++;
+    }
+
+    /* Jumps only reach 255 instructions ahead */
+    if (filter->all || num_cmds > 255)
+    {
+        if (setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) < 0 &&
+            errno != ENOENT)
+            return -errno;
+        return 0;
+    }
+
+    code[prog.len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+                                                    NLMSG_HDRLEN +
+                                                    offsetof(struct genlmsghdr, cmd));
+    for (cmd = 0; cmd < 64 * ARRAY_SIZE(filter->cmds); cmd++)
+    {
+        if (!(filter->cmds[cmd / 64] & (1ULL << (cmd % 64))))
+            continue;
+
+        /* Jump over the remaining commands and the discarding return */
+        code[prog.len] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cmd,
+                                                      num_cmds - (prog.len - 1), 0);
+        prog.len++;
+    }
+    code[prog.len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    code[prog.len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+        return -errno;
+
+    return 0;
+}
+
+
+static int
+nlCallback(struct nl_msg* msg, void* arg)
+{
+    nl80211_params_t *params = (nl80211_params_t *)arg;
+
+    struct nlmsghdr* ret_hdr = nlmsg_hdr(msg);
+    struct genlmsghdr *gnlh = nlmsg_data(ret_hdr);
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+    backend_nl80211_t *nl80211 = params->backend;
+    bool wanted;
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->monitor_filter_mutex) == 0);
+    wanted = nl80211_filter_wants(&nl80211->monitor_filter, gnlh);
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->monitor_filter_mutex) == 0);
+
+    /* No monitor can match it, so don't spend time parsing it */
+    if (!wanted)
+        return NL_SKIP;
+
+    trace_record(TRACE_NL80211, TRACE_EVENT, gnlh->cmd, 0, 0);
+    MMSM_PROBE1(nl80211__event, gnlh->cmd);
+
+    LOG_VERBOSE("RX: \n");
+    LOG_DATA(LOG_LEVEL_VERBOSE,
+             (uint8_t *)nlmsg_hdr(msg),
+             nlmsg_get_max_size(msg));
+
+    if (nl80211_datalog_sample(nl80211, msg))
+    {
+        datalog_write_string(nl80211->datalog, "Rx\n");
+        datalog_write_data(nl80211->datalog,
+            (uint8_t *)nlmsg_hdr(msg), nlmsg_get_max_size(msg));
+    }
+
+    mmsm_data_item_t **result = params->result;
+    mmsm_data_item_t *iter = NULL;
+    mmsm_data_item_t *entry = nl80211_msg_parse(params->arena, msg);
+
+    if (!entry)
+        return NL_STOP;
+
+    if (*result == NULL)
+    {
+        *result = entry;
+    }
+    else
+    {
+        iter = *result;
+        while (iter->mmsm_next)
+        {
+            iter = iter->mmsm_next;
+        }
+        iter->mmsm_next = entry;
+    }
+
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+          genlmsg_attrlen(gnlh, 0), NULL);
+
+    mmsm_data_item_set_key_u32(entry, gnlh->cmd);
+
+    return NL_OK;
+}
+
+
+static int
+backend_nl80211_monitor_get_fd(mmsm_backend_intf_t *intf)
+{
+    backend_nl80211_t *nl80211 =
+            get_container_from_intf(nl80211, intf);
+    int ret = 0;
+
+    if (nl80211->sock)
+        return nl_socket_get_fd(nl80211->sock);
+
+    nl80211->sock = nl_socket_alloc();
+    if (!nl80211->sock)
+    {
+        LOG_ERROR("Failed to open nl80211 interface\n");
+        return -1;
+    }
+    ret = genl_connect(nl80211->sock);
+    if (ret < 0)
+    {
+        LOG_ERROR("no connect\n");
+        goto fail;
+    }
+
+    if (nl80211->monitor_rx_buffer > 0 &&
+        nl_socket_set_buffer_size(nl80211->sock, nl80211->monitor_rx_buffer, 0) < 0)
+    {
+        LOG_WARN("Failed to set monitor receive buffer to %d\n", nl80211->monitor_rx_buffer);
+    }
+
+    ret = genl_ctrl_resolve(nl80211->sock, "nl80211");
+    ret = genl_ctrl_resolve_grp(nl80211->sock, "nl80211", "mlme");
+    if (ret < 0)
+    {
+        LOG_ERROR("MLME group not found\n");
+        goto fail;
+    }
+    ret = nl_socket_add_membership(nl80211->sock, ret);
+    if (ret < 0)
+    {
+        LOG_ERROR("MLME group not found\n");
+        goto fail;
+    }
+
+    ret = genl_ctrl_resolve_grp(nl80211->sock, "nl80211", "vendor");
+    if (ret < 0)
+    {
+        LOG_ERROR("vendor group not found\n");
+        goto fail;
+    }
+    ret = nl_socket_add_membership(nl80211->sock, ret);
+    if (ret < 0)
+    {
+        LOG_ERROR("vendor group not found\n");
+        goto fail;
+    }
+
+    nl_socket_disable_seq_check(nl80211->sock);
+
+    nl80211->monitor_params.backend = nl80211;
+    ret = nl_socket_modify_cb(nl80211->sock, NL_CB_VALID,
+                              NL_CB_CUSTOM, nlCallback, &nl80211->monitor_params);
+    if (ret < 0)
+    {
+        LOG_ERROR("Unable to register callback\n");
+        goto fail;
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->monitor_filter_mutex) == 0);
+    nl80211->monitor_fd = nl_socket_get_fd(nl80211->sock);
+    ret = nl80211_filter_attach(nl80211->monitor_fd, &nl80211->monitor_filter);
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->monitor_filter_mutex) == 0);
+    if (ret < 0)
+        LOG_WARN("Unable to filter notifications in the kernel: %d\n", ret);
+
+    return nl_socket_get_fd(nl80211->sock);
+
+fail:
+    nl_socket_free(nl80211->sock);
+    nl80211->sock = NULL;
+    return -1;
+}
+
+
+/**
+ * Counts an overflow of the monitor socket's receive buffer, and adds a
+ * @ref MMSM_BACKEND_NL80211_EVENTS_LOST notification to the result for the monitors to resync.
+ */
+static void
+nl80211_monitor_events_lost(backend_nl80211_t *nl80211, mmsm_data_item_t **result)
+{
+    uint64_t lost = __atomic_add_fetch(&nl80211->events_lost, 1, __ATOMIC_RELAXED);
+    mmsm_data_item_t *entry = mmsm_data_item_alloc_in(nl80211->monitor_params.arena);
+    mmsm_data_item_t *iter;
+
+    LOG_WARN("nl80211 notifications lost, receive buffer overflowed (%" PRIu64 " times)\n",
+             lost);
+
+    if (!entry)
+        return;
+
+    mmsm_data_item_set_key_u32(entry, MMSM_BACKEND_NL80211_EVENTS_LOST);
+    mmsm_data_item_set_val_bytes(entry, (uint8_t *)&lost, sizeof(lost));
+
+    if (*result == NULL)
+    {
+        *result = entry;
+        return;
+    }
+
+    for (iter = *result; iter->mmsm_next; iter = iter->mmsm_next)
+        ;
+    iter->mmsm_next = entry;
+}
+
+
+static mmsm_error_code
+backend_nl80211_monitor_recv(mmsm_backend_intf_t *intf,
+                             mmsm_data_item_t **result)
+{
+    backend_nl80211_t *nl80211 =
+            get_container_from_intf(nl80211, intf);
+    int ret;
+
+    nl80211->monitor_params.result = result;
+    nl80211->monitor_params.arena = mmsm_data_arena_create();
+    ret = nl_recvmsgs_default(nl80211->sock);
+    if (ret == -NLE_NOMEM)
+    {
+        /* ENOBUFS, the kernel had to discard notifications */
+        nl80211_monitor_events_lost(nl80211, result);
+    }
+    else if (ret < 0)
+    {
+        LOG_ERROR("Error receiving message\n");
+        __atomic_fetch_add(&nl80211->errors, 1, __ATOMIC_RELAXED);
+    }
+    mmsm_data_arena_put(nl80211->monitor_params.arena);
+    nl80211->monitor_params.arena = NULL;
+    nl80211->monitor_params.result = NULL;
+
+    return MMSM_SUCCESS;
+}
+
+
+/**
+ * Restricts the notifications parsed to the commands of the pattern monitors, and for vendor
+ * events to the vendor IDs and subcmds they match on. Commands are also filtered in the kernel,
+ * so other notifications aren't even received.
+ */
+static mmsm_error_code
+backend_nl80211_monitor_filter(mmsm_backend_intf_t *intf,
+                               mmsm_data_item_t *const *commands,
+                               size_t count)
+{
+    backend_nl80211_t *nl80211 =
+            get_container_from_intf(nl80211, intf);
+    nl80211_filter_t filter;
+    mmsm_error_code err = MMSM_SUCCESS;
+    size_t i;
+
+    memset(&filter, 0, sizeof(filter));
+    for (i = 0; i < count; i++)
+        nl80211_filter_add(&filter, commands[i]);
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->monitor_filter_mutex) == 0);
+    nl80211->monitor_filter = filter;
+    if (nl80211->monitor_fd >= 0 && nl80211_filter_attach(nl80211->monitor_fd, &filter) < 0)
+    {
+        /* The previous kernel filter may discard notifications the new monitors match */
+        memset(&nl80211->monitor_filter, 0, sizeof(nl80211->monitor_filter));
+        nl80211->monitor_filter.all = true;
+        if (nl80211_filter_attach(nl80211->monitor_fd, &nl80211->monitor_filter) < 0)
+            LOG_ERROR("Unable to remove the kernel notification filter\n");
+        err = MMSM_UNKNOWN_ERROR;
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->monitor_filter_mutex) == 0);
+
+    return err;
+}
+
+
+static mmsm_error_code
+backend_nl80211_ctrl_monitor(mmsm_backend_intf_t *intf,
+                             mmsm_data_item_t **result)
+{
+    int sk_fd;
+    fd_set rfds;
+    int ret = 0;
+    struct timeval tv;
+
+    sk_fd = backend_nl80211_monitor_get_fd(intf);
+    if (sk_fd < 0)
+        return MMSM_UNKNOWN_ERROR;
+
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+
+    FD_ZERO(&rfds);
+    FD_SET(sk_fd, &rfds);
+    ret = select(sk_fd + 1, &rfds, NULL, NULL, &tv);
+    if (ret <= 0)
+        return MMSM_SUCCESS;
+
+    return backend_nl80211_monitor_recv(intf, result);
+}
+
+
+/**
+ * Gets the netlink flags of a command, as formatted by @ref backend_nl80211_process_request_args.
+ */
+static uint16_t
+backend_nl80211_command_flags(mmsm_data_item_t *command)
+{
+    uint16_t cmd_flags;
+
+    memcpy(&cmd_flags, command->mmsm_value, sizeof(cmd_flags));
+    return cmd_flags;
+}
+
+
+/**
+ * Fills in a message from a command, as formatted by @ref backend_nl80211_process_request_args.
+ */
+static void
+backend_nl80211_put_command(struct nl_msg *msg, int id, mmsm_data_item_t *command)
+{
+    mmsm_data_item_t *cur = command;
+
+    genlmsg_put(msg,
+                NL_AUTO_PORT,
+                NL_AUTO_SEQ,
+                id,
+                0,
+                backend_nl80211_command_flags(command) | NLM_F_REQUEST,
+                cur->mmsm_key.d.u32,
+                0);
+
+    while (cur->mmsm_next)
+    {
+        cur = cur->mmsm_next;
+        nla_put(msg, cur->mmsm_key.d.u32, cur->mmsm_value_len, cur->mmsm_value);
+    }
+}
+
+
+/**
+ * Sends a command on a request socket and receives the whole reply.
+ *
+ * @param params Where the reply is built. Its arena is released before returning.
+ */
+static mmsm_error_code
+backend_nl80211_exchange(backend_nl80211_t *nl80211,
+                         mmsm_data_item_t *command,
+                         nl80211_params_t *params)
+{
+    nl80211_req_sock_t *req_sock = NULL;
+    struct nl_cb *nlcb = NULL;
+    bool broken = false;
+    int running = 1;
+    int ret = 0;
+    mmsm_error_code err = MMSM_SUCCESS;
+    uint64_t started_us = 0;
+    int id;
+
+    struct nl_msg* msg = nlmsg_alloc();
+    if (!msg)
+    {
+        LOG_ERROR("Failed to allocate netlink message.\n");
+        mmsm_data_arena_put(params->arena);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    req_sock = backend_nl80211_req_sock_get(nl80211, &id);
+    if (!req_sock)
+    {
+        LOG_ERROR("Failed to open nl80211 interface\n");
+        err = MMSM_UNKNOWN_ERROR;
+        goto exit;
+    }
+
+    nlcb = nl_cb_alloc(NL_CB_DEFAULT);
+    if (!nlcb)
+    {
+        LOG_ERROR("Failed to allocate callback\n");
+        err = MMSM_UNKNOWN_ERROR;
+        goto exit;
+    }
+
+    nl_cb_err(nlcb, NL_CB_CUSTOM, error_handler, &running);
+    nl_cb_set(nlcb, NL_CB_VALID , NL_CB_CUSTOM, sync_callback, params);
+    nl_cb_set(nlcb, NL_CB_FINISH, NL_CB_CUSTOM, sync_finish_handler, &running);
+    nl_cb_set(nlcb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &running);
+
+    backend_nl80211_put_command(msg, id, command);
+
+    params->logged = nl80211_datalog_sample(nl80211, msg);
+    if (params->logged)
+    {
+        datalog_write_string(nl80211->datalog, "Tx\n");
+        datalog_write_data(nl80211->datalog,
+            (uint8_t *)nlmsg_hdr(msg),
+            nlmsg_datalen(nlmsg_hdr(msg)) +  NLMSG_HDRLEN);
+    }
+
+    started_us = trace_begin(TRACE_NL80211, command->mmsm_key.d.u32, 0);
+    MMSM_PROBE1(nl80211__request__start, command->mmsm_key.d.u32);
+    ret = nl_send_auto(req_sock->sock, msg);
+
+    if (ret < 0)
+    {
+        LOG_ERROR("nl_send failed %d\n", ret);
+        err = MMSM_UNKNOWN_ERROR;
+        broken = true;
+        goto exit;
+    }
+
+    /* Positive indicates running, 0 indicates done, negative indicates error.
+     * Suppress coverity warning as it thinks the below loop will be an infinite loop.
+     * This is beacause coverity does not know the variable running will be updated by the netlink
+     * callback set previously by nl_cb_set.
+     */
+    /* coverity[loop_top:SUPPRESS] */
+    while (running > 0)
+    {
+        if ((ret = nl_recvmsgs(req_sock->sock, nlcb)) < 0)
+        {
+            LOG_ERROR("Error on nl_recvmsgs %d\n", ret);
+            /* The rest of the reply may still be queued, so the socket can't be reused */
+            broken = true;
+            running = ret;
+        }
+    }
+
+    err = (running < 0) ? MMSM_UNKNOWN_ERROR : MMSM_SUCCESS;
+
+exit:
+    if (started_us)
+    {
+        uint32_t latency_us = trace_end(TRACE_NL80211, command->mmsm_key.d.u32, err, started_us);
+
+        MMSM_PROBE3(nl80211__request__done, command->mmsm_key.d.u32, err, latency_us);
+    }
+
+    if (nlcb)
+        nl_cb_put(nlcb);
+
+    if (msg)
+        nlmsg_free(msg);
+
+    if (req_sock)
+        backend_nl80211_req_sock_put(nl80211, req_sock, broken);
+
+    mmsm_data_arena_put(params->arena);
+
+    return err;
+}
+
+
+static mmsm_error_code
+backend_nl80211_sync_command(mmsm_backend_intf_t *intf,
+                             mmsm_data_item_t *command,
+                             mmsm_data_item_t **result)
+{
+    backend_nl80211_t *nl80211 =
+            get_container_from_intf(nl80211, intf);
+    nl80211_params_t params = {
+        .backend = nl80211,
+        .result = result,
+        .arena = mmsm_data_arena_create(),
+    };
+
+    return backend_nl80211_exchange(nl80211, command, &params);
+}
+
+
+static uint64_t
+nl80211_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Wakes the submit thread.
+ */
+static void
+nl80211_submit_wake(backend_nl80211_t *nl80211)
+{
+    uint64_t one = 1;
+
+    if (write(nl80211->submit_wake_fd, &one, sizeof(one)) < 0)
+        LOG_ERROR("Failed to wake nl80211 submit thread: %d\n", errno);
+}
+
+
+/**
+ * Completes a submitted request and frees it.
+ */
+static void
+nl80211_submit_finish(nl80211_submit_t *submit, mmsm_error_code err)
+{
+    mmsm_data_item_t *result = submit->result;
+
+    if (submit->started_us)
+    {
+        uint32_t latency_us = trace_end(TRACE_NL80211, submit->cmd, err, submit->started_us);
+
+        MMSM_PROBE3(nl80211__request__done, submit->cmd, err, latency_us);
+    }
+
+    if (err != MMSM_SUCCESS)
+    {
+        mmsm_data_item_free(result);
+        result = NULL;
+    }
+    mmsm_data_arena_put(submit->params.arena);
+
+    submit->done(submit->arg, err, result);
+    free(submit);
+}
+
+
+/**
+ * Takes a request that is in flight out of the in flight list.
+ *
+ * @return the request, or NULL if none is in flight with the sequence number
+ */
+static nl80211_submit_t *
+nl80211_submit_take(backend_nl80211_t *nl80211, uint32_t seq)
+{
+    nl80211_submit_t **link;
+
+    for (link = &nl80211->in_flight; *link; link = &(*link)->next)
+    {
+        nl80211_submit_t *submit = *link;
+
+        if (submit->seq != seq)
+            continue;
+
+        *link = submit->next;
+        nl80211->num_in_flight--;
+        return submit;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Finds a request that is in flight by the sequence number its replies carry.
+ */
+static nl80211_submit_t *
+nl80211_submit_find(backend_nl80211_t *nl80211, uint32_t seq)
+{
+    nl80211_submit_t *submit;
+
+    for (submit = nl80211->in_flight; submit; submit = submit->next)
+    {
+        if (submit->seq == seq)
+            return submit;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Replies to several requests can arrive in one read, so the handlers below return NL_SKIP
+ * rather than NL_STOP to carry on with the rest. Replies that match no request in flight, e.g.
+ * to one that has timed out, are dropped.
+ */
+
+static int
+nl80211_submit_valid_handler(struct nl_msg *msg, void *arg)
+{
+    nl80211_submit_t *submit = nl80211_submit_find(arg, nlmsg_hdr(msg)->nlmsg_seq);
+
+    if (submit)
+        sync_callback(msg, &submit->params);
+
+    return NL_SKIP;
+}
+
+
+static int
+nl80211_submit_done_handler(struct nl_msg *msg, void *arg)
+{
+    nl80211_submit_t *submit = nl80211_submit_take(arg, nlmsg_hdr(msg)->nlmsg_seq);
+
+    if (submit)
+        nl80211_submit_finish(submit, MMSM_SUCCESS);
+
+    return NL_SKIP;
+}
+
+
+static int
+nl80211_submit_error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+    /* The error carries the header of the request it is for */
+    nl80211_submit_t *submit = nl80211_submit_take(arg, err->msg.nlmsg_seq);
+
+    if (submit)
+    {
+        LOG_ERROR("Error in NL command %d\n", err->error);
+        nl80211_submit_finish(submit, MMSM_UNKNOWN_ERROR);
+    }
+
+    return NL_SKIP;
+}
+
+
+static int
+nl80211_submit_seq_check(struct nl_msg *msg, void *arg)
+{
+    /* Several requests are in flight, so any of their sequence numbers may arrive */
+    return NL_OK;
+}
+
+
+/**
+ * Closes the submit socket and fails every request in flight on it.
+ */
+static void
+nl80211_submit_reset(backend_nl80211_t *nl80211)
+{
+    nl80211_submit_t *submit = nl80211->in_flight;
+
+    nl80211->in_flight = NULL;
+    nl80211->num_in_flight = 0;
+    while (submit)
+    {
+        nl80211_submit_t *next = submit->next;
+
+        nl80211_submit_finish(submit, MMSM_UNKNOWN_ERROR);
+        submit = next;
+    }
+
+    if (nl80211->submit_sock)
+    {
+        nl_close(nl80211->submit_sock);
+        nl_socket_free(nl80211->submit_sock);
+        nl80211->submit_sock = NULL;
+    }
+}
+
+
+/**
+ * Connects the submit socket.
+ *
+ * @return 0 on success, or -1
+ */
+static int
+nl80211_submit_connect(backend_nl80211_t *nl80211)
+{
+    int id = nl80211->family_id;
+
+    nl80211->submit_sock = backend_nl80211_socket_connect(nl80211->request_rx_buffer,
+                                                          id ? NULL : &id);
+    if (!nl80211->submit_sock)
+        return -1;
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->req_socks_mutex) == 0);
+    nl80211->family_id = id;
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->req_socks_mutex) == 0);
+
+    if (nl80211->request_rx_buffer < NL80211_SUBMIT_RX_BUFFER_SIZE)
+        nl_socket_set_buffer_size(nl80211->submit_sock, NL80211_SUBMIT_RX_BUFFER_SIZE, 0);
+    if (nl_socket_set_nonblocking(nl80211->submit_sock) < 0)
+    {
+        LOG_ERROR("Failed to make nl80211 submit socket non-blocking\n");
+        nl80211_submit_reset(nl80211);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Sends a submitted request on the submit socket and adds it to the in flight list.
+ */
+static void
+nl80211_submit_send(backend_nl80211_t *nl80211, nl80211_submit_t *submit)
+{
+    struct nl_msg *msg = nlmsg_alloc();
+    int ret;
+
+    if (!msg)
+    {
+        LOG_ERROR("Failed to allocate netlink message.\n");
+        nl80211_submit_finish(submit, MMSM_UNKNOWN_ERROR);
+        return;
+    }
+
+    backend_nl80211_put_command(msg, nl80211->family_id, submit->command);
+    submit->params.logged = nl80211_datalog_sample(nl80211, msg);
+    if (submit->params.logged)
+    {
+        datalog_write_string(nl80211->datalog, "Tx\n");
+        datalog_write_data(nl80211->datalog,
+            (uint8_t *)nlmsg_hdr(msg),
+            nlmsg_datalen(nlmsg_hdr(msg)) +  NLMSG_HDRLEN);
+    }
+
+    submit->cmd = submit->command->mmsm_key.d.u32;
+    submit->started_us = trace_begin(TRACE_NL80211, submit->cmd, 0);
+    MMSM_PROBE1(nl80211__request__start, submit->cmd);
+    ret = nl_send_auto(nl80211->submit_sock, msg);
+    if (ret < 0)
+    {
+        LOG_ERROR("nl_send failed %d\n", ret);
+        __atomic_fetch_add(&nl80211->errors, 1, __ATOMIC_RELAXED);
+        nlmsg_free(msg);
+        nl80211_submit_finish(submit, MMSM_UNKNOWN_ERROR);
+        return;
+    }
+
+    /* nl_send_auto fills in the sequence number */
+    submit->seq = nlmsg_hdr(msg)->nlmsg_seq;
+    submit->deadline_us = nl80211_now_us() + NL80211_SUBMIT_TIMEOUT_MS * 1000ull;
+    nlmsg_free(msg);
+
+    submit->next = nl80211->in_flight;
+    nl80211->in_flight = submit;
+    nl80211->num_in_flight++;
+}
+
+
+/**
+ * Checks whether a dump is in flight.
+ */
+static bool
+nl80211_submit_dump_in_flight(backend_nl80211_t *nl80211)
+{
+    nl80211_submit_t *submit;
+
+    for (submit = nl80211->in_flight; submit; submit = submit->next)
+    {
+        if (submit->dump)
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Sends queued requests, in order, until the in flight limit is reached or the next is a dump
+ * that has to wait for another to finish.
+ */
+static void
+nl80211_submit_start(backend_nl80211_t *nl80211)
+{
+    while (nl80211->num_in_flight < NL80211_SUBMIT_MAX_IN_FLIGHT)
+    {
+        nl80211_submit_t *submit;
+
+        MMSM_ASSERT(pthread_mutex_lock(&nl80211->submit_mutex) == 0);
+        submit = nl80211->submit_head;
+        if (submit && submit->dump && nl80211_submit_dump_in_flight(nl80211))
+            submit = NULL;
+
+        if (submit)
+        {
+            nl80211->submit_head = submit->next;
+            if (!nl80211->submit_head)
+                nl80211->submit_tail = &nl80211->submit_head;
+        }
+        MMSM_ASSERT(pthread_mutex_unlock(&nl80211->submit_mutex) == 0);
+
+        if (!submit)
+            return;
+
+        if (!nl80211->submit_sock && nl80211_submit_connect(nl80211) != 0)
+        {
+            LOG_ERROR("Failed to open nl80211 interface\n");
+            nl80211_submit_finish(submit, MMSM_UNKNOWN_ERROR);
+            continue;
+        }
+
+        nl80211_submit_send(nl80211, submit);
+    }
+}
+
+
+/**
+ * Fails requests in flight whose replies are overdue.
+ *
+ * @return the time in milliseconds until the next is due, or -1 if none is in flight
+ */
+static int
+nl80211_submit_expire(backend_nl80211_t *nl80211)
+{
+    uint64_t now = nl80211_now_us();
+    nl80211_submit_t **link = &nl80211->in_flight;
+    int timeout_ms = -1;
+
+    while (*link)
+    {
+        nl80211_submit_t *submit = *link;
+        int remaining_ms;
+
+        if (submit->deadline_us > now)
+        {
+            remaining_ms = (submit->deadline_us - now + 999) / 1000;
+            if (timeout_ms < 0 || remaining_ms < timeout_ms)
+                timeout_ms = remaining_ms;
+            link = &submit->next;
+            continue;
+        }
+
+        LOG_ERROR("Timed out waiting for nl80211 reply %u\n", submit->seq);
+        if (submit->dump)
+        {
+            /* The kernel may still be running the dump, which would block the next one */
+            nl80211_submit_reset(nl80211);
+            return -1;
+        }
+
+        *link = submit->next;
+        nl80211->num_in_flight--;
+        nl80211_submit_finish(submit, MMSM_UNKNOWN_ERROR);
+    }
+
+    return timeout_ms;
+}
+
+
+/**
+ * Sends submitted requests on one socket without waiting for the replies to those before, and
+ * hands back their replies as they arrive.
+ */
+static void *
+nl80211_submit_thread_fn(void *arg)
+{
+    backend_nl80211_t *nl80211 = (backend_nl80211_t *)arg;
+    nl80211_submit_t *submit;
+    bool stopping = false;
+
+    while (!stopping)
+    {
+        struct pollfd pfds[2];
+        size_t in_flight;
+        size_t num = 0;
+        uint64_t wake;
+        int timeout_ms;
+        int ret;
+
+        /*
+         * Expiring requests frees their slots, as does resetting the socket, so start any queued
+         * behind them before waiting, until nothing more expires
+         */
+        do
+        {
+            nl80211_submit_start(nl80211);
+            in_flight = nl80211->num_in_flight;
+            timeout_ms = nl80211_submit_expire(nl80211);
+        } while (nl80211->num_in_flight != in_flight);
+
+        pfds[num].fd = nl80211->submit_wake_fd;
+        pfds[num++].events = POLLIN;
+        if (nl80211->submit_sock && nl80211->in_flight)
+        {
+            pfds[num].fd = nl_socket_get_fd(nl80211->submit_sock);
+            pfds[num++].events = POLLIN;
+        }
+
+        if (poll(pfds, num, timeout_ms) < 0)
+        {
+            if (errno != EINTR)
+                LOG_ERROR("nl80211 submit poll failed: %d\n", errno);
+            continue;
+        }
+
+        if (pfds[0].revents && read(nl80211->submit_wake_fd, &wake, sizeof(wake)) < 0)
+            LOG_ERROR("Failed to clear nl80211 submit wake up: %d\n", errno);
+
+        if (num > 1 && pfds[1].revents)
+        {
+            ret = nl_recvmsgs(nl80211->submit_sock, nl80211->submit_cb);
+            if (ret < 0 && ret != -NLE_AGAIN)
+            {
+                /* e.g. replies were dropped because the receive buffer overflowed */
+                LOG_ERROR("Error on nl_recvmsgs %d\n", ret);
+                __atomic_fetch_add(&nl80211->errors, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&nl80211->reconnects, 1, __ATOMIC_RELAXED);
+                nl80211_submit_reset(nl80211);
+            }
+        }
+
+        MMSM_ASSERT(pthread_mutex_lock(&nl80211->submit_mutex) == 0);
+        stopping = nl80211->submit_stopping;
+        MMSM_ASSERT(pthread_mutex_unlock(&nl80211->submit_mutex) == 0);
+    }
+
+    /* Fail whatever is left, in flight or queued */
+    nl80211_submit_reset(nl80211);
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->submit_mutex) == 0);
+    submit = nl80211->submit_head;
+    nl80211->submit_head = NULL;
+    nl80211->submit_tail = &nl80211->submit_head;
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->submit_mutex) == 0);
+
+    while (submit)
+    {
+        nl80211_submit_t *next = submit->next;
+
+        nl80211_submit_finish(submit, MMSM_UNKNOWN_ERROR);
+        submit = next;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Starts the submit thread. Must be called with submit_mutex held.
+ *
+ * @return 0 on success, or -1
+ */
+static int
+nl80211_submit_thread_start(backend_nl80211_t *nl80211)
+{
+    nl80211->submit_cb = nl_cb_alloc(NL_CB_DEFAULT);
+    if (!nl80211->submit_cb)
+        return -1;
+
+    nl_cb_err(nl80211->submit_cb, NL_CB_CUSTOM, nl80211_submit_error_handler, nl80211);
+    nl_cb_set(nl80211->submit_cb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_submit_valid_handler,
+              nl80211);
+    nl_cb_set(nl80211->submit_cb, NL_CB_FINISH, NL_CB_CUSTOM, nl80211_submit_done_handler,
+              nl80211);
+    nl_cb_set(nl80211->submit_cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_submit_done_handler, nl80211);
+    nl_cb_set(nl80211->submit_cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, nl80211_submit_seq_check, NULL);
+
+    nl80211->submit_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (nl80211->submit_wake_fd < 0)
+        goto fail;
+
+    if (pthread_create(&nl80211->submit_thread, NULL, nl80211_submit_thread_fn, nl80211) != 0)
+    {
+        close(nl80211->submit_wake_fd);
+        goto fail;
+    }
+
+    nl80211->submit_started = true;
+    return 0;
+
+fail:
+    nl_cb_put(nl80211->submit_cb);
+    nl80211->submit_cb = NULL;
+    return -1;
+}
+
+
+static mmsm_error_code
+backend_nl80211_submit(mmsm_backend_intf_t *intf,
+                       mmsm_data_item_t *command,
+                       mmsm_backend_completion_fn_t done,
+                       void *arg)
+{
+    backend_nl80211_t *nl80211 = get_container_from_intf(nl80211, intf);
+    nl80211_submit_t *submit = calloc(1, sizeof(*submit));
+    mmsm_error_code err = MMSM_SUCCESS;
+
+    if (!submit)
+        return MMSM_UNKNOWN_ERROR;
+
+    submit->command = command;
+    submit->done = done;
+    submit->arg = arg;
+    submit->dump = backend_nl80211_command_flags(command) & NLM_F_DUMP;
+    submit->params.backend = nl80211;
+    submit->params.result = &submit->result;
+    submit->params.arena = mmsm_data_arena_create();
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->submit_mutex) == 0);
+    if (!nl80211->submit_started && nl80211_submit_thread_start(nl80211) != 0)
+    {
+        LOG_ERROR("Failed to start nl80211 submit thread\n");
+        err = MMSM_UNKNOWN_ERROR;
+        goto exit;
+    }
+
+    *nl80211->submit_tail = submit;
+    nl80211->submit_tail = &submit->next;
+    nl80211_submit_wake(nl80211);
+    submit = NULL;
+
+exit:
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->submit_mutex) == 0);
+    if (submit)
+    {
+        mmsm_data_arena_put(submit->params.arena);
+        free(submit);
+    }
+    return err;
+}
+
+
+mmsm_error_code
+mmsm_backend_nl80211_dump(mmsm_backend_intf_t *handle,
+                          size_t batch_size,
+                          mmsm_backend_nl80211_dump_fn_t fn,
+                          void *context,
+                          ...)
+{
+    backend_nl80211_t *nl80211 = get_container_from_intf(nl80211, handle);
+    mmsm_data_item_t *result = NULL;
+    mmsm_data_item_t *command;
+    mmsm_error_code err;
+    uint16_t cmd_flags;
+    va_list args;
+    nl80211_params_t params = {
+        .backend = nl80211,
+        .result = &result,
+        .stream_fn = fn,
+        .stream_context = context,
+        .stream_batch = batch_size ? batch_size : 1,
+    };
+
+    va_start(args, context);
+    command = backend_nl80211_process_request_args(handle, args);
+    va_end(args);
+
+    if (!command)
+        return MMSM_UNKNOWN_ERROR;
+
+    cmd_flags = backend_nl80211_command_flags(command) | NLM_F_DUMP;
+    memcpy(command->mmsm_value, &cmd_flags, sizeof(cmd_flags));
+
+    params.arena = mmsm_data_arena_create();
+    err = backend_nl80211_exchange(nl80211, command, &params);
+    mmsm_data_item_free(command);
+
+    /* Hand over the last, partial batch, unless the dump was cut short */
+    if (err == MMSM_SUCCESS && result)
+        fn(context, result);
+    mmsm_data_item_free(result);
+
+    return err;
+}
+
+
+/**
+ * One of the requests exchanged by @ref mmsm_backend_nl80211_request_many
+ */
+typedef struct nl80211_many_t
+{
+    /** Where the reply is built */
+    nl80211_params_t params;
 
-        if (iter != NULL)
-        {
-            iter = mmsm_data_item_alloc_next(iter);
-        }
-        else
-        {
-            head = mmsm_data_item_alloc();
-            iter = head;
-        }
+    /** Sequence number the request was sent with, which its replies carry */
+    uint32_t seq;
 
-        mmsm_data_item_set_key_u32(iter, attr);
-        mmsm_data_item_set_val_bytes(iter, data, length);
+    /** Set once the request has been acknowledged or has failed */
+    bool done;
 
-        if (attr_looks_nested((struct nlattr *)data, length))
-        {
-            iter->mmsm_sub_values = navigate_attrs((struct nlattr *)data,
-                                                   length);
-        }
-    }
+    /** Whether the request failed */
+    bool failed;
 
-    return head;
-}
+    /** The NL80211_CMD_* sent, and when, for the flight recorder. started_us is 0 until sent. */
+    uint16_t cmd;
+    uint64_t started_us;
+} nl80211_many_t;
 
 
-static int
-sync_callback(struct nl_msg *msg, void *arg)
+typedef struct nl80211_many_batch_t
 {
-    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-    struct nlattr *nla;
-    int len;
-    nl80211_params_t *params = (nl80211_params_t *)arg;
+    nl80211_many_t *reqs;
 
-    LOG_VERBOSE("RX: \n");
-    LOG_DATA(LOG_LEVEL_VERBOSE,
-             (uint8_t *)nlmsg_hdr(msg),
-             nlmsg_get_max_size(msg));
-    datalog_write_string(params->backend->datalog, "Rx\n");
-    datalog_write_data(params->backend->datalog,
-        (uint8_t *)nlmsg_hdr(msg), nlmsg_get_max_size(msg));
+    /** Number of requests sent */
+    size_t sent;
 
-    mmsm_data_item_t **result = params->result;
-    mmsm_data_item_t *iter = NULL;
-    mmsm_data_item_t *entry = mmsm_data_item_alloc();
+    /** Number of requests sent and not yet done */
+    size_t remaining;
+} nl80211_many_batch_t;
 
-    nla = genlmsg_attrdata(gnlh, 0);
-    len = genlmsg_attrlen(gnlh, 0);
 
-    entry->mmsm_sub_values = navigate_attrs(nla, len);
+static nl80211_many_t *
+nl80211_many_find(nl80211_many_batch_t *batch, uint32_t seq)
+{
+    size_t i;
 
-    if (*result == NULL)
-    {
-        *result = entry;
-    }
-    else
+    for (i = 0; i < batch->sent; i++)
     {
-        iter = *result;
-        while (iter->mmsm_next)
-        {
-            iter = iter->mmsm_next;
-        }
-        iter->mmsm_next = entry;
+        if (batch->reqs[i].seq == seq && !batch->reqs[i].done)
+            return &batch->reqs[i];
     }
 
-    return NL_OK;
+    return NULL;
 }
 
 
-static int sync_finish_handler(struct nl_msg *msg, void *arg)
+static void
+nl80211_many_finish(nl80211_many_batch_t *batch, nl80211_many_t *req, bool failed)
 {
-    int *ret = arg;
-    *ret = 0;
+    uint32_t latency_us;
 
-    return NL_SKIP;
+    req->done = true;
+    req->failed = failed;
+    batch->remaining--;
+    latency_us = trace_end(TRACE_NL80211, req->cmd, failed, req->started_us);
+    MMSM_PROBE3(nl80211__request__done, req->cmd, failed, latency_us);
 }
 
-static int ack_handler(struct nl_msg *msg, void *arg)
-{
-    int *ret = arg;
-    *ret = 0;
 
-    return NL_STOP;
-}
+/*
+ * As for the submit socket, the replies to several requests can arrive in one read, so these
+ * handlers return NL_SKIP to carry on with the rest.
+ */
 
-static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+static int
+nl80211_many_valid_handler(struct nl_msg *msg, void *arg)
 {
-    int *ret = arg;
+    nl80211_many_t *req = nl80211_many_find(arg, nlmsg_hdr(msg)->nlmsg_seq);
 
-    if (err->error > 0)
-    {
-        *ret = err->error;
-    }
-    else
-    {
-        *ret = -EPROTO;
-    }
-    LOG_ERROR("Error in NL command %d\n", err->error);
-    return NL_STOP;
+    if (req)
+        sync_callback(msg, &req->params);
+
+    return NL_SKIP;
 }
 
 
 static int
-nlCallback(struct nl_msg* msg, void* arg)
+nl80211_many_ack_handler(struct nl_msg *msg, void *arg)
 {
-    struct nlattr *nla;
-    int len;
-    nl80211_params_t *params = (nl80211_params_t *)arg;
-
-    struct nlmsghdr* ret_hdr = nlmsg_hdr(msg);
-    struct genlmsghdr *gnlh = nlmsg_data(ret_hdr);
-    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+    nl80211_many_t *req = nl80211_many_find(arg, nlmsg_hdr(msg)->nlmsg_seq);
 
-    LOG_VERBOSE("RX: \n");
-    LOG_DATA(LOG_LEVEL_VERBOSE,
-             (uint8_t *)nlmsg_hdr(msg),
-             nlmsg_get_max_size(msg));
-
-    datalog_write_string(params->backend->datalog, "Rx\n");
-    datalog_write_data(params->backend->datalog,
-        (uint8_t *)nlmsg_hdr(msg), nlmsg_get_max_size(msg));
-
-    mmsm_data_item_t **result = params->result;
-    mmsm_data_item_t *iter = NULL;
-    mmsm_data_item_t *entry = mmsm_data_item_alloc();
+    if (req)
+        nl80211_many_finish(arg, req, false);
 
-    if (!entry)
-        return NL_STOP;
+    return NL_SKIP;
+}
 
-    nla = genlmsg_attrdata(gnlh, 0);
-    len = genlmsg_attrlen(gnlh, 0);
 
-    entry->mmsm_sub_values = navigate_attrs(nla, len);
+static int
+nl80211_many_error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+    /* The error carries the header of the request it is for */
+    nl80211_many_t *req = nl80211_many_find(arg, err->msg.nlmsg_seq);
 
-    if (*result == NULL)
-    {
-        *result = entry;
-    }
-    else
+    if (req)
     {
-        iter = *result;
-        while (iter->mmsm_next)
-        {
-            iter = iter->mmsm_next;
-        }
-        iter->mmsm_next = entry;
+        LOG_ERROR("Error in NL command %d\n", err->error);
+        nl80211_many_finish(arg, req, true);
     }
 
-    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
-          genlmsg_attrlen(gnlh, 0), NULL);
-
-    mmsm_data_item_set_key_u32(entry, gnlh->cmd);
-
-    return NL_OK;
+    return NL_SKIP;
 }
 
 
-static mmsm_error_code
-backend_nl80211_ctrl_monitor(mmsm_backend_intf_t *intf,
-                             mmsm_data_item_t **result)
+/**
+ * Writes the requests of a batch to a socket, without waiting for any reply.
+ *
+ * @return 0 on success, or a negative value if a request couldn't be sent, in which case the
+ *         requests sent before it are still in flight
+ */
+static int
+nl80211_many_send(backend_nl80211_t *nl80211, struct nl_sock *sock, int id,
+                  mmsm_data_item_t *const *commands, size_t count,
+                  nl80211_many_batch_t *batch)
 {
-    mmsm_error_code err = MMSM_SUCCESS;
-    backend_nl80211_t *nl80211 =
-            get_container_from_intf(nl80211, intf);
-    nl80211_params_t params = {
-        .backend = nl80211,
-        .result = result
-    };
-    int sk_fd;
-    fd_set rfds;
+    struct nl_msg *msg;
     int ret = 0;
 
-    if (nl80211->sock == NULL)
+    for (batch->sent = 0; batch->sent < count; batch->sent++)
     {
-        nl80211->sock = nl_socket_alloc();
-        if (!nl80211->sock)
-        {
-            LOG_ERROR("Failed to open nl80211 interface\n");
-            err = MMSM_UNKNOWN_ERROR;
-            goto done;
-        }
-        ret = genl_connect(nl80211->sock);
-        if (ret < 0)
-        {
-            LOG_ERROR("no connect\n");
-            goto done;
-        }
+        nl80211_many_t *req = &batch->reqs[batch->sent];
 
-        ret = genl_ctrl_resolve(nl80211->sock, "nl80211");
-        ret = genl_ctrl_resolve_grp(nl80211->sock, "nl80211", "mlme");
-        if (ret < 0)
-        {
-            LOG_ERROR("MLME group not found\n");
-            goto done;
-        }
-        ret = nl_socket_add_membership(nl80211->sock, ret);
-        if (ret < 0)
+        msg = nlmsg_alloc();
+        if (!msg)
         {
-            LOG_ERROR("MLME group not found\n");
-            goto done;
+            LOG_ERROR("Failed to allocate netlink message.\n");
+            return -ENOMEM;
         }
 
-        ret = genl_ctrl_resolve_grp(nl80211->sock, "nl80211", "vendor");
-        if (ret < 0)
-        {
-            LOG_ERROR("vendor group not found\n");
-            goto done;
-        }
-        ret = nl_socket_add_membership(nl80211->sock, ret);
-        if (ret < 0)
+        backend_nl80211_put_command(msg, id, commands[batch->sent]);
+
+        req->params.logged = nl80211_datalog_sample(nl80211, msg);
+        if (req->params.logged)
         {
-            LOG_ERROR("vendor group not found\n");
-            goto done;
+            datalog_write_string(nl80211->datalog, "Tx\n");
+            datalog_write_data(nl80211->datalog,
+                (uint8_t *)nlmsg_hdr(msg),
+                nlmsg_datalen(nlmsg_hdr(msg)) + NLMSG_HDRLEN);
         }
 
-        nl_socket_disable_seq_check(nl80211->sock);
+        req->cmd = commands[batch->sent]->mmsm_key.d.u32;
+        req->started_us = trace_begin(TRACE_NL80211, req->cmd, 0);
+        MMSM_PROBE1(nl80211__request__start, req->cmd);
+        ret = nl_send_auto(sock, msg);
+        req->seq = nlmsg_hdr(msg)->nlmsg_seq;
+        nlmsg_free(msg);
 
-        ret = nl_socket_modify_cb(nl80211->sock, NL_CB_VALID,
-                                  NL_CB_CUSTOM, nlCallback, &params);
         if (ret < 0)
         {
-            LOG_ERROR("Unable to register callback\n");
-            goto done;
+            LOG_ERROR("nl_send failed %d\n", ret);
+            return ret;
         }
-    }
-    struct timeval tv;
-
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-
-    FD_ZERO(&rfds);
-
-    sk_fd = nl_socket_get_fd(nl80211->sock);
-    FD_SET(sk_fd, &rfds);
-    ret = select(sk_fd + 1, &rfds, NULL, NULL, &tv);
-    if (ret == 0)
-    {
-        goto done;
-    }
 
-    ret = nl_recvmsgs_default(nl80211->sock);
-    if (ret < 0) {
-        LOG_ERROR("Error receiving message\n");
+        batch->remaining++;
     }
 
-done:
-
-    return err;
+    return 0;
 }
 
 
-static mmsm_error_code
-backend_nl80211_sync_command(mmsm_backend_intf_t *intf,
-                             mmsm_data_item_t *command,
-                             mmsm_data_item_t **result)
+mmsm_error_code
+mmsm_backend_nl80211_request_many(mmsm_backend_intf_t *handle,
+                                  mmsm_data_item_t *const *commands,
+                                  size_t count,
+                                  mmsm_data_item_t **results)
 {
-    struct nl_sock *sock = NULL;
+    backend_nl80211_t *nl80211 = get_container_from_intf(nl80211, handle);
+    nl80211_many_batch_t batch = { 0 };
+    nl80211_req_sock_t *req_sock = NULL;
     struct nl_cb *nlcb = NULL;
-    int running = 1;
-    int ret = 0;
     mmsm_error_code err = MMSM_SUCCESS;
+    bool broken = false;
+    size_t i;
+    int ret;
     int id;
-    mmsm_data_item_t *cur;
-    backend_nl80211_t *nl80211 =
-            get_container_from_intf(nl80211, intf);
-    nl80211_params_t params = {
-        .backend = nl80211,
-        .result = result
-    };
 
-    struct nl_msg* msg = nlmsg_alloc();
-    if (!msg)
+    for (i = 0; i < count; i++)
     {
-        LOG_ERROR("Failed to allocate netlink message.\n");
+        results[i] = NULL;
+        if (backend_nl80211_command_flags(commands[i]) & NLM_F_DUMP)
+        {
+            LOG_ERROR("Dumps can't be batched\n");
+            return MMSM_UNKNOWN_ERROR;
+        }
+    }
+
+    if (!count)
+        return MMSM_SUCCESS;
+
+    batch.reqs = calloc(count, sizeof(*batch.reqs));
+    if (!batch.reqs)
         return MMSM_UNKNOWN_ERROR;
+
+    for (i = 0; i < count; i++)
+    {
+        batch.reqs[i].params.backend = nl80211;
+        batch.reqs[i].params.result = &results[i];
+        batch.reqs[i].params.arena = mmsm_data_arena_create();
     }
 
-    sock = backend_nl80211_socket_connect(&id);
-    if (!sock)
+    req_sock = backend_nl80211_req_sock_get(nl80211, &id);
+    if (!req_sock)
     {
         LOG_ERROR("Failed to open nl80211 interface\n");
         err = MMSM_UNKNOWN_ERROR;
@@ -426,82 +2198,69 @@ backend_nl80211_sync_command(mmsm_backend_intf_t *intf,
         goto exit;
     }
 
-    datalog_write_string(nl80211->datalog, "Tx\n");
-    datalog_write_data(nl80211->datalog,
-        (uint8_t *)nlmsg_hdr(msg),
-        nlmsg_datalen(nlmsg_hdr(msg)) +  NLMSG_HDRLEN);
-
-    nl_cb_err(nlcb, NL_CB_CUSTOM, error_handler, &running);
-    nl_cb_set(nlcb, NL_CB_VALID , NL_CB_CUSTOM, sync_callback, &params);
-    nl_cb_set(nlcb, NL_CB_FINISH, NL_CB_CUSTOM, sync_finish_handler, &running);
-    nl_cb_set(nlcb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &running);
-
-    cur = command;
-
-    uint16_t cmd_flags;
-    memcpy(&cmd_flags, cur->mmsm_value, sizeof(cmd_flags));
-
-    genlmsg_put(msg,
-                NL_AUTO_PORT,
-                NL_AUTO_SEQ,
-                id,
-                0,
-                cmd_flags | NLM_F_REQUEST,
-                cur->mmsm_key.d.u32,
-                0);
-
-    while (cur->mmsm_next)
-    {
-        cur = cur->mmsm_next;
-        nla_put(msg, cur->mmsm_key.d.u32, cur->mmsm_value_len, cur->mmsm_value);
-    }
-
-    ret = nl_send_auto(sock, msg);
+    nl_cb_err(nlcb, NL_CB_CUSTOM, nl80211_many_error_handler, &batch);
+    nl_cb_set(nlcb, NL_CB_VALID, NL_CB_CUSTOM, nl80211_many_valid_handler, &batch);
+    nl_cb_set(nlcb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_many_ack_handler, &batch);
+    nl_cb_set(nlcb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, nl80211_submit_seq_check, NULL);
 
-    if (ret < 0)
+    if (nl80211_many_send(nl80211, req_sock->sock, id, commands, count, &batch) < 0)
     {
-        LOG_ERROR("nl_send failed %d\n", ret);
+        /* The requests already sent are still answered, so the socket can't be reused */
+        err = MMSM_UNKNOWN_ERROR;
+        broken = true;
     }
 
-    /* Positive indicates running, 0 indicates done, negative indicates error.
-     * Suppress coverity warning as it thinks the below loop will be an infinite loop.
-     * This is beacause coverity does not know the variable running will be updated by the netlink
-     * callback set previously by nl_cb_set.
-     */
     /* coverity[loop_top:SUPPRESS] */
-    while (running > 0)
+    while (batch.remaining > 0)
     {
-        if ((ret = nl_recvmsgs(sock, nlcb)) < 0)
+        if ((ret = nl_recvmsgs(req_sock->sock, nlcb)) < 0)
         {
             LOG_ERROR("Error on nl_recvmsgs %d\n", ret);
+            broken = true;
+            break;
         }
     }
 
-    err = (running < 0) ? MMSM_UNKNOWN_ERROR : MMSM_SUCCESS;
-
 exit:
+    for (i = 0; i < count; i++)
+    {
+        /* Requests that were sent but never answered */
+        if (!batch.reqs[i].done && batch.reqs[i].started_us)
+        {
+            uint32_t latency_us = trace_end(TRACE_NL80211, batch.reqs[i].cmd,
+                                            MMSM_UNKNOWN_ERROR, batch.reqs[i].started_us);
+
+            MMSM_PROBE3(nl80211__request__done, batch.reqs[i].cmd, MMSM_UNKNOWN_ERROR,
+                        latency_us);
+        }
+
+        if (!batch.reqs[i].done || batch.reqs[i].failed)
+        {
+            mmsm_data_item_free(results[i]);
+            results[i] = NULL;
+            err = MMSM_UNKNOWN_ERROR;
+        }
+        mmsm_data_arena_put(batch.reqs[i].params.arena);
+    }
+
     if (nlcb)
         nl_cb_put(nlcb);
 
-    if (msg)
-        nlmsg_free(msg);
+    if (req_sock)
+        backend_nl80211_req_sock_put(nl80211, req_sock, broken);
 
-    if (sock)
-    {
-        nl_close(sock);
-        nl_socket_free(sock);
-    }
+    free(batch.reqs);
 
     return err;
 }
 
 
-#define PACK_VA_ARG(dest, type)                             \
-    do {                                                    \
-        type value = (type)va_arg(args, int);               \
-        (dest)->mmsm_value = calloc(1, sizeof(type));       \
-        memcpy((dest)->mmsm_value, &(value), sizeof(type)); \
-        (dest)->mmsm_value_len = sizeof(type);              \
+#define PACK_VA_ARG(dest, type)                                             \
+    do {                                                                    \
+        type value = (type)va_arg(args, int);                               \
+        (dest)->mmsm_value = mmsm_data_item_value_alloc((dest), sizeof(type)); \
+        memcpy((dest)->mmsm_value, &(value), sizeof(type));                 \
+        (dest)->mmsm_value_len = sizeof(type);                              \
     } while (0)
 
 
@@ -555,7 +2314,7 @@ backend_nl80211_process_request_args(mmsm_backend_intf_t *intf,
 
             case NLA_BINARY:
                 cur->mmsm_value_len = (uint32_t) va_arg(args, int);
-                cur->mmsm_value = calloc(1, cur->mmsm_value_len);
+                cur->mmsm_value = mmsm_data_item_value_alloc(cur, cur->mmsm_value_len);
                 memcpy(cur->mmsm_value, (uint8_t*) va_arg(args, char *), cur->mmsm_value_len);
                 break;
 
@@ -584,25 +2343,112 @@ mmsm_backend_nl80211_create(void)
 
     memcpy(&module->intf, &nl80211_intf, sizeof(module->intf));
     module->datalog = datalog_create("nl80211");
+    MMSM_ASSERT(pthread_mutex_init(&module->req_socks_mutex, NULL) == 0);
+    MMSM_ASSERT(pthread_cond_init(&module->req_socks_cond, NULL) == 0);
+    MMSM_ASSERT(pthread_mutex_init(&module->submit_mutex, NULL) == 0);
+    module->submit_tail = &module->submit_head;
+    module->submit_wake_fd = -1;
+    MMSM_ASSERT(pthread_mutex_init(&module->monitor_filter_mutex, NULL) == 0);
+    module->monitor_filter.all = true;
+    module->monitor_fd = -1;
 
     return &module->intf;
 }
 
 
+void
+mmsm_backend_nl80211_set_rx_buffers(mmsm_backend_intf_t *handle,
+                                    int monitor_bytes,
+                                    int request_bytes)
+{
+    backend_nl80211_t *nl80211 = get_container_from_intf(nl80211, handle);
+
+    nl80211->monitor_rx_buffer = monitor_bytes;
+    nl80211->request_rx_buffer = request_bytes;
+}
+
+
+static void
+backend_nl80211_get_counters(mmsm_backend_intf_t *intf,
+                             mmsm_backend_counters_t *counters)
+{
+    backend_nl80211_t *nl80211 = get_container_from_intf(nl80211, intf);
+
+    counters->reconnects = __atomic_load_n(&nl80211->reconnects, __ATOMIC_RELAXED);
+    counters->errors = __atomic_load_n(&nl80211->errors, __ATOMIC_RELAXED);
+    counters->events_lost = __atomic_load_n(&nl80211->events_lost, __ATOMIC_RELAXED);
+}
+
+
+uint64_t
+mmsm_backend_nl80211_get_events_lost(mmsm_backend_intf_t *handle)
+{
+    backend_nl80211_t *nl80211 = get_container_from_intf(nl80211, handle);
+
+    return __atomic_load_n(&nl80211->events_lost, __ATOMIC_RELAXED);
+}
+
+
+mmsm_data_item_t *
+mmsm_backend_nl80211_parse(struct nl_msg *msg)
+{
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    mmsm_data_arena_t *arena = mmsm_data_arena_create();
+    mmsm_data_item_t *entry;
+
+    if (!arena)
+        return NULL;
+
+    entry = nl80211_msg_parse(arena, msg);
+    if (entry)
+        mmsm_data_item_set_key_u32(entry, gnlh->cmd);
+    mmsm_data_arena_put(arena);
+
+    return entry;
+}
+
+
 void
 mmsm_backend_nl80211_destroy(mmsm_backend_intf_t *handle)
 {
     backend_nl80211_t *nl80211;
+    size_t i;
 
     if (!handle)
         return;
 
     nl80211 = get_container_from_intf(nl80211, handle);
+
+    MMSM_ASSERT(pthread_mutex_lock(&nl80211->submit_mutex) == 0);
+    nl80211->submit_stopping = true;
+    if (nl80211->submit_started)
+        nl80211_submit_wake(nl80211);
+    MMSM_ASSERT(pthread_mutex_unlock(&nl80211->submit_mutex) == 0);
+
+    if (nl80211->submit_started)
+    {
+        MMSM_ASSERT(pthread_join(nl80211->submit_thread, NULL) == 0);
+        close(nl80211->submit_wake_fd);
+        nl_cb_put(nl80211->submit_cb);
+    }
+    MMSM_ASSERT(pthread_mutex_destroy(&nl80211->submit_mutex) == 0);
+
+    for (i = 0; i < NL80211_REQ_POOL_SIZE; i++)
+    {
+        if (nl80211->req_socks[i].sock)
+        {
+            nl_close(nl80211->req_socks[i].sock);
+            nl_socket_free(nl80211->req_socks[i].sock);
+        }
+    }
+    MMSM_ASSERT(pthread_cond_destroy(&nl80211->req_socks_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&nl80211->req_socks_mutex) == 0);
     datalog_close(nl80211->datalog);
     nl80211->datalog = NULL;
     if (nl80211->sock)
     {
         nl_socket_free(nl80211->sock);
     }
+    MMSM_ASSERT(pthread_mutex_destroy(&nl80211->monitor_filter_mutex) == 0);
     free(nl80211);
 }
@@ -0,0 +1,270 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smart_manager.h"
+#include "backend.h"
+#include "helpers.h"
+#include "logging.h"
+
+
+typedef enum
+{
+    BACKEND_REGISTRY_NL80211,
+    BACKEND_REGISTRY_HOSTAPD,
+    BACKEND_REGISTRY_MORSECTRL,
+} backend_registry_type_t;
+
+
+/**
+ * A shared backend instance
+ */
+typedef struct backend_registry_entry_t
+{
+    backend_registry_type_t type;
+
+    /** What the instance talks to, e.g. the control socket or interface name */
+    char target[256];
+
+    mmsm_backend_intf_t *intf;
+
+    /** The nl80211 backend a morsectrl backend uses, held until it is destroyed */
+    mmsm_backend_intf_t *nl80211_intf;
+
+    /** Number of gets not yet put back */
+    unsigned int refs;
+
+    struct backend_registry_entry_t *next;
+} backend_registry_entry_t;
+
+
+/** Protects @ref registry_head. Held while creating instances, but not destroying them. */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static backend_registry_entry_t *registry_head;
+
+
+static const char *
+backend_registry_type_name(backend_registry_type_t type)
+{
+    switch (type)
+    {
+    case BACKEND_REGISTRY_NL80211:
+        return "nl80211";
+    case BACKEND_REGISTRY_HOSTAPD:
+        return "hostapd";
+    case BACKEND_REGISTRY_MORSECTRL:
+        return "morsectrl";
+    }
+
+    return "unknown";
+}
+
+
+/**
+ * Gets the instance for a target, or creates it.
+ *
+ * @param nl80211_intf For morsectrl, the nl80211 backend to create it on. The reference passed
+ *                     in is kept by a new instance, and put back if there already is one.
+ */
+static mmsm_backend_intf_t *
+backend_registry_get(backend_registry_type_t type, const char *target,
+                     mmsm_backend_intf_t *nl80211_intf)
+{
+    backend_registry_entry_t *entry;
+    mmsm_backend_intf_t *intf = NULL;
+
+    if (strlen(target) >= sizeof(entry->target))
+    {
+        LOG_ERROR("Backend target %s is too long\n", target);
+        mmsm_backend_put(nl80211_intf);
+        return NULL;
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&registry_mutex) == 0);
+
+    for (entry = registry_head; entry; entry = entry->next)
+    {
+        if (entry->type == type && strcmp(entry->target, target) == 0)
+        {
+            entry->refs++;
+            intf = entry->intf;
+            break;
+        }
+    }
+
+    if (entry)
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&registry_mutex) == 0);
+        mmsm_backend_put(nl80211_intf);
+        return intf;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry)
+    {
+        switch (type)
+        {
+        case BACKEND_REGISTRY_NL80211:
+            intf = mmsm_backend_nl80211_create();
+            break;
+        case BACKEND_REGISTRY_HOSTAPD:
+        {
+            /* Other BSSes' backends will be logging too, so log by the socket's name */
+            const char *bss = strrchr(target, '/');
+
+            intf = mmsm_backend_hostapd_ctrl_create_instance(target, bss ? bss + 1 : target);
+            break;
+        }
+        case BACKEND_REGISTRY_MORSECTRL:
+            intf = mmsm_backend_morsectrl_create_with_nl80211(target, nl80211_intf);
+            break;
+        }
+    }
+
+    if (intf)
+    {
+        entry->type = type;
+        snprintf(entry->target, sizeof(entry->target), "%s", target);
+        entry->intf = intf;
+        entry->nl80211_intf = nl80211_intf;
+        entry->refs = 1;
+        entry->next = registry_head;
+        registry_head = entry;
+        LOG_DEBUG("Created shared %s backend %s\n", backend_registry_type_name(type), target);
+    }
+
+    MMSM_ASSERT(pthread_mutex_unlock(&registry_mutex) == 0);
+
+    if (!intf)
+    {
+        LOG_ERROR("Failed to create %s backend %s\n", backend_registry_type_name(type), target);
+        free(entry);
+        mmsm_backend_put(nl80211_intf);
+    }
+
+    return intf;
+}
+
+
+mmsm_backend_intf_t *
+mmsm_backend_get(const char *name)
+{
+    if (strcmp(name, "nl80211") == 0)
+        return backend_registry_get(BACKEND_REGISTRY_NL80211, "", NULL);
+
+    LOG_ERROR("Unknown backend %s\n", name);
+    return NULL;
+}
+
+
+mmsm_backend_intf_t *
+mmsm_backend_get_hostapd(const char *control_sock)
+{
+    return backend_registry_get(BACKEND_REGISTRY_HOSTAPD, control_sock, NULL);
+}
+
+
+mmsm_backend_intf_t *
+mmsm_backend_get_morsectrl(const char *ifname)
+{
+    /* Got first, as getting it takes the registry's lock */
+    mmsm_backend_intf_t *nl80211_intf = mmsm_backend_get("nl80211");
+
+    if (!nl80211_intf)
+        return NULL;
+
+    return backend_registry_get(BACKEND_REGISTRY_MORSECTRL, ifname, nl80211_intf);
+}
+
+
+bool
+mmsm_backend_get_name(mmsm_backend_intf_t *intf, char *buf, size_t size)
+{
+    backend_registry_entry_t *entry;
+
+    MMSM_ASSERT(pthread_mutex_lock(&registry_mutex) == 0);
+
+    for (entry = registry_head; entry; entry = entry->next)
+    {
+        if (entry->intf == intf)
+            break;
+    }
+
+    if (entry && entry->target[0])
+        snprintf(buf, size, "%s:%s", backend_registry_type_name(entry->type), entry->target);
+    else if (entry)
+        snprintf(buf, size, "%s", backend_registry_type_name(entry->type));
+
+    MMSM_ASSERT(pthread_mutex_unlock(&registry_mutex) == 0);
+
+    return entry != NULL;
+}
+
+
+void
+mmsm_backend_put(mmsm_backend_intf_t *intf)
+{
+    backend_registry_entry_t **link;
+    backend_registry_entry_t *entry = NULL;
+    bool last = false;
+
+    if (!intf)
+        return;
+
+    MMSM_ASSERT(pthread_mutex_lock(&registry_mutex) == 0);
+
+    for (link = &registry_head; *link; link = &(*link)->next)
+    {
+        if ((*link)->intf == intf)
+        {
+            entry = *link;
+            break;
+        }
+    }
+
+    if (entry && --entry->refs == 0)
+    {
+        *link = entry->next;
+        last = true;
+    }
+
+    MMSM_ASSERT(pthread_mutex_unlock(&registry_mutex) == 0);
+
+    if (!entry)
+    {
+        LOG_ERROR("Releasing a backend that isn't shared\n");
+        return;
+    }
+
+    if (!last)
+        return;
+
+    LOG_DEBUG("Destroying shared %s backend %s\n", backend_registry_type_name(entry->type),
+              entry->target);
+
+    mmsm_request_cache_remove(intf);
+    switch (entry->type)
+    {
+    case BACKEND_REGISTRY_NL80211:
+        mmsm_backend_nl80211_destroy(intf);
+        break;
+    case BACKEND_REGISTRY_HOSTAPD:
+        mmsm_backend_hostapd_ctrl_destroy(intf);
+        break;
+    case BACKEND_REGISTRY_MORSECTRL:
+        mmsm_backend_morsectrl_destroy(intf);
+        break;
+    }
+
+    /* Only once the morsectrl backend is done with it */
+    mmsm_backend_put(entry->nl80211_intf);
+    free(entry);
+}
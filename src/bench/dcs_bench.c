@@ -0,0 +1,325 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ *
+ * dcs_bench.c - Compares the DCS algorithms offline, over recorded samples files
+ *
+ * Replays each samples file (the dcs datalog, CSV or binary) through each algorithm, see
+ * dcs_replay(), for every combination of the settings swept, and reports per run:
+ *  - the number of channel switches
+ *  - the share of time spent on a channel worse than the best one at the time
+ *  - the mean metric of the operating channel
+ *  - the CPU time per evaluation
+ *
+ * The other settings come from the config file given, as smart_manager would read them. Build
+ * with `scons bench`, then eg.
+ *
+ *   dcs_bench -c smart_manager.conf.default -s ewma.ewma_alpha=10,30,50 \
+ *       -s ewma.threshold_percentage=0,5,10 capture1.csv capture2.csv
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libconfig.h>
+
+#include "smart_manager.h"
+#include "logging.h"
+#include "utils.h"
+#include "modules/dcs/dcs.h"
+#include "modules/dcs/algo.h"
+
+#define BENCH_MAX_SWEEPS (8)
+#define BENCH_MAX_VALUES (16)
+#define BENCH_MAX_ALGOS (8)
+
+/** A setting of the dcs group, and the values to try it at */
+typedef struct bench_sweep
+{
+    /** Path of the setting within the dcs group, eg. "ewma.ewma_alpha" */
+    char path[64];
+    int values[BENCH_MAX_VALUES];
+    int num_values;
+} bench_sweep_t;
+
+static bench_sweep_t bench_sweeps[BENCH_MAX_SWEEPS];
+static int bench_num_sweeps;
+
+/* The results, kept apart from the logging on stdout */
+static FILE *bench_out;
+
+/* Only ever replaying, so there is nothing to halt */
+void mmsm_halt(void)
+{
+}
+
+static void bench_usage(void)
+{
+    fprintf(stderr,
+        "Usage: dcs_bench -c <config> [-a <algo>]... [-s <group>.<setting>=<v1>[,<v2>...]]...\n"
+        "                 [-v] <samples.csv>...\n"
+        "  -c  smart_manager config file the other DCS settings are read from\n"
+        "  -a  algorithm to run, built in or a plugin, default every built in one\n"
+        "  -s  integer setting of the dcs group to sweep. Only applies to the algorithm the\n"
+        "      group is named after, or to all of them if it isn't named after one\n"
+        "  -v  keep DCS logging at the level in the config\n");
+}
+
+static int bench_parse_sweep(const char *arg)
+{
+    bench_sweep_t *sweep = &bench_sweeps[bench_num_sweeps];
+    const char *eq = strchr(arg, '=');
+    const char *p;
+    char *end;
+
+    if (bench_num_sweeps == BENCH_MAX_SWEEPS || !eq || eq == arg ||
+        (size_t)(eq - arg) >= sizeof(sweep->path))
+        return -1;
+
+    snprintf(sweep->path, sizeof(sweep->path), "%.*s", (int)(eq - arg), arg);
+    sweep->num_values = 0;
+
+    for (p = eq + 1; ; p = end + 1)
+    {
+        if (sweep->num_values == BENCH_MAX_VALUES)
+            return -1;
+
+        sweep->values[sweep->num_values++] = strtol(p, &end, 10);
+        if (end == p || (*end != ',' && *end != '\0'))
+            return -1;
+        if (*end == '\0')
+            break;
+    }
+
+    bench_num_sweeps++;
+    return 0;
+}
+
+/**
+ * Finds a setting by its path within the dcs group, adding it and any groups on the way if
+ * missing.
+ */
+static config_setting_t *bench_get_setting(config_t *config, const char *path, int type)
+{
+    config_setting_t *setting = config_lookup(config, "dcs");
+    char name[64];
+    const char *p = path;
+    const char *dot;
+
+    if (!setting)
+        setting = config_setting_add(config_root_setting(config), "dcs", CONFIG_TYPE_GROUP);
+
+    while (setting)
+    {
+        config_setting_t *child;
+
+        dot = strchr(p, '.');
+        snprintf(name, sizeof(name), "%.*s", dot ? (int)(dot - p) : (int)strlen(p), p);
+
+        child = config_setting_get_member(setting, name);
+        if (!child)
+            child = config_setting_add(setting, name, dot ? CONFIG_TYPE_GROUP : type);
+        if (!dot)
+            return child;
+
+        setting = child;
+        p = dot + 1;
+    }
+    return NULL;
+}
+
+/** Whether a sweep applies to an algorithm */
+static bool bench_sweep_applies(const bench_sweep_t *sweep, const char *algo_name)
+{
+    size_t len = strcspn(sweep->path, ".");
+
+    if (sweep->path[len] == '\0')
+        return true;
+
+    if (strlen(algo_name) == len && strncmp(sweep->path, algo_name, len) == 0)
+        return true;
+
+    for (int i = 0; dcs_algo_get(i); i++)
+    {
+        const char *name = dcs_algo_get(i)->name;
+
+        if (strlen(name) == len && strncmp(sweep->path, name, len) == 0)
+            return false;
+    }
+    return true;
+}
+
+static void bench_report(const char *algo_name, const char *params, const char *samples,
+                         const struct dcs_replay_stats *stats)
+{
+    double scored = stats->scored_ms ? stats->scored_ms : 1;
+
+    fprintf(bench_out, "%-16s %-40s %-24s %5u %7u %6.1f%% %7.2f %9.2f us\n",
+             algo_name, params, samples, stats->csas, stats->evaluations,
+            100.0 * stats->suboptimal_ms / scored,
+            stats->metric_ms / scored,
+            stats->evaluations ? stats->evaluate_cpu_ns / 1e3 / stats->evaluations : 0.0);
+}
+
+/** Replays every file through one algorithm, for every combination of the sweeps applying */
+static int bench_run(config_t *config, const char *algo_name, char **files, int num_files)
+{
+    int applying[BENCH_MAX_SWEEPS];
+    int index[BENCH_MAX_SWEEPS] = { 0 };
+    int num_applying = 0;
+    struct dcs_replay_stats stats;
+    struct dcs_replay_stats total;
+    char params[128];
+    int i;
+
+    config_setting_set_string(bench_get_setting(config, "algo_type", CONFIG_TYPE_STRING),
+                              algo_name);
+
+    for (i = 0; i < bench_num_sweeps; i++)
+    {
+        if (bench_sweep_applies(&bench_sweeps[i], algo_name))
+            applying[num_applying++] = i;
+    }
+
+    while (1)
+    {
+        size_t len = 0;
+
+        params[0] = '\0';
+        for (i = 0; i < num_applying; i++)
+        {
+            bench_sweep_t *sweep = &bench_sweeps[applying[i]];
+            const char *name = strrchr(sweep->path, '.');
+            int value = sweep->values[index[i]];
+
+            config_setting_set_int(bench_get_setting(config, sweep->path, CONFIG_TYPE_INT),
+                                   value);
+            len += snprintf(params + len, sizeof(params) - MIN(len, sizeof(params)), "%s%s=%d",
+                            len ? " " : "", name ? name + 1 : sweep->path, value);
+        }
+
+        memset(&total, 0, sizeof(total));
+        for (int f = 0; f < num_files; f++)
+        {
+            config_setting_set_string(
+                bench_get_setting(config, "test.filepath", CONFIG_TYPE_STRING), files[f]);
+
+            if (dcs_replay(config, &stats))
+            {
+                fprintf(stderr, "Failed to replay %s with %s, see -v\n", files[f], algo_name);
+                return -1;
+            }
+            bench_report(algo_name, params, files[f], &stats);
+
+            total.csas += stats.csas;
+            total.evaluations += stats.evaluations;
+            total.scored_ms += stats.scored_ms;
+            total.suboptimal_ms += stats.suboptimal_ms;
+            total.metric_ms += stats.metric_ms;
+            total.evaluate_cpu_ns += stats.evaluate_cpu_ns;
+        }
+
+        if (num_files > 1)
+            bench_report(algo_name, params, "(all)", &total);
+
+        /* Next combination, the last sweep varying fastest */
+        for (i = num_applying - 1; i >= 0; i--)
+        {
+            if (++index[i] < bench_sweeps[applying[i]].num_values)
+                break;
+            index[i] = 0;
+        }
+        if (i < 0)
+            break;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *algos[BENCH_MAX_ALGOS];
+    int num_algos = 0;
+    const char *config_file = NULL;
+    bool verbose = false;
+    config_t config;
+    int opt;
+    int ret = 0;
+
+    while ((opt = getopt(argc, argv, "c:a:s:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config_file = optarg;
+            break;
+        case 'a':
+            if (num_algos == BENCH_MAX_ALGOS)
+            {
+                bench_usage();
+                return 1;
+            }
+            algos[num_algos++] = optarg;
+            break;
+        case 's':
+            if (bench_parse_sweep(optarg))
+            {
+                fprintf(stderr, "Invalid sweep %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            bench_usage();
+            return 1;
+        }
+    }
+
+    if (!config_file || optind == argc)
+    {
+        bench_usage();
+        return 1;
+    }
+
+    config_init(&config);
+    if (!config_read_file(&config, config_file))
+    {
+        fprintf(stderr, "Error in reading config file %s at line %d: %s\n", config_file,
+                config_error_line(&config), config_error_text(&config));
+        config_destroy(&config);
+        return 1;
+    }
+
+    /* Logging, some of which ignores the level, goes to stderr, or nowhere unless verbose */
+    bench_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (verbose)
+    {
+        mmsm_set_log_config(config_lookup(&config, "logging"));
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    else
+    {
+        mmsm_set_log_level(LOG_LEVEL_ERROR);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+    }
+
+    if (num_algos == 0)
+    {
+        for (int i = 0; i < BENCH_MAX_ALGOS && dcs_algo_get(i); i++)
+            algos[num_algos++] = dcs_algo_get(i)->name;
+    }
+
+    fprintf(bench_out, "%-16s %-40s %-24s %5s %7s %7s %7s %12s\n", "algorithm", "parameters",
+            "samples", "csas", "rounds", "subopt", "metric", "cpu/eval");
+
+    for (int i = 0; i < num_algos && ret == 0; i++)
+        ret = bench_run(&config, algos[i], &argv[optind], argc - optind);
+
+    config_destroy(&config);
+    fclose(bench_out);
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ *
+ * hashmap_bench.c - Compares hashmap.h against the chained map it replaced
+ *
+ * For each key set, inserts the keys, then times lookups of every key and reports the mean
+ * number of key comparisons per lookup. The old map is kept here, with its hash, only as the
+ * baseline. Build with `scons bench`.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap.h"
+#include "list.h"
+
+#define BENCH_ROUNDS (20)
+
+typedef struct bench_entry
+{
+    list_entry_t chain;
+    uint8_t key[32];
+} bench_entry_t;
+
+static size_t bench_key_size;
+static uint64_t bench_compares;
+
+/* The previous map: a fixed array of chained buckets */
+
+typedef struct legacy_map
+{
+    list_head_t *buckets;
+    size_t size;
+} legacy_map_t;
+
+static uint32_t legacy_hash(const void *key, size_t key_size)
+{
+    uint32_t hash = 0x12345;
+    const uint8_t *bytes = key;
+
+    for (size_t i = 0; i < key_size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 8;
+    }
+    return hash;
+}
+
+static void legacy_init(legacy_map_t *map, size_t size)
+{
+    map->buckets = calloc(size, sizeof(*map->buckets));
+    map->size = size;
+    for (size_t i = 0; i < size; i++)
+        list_reset(&map->buckets[i]);
+}
+
+static void legacy_insert(legacy_map_t *map, bench_entry_t *entry)
+{
+    uint32_t idx = legacy_hash(entry->key, bench_key_size) % map->size;
+
+    list_add_tail(&map->buckets[idx], &entry->chain);
+}
+
+static bench_entry_t *legacy_find(legacy_map_t *map, const void *key)
+{
+    uint32_t idx = legacy_hash(key, bench_key_size) % map->size;
+    list_entry_t *pos;
+
+    list_for_each_entry(pos, &map->buckets[idx])
+    {
+        bench_entry_t *entry = list_get_item(entry, pos, chain);
+
+        bench_compares++;
+        if (memcmp(entry->key, key, bench_key_size) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+/* The current map */
+
+static const void *bench_get_key(const void *entry)
+{
+    return ((const bench_entry_t *)entry)->key;
+}
+
+static bool bench_equal(const void *key, const void *entry_key, size_t key_size)
+{
+    bench_compares++;
+    return memcmp(key, entry_key, key_size) == 0;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Fills in keys: MAC addresses of one vendor prefix if mac is set, else sequential counters
+ * padded to the key size.
+ */
+static void bench_make_keys(bench_entry_t *entries, size_t n, bool mac)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        memset(entries[i].key, 0, sizeof(entries[i].key));
+        if (mac)
+        {
+            uint8_t addr[6] = {0x0c, 0xbf, 0x74, (uint8_t)(i >> 16), (uint8_t)(i >> 8),
+                               (uint8_t)i};
+
+            memcpy(entries[i].key, addr, sizeof(addr));
+        }
+        else
+        {
+            snprintf((char *)entries[i].key, sizeof(entries[i].key), "wlan0/sta/%08zu", i);
+        }
+    }
+}
+
+static void bench_run(const char *name, size_t n, size_t key_size, bool mac)
+{
+    bench_entry_t *entries = calloc(n, sizeof(*entries));
+    legacy_map_t legacy;
+    hashmap_t map;
+    double start;
+    double legacy_time;
+    double map_time;
+    uint64_t legacy_compares;
+    size_t found = 0;
+
+    bench_key_size = key_size;
+    bench_make_keys(entries, n, mac);
+
+    /* The old map was sized once for the expected load, as monitor_index did */
+    legacy_init(&legacy, 64);
+    hashmap_init_custom(&map, 0, key_size, bench_get_key, hashmap_hash_default, bench_equal);
+    for (size_t i = 0; i < n; i++)
+    {
+        legacy_insert(&legacy, &entries[i]);
+        hashmap_insert(&map, &entries[i]);
+    }
+
+    bench_compares = 0;
+    start = bench_now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        for (size_t i = 0; i < n; i++)
+            found += legacy_find(&legacy, entries[i].key) != NULL;
+    legacy_time = bench_now() - start;
+    legacy_compares = bench_compares;
+
+    bench_compares = 0;
+    start = bench_now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        for (size_t i = 0; i < n; i++)
+            found += hashmap_find(&map, entries[i].key) != NULL;
+    map_time = bench_now() - start;
+
+    if (found != 2 * n * BENCH_ROUNDS)
+        printf("%s: lookups failed\n", name);
+
+    printf("%-18s %7zu keys  legacy %8.1f ns %7.2f cmp  hashmap %8.1f ns %5.2f cmp\n",
+           name, n,
+           legacy_time * 1e9 / (n * BENCH_ROUNDS),
+           (double)legacy_compares / (n * BENCH_ROUNDS),
+           map_time * 1e9 / (n * BENCH_ROUNDS),
+           (double)bench_compares / (n * BENCH_ROUNDS));
+
+    hashmap_cleanup(&map, NULL);
+    free(legacy.buckets);
+    free(entries);
+}
+
+int main(void)
+{
+    static const size_t counts[] = {16, 64, 256, 1024, 4096};
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        bench_run("mac", counts[i], 6, true);
+        bench_run("string", counts[i], 32, false);
+    }
+
+    return 0;
+}
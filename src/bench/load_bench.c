@@ -0,0 +1,301 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ *
+ * load_bench.c - Load tests the engine on a mock backend
+ *
+ * Registers polling monitors and pattern monitors on a mock backend, see
+ * mmsm_backend_mock_create(), that answers with a configurable latency and raises notifications
+ * at a configurable rate, each for one of the pattern monitors' stations. Runs the engine for a
+ * while, with the engine settings of the config file given, then reports as "metric,value" CSV
+ * lines how late the polling monitors fired, how many notifications were delivered, how the
+ * notification queue held up and the CPU used. Build with `scons bench`, then eg.
+ *
+ *   load_bench -c smart_manager.conf.default -p 5000 -P 100 -e 2000 -r 50000 -d 10
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libconfig.h>
+
+#include "smart_manager.h"
+#include "backend/backend.h"
+#include "logging.h"
+#include "utils.h"
+
+static const char bench_status[] =
+    "state=ENABLED\n"
+    "freq=5180\n"
+    "channel=36\n"
+    "beacon_int=100\n"
+    "dtim_period=1\n"
+    "s1g_freq=916000\n"
+    "s1g_bw=8\n"
+    "s1g_prim_chwidth=2\n"
+    "s1g_prim_1mhz_chan_index=3\n"
+    "num_sta[0]=2\n";
+
+static uint64_t bench_polls;
+static uint64_t bench_events;
+
+/* The results, kept apart from the logging on stdout */
+static FILE *bench_out;
+
+/* Nothing to halt */
+void mmsm_halt(void)
+{
+}
+
+static void bench_usage(void)
+{
+    fprintf(stderr,
+        "Usage: load_bench [-c <config>] [-p <monitors>] [-P <ms>] [-e <monitors>] [-r <rate>]\n"
+        "                  [-l <us>] [-j <us>] [-d <s>] [-v]\n"
+        "  -c  smart_manager config file the engine settings are read from\n"
+        "  -p  polling monitors, default 1000\n"
+        "  -P  period of the polling monitors, default 100 ms\n"
+        "  -e  pattern monitors, each matching the notifications of a station of its own,\n"
+        "      default 1000\n"
+        "  -r  notifications raised per second, default 10000\n"
+        "  -l  latency of each request, default 0 us\n"
+        "  -j  up to this much more latency at random, default 0 us\n"
+        "  -d  duration, default 10 s\n"
+        "  -v  keep logging at the level in the config\n");
+}
+
+static void bench_poll_callback(void *context, mmsm_backend_intf_t *intf,
+                                mmsm_data_item_t *result)
+{
+    UNUSED(context);
+    UNUSED(intf);
+    UNUSED(result);
+
+    __atomic_fetch_add(&bench_polls, 1, __ATOMIC_RELAXED);
+}
+
+static void bench_event_callback(void *context, mmsm_backend_intf_t *intf,
+                                 mmsm_data_item_t *result)
+{
+    UNUSED(context);
+    UNUSED(intf);
+    UNUSED(result);
+
+    __atomic_fetch_add(&bench_events, 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t bench_now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_histogram_add(mmsm_histogram_t *total, const mmsm_histogram_t *histogram)
+{
+    total->count += histogram->count;
+    total->sum_us += histogram->sum_us;
+    total->max_us = MAX(total->max_us, histogram->max_us);
+    for (int i = 0; i < MMSM_HISTOGRAM_BUCKETS; i++)
+        total->buckets[i] += histogram->buckets[i];
+}
+
+static void bench_report(const char *metric, uint64_t value)
+{
+    fprintf(bench_out, "%s,%" PRIu64 "\n", metric, value);
+}
+
+/** Reports the counters the engine kept of the monitors */
+static void bench_report_stats(void)
+{
+    mmsm_stats_t *stats = mmsm_get_stats();
+    mmsm_histogram_t lag = { 0 };
+    mmsm_histogram_t poll_callback = { 0 };
+    mmsm_histogram_t event_callback = { 0 };
+    uint64_t deadline_misses = 0;
+
+    if (!stats)
+        return;
+
+    for (size_t i = 0; i < stats->num_entries; i++)
+    {
+        const mmsm_stats_entry_t *entry = &stats->entries[i];
+
+        if (entry->type == MMSM_STATS_POLLING_MONITOR)
+        {
+            bench_histogram_add(&lag, &entry->counters.lag_us);
+            bench_histogram_add(&poll_callback, &entry->counters.callback_us);
+            deadline_misses += entry->counters.deadline_misses;
+        }
+        else if (entry->type == MMSM_STATS_PATTERN_MONITOR)
+        {
+            bench_histogram_add(&event_callback, &entry->counters.callback_us);
+        }
+    }
+
+    bench_report("poll_lag_p50_us", mmsm_histogram_percentile_us(&lag, 50));
+    bench_report("poll_lag_p99_us", mmsm_histogram_percentile_us(&lag, 99));
+    bench_report("poll_lag_max_us", lag.max_us);
+    bench_report("poll_deadline_misses", deadline_misses);
+    bench_report("poll_callback_p99_us", mmsm_histogram_percentile_us(&poll_callback, 99));
+    bench_report("event_callback_p99_us", mmsm_histogram_percentile_us(&event_callback, 99));
+
+    mmsm_stats_free(stats);
+}
+
+int main(int argc, char **argv)
+{
+    mmsm_backend_mock_config_t mock_config = {
+        .event = "<3>AP-STA-CONNECTED",
+        .event_rate = 10000,
+    };
+    mmsm_backend_mock_counters_t counters;
+    mmsm_monitor_queue_stats_t queue;
+    mmsm_backend_intf_t *mock;
+    const char *config_file = NULL;
+    unsigned int polling_monitors = 1000;
+    unsigned int period_ms = 100;
+    unsigned int pattern_monitors = 1000;
+    unsigned int duration_s = 10;
+    bool verbose = false;
+    config_t config;
+    uint64_t start_ns;
+    uint64_t start_cpu_ns;
+    uint64_t elapsed_ns;
+    uint64_t cpu_ns;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:p:P:e:r:l:j:d:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config_file = optarg;
+            break;
+        case 'p':
+            polling_monitors = strtoul(optarg, NULL, 0);
+            break;
+        case 'P':
+            period_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            pattern_monitors = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            mock_config.event_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            mock_config.latency_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            mock_config.latency_jitter_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration_s = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            bench_usage();
+            return 1;
+        }
+    }
+
+    if (optind != argc || period_ms == 0 || duration_s == 0)
+    {
+        bench_usage();
+        return 1;
+    }
+
+    config_init(&config);
+    if (config_file && !config_read_file(&config, config_file))
+    {
+        fprintf(stderr, "Error in reading config file %s at line %d: %s\n", config_file,
+                config_error_line(&config), config_error_text(&config));
+        config_destroy(&config);
+        return 1;
+    }
+
+    /* Logging, some of which ignores the level, goes to stderr, or nowhere unless verbose */
+    bench_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (verbose)
+    {
+        mmsm_set_log_config(config_lookup(&config, "logging"));
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    else
+    {
+        mmsm_set_log_level(LOG_LEVEL_ERROR);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+    }
+
+    mmsm_init();
+    mmsm_set_engine_config(config_lookup(&config, "engine"));
+
+    /* Every notification is for the station of one of the pattern monitors */
+    mock_config.event_stations = MAX(pattern_monitors, 1);
+    mock = mmsm_backend_mock_create(&mock_config);
+    if (!mock || mmsm_backend_mock_set_response(mock, "STATUS", bench_status) != MMSM_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create the mock backend\n");
+        mmsm_backend_mock_destroy(mock);
+        config_destroy(&config);
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < polling_monitors; i++)
+        mmsm_monitor_polling(mock, period_ms, bench_poll_callback, NULL, "STATUS");
+
+    for (unsigned int i = 0; i < pattern_monitors; i++)
+    {
+        unsigned int station = i + 1;
+        char pattern[32];
+
+        snprintf(pattern, sizeof(pattern), "02:00:00:%02x:%02x:%02x",
+                 (station >> 16) & 0xff, (station >> 8) & 0xff, station & 0xff);
+        mmsm_monitor_pattern(mock, pattern, bench_event_callback, NULL, "AP-STA-CONNECTED");
+    }
+
+    start_ns = bench_now_ns(CLOCK_MONOTONIC);
+    start_cpu_ns = bench_now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    mmsm_start();
+
+    sleep(duration_s);
+
+    mmsm_backend_mock_get_counters(mock, &counters);
+    elapsed_ns = bench_now_ns(CLOCK_MONOTONIC) - start_ns;
+    cpu_ns = bench_now_ns(CLOCK_PROCESS_CPUTIME_ID) - start_cpu_ns;
+
+    fprintf(bench_out, "metric,value\n");
+    bench_report("polling_monitors", polling_monitors);
+    bench_report("pattern_monitors", pattern_monitors);
+    bench_report("polls", __atomic_load_n(&bench_polls, __ATOMIC_RELAXED));
+    bench_report("polls_expected", (uint64_t)polling_monitors * elapsed_ns / 1000000 / period_ms);
+    bench_report("requests", counters.requests);
+    bench_report("events_raised", counters.events_raised);
+    bench_report("events_received", counters.events_received);
+    bench_report("event_callbacks", __atomic_load_n(&bench_events, __ATOMIC_RELAXED));
+    if (mmsm_monitor_get_queue_stats(mock, &queue) == MMSM_SUCCESS)
+    {
+        bench_report("queue_max_depth", queue.max_depth);
+        bench_report("queue_dropped", queue.dropped);
+    }
+    bench_report_stats();
+    bench_report("cpu_percent", cpu_ns * 100 / elapsed_ns);
+
+    mmsm_monitor_polling_remove(mock, bench_poll_callback, NULL);
+    mmsm_monitor_pattern_remove(mock, bench_event_callback, NULL);
+    mmsm_stop();
+    mmsm_backend_mock_destroy(mock);
+
+    config_destroy(&config);
+    fclose(bench_out);
+    return 0;
+}
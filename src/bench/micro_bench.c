@@ -0,0 +1,811 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ *
+ * micro_bench.c - Times the hot paths of the engine and backends
+ *
+ * Covers parsing hostapd replies and nl80211 messages as the backends receive them, building,
+ * freeing and searching data items, hashmap.h, writing CSV datalogs, and the polling scheduler
+ * with N monitors. Each benchmark is run for long enough to take at least the target time, and
+ * reported as a CSV line of
+ *
+ *   benchmark,case,ops,ns_per_op,allocs_per_op
+ *
+ * in a fixed order, so runs of different releases can be compared line by line. ns_per_op is
+ * the wall clock time of the calling thread, except for the polling scheduler, which sleeps
+ * between monitors and so reports the CPU time of every thread per monitor fired.
+ * allocs_per_op counts the malloc, calloc, realloc, strdup and open_memstream calls of every
+ * thread, which the link wraps. Allocations made inside libc and libnl themselves aren't counted.
+ * Build with `scons bench`, then eg.
+ *
+ *   micro_bench -t 500 -b hostapd > before.csv
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <libconfig.h>
+#include <netlink/genl/genl.h>
+#include <linux/nl80211.h>
+
+#include "smart_manager.h"
+#include "backend/backend.h"
+#include "backend/morsectrl/command.h"
+#include "backend/morsectrl/vendor.h"
+#include "mmsm_data.h"
+#include "helpers.h"
+#include "datalog.h"
+#include "hashmap.h"
+#include "logging.h"
+#include "utils.h"
+
+#define BENCH_DEFAULT_TIME_MS (200)
+#define BENCH_HASHMAP_KEYS (1024)
+#define BENCH_DATA_ITEMS (16)
+
+typedef void (*bench_fn_t)(void *arg, uint64_t ops);
+
+static uint64_t bench_allocs;
+static uint64_t bench_min_ns = BENCH_DEFAULT_TIME_MS * 1000000ull;
+static const char *bench_filter;
+
+/* The results, kept apart from the logging on stdout */
+static FILE *bench_out;
+
+/* Allocations, counted through the --wrap link flags the bench target sets */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+FILE *__real_open_memstream(char **ptr, size_t *sizeloc);
+
+void *__wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strdup(s);
+}
+
+FILE *__wrap_open_memstream(char **ptr, size_t *sizeloc)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_open_memstream(ptr, sizeloc);
+}
+
+/* Nothing to halt */
+void mmsm_halt(void)
+{
+}
+
+static uint64_t bench_now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t bench_allocs_now(void)
+{
+    return __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+}
+
+static bool bench_selected(const char *name)
+{
+    return !bench_filter || strstr(name, bench_filter);
+}
+
+static void bench_report(const char *name, const char *variant, uint64_t ops, uint64_t ns,
+                         uint64_t allocs)
+{
+    fprintf(bench_out, "%s,%s,%" PRIu64 ",%.1f,%.2f\n", name, variant, ops,
+            ops ? (double)ns / ops : 0.0, ops ? (double)allocs / ops : 0.0);
+    fflush(bench_out);
+}
+
+/**
+ * Runs a benchmark with more and more ops until a run takes the target time, and reports that
+ * run.
+ */
+static void bench_measure(const char *name, const char *variant, bench_fn_t fn, void *arg)
+{
+    uint64_t ops = 1;
+
+    if (!bench_selected(name))
+        return;
+
+    /* Warms the caches, and the lookup indexes built on first search */
+    fn(arg, 1);
+
+    while (true)
+    {
+        uint64_t allocs = bench_allocs_now();
+        uint64_t start = bench_now_ns(CLOCK_MONOTONIC);
+        uint64_t elapsed;
+        uint64_t next;
+
+        fn(arg, ops);
+        elapsed = bench_now_ns(CLOCK_MONOTONIC) - start;
+        allocs = bench_allocs_now() - allocs;
+
+        if (elapsed >= bench_min_ns || ops >= UINT64_MAX / 16)
+        {
+            bench_report(name, variant, ops, elapsed, allocs);
+            return;
+        }
+
+        /* Aim a little past the target, growing between 2 and 10 times */
+        next = elapsed ? (uint64_t)((double)ops * bench_min_ns * 1.2 / elapsed) : ops * 10;
+        ops = MIN(MAX(next, ops * 2), ops * 10);
+    }
+}
+
+/* hostapd replies, as received */
+
+typedef struct bench_hostapd
+{
+    const char *reply;
+    size_t len;
+    const char *const *keys;
+} bench_hostapd_t;
+
+static const char bench_hostapd_status[] =
+    "state=ENABLED\n"
+    "phy=phy0\n"
+    "freq=5180\n"
+    "num_sta_non_erp=0\n"
+    "num_sta_no_short_slot_time=0\n"
+    "num_sta_no_short_preamble=0\n"
+    "olbc=0\n"
+    "num_sta_ht_no_gf=0\n"
+    "num_sta_no_ht=0\n"
+    "num_sta_ht_20_mhz=0\n"
+    "num_sta_ht40_intolerant=0\n"
+    "olbc_ht=0\n"
+    "ht_op_mode=0x0\n"
+    "hw_mode=a\n"
+    "country_code=US\n"
+    "country3=0x20\n"
+    "cac_time_seconds=0\n"
+    "cac_time_left_seconds=N/A\n"
+    "channel=36\n"
+    "edmg_enable=0\n"
+    "edmg_channel=0\n"
+    "secondary_channel=1\n"
+    "ieee80211n=1\n"
+    "ieee80211ac=1\n"
+    "ieee80211ax=0\n"
+    "beacon_int=100\n"
+    "dtim_period=1\n"
+    "vht_oper_chwidth=1\n"
+    "vht_oper_centr_freq_seg0_idx=42\n"
+    "vht_oper_centr_freq_seg1_idx=0\n"
+    "vht_caps_info=0000c03a\n"
+    "s1g_freq=916000\n"
+    "s1g_bw=8\n"
+    "s1g_prim_chwidth=2\n"
+    "s1g_prim_1mhz_chan_index=3\n"
+    "supported_rates=0c 12 18 24 30 48 60 6c\n"
+    "max_txpower=21\n"
+    "bss[0]=wlan0\n"
+    "bssid[0]=0c:bf:74:00:12:34\n"
+    "ssid[0]=halow\n"
+    "num_sta[0]=2\n";
+
+/* The keys DCS reads of STATUS */
+static const char *const bench_hostapd_status_keys[] = {
+    "freq", "s1g_freq", "s1g_bw", "s1g_prim_chwidth", "s1g_prim_1mhz_chan_index", "beacon_int",
+    "dtim_period", NULL
+};
+
+static const char bench_hostapd_sta[] =
+    "0c:bf:74:00:56:78\n"
+    "flags=[AUTH][ASSOC][AUTHORIZED][WMM]\n"
+    "aid=1\n"
+    "capability=0x0\n"
+    "listen_interval=10\n"
+    "supported_rates=0c 12 18 24 30 48 60 6c\n"
+    "timeout_next=NULLFUNC POLL\n"
+    "dot11RSNAStatsSTAAddress=0c:bf:74:00:56:78\n"
+    "dot11RSNAStatsVersion=1\n"
+    "dot11RSNAStatsSelectedPairwiseCipher=00-0f-ac-4\n"
+    "dot11RSNAStatsTKIPLocalMICFailures=0\n"
+    "dot11RSNAStatsTKIPRemoteMICFailures=0\n"
+    "wpa=2\n"
+    "AKMSuiteSelector=00-0f-ac-8\n"
+    "hostapdWPAPTKState=11\n"
+    "hostapdWPAPTKGroupState=0\n"
+    "rx_packets=1234\n"
+    "tx_packets=2345\n"
+    "rx_bytes=123456\n"
+    "tx_bytes=234567\n"
+    "inactive_msec=120\n"
+    "signal=-62\n"
+    "rx_rate_info=65\n"
+    "tx_rate_info=65\n"
+    "connected_time=3600\n";
+
+static const char bench_hostapd_event[] =
+    "<3>AP-STA-CONNECTED 0c:bf:74:00:56:78 auth_alg=sae";
+
+static bench_hostapd_t bench_hostapd_cases[] = {
+    { bench_hostapd_status, sizeof(bench_hostapd_status) - 1, NULL },
+    { bench_hostapd_status, sizeof(bench_hostapd_status) - 1, bench_hostapd_status_keys },
+    { bench_hostapd_sta, sizeof(bench_hostapd_sta) - 1, NULL },
+    { bench_hostapd_event, sizeof(bench_hostapd_event) - 1, NULL },
+};
+
+/** Receives the reply into a buffer of its own as the backend does, and parses it */
+static void bench_hostapd_parse(void *arg, uint64_t ops)
+{
+    bench_hostapd_t *reply = arg;
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        mmsm_data_buf_t *buf = mmsm_data_buf_alloc(reply->len + 1);
+
+        memcpy(mmsm_data_buf_data(buf), reply->reply, reply->len + 1);
+        mmsm_data_item_free(mmsm_backend_hostapd_ctrl_parse(buf, reply->len, reply->keys));
+        mmsm_data_buf_put(buf);
+    }
+}
+
+/* nl80211 messages, built as the kernel sends them */
+
+static struct nl_msg *bench_nl80211_ocs_done(void)
+{
+    struct morse_cmd_evt_ocs_done event = {
+        .time_listen = htole64(50000),
+        .time_rx = htole64(3200),
+        .noise = -95,
+        .metric = 87,
+    };
+    struct nl_msg *msg = nlmsg_alloc();
+    struct nlattr *data;
+
+    genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, 0x22, 0, 0, NL80211_CMD_VENDOR, 0);
+    nla_put_u32(msg, NL80211_ATTR_WIPHY, 0);
+    nla_put_u64(msg, NL80211_ATTR_WDEV, 1);
+    nla_put_u32(msg, NL80211_ATTR_IFINDEX, 5);
+    nla_put_u32(msg, NL80211_ATTR_VENDOR_ID, MORSE_OUI);
+    nla_put_u32(msg, NL80211_ATTR_VENDOR_SUBCMD, MORSE_VENDOR_EVENT_OCS_DONE);
+    data = nla_nest_start(msg, NL80211_ATTR_VENDOR_DATA);
+    nla_put(msg, MORSE_VENDOR_ATTR_DATA, sizeof(event), &event);
+    nla_nest_end(msg, data);
+
+    return msg;
+}
+
+static void bench_nl80211_put_rate(struct nl_msg *msg, int attr)
+{
+    struct nlattr *rate = nla_nest_start(msg, attr);
+
+    nla_put_u16(msg, NL80211_RATE_INFO_BITRATE, 65);
+    nla_put_u32(msg, NL80211_RATE_INFO_BITRATE32, 65);
+    nla_put_u8(msg, NL80211_RATE_INFO_MCS, 7);
+    nla_nest_end(msg, rate);
+}
+
+/** A message of a station dump */
+static struct nl_msg *bench_nl80211_station(void)
+{
+    static const uint8_t mac[6] = { 0x0c, 0xbf, 0x74, 0x00, 0x56, 0x78 };
+    struct nl_msg *msg = nlmsg_alloc();
+    struct nlattr *info;
+    struct nlattr *bss;
+
+    genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, 0x22, 0, NLM_F_MULTI, NL80211_CMD_NEW_STATION,
+                0);
+    nla_put_u32(msg, NL80211_ATTR_IFINDEX, 5);
+    nla_put(msg, NL80211_ATTR_MAC, sizeof(mac), mac);
+    nla_put_u32(msg, NL80211_ATTR_GENERATION, 12);
+
+    info = nla_nest_start(msg, NL80211_ATTR_STA_INFO);
+    nla_put_u32(msg, NL80211_STA_INFO_INACTIVE_TIME, 120);
+    nla_put_u32(msg, NL80211_STA_INFO_RX_BYTES, 123456);
+    nla_put_u64(msg, NL80211_STA_INFO_RX_BYTES64, 123456);
+    nla_put_u32(msg, NL80211_STA_INFO_TX_BYTES, 234567);
+    nla_put_u64(msg, NL80211_STA_INFO_TX_BYTES64, 234567);
+    nla_put_u32(msg, NL80211_STA_INFO_RX_PACKETS, 1234);
+    nla_put_u32(msg, NL80211_STA_INFO_TX_PACKETS, 2345);
+    nla_put_u32(msg, NL80211_STA_INFO_TX_RETRIES, 12);
+    nla_put_u32(msg, NL80211_STA_INFO_TX_FAILED, 1);
+    nla_put_u8(msg, NL80211_STA_INFO_SIGNAL, (uint8_t)-62);
+    nla_put_u8(msg, NL80211_STA_INFO_SIGNAL_AVG, (uint8_t)-63);
+    bench_nl80211_put_rate(msg, NL80211_STA_INFO_TX_BITRATE);
+    bench_nl80211_put_rate(msg, NL80211_STA_INFO_RX_BITRATE);
+    nla_put_u32(msg, NL80211_STA_INFO_CONNECTED_TIME, 3600);
+    bss = nla_nest_start(msg, NL80211_STA_INFO_BSS_PARAM);
+    nla_put_u8(msg, NL80211_STA_BSS_PARAM_DTIM_PERIOD, 1);
+    nla_put_u16(msg, NL80211_STA_BSS_PARAM_BEACON_INTERVAL, 100);
+    nla_nest_end(msg, bss);
+    nla_nest_end(msg, info);
+
+    return msg;
+}
+
+static void bench_nl80211_parse(void *arg, uint64_t ops)
+{
+    for (uint64_t i = 0; i < ops; i++)
+        mmsm_data_item_free(mmsm_backend_nl80211_parse(arg));
+}
+
+/* Data items */
+
+static void bench_data_item_alloc_free(void *arg, uint64_t ops)
+{
+    UNUSED(arg);
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        mmsm_data_item_t *head = mmsm_data_item_alloc();
+        mmsm_data_item_t *iter = head;
+
+        mmsm_data_item_set_key_u32(iter, 0);
+        mmsm_data_item_set_val_u32(iter, 0);
+        for (uint32_t n = 1; n < BENCH_DATA_ITEMS; n++)
+        {
+            iter = mmsm_data_item_alloc_next(iter);
+            mmsm_data_item_set_key_u32(iter, n);
+            mmsm_data_item_set_val_u32(iter, n);
+        }
+        mmsm_data_item_free(head);
+    }
+}
+
+static void bench_data_item_arena_alloc_free(void *arg, uint64_t ops)
+{
+    UNUSED(arg);
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        mmsm_data_arena_t *arena = mmsm_data_arena_create();
+        mmsm_data_item_t *head = mmsm_data_item_alloc_in(arena);
+        mmsm_data_item_t *iter = head;
+
+        mmsm_data_item_set_key_u32(iter, 0);
+        mmsm_data_item_set_val_u32(iter, 0);
+        for (uint32_t n = 1; n < BENCH_DATA_ITEMS; n++)
+        {
+            iter = mmsm_data_item_alloc_next(iter);
+            mmsm_data_item_set_key_u32(iter, n);
+            mmsm_data_item_set_val_u32(iter, n);
+        }
+        mmsm_data_arena_put(arena);
+        mmsm_data_item_free(head);
+    }
+}
+
+/** Reads the keys DCS reads of a parsed STATUS reply */
+static void bench_data_item_find_key(void *arg, uint64_t ops)
+{
+    mmsm_data_item_t *status = arg;
+    size_t num_keys = ARRAY_SIZE(bench_hostapd_status_keys) - 1;
+    int64_t sum = 0;
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        int64_t val;
+
+        if (mmsm_find_i64_by_key(status, bench_hostapd_status_keys[i % num_keys], &val))
+            sum += val;
+    }
+
+    __asm__ volatile("" : : "r"(sum));
+}
+
+/** Finds the OCS done event data, as DCS does */
+static void bench_data_item_find_nested(void *arg, uint64_t ops)
+{
+    mmsm_data_item_t *event = arg;
+    uintptr_t sum = 0;
+
+    for (uint64_t i = 0; i < ops; i++)
+        sum += (uintptr_t)mmsm_find_by_nested_intkeys(event, NL80211_CMD_VENDOR,
+                                                      NL80211_ATTR_VENDOR_DATA,
+                                                      MORSE_VENDOR_ATTR_DATA, -1);
+
+    __asm__ volatile("" : : "r"(sum));
+}
+
+/* hashmap.h, keyed by MAC address as the STA table is */
+
+typedef struct bench_hashmap_entry
+{
+    uint8_t mac[6];
+} bench_hashmap_entry_t;
+
+typedef struct bench_hashmap
+{
+    hashmap_t map;
+    bench_hashmap_entry_t entries[BENCH_HASHMAP_KEYS];
+} bench_hashmap_t;
+
+static const void *bench_hashmap_get_key(const void *entry)
+{
+    return ((const bench_hashmap_entry_t *)entry)->mac;
+}
+
+/** Inserts every key into a new map, then frees it, as often as it takes */
+static void bench_hashmap_insert(void *arg, uint64_t ops)
+{
+    bench_hashmap_t *bench = arg;
+    hashmap_t map;
+
+    hashmap_init(&map, 0, sizeof(bench->entries[0].mac), bench_hashmap_get_key);
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        if (i && i % BENCH_HASHMAP_KEYS == 0)
+        {
+            hashmap_cleanup(&map, NULL);
+            hashmap_init(&map, 0, sizeof(bench->entries[0].mac), bench_hashmap_get_key);
+        }
+        hashmap_insert(&map, &bench->entries[i % BENCH_HASHMAP_KEYS]);
+    }
+    hashmap_cleanup(&map, NULL);
+}
+
+static void bench_hashmap_find(void *arg, uint64_t ops)
+{
+    bench_hashmap_t *bench = arg;
+    uintptr_t sum = 0;
+
+    for (uint64_t i = 0; i < ops; i++)
+        sum += (uintptr_t)hashmap_find(&bench->map, bench->entries[i % BENCH_HASHMAP_KEYS].mac);
+
+    __asm__ volatile("" : : "r"(sum));
+}
+
+static void bench_hashmap_find_missing(void *arg, uint64_t ops)
+{
+    bench_hashmap_t *bench = arg;
+    uintptr_t sum = 0;
+    uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+    for (uint64_t i = 0; i < ops; i++)
+    {
+        mac[4] = (uint8_t)(i >> 8);
+        mac[5] = (uint8_t)i;
+        sum += (uintptr_t)hashmap_find(&bench->map, mac);
+    }
+
+    __asm__ volatile("" : : "r"(sum));
+}
+
+static void bench_hashmap_run(void)
+{
+    bench_hashmap_t *bench;
+
+    if (!bench_selected("hashmap"))
+        return;
+
+    bench = calloc(1, sizeof(*bench));
+    for (size_t i = 0; i < BENCH_HASHMAP_KEYS; i++)
+    {
+        uint8_t mac[6] = { 0x0c, 0xbf, 0x74, 0x00, (uint8_t)(i >> 8), (uint8_t)i };
+
+        memcpy(bench->entries[i].mac, mac, sizeof(mac));
+    }
+
+    hashmap_init(&bench->map, 0, sizeof(bench->entries[0].mac), bench_hashmap_get_key);
+    for (size_t i = 0; i < BENCH_HASHMAP_KEYS; i++)
+        hashmap_insert(&bench->map, &bench->entries[i]);
+
+    bench_measure("hashmap", "insert_1024", bench_hashmap_insert, bench);
+    bench_measure("hashmap", "find_1024", bench_hashmap_find, bench);
+    bench_measure("hashmap", "find_missing_1024", bench_hashmap_find_missing, bench);
+
+    hashmap_cleanup(&bench->map, NULL);
+    free(bench);
+}
+
+/* CSV datalogs, written to a directory of their own */
+
+static void bench_datalog_write_csv(void *arg, uint64_t ops)
+{
+    struct datalog *dl = arg;
+
+    for (uint64_t i = 0; i < ops; i++)
+        datalog_write_csv(dl, "uuudS", (unsigned int)i, 36u, 87u, -95, "ENABLED");
+}
+
+/** Removes a directory and everything in it */
+static void bench_remove_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    char child[512];
+
+    if (!dir)
+    {
+        unlink(path);
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        bench_remove_dir(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+static void bench_datalog_run(void)
+{
+    static const char *const modes[] = { "sync", "async" };
+    char root[] = "/tmp/micro_bench.XXXXXX";
+    config_t configs[ARRAY_SIZE(modes)];
+    char text[512];
+
+    if (!bench_selected("datalog_write_csv"))
+        return;
+
+    if (!mkdtemp(root))
+    {
+        fprintf(stderr, "Could not create a directory for the datalogs\n");
+        return;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(modes); i++)
+    {
+        char name[] = "bench";
+        struct datalog *dl;
+
+        snprintf(text, sizeof(text),
+                 "root_dir = \"%s\"\n"
+                 "async = %s\n"
+                 "queue_size = 65536\n"
+                 "compress = false\n"
+                 "bench : { enabled = true }\n",
+                 root, i ? "true" : "false");
+
+        config_init(&configs[i]);
+        if (!config_read_string(&configs[i], text))
+        {
+            fprintf(stderr, "Could not configure the %s datalog\n", modes[i]);
+            continue;
+        }
+        datalog_set_config_settings(config_root_setting(&configs[i]));
+
+        dl = datalog_create(name);
+        if (!dl || !datalog_init_csv(dl, "round,channel,metric,noise,state"))
+        {
+            fprintf(stderr, "Could not create the %s datalog in %s\n", modes[i], root);
+            datalog_close(dl);
+            continue;
+        }
+
+        bench_measure("datalog_write_csv", modes[i], bench_datalog_write_csv, dl);
+        datalog_close(dl);
+    }
+
+    /* The configs are kept until the last datalog has been created with them */
+    for (size_t i = 0; i < ARRAY_SIZE(modes); i++)
+        config_destroy(&configs[i]);
+
+    bench_remove_dir(root);
+}
+
+/* The polling scheduler, on a backend that answers straight away */
+
+static uint64_t bench_polls;
+
+static mmsm_data_item_t *bench_backend_process_request_args(mmsm_backend_intf_t *intf,
+                                                             va_list args)
+{
+    mmsm_data_item_t *command = mmsm_data_item_alloc();
+
+    UNUSED(intf);
+    mmsm_data_item_set_key_u32(command, va_arg(args, uint32_t));
+    return command;
+}
+
+static mmsm_error_code bench_backend_req_blocking(mmsm_backend_intf_t *intf,
+                                                  mmsm_data_item_t *command,
+                                                  mmsm_data_item_t **result)
+{
+    UNUSED(intf);
+
+    *result = mmsm_data_item_alloc();
+    mmsm_data_item_set_key_u32(*result, command->mmsm_key.d.u32);
+    mmsm_data_item_set_val_u32(*result, 0);
+    return MMSM_SUCCESS;
+}
+
+static mmsm_backend_intf_t bench_backend = {
+    .req_blocking = bench_backend_req_blocking,
+    .process_request_args = bench_backend_process_request_args,
+};
+
+static void bench_polling_callback(void *context, mmsm_backend_intf_t *intf,
+                                   mmsm_data_item_t *result)
+{
+    UNUSED(context);
+    UNUSED(intf);
+    UNUSED(result);
+
+    __atomic_fetch_add(&bench_polls, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Polls monitors every millisecond for the target time, and reports the CPU time spent per
+ * monitor fired
+ */
+static void bench_polling_measure(unsigned int monitors)
+{
+    struct timespec wait = {
+        .tv_sec = bench_min_ns / 1000000000ull,
+        .tv_nsec = bench_min_ns % 1000000000ull,
+    };
+    uint64_t cpu;
+    uint64_t allocs;
+    uint64_t polls;
+    char variant[32];
+
+    for (unsigned int i = 0; i < monitors; i++)
+        mmsm_monitor_polling(&bench_backend, 1, bench_polling_callback, NULL, i);
+
+    /* Let the monitors all fall due before measuring */
+    nanosleep(&(struct timespec){ .tv_nsec = 10000000 }, NULL);
+
+    polls = __atomic_load_n(&bench_polls, __ATOMIC_RELAXED);
+    allocs = bench_allocs_now();
+    cpu = bench_now_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    nanosleep(&wait, NULL);
+
+    cpu = bench_now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    allocs = bench_allocs_now() - allocs;
+    polls = __atomic_load_n(&bench_polls, __ATOMIC_RELAXED) - polls;
+
+    mmsm_monitor_polling_remove(&bench_backend, bench_polling_callback, NULL);
+
+    snprintf(variant, sizeof(variant), "monitors_%u", monitors);
+    bench_report("polling", variant, polls, cpu, allocs);
+}
+
+static void bench_polling_run(void)
+{
+    static const unsigned int monitors[] = { 1, 16, 256 };
+
+    if (!bench_selected("polling"))
+        return;
+
+    mmsm_init();
+    if (mmsm_start() != MMSM_SUCCESS)
+    {
+        fprintf(stderr, "Could not start the polling scheduler\n");
+        return;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(monitors); i++)
+        bench_polling_measure(monitors[i]);
+
+    mmsm_stop();
+}
+
+static void bench_usage(void)
+{
+    fprintf(stderr,
+        "Usage: micro_bench [-t <ms>] [-b <benchmark>] [-v]\n"
+        "  -t  time to run each benchmark for at least, default %d ms\n"
+        "  -b  only run the benchmarks whose name contains this, eg. hostapd_parse\n"
+        "  -v  keep logging, to stderr\n", BENCH_DEFAULT_TIME_MS);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const hostapd_variants[] = {
+        "status", "status_keys", "sta", "event"
+    };
+    mmsm_data_item_t *status;
+    struct nl_msg *ocs_done;
+    struct nl_msg *station;
+    mmsm_data_item_t *event;
+    mmsm_data_buf_t *status_buf;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:b:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            if (atoi(optarg) <= 0)
+            {
+                bench_usage();
+                return 1;
+            }
+            bench_min_ns = (uint64_t)atoi(optarg) * 1000000ull;
+            break;
+        case 'b':
+            bench_filter = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            bench_usage();
+            return 1;
+        }
+    }
+
+    /* Logging, some of which ignores the level, goes to stderr, or nowhere unless verbose */
+    bench_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (verbose)
+    {
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    else
+    {
+        mmsm_set_log_level(LOG_LEVEL_NONE);
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+    }
+
+    fprintf(bench_out, "benchmark,case,ops,ns_per_op,allocs_per_op\n");
+
+    for (size_t i = 0; i < ARRAY_SIZE(bench_hostapd_cases); i++)
+        bench_measure("hostapd_parse", hostapd_variants[i], bench_hostapd_parse,
+                      &bench_hostapd_cases[i]);
+
+    ocs_done = bench_nl80211_ocs_done();
+    station = bench_nl80211_station();
+    bench_measure("nl80211_parse", "vendor_ocs_done", bench_nl80211_parse, ocs_done);
+    bench_measure("nl80211_parse", "new_station", bench_nl80211_parse, station);
+
+    bench_measure("data_item", "alloc_free_16", bench_data_item_alloc_free, NULL);
+    bench_measure("data_item", "arena_alloc_free_16", bench_data_item_arena_alloc_free, NULL);
+
+    status_buf = mmsm_data_buf_alloc(sizeof(bench_hostapd_status));
+    memcpy(mmsm_data_buf_data(status_buf), bench_hostapd_status, sizeof(bench_hostapd_status));
+    status = mmsm_backend_hostapd_ctrl_parse(status_buf, sizeof(bench_hostapd_status) - 1, NULL);
+    mmsm_data_buf_put(status_buf);
+    event = mmsm_backend_nl80211_parse(ocs_done);
+    if (!mmsm_find_i64_by_key(status, "s1g_freq", &(int64_t){ 0 }) ||
+        !mmsm_find_by_nested_intkeys(event, NL80211_CMD_VENDOR, NL80211_ATTR_VENDOR_DATA,
+                                     MORSE_VENDOR_ATTR_DATA, -1))
+    {
+        fprintf(stderr, "The parsed replies are missing the values looked up\n");
+        return 1;
+    }
+    bench_measure("data_item", "find_key_status", bench_data_item_find_key, status);
+    bench_measure("data_item", "find_nested_ocs_done", bench_data_item_find_nested, event);
+    mmsm_data_item_free(event);
+    mmsm_data_item_free(status);
+    nlmsg_free(station);
+    nlmsg_free(ocs_done);
+
+    bench_hashmap_run();
+    bench_datalog_run();
+    bench_polling_run();
+
+    fclose(bench_out);
+    return 0;
+}
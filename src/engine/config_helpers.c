@@ -7,7 +7,9 @@
  * Helpers for parsing config settings
  */
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <libconfig.h>
 
@@ -220,3 +222,102 @@ exit:
     LOG_INFO_ALWAYS("Could not find %s : defaulting to %s\n", buff, on_fail);
     return on_fail;
 }
+
+
+bool cfg_setting_equal(struct config_setting_t *a, struct config_setting_t *b)
+{
+    int type;
+
+    if (!a || !b)
+        return a == b;
+
+    type = config_setting_type(a);
+    if (type != config_setting_type(b))
+        return false;
+
+    switch (type)
+    {
+    case CONFIG_TYPE_INT:
+        return config_setting_get_int(a) == config_setting_get_int(b);
+    case CONFIG_TYPE_INT64:
+        return config_setting_get_int64(a) == config_setting_get_int64(b);
+    case CONFIG_TYPE_FLOAT:
+        return config_setting_get_float(a) == config_setting_get_float(b);
+    case CONFIG_TYPE_BOOL:
+        return config_setting_get_bool(a) == config_setting_get_bool(b);
+    case CONFIG_TYPE_STRING:
+        return strcmp(config_setting_get_string(a), config_setting_get_string(b)) == 0;
+    case CONFIG_TYPE_GROUP:
+        if (config_setting_length(a) != config_setting_length(b))
+            return false;
+
+        /* Members may be in any order */
+        for (int i = 0; i < config_setting_length(a); i++)
+        {
+            struct config_setting_t *member = config_setting_get_elem(a, i);
+
+            if (!cfg_setting_equal(member,
+                                   config_setting_get_member(b, config_setting_name(member))))
+                return false;
+        }
+        return true;
+    case CONFIG_TYPE_ARRAY:
+    case CONFIG_TYPE_LIST:
+        if (config_setting_length(a) != config_setting_length(b))
+            return false;
+
+        for (int i = 0; i < config_setting_length(a); i++)
+        {
+            if (!cfg_setting_equal(config_setting_get_elem(a, i), config_setting_get_elem(b, i)))
+                return false;
+        }
+        return true;
+    }
+
+    return true;
+}
+
+
+int cfg_hostapd_control_sock(
+        struct config_setting_t *hostapd_cfg, const char *if_name, char *buff, int buff_len)
+{
+    struct config_setting_t *bss_list;
+    const char *control_path = NULL;
+    int ret;
+
+    MMSM_ASSERT(hostapd_cfg != NULL);
+
+    /* A BSS of another hostapd, listed with its own control_path */
+    bss_list = config_setting_get_member(hostapd_cfg, "bss");
+    for (int i = 0; bss_list && i < config_setting_length(bss_list); i++)
+    {
+        struct config_setting_t *bss = config_setting_get_elem(bss_list, i);
+        const char *name;
+
+        if (!config_setting_lookup_string(bss, "interface", &name) || strcmp(name, if_name))
+            continue;
+
+        if (!config_setting_lookup_string(bss, "control_path", &control_path))
+        {
+            LOG_ERROR("No control_path for hostapd BSS %s (line %d)\n", if_name,
+                config_setting_source_line(bss));
+            return -EINVAL;
+        }
+        break;
+    }
+
+    if (!control_path)
+        control_path = cfg_parse_string(hostapd_cfg, "control_path", NULL);
+    if (!control_path)
+        return -EINVAL;
+
+    ret = snprintf(buff, buff_len, "%s/%s", control_path, if_name);
+    if (ret < 0 || ret >= buff_len)
+    {
+        LOG_ERROR("hostapd control socket of %s is too long\n", if_name);
+        return -ENAMETOOLONG;
+    }
+
+    LOG_INFO_ALWAYS("hostapd control socket of %s is %s\n", if_name, buff);
+    return 0;
+}
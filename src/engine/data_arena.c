@@ -0,0 +1,231 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_index.h"
+#include "mmsm_data.h"
+#include "utils.h"
+
+/** Size of the first chunk of an arena, which also holds the arena itself */
+#define ARENA_FIRST_CHUNK_SIZE  (2048)
+
+/** Largest size chunks grow to. Bigger allocations get a chunk of their own. */
+#define ARENA_MAX_CHUNK_SIZE    (65536)
+
+/** Alignment of every allocation */
+#define ARENA_ALIGN             (16)
+
+#define ARENA_ALIGN_UP(_x) (((_x) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+/**
+ * A block of memory allocations are carved out of
+ */
+typedef struct arena_chunk
+{
+    /** The previously filled chunk */
+    struct arena_chunk *prev;
+    /** Number of bytes of data */
+    size_t size;
+    /** Number of bytes of data handed out */
+    size_t used;
+    /** The data */
+    uint8_t data[] __attribute__((aligned(ARENA_ALIGN)));
+} arena_chunk_t;
+
+/**
+ * A buffer referenced by items of an arena
+ */
+typedef struct arena_held_buf
+{
+    /** The previously held buffer */
+    struct arena_held_buf *prev;
+    /** The buffer */
+    mmsm_data_buf_t *buf;
+} arena_held_buf_t;
+
+struct mmsm_data_arena
+{
+    /** The chunk currently being allocated from */
+    arena_chunk_t *chunk;
+    /** The first item allocated, whose freeing releases the arena */
+    mmsm_data_item_t *root;
+    /** One for the creator, and one for the root until it is freed */
+    unsigned int refs;
+    /** Size of the next chunk to allocate */
+    size_t next_chunk_size;
+    /** Buffers the arena holds a reference to, most recent first */
+    arena_held_buf_t *held;
+    /** Indices built on items of the arena, which are heap allocated */
+    struct mmsm_data_index *indices;
+};
+
+static arena_chunk_t *arena_chunk_alloc(size_t size)
+{
+    arena_chunk_t *chunk = malloc(sizeof(*chunk) + size);
+
+    if (!chunk)
+        return NULL;
+
+    chunk->prev = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+mmsm_data_arena_t *mmsm_data_arena_create(void)
+{
+    arena_chunk_t *chunk = arena_chunk_alloc(ARENA_FIRST_CHUNK_SIZE);
+    mmsm_data_arena_t *arena;
+
+    if (!chunk)
+        return NULL;
+
+    /* The arena lives at the start of its first chunk */
+    arena = (mmsm_data_arena_t *)chunk->data;
+    chunk->used = ARENA_ALIGN_UP(sizeof(*arena));
+    arena->chunk = chunk;
+    arena->root = NULL;
+    arena->refs = 1;
+    arena->next_chunk_size = ARENA_FIRST_CHUNK_SIZE * 2;
+    arena->held = NULL;
+    arena->indices = NULL;
+
+    return arena;
+}
+
+static void arena_release(mmsm_data_arena_t *arena)
+{
+    arena_chunk_t *chunk = arena->chunk;
+    arena_held_buf_t *held;
+
+    for (held = arena->held; held; held = held->prev)
+        mmsm_data_buf_put(held->buf);
+
+    data_index_free_arena_list(arena->indices);
+
+    /* The first chunk holds the arena, so is freed last */
+    while (chunk)
+    {
+        arena_chunk_t *prev = chunk->prev;
+
+        free(chunk);
+        chunk = prev;
+    }
+}
+
+static void arena_unref(mmsm_data_arena_t *arena)
+{
+    if (__atomic_sub_fetch(&arena->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        arena_release(arena);
+}
+
+void mmsm_data_arena_put(mmsm_data_arena_t *arena)
+{
+    if (arena)
+        arena_unref(arena);
+}
+
+void *mmsm_data_arena_alloc(mmsm_data_arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk = arena->chunk;
+    void *ptr;
+
+    size = ARENA_ALIGN_UP(size ? size : 1);
+
+    if (chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = arena->next_chunk_size;
+
+        if (chunk_size < size)
+            chunk_size = size;
+
+        chunk = arena_chunk_alloc(chunk_size);
+        if (!chunk)
+            return NULL;
+
+        if (arena->next_chunk_size < ARENA_MAX_CHUNK_SIZE)
+            arena->next_chunk_size *= 2;
+
+        /*
+         * Keep allocating from the current chunk if it has more space left than the new one
+         * will after this allocation, e.g. when the allocation is too big for a normal chunk.
+         */
+        if (chunk_size - size < arena->chunk->size - arena->chunk->used)
+        {
+            chunk->prev = arena->chunk->prev;
+            arena->chunk->prev = chunk;
+        }
+        else
+        {
+            chunk->prev = arena->chunk;
+            arena->chunk = chunk;
+        }
+    }
+
+    ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+mmsm_data_item_t *mmsm_data_item_alloc_in(mmsm_data_arena_t *arena)
+{
+    mmsm_data_item_t *item;
+
+    if (!arena)
+        return mmsm_data_item_alloc();
+
+    item = mmsm_data_arena_alloc(arena, sizeof(*item));
+    if (!item)
+        return NULL;
+
+    item->mmsm_arena = arena;
+    if (!arena->root)
+    {
+        arena->root = item;
+        __atomic_add_fetch(&arena->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    return item;
+}
+
+void mmsm_data_arena_item_free(mmsm_data_item_t *item)
+{
+    mmsm_data_arena_t *arena = item->mmsm_arena;
+
+    /* Everything else in the tree is released along with the root */
+    if (arena->root == item)
+        arena_unref(arena);
+}
+
+struct mmsm_data_index **mmsm_data_arena_index_list(mmsm_data_arena_t *arena)
+{
+    return &arena->indices;
+}
+
+int mmsm_data_arena_hold(mmsm_data_arena_t *arena, mmsm_data_buf_t *buf)
+{
+    arena_held_buf_t *held;
+
+    /* Items of a tree tend to reference the same buffer one after the other */
+    if (arena->held && arena->held->buf == buf)
+        return 0;
+
+    held = mmsm_data_arena_alloc(arena, sizeof(*held));
+    if (!held)
+        return -ENOMEM;
+
+    held->buf = mmsm_data_buf_get(buf);
+    held->prev = arena->held;
+    arena->held = held;
+    return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mmsm_data.h"
+#include "utils.h"
+
+struct mmsm_data_buf
+{
+    /** Number of references */
+    unsigned int refs;
+    /** Releases the memory, or NULL if it is @ref data */
+    mmsm_data_buf_release_fn_t release;
+    /** Passed to release */
+    void *ctx;
+    /** Memory of buffers made by @ref mmsm_data_buf_alloc */
+    uint8_t data[] __attribute__((aligned(16)));
+};
+
+mmsm_data_buf_t *mmsm_data_buf_create(mmsm_data_buf_release_fn_t release, void *ctx)
+{
+    mmsm_data_buf_t *buf = malloc(sizeof(*buf));
+
+    if (!buf)
+        return NULL;
+
+    buf->refs = 1;
+    buf->release = release;
+    buf->ctx = ctx;
+    return buf;
+}
+
+mmsm_data_buf_t *mmsm_data_buf_alloc(size_t size)
+{
+    mmsm_data_buf_t *buf = malloc(sizeof(*buf) + size);
+
+    if (!buf)
+        return NULL;
+
+    buf->refs = 1;
+    buf->release = NULL;
+    buf->ctx = NULL;
+    return buf;
+}
+
+void *mmsm_data_buf_data(mmsm_data_buf_t *buf)
+{
+    return buf->data;
+}
+
+mmsm_data_buf_t *mmsm_data_buf_get(mmsm_data_buf_t *buf)
+{
+    __atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+void mmsm_data_buf_put(mmsm_data_buf_t *buf)
+{
+    if (!buf)
+        return;
+
+    if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    if (buf->release)
+        buf->release(buf->ctx);
+    free(buf);
+}
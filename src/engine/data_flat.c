@@ -0,0 +1,468 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmsm_flat.h"
+#include "helpers.h"
+#include "utils.h"
+
+/** Set if the item has a value, even an empty one */
+#define FLAT_HAS_VALUE  (1 << 0)
+/** Set if the item has sub-values, which follow its value */
+#define FLAT_HAS_SUB    (1 << 1)
+/** Set if another item follows this one's record */
+#define FLAT_HAS_NEXT   (1 << 2)
+
+/** Deepest nesting accepted by @ref mmsm_flat_validate */
+#define FLAT_MAX_DEPTH  (64)
+
+#define FLAT_ALIGN_UP(_x) (((_x) + 3) & ~(size_t)3)
+
+struct mmsm_flat_item_t
+{
+    /** Size of the record in bytes, including its sub-values */
+    uint32_t size;
+    /** Length of the value */
+    uint32_t value_len;
+    /** The key if it is an integer, otherwise the length of the string key including its
+     *  terminator, or 0 for a NULL string */
+    uint32_t key;
+    /** A @ref mmsm_key_type_t */
+    uint8_t key_type;
+    /** FLAT_HAS_* flags */
+    uint8_t flags;
+    uint16_t reserved;
+    /** The string key, then the value, each padded to 4 bytes, then the sub-values */
+    uint8_t data[];
+};
+
+static size_t flat_key_len(const mmsm_data_item_t *item)
+{
+    if (item->mmsm_key.type != MMSM_KEY_TYPE_STRING || !item->mmsm_key.d.string)
+        return 0;
+
+    return strlen(item->mmsm_key.d.string) + 1;
+}
+
+static size_t flat_list_size(const mmsm_data_item_t *item)
+{
+    size_t size = 0;
+
+    for (; item; item = item->mmsm_next)
+    {
+        size_t sub = flat_list_size(item->mmsm_sub_values);
+
+        if (item->mmsm_sub_values && !sub)
+            return 0;
+
+        size += sizeof(mmsm_flat_item_t) + FLAT_ALIGN_UP(flat_key_len(item)) +
+                FLAT_ALIGN_UP(item->mmsm_value_len) + sub;
+        if (size > UINT32_MAX - sizeof(mmsm_flat_t))
+            return 0;
+    }
+
+    return size;
+}
+
+size_t
+mmsm_flat_size(const mmsm_data_item_t *item)
+{
+    size_t size = flat_list_size(item);
+
+    if (item && !size)
+        return 0;
+
+    return sizeof(mmsm_flat_t) + size;
+}
+
+/**
+ * Encodes a list into a buffer known to be big enough, returning the bytes written
+ */
+static size_t flat_encode_list(const mmsm_data_item_t *item, uint8_t *out)
+{
+    uint8_t *start = out;
+
+    for (; item; item = item->mmsm_next)
+    {
+        mmsm_flat_item_t *record = (mmsm_flat_item_t *)out;
+        size_t key_len = flat_key_len(item);
+        uint8_t *data = record->data;
+
+        memset(record, 0, sizeof(*record));
+        record->key_type = item->mmsm_key.type;
+        record->key = item->mmsm_key.type == MMSM_KEY_TYPE_U32 ? item->mmsm_key.d.u32 : key_len;
+        record->value_len = item->mmsm_value_len;
+        if (item->mmsm_value)
+            record->flags |= FLAT_HAS_VALUE;
+        if (item->mmsm_next)
+            record->flags |= FLAT_HAS_NEXT;
+
+        memset(data, 0, FLAT_ALIGN_UP(key_len));
+        if (key_len)
+            memcpy(data, item->mmsm_key.d.string, key_len);
+        data += FLAT_ALIGN_UP(key_len);
+
+        memset(data, 0, FLAT_ALIGN_UP(item->mmsm_value_len));
+        if (item->mmsm_value && item->mmsm_value_len)
+            memcpy(data, item->mmsm_value, item->mmsm_value_len);
+        data += FLAT_ALIGN_UP(item->mmsm_value_len);
+
+        if (item->mmsm_sub_values)
+        {
+            record->flags |= FLAT_HAS_SUB;
+            data += flat_encode_list(item->mmsm_sub_values, data);
+        }
+
+        record->size = data - out;
+        out = data;
+    }
+
+    return out - start;
+}
+
+size_t
+mmsm_flat_encode(const mmsm_data_item_t *item, void *buf, size_t len)
+{
+    size_t size = mmsm_flat_size(item);
+    mmsm_flat_t *flat = buf;
+
+    if (!size || size > len)
+        return 0;
+
+    flat->magic = MMSM_FLAT_MAGIC;
+    flat->len = size;
+    flat_encode_list(item, (uint8_t *)(flat + 1));
+
+    return size;
+}
+
+mmsm_flat_t *
+mmsm_flat_serialize(const mmsm_data_item_t *item)
+{
+    size_t size = mmsm_flat_size(item);
+    mmsm_flat_t *flat;
+
+    if (!size)
+        return NULL;
+
+    flat = malloc(size);
+    if (!flat)
+        return NULL;
+
+    mmsm_flat_encode(item, flat, size);
+    return flat;
+}
+
+static const uint8_t *flat_item_value_start(const mmsm_flat_item_t *item)
+{
+    size_t key_len = item->key_type == MMSM_KEY_TYPE_STRING ? item->key : 0;
+
+    return item->data + FLAT_ALIGN_UP(key_len);
+}
+
+/**
+ * Checks that a list exactly fills len bytes
+ */
+static bool flat_validate_list(const uint8_t *buf, size_t len, unsigned int depth)
+{
+    const uint8_t *end = buf + len;
+
+    if (depth > FLAT_MAX_DEPTH)
+        return false;
+
+    while (buf < end)
+    {
+        const mmsm_flat_item_t *item = (const mmsm_flat_item_t *)buf;
+        size_t remaining = end - buf;
+        size_t used = sizeof(*item);
+
+        if (remaining < sizeof(*item) || item->size < sizeof(*item) ||
+            item->size > remaining || item->size % 4)
+            return false;
+
+        if (item->key_type == MMSM_KEY_TYPE_STRING)
+        {
+            if (item->key > item->size - used)
+                return false;
+            if (item->key && item->data[item->key - 1] != 0)
+                return false;
+            used += FLAT_ALIGN_UP(item->key);
+        }
+        else if (item->key_type != MMSM_KEY_TYPE_U32)
+        {
+            return false;
+        }
+
+        if (used > item->size || item->value_len > item->size - used)
+            return false;
+        used += FLAT_ALIGN_UP(item->value_len);
+        if (used > item->size)
+            return false;
+
+        if (item->flags & FLAT_HAS_SUB)
+        {
+            if (used == item->size ||
+                !flat_validate_list(buf + used, item->size - used, depth + 1))
+                return false;
+        }
+        else if (used != item->size)
+        {
+            return false;
+        }
+
+        buf += item->size;
+        if (!(item->flags & FLAT_HAS_NEXT))
+            break;
+        if (buf == end)
+            return false;
+    }
+
+    return buf == end;
+}
+
+bool
+mmsm_flat_validate(const void *buf, size_t len)
+{
+    const mmsm_flat_t *flat = buf;
+
+    if (!buf || len < sizeof(*flat) || flat->magic != MMSM_FLAT_MAGIC ||
+        flat->len < sizeof(*flat) || flat->len > len)
+        return false;
+
+    return flat_validate_list((const uint8_t *)(flat + 1), flat->len - sizeof(*flat), 0);
+}
+
+/**
+ * Decodes a list, allocating its items from an arena. The list is linked into *out as it is
+ * built, so that on failure whatever was allocated can still be freed.
+ *
+ * @return 0 on success, or -ENOMEM
+ */
+static int flat_decode_list(mmsm_data_arena_t *arena, const mmsm_flat_item_t *record,
+                            mmsm_data_item_t **out)
+{
+    mmsm_data_item_t *item = NULL;
+
+    for (; record; record = mmsm_flat_item_next(record))
+    {
+        const mmsm_flat_item_t *sub = mmsm_flat_item_sub_values(record);
+        mmsm_key_t key = mmsm_flat_item_key(record);
+
+        item = item ? mmsm_data_item_alloc_next(item) : (*out = mmsm_data_item_alloc_in(arena));
+        if (!item)
+            return -ENOMEM;
+
+        if (key.type == MMSM_KEY_TYPE_U32)
+            mmsm_data_item_set_key_u32(item, key.d.u32);
+        else if (key.d.string)
+            mmsm_data_item_set_key_str(item, key.d.string);
+        else
+            item->mmsm_key.type = MMSM_KEY_TYPE_STRING;
+
+        if (record->flags & FLAT_HAS_VALUE)
+        {
+            item->mmsm_value = mmsm_data_item_value_alloc(item, record->value_len);
+            if (!item->mmsm_value)
+                return -ENOMEM;
+            memcpy(item->mmsm_value, flat_item_value_start(record), record->value_len);
+            item->mmsm_value_len = record->value_len;
+        }
+
+        if (sub && flat_decode_list(arena, sub, &item->mmsm_sub_values) != 0)
+            return -ENOMEM;
+    }
+
+    return 0;
+}
+
+mmsm_data_item_t *
+mmsm_flat_deserialize(const void *buf, size_t len)
+{
+    const mmsm_flat_item_t *first;
+    mmsm_data_arena_t *arena;
+    mmsm_data_item_t *head = NULL;
+
+    if (!mmsm_flat_validate(buf, len))
+        return NULL;
+
+    first = mmsm_flat_first(buf);
+    if (!first)
+        return NULL;
+
+    /* The whole tree is freed at once, so allocate it in one arena */
+    arena = mmsm_data_arena_create();
+    if (flat_decode_list(arena, first, &head) != 0)
+    {
+        mmsm_data_item_free(head);
+        head = NULL;
+    }
+    mmsm_data_arena_put(arena);
+
+    return head;
+}
+
+const mmsm_flat_item_t *
+mmsm_flat_first(const mmsm_flat_t *flat)
+{
+    if (flat->len <= sizeof(*flat))
+        return NULL;
+
+    return (const mmsm_flat_item_t *)(flat + 1);
+}
+
+const mmsm_flat_item_t *
+mmsm_flat_item_next(const mmsm_flat_item_t *item)
+{
+    if (!(item->flags & FLAT_HAS_NEXT))
+        return NULL;
+
+    return (const mmsm_flat_item_t *)((const uint8_t *)item + item->size);
+}
+
+const mmsm_flat_item_t *
+mmsm_flat_item_sub_values(const mmsm_flat_item_t *item)
+{
+    if (!(item->flags & FLAT_HAS_SUB))
+        return NULL;
+
+    return (const mmsm_flat_item_t *)(flat_item_value_start(item) +
+                                      FLAT_ALIGN_UP(item->value_len));
+}
+
+mmsm_key_t
+mmsm_flat_item_key(const mmsm_flat_item_t *item)
+{
+    mmsm_key_t key = { .type = item->key_type };
+
+    if (item->key_type == MMSM_KEY_TYPE_U32)
+        key.d.u32 = item->key;
+    else
+        key.d.string = item->key ? (char *)item->data : NULL;
+
+    return key;
+}
+
+const uint8_t *
+mmsm_flat_item_value(const mmsm_flat_item_t *item)
+{
+    if (!(item->flags & FLAT_HAS_VALUE))
+        return NULL;
+
+    return flat_item_value_start(item);
+}
+
+uint32_t
+mmsm_flat_item_value_len(const mmsm_flat_item_t *item)
+{
+    return item->value_len;
+}
+
+const mmsm_flat_item_t *
+mmsm_flat_find_key(const mmsm_flat_item_t *head, const mmsm_key_t *key)
+{
+    for_each_flat_item(head, head)
+    {
+        if (head->key_type != key->type)
+            continue;
+
+        if (key->type == MMSM_KEY_TYPE_U32)
+        {
+            if (head->key == key->d.u32)
+                return head;
+        }
+        else if (head->key && key->d.string && strcmp((const char *)head->data, key->d.string) == 0)
+        {
+            return head;
+        }
+    }
+
+    return NULL;
+}
+
+const uint8_t *
+mmsm_flat_find_value_by_key(const mmsm_flat_item_t *head, const char *key)
+{
+    mmsm_key_t k = { .type = MMSM_KEY_TYPE_STRING, .d.string = (char *)key };
+    const mmsm_flat_item_t *item = mmsm_flat_find_key(head, &k);
+
+    return item ? mmsm_flat_item_value(item) : NULL;
+}
+
+const uint8_t *
+mmsm_flat_find_value_by_intkey(const mmsm_flat_item_t *head, uint32_t key)
+{
+    mmsm_key_t k = { .type = MMSM_KEY_TYPE_U32, .d.u32 = key };
+    const mmsm_flat_item_t *item = mmsm_flat_find_key(head, &k);
+
+    return item ? mmsm_flat_item_value(item) : NULL;
+}
+
+const uint8_t *
+mmsm_flat_find_nth_value(const mmsm_flat_item_t *head, uint32_t n)
+{
+    while (head && n > 0)
+    {
+        head = mmsm_flat_item_next(head);
+        n--;
+    }
+
+    return head ? mmsm_flat_item_value(head) : NULL;
+}
+
+const uint8_t *
+mmsm_flat_find_by_nested_intkeys(const mmsm_flat_item_t *head, ...)
+{
+    va_list args;
+    int attr_id;
+    const mmsm_flat_item_t *iter = head;
+
+    va_start(args, head);
+
+    attr_id = va_arg(args, int);
+    while (attr_id != -1)
+    {
+        mmsm_key_t key = { .type = MMSM_KEY_TYPE_U32, .d.u32 = attr_id };
+
+        iter = mmsm_flat_find_key(iter, &key);
+        if (iter == NULL)
+        {
+            va_end(args);
+            return NULL;
+        }
+
+        attr_id = va_arg(args, int);
+
+        if (attr_id != -1)
+            iter = mmsm_flat_item_sub_values(iter);
+    }
+
+    va_end(args);
+    return mmsm_flat_item_value(iter);
+}
+
+bool
+mmsm_flat_is_flag_set_in(const mmsm_flat_item_t *head, const char *key, const char *flag)
+{
+    mmsm_key_t k = { .type = MMSM_KEY_TYPE_STRING, .d.string = (char *)key };
+    const mmsm_flat_item_t *item = mmsm_flat_find_key(head, &k);
+    const char *value = item ? (const char *)mmsm_flat_item_value(item) : NULL;
+    char wrapped_flag[1024];
+
+    /* Values aren't always strings, so don't search past the end of one */
+    if (!value || !memchr(value, 0, item->value_len))
+        return false;
+
+    snprintf(wrapped_flag, sizeof(wrapped_flag), "[%s]", flag);
+
+    return strstr(value, wrapped_flag) != NULL;
+}
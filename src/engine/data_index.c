@@ -0,0 +1,197 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data_index.h"
+#include "utils.h"
+
+struct mmsm_data_index
+{
+    /** The next index to free along with the arena of the item, for arena items */
+    struct mmsm_data_index *arena_next;
+    /** The last item of the list when the index was built */
+    mmsm_data_item_t *tail;
+    /** Number of slots - 1. The number of slots is a power of 2. */
+    size_t mask;
+    /** Open addressed slots holding the first item with each key, or NULL */
+    mmsm_data_item_t *slots[];
+};
+
+static uint32_t data_index_hash(const mmsm_key_t *key)
+{
+    uint32_t hash;
+
+    if (key->type == MMSM_KEY_TYPE_U32)
+    {
+        hash = key->d.u32 * 0x9e3779b1u;
+        return hash ^ (hash >> 16);
+    }
+
+    if (key->interned)
+        return mmsm_key_atom_hash(key->d.string);
+
+    /* FNV-1a, as atoms are hashed */
+    hash = 2166136261u;
+    for (const char *c = key->d.string; *c; c++)
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+
+    return hash;
+}
+
+static bool data_index_key_equal(const mmsm_key_t *a, const mmsm_key_t *b)
+{
+    if (a->type != b->type)
+        return false;
+
+    if (a->type == MMSM_KEY_TYPE_U32)
+        return a->d.u32 == b->d.u32;
+
+    return a->d.string && b->d.string && mmsm_key_string_equal(a, b);
+}
+
+static mmsm_data_item_t *data_index_walk(mmsm_data_item_t *head, const mmsm_key_t *key)
+{
+    for (; head; head = head->mmsm_next)
+    {
+        if (data_index_key_equal(&head->mmsm_key, key))
+            return head;
+    }
+
+    return NULL;
+}
+
+/**
+ * Builds an index for a list, or returns NULL if the list is too short or allocation fails
+ */
+static struct mmsm_data_index *data_index_build(mmsm_data_item_t *head)
+{
+    struct mmsm_data_index *index;
+    mmsm_data_item_t *item;
+    size_t count = 0;
+    size_t size = 1;
+
+    for (item = head; item; item = item->mmsm_next)
+        count++;
+
+    if (count < DATA_INDEX_MIN_ITEMS)
+        return NULL;
+
+    /* Keep the load factor at most a half */
+    while (size < count * 2)
+        size <<= 1;
+
+    /* Always on the heap: allocating from an arena isn't safe on a tree shared between threads */
+    index = calloc(1, sizeof(*index) + size * sizeof(index->slots[0]));
+    if (!index)
+        return NULL;
+
+    index->mask = size - 1;
+    for (item = head; item; item = item->mmsm_next)
+    {
+        size_t slot;
+
+        index->tail = item;
+        if (item->mmsm_key.type == MMSM_KEY_TYPE_STRING && !item->mmsm_key.d.string)
+            continue;
+
+        for (slot = data_index_hash(&item->mmsm_key) & index->mask;
+             index->slots[slot];
+             slot = (slot + 1) & index->mask)
+        {
+            if (data_index_key_equal(&index->slots[slot]->mmsm_key, &item->mmsm_key))
+                break;
+        }
+
+        /* Lookups return the first item with a key, as walking the list would */
+        if (!index->slots[slot])
+            index->slots[slot] = item;
+    }
+
+    return index;
+}
+
+/**
+ * Links an index attached to an arena item into the arena's list, to be freed with the arena
+ */
+static void data_index_arena_link(mmsm_data_arena_t *arena, struct mmsm_data_index *index)
+{
+    struct mmsm_data_index **list = mmsm_data_arena_index_list(arena);
+
+    index->arena_next = __atomic_load_n(list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(list, &index->arena_next, index, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+mmsm_data_item_t *data_index_find(mmsm_data_item_t *head, const mmsm_key_t *key)
+{
+    struct mmsm_data_index *index;
+    size_t slot;
+
+    if (!head)
+        return NULL;
+
+    index = __atomic_load_n(&head->mmsm_index, __ATOMIC_ACQUIRE);
+    if (!index)
+    {
+        struct mmsm_data_index *expected = NULL;
+
+        index = data_index_build(head);
+        if (!index)
+            return data_index_walk(head, key);
+
+        /* Another thread may have raced to build one too */
+        if (!__atomic_compare_exchange_n(&head->mmsm_index, &expected, index, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            free(index);
+            index = expected;
+        }
+        else if (head->mmsm_arena)
+        {
+            data_index_arena_link(head->mmsm_arena, index);
+        }
+    }
+
+    /* The list has grown since the index was built */
+    if (index->tail->mmsm_next)
+        return data_index_walk(head, key);
+
+    if (key->type == MMSM_KEY_TYPE_STRING && !key->d.string)
+        return NULL;
+
+    for (slot = data_index_hash(key) & index->mask;
+         index->slots[slot];
+         slot = (slot + 1) & index->mask)
+    {
+        if (data_index_key_equal(&index->slots[slot]->mmsm_key, key))
+            return index->slots[slot];
+    }
+
+    return NULL;
+}
+
+void data_index_free(mmsm_data_item_t *item)
+{
+    if (!item->mmsm_arena)
+        free(item->mmsm_index);
+    item->mmsm_index = NULL;
+}
+
+void data_index_free_arena_list(struct mmsm_data_index *list)
+{
+    while (list)
+    {
+        struct mmsm_data_index *next = list->arena_next;
+
+        free(list);
+        list = next;
+    }
+}
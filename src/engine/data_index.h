@@ -0,0 +1,55 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include "mmsm_data.h"
+
+/**
+ * Engine-internal hash index over the keys of a data item list, used by the mmsm_find_* helpers.
+ *
+ * The index is built the first time a long enough list is searched, and attached to the item
+ * the search started from. It is never changed after being attached, so concurrent lookups on a
+ * shared response are safe. Items appended to the list afterwards aren't in the index, so once
+ * the list has grown lookups fall back to walking it. Keys must not be changed once a list has
+ * been searched.
+ */
+
+/** Lists shorter than this are always walked */
+#define DATA_INDEX_MIN_ITEMS (8)
+
+/**
+ * @brief Find the first item of a list with a key
+ *
+ * @param head The first item of the list
+ * @param key The key to find
+ * @return the item, or NULL if no item has the key
+ */
+mmsm_data_item_t *data_index_find(mmsm_data_item_t *head, const mmsm_key_t *key);
+
+/**
+ * @brief Free the index attached to an item, if any. Does nothing for arena items, whose index
+ *        is freed with the arena.
+ *
+ * @param item The item
+ */
+void data_index_free(mmsm_data_item_t *item);
+
+/**
+ * @brief Free the indices attached to the items of an arena, as the arena is released
+ *
+ * @param list The arena's list, from @ref mmsm_data_arena_index_list
+ */
+void data_index_free_arena_list(struct mmsm_data_index *list);
+
+/**
+ * @brief Get the list of indices attached to the items of an arena. Indices are always heap
+ *        allocated, as the arena can't be allocated from once its tree is shared between
+ *        threads, and are linked into this list to be freed with the arena.
+ *
+ * @param arena The arena
+ * @return the head of the list, only to be updated atomically
+ */
+struct mmsm_data_index **mmsm_data_arena_index_list(mmsm_data_arena_t *arena);
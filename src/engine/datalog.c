@@ -6,12 +6,16 @@
 #include <time.h>
 #include <string.h>
 #include <errno.h>
+#include <endian.h>
 #include <stdarg.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <libconfig.h>
 
 #include "datalog.h"
@@ -19,6 +23,7 @@
 #include "utils.h"
 #include "timestamp.h"
 #include "helpers.h"
+#include "datalog_archive.h"
 
 /** Root datalog directory */
 static char datalog_root[64] = "/var/log/smart_manager";
@@ -26,17 +31,684 @@ static char datalog_root[64] = "/var/log/smart_manager";
 /** Datalog config settings */
 static config_setting_t *dl_config;
 
+/** Default number of records queued for the writer thread */
+#define DATALOG_DEFAULT_QUEUE_SIZE (1024)
+
+/** Default time between the writer thread writing the queued records out */
+#define DATALOG_DEFAULT_FLUSH_INTERVAL_MS (1000)
+
+/** Shortest time between warnings of records being dropped */
+#define DATALOG_DROPPED_WARN_INTERVAL_MS (10000)
+
+/** Length of the fixed part of a binary datalog's header */
+#define DATALOG_BINARY_HEADER_LEN (24)
+
+/** Offset of base_ms in a binary datalog's header */
+#define DATALOG_BINARY_BASE_OFFSET (16)
+
+/**
+ * A slot of the writer thread's queue, holding a formatted record.
+ *
+ * The queue is a bounded ring that any number of threads push to without locking, and the
+ * writer thread alone pops from. Pushing claims the tail position with a compare-and-swap, then
+ * fills the slot in and publishes it by setting seq one past the position. Popping releases the
+ * slot to the position a lap on. A slot whose seq is behind the tail position is still waiting
+ * for the writer thread, so the queue is full.
+ */
+typedef struct datalog_slot
+{
+    /** Position the slot may be claimed at, or one past it once it holds a record */
+    size_t seq;
+    /** Datalog the record is for */
+    struct datalog *dl;
+    /** The record, to free once written */
+    char *text;
+    /** Length of the record */
+    size_t len;
+    /** Whether to rotate the file before writing the record, which is its headings */
+    bool rotate;
+} datalog_slot_t;
+
+/** The writer thread of async datalogs, and the queue of records waiting for it */
+static struct
+{
+    /** Next position to claim, advanced by the threads writing records */
+    size_t tail __attribute__((aligned(64)));
+    /** Next position to write out, only advanced by the writer thread */
+    size_t head __attribute__((aligned(64)));
+    /** The slots, indexed by position modulo the capacity */
+    datalog_slot_t *slots __attribute__((aligned(64)));
+    /** Number of slots, a power of 2 */
+    size_t capacity;
+    /** Records dropped across all datalogs */
+    uint64_t dropped;
+    /** Set when the queue has filled up to half, to have the writer thread drain it early */
+    bool kicked;
+
+    /** Whether datalogs created from now on are async */
+    bool enabled;
+    /** Number of slots to create the queue with */
+    size_t queue_size;
+    /** Time between writing the queued records out */
+    uint32_t flush_interval_ms;
+
+    /** Serialises starting and stopping the writer thread, along with the datalogs using it */
+    pthread_mutex_t lifecycle_mutex;
+    /** Protects the fields below, and sleeping on the conditions */
+    pthread_mutex_t mutex;
+    /** Signalled to wake the writer thread */
+    pthread_cond_t wake;
+    /** Signalled by the writer thread each time it has written records out and flushed them */
+    pthread_cond_t flushed;
+    /** The async datalogs open */
+    list_head_t datalogs;
+    /** Position up to which records have been written out and flushed */
+    size_t flushed_to;
+    /** Position up to which a thread is waiting for records to be flushed */
+    size_t flush_to;
+    /** Set to stop the writer thread */
+    bool stopping;
+    pthread_t thread;
+} dl_writer = {
+    .lifecycle_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .queue_size = DATALOG_DEFAULT_QUEUE_SIZE,
+    .flush_interval_ms = DATALOG_DEFAULT_FLUSH_INTERVAL_MS,
+};
+
+static pthread_once_t dl_writer_once = PTHREAD_ONCE_INIT;
+
+/** Shortest record with a 't' column, to hold the time of a rebase record */
+#define DATALOG_BINARY_MIN_REBASE_LEN (sizeof(int32_t) + sizeof(uint64_t))
+
+/** Width of a column of a binary datalog, or 0 if the type can't be written as one */
+static size_t binary_field_width(char type)
+{
+    switch (type)
+    {
+        case 'u':
+        case 'd':
+        case 't':
+            return sizeof(uint32_t);
+        case 'b':
+            return sizeof(uint8_t);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Lay out the records of a binary datalog
+ *
+ * @param layout Layout, with its columns set, to fill in the offsets and length of
+ * @return true if every column is fixed width, else false
+ */
+static bool binary_layout(struct datalog_binary *layout)
+{
+    uint32_t len = 0;
+
+    layout->rebase_field = -1;
+    for (int i = 0; i < layout->n_fields; i++)
+    {
+        size_t width = binary_field_width(layout->fmt[i]);
+
+        if (!width)
+            return false;
+
+        if (layout->fmt[i] == 't' && layout->rebase_field < 0)
+            layout->rebase_field = i;
+
+        layout->offset[i] = len;
+        len += width;
+    }
+
+    if (layout->rebase_field >= 0)
+        len = MAX(len, DATALOG_BINARY_MIN_REBASE_LEN);
+
+    layout->record_len = len;
+    return true;
+}
+
+static void put_le16(uint8_t *p, uint16_t val)
+{
+    val = htole16(val);
+    memcpy(p, &val, sizeof(val));
+}
+
+static void put_le32(uint8_t *p, uint32_t val)
+{
+    val = htole32(val);
+    memcpy(p, &val, sizeof(val));
+}
+
+static void put_le64(uint8_t *p, uint64_t val)
+{
+    val = htole64(val);
+    memcpy(p, &val, sizeof(val));
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    uint16_t val;
+
+    memcpy(&val, p, sizeof(val));
+    return le16toh(val);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    uint32_t val;
+
+    memcpy(&val, p, sizeof(val));
+    return le32toh(val);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    uint64_t val;
+
+    memcpy(&val, p, sizeof(val));
+    return le64toh(val);
+}
+
+/**
+ * @brief Encode a rebase record of a binary datalog, see @ref datalog_init_columns
+ *
+ * @param layout Layout of the datalog, which must have a 't' column
+ * @param record Set to the record, of the layout's record length
+ * @param time_ms Time the next record is to be relative to
+ */
+static void encode_rebase(const struct datalog_binary *layout, uint8_t *record, uint64_t time_ms)
+{
+    uint8_t payload[sizeof(uint64_t)];
+    size_t offset = layout->offset[layout->rebase_field];
+    size_t before = MIN(offset, sizeof(payload));
+
+    memset(record, 0, layout->record_len);
+
+    /* The time goes either side of the marker, as much as fits before it */
+    put_le64(payload, time_ms);
+    put_le32(record + offset, (uint32_t)INT32_MIN);
+    memcpy(record, payload, before);
+    memcpy(record + offset + sizeof(uint32_t), payload + before, sizeof(payload) - before);
+}
+
+/**
+ * @brief Rotate a datalog's file: rename it to the next segment, which is handed over to be
+ *        archived, and start a new file in its place
+ *
+ * Only called by the thread writing the file, the writer thread for async datalogs, else with
+ * the file locked. The FILE stays the same, so other threads waiting to write to it can then
+ * carry on with the new file.
+ *
+ * @param dl The datalog
+ * @return 0 on success, else -errno, in which case the file carries on as it was
+ */
+static int rotate_file(struct datalog *dl)
+{
+    char segment[sizeof(dl->rotate.path) + 16];
+    int ret;
+    int fd;
+
+    fflush(dl->fptr);
+    snprintf(segment, sizeof(segment), "%s.%u", dl->rotate.path, dl->rotate.segment);
+
+    if (rename(dl->rotate.path, segment))
+    {
+        ret = -errno;
+        goto fail;
+    }
+
+    fd = open(dl->rotate.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+    {
+        ret = -errno;
+        rename(segment, dl->rotate.path);
+        goto fail;
+    }
+
+    /* Swap the new file in under the FILE, and tell it it's at the start */
+    ret = dup2(fd, fileno(dl->fptr)) < 0 ? -errno : 0;
+    close(fd);
+    if (ret)
+    {
+        rename(segment, dl->rotate.path);
+        goto fail;
+    }
+    fseeko(dl->fptr, 0, SEEK_SET);
+
+    dl->rotate.segment++;
+    datalog_archive_add(segment);
+    return 0;
+
+fail:
+    LOG_WARN("Failed to rotate datalog %s (%d)\n", dl->rotate.path, ret);
+    return ret;
+}
+
 void datalog_set_root_dir(const char *path)
 {
-    strncpy(datalog_root, path, sizeof(datalog_root) - 1);
+    /* Defaults to itself when the config doesn't set one */
+    if (path != datalog_root)
+        strncpy(datalog_root, path, sizeof(datalog_root) - 1);
     LOG_INFO("Datalog root directory set: %s\n", datalog_root);
 }
 
 void datalog_set_config_settings(config_setting_t *config)
 {
+    int value;
+
     dl_config = config;
     datalog_set_root_dir(
         cfg_parse_string_with_default(config, "root_dir", datalog_root));
+
+    dl_writer.enabled = cfg_parse_bool_with_default(config, "async", false);
+
+    value = cfg_parse_int_with_default(config, "queue_size", DATALOG_DEFAULT_QUEUE_SIZE);
+    if (value <= 0)
+    {
+        LOG_WARN("Invalid datalog queue size %d, using %d\n", value, DATALOG_DEFAULT_QUEUE_SIZE);
+        value = DATALOG_DEFAULT_QUEUE_SIZE;
+    }
+    dl_writer.queue_size = value;
+
+    value = cfg_parse_int_with_default(config, "flush_interval_ms",
+                                       DATALOG_DEFAULT_FLUSH_INTERVAL_MS);
+    if (value <= 0)
+    {
+        LOG_WARN("Invalid datalog flush interval %d, using %d\n", value,
+                 DATALOG_DEFAULT_FLUSH_INTERVAL_MS);
+        value = DATALOG_DEFAULT_FLUSH_INTERVAL_MS;
+    }
+    /* Read by the writer thread each time it sleeps */
+    MMSM_ASSERT(pthread_mutex_lock(&dl_writer.mutex) == 0);
+    dl_writer.flush_interval_ms = value;
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.mutex) == 0);
+
+    value = cfg_parse_int_with_default(config, "max_total_kb", 0);
+    datalog_archive_configure(datalog_root, value > 0 ? (uint64_t)value * 1024 : 0,
+                              cfg_parse_bool_with_default(config, "compress", true));
+}
+
+static void writer_init_once(void)
+{
+    pthread_condattr_t attr;
+
+    /* Time out on the monotonic clock, so stepping the wall clock doesn't stall flushing */
+    MMSM_ASSERT(pthread_condattr_init(&attr) == 0);
+    MMSM_ASSERT(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+    MMSM_ASSERT(pthread_cond_init(&dl_writer.wake, &attr) == 0);
+    MMSM_ASSERT(pthread_cond_init(&dl_writer.flushed, &attr) == 0);
+    MMSM_ASSERT(pthread_condattr_destroy(&attr) == 0);
+
+    list_reset(&dl_writer.datalogs);
+}
+
+/**
+ * @brief Queue a record for the writer thread. May be called from any thread.
+ *
+ * @param dl The datalog the record is for
+ * @param text The record, which the queue takes ownership of
+ * @param len Length of the record
+ * @param rotate Whether to rotate the file before writing the record
+ * @return true if queued, or false if the queue was full and the record was dropped
+ */
+static bool writer_push(struct datalog *dl, char *text, size_t len, bool rotate)
+{
+    size_t pos = __atomic_load_n(&dl_writer.tail, __ATOMIC_RELAXED);
+    size_t mask = dl_writer.capacity - 1;
+    datalog_slot_t *slot;
+
+    while (1)
+    {
+        size_t seq;
+
+        slot = &dl_writer.slots[pos & mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == pos)
+        {
+            /* On failure, pos is updated to the current tail */
+            if (__atomic_compare_exchange_n(&dl_writer.tail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((ssize_t)(seq - pos) < 0)
+        {
+            /* The slot is a lap behind, waiting for the writer thread */
+            __atomic_add_fetch(&dl->dropped, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&dl_writer.dropped, 1, __ATOMIC_RELAXED);
+            free(text);
+            return false;
+        }
+        else
+        {
+            /* Another thread claimed the position */
+            pos = __atomic_load_n(&dl_writer.tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->dl = dl;
+    slot->text = text;
+    slot->len = len;
+    slot->rotate = rotate;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /*
+     * Have the writer thread drain a burst early, rather than dropping records. If the mutex is
+     * taken, the writer thread is most likely busy flushing, and sees the flag before sleeping.
+     */
+    if (pos + 1 - __atomic_load_n(&dl_writer.head, __ATOMIC_RELAXED) >= dl_writer.capacity / 2 &&
+        !__atomic_exchange_n(&dl_writer.kicked, true, __ATOMIC_ACQ_REL) &&
+        pthread_mutex_trylock(&dl_writer.mutex) == 0)
+    {
+        MMSM_ASSERT(pthread_cond_signal(&dl_writer.wake) == 0);
+        MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.mutex) == 0);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write out every record queued, up to the first one not yet published. Only called by
+ *        the writer thread.
+ */
+static void writer_drain(void)
+{
+    size_t mask = dl_writer.capacity - 1;
+
+    while (1)
+    {
+        datalog_slot_t *slot = &dl_writer.slots[dl_writer.head & mask];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != dl_writer.head + 1)
+            break;
+
+        /* Only this thread writes to the file */
+        if (!slot->rotate || rotate_file(slot->dl) == 0)
+        {
+            fwrite_unlocked(slot->text, 1, slot->len, slot->dl->fptr);
+        }
+        else if (slot->dl->binary.enabled && slot->dl->binary.layout.rebase_field >= 0)
+        {
+            /* The same file carries on, so instead of the header, its times */
+            uint8_t record[DATALOG_BINARY_MAX_FIELDS * sizeof(uint32_t)];
+
+            encode_rebase(&slot->dl->binary.layout, record,
+                          get_le64((uint8_t *)slot->text + DATALOG_BINARY_BASE_OFFSET));
+            fwrite_unlocked(record, 1, slot->dl->binary.layout.record_len, slot->dl->fptr);
+        }
+        slot->dl->dirty = true;
+        free(slot->text);
+
+        __atomic_store_n(&slot->seq, dl_writer.head + dl_writer.capacity, __ATOMIC_RELEASE);
+        __atomic_store_n(&dl_writer.head, dl_writer.head + 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *writer_thread_fn(void *arg)
+{
+    uint64_t reported = __atomic_load_n(&dl_writer.dropped, __ATOMIC_RELAXED);
+    uint64_t reported_ms = 0;
+    struct timespec next;
+    list_entry_t *entry;
+
+    UNUSED(arg);
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_writer.mutex) == 0);
+    while (1)
+    {
+        bool stopping = dl_writer.stopping;
+        uint64_t dropped;
+        int ret = 0;
+
+        MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.mutex) == 0);
+        /* Cleared first, so a burst pushed while draining wakes us again */
+        __atomic_store_n(&dl_writer.kicked, false, __ATOMIC_RELEASE);
+        writer_drain();
+        MMSM_ASSERT(pthread_mutex_lock(&dl_writer.mutex) == 0);
+
+        list_for_each_entry(entry, &dl_writer.datalogs)
+        {
+            struct datalog *dl = list_get_item(dl, entry, list);
+
+            if (dl->dirty)
+            {
+                fflush(dl->fptr);
+                dl->dirty = false;
+            }
+        }
+        dl_writer.flushed_to = dl_writer.head;
+        MMSM_ASSERT(pthread_cond_broadcast(&dl_writer.flushed) == 0);
+
+        dropped = __atomic_load_n(&dl_writer.dropped, __ATOMIC_RELAXED);
+        if (dropped != reported && (stopping ||
+            timestamp_monotonic_ms() - reported_ms >= DATALOG_DROPPED_WARN_INTERVAL_MS))
+        {
+            LOG_WARN("%" PRIu64 " datalog records dropped, as the queue was full\n",
+                     dropped - reported);
+            reported = dropped;
+            reported_ms = timestamp_monotonic_ms();
+        }
+
+        if (stopping)
+            break;
+
+        /* A record being waited for is still being queued */
+        if (dl_writer.flush_to > dl_writer.flushed_to)
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        next.tv_sec += dl_writer.flush_interval_ms / 1000;
+        next.tv_nsec += (dl_writer.flush_interval_ms % 1000) * 1000000;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+
+        while (ret == 0 && !dl_writer.stopping && dl_writer.flush_to <= dl_writer.flushed_to &&
+               !__atomic_load_n(&dl_writer.kicked, __ATOMIC_ACQUIRE))
+        {
+            ret = pthread_cond_timedwait(&dl_writer.wake, &dl_writer.mutex, &next);
+            MMSM_ASSERT(ret == 0 || ret == ETIMEDOUT);
+        }
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.mutex) == 0);
+
+    return NULL;
+}
+
+/**
+ * @brief Wait for the writer thread to write out and flush every record queued so far
+ */
+static void writer_sync(void)
+{
+    size_t target = __atomic_load_n(&dl_writer.tail, __ATOMIC_RELAXED);
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_writer.mutex) == 0);
+    while (dl_writer.flushed_to < target)
+    {
+        dl_writer.flush_to = MAX(dl_writer.flush_to, target);
+        MMSM_ASSERT(pthread_cond_signal(&dl_writer.wake) == 0);
+        MMSM_ASSERT(pthread_cond_wait(&dl_writer.flushed, &dl_writer.mutex) == 0);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.mutex) == 0);
+}
+
+/**
+ * @brief Have the writer thread write a datalog, starting the thread if it is the first
+ *
+ * @param dl The datalog
+ * @return 0 on success, else -errno, in which case the datalog is written synchronously
+ */
+static int writer_add(struct datalog *dl)
+{
+    int ret = 0;
+
+    pthread_once(&dl_writer_once, writer_init_once);
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_writer.lifecycle_mutex) == 0);
+    if (list_is_empty(&dl_writer.datalogs))
+    {
+        size_t capacity = 1;
+
+        while (capacity < dl_writer.queue_size)
+            capacity <<= 1;
+
+        dl_writer.slots = calloc(capacity, sizeof(*dl_writer.slots));
+        if (!dl_writer.slots)
+        {
+            ret = -ENOMEM;
+            goto exit;
+        }
+
+        for (size_t i = 0; i < capacity; i++)
+            dl_writer.slots[i].seq = i;
+        dl_writer.capacity = capacity;
+        dl_writer.head = 0;
+        dl_writer.tail = 0;
+        dl_writer.flushed_to = 0;
+        dl_writer.flush_to = 0;
+        dl_writer.stopping = false;
+
+        ret = -pthread_create(&dl_writer.thread, NULL, writer_thread_fn, NULL);
+        if (ret)
+        {
+            free(dl_writer.slots);
+            dl_writer.slots = NULL;
+            goto exit;
+        }
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_writer.mutex) == 0);
+    list_add_tail(&dl_writer.datalogs, &dl->list);
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.mutex) == 0);
+    dl->async = true;
+
+exit:
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.lifecycle_mutex) == 0);
+    return ret;
+}
+
+/**
+ * @brief Write out a datalog's records and stop writing it, stopping the writer thread if it
+ *        was the last
+ *
+ * @param dl The datalog, which no thread may write to any more
+ */
+static void writer_remove(struct datalog *dl)
+{
+    bool last;
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_writer.lifecycle_mutex) == 0);
+    writer_sync();
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_writer.mutex) == 0);
+    list_remove(&dl->list);
+    last = list_is_empty(&dl_writer.datalogs);
+    if (last)
+    {
+        dl_writer.stopping = true;
+        MMSM_ASSERT(pthread_cond_signal(&dl_writer.wake) == 0);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.mutex) == 0);
+
+    if (last)
+    {
+        MMSM_ASSERT(pthread_join(dl_writer.thread, NULL) == 0);
+        free(dl_writer.slots);
+        dl_writer.slots = NULL;
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_writer.lifecycle_mutex) == 0);
+
+    if (dl->dropped)
+        LOG_WARN("%" PRIu64 " records dropped from datalog\n", dl->dropped);
+}
+
+/**
+ * @brief Check whether a datalog is rotated, see @ref rotate_if_due
+ *
+ * @param dl The datalog
+ * @return true if it has a maximum size or age
+ */
+static bool rotates(struct datalog *dl)
+{
+    return dl->rotate.max_size || dl->rotate.max_age_ms;
+}
+
+/**
+ * A record being written, see @ref record_begin
+ */
+typedef struct datalog_record
+{
+    /** Where the record is formatted */
+    FILE *out;
+    /** For async datalogs, the record formatted */
+    char *text;
+    size_t len;
+} datalog_record_t;
+
+/**
+ * @brief Start writing a record
+ *
+ * @param dl The datalog
+ * @param rec The record, passed to @ref record_end once written
+ * @return the file to write the record to, the datalog's own unless it is async, or NULL if it
+ *         can't be written
+ */
+static FILE *record_begin(struct datalog *dl, datalog_record_t *rec)
+{
+    if (!dl->async)
+    {
+        /* So the file isn't rotated part way through the record */
+        if (rotates(dl))
+            flockfile(dl->fptr);
+
+        rec->out = dl->fptr;
+        return rec->out;
+    }
+
+    rec->text = NULL;
+    rec->out = open_memstream(&rec->text, &rec->len);
+    if (!rec->out)
+        __atomic_add_fetch(&dl->dropped, 1, __ATOMIC_RELAXED);
+
+    return rec->out;
+}
+
+/**
+ * @brief Finish writing a record, flushing it or queuing it for the writer thread
+ *
+ * @param dl The datalog
+ * @param rec The record
+ * @return true if written or queued
+ */
+static bool record_end(struct datalog *dl, datalog_record_t *rec)
+{
+    if (!dl->async)
+    {
+        fflush(rec->out);
+        if (rotates(dl))
+        {
+            __atomic_store_n(&dl->rotate.size, ftello(rec->out), __ATOMIC_RELAXED);
+            funlockfile(rec->out);
+        }
+        return true;
+    }
+
+    if (fclose(rec->out) != 0)
+    {
+        __atomic_add_fetch(&dl->dropped, 1, __ATOMIC_RELAXED);
+        free(rec->text);
+        return false;
+    }
+
+    if (!writer_push(dl, rec->text, rec->len, false))
+        return false;
+
+    __atomic_add_fetch(&dl->rotate.size, rec->len, __ATOMIC_RELAXED);
+    return true;
 }
 
 /**
@@ -65,11 +737,138 @@ static bool is_datalog_enabled(char *name)
         return true;
     }
 
-    return false;
+    return false;
+}
+
+/**
+ * @brief Check if the datalog is to be written in the binary format, see
+ *        @ref datalog_init_columns
+ *
+ * @param name datalog name
+ * @return true if its "format" is "binary", else false
+ */
+static bool is_datalog_binary(char *name)
+{
+    config_setting_t *member;
+    const char *format;
+
+    if (!dl_config)
+        return false;
+
+    member = config_setting_get_member(dl_config, name);
+    if (!member)
+        return false;
+
+    format = cfg_parse_string_with_default(member, "format", "csv");
+    if (strcmp(format, "binary") == 0)
+        return true;
+
+    if (strcmp(format, "csv") != 0)
+        LOG_WARN("Unknown %s datalog format %s, using csv\n", name, format);
+
+    return false;
+}
+
+
+/**
+ * @brief Set up rotation of a datalog's file, from its "max_size_kb" and "max_age_s"
+ *
+ * @param dl The datalog
+ * @param name datalog name
+ * @param path Path of its file
+ */
+static void configure_rotation(struct datalog *dl, char *name, const char *path)
+{
+    config_setting_t *member = config_setting_get_member(dl_config, name);
+    int max_size_kb = cfg_parse_int_with_default(member, "max_size_kb", 0);
+    int max_age_s = cfg_parse_int_with_default(member, "max_age_s", 0);
+
+    snprintf(dl->rotate.path, sizeof(dl->rotate.path), "%s", path);
+    dl->rotate.max_size = max_size_kb > 0 ? (uint64_t)max_size_kb * 1024 : 0;
+    dl->rotate.max_age_ms = max_age_s > 0 ? (uint64_t)max_age_s * 1000 : 0;
+    dl->rotate.started_ms = timestamp_monotonic_ms();
+    dl->rotate.segment = 1;
+}
+
+/**
+ * @brief Read a list of commands of a datalog's config, given as strings or numbers
+ *
+ * @param member The datalog's config
+ * @param name Name of the list
+ * @param n Set to the number of commands
+ * @return the commands, or NULL if there are none
+ */
+static char **read_commands(config_setting_t *member, const char *name, int *n)
+{
+    config_setting_t *list = member ? config_setting_get_member(member, name) : NULL;
+    char **commands;
+    int len;
+
+    *n = 0;
+    len = list ? config_setting_length(list) : 0;
+    if (len <= 0)
+        return NULL;
+
+    commands = calloc(len, sizeof(*commands));
+    if (!commands)
+        return NULL;
+
+    for (int i = 0; i < len; i++)
+    {
+        config_setting_t *elem = config_setting_get_elem(list, i);
+        char number[16];
+        const char *command = number;
+
+        if (config_setting_type(elem) == CONFIG_TYPE_INT)
+            snprintf(number, sizeof(number), "%d", config_setting_get_int(elem));
+        else if (!(command = config_setting_get_string(elem)))
+            continue;
+
+        commands[*n] = strdup(command);
+        if (commands[*n])
+            (*n)++;
+    }
+
+    if (*n == 0)
+    {
+        free(commands);
+        return NULL;
+    }
+    return commands;
+}
+
+static void free_commands(char **commands, int n)
+{
+    for (int i = 0; i < n; i++)
+        free(commands[i]);
+    free(commands);
+}
+
+/** Read the messages a datalog lets through, see @ref datalog_sample */
+static void configure_sampling(struct datalog *dl, char *name)
+{
+    config_setting_t *member = config_setting_get_member(dl_config, name);
+    int every = cfg_parse_int_with_default(member, "sample_every", 1);
+    int max_rate = cfg_parse_int_with_default(member, "max_rate", 0);
+    int burst = cfg_parse_int_with_default(member, "burst", max_rate);
+
+    dl->sample.every = every > 1 ? every : 0;
+    dl->sample.max_rate = max_rate > 0 ? max_rate : 0;
+    dl->sample.burst = MAX(burst, 1);
+    dl->sample.tokens = (uint64_t)dl->sample.burst * 1000000;
+    dl->sample.refilled_ms = timestamp_monotonic_ms();
+    dl->sample.commands = read_commands(member, "commands", &dl->sample.n_commands);
+    dl->sample.exclude = read_commands(member, "exclude_commands", &dl->sample.n_exclude);
+    MMSM_ASSERT(pthread_mutex_init(&dl->sample.mutex, NULL) == 0);
 }
 
 
 struct datalog *datalog_create(char *name)
+{
+    return datalog_create_instance(name, NULL);
+}
+
+struct datalog *datalog_create_instance(char *name, const char *instance)
 {
     struct datalog *dl;
     timestamp_t timestamp;
@@ -111,7 +910,10 @@ struct datalog *datalog_create(char *name)
         return NULL;
 
     timestamp_get(&timestamp);
-    snprintf(file_name + ret, sizeof(file_name) - ret, "%s.log", name);
+    if (instance)
+        snprintf(file_name + ret, sizeof(file_name) - ret, "%s_%s.log", name, instance);
+    else
+        snprintf(file_name + ret, sizeof(file_name) - ret, "%s.log", name);
 
     dl->fptr = fopen(file_name, "w");
     if (dl->fptr == NULL)
@@ -121,13 +923,167 @@ struct datalog *datalog_create(char *name)
         free(dl);
         return NULL;
     }
+
+    dl->binary.requested = is_datalog_binary(name);
+    MMSM_ASSERT(pthread_mutex_init(&dl->binary.mutex, NULL) == 0);
+    configure_rotation(dl, name, file_name);
+    configure_sampling(dl, name);
+
+    if (dl_writer.enabled && (ret = writer_add(dl)) != 0)
+        LOG_WARN("Failed to start datalog writer thread (%d), writing %s directly\n", ret, name);
+
     return dl;
 }
 
+/**
+ * @brief Write the header of a binary datalog, see @ref datalog_init_columns, which the times of
+ *        the records after it are relative to
+ *
+ * @param dl The datalogger
+ * @param out Where to write it
+ */
+static void write_binary_header(struct datalog *dl, FILE *out)
+{
+    static const uint8_t padding[8];
+    struct datalog_binary *layout = &dl->binary.layout;
+    uint8_t fixed[DATALOG_BINARY_HEADER_LEN];
+    size_t len = sizeof(fixed) + layout->n_fields + strlen(dl->heading) + 1;
+    size_t header_len = (len + 7) & ~(size_t)7;
+    timestamp_t now;
+
+    /* The same clock as the timestamps written, which are local time */
+    timestamp_get(&now);
+    layout->base_ms = timestamp_to_ms(&now);
+
+    memcpy(fixed, DATALOG_BINARY_MAGIC, 8);
+    put_le16(fixed + 8, DATALOG_BINARY_VERSION);
+    put_le16(fixed + 10, layout->n_fields);
+    put_le32(fixed + 12, header_len);
+    put_le64(fixed + DATALOG_BINARY_BASE_OFFSET, layout->base_ms);
+
+    fwrite(fixed, 1, sizeof(fixed), out);
+    fwrite(layout->fmt, 1, layout->n_fields, out);
+    fwrite(dl->heading, 1, strlen(dl->heading) + 1, out);
+    fwrite(padding, 1, header_len - len, out);
+
+    for (int i = 0; i < layout->n_fields; i++)
+        dl->binary.last_ms[i] = layout->base_ms;
+}
+
+/**
+ * @brief Write the headings at the start of a datalog's file, or of a segment
+ *
+ * @param dl The datalogger
+ * @param out Where to write them
+ */
+static void write_header(struct datalog *dl, FILE *out)
+{
+    if (dl->binary.enabled)
+    {
+        write_binary_header(dl, out);
+    }
+    else if (dl->heading)
+    {
+        fputs(dl->heading, out);
+        fputc('\n', out);
+    }
+}
+
+/**
+ * @brief Check whether a datalog's file is due to be rotated
+ *
+ * @param dl The datalog
+ * @return true if it has reached its maximum size or age
+ */
+static bool rotation_due(struct datalog *dl)
+{
+    uint64_t size = __atomic_load_n(&dl->rotate.size, __ATOMIC_RELAXED);
+    uint64_t started_ms = __atomic_load_n(&dl->rotate.started_ms, __ATOMIC_RELAXED);
+
+    return (dl->rotate.max_size && size >= dl->rotate.max_size) ||
+        (dl->rotate.max_age_ms && timestamp_monotonic_ms() - started_ms >= dl->rotate.max_age_ms);
+}
+
+/**
+ * @brief Rotate a datalog's file if it is due, before writing a record
+ *
+ * The file of an async datalog is rotated by the writer thread, once it gets to the new file's
+ * headings, which are queued to it here. The headings of a binary datalog reset the times the
+ * records after them are relative to, so for those this is called with the binary mutex held.
+ *
+ * @param dl The datalog
+ */
+static void rotate_if_due(struct datalog *dl)
+{
+    uint64_t last_ms[DATALOG_BINARY_MAX_FIELDS];
+    uint64_t base_ms = dl->binary.layout.base_ms;
+    datalog_record_t rec = { 0 };
+    bool queued = false;
+
+    if (!rotates(dl) || !rotation_due(dl))
+        return;
+
+    if (!dl->async)
+    {
+        flockfile(dl->fptr);
+        if (rotation_due(dl))
+        {
+            off_t size = 0;
+
+            /* Retried after another max_size bytes on failure, rather than every record */
+            if (rotate_file(dl) == 0)
+            {
+                write_header(dl, dl->fptr);
+                fflush(dl->fptr);
+                size = ftello(dl->fptr);
+            }
+            __atomic_store_n(&dl->rotate.size, size, __ATOMIC_RELAXED);
+            __atomic_store_n(&dl->rotate.started_ms, timestamp_monotonic_ms(), __ATOMIC_RELAXED);
+        }
+        funlockfile(dl->fptr);
+        return;
+    }
+
+    /* One thread queues the rotation, the others carry on writing to the current file */
+    if (__atomic_exchange_n(&dl->rotate.rotating, true, __ATOMIC_ACQUIRE))
+        return;
+
+    if (rotation_due(dl))
+    {
+        memcpy(last_ms, dl->binary.last_ms, sizeof(last_ms));
+
+        rec.out = open_memstream(&rec.text, &rec.len);
+        if (rec.out)
+        {
+            write_header(dl, rec.out);
+            if (fclose(rec.out) == 0)
+                queued = writer_push(dl, rec.text, rec.len, true);
+            else
+                free(rec.text);
+        }
+
+        if (queued)
+        {
+            __atomic_store_n(&dl->rotate.size, rec.len, __ATOMIC_RELAXED);
+            __atomic_store_n(&dl->rotate.started_ms, timestamp_monotonic_ms(), __ATOMIC_RELAXED);
+        }
+        else
+        {
+            /* Still writing to the current file, so the times carry on from it */
+            memcpy(dl->binary.last_ms, last_ms, sizeof(last_ms));
+            dl->binary.layout.base_ms = base_ms;
+        }
+    }
+
+    __atomic_store_n(&dl->rotate.rotating, false, __ATOMIC_RELEASE);
+}
+
 bool datalog_init_csv(struct datalog *dl, const char *heading)
 {
     int num_fields = 1;
     const char *ptr = heading;
+    datalog_record_t rec;
+    FILE *out;
 
     if (!dl || !heading)
         return false;
@@ -142,16 +1098,200 @@ bool datalog_init_csv(struct datalog *dl, const char *heading)
 
     dl->csv.n_fields = num_fields;
 
-    fputs(heading, dl->fptr);
-    fputc('\n', dl->fptr);
-    fflush(dl->fptr);
+    free(dl->heading);
+    dl->heading = strdup(heading);
+    if (!dl->heading)
+        return false;
 
-    return true;
+    out = record_begin(dl, &rec);
+    if (!out)
+        return false;
+
+    write_header(dl, out);
+
+    return record_end(dl, &rec);
+}
+
+bool datalog_init_columns(struct datalog *dl, const char *heading, const char *fmt)
+{
+    struct datalog_binary layout = { 0 };
+    datalog_record_t rec;
+    const char *ptr;
+    int n_headings = 1;
+    FILE *out;
+
+    if (!dl || !heading || !fmt)
+        return false;
+
+    for (ptr = strchr(heading, ','); ptr; ptr = strchr(ptr + 1, ','))
+        n_headings++;
+
+    if (strlen(fmt) != n_headings || n_headings > DATALOG_BINARY_MAX_FIELDS)
+    {
+        LOG_ERROR("Datalog format %s doesn't match the %d headings\n", fmt, n_headings);
+        return false;
+    }
+
+    layout.n_fields = n_headings;
+    layout.fmt = fmt;
+    if (!binary_layout(&layout))
+    {
+        LOG_ERROR("Datalog format %s has a field that isn't fixed width\n", fmt);
+        return false;
+    }
+
+    if (!dl->binary.requested)
+        return datalog_init_csv(dl, heading);
+
+    free(dl->heading);
+    dl->heading = strdup(heading);
+    if (!dl->heading)
+        return false;
+
+    strcpy(dl->binary.fmt, fmt);
+    layout.fmt = dl->binary.fmt;
+    dl->binary.layout = layout;
+    dl->csv.n_fields = n_headings;
+    dl->binary.enabled = true;
+
+    out = record_begin(dl, &rec);
+    if (!out)
+        return false;
+
+    write_header(dl, out);
+
+    return record_end(dl, &rec);
+}
+
+/**
+ * @brief Queue or write a record of a binary datalog
+ *
+ * @param dl The datalogger
+ * @param record The record, of the datalog's record length
+ * @return true Successfully written, else false
+ */
+static bool write_binary(struct datalog *dl, const uint8_t *record)
+{
+    datalog_record_t rec;
+    FILE *out;
+
+    out = record_begin(dl, &rec);
+    if (!out)
+        return false;
+
+    fwrite(record, 1, dl->binary.layout.record_len, out);
+    return record_end(dl, &rec);
+}
+
+/**
+ * @brief Write a record of a binary datalog, see @ref datalog_init_columns
+ *
+ * @param dl The datalogger
+ * @param fmt Format string, matching the datalog's
+ * @param args Fields, as for @ref datalog_write_csv
+ * @return true Successfully written, else false
+ */
+static bool write_binary_record(struct datalog *dl, const char *fmt, va_list args)
+{
+    const struct datalog_binary *layout = &dl->binary.layout;
+    uint8_t record[DATALOG_BINARY_MAX_FIELDS * sizeof(uint32_t)] = { 0 };
+    uint64_t vals[DATALOG_BINARY_MAX_FIELDS];
+    uint64_t last_ms[DATALOG_BINARY_MAX_FIELDS];
+    bool empty[DATALOG_BINARY_MAX_FIELDS];
+    int64_t rebase_ms = -1;
+    bool ret;
+
+    for (int i = 0; i < layout->n_fields; i++)
+    {
+        /* An empty field, or every field after the format string ends */
+        empty[i] = *fmt == '0' || *fmt == '\0';
+        MMSM_ASSERT(empty[i] || *fmt == layout->fmt[i]);
+        if (*fmt)
+            fmt++;
+
+        if (empty[i])
+            vals[i] = 0;
+        else if (layout->fmt[i] == 't')
+            vals[i] = timestamp_to_ms(va_arg(args, timestamp_t *));
+        else
+            vals[i] = va_arg(args, unsigned int);
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl->binary.mutex) == 0);
+    rotate_if_due(dl);
+    memcpy(last_ms, dl->binary.last_ms, sizeof(last_ms));
+
+    /* The first time that can't be held as a delta becomes the base of every column */
+    for (int i = 0; i < layout->n_fields && rebase_ms < 0; i++)
+    {
+        int64_t delta = vals[i] - last_ms[i];
+
+        if (layout->fmt[i] == 't' && !empty[i] && (delta <= INT32_MIN || delta > INT32_MAX))
+            rebase_ms = vals[i];
+    }
+
+    if (rebase_ms >= 0)
+    {
+        encode_rebase(layout, record, rebase_ms);
+
+        /* The record would be read relative to the wrong time without it */
+        if (!write_binary(dl, record))
+        {
+            MMSM_ASSERT(pthread_mutex_unlock(&dl->binary.mutex) == 0);
+            return false;
+        }
+        memset(record, 0, sizeof(record));
+
+        for (int i = 0; i < layout->n_fields; i++)
+            dl->binary.last_ms[i] = last_ms[i] = rebase_ms;
+    }
+
+    for (int i = 0; i < layout->n_fields; i++)
+    {
+        uint8_t *p = record + layout->offset[i];
+
+        switch (layout->fmt[i])
+        {
+            case 'u':
+            case 'd':
+                put_le32(p, vals[i]);
+                break;
+            case 'b':
+                *p = !!vals[i];
+                break;
+            case 't':
+            {
+                int64_t delta = 0;
+
+                /* Other columns only saturate, when the first one is rebased */
+                if (!empty[i])
+                {
+                    delta = MIN(MAX((int64_t)(vals[i] - last_ms[i]), INT32_MIN + 1), INT32_MAX);
+                    last_ms[i] += delta;
+                }
+                put_le32(p, (uint32_t)(int32_t)delta);
+                break;
+            }
+        }
+    }
+
+    /*
+     * Written under the lock, so the delta applies to the record before. A record dropped
+     * leaves the next one relative to the one before it.
+     */
+    ret = write_binary(dl, record);
+    if (ret)
+        memcpy(dl->binary.last_ms, last_ms, sizeof(last_ms));
+
+    MMSM_ASSERT(pthread_mutex_unlock(&dl->binary.mutex) == 0);
+    return ret;
 }
 
 bool datalog_write_csv(struct datalog *dl, const char *fmt, ...)
 {
     bool first = true;
+    datalog_record_t rec;
+    FILE *out;
     uint16_t n;
 
     if (!dl)
@@ -164,32 +1304,48 @@ bool datalog_write_csv(struct datalog *dl, const char *fmt, ...)
     va_list args;
     va_start(args, fmt);
 
+    if (dl->binary.enabled)
+    {
+        bool ret = write_binary_record(dl, fmt, args);
+
+        va_end(args);
+        return ret;
+    }
+
+    rotate_if_due(dl);
+    out = record_begin(dl, &rec);
+    if (!out)
+    {
+        va_end(args);
+        return false;
+    }
+
     while (n-- > 0)
     {
         if (!first)
-            fputc(',', dl->fptr);
+            fputc(',', out);
         else
             first = false;
 
         switch (*fmt)
         {
             case 'u':
-                fprintf(dl->fptr, "%u", va_arg(args, unsigned int));
+                fprintf(out, "%u", va_arg(args, unsigned int));
                 break;
             case 'd':
-                fprintf(dl->fptr, "%d", va_arg(args, int));
+                fprintf(out, "%d", va_arg(args, int));
                 break;
             case 's':
-                fprintf(dl->fptr, "%s", va_arg(args, char *));
+                fprintf(out, "%s", va_arg(args, char *));
                 break;
             case 'S':
-                fprintf(dl->fptr, "\"%s\"", va_arg(args, char *));
+                fprintf(out, "\"%s\"", va_arg(args, char *));
                 break;
             case 'b':
-                fprintf(dl->fptr, "%s", va_arg(args, int) ? "True" : "False");
+                fprintf(out, "%s", va_arg(args, int) ? "True" : "False");
                 break;
             case 't':
-                timestamp_write_to_file_as_iso(dl->fptr, va_arg(args, timestamp_t *));
+                timestamp_write_to_file_as_iso(out, va_arg(args, timestamp_t *));
                 break;
 
             /* 0 means skip this field (aka arg not included)*/
@@ -209,60 +1365,265 @@ bool datalog_write_csv(struct datalog *dl, const char *fmt, ...)
 
     va_end(args);
 
-    fprintf(dl->fptr, "\n");
-    fflush(dl->fptr);
-    return true;
+    fprintf(out, "\n");
+    return record_end(dl, &rec);
 }
 
 bool datalog_write_string(struct datalog *dl, const char *str, ...)
 {
     timestamp_t timestamp;
-    timestamp_get(&timestamp);
+    datalog_record_t rec;
+    FILE *out;
 
     if (!dl)
         return false;
 
-    fprintf(dl->fptr, "%04u/%02u/%02u:%02u:%02u:%02u:%03u ",
+    timestamp_get(&timestamp);
+
+    rotate_if_due(dl);
+    out = record_begin(dl, &rec);
+    if (!out)
+        return false;
+
+    fprintf(out, "%04u/%02u/%02u:%02u:%02u:%02u:%03u ",
         timestamp.year, timestamp.month, timestamp.day, timestamp.hour,
         timestamp.minute, timestamp.second, timestamp.millisecond);
 
     va_list args;
     va_start(args, str);
-    vfprintf(dl->fptr, str, args);
+    vfprintf(out, str, args);
     va_end(args);
-    fflush(dl->fptr);
-    return true;
+    return record_end(dl, &rec);
 }
 
 
+/** Bytes of data hex dumped per write by @ref datalog_write_data */
+#define DATALOG_HEX_CHUNK (1024)
+
+/** Characters a line of 16 bytes is dumped as: a tab, "xx " per byte, a gap and a newline */
+#define DATALOG_HEX_LINE_LEN (1 + 16 * 3 + 1 + 1)
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * @brief Hex dump bytes of a message, 16 to a line with a gap after the 8th
+ *
+ * @param buf Buffer of at least @ref DATALOG_HEX_LINE_LEN characters per 16 bytes
+ * @param data The message
+ * @param start Offset of the first byte to dump, a multiple of 16
+ * @param end Offset after the last byte to dump
+ * @return the number of characters written, not terminated
+ */
+static size_t hex_dump(char *buf, const uint8_t *data, uint32_t start, uint32_t end)
+{
+    char *p = buf;
+
+    for (uint32_t i = start; i < end; i++)
+    {
+        unsigned int col = i % 16;
+
+        if (col == 0)
+            *p++ = '\t';
+
+        *p++ = hex_digits[data[i] >> 4];
+        *p++ = hex_digits[data[i] & 0xf];
+        *p++ = ' ';
+
+        if (col == 7)
+            *p++ = ' ';
+        else if (col == 15)
+            *p++ = '\n';
+    }
+    return p - buf;
+}
+
 bool datalog_write_data(struct datalog *dl, uint8_t *data, uint32_t size)
 {
+    char buf[DATALOG_HEX_CHUNK / 16 * DATALOG_HEX_LINE_LEN + 32];
     timestamp_t timestamp;
-    timestamp_get(&timestamp);
+    datalog_record_t rec;
+    uint32_t start = 0;
+    size_t len;
+    FILE *out;
 
     if (!dl)
         return false;
 
-    fprintf(dl->fptr, "%04u/%02u/%02u:%02u:%02u:%02u:%03u \n",
+    timestamp_get(&timestamp);
+
+    rotate_if_due(dl);
+    out = record_begin(dl, &rec);
+    if (!out)
+        return false;
+
+    len = snprintf(buf, sizeof(buf), "%04u/%02u/%02u:%02u:%02u:%02u:%03u \n",
         timestamp.year, timestamp.month, timestamp.day, timestamp.hour,
         timestamp.minute, timestamp.second, timestamp.millisecond);
-    for (int i = 0; i < size; i++)
+
+    /* Formatted a chunk at a time, so most messages are written in a single call */
+    do
     {
-        if (i % 16 == 0)
-            fprintf(dl->fptr, "\t");
+        uint32_t end = MIN(size, start + DATALOG_HEX_CHUNK);
+
+        len += hex_dump(buf + len, data, start, end);
+        if (end == size)
+            buf[len++] = '\n';
+
+        fwrite(buf, 1, len, out);
+        len = 0;
+        start = end;
+    } while (start < size);
+
+    return record_end(dl, &rec);
+}
 
-        fprintf(dl->fptr, "%02x ", data[i]);
+/** Whether a list of commands has the first word of a key */
+static bool has_command(char **commands, int n, const char *key)
+{
+    size_t len = strcspn(key, " \n");
 
-        if (i % 16 == 7)
-            fprintf(dl->fptr, " ");
-        else if (i % 16 == 15)
-            fprintf(dl->fptr, "\n");
+    for (int i = 0; i < n; i++)
+    {
+        if (strlen(commands[i]) == len && strncmp(commands[i], key, len) == 0)
+            return true;
     }
-    fprintf(dl->fptr, "\n");
-    fflush(dl->fptr);
+    return false;
+}
+
+/** Take a token from the rate limit's bucket, refilled at max_rate up to burst */
+static bool take_token(struct datalog *dl)
+{
+    const uint64_t full = (uint64_t)dl->sample.burst * 1000000;
+    uint64_t now_ms = timestamp_monotonic_ms();
+    bool taken = false;
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl->sample.mutex) == 0);
+
+    /* Another thread may have refilled it since now_ms was read */
+    if (now_ms > dl->sample.refilled_ms)
+    {
+        uint64_t elapsed = MIN(now_ms - dl->sample.refilled_ms, full);
+
+        dl->sample.tokens = MIN(dl->sample.tokens + elapsed * 1000 * dl->sample.max_rate, full);
+        dl->sample.refilled_ms = now_ms;
+    }
+
+    if (dl->sample.tokens >= 1000000)
+    {
+        dl->sample.tokens -= 1000000;
+        taken = true;
+    }
+
+    MMSM_ASSERT(pthread_mutex_unlock(&dl->sample.mutex) == 0);
+    return taken;
+}
+
+bool datalog_sample(struct datalog *dl, const char *key)
+{
+    if (!dl)
+        return false;
+
+    if (dl->sample.commands && !has_command(dl->sample.commands, dl->sample.n_commands, key))
+        return false;
+    if (dl->sample.exclude && has_command(dl->sample.exclude, dl->sample.n_exclude, key))
+        return false;
+
+    if ((dl->sample.every &&
+         __atomic_fetch_add(&dl->sample.count, 1, __ATOMIC_RELAXED) % dl->sample.every != 0) ||
+        (dl->sample.max_rate && !take_token(dl)))
+    {
+        __atomic_add_fetch(&dl->sample.skipped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+
+bool datalog_binary_open(struct datalog_binary *bin, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t header_len;
+
+    if (len < DATALOG_BINARY_HEADER_LEN || memcmp(p, DATALOG_BINARY_MAGIC, 8) != 0)
+        return false;
+
+    if (get_le16(p + 8) != DATALOG_BINARY_VERSION)
+    {
+        LOG_ERROR("Unsupported binary datalog version %u\n", get_le16(p + 8));
+        return false;
+    }
+
+    bin->n_fields = get_le16(p + 10);
+    header_len = get_le32(p + 12);
+    bin->base_ms = get_le64(p + DATALOG_BINARY_BASE_OFFSET);
+    bin->fmt = (const char *)p + DATALOG_BINARY_HEADER_LEN;
+    bin->heading = bin->fmt + bin->n_fields;
+
+    /* The heading must be terminated within the header */
+    if (bin->n_fields == 0 || bin->n_fields > DATALOG_BINARY_MAX_FIELDS || header_len > len ||
+        header_len <= DATALOG_BINARY_HEADER_LEN + bin->n_fields ||
+        !memchr(bin->heading, '\0', header_len - DATALOG_BINARY_HEADER_LEN - bin->n_fields))
+    {
+        LOG_ERROR("Invalid binary datalog header\n");
+        return false;
+    }
+
+    if (!binary_layout(bin))
+    {
+        LOG_ERROR("Invalid binary datalog format %.*s\n", bin->n_fields, bin->fmt);
+        return false;
+    }
+
+    bin->records = p + header_len;
+    bin->n_records = (len - header_len) / bin->record_len;
+    return true;
+}
+
+bool datalog_binary_is_rebase(const struct datalog_binary *bin, const uint8_t *record,
+                              uint64_t *time_ms)
+{
+    uint8_t payload[sizeof(uint64_t)];
+    size_t offset;
+    size_t before;
+
+    if (bin->rebase_field < 0)
+        return false;
+
+    offset = bin->offset[bin->rebase_field];
+    if (get_le32(record + offset) != (uint32_t)INT32_MIN)
+        return false;
+
+    before = MIN(offset, sizeof(payload));
+    memcpy(payload, record, before);
+    memcpy(payload + before, record + offset + sizeof(uint32_t), sizeof(payload) - before);
+    *time_ms = get_le64(payload);
     return true;
 }
 
+int64_t datalog_binary_get(const struct datalog_binary *bin, const uint8_t *record, int field)
+{
+    const uint8_t *p = record + bin->offset[field];
+
+    switch (bin->fmt[field])
+    {
+        case 'u':
+            return get_le32(p);
+        case 'b':
+            return *p;
+        default:
+            return (int32_t)get_le32(p);
+    }
+}
+
+
+uint64_t datalog_get_dropped(struct datalog *dl)
+{
+    if (!dl)
+        return 0;
+
+    return __atomic_load_n(&dl->dropped, __ATOMIC_RELAXED);
+}
+
 
 bool datalog_close(struct datalog *dl)
 {
@@ -276,12 +1637,23 @@ bool datalog_close(struct datalog *dl)
         return false;
     }
 
+    if (dl->async)
+        writer_remove(dl);
+
     if (fclose(dl->fptr) > 0)
     {
         LOG_ERROR("Can't close data log file: %s\n", strerror(errno));
         return false;
     }
 
+    if (dl->sample.skipped)
+        LOG_INFO("%" PRIu64 " messages not written to datalog by sampling\n", dl->sample.skipped);
+
+    MMSM_ASSERT(pthread_mutex_destroy(&dl->binary.mutex) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&dl->sample.mutex) == 0);
+    free_commands(dl->sample.commands, dl->sample.n_commands);
+    free_commands(dl->sample.exclude, dl->sample.n_exclude);
+    free(dl->heading);
     free(dl);
 
     return true;
@@ -0,0 +1,445 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "datalog_archive.h"
+#include "list.h"
+#include "logging.h"
+#include "utils.h"
+
+/** Size of the chunks segments are compressed in */
+#define DATALOG_ARCHIVE_CHUNK_SIZE (16 * 1024)
+
+/** A segment waiting to be archived */
+typedef struct archive_item
+{
+    list_entry_t list;
+    char path[];
+} archive_item_t;
+
+/** A file under the root directory, found while applying the disk budget */
+typedef struct archive_file
+{
+    char *path;
+    off_t size;
+    struct timespec mtime;
+} archive_file_t;
+
+/** The archiving thread, and the segments waiting for it */
+static struct
+{
+    /** Protects the fields below */
+    pthread_mutex_t mutex;
+    /** Signalled when there is something for the thread to do */
+    pthread_cond_t wake;
+    /** The segments waiting, oldest first */
+    list_head_t pending;
+    /** Set to have the thread tidy up after an earlier run */
+    bool tidy;
+    /** Whether the thread has been started */
+    bool running;
+
+    /** Root directory of the datalogs */
+    char root_dir[64];
+    /** Disk budget in bytes, or 0 for no limit */
+    uint64_t max_total;
+    /** Whether to compress segments */
+    bool compress;
+    /** Files last written before this were written by an earlier run */
+    time_t started;
+} dl_archive = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+/** The files found by a walk of the root directory, which only the archiving thread walks */
+static archive_file_t *walk_files;
+static size_t walk_num_files;
+static size_t walk_capacity;
+static uint64_t walk_total;
+
+/**
+ * @brief Check whether a file is a segment of a datalog, "<name>.log.<n>", or a compressed one
+ *
+ * @param name File name
+ * @param compressed Set if the segment is compressed
+ * @return true if a segment
+ */
+static bool is_segment(const char *name, bool *compressed)
+{
+    const char *p = strstr(name, ".log.");
+    const char *digits;
+
+    if (!p)
+        return false;
+
+    digits = p + strlen(".log.");
+    for (p = digits; *p >= '0' && *p <= '9'; p++)
+        ;
+
+    if (p == digits)
+        return false;
+
+    *compressed = strcmp(p, ".gz") == 0;
+    return *p == '\0' || *compressed;
+}
+
+/**
+ * @brief Compress a segment to "<segment>.gz", then delete it
+ *
+ * The compressed file is written under a temporary name first, so a segment is never left only
+ * partly compressed.
+ *
+ * @param path Path of the segment
+ * @return 0 on success, else -errno
+ */
+static int compress_segment(const char *path)
+{
+    char gz_path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    char *buf;
+    struct stat st;
+    struct timespec times[2];
+    gzFile gz;
+    ssize_t n;
+    int ret = 0;
+    int fd;
+
+    if (snprintf(gz_path, sizeof(gz_path), "%s.gz", path) >= sizeof(gz_path) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.gz.tmp", path) >= sizeof(tmp_path))
+        return -ENAMETOOLONG;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    buf = malloc(DATALOG_ARCHIVE_CHUNK_SIZE);
+    gz = gzopen(tmp_path, "wb");
+    if (!buf || !gz)
+    {
+        ret = -ENOMEM;
+        goto exit;
+    }
+
+    if (fstat(fd, &st))
+    {
+        ret = -errno;
+        goto exit;
+    }
+
+    while ((n = read(fd, buf, DATALOG_ARCHIVE_CHUNK_SIZE)) > 0)
+    {
+        if (gzwrite(gz, buf, n) != n)
+        {
+            ret = -EIO;
+            goto exit;
+        }
+    }
+    if (n < 0)
+        ret = -errno;
+
+exit:
+    if (gz && gzclose(gz) != Z_OK && ret == 0)
+        ret = -EIO;
+    free(buf);
+    close(fd);
+
+    if (ret == 0)
+    {
+        /* Keeps the segment's age, which the budget deletes the oldest by */
+        times[0] = st.st_atim;
+        times[1] = st.st_mtim;
+        utimensat(AT_FDCWD, tmp_path, times, 0);
+
+        if (rename(tmp_path, gz_path))
+            ret = -errno;
+    }
+
+    if (ret)
+    {
+        unlink(tmp_path);
+        return ret;
+    }
+
+    unlink(path);
+    return 0;
+}
+
+/**
+ * Function called for each file found by @ref walk_dir
+ *
+ * @param path Path of the file
+ * @param name Name of the file
+ * @param st Status of the file
+ * @return 0 to carry on, else an error code to stop the walk with
+ */
+typedef int (*walk_fn_t)(const char *path, const char *name, const struct stat *st);
+
+/**
+ * @brief Call a function for each regular file in a directory, and its subdirectories
+ *
+ * @param dir_path Path of the directory
+ * @param fn The function
+ * @return 0 on success, else an error code
+ */
+static int walk_dir(const char *dir_path, walk_fn_t fn)
+{
+    char path[PATH_MAX];
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir;
+    int ret = 0;
+
+    dir = opendir(dir_path);
+    if (!dir)
+        return -errno;
+
+    while (ret == 0 && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        if (snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name) >= sizeof(path) ||
+            lstat(path, &st))
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            ret = walk_dir(path, fn);
+        else if (S_ISREG(st.st_mode))
+            ret = fn(path, entry->d_name, &st);
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+static int walk_fn(const char *path, const char *name, const struct stat *st)
+{
+    bool compressed;
+    archive_file_t *file;
+
+    walk_total += st->st_size;
+
+    /* A datalog of this run is only deletable once rotated out */
+    if (st->st_mtime >= dl_archive.started && !is_segment(name, &compressed))
+        return 0;
+
+    if (walk_num_files == walk_capacity)
+    {
+        size_t capacity = walk_capacity ? walk_capacity * 2 : 64;
+        archive_file_t *files = realloc(walk_files, capacity * sizeof(*files));
+
+        if (!files)
+            return -ENOMEM;
+
+        walk_files = files;
+        walk_capacity = capacity;
+    }
+
+    file = &walk_files[walk_num_files];
+    file->path = strdup(path);
+    if (!file->path)
+        return -ENOMEM;
+
+    file->size = st->st_size;
+    file->mtime = st->st_mtim;
+    walk_num_files++;
+    return 0;
+}
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const archive_file_t *fa = a;
+    const archive_file_t *fb = b;
+
+    if (fa->mtime.tv_sec != fb->mtime.tv_sec)
+        return fa->mtime.tv_sec < fb->mtime.tv_sec ? -1 : 1;
+    if (fa->mtime.tv_nsec != fb->mtime.tv_nsec)
+        return fa->mtime.tv_nsec < fb->mtime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Delete the oldest deletable files until everything under the root directory fits in
+ *        the disk budget
+ */
+static void apply_budget(void)
+{
+    static bool warned;
+    size_t i;
+
+    if (!dl_archive.max_total)
+        return;
+
+    walk_num_files = 0;
+    walk_total = 0;
+    if (walk_dir(dl_archive.root_dir, walk_fn) != 0)
+    {
+        LOG_WARN("Failed to read datalog directory %s\n", dl_archive.root_dir);
+        goto exit;
+    }
+
+    qsort(walk_files, walk_num_files, sizeof(*walk_files), compare_mtime);
+
+    for (i = 0; i < walk_num_files && walk_total > dl_archive.max_total; i++)
+    {
+        archive_file_t *file = &walk_files[i];
+
+        if (unlink(file->path))
+            continue;
+
+        LOG_DEBUG("Deleted %s for the datalog disk budget\n", file->path);
+        walk_total -= file->size;
+
+        /* The directory of an earlier run, once it is empty */
+        if (file->mtime.tv_sec < dl_archive.started && strcmp(dirname(file->path),
+                                                               dl_archive.root_dir) != 0)
+            rmdir(file->path);
+    }
+
+    if (walk_total > dl_archive.max_total && !warned)
+        LOG_WARN("Datalogs being written exceed the disk budget of %" PRIu64 " bytes\n",
+                 dl_archive.max_total);
+    warned = walk_total > dl_archive.max_total;
+
+exit:
+    for (i = 0; i < walk_num_files; i++)
+        free(walk_files[i].path);
+}
+
+static int tidy_fn(const char *path, const char *name, const struct stat *st)
+{
+    size_t len = strlen(name);
+    bool compressed;
+
+    UNUSED(st);
+
+    /* Left behind by compressing a segment when the earlier run stopped */
+    if (len > strlen(".gz.tmp") && strcmp(name + len - strlen(".gz.tmp"), ".gz.tmp") == 0)
+    {
+        unlink(path);
+        return 0;
+    }
+
+    if (dl_archive.compress && is_segment(name, &compressed) && !compressed)
+        datalog_archive_add(path);
+
+    return 0;
+}
+
+static void *archive_thread_fn(void *arg)
+{
+    archive_item_t *item;
+    int ret;
+
+    UNUSED(arg);
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_archive.mutex) == 0);
+    while (1)
+    {
+        while (!dl_archive.tidy && list_is_empty(&dl_archive.pending))
+            MMSM_ASSERT(pthread_cond_wait(&dl_archive.wake, &dl_archive.mutex) == 0);
+
+        if (dl_archive.tidy)
+        {
+            dl_archive.tidy = false;
+            MMSM_ASSERT(pthread_mutex_unlock(&dl_archive.mutex) == 0);
+
+            walk_dir(dl_archive.root_dir, tidy_fn);
+            apply_budget();
+
+            MMSM_ASSERT(pthread_mutex_lock(&dl_archive.mutex) == 0);
+            continue;
+        }
+
+        item = list_get_first_item(item, &dl_archive.pending, list);
+        list_remove(&item->list);
+        MMSM_ASSERT(pthread_mutex_unlock(&dl_archive.mutex) == 0);
+
+        /* The budget may have deleted it already */
+        if (dl_archive.compress && (ret = compress_segment(item->path)) != 0 && ret != -ENOENT)
+            LOG_WARN("Failed to compress datalog %s (%d)\n", item->path, ret);
+        free(item);
+
+        apply_budget();
+
+        MMSM_ASSERT(pthread_mutex_lock(&dl_archive.mutex) == 0);
+    }
+
+    return NULL;
+}
+
+void datalog_archive_configure(const char *root_dir, uint64_t max_total, bool compress)
+{
+    pthread_t thread;
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_archive.mutex) == 0);
+
+    snprintf(dl_archive.root_dir, sizeof(dl_archive.root_dir), "%s", root_dir);
+    dl_archive.max_total = max_total;
+    dl_archive.compress = compress;
+    /* Only the first time, so reconfiguring doesn't make this run's datalogs look older */
+    if (!dl_archive.started)
+        dl_archive.started = time(NULL);
+
+    if (!compress && !max_total)
+        goto exit;
+
+    if (!dl_archive.running)
+    {
+        list_reset(&dl_archive.pending);
+        if (pthread_create(&thread, NULL, archive_thread_fn, NULL) != 0)
+        {
+            LOG_WARN("Failed to start datalog archiving thread, segments are kept as they are\n");
+            dl_archive.compress = false;
+            dl_archive.max_total = 0;
+            goto exit;
+        }
+        pthread_detach(thread);
+        dl_archive.running = true;
+    }
+
+    dl_archive.tidy = true;
+    MMSM_ASSERT(pthread_cond_signal(&dl_archive.wake) == 0);
+
+exit:
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_archive.mutex) == 0);
+}
+
+void datalog_archive_add(const char *path)
+{
+    archive_item_t *item;
+
+    MMSM_ASSERT(pthread_mutex_lock(&dl_archive.mutex) == 0);
+
+    /* Kept as it is */
+    if (!dl_archive.running)
+        goto exit;
+
+    item = malloc(sizeof(*item) + strlen(path) + 1);
+    if (!item)
+        goto exit;
+
+    strcpy(item->path, path);
+    list_add_tail(&dl_archive.pending, &item->list);
+    MMSM_ASSERT(pthread_cond_signal(&dl_archive.wake) == 0);
+
+exit:
+    MMSM_ASSERT(pthread_mutex_unlock(&dl_archive.mutex) == 0);
+}
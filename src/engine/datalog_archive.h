@@ -0,0 +1,37 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Engine-internal archiving of the segments datalogs are rotated to, on a background thread.
+ *
+ * Each segment rotated out is compressed to "<segment>.gz", then the oldest segments, and the
+ * datalogs of earlier runs, are deleted until everything under the datalog root directory
+ * fits in the total disk budget. The datalogs being written by this run are never deleted.
+ */
+
+/**
+ * @brief Configure archiving, and tidy up after an earlier run: segments it left uncompressed
+ *        are compressed, and the disk budget applied
+ *
+ * Starts the archiving thread, unless there is nothing to do. May be called again to change
+ * the budget and compression.
+ *
+ * @param root_dir Root directory of the datalogs
+ * @param max_total Disk budget in bytes, or 0 for no limit
+ * @param compress Whether to compress segments
+ */
+void datalog_archive_configure(const char *root_dir, uint64_t max_total, bool compress);
+
+/**
+ * @brief Archive a segment a datalog has been rotated to
+ *
+ * @param path Path of the segment, which is copied
+ */
+void datalog_archive_add(const char *path);
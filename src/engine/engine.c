@@ -10,9 +10,28 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "smart_manager.h"
+#include "heap.h"
+#include "pool.h"
+#include "rcu.h"
 #include "utils.h"
+#include "workers.h"
+#include "monitor_index.h"
+#include "request_cache.h"
+#include "event_queue.h"
+#include "stats.h"
+#include "datalog.h"
+#include "timestamp.h"
+#include "trace.h"
+#include "probes.h"
+#include "metrics.h"
+#include "query.h"
 
 /**
  * A polling monitor instance.
@@ -34,11 +53,47 @@ typedef struct polling_monitor_t
     /** How often to send the command, in milliseconds */
     uint32_t frequency_ms;
 
-    /** The next time that sending the command is due */
+    /** The next time that sending the command is due (CLOCK_MONOTONIC) */
     struct timespec next_time;
 
-    /** The next instance in the list */
-    struct polling_monitor_t *next;
+    /** When the monitor is next due before any jitter, from which fixed rate monitors advance */
+    struct timespec slot_time;
+
+    /** How far into its period its first fire is, see polling_spread */
+    uint32_t phase_ms;
+
+    /** Position of this monitor in the polling heap */
+    size_t heap_index;
+
+    /** How late the most recent fire was compared with next_time, in microseconds */
+    uint64_t last_lag_us;
+
+    /** The latest any fire has been compared with next_time, in microseconds */
+    uint64_t max_lag_us;
+
+    /** Link used to batch up monitors that are due in the same pass */
+    struct polling_monitor_t *next_due;
+
+    /** Work item used to run this monitor on the worker pool */
+    worker_item_t work;
+
+    /** Set while the monitor is queued or running on the worker pool */
+    bool in_flight;
+
+    /** Number of times the monitor was due while still in flight, and so was skipped */
+    uint32_t skipped_fires;
+
+    /** Set once the monitor has been removed, so must not be fired or rescheduled */
+    bool removed;
+
+    /** Free the monitor once it is no longer in flight, rather than leaving it to the remover */
+    bool free_when_idle;
+
+    /** Link in @ref polling_monitor_list */
+    list_entry_t list;
+
+    /** Counters, see @ref mmsm_get_stats */
+    mmsm_stats_counters_t stats;
 } polling_monitor_t;
 
 /**
@@ -61,10 +116,152 @@ typedef struct async_monitor_t
     /** The pattern to monitor for */
     char pattern[1024];
 
+    /** Set while the monitor is being removed, to leave it out of new snapshots */
+    bool removed;
+
+    /** Used to free the monitor once no dispatch can still be using it */
+    rcu_head_t rcu;
+
+    /** Counters, see @ref mmsm_get_stats */
+    mmsm_stats_counters_t stats;
+
     /** The next instance in the list */
     struct async_monitor_t *next;
 } async_monitor_t;
 
+/**
+ * A monitor's entry in a snapshot.
+ */
+typedef struct async_monitor_entry_t
+{
+    /** The entry in the snapshot's index */
+    monitor_index_node_t node;
+
+    /** The monitor */
+    async_monitor_t *monitor;
+} async_monitor_entry_t;
+
+/**
+ * An immutable copy of the monitors on an interface, published with RCU so that received data
+ * can be dispatched without taking @ref async_mutex.
+ *
+ * A snapshot is only ever matched against by the single thread that dispatches data for its
+ * interface, as matching updates the per-node bookkeeping in the index.
+ */
+typedef struct async_monitor_snapshot_t
+{
+    /** Used to free the snapshot once no dispatch can still be using it */
+    rcu_head_t rcu;
+
+    /** Index of @ref entries */
+    monitor_index_t index;
+
+    /** Number of entries */
+    size_t num_entries;
+
+    /** The monitors */
+    async_monitor_entry_t entries[];
+} async_monitor_snapshot_t;
+
+/**
+ * A request sent with mmsm_request_async.
+ */
+typedef struct async_request_t
+{
+    /** The backend interface the request is sent on */
+    mmsm_backend_intf_t *intf;
+
+    /** The callback to fire when the response is available */
+    mmsm_data_callback_fn_t callback;
+
+    /** The context to provide back to the user */
+    void *context;
+
+    /** The command to send */
+    mmsm_data_item_t *command;
+
+    /** Work item used when the request runs on the request workers */
+    worker_item_t work;
+} async_request_t;
+
+/**
+ * One command of a batch, see @ref mmsm_batch.
+ */
+typedef struct batch_request_t
+{
+    /** The batch the request belongs to */
+    struct mmsm_batch *batch;
+
+    /** The backend interface the request is sent on */
+    mmsm_backend_intf_t *intf;
+
+    /** The command to send */
+    mmsm_data_item_t *command;
+
+    /** The response, or NULL if the request failed */
+    mmsm_data_item_t *result;
+
+    /** Set by whichever of the caller or a request worker runs the request */
+    bool claimed;
+
+    /** Work item used when the request runs on the request workers */
+    worker_item_t work;
+} batch_request_t;
+
+/**
+ * A set of requests sent together with mmsm_request_batch.
+ */
+struct mmsm_batch
+{
+    /** Protects pending and refs */
+    pthread_mutex_t mutex;
+
+    /** Signalled when the last pending request completes */
+    pthread_cond_t cond;
+
+    /** The requests, in the order they were added */
+    batch_request_t *requests;
+
+    /** Number of requests added */
+    size_t num_requests;
+
+    /** Number of requests there is space for */
+    size_t max_requests;
+
+    /** Number of requests sent that haven't completed yet */
+    size_t pending;
+
+    /** The caller's reference plus one per request queued on the request workers */
+    unsigned int refs;
+
+    /** Set once the batch has been sent */
+    bool executed;
+};
+
+/** Number of requests a batch has space for when created */
+#define BATCH_INITIAL_REQUESTS (4)
+
+/**
+ * Used to wait for a request sent with req_submit to complete.
+ */
+typedef struct request_completion_t
+{
+    /** Protects the rest of the structure */
+    pthread_mutex_t mutex;
+
+    /** Signalled when the request completes */
+    pthread_cond_t cond;
+
+    /** Set once the request has completed */
+    bool done;
+
+    /** The result of the request */
+    mmsm_error_code err;
+
+    /** The response */
+    mmsm_data_item_t *result;
+} request_completion_t;
+
 /**
  * A list of all interfaces that have async operations.
  */
@@ -76,9 +273,27 @@ typedef struct async_intf_def_t
     /** The thread that will run this list. */
     pthread_t async_monitor_thread;
 
+    /** Whether this list is run by the event loop rather than its own thread */
+    bool in_event_loop;
+
+    /** Whether async_monitor_thread has been started and not yet joined */
+    bool has_thread;
+
+    /** Received notifications waiting to be dispatched, if dispatch_queue is set */
+    event_queue_t queue;
+
+    /** The thread running the monitor callbacks, when notifications are queued */
+    pthread_t dispatch_thread;
+
+    /** Whether dispatch_thread has been started and not yet joined */
+    bool has_dispatch_thread;
+
     /** The head of the list of asynch operations on this interface. */
     struct async_monitor_t *head;
 
+    /** The published copy of the monitors in the list, or NULL if there are none */
+    async_monitor_snapshot_t *snapshot;
+
     /** The next interface on which there are async ops. */
     struct async_intf_def_t *next;
 } async_intf_def_t;
@@ -95,14 +310,128 @@ static pthread_t polling_monitor_thread;
 /** The mutex for communication to the polling thread */
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/** The condition to notify changes to the polling thread */
-static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+/** The condition to notify changes to the polling thread. Waits on CLOCK_MONOTONIC. */
+static pthread_cond_t cond;
+
+/** Guards the one-time initialisation of @ref cond and @ref polling_monitor_heap */
+static pthread_once_t polling_once = PTHREAD_ONCE_INIT;
 
 /** Whether or not the system is running */
 static bool is_running = false;
 
-/** The polling monitor list */
-static polling_monitor_t *polling_monitor_list = NULL;
+/** The polling monitors, ordered by the time they are next due */
+static heap_t polling_monitor_heap;
+
+/** Every polling monitor, whether in the heap or currently being fired */
+static list_head_t polling_monitor_list;
+
+/** Signalled whenever a polling monitor stops being in flight, or a polling pass completes */
+static pthread_cond_t polling_idle_cond = PTHREAD_COND_INITIALIZER;
+
+/** Incremented every time the polling thread finishes firing the monitors that were due */
+static uint64_t polling_pass_count;
+
+/** The thread writing the counters to @ref stats_datalog, if enabled */
+static pthread_t stats_thread;
+
+/** Signalled when stopping, to wake @ref stats_thread. Waits on CLOCK_MONOTONIC. */
+static pthread_cond_t stats_cond;
+
+/** Whether @ref stats_thread has been started and not yet joined */
+static bool has_stats_thread;
+
+/** The engine_stats datalog, or NULL if the counters aren't being written out */
+static struct datalog *stats_datalog;
+
+/** The thread running the event loop, if enabled */
+static pthread_t event_loop_thread;
+
+/** The epoll instance of the event loop, or -1 if the event loop isn't running */
+static int event_loop_epoll_fd = -1;
+
+/** eventfd used to wake the event loop when stopping */
+static int event_loop_wake_fd = -1;
+
+/** Pool that runs polling monitors, or NULL to run them on the polling thread */
+static worker_pool_t *polling_workers;
+
+/** Pool that runs async requests for backends without req_submit */
+static worker_pool_t *request_workers;
+
+/** Protects creation and destruction of @ref request_workers */
+static pthread_mutex_t request_workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Whether @ref request_workers are being destroyed, so mustn't be recreated */
+static bool request_workers_stopping;
+
+/** Where polling monitors, pattern monitors and async requests are allocated from */
+static pool_t polling_monitor_pool =
+    POOL_INITIALIZER("polling_monitor", sizeof(polling_monitor_t), 16);
+static pool_t async_monitor_pool = POOL_INITIALIZER("async_monitor", sizeof(async_monitor_t), 16);
+static pool_t async_request_pool = POOL_INITIALIZER("async_request", sizeof(async_request_t), 16);
+
+/** Number of request workers used if not set in the config */
+#define DEFAULT_REQUEST_WORKERS (2)
+
+/** Where the flight recorder is dumped to, see trace.h */
+#define DEFAULT_TRACE_FILE "/var/log/smart_manager/smart_manager.trace"
+
+/**
+ * Most notifications received from one interface per wake up, so that a flood on one interface
+ * can't hold up the others sharing the event loop
+ */
+#define ASYNC_MONITOR_DRAIN_MAX (256)
+
+/** Engine settings, see @ref mmsm_set_engine_config */
+static struct
+{
+    /** Number of worker threads used to run polling monitors */
+    unsigned int polling_workers;
+    /** Run all of the monitors of one backend interface on the same worker */
+    bool group_by_backend;
+    /** Number of worker threads used to run async requests */
+    unsigned int request_workers;
+    /** Service the notifications of all backends from one epoll loop */
+    bool event_loop;
+    /** Coalesce and cache requests for commands registered with mmsm_request_cache_command */
+    bool request_cache;
+    /** Number of notifications queued per interface between receive and dispatch, 0 = inline */
+    unsigned int dispatch_queue;
+    /** What to do with a notification when an interface's queue is full */
+    event_queue_policy_t dispatch_overflow;
+    /** Seconds between writes of the counters to the engine_stats datalog, 0 = never */
+    unsigned int stats_interval_s;
+    /** Schedule polling monitors a period after their last slot, rather than after firing */
+    bool polling_fixed_rate;
+    /** Spread the first fires of polling monitors over their periods */
+    bool polling_spread;
+    /** Up to how much later than scheduled polling monitors fire, at random */
+    unsigned int polling_jitter_ms;
+    /** UNIX socket the metrics are served on, or "" */
+    char metrics_socket[108];
+    /** Address and TCP port the metrics are served over HTTP on, 0 = not served */
+    char metrics_address[64];
+    unsigned int metrics_port;
+    /** UNIX socket queries are answered on, or "" */
+    char query_socket[108];
+} engine_config = {
+    .request_workers = DEFAULT_REQUEST_WORKERS,
+};
+
+/**
+ * The lag of the polling monitor whose callback is currently running on this thread, or -1 when
+ * not running a polling monitor callback.
+ */
+static __thread int64_t current_polling_lag_us = -1;
+
+/** The polling monitor whose callback is currently running on this thread, if any */
+static __thread polling_monitor_t *current_polling_monitor;
+
+/** Number of polling monitors registered so far, which gives the next one its phase */
+static uint32_t polling_spread_seq;
+
+/** State of the random polling jitter, only used with @ref mutex held */
+static unsigned int polling_jitter_seed;
 
 /**
  * Adds the given number of milliseconds to the timespec value.
@@ -116,6 +445,18 @@ timespec_add_ms(struct timespec *ts, uint32_t milliseconds)
     ts->tv_nsec = ts->tv_nsec % 1000000000ull;
 }
 
+/**
+ * Adds the given number of microseconds to the timespec value.
+ */
+static void
+timespec_add_us(struct timespec *ts, uint64_t microseconds)
+{
+    ts->tv_sec += microseconds / 1000000ull;
+    ts->tv_nsec += (microseconds % 1000000ull) * 1000ul;
+    ts->tv_sec += ts->tv_nsec / 1000000000ull;
+    ts->tv_nsec = ts->tv_nsec % 1000000000ull;
+}
+
 /**
  * Returns true if lhs is at an earlier point in time than rhs
  */
@@ -127,9 +468,155 @@ timespec_is_less_than(const struct timespec *lhs, const struct timespec *rhs)
     return lhs->tv_sec < rhs->tv_sec;
 }
 
+/**
+ * Returns the number of microseconds from lhs to rhs, or 0 if rhs is not after lhs
+ */
+static uint64_t
+timespec_diff_us(const struct timespec *lhs, const struct timespec *rhs)
+{
+    int64_t diff_ns;
+
+    if (!timespec_is_less_than(lhs, rhs))
+        return 0;
+
+    diff_ns = (int64_t)(rhs->tv_sec - lhs->tv_sec) * 1000000000ll +
+              (rhs->tv_nsec - lhs->tv_nsec);
+    return (uint64_t)diff_ns / 1000ull;
+}
+
+/**
+ * Returns how far into its period the n-th polling monitor registered first fires: n times the
+ * golden ratio, modulo 1, of the period. However many monitors are registered, and whatever
+ * their periods, each next one lands in the largest gap left, so their fires stay spread out.
+ */
+static uint32_t
+polling_monitor_phase_ms(uint32_t seq, uint32_t frequency_ms)
+{
+    /* 2^32 divided by the golden ratio, wrapping */
+    uint32_t fraction = seq * 2654435769u;
+
+    return ((uint64_t)fraction * frequency_ms) >> 32;
+}
+
+/**
+ * Sets when a polling monitor is next due, from the slot it is scheduled for, adding the jitter.
+ * The jitter is kept under the period, so a monitor never fires twice in one slot.
+ */
+static void
+polling_monitor_set_next_time(polling_monitor_t *monitor)
+{
+    uint32_t jitter_ms = MIN(engine_config.polling_jitter_ms,
+                             monitor->frequency_ms ? monitor->frequency_ms - 1 : 0);
+
+    monitor->next_time = monitor->slot_time;
+    if (jitter_ms)
+        timespec_add_ms(&monitor->next_time, rand_r(&polling_jitter_seed) % (jitter_ms + 1));
+}
+
+/**
+ * Schedules a polling monitor's first fire, its phase into its period from now.
+ */
+static void
+polling_monitor_schedule_first(polling_monitor_t *monitor, const struct timespec *now)
+{
+    monitor->slot_time = *now;
+    timespec_add_ms(&monitor->slot_time, monitor->phase_ms);
+    polling_monitor_set_next_time(monitor);
+}
+
+/**
+ * Schedules a polling monitor's next fire, once it has become due. With polling_fixed_rate, it
+ * is the next of the slots a period apart from its first that is still to come, so monitors
+ * don't drift however late they fire, and a monitor that fell behind skips the slots it
+ * missed. Otherwise, it is a period from now.
+ */
+static void
+polling_monitor_reschedule(polling_monitor_t *monitor, const struct timespec *now)
+{
+    if (engine_config.polling_fixed_rate && monitor->frequency_ms)
+    {
+        uint64_t period_us = monitor->frequency_ms * 1000ull;
+        uint64_t missed = timespec_diff_us(&monitor->slot_time, now) / period_us;
+
+        timespec_add_us(&monitor->slot_time, (missed + 1) * period_us);
+    }
+    else
+    {
+        monitor->slot_time = *now;
+        timespec_add_ms(&monitor->slot_time, monitor->frequency_ms);
+    }
+
+    polling_monitor_set_next_time(monitor);
+}
+
+static bool
+polling_monitor_is_before(const void *lhs, const void *rhs)
+{
+    const polling_monitor_t *lhs_mon = lhs;
+    const polling_monitor_t *rhs_mon = rhs;
+
+    return timespec_is_less_than(&lhs_mon->next_time, &rhs_mon->next_time);
+}
+
+static void
+polling_monitor_set_heap_index(void *item, size_t index)
+{
+    ((polling_monitor_t *)item)->heap_index = index;
+}
+
+/**
+ * One-time set up of the polling scheduler state.
+ *
+ * The condition variable is switched over to CLOCK_MONOTONIC so that stepping the wall clock (NTP,
+ * the user running `date`) can't cause a burst of late fires or stall the scheduler.
+ */
+static void
+polling_init_once(void)
+{
+    pthread_condattr_t attr;
+
+    MMSM_ASSERT(pthread_condattr_init(&attr) == 0);
+    MMSM_ASSERT(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+    MMSM_ASSERT(pthread_cond_init(&cond, &attr) == 0);
+    MMSM_ASSERT(pthread_cond_init(&stats_cond, &attr) == 0);
+    MMSM_ASSERT(pthread_condattr_destroy(&attr) == 0);
+
+    heap_init(&polling_monitor_heap, polling_monitor_is_before, polling_monitor_set_heap_index);
+    list_reset(&polling_monitor_list);
+}
+
+/**
+ * Frees a polling monitor that is in neither the heap nor flight.
+ */
+static void
+polling_monitor_free(polling_monitor_t *monitor)
+{
+    mmsm_data_item_free(monitor->command);
+    pool_free(&polling_monitor_pool, monitor);
+}
+
+/**
+ * Completion callback for requests that mmsm_internal_request is waiting on.
+ */
+static void
+request_completion_done(void *arg, mmsm_error_code err, mmsm_data_item_t *result)
+{
+    request_completion_t *completion = (request_completion_t *)arg;
+
+    MMSM_ASSERT(pthread_mutex_lock(&completion->mutex) == 0);
+    completion->err = err;
+    completion->result = result;
+    completion->done = true;
+    MMSM_ASSERT(pthread_cond_signal(&completion->cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&completion->mutex) == 0);
+}
+
+/**
+ * Performs a request on the backend, bypassing the request cache.
+ */
 static mmsm_data_item_t *
-mmsm_internal_request(mmsm_backend_intf_t *intf,
-                      mmsm_data_item_t *command)
+mmsm_backend_request_untimed(mmsm_backend_intf_t *intf,
+                             mmsm_data_item_t *command)
 {
     mmsm_data_item_t *rsp = NULL;
 
@@ -142,80 +629,724 @@ mmsm_internal_request(mmsm_backend_intf_t *intf,
             return NULL;
         }
     }
-    else if (intf->req_async)
+    else if (intf->req_submit)
     {
-        /* Not implemented yet */
-        return NULL;
+        /* Backend only has a non-blocking path, so submit and wait for it here */
+        request_completion_t completion = {
+            .mutex = PTHREAD_MUTEX_INITIALIZER,
+            .cond = PTHREAD_COND_INITIALIZER,
+        };
+        mmsm_error_code err = intf->req_submit(intf, command, request_completion_done,
+                                               &completion);
+        if (err != MMSM_SUCCESS)
+        {
+            LOG_ERROR("req_submit failed: %d\n", err);
+            return NULL;
+        }
+
+        MMSM_ASSERT(pthread_mutex_lock(&completion.mutex) == 0);
+        while (!completion.done)
+        {
+            MMSM_ASSERT(pthread_cond_wait(&completion.cond, &completion.mutex) == 0);
+        }
+        MMSM_ASSERT(pthread_mutex_unlock(&completion.mutex) == 0);
+
+        if (completion.err != MMSM_SUCCESS)
+        {
+            LOG_ERROR("Submitted request failed: %d\n", completion.err);
+            mmsm_data_item_free(completion.result);
+            return NULL;
+        }
+        rsp = completion.result;
+    }
+    else
+    {
+        LOG_ERROR("Backend does not support requests\n");
     }
 
     return rsp;
 }
 
 /**
- * Runs an async monitor.
- *
- * The thread monitors the polling_monitor_list linked list, waiting for any of
- * them to expire. When one expires, it sends the request as a blocking request
- * and fires the provided callback.
- *
- * Both of those actions block the polling monitor thread and so user code that
- * blocks the callback while waiting for another callback to arrive will
- * deadlock!
- *
- * Mutexes are not held during the callback so the user can send requests in a
- * callback.
+ * The id of a command for the flight recorder: its key, or the first 4 characters of it.
  */
-static void *
-async_monitor_thread_fn(void *arg)
+static uint32_t
+mmsm_trace_command(mmsm_data_item_t *command)
 {
-    async_intf_def_t *current_list = (async_intf_def_t *)arg;
+    if (!command)
+        return 0;
 
-    MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+    if (command->mmsm_key.type == MMSM_KEY_TYPE_U32)
+        return command->mmsm_key.d.u32;
 
-    /* coverity[missing_lock:SUPPRESS] */
-    while (is_running && current_list->head)
+    return command->mmsm_key.d.string ? trace_name(command->mmsm_key.d.string) : 0;
+}
+
+/**
+ * Performs a request on the backend, bypassing the request cache, and updates the backend's
+ * counters.
+ */
+static mmsm_data_item_t *
+mmsm_backend_request(mmsm_backend_intf_t *intf,
+                     mmsm_data_item_t *command)
+{
+    mmsm_stats_counters_t *stats = engine_backend_stats(intf);
+    uint16_t backend = engine_backend_index(intf);
+    uint32_t key = mmsm_trace_command(command);
+    uint64_t start = trace_begin(TRACE_ENGINE, backend, key);
+    mmsm_data_item_t *rsp = mmsm_backend_request_untimed(intf, command);
+    uint32_t latency_us = trace_end(TRACE_ENGINE, backend, rsp ? 0 : 1, start);
+
+    MMSM_PROBE4(backend__request, intf, key, rsp ? 0 : 1, latency_us);
+    if (stats)
     {
-        async_monitor_t *iter;
-        mmsm_data_item_t *result = NULL;
+        engine_histogram_record(&stats->request_us, engine_stats_now_us() - start);
+        if (!rsp)
+            engine_stats_inc(&stats->errors);
+    }
 
-        MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
-        current_list->this_interface->req_async(current_list->this_interface,
-                                                &result);
+    return rsp;
+}
 
-        if (!result)
-        {
-            MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
-            continue;
-        }
+static mmsm_data_item_t *
+mmsm_internal_request(mmsm_backend_intf_t *intf,
+                      mmsm_data_item_t *command)
+{
+    mmsm_data_item_t *rsp;
 
-        for (iter = current_list->head;
-             iter;
-             iter = iter->next)
-        {
-            if (mmsm_find_key(result, &iter->command->mmsm_key) && iter->callback)
-            {
-                iter->callback(iter->context, iter->intf, result);
-            }
-        }
-        MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+    MMSM_PROBE2(request__start, intf, mmsm_trace_command(command));
 
-        mmsm_data_item_free(result);
+    if (!engine_config.request_cache ||
+        !request_cache_request(intf, command, mmsm_backend_request, &rsp))
+    {
+        rsp = mmsm_backend_request(intf, command);
     }
-    MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
 
-    return NULL;
+    MMSM_PROBE3(request__done, intf, mmsm_trace_command(command), rsp != NULL);
+    return rsp;
 }
 
 /**
- * Runs the polling monitor.
- *
- * The thread monitors the polling_monitor_list linked list, waiting for any of
+ * Provides the response to an async request to the user and frees the request.
+ */
+static void
+async_request_complete(async_request_t *request, mmsm_data_item_t *result)
+{
+    request->callback(request->context, request->intf, result);
+
+    mmsm_data_item_free(result);
+    mmsm_data_item_free(request->command);
+    pool_free(&async_request_pool, request);
+}
+
+/**
+ * Completion callback for async requests sent with req_submit.
+ */
+static void
+async_request_submit_done(void *arg, mmsm_error_code err, mmsm_data_item_t *result)
+{
+    async_request_t *request = (async_request_t *)arg;
+
+    if (err != MMSM_SUCCESS)
+    {
+        LOG_ERROR("Async request failed: %d\n", err);
+        mmsm_data_item_free(result);
+        result = NULL;
+    }
+
+    async_request_complete(request, result);
+}
+
+/**
+ * Queues work on the request workers, creating them on first use.
+ */
+static mmsm_error_code
+request_workers_submit(uintptr_t key, worker_item_t *work)
+{
+    MMSM_ASSERT(pthread_mutex_lock(&request_workers_mutex) == 0);
+    if (request_workers_stopping)
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&request_workers_mutex) == 0);
+        LOG_WARN("Request submitted while stopping\n");
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    if (!request_workers)
+    {
+        request_workers = worker_pool_create("request", engine_config.request_workers, false);
+    }
+
+    if (!request_workers)
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&request_workers_mutex) == 0);
+        LOG_ERROR("Failed to create request workers\n");
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    worker_pool_submit(request_workers, key, work);
+    MMSM_ASSERT(pthread_mutex_unlock(&request_workers_mutex) == 0);
+
+    return MMSM_SUCCESS;
+}
+
+/**
+ * Runs an async request on a request worker, for backends without req_submit.
+ */
+static void
+async_request_work_fn(worker_item_t *work)
+{
+    async_request_t *request = container_of(work, async_request_t, work);
+
+    async_request_complete(request, mmsm_internal_request(request->intf, request->command));
+}
+
+/** Frees a monitor once no dispatch can still be using it */
+static void
+async_monitor_free_rcu(rcu_head_t *head)
+{
+    async_monitor_t *monitor = container_of(head, async_monitor_t, rcu);
+
+    mmsm_data_item_free(monitor->command);
+    pool_free(&async_monitor_pool, monitor);
+}
+
+static void
+async_monitor_snapshot_free(async_monitor_snapshot_t *snapshot)
+{
+    monitor_index_cleanup(&snapshot->index);
+    free(snapshot);
+}
+
+static void
+async_monitor_snapshot_free_rcu(rcu_head_t *head)
+{
+    async_monitor_snapshot_free(container_of(head, async_monitor_snapshot_t, rcu));
+}
+
+/**
+ * Tells the interface's backend which notifications the monitors of a
+ * snapshot can match, if it can filter them.
+ *
+ * @returns MMSM_SUCCESS, or an error if the commands couldn't be gathered
+ */
+static mmsm_error_code
+async_monitor_filter(async_intf_def_t *current_list,
+                     async_monitor_snapshot_t *snapshot)
+{
+    mmsm_backend_intf_t *intf = current_list->this_interface;
+    mmsm_data_item_t **commands = NULL;
+    size_t count = snapshot ? snapshot->num_entries : 0;
+    mmsm_error_code err;
+    size_t i;
+
+    if (!intf->monitor_filter)
+        return MMSM_SUCCESS;
+
+    if (count)
+    {
+        commands = calloc(count, sizeof(*commands));
+        if (!commands)
+            return MMSM_UNKNOWN_ERROR;
+
+        for (i = 0; i < count; i++)
+            commands[i] = snapshot->entries[i].monitor->command;
+    }
+
+    err = intf->monitor_filter(intf, commands, count);
+    if (err != MMSM_SUCCESS)
+        LOG_WARN("Failed to filter notifications: %d, receiving all of them\n", err);
+
+    free(commands);
+    return MMSM_SUCCESS;
+}
+
+/**
+ * Builds a new snapshot of the monitors on the interface that haven't been
+ * removed, and publishes it in place of the current one.
+ *
+ * Must be called with @ref async_mutex held.
+ */
+static mmsm_error_code
+async_monitor_publish(async_intf_def_t *current_list)
+{
+    async_monitor_snapshot_t *snapshot = NULL;
+    async_monitor_snapshot_t *old;
+    async_monitor_t *iter;
+    size_t count = 0;
+
+    for (iter = current_list->head; iter; iter = iter->next)
+    {
+        if (!iter->removed)
+            count++;
+    }
+
+    if (count)
+    {
+        snapshot = calloc(1, sizeof(*snapshot) + count * sizeof(snapshot->entries[0]));
+        if (!snapshot)
+            return MMSM_UNKNOWN_ERROR;
+
+        if (monitor_index_init(&snapshot->index) != 0)
+        {
+            free(snapshot);
+            return MMSM_UNKNOWN_ERROR;
+        }
+
+        for (iter = current_list->head; iter; iter = iter->next)
+        {
+            async_monitor_entry_t *entry = &snapshot->entries[snapshot->num_entries];
+
+            if (iter->removed)
+                continue;
+
+            entry->monitor = iter;
+            entry->node.command = iter->command;
+            entry->node.pattern = iter->pattern[0] ? iter->pattern : NULL;
+            if (monitor_index_add(&snapshot->index, &entry->node) != 0)
+            {
+                async_monitor_snapshot_free(snapshot);
+                return MMSM_UNKNOWN_ERROR;
+            }
+            snapshot->num_entries++;
+        }
+    }
+
+    if (async_monitor_filter(current_list, snapshot) != MMSM_SUCCESS)
+    {
+        if (snapshot)
+            async_monitor_snapshot_free(snapshot);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    old = current_list->snapshot;
+    rcu_assign_pointer(current_list->snapshot, snapshot);
+    if (old)
+        rcu_call(&old->rcu, async_monitor_snapshot_free_rcu);
+
+    return MMSM_SUCCESS;
+}
+
+/**
+ * Provides received data to every monitor on the interface that matches it.
+ *
+ * The monitors are read from the interface's published snapshot without taking
+ * @ref async_mutex, so callbacks are free to add and remove monitors.
+ */
+static void
+async_monitor_dispatch(async_intf_def_t *current_list, mmsm_data_item_t *result)
+{
+    async_monitor_snapshot_t *snapshot;
+    monitor_index_node_t *node = NULL;
+
+    rcu_read_lock();
+    snapshot = rcu_dereference(current_list->snapshot);
+    if (snapshot)
+        node = monitor_index_match(&snapshot->index, result);
+
+    for (; node; node = node->match_next)
+    {
+        async_monitor_entry_t *entry = container_of(node, async_monitor_entry_t, node);
+        async_monitor_t *monitor = entry->monitor;
+
+        if (monitor->callback)
+        {
+            uint64_t start = engine_stats_now_us();
+            uint64_t duration;
+
+            monitor->callback(monitor->context, monitor->intf, result);
+            duration = engine_stats_now_us() - start;
+            engine_histogram_record(&monitor->stats.callback_us, duration);
+            trace_record(TRACE_ENGINE, TRACE_CALLBACK, TRACE_CALLBACK_PATTERN,
+                         engine_backend_index(monitor->intf), MIN(duration, UINT32_MAX));
+            MMSM_PROBE3(callback__done, monitor->intf, 0, duration);
+        }
+    }
+    rcu_read_unlock();
+
+    /* Free what callbacks replaced or removed, as they can't wait for a grace period */
+    rcu_reclaim();
+}
+
+/**
+ * Hands a received notification over to be dispatched, either by queueing it for the
+ * interface's dispatch thread or by dispatching it on the calling thread.
+ */
+static void
+async_monitor_deliver(async_intf_def_t *current_list, mmsm_data_item_t *result)
+{
+    uint32_t key = mmsm_trace_command(result);
+
+    trace_record(TRACE_ENGINE, TRACE_EVENT, engine_backend_index(current_list->this_interface),
+                 key, 0);
+    MMSM_PROBE2(event__receive, current_list->this_interface, key);
+
+    if (current_list->has_dispatch_thread)
+    {
+        event_queue_push(&current_list->queue, result);
+        return;
+    }
+
+    async_monitor_dispatch(current_list, result);
+    mmsm_data_item_free(result);
+}
+
+static void
+async_monitor_queue_free(void *item)
+{
+    mmsm_data_item_free((mmsm_data_item_t *)item);
+}
+
+/**
+ * Runs the callbacks for the notifications queued on an interface, so that slow callbacks don't
+ * hold up receiving.
+ */
+static void *
+async_dispatch_thread_fn(void *arg)
+{
+    async_intf_def_t *current_list = (async_intf_def_t *)arg;
+    mmsm_data_item_t *result;
+
+    while ((result = event_queue_pop(&current_list->queue)))
+    {
+        async_monitor_dispatch(current_list, result);
+        mmsm_data_item_free(result);
+    }
+
+    return NULL;
+}
+
+/**
+ * Receives and delivers every further notification already waiting on an interface, up to
+ * @ref ASYNC_MONITOR_DRAIN_MAX, so a burst is handled in one wake up.
+ */
+static void
+async_monitor_drain(async_intf_def_t *current_list)
+{
+    mmsm_backend_intf_t *intf = current_list->this_interface;
+    size_t i;
+
+    if (!intf->monitor_pending || !intf->monitor_recv)
+        return;
+
+    for (i = 0; i < ASYNC_MONITOR_DRAIN_MAX && intf->monitor_pending(intf); i++)
+    {
+        mmsm_data_item_t *result = NULL;
+
+        if (intf->monitor_recv(intf, &result) != MMSM_SUCCESS)
+            break;
+
+        if (result)
+            async_monitor_deliver(current_list, result);
+    }
+}
+
+/**
+ * Runs an async monitor.
+ *
+ * The thread monitors the polling_monitor_list linked list, waiting for any of
  * them to expire. When one expires, it sends the request as a blocking request
  * and fires the provided callback.
  *
- * Both of those actions block the polling monitor thread and so user code that
- * blocks the callback while waiting for another callback to arrive will
- * deadlock!
+ * Both of those actions block the polling monitor thread and so user code that
+ * blocks the callback while waiting for another callback to arrive will
+ * deadlock!
+ *
+ * Mutexes are not held during the callback so the user can send requests in a
+ * callback.
+ */
+static void *
+async_monitor_thread_fn(void *arg)
+{
+    async_intf_def_t *current_list = (async_intf_def_t *)arg;
+
+    while (__atomic_load_n(&is_running, __ATOMIC_ACQUIRE))
+    {
+        mmsm_data_item_t *result = NULL;
+
+        current_list->this_interface->req_async(current_list->this_interface,
+                                                &result);
+
+        if (result)
+            async_monitor_deliver(current_list, result);
+
+        async_monitor_drain(current_list);
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs the event loop.
+ *
+ * Waits on the notification descriptors of every interface registered with the
+ * loop, and receives and dispatches notifications as they become readable. The
+ * loop exits as soon as @ref event_loop_wake_fd is written to.
+ *
+ * As with the per-interface threads, callbacks run on this thread unless
+ * dispatch_queue is set, so a callback that blocks delays the notifications of
+ * every interface on the loop.
+ */
+static void *
+event_loop_thread_fn(void *arg)
+{
+    struct epoll_event events[16];
+
+    UNUSED(arg);
+
+    while (true)
+    {
+        int i;
+        int num_events = epoll_wait(event_loop_epoll_fd, events, ARRAY_SIZE(events), -1);
+
+        if (num_events < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LOG_ERROR("epoll_wait failed: %d\n", errno);
+            break;
+        }
+
+        for (i = 0; i < num_events; i++)
+        {
+            async_intf_def_t *current_list = events[i].data.ptr;
+            mmsm_backend_intf_t *intf;
+            mmsm_data_item_t *result = NULL;
+
+            /* The wake descriptor is registered with no list */
+            if (!current_list)
+                return NULL;
+
+            intf = current_list->this_interface;
+            intf->monitor_recv(intf, &result);
+            if (result)
+                async_monitor_deliver(current_list, result);
+
+            async_monitor_drain(current_list);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Adds an interface to the event loop, if it supports it.
+ *
+ * Must be called with @ref async_mutex held.
+ *
+ * @returns true if the interface is now serviced by the event loop
+ */
+static bool
+event_loop_add(async_intf_def_t *current_list)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = current_list };
+    mmsm_backend_intf_t *intf = current_list->this_interface;
+    int fd;
+
+    if (!intf->monitor_get_fd || !intf->monitor_recv)
+        return false;
+
+    fd = intf->monitor_get_fd(intf);
+    if (fd < 0)
+    {
+        LOG_WARN("No monitor descriptor for interface, using a thread\n");
+        return false;
+    }
+
+    if (epoll_ctl(event_loop_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        LOG_WARN("Failed to add interface to event loop: %d, using a thread\n", errno);
+        return false;
+    }
+
+    current_list->in_event_loop = true;
+    return true;
+}
+
+/**
+ * Creates the event loop. Interfaces are added to it by @ref async_intf_start.
+ *
+ * @returns MMSM_SUCCESS if the loop was started
+ */
+static mmsm_error_code
+event_loop_start(void)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+
+    event_loop_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (event_loop_epoll_fd < 0)
+    {
+        LOG_ERROR("Failed to create epoll instance: %d\n", errno);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    event_loop_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_loop_wake_fd < 0 ||
+        epoll_ctl(event_loop_epoll_fd, EPOLL_CTL_ADD, event_loop_wake_fd, &event) < 0)
+    {
+        LOG_ERROR("Failed to set up event loop wake up: %d\n", errno);
+        goto fail;
+    }
+
+    MMSM_ASSERT(pthread_create(&event_loop_thread,
+                               NULL,
+                               event_loop_thread_fn,
+                               NULL) == 0);
+
+    return MMSM_SUCCESS;
+
+fail:
+    if (event_loop_wake_fd >= 0)
+        close(event_loop_wake_fd);
+    close(event_loop_epoll_fd);
+    event_loop_wake_fd = -1;
+    event_loop_epoll_fd = -1;
+    return MMSM_UNKNOWN_ERROR;
+}
+
+/**
+ * Starts receiving notifications on an interface, on the event loop if it is
+ * running and the interface supports it, else on a thread of its own.
+ *
+ * Must be called with @ref async_mutex held while the engine is running.
+ */
+static void
+async_intf_start(async_intf_def_t *current_list)
+{
+    if (engine_config.dispatch_queue)
+    {
+        if (event_queue_init(&current_list->queue, engine_config.dispatch_queue,
+                             engine_config.dispatch_overflow, async_monitor_queue_free) == 0)
+        {
+            MMSM_ASSERT(pthread_create(&current_list->dispatch_thread,
+                                       NULL,
+                                       async_dispatch_thread_fn,
+                                       current_list) == 0);
+            current_list->has_dispatch_thread = true;
+        }
+        else
+        {
+            LOG_ERROR("Failed to create dispatch queue, dispatching inline\n");
+        }
+    }
+
+    if (event_loop_epoll_fd >= 0 && event_loop_add(current_list))
+        return;
+
+    MMSM_ASSERT(pthread_create(&current_list->async_monitor_thread,
+                               NULL,
+                               async_monitor_thread_fn,
+                               current_list) == 0);
+    current_list->has_thread = true;
+}
+
+/**
+ * Wakes the event loop, waits for it to exit and frees its resources.
+ */
+static void
+event_loop_stop(void)
+{
+    uint64_t wake = 1;
+    async_intf_def_t *current_list;
+
+    if (event_loop_epoll_fd < 0)
+        return;
+
+    MMSM_ASSERT(write(event_loop_wake_fd, &wake, sizeof(wake)) == sizeof(wake));
+    MMSM_ASSERT(pthread_join(event_loop_thread, NULL) == 0);
+
+    close(event_loop_wake_fd);
+    close(event_loop_epoll_fd);
+    event_loop_wake_fd = -1;
+    event_loop_epoll_fd = -1;
+
+    MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+    for (current_list = async_interface_list;
+         current_list;
+         current_list = current_list->next)
+    {
+        current_list->in_event_loop = false;
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+}
+
+/**
+ * Sends a polling monitor's request and provides the response on its callback.
+ */
+static void
+polling_monitor_fire(polling_monitor_t *monitor)
+{
+    mmsm_data_item_t *result;
+    uint64_t start;
+    uint64_t end;
+    uint64_t duration;
+
+    if (monitor->last_lag_us > MSEC_TO_USEC((uint64_t)monitor->frequency_ms))
+    {
+        LOG_DEBUG("Polling monitor fired %" PRIu64 "us late (period %ums)\n",
+                  monitor->last_lag_us, monitor->frequency_ms);
+    }
+
+    engine_histogram_record(&monitor->stats.lag_us, monitor->last_lag_us);
+    if (monitor->last_lag_us > MSEC_TO_USEC((uint64_t)monitor->frequency_ms))
+        engine_stats_inc(&monitor->stats.deadline_misses);
+
+    start = engine_stats_now_us();
+    result = mmsm_internal_request(monitor->intf, monitor->command);
+    end = engine_stats_now_us();
+    engine_histogram_record(&monitor->stats.request_us, end - start);
+    if (!result)
+        engine_stats_inc(&monitor->stats.errors);
+
+    current_polling_lag_us = (int64_t)monitor->last_lag_us;
+    current_polling_monitor = monitor;
+    monitor->callback(monitor->context, monitor->intf, result);
+    current_polling_monitor = NULL;
+    current_polling_lag_us = -1;
+    duration = engine_stats_now_us() - end;
+    engine_histogram_record(&monitor->stats.callback_us, duration);
+    trace_record(TRACE_ENGINE, TRACE_CALLBACK, TRACE_CALLBACK_POLLING,
+                 engine_backend_index(monitor->intf), MIN(duration, UINT32_MAX));
+    MMSM_PROBE3(callback__done, monitor->intf, 1, duration);
+
+    mmsm_data_item_free(result);
+}
+
+/**
+ * Runs a polling monitor on a worker thread.
+ */
+static void
+polling_monitor_work_fn(worker_item_t *work)
+{
+    polling_monitor_t *monitor = container_of(work, polling_monitor_t, work);
+
+    polling_monitor_fire(monitor);
+
+    MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
+    monitor->in_flight = false;
+    if (monitor->free_when_idle)
+        polling_monitor_free(monitor);
+    else
+        MMSM_ASSERT(pthread_cond_broadcast(&polling_idle_cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+}
+
+/**
+ * Runs the polling monitor.
+ *
+ * The thread keeps the polling monitors in a min-heap ordered by the time they are next due, and
+ * sleeps until the earliest one expires. When woken, every monitor that is due is taken off the
+ * heap in one pass, its request is sent as a blocking request and the provided callback is fired.
+ * Each monitor is then rescheduled relative to the time it was fired.
+ *
+ * If polling workers are configured, due monitors are handed to the worker pool
+ * instead, so that a slow backend only delays its own monitors. A monitor that is
+ * still queued or running when it next becomes due is skipped for that period, so
+ * a given monitor never runs twice at the same time.
+ *
+ * Without workers, both of those actions block the polling monitor thread and so
+ * user code that blocks the callback while waiting for another callback to arrive
+ * will deadlock!
  *
  * Mutexes are not held during the callback so the user can send requests in a
  * callback.
@@ -230,49 +1361,89 @@ polling_monitor_thread_fn(void *arg)
     /* coverity[missing_lock:SUPPRESS] */
     while (is_running)
     {
-        polling_monitor_t *iter;
+        polling_monitor_t *monitor;
+        polling_monitor_t *due = NULL;
+        polling_monitor_t **due_tail = &due;
         struct timespec now;
-        struct timespec *next_expires = NULL;
-        bool fired_one = false;
 
-        clock_gettime(CLOCK_REALTIME, &now);
+        clock_gettime(CLOCK_MONOTONIC, &now);
 
-        for (iter = polling_monitor_list;
-             iter;
-             iter = iter->next)
+        /* Take every monitor that has expired off the heap */
+        while ((monitor = heap_peek(&polling_monitor_heap)) != NULL &&
+               !timespec_is_less_than(&now, &monitor->next_time))
         {
-            if (next_expires == NULL ||
-                timespec_is_less_than(&iter->next_time, next_expires))
-            {
-                next_expires = &iter->next_time;
-            }
+            heap_pop(&polling_monitor_heap);
 
-            if (timespec_is_less_than(&iter->next_time, &now))
+            monitor->last_lag_us = timespec_diff_us(&monitor->next_time, &now);
+            if (monitor->last_lag_us > monitor->max_lag_us)
+                monitor->max_lag_us = monitor->last_lag_us;
+
+            polling_monitor_reschedule(monitor, &now);
+
+            monitor->next_due = NULL;
+            *due_tail = monitor;
+            due_tail = &monitor->next_due;
+        }
+
+        if (due && polling_workers)
+        {
+            for (monitor = due; monitor; monitor = monitor->next_due)
             {
-                mmsm_data_item_t *result;
+                if (monitor->in_flight)
+                {
+                    monitor->skipped_fires++;
+                    engine_stats_inc(&monitor->stats.deadline_misses);
+                    LOG_DEBUG("Polling monitor still busy, skipping (%u skipped)\n",
+                              monitor->skipped_fires);
+                    continue;
+                }
 
-                fired_one = true;
-                iter->next_time = now;
-                timespec_add_ms(&iter->next_time, iter->frequency_ms);
+                monitor->in_flight = true;
+                worker_pool_submit(polling_workers,
+                                   engine_config.group_by_backend ?
+                                        (uintptr_t)monitor->intf : (uintptr_t)monitor,
+                                   &monitor->work);
+            }
+        }
+        else if (due)
+        {
+            for (monitor = due; monitor; monitor = monitor->next_due)
+            {
+                if (monitor->removed)
+                    continue;
 
+                monitor->in_flight = true;
                 MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
-                result = mmsm_internal_request(iter->intf, iter->command);
-                iter->callback(iter->context, iter->intf, result);
+                polling_monitor_fire(monitor);
                 MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
-
-                mmsm_data_item_free(result);
-
-                break;
+                monitor->in_flight = false;
+                MMSM_ASSERT(pthread_cond_broadcast(&polling_idle_cond) == 0);
             }
         }
 
-        if (fired_one)
+        if (due)
+        {
+
+            /* Put them back in for their next expiry, unless removed while being fired */
+            while (due)
+            {
+                monitor = due;
+                due = monitor->next_due;
+                if (monitor->removed)
+                    polling_monitor_free(monitor);
+                else
+                    MMSM_ASSERT(heap_push(&polling_monitor_heap, monitor) == 0);
+            }
+            polling_pass_count++;
+            MMSM_ASSERT(pthread_cond_broadcast(&polling_idle_cond) == 0);
             continue;
+        }
 
         /* Wait for next monitor to expire, or the condition to fire */
-        if (next_expires)
+        monitor = heap_peek(&polling_monitor_heap);
+        if (monitor)
         {
-            int ret = pthread_cond_timedwait(&cond, &mutex, next_expires);
+            int ret = pthread_cond_timedwait(&cond, &mutex, &monitor->next_time);
             MMSM_ASSERT(ret == 0 || ret == ETIMEDOUT);
         }
         else
@@ -289,6 +1460,7 @@ void mmsm_init(void)
 {
     LOG_INFO("Initialising...\n");
     mmsm_init_time();
+    MMSM_ASSERT(pthread_once(&polling_once, polling_init_once) == 0);
 }
 
 mmsm_data_item_t *
@@ -315,6 +1487,355 @@ mmsm_request(mmsm_backend_intf_t *intf, ...)
     return rsp;
 }
 
+mmsm_error_code
+mmsm_request_cache_command(mmsm_backend_intf_t *intf, uint32_t ttl_ms, ...)
+{
+    va_list args;
+    mmsm_data_item_t *command;
+    int ret;
+
+    MMSM_ASSERT(intf);
+
+    va_start(args, ttl_ms);
+    MMSM_ASSERT(intf->process_request_args);
+    command = intf->process_request_args(intf, args);
+    va_end(args);
+
+    if (!command)
+    {
+        LOG_ERROR("Failed to parse args\n");
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    ret = request_cache_register(intf, command, ttl_ms);
+    mmsm_data_item_free(command);
+    if (ret)
+    {
+        LOG_ERROR("Failed to register cached command: %d\n", ret);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    return MMSM_SUCCESS;
+}
+
+void
+mmsm_request_cache_invalidate(mmsm_backend_intf_t *intf)
+{
+    request_cache_invalidate(intf);
+}
+
+void
+mmsm_request_cache_remove(mmsm_backend_intf_t *intf)
+{
+    request_cache_unregister(intf);
+}
+
+mmsm_error_code
+mmsm_request_async(mmsm_backend_intf_t *intf,
+                   mmsm_data_callback_fn_t callback,
+                   void *context,
+                   ...)
+{
+    async_request_t *request;
+    mmsm_error_code err;
+    va_list args;
+
+    MMSM_ASSERT(intf);
+    MMSM_ASSERT(callback);
+    MMSM_ASSERT(intf->process_request_args);
+
+    request = pool_alloc(&async_request_pool);
+    if (!request)
+        return MMSM_UNKNOWN_ERROR;
+
+    va_start(args, context);
+    request->command = intf->process_request_args(intf, args);
+    va_end(args);
+
+    if (!request->command)
+    {
+        LOG_ERROR("Failed to parse args\n");
+        pool_free(&async_request_pool, request);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    request->intf = intf;
+    request->callback = callback;
+    request->context = context;
+
+    if (intf->req_submit)
+    {
+        err = intf->req_submit(intf, request->command, async_request_submit_done, request);
+        if (err != MMSM_SUCCESS)
+        {
+            LOG_ERROR("req_submit failed: %d\n", err);
+            mmsm_data_item_free(request->command);
+            pool_free(&async_request_pool, request);
+        }
+        return err;
+    }
+
+    request->work.fn = async_request_work_fn;
+    err = request_workers_submit((uintptr_t)request, &request->work);
+    if (err != MMSM_SUCCESS)
+    {
+        mmsm_data_item_free(request->command);
+        pool_free(&async_request_pool, request);
+    }
+
+    return err;
+}
+
+mmsm_batch_t *
+mmsm_batch_create(void)
+{
+    mmsm_batch_t *batch = calloc(1, sizeof(*batch));
+
+    if (!batch)
+        return NULL;
+
+    batch->requests = calloc(BATCH_INITIAL_REQUESTS, sizeof(*batch->requests));
+    if (!batch->requests)
+    {
+        free(batch);
+        return NULL;
+    }
+
+    batch->max_requests = BATCH_INITIAL_REQUESTS;
+    batch->refs = 1;
+    MMSM_ASSERT(pthread_mutex_init(&batch->mutex, NULL) == 0);
+    MMSM_ASSERT(pthread_cond_init(&batch->cond, NULL) == 0);
+
+    return batch;
+}
+
+mmsm_error_code
+mmsm_batch_add(mmsm_batch_t *batch, mmsm_backend_intf_t *intf, ...)
+{
+    batch_request_t *request;
+    va_list args;
+
+    MMSM_ASSERT(batch);
+    MMSM_ASSERT(intf);
+    MMSM_ASSERT(intf->process_request_args);
+
+    if (batch->executed)
+        return MMSM_UNKNOWN_ERROR;
+
+    if (batch->num_requests == batch->max_requests)
+    {
+        size_t max_requests = batch->max_requests * 2;
+        batch_request_t *requests = realloc(batch->requests, max_requests * sizeof(*requests));
+
+        if (!requests)
+            return MMSM_UNKNOWN_ERROR;
+
+        batch->requests = requests;
+        batch->max_requests = max_requests;
+    }
+
+    request = &batch->requests[batch->num_requests];
+    memset(request, 0, sizeof(*request));
+
+    va_start(args, intf);
+    request->command = intf->process_request_args(intf, args);
+    va_end(args);
+
+    if (!request->command)
+    {
+        LOG_ERROR("Failed to parse args\n");
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    request->intf = intf;
+    batch->num_requests++;
+
+    return MMSM_SUCCESS;
+}
+
+/**
+ * Frees a batch once the caller and every request worker are done with it.
+ */
+static void
+batch_put(mmsm_batch_t *batch)
+{
+    size_t i;
+    bool last;
+
+    MMSM_ASSERT(pthread_mutex_lock(&batch->mutex) == 0);
+    last = --batch->refs == 0;
+    MMSM_ASSERT(pthread_mutex_unlock(&batch->mutex) == 0);
+
+    if (!last)
+        return;
+
+    for (i = 0; i < batch->num_requests; i++)
+    {
+        mmsm_data_item_free(batch->requests[i].command);
+        mmsm_data_item_free(batch->requests[i].result);
+    }
+
+    MMSM_ASSERT(pthread_cond_destroy(&batch->cond) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&batch->mutex) == 0);
+    free(batch->requests);
+    free(batch);
+}
+
+/**
+ * Records the response to a batched request and wakes the caller if it was the last one.
+ */
+static void
+batch_request_complete(batch_request_t *request, mmsm_data_item_t *result)
+{
+    mmsm_batch_t *batch = request->batch;
+
+    MMSM_ASSERT(pthread_mutex_lock(&batch->mutex) == 0);
+    request->result = result;
+    if (--batch->pending == 0)
+        MMSM_ASSERT(pthread_cond_signal(&batch->cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&batch->mutex) == 0);
+}
+
+/**
+ * Completion callback for batched requests sent with req_submit.
+ */
+static void
+batch_request_submit_done(void *arg, mmsm_error_code err, mmsm_data_item_t *result)
+{
+    batch_request_t *request = (batch_request_t *)arg;
+
+    if (err != MMSM_SUCCESS)
+    {
+        LOG_ERROR("Batched request failed: %d\n", err);
+        mmsm_data_item_free(result);
+        result = NULL;
+    }
+
+    batch_request_complete(request, result);
+}
+
+/**
+ * Claims a batched request so that it is only run once, by either the caller or a worker.
+ */
+static bool
+batch_request_claim(batch_request_t *request)
+{
+    return !__atomic_exchange_n(&request->claimed, true, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Runs a batched request on a request worker, unless the caller got to it first.
+ */
+static void
+batch_request_work_fn(worker_item_t *work)
+{
+    batch_request_t *request = container_of(work, batch_request_t, work);
+    mmsm_batch_t *batch = request->batch;
+
+    if (batch_request_claim(request))
+        batch_request_complete(request, mmsm_internal_request(request->intf, request->command));
+
+    batch_put(batch);
+}
+
+mmsm_error_code
+mmsm_request_batch(mmsm_batch_t *batch)
+{
+    size_t num_blocking = 0;
+    size_t i;
+
+    MMSM_ASSERT(batch);
+
+    if (batch->executed)
+        return MMSM_UNKNOWN_ERROR;
+
+    batch->executed = true;
+    batch->pending = batch->num_requests;
+
+    /* Backends that can keep requests in flight get every request up front */
+    for (i = 0; i < batch->num_requests; i++)
+    {
+        batch_request_t *request = &batch->requests[i];
+        mmsm_error_code err;
+
+        request->batch = batch;
+
+        if (!request->intf->req_submit)
+        {
+            num_blocking++;
+            continue;
+        }
+
+        request->claimed = true;
+        err = request->intf->req_submit(request->intf, request->command,
+                                        batch_request_submit_done, request);
+        if (err != MMSM_SUCCESS)
+        {
+            LOG_ERROR("req_submit failed: %d\n", err);
+            batch_request_complete(request, NULL);
+        }
+    }
+
+    /*
+     * The rest are spread over the request workers, keeping one back for this thread. This thread
+     * then runs any that no worker has started, so the batch completes even if every worker is
+     * busy, or is itself waiting on a batch.
+     */
+    for (i = 0; i < batch->num_requests && num_blocking > 1; i++)
+    {
+        batch_request_t *request = &batch->requests[i];
+
+        if (request->claimed)
+            continue;
+
+        MMSM_ASSERT(pthread_mutex_lock(&batch->mutex) == 0);
+        batch->refs++;
+        MMSM_ASSERT(pthread_mutex_unlock(&batch->mutex) == 0);
+
+        request->work.fn = batch_request_work_fn;
+        if (request_workers_submit((uintptr_t)request, &request->work) != MMSM_SUCCESS)
+        {
+            batch_put(batch);
+            break;
+        }
+        num_blocking--;
+    }
+
+    for (i = batch->num_requests; i-- > 0;)
+    {
+        batch_request_t *request = &batch->requests[i];
+
+        if (batch_request_claim(request))
+            batch_request_complete(request, mmsm_internal_request(request->intf,
+                                                                  request->command));
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&batch->mutex) == 0);
+    while (batch->pending)
+        MMSM_ASSERT(pthread_cond_wait(&batch->cond, &batch->mutex) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&batch->mutex) == 0);
+
+    return MMSM_SUCCESS;
+}
+
+mmsm_data_item_t *
+mmsm_batch_get_result(mmsm_batch_t *batch, size_t index)
+{
+    MMSM_ASSERT(batch);
+
+    if (!batch->executed || index >= batch->num_requests)
+        return NULL;
+
+    return batch->requests[index].result;
+}
+
+void
+mmsm_batch_free(mmsm_batch_t *batch)
+{
+    if (batch)
+        batch_put(batch);
+}
+
 mmsm_error_code
 mmsm_monitor_polling(mmsm_backend_intf_t *intf,
                      uint32_t frequency_ms,
@@ -323,43 +1844,127 @@ mmsm_monitor_polling(mmsm_backend_intf_t *intf,
                      ...)
 {
     polling_monitor_t *monitor;
+    struct timespec now;
     va_list args;
 
+    MMSM_ASSERT(pthread_once(&polling_once, polling_init_once) == 0);
     MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
 
-    monitor = malloc(sizeof(*monitor));
+    monitor = pool_alloc(&polling_monitor_pool);
     if (!monitor)
     {
         MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
         return MMSM_UNKNOWN_ERROR;
     }
 
-    va_start(args, context);
-    monitor->command = intf->process_request_args(intf, args);
-    va_end(args);
+    va_start(args, context);
+    monitor->command = intf->process_request_args(intf, args);
+    va_end(args);
+
+    if (!monitor->command)
+    {
+        mmsm_data_item_free(monitor->command);
+        pool_free(&polling_monitor_pool, monitor);
+        MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    monitor->intf = intf;
+    monitor->callback = callback;
+    monitor->context = context;
+    monitor->work.fn = polling_monitor_work_fn;
+
+    monitor->frequency_ms = frequency_ms;
+    if (engine_config.polling_spread)
+        monitor->phase_ms = polling_monitor_phase_ms(polling_spread_seq++, frequency_ms);
+
+    /* Due straight away, unless spread */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    polling_monitor_schedule_first(monitor, &now);
+
+    if (heap_push(&polling_monitor_heap, monitor))
+    {
+        mmsm_data_item_free(monitor->command);
+        pool_free(&polling_monitor_pool, monitor);
+        MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+        return MMSM_UNKNOWN_ERROR;
+    }
+    list_add_tail(&polling_monitor_list, &monitor->list);
+
+    MMSM_ASSERT(pthread_cond_signal(&cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+
+    return MMSM_SUCCESS;
+}
+
+mmsm_error_code
+mmsm_monitor_polling_remove(mmsm_backend_intf_t *intf,
+                            mmsm_data_callback_fn_t callback,
+                            void *context)
+{
+    list_entry_t *entry, *tmp;
+    bool found = false;
+
+    MMSM_ASSERT(pthread_once(&polling_once, polling_init_once) == 0);
+    MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
 
-    if (!monitor->command)
+restart:
+    list_for_each_entry_safe(entry, tmp, &polling_monitor_list)
     {
-        mmsm_data_item_free(monitor->command);
-        free(monitor);
-        MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
-        return MMSM_UNKNOWN_ERROR;
-    }
+        polling_monitor_t *monitor = list_get_item(monitor, entry, list);
 
-    monitor->intf = intf;
-    monitor->callback = callback;
-    monitor->context = context;
+        if (monitor->intf != intf || monitor->callback != callback ||
+            monitor->context != context)
+        {
+            continue;
+        }
 
-    monitor->frequency_ms = frequency_ms;
-    monitor->next_time.tv_sec = 0;
+        found = true;
+        list_remove(&monitor->list);
+        monitor->removed = true;
 
-    monitor->next = polling_monitor_list;
-    polling_monitor_list = monitor;
+        if (monitor->heap_index == HEAP_INDEX_NONE)
+        {
+            /*
+             * Taken off the heap by the polling thread, which frees it at the end of the pass.
+             * Unless called from a callback in that same pass, wait for the pass to end so that
+             * the callback is never called once this returns.
+             */
+            if (!current_polling_monitor)
+            {
+                uint64_t pass = polling_pass_count;
+
+                while (pass == polling_pass_count)
+                    MMSM_ASSERT(pthread_cond_wait(&polling_idle_cond, &mutex) == 0);
+                /* The list may have changed while waiting */
+                goto restart;
+            }
+            continue;
+        }
+
+        heap_remove(&polling_monitor_heap, monitor->heap_index);
+
+        if (monitor->in_flight && monitor == current_polling_monitor)
+        {
+            /* Removed from its own callback on a worker, so the worker frees it */
+            monitor->free_when_idle = true;
+            continue;
+        }
+
+        if (monitor->in_flight)
+        {
+            while (monitor->in_flight)
+                MMSM_ASSERT(pthread_cond_wait(&polling_idle_cond, &mutex) == 0);
+            polling_monitor_free(monitor);
+            goto restart;
+        }
+        polling_monitor_free(monitor);
+    }
 
     MMSM_ASSERT(pthread_cond_signal(&cond) == 0);
     MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
 
-    return MMSM_SUCCESS;
+    return found ? MMSM_SUCCESS : MMSM_UNKNOWN_ERROR;
 }
 
 static void
@@ -367,6 +1972,7 @@ ail_init(async_intf_def_t *this_ail, mmsm_backend_intf_t *intf)
 {
     this_ail->this_interface = intf;
     this_ail->head = NULL;
+    this_ail->snapshot = NULL;
     this_ail->next = NULL;
 }
 
@@ -380,6 +1986,7 @@ mmsm_monitor_pattern(mmsm_backend_intf_t *intf,
     async_monitor_t *monitor;
     va_list args;
     async_intf_def_t *current_list;
+    bool is_new_list = false;
 
     MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
     current_list = async_interface_list;
@@ -398,6 +2005,7 @@ mmsm_monitor_pattern(mmsm_backend_intf_t *intf,
 
         ail_init(async_interface_list, intf);
         current_list = async_interface_list;
+        is_new_list = true;
     }
     else
     {
@@ -419,13 +2027,14 @@ mmsm_monitor_pattern(mmsm_backend_intf_t *intf,
                 }
                 ail_init(current_list->next, intf);
                 current_list = current_list->next;
+                is_new_list = true;
                 break;
             }
             current_list = current_list->next;
         }
     }
 
-    monitor = malloc(sizeof(*monitor));
+    monitor = pool_alloc(&async_monitor_pool);
     if (!monitor)
     {
         MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
@@ -439,7 +2048,7 @@ mmsm_monitor_pattern(mmsm_backend_intf_t *intf,
     if (!monitor->command)
     {
         mmsm_data_item_free(monitor->command);
-        free(monitor);
+        pool_free(&async_monitor_pool, monitor);
         MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
         return MMSM_UNKNOWN_ERROR;
     }
@@ -450,17 +2059,417 @@ mmsm_monitor_pattern(mmsm_backend_intf_t *intf,
 
     strncpy(monitor->pattern, pattern, sizeof(monitor->pattern));
     monitor->pattern[sizeof(monitor->pattern) - 1] = '\0';
+
     monitor->next = current_list->head;
     current_list->head = monitor;
 
+    if (async_monitor_publish(current_list) != MMSM_SUCCESS)
+    {
+        current_list->head = monitor->next;
+        mmsm_data_item_free(monitor->command);
+        pool_free(&async_monitor_pool, monitor);
+        MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    /* Interfaces that are new since the engine started need something receiving on them */
+    if (is_new_list && is_running)
+        async_intf_start(current_list);
+
+    MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+
+    /* Free the previous snapshot now if nothing is dispatching */
+    rcu_reclaim();
+
+    return MMSM_SUCCESS;
+}
+
+mmsm_error_code
+mmsm_monitor_pattern_remove(mmsm_backend_intf_t *intf,
+                            mmsm_data_callback_fn_t callback,
+                            void *context)
+{
+    async_intf_def_t *current_list;
+    async_monitor_t **iter;
+    bool found = false;
+
+    MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+
+    current_list = async_interface_list;
+    while (current_list && current_list->this_interface != intf)
+        current_list = current_list->next;
+
+    if (!current_list)
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    for (iter = &current_list->head; *iter; iter = &(*iter)->next)
+    {
+        if ((*iter)->callback == callback && (*iter)->context == context)
+        {
+            (*iter)->removed = true;
+            found = true;
+        }
+    }
+
+    if (found && async_monitor_publish(current_list) != MMSM_SUCCESS)
+    {
+        for (iter = &current_list->head; *iter; iter = &(*iter)->next)
+            (*iter)->removed = false;
+        MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    /* Unlink the removed monitors, and free them once no dispatch can be using them */
+    iter = &current_list->head;
+    while (*iter)
+    {
+        async_monitor_t *monitor = *iter;
+
+        if (!monitor->removed)
+        {
+            iter = &monitor->next;
+            continue;
+        }
+
+        *iter = monitor->next;
+        rcu_call(&monitor->rcu, async_monitor_free_rcu);
+    }
+
+    MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+
+    if (!found)
+        return MMSM_UNKNOWN_ERROR;
+
+    /*
+     * Wait for any dispatch still using the old snapshot, so the callback is never called once
+     * this returns. From within a callback that would wait on ourselves, so leave the monitors
+     * to be freed later.
+     */
+    if (!rcu_read_lock_held())
+        rcu_synchronize();
+
+    return MMSM_SUCCESS;
+}
+
+mmsm_error_code
+mmsm_monitor_get_queue_stats(mmsm_backend_intf_t *intf, mmsm_monitor_queue_stats_t *stats)
+{
+    async_intf_def_t *current_list;
+    size_t depth;
+    size_t max_depth;
+
+    MMSM_ASSERT(stats);
+    MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+
+    current_list = async_interface_list;
+    while (current_list && current_list->this_interface != intf)
+        current_list = current_list->next;
+
+    if (!current_list || !current_list->has_dispatch_thread)
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+        return MMSM_UNKNOWN_ERROR;
+    }
+
+    event_queue_get_stats(&current_list->queue, &depth, &max_depth, &stats->dropped);
+    stats->capacity = event_queue_capacity(&current_list->queue);
+    stats->depth = depth;
+    stats->max_depth = max_depth;
+
     MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
 
     return MMSM_SUCCESS;
 }
 
+mmsm_stats_t *
+mmsm_get_stats(void)
+{
+    mmsm_stats_t *stats;
+    size_t max_entries = ENGINE_STATS_MAX_BACKENDS;
+    list_entry_t *entry;
+    async_intf_def_t *current_list;
+    async_monitor_t *monitor;
+
+    MMSM_ASSERT(pthread_once(&polling_once, polling_init_once) == 0);
+    MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
+    MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+
+    list_for_each_entry(entry, &polling_monitor_list)
+        max_entries++;
+
+    for (current_list = async_interface_list; current_list; current_list = current_list->next)
+    {
+        for (monitor = current_list->head; monitor; monitor = monitor->next)
+            max_entries++;
+    }
+
+    stats = calloc(1, sizeof(*stats) + max_entries * sizeof(stats->entries[0]));
+    if (!stats)
+        goto out;
+
+    stats->num_entries = engine_backend_stats_read(stats->entries, ENGINE_STATS_MAX_BACKENDS);
+
+    list_for_each_entry(entry, &polling_monitor_list)
+    {
+        polling_monitor_t *polling = list_get_item(polling, entry, list);
+        mmsm_stats_entry_t *stats_entry = &stats->entries[stats->num_entries];
+
+        if (polling->removed)
+            continue;
+
+        stats_entry->type = MMSM_STATS_POLLING_MONITOR;
+        stats_entry->intf = polling->intf;
+        stats_entry->callback = polling->callback;
+        stats_entry->context = polling->context;
+        stats_entry->frequency_ms = polling->frequency_ms;
+        engine_stats_counters_read(&stats_entry->counters, &polling->stats);
+        stats->num_entries++;
+    }
+
+    for (current_list = async_interface_list; current_list; current_list = current_list->next)
+    {
+        for (monitor = current_list->head; monitor; monitor = monitor->next)
+        {
+            mmsm_stats_entry_t *stats_entry = &stats->entries[stats->num_entries];
+
+            stats_entry->type = MMSM_STATS_PATTERN_MONITOR;
+            stats_entry->intf = monitor->intf;
+            stats_entry->callback = monitor->callback;
+            stats_entry->context = monitor->context;
+            engine_stats_counters_read(&stats_entry->counters, &monitor->stats);
+            stats->num_entries++;
+        }
+    }
+
+out:
+    MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+
+    return stats;
+}
+
+void
+mmsm_stats_free(mmsm_stats_t *stats)
+{
+    free(stats);
+}
+
+/**
+ * Writes a snapshot of the counters to @ref stats_datalog, one line per entry.
+ */
+static void
+stats_write_datalog(void)
+{
+    static const char *const type_names[] = {
+        [MMSM_STATS_BACKEND] = "backend",
+        [MMSM_STATS_POLLING_MONITOR] = "polling",
+        [MMSM_STATS_PATTERN_MONITOR] = "pattern",
+    };
+    mmsm_stats_t *stats = mmsm_get_stats();
+    timestamp_t now;
+    size_t i;
+
+    if (!stats)
+        return;
+
+    timestamp_get(&now);
+
+    for (i = 0; i < stats->num_entries; i++)
+    {
+        const mmsm_stats_entry_t *stats_entry = &stats->entries[i];
+        const mmsm_stats_counters_t *counters = &stats_entry->counters;
+        char id[64];
+
+        snprintf(id, sizeof(id), "%p/%p", (void *)stats_entry->intf, stats_entry->context);
+        datalog_write_csv(stats_datalog, "tssuuuuuuuuuuuuu", &now,
+                          type_names[stats_entry->type], id,
+                          stats_entry->frequency_ms,
+                          (unsigned int)counters->errors,
+                          (unsigned int)counters->deadline_misses,
+                          (unsigned int)counters->request_us.count,
+                          (unsigned int)mmsm_histogram_percentile_us(&counters->request_us, 50),
+                          (unsigned int)mmsm_histogram_percentile_us(&counters->request_us, 99),
+                          (unsigned int)counters->request_us.max_us,
+                          (unsigned int)counters->callback_us.count,
+                          (unsigned int)mmsm_histogram_percentile_us(&counters->callback_us, 50),
+                          (unsigned int)mmsm_histogram_percentile_us(&counters->callback_us, 99),
+                          (unsigned int)counters->callback_us.max_us,
+                          (unsigned int)mmsm_histogram_percentile_us(&counters->lag_us, 99),
+                          (unsigned int)counters->lag_us.max_us);
+    }
+
+    mmsm_stats_free(stats);
+}
+
+/**
+ * Periodically writes the counters to the engine_stats datalog until the engine stops.
+ */
+static void *
+stats_thread_fn(void *arg)
+{
+    struct timespec next;
+
+    UNUSED(arg);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
+    while (is_running)
+    {
+        int ret;
+
+        next.tv_sec += engine_config.stats_interval_s;
+        do
+        {
+            ret = pthread_cond_timedwait(&stats_cond, &mutex, &next);
+            MMSM_ASSERT(ret == 0 || ret == ETIMEDOUT);
+        } while (ret == 0 && is_running);
+
+        if (!is_running)
+            break;
+
+        MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+        stats_write_datalog();
+        MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
+
+    return NULL;
+}
+
+void
+mmsm_set_engine_config(config_setting_t *cfg)
+{
+    int workers = cfg_parse_int_with_default(cfg, "polling_workers", 0);
+    const char *overflow;
+    const char *schedule;
+
+    if (workers < 0)
+    {
+        LOG_WARN("Invalid number of polling workers %d, running monitors inline\n", workers);
+        workers = 0;
+    }
+
+    engine_config.polling_workers = workers;
+    engine_config.group_by_backend = cfg_parse_bool_with_default(cfg, "group_by_backend", false);
+
+    workers = cfg_parse_int_with_default(cfg, "request_workers", DEFAULT_REQUEST_WORKERS);
+    if (workers <= 0)
+    {
+        LOG_WARN("Invalid number of request workers %d, using %d\n",
+                 workers, DEFAULT_REQUEST_WORKERS);
+        workers = DEFAULT_REQUEST_WORKERS;
+    }
+    engine_config.request_workers = workers;
+
+    engine_config.event_loop = cfg_parse_bool_with_default(cfg, "event_loop", false);
+    engine_config.request_cache = cfg_parse_bool_with_default(cfg, "request_cache", false);
+
+    workers = cfg_parse_int_with_default(cfg, "dispatch_queue", 0);
+    if (workers < 0)
+    {
+        LOG_WARN("Invalid dispatch queue size %d, dispatching inline\n", workers);
+        workers = 0;
+    }
+    engine_config.dispatch_queue = workers;
+
+    workers = cfg_parse_int_with_default(cfg, "stats_interval_s", 0);
+    if (workers < 0)
+    {
+        LOG_WARN("Invalid stats interval %d, not writing stats\n", workers);
+        workers = 0;
+    }
+    engine_config.stats_interval_s = workers;
+
+    schedule = cfg_parse_string_with_default(cfg, "polling_schedule", "fixed_delay");
+    engine_config.polling_fixed_rate = strcmp(schedule, "fixed_rate") == 0;
+    if (!engine_config.polling_fixed_rate && strcmp(schedule, "fixed_delay") != 0)
+        LOG_WARN("Unknown polling schedule %s, using fixed_delay\n", schedule);
+
+    engine_config.polling_spread = cfg_parse_bool_with_default(cfg, "polling_spread", false);
+
+    workers = cfg_parse_int_with_default(cfg, "polling_jitter_ms", 0);
+    if (workers < 0)
+    {
+        LOG_WARN("Invalid polling jitter %d, not adding any\n", workers);
+        workers = 0;
+    }
+    engine_config.polling_jitter_ms = workers;
+
+    trace_set_file(cfg_parse_string_with_default(cfg, "trace_file", DEFAULT_TRACE_FILE));
+
+    snprintf(engine_config.metrics_socket, sizeof(engine_config.metrics_socket), "%s",
+             cfg_parse_string_with_default(cfg, "metrics_socket", ""));
+    snprintf(engine_config.metrics_address, sizeof(engine_config.metrics_address), "%s",
+             cfg_parse_string_with_default(cfg, "metrics_address", "127.0.0.1"));
+    workers = cfg_parse_int_with_default(cfg, "metrics_port", 0);
+    if (workers < 0 || workers > UINT16_MAX)
+    {
+        LOG_WARN("Invalid metrics port %d, not serving metrics over HTTP\n", workers);
+        workers = 0;
+    }
+    engine_config.metrics_port = workers;
+
+    snprintf(engine_config.query_socket, sizeof(engine_config.query_socket), "%s",
+             cfg_parse_string_with_default(cfg, "query_socket", ""));
+
+    overflow = cfg_parse_string_with_default(cfg, "dispatch_overflow", "drop_oldest");
+    if (strcmp(overflow, "block") == 0)
+    {
+        engine_config.dispatch_overflow = EVENT_QUEUE_BLOCK;
+    }
+    else if (strcmp(overflow, "count") == 0)
+    {
+        engine_config.dispatch_overflow = EVENT_QUEUE_DROP_NEWEST;
+    }
+    else
+    {
+        if (strcmp(overflow, "drop_oldest") != 0)
+            LOG_WARN("Unknown dispatch overflow policy %s, using drop_oldest\n", overflow);
+        engine_config.dispatch_overflow = EVENT_QUEUE_DROP_OLDEST;
+    }
+}
+
+int64_t
+mmsm_monitor_polling_get_lag_us(void)
+{
+    return current_polling_lag_us;
+}
+
+/**
+ * Seeds the polling jitter and, with polling_spread, moves the first fires of the polling
+ * monitors registered before starting to their phases from now, as they would otherwise all be
+ * due at once. Must be called with @ref mutex held.
+ */
+static void
+polling_monitors_start(void)
+{
+    list_entry_t *entry;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    polling_jitter_seed = (unsigned int)now.tv_nsec;
+
+    if (!engine_config.polling_spread)
+        return;
+
+    list_for_each_entry(entry, &polling_monitor_list)
+    {
+        polling_monitor_t *monitor = list_get_item(monitor, entry, list);
+
+        polling_monitor_schedule_first(monitor, &now);
+        if (monitor->heap_index != HEAP_INDEX_NONE)
+            heap_update(&polling_monitor_heap, monitor->heap_index);
+    }
+}
+
 mmsm_error_code
 mmsm_start(void)
 {
+    MMSM_ASSERT(pthread_once(&polling_once, polling_init_once) == 0);
     MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
     MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
 
@@ -471,21 +2480,65 @@ mmsm_start(void)
         return MMSM_UNKNOWN_ERROR;
     }
 
-    is_running = true;
+    __atomic_store_n(&is_running, true, __ATOMIC_RELEASE);
+
+    polling_monitors_start();
+
+    if (engine_config.polling_workers)
+    {
+        polling_workers = worker_pool_create("polling", engine_config.polling_workers,
+                                             engine_config.group_by_backend);
+        if (!polling_workers)
+            LOG_ERROR("Failed to create polling workers, running monitors inline\n");
+    }
 
     MMSM_ASSERT(pthread_create(&polling_monitor_thread,
                                NULL,
                                polling_monitor_thread_fn,
                                NULL) == 0);
 
+    if (engine_config.event_loop && event_loop_start() != MMSM_SUCCESS)
+        LOG_ERROR("Failed to start event loop, using a thread per interface\n");
+
+    if (engine_config.stats_interval_s)
+    {
+        if (!stats_datalog)
+        {
+            stats_datalog = datalog_create("engine_stats");
+            datalog_init_csv(stats_datalog,
+                             "time,type,id,frequency_ms,errors,deadline_misses,"
+                             "requests,request_p50_us,request_p99_us,request_max_us,"
+                             "callbacks,callback_p50_us,callback_p99_us,callback_max_us,"
+                             "lag_p99_us,lag_max_us");
+        }
+
+        if (stats_datalog)
+        {
+            MMSM_ASSERT(pthread_create(&stats_thread,
+                                       NULL,
+                                       stats_thread_fn,
+                                       NULL) == 0);
+            has_stats_thread = true;
+        }
+    }
+
+    if (engine_config.metrics_socket[0] || engine_config.metrics_port)
+    {
+        if (metrics_server_start(engine_config.metrics_socket[0] ?
+                                     engine_config.metrics_socket : NULL,
+                                 engine_config.metrics_address,
+                                 engine_config.metrics_port) != 0)
+            LOG_ERROR("Failed to start serving metrics\n");
+    }
+
+    if (engine_config.query_socket[0] && query_server_start(engine_config.query_socket) != 0)
+        LOG_ERROR("Failed to start answering queries\n");
+
     async_intf_def_t *current_list = async_interface_list;
 
     while (current_list)
     {
-        MMSM_ASSERT(pthread_create(&current_list->async_monitor_thread,
-                                   NULL,
-                                   async_monitor_thread_fn,
-                                   current_list) == 0);
+        async_intf_start(current_list);
         current_list = current_list->next;
     }
     MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
@@ -497,6 +2550,12 @@ mmsm_start(void)
 mmsm_error_code
 mmsm_stop(void)
 {
+    worker_pool_t *workers;
+
+    /* Stopped first, as scrapes and queries take the locks below */
+    metrics_server_stop();
+    query_server_stop();
+
     MMSM_ASSERT(pthread_mutex_lock(&mutex) == 0);
     MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
 
@@ -507,22 +2566,71 @@ mmsm_stop(void)
         return MMSM_UNKNOWN_ERROR;
     }
 
-    is_running = false;
+    __atomic_store_n(&is_running, false, __ATOMIC_RELEASE);
 
     MMSM_ASSERT(pthread_cond_signal(&cond) == 0);
+    MMSM_ASSERT(pthread_cond_signal(&stats_cond) == 0);
     MMSM_ASSERT(pthread_mutex_unlock(&mutex) == 0);
     MMSM_ASSERT(pthread_join(polling_monitor_thread, NULL) == 0);
+    if (has_stats_thread)
+    {
+        MMSM_ASSERT(pthread_join(stats_thread, NULL) == 0);
+        has_stats_thread = false;
+    }
 
     struct async_intf_def_t *iter = async_interface_list;
     while (iter)
     {
-        MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
-        MMSM_ASSERT(pthread_join(iter->async_monitor_thread, NULL) == 0);
-        MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+        if (iter->has_thread)
+        {
+            MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+            MMSM_ASSERT(pthread_join(iter->async_monitor_thread, NULL) == 0);
+            MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+            iter->has_thread = false;
+        }
 
         iter = iter->next;
     }
     MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
 
+    event_loop_stop();
+
+    /* Nothing is receiving any more, so let the dispatch threads drain their queues */
+    MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+    for (iter = async_interface_list; iter; iter = iter->next)
+    {
+        if (!iter->has_dispatch_thread)
+            continue;
+
+        event_queue_stop(&iter->queue);
+        MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+        MMSM_ASSERT(pthread_join(iter->dispatch_thread, NULL) == 0);
+        MMSM_ASSERT(pthread_mutex_lock(&async_mutex) == 0);
+        iter->has_dispatch_thread = false;
+        event_queue_cleanup(&iter->queue);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&async_mutex) == 0);
+
+    /* Let any monitors and requests that were already handed to the workers finish */
+    worker_pool_destroy(polling_workers);
+    polling_workers = NULL;
+
+    /*
+     * Not under the lock, as a completion callback on a worker may submit another request.
+     * Submitting fails until the workers are gone, rather than creating the pool again.
+     */
+    MMSM_ASSERT(pthread_mutex_lock(&request_workers_mutex) == 0);
+    workers = request_workers;
+    request_workers = NULL;
+    request_workers_stopping = true;
+    MMSM_ASSERT(pthread_mutex_unlock(&request_workers_mutex) == 0);
+    worker_pool_destroy(workers);
+    MMSM_ASSERT(pthread_mutex_lock(&request_workers_mutex) == 0);
+    request_workers_stopping = false;
+    MMSM_ASSERT(pthread_mutex_unlock(&request_workers_mutex) == 0);
+
+    /* Free anything removed while callbacks were running */
+    rcu_synchronize();
+
     return MMSM_SUCCESS;
 }
@@ -0,0 +1,207 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "event_queue.h"
+#include "utils.h"
+
+/*
+ * The consumer pops by advancing head with a compare-and-swap rather than a plain store, as the
+ * producer also advances it when dropping the oldest item. Whichever side wins the swap owns the
+ * item; the other reads the slot again. Indices only ever increase, so a slot can't be reused
+ * between reading it and swapping head past it.
+ *
+ * A side about to sleep sets its waiting flag and then checks the queue again, while the other
+ * side updates the queue and then checks the flag. With a full barrier between each store and
+ * load, at least one of them sees the other, so a wake up is never lost.
+ */
+
+int event_queue_init(event_queue_t *queue, size_t capacity, event_queue_policy_t policy,
+                     event_queue_free_fn_t free_fn)
+{
+    size_t size = 1;
+
+    while (size < capacity)
+        size <<= 1;
+
+    memset(queue, 0, sizeof(*queue));
+    queue->slots = calloc(size, sizeof(*queue->slots));
+    if (!queue->slots)
+        return -ENOMEM;
+
+    queue->mask = size - 1;
+    queue->policy = policy;
+    queue->free_fn = free_fn;
+    MMSM_ASSERT(pthread_mutex_init(&queue->mutex, NULL) == 0);
+    MMSM_ASSERT(pthread_cond_init(&queue->not_empty, NULL) == 0);
+    MMSM_ASSERT(pthread_cond_init(&queue->not_full, NULL) == 0);
+
+    return 0;
+}
+
+void event_queue_cleanup(event_queue_t *queue)
+{
+    size_t i;
+
+    if (!queue->slots)
+        return;
+
+    for (i = queue->head; i != queue->tail; i++)
+        queue->free_fn(queue->slots[i & queue->mask]);
+
+    MMSM_ASSERT(pthread_cond_destroy(&queue->not_full) == 0);
+    MMSM_ASSERT(pthread_cond_destroy(&queue->not_empty) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&queue->mutex) == 0);
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+/**
+ * Wakes the other side if it is waiting on the condition
+ */
+static void event_queue_wake(event_queue_t *queue, bool *waiting, pthread_cond_t *cond)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(waiting, __ATOMIC_RELAXED))
+        return;
+
+    MMSM_ASSERT(pthread_mutex_lock(&queue->mutex) == 0);
+    MMSM_ASSERT(pthread_cond_signal(cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&queue->mutex) == 0);
+}
+
+static bool event_queue_is_full(event_queue_t *queue)
+{
+    return queue->tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) > queue->mask;
+}
+
+static bool event_queue_is_empty(event_queue_t *queue)
+{
+    return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Makes space in a full queue according to its policy.
+ *
+ * @return true if there is now space, false if the new item should be dropped
+ */
+static bool event_queue_make_space(event_queue_t *queue)
+{
+    size_t head;
+    void *oldest;
+
+    switch (queue->policy)
+    {
+    case EVENT_QUEUE_DROP_OLDEST:
+        head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        oldest = __atomic_load_n(&queue->slots[head & queue->mask], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&queue->head, &head, head + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            queue->free_fn(oldest);
+            __atomic_store_n(&queue->dropped, queue->dropped + 1, __ATOMIC_RELAXED);
+        }
+        /* Otherwise the consumer took it, which also made space */
+        return true;
+
+    case EVENT_QUEUE_BLOCK:
+        /* Once stopped, the consumer may already have gone */
+        MMSM_ASSERT(pthread_mutex_lock(&queue->mutex) == 0);
+        __atomic_store_n(&queue->producer_waiting, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (event_queue_is_full(queue) && !queue->stopping)
+            MMSM_ASSERT(pthread_cond_wait(&queue->not_full, &queue->mutex) == 0);
+        __atomic_store_n(&queue->producer_waiting, false, __ATOMIC_RELAXED);
+        MMSM_ASSERT(pthread_mutex_unlock(&queue->mutex) == 0);
+        return !event_queue_is_full(queue);
+
+    case EVENT_QUEUE_DROP_NEWEST:
+    default:
+        return false;
+    }
+}
+
+void event_queue_push(event_queue_t *queue, void *item)
+{
+    size_t depth;
+
+    if (event_queue_is_full(queue) && !event_queue_make_space(queue))
+    {
+        queue->free_fn(item);
+        __atomic_store_n(&queue->dropped, queue->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_store_n(&queue->slots[queue->tail & queue->mask], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+
+    depth = queue->tail - __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    if (depth > queue->max_depth)
+        __atomic_store_n(&queue->max_depth, depth, __ATOMIC_RELAXED);
+
+    event_queue_wake(queue, &queue->consumer_waiting, &queue->not_empty);
+}
+
+void *event_queue_pop(event_queue_t *queue)
+{
+    bool stopped;
+
+    while (true)
+    {
+        size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+        if (head != __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+        {
+            void *item = __atomic_load_n(&queue->slots[head & queue->mask], __ATOMIC_RELAXED);
+
+            if (!__atomic_compare_exchange_n(&queue->head, &head, head + 1, false,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                continue;
+
+            if (queue->policy == EVENT_QUEUE_BLOCK)
+                event_queue_wake(queue, &queue->producer_waiting, &queue->not_full);
+            return item;
+        }
+
+        MMSM_ASSERT(pthread_mutex_lock(&queue->mutex) == 0);
+        __atomic_store_n(&queue->consumer_waiting, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (event_queue_is_empty(queue) && !queue->stopping)
+            MMSM_ASSERT(pthread_cond_wait(&queue->not_empty, &queue->mutex) == 0);
+        __atomic_store_n(&queue->consumer_waiting, false, __ATOMIC_RELAXED);
+        stopped = event_queue_is_empty(queue) && queue->stopping;
+        MMSM_ASSERT(pthread_mutex_unlock(&queue->mutex) == 0);
+
+        if (stopped)
+            return NULL;
+    }
+}
+
+void event_queue_stop(event_queue_t *queue)
+{
+    MMSM_ASSERT(pthread_mutex_lock(&queue->mutex) == 0);
+    queue->stopping = true;
+    MMSM_ASSERT(pthread_cond_broadcast(&queue->not_empty) == 0);
+    MMSM_ASSERT(pthread_cond_broadcast(&queue->not_full) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&queue->mutex) == 0);
+}
+
+void event_queue_get_stats(event_queue_t *queue, size_t *depth, size_t *max_depth,
+                           uint64_t *dropped)
+{
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    *depth = tail >= head ? tail - head : 0;
+    *max_depth = __atomic_load_n(&queue->max_depth, __ATOMIC_RELAXED);
+    *dropped = __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Engine-internal bounded queue between the thread receiving an interface's notifications and
+ * the thread running its monitor callbacks.
+ *
+ * The queue is a single-producer single-consumer ring. Pushing and popping don't take any locks
+ * unless the other side has gone to sleep waiting on the queue. What happens when the producer
+ * finds the queue full depends on the queue's @ref event_queue_policy_t.
+ */
+
+/**
+ * What to do with a new item when the queue is full
+ */
+typedef enum event_queue_policy
+{
+    /** Drop the oldest queued item to make space */
+    EVENT_QUEUE_DROP_OLDEST,
+    /** Wait for the consumer to make space */
+    EVENT_QUEUE_BLOCK,
+    /** Drop the new item */
+    EVENT_QUEUE_DROP_NEWEST,
+} event_queue_policy_t;
+
+/**
+ * Function used to free items the queue drops
+ */
+typedef void (*event_queue_free_fn_t)(void *item);
+
+/**
+ * The queue
+ */
+typedef struct event_queue
+{
+    /** Index of the next item to pop. Advanced by the consumer, and by the producer dropping. */
+    size_t head __attribute__((aligned(64)));
+    /** Index of the next slot to push to. Only written by the producer. */
+    size_t tail __attribute__((aligned(64)));
+    /** Highest number of items queued at once */
+    size_t max_depth;
+    /** Number of items dropped */
+    uint64_t dropped;
+    /** Slots, indexed modulo the capacity */
+    void **slots __attribute__((aligned(64)));
+    /** Capacity - 1. The capacity is a power of 2. */
+    size_t mask;
+    /** What to do when full */
+    event_queue_policy_t policy;
+    /** Frees dropped items */
+    event_queue_free_fn_t free_fn;
+    /** Protects sleeping on the conditions below */
+    pthread_mutex_t mutex;
+    /** Signalled when an item is pushed while the consumer is waiting */
+    pthread_cond_t not_empty;
+    /** Signalled when an item is popped while the producer is waiting */
+    pthread_cond_t not_full;
+    /** Set while the consumer is waiting for an item */
+    bool consumer_waiting;
+    /** Set while the producer is waiting for space */
+    bool producer_waiting;
+    /** Set by @ref event_queue_stop */
+    bool stopping;
+} event_queue_t;
+
+/**
+ * @brief Initialise a queue
+ *
+ * @param queue Queue to initialise
+ * @param capacity Minimum number of items the queue can hold. Rounded up to a power of 2.
+ * @param policy What to do when full
+ * @param free_fn Function used to free dropped items
+ * @return 0 on success, or -ENOMEM
+ */
+int event_queue_init(event_queue_t *queue, size_t capacity, event_queue_policy_t policy,
+                     event_queue_free_fn_t free_fn);
+
+/**
+ * @brief Free the storage of a queue, and any items still queued
+ *
+ * @param queue Queue to clean up
+ */
+void event_queue_cleanup(event_queue_t *queue);
+
+/**
+ * @brief Queue an item. Must only be called by the producer.
+ *
+ * The queue takes ownership of the item, and frees it if it is dropped.
+ *
+ * @param queue Queue to push to
+ * @param item Item to queue
+ */
+void event_queue_push(event_queue_t *queue, void *item);
+
+/**
+ * @brief Take the oldest item off the queue, waiting for one if it is empty. Must only be called
+ *        by the consumer.
+ *
+ * @param queue Queue to pop from
+ * @return the item, or NULL once the queue has been stopped and is empty
+ */
+void *event_queue_pop(event_queue_t *queue);
+
+/**
+ * @brief Stop the queue, waking up both sides
+ *
+ * Items queued before stopping are still returned by @ref event_queue_pop. Items pushed when a
+ * blocking queue is full are dropped rather than waiting.
+ *
+ * @param queue Queue to stop
+ */
+void event_queue_stop(event_queue_t *queue);
+
+/**
+ * @brief Get the queue's statistics. May be called from any thread.
+ *
+ * @param queue The queue
+ * @param depth Set to the number of items currently queued
+ * @param max_depth Set to the highest number of items queued at once
+ * @param dropped Set to the number of items dropped
+ */
+void event_queue_get_stats(event_queue_t *queue, size_t *depth, size_t *max_depth,
+                           uint64_t *dropped);
+
+/**
+ * @brief Get the number of items the queue can hold
+ */
+static inline size_t event_queue_capacity(const event_queue_t *queue)
+{
+    return queue->mask + 1;
+}
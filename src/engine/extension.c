@@ -0,0 +1,122 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+/*
+ * Loading of Smart Manager extensions (.mmext shared objects)
+ */
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <libconfig.h>
+
+#include "extension.h"
+#include "logging.h"
+
+#define MMEXT_STR "%s/%s.mmext"
+
+/**
+ * @brief Try to open an extension from one directory
+ *
+ * @param dir Directory to look in
+ * @param name Name of the extension
+ * @param symbol Symbol the extension must export
+ * @param value Set to the address of @p symbol
+ * @return Handle of the extension, or NULL
+ */
+static void *
+open_from_directory(const char *dir, const char *name, const char *symbol, void **value)
+{
+    char libname[PATH_MAX];
+    void *handle;
+
+    if (snprintf(libname, sizeof(libname), MMEXT_STR, dir, name) >= (int)sizeof(libname))
+    {
+        LOG_ERROR("Path of extension %s in %s is too long\n", name, dir);
+        return NULL;
+    }
+
+    handle = dlopen(libname, RTLD_LAZY | RTLD_GLOBAL);
+    if (!handle)
+    {
+        LOG_VERBOSE("Error: %s\n", dlerror());
+        return NULL;
+    }
+
+    *value = mmsm_extension_symbol(handle, symbol);
+    if (!*value)
+    {
+        LOG_ERROR("Error loading %s from %s\n", symbol, libname);
+        dlclose(handle);
+        return NULL;
+    }
+
+    LOG_DEBUG("Loaded extension %s from %s\n", name, libname);
+    return handle;
+}
+
+void *
+mmsm_extension_open(config_setting_t *module_dirs, const char *name, const char *symbol,
+                    void **value)
+{
+    void *handle = NULL;
+    char *cwd;
+
+    /* Try to find the extension in the module_dirs if provided */
+    if (module_dirs != NULL && config_setting_is_array(module_dirs))
+    {
+        for (int i = 0; i < config_setting_length(module_dirs) && !handle; i++)
+        {
+            const char *dir = config_setting_get_string_elem(module_dirs, i);
+
+            if (dir == NULL)
+            {
+                LOG_ERROR("Invalid directory in module_dirs\n");
+                continue;
+            }
+
+            LOG_VERBOSE("Trying to find %s in directory: %s\n", name, dir);
+            handle = open_from_directory(dir, name, symbol, value);
+        }
+    }
+
+    /* If not found in any provided directory, try the current working directory */
+    if (!handle)
+    {
+        cwd = getcwd(NULL, 0);
+        if (cwd == NULL)
+        {
+            LOG_ERROR("Error: could not determine current working directory\n");
+            return NULL;
+        }
+
+        LOG_VERBOSE("Trying to find %s in current working directory: %s\n", name, cwd);
+        handle = open_from_directory(cwd, name, symbol, value);
+        free(cwd);
+    }
+
+    return handle;
+}
+
+void *
+mmsm_extension_symbol(void *handle, const char *symbol)
+{
+    void *value;
+
+    /* Clear any existing error */
+    dlerror();
+
+    value = dlsym(handle, symbol);
+    return dlerror() ? NULL : value;
+}
+
+void
+mmsm_extension_close(void *handle)
+{
+    if (handle)
+        dlclose(handle);
+}
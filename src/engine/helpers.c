@@ -11,8 +11,14 @@
 #include <stdarg.h>
 
 #include "helpers.h"
+#include "data_index.h"
 #include "utils.h"
 #include "logging.h"
+#include "trace.h"
+#include "pool.h"
+
+/** Data items not allocated from an arena. Never released, so items can be freed at any time. */
+static pool_t data_item_pool = POOL_INITIALIZER("data_item", sizeof(mmsm_data_item_t), 128);
 
 void mmsm_assert_failed(const char *cond, const char *func, int line)
 {
@@ -21,23 +27,17 @@ void mmsm_assert_failed(const char *cond, const char *func, int line)
     {
         LOG_ERROR("errno: [%d] %s\n", errno, strerror(errno));
     }
+    trace_dump();
     exit(1);
 }
 
 uint8_t *
 mmsm_find_value_by_intkey(mmsm_data_item_t *head, uint32_t key)
 {
-    while (head)
-    {
-        if (head->mmsm_key.type == MMSM_KEY_TYPE_U32 &&
-            head->mmsm_key.d.u32 == key)
-        {
-            return head->mmsm_value;
-        }
+    mmsm_key_t k = { .type = MMSM_KEY_TYPE_U32, .d.u32 = key };
+    mmsm_data_item_t *item = data_index_find(head, &k);
 
-        head = head->mmsm_next;
-    }
-    return NULL;
+    return item ? item->mmsm_value : NULL;
 }
 
 
@@ -136,43 +136,17 @@ _mmsm_dump_data_item(mmsm_data_item_t *result, int log_level)
 uint8_t *
 mmsm_find_value_by_key(mmsm_data_item_t *head, const char *key)
 {
-    while (head)
-    {
-        if (head->mmsm_key.type == MMSM_KEY_TYPE_STRING &&
-            strcmp(head->mmsm_key.d.string, key) == 0)
-        {
-            return head->mmsm_value;
-        }
+    mmsm_key_t k = { .type = MMSM_KEY_TYPE_STRING, .d.string = (char *)key };
+    mmsm_data_item_t *item = data_index_find(head, &k);
 
-        head = head->mmsm_next;
-    }
-    return NULL;
+    return item ? item->mmsm_value : NULL;
 }
 
 
 mmsm_data_item_t *
 mmsm_find_key(mmsm_data_item_t *head, const mmsm_key_t *key)
 {
-    while (head)
-    {
-        if (head->mmsm_key.type == key->type)
-        {
-            if (head->mmsm_key.type == MMSM_KEY_TYPE_STRING &&
-                strcmp(head->mmsm_key.d.string, key->d.string) == 0)
-            {
-                return head;
-            }
-
-            if (head->mmsm_key.type == MMSM_KEY_TYPE_U32 &&
-                head->mmsm_key.d.u32 == key->d.u32)
-            {
-                return head;
-            }
-        }
-
-        head = head->mmsm_next;
-    }
-    return NULL;
+    return data_index_find(head, key);
 }
 
 
@@ -204,14 +178,9 @@ mmsm_find_by_nested_intkeys(mmsm_data_item_t *head, ...)
     attr_id = va_arg(args, int);
     while (attr_id != -1)
     {
-        for (; iter; iter = iter->mmsm_next)
-        {
-            if (iter->mmsm_key.type == MMSM_KEY_TYPE_U32 &&
-                iter->mmsm_key.d.u32 == attr_id)
-            {
-                break;
-            }
-        }
+        mmsm_key_t key = { .type = MMSM_KEY_TYPE_U32, .d.u32 = attr_id };
+
+        iter = data_index_find(iter, &key);
         if (iter == NULL)
         {
             va_end(args);
@@ -229,6 +198,74 @@ mmsm_find_by_nested_intkeys(mmsm_data_item_t *head, ...)
 }
 
 
+void
+mmsm_data_item_set_typed_from_string(mmsm_data_item_t *item)
+{
+    const char *str = (const char *)item->mmsm_value;
+    const char *digits;
+    uint8_t mac[6];
+    long long num;
+    char *end;
+    int len = 0;
+
+    item->mmsm_typed.type = MMSM_VALUE_TYPE_NONE;
+    if (!str || !item->mmsm_value_len || str[item->mmsm_value_len - 1] != 0)
+        return;
+
+    digits = str[0] == '-' ? str + 1 : str;
+    if (digits[0] >= '0' && digits[0] <= '9')
+    {
+        errno = 0;
+        num = strtoll(str, &end, 10);
+        if (*end == 0 && errno == 0)
+        {
+            mmsm_data_item_set_typed_i64(item, num);
+            return;
+        }
+    }
+
+    if (sscanf(str, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n",
+               &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5], &len) == 6 &&
+        len == 17 && str[len] == 0)
+    {
+        mmsm_data_item_set_typed_mac(item, mac);
+    }
+}
+
+
+bool
+mmsm_find_i64_by_key(mmsm_data_item_t *head, const char *key, int64_t *val)
+{
+    mmsm_key_t k = { .type = MMSM_KEY_TYPE_STRING, .d.string = (char *)key };
+    mmsm_data_item_t *item = data_index_find(head, &k);
+
+    if (!item || !item->mmsm_value)
+        return false;
+
+    /* Backends that don't fill in typed values are parsed as they always were */
+    if (!mmsm_data_item_get_typed_i64(item, val))
+        *val = strtoll((const char *)item->mmsm_value, NULL, 10);
+
+    return true;
+}
+
+
+bool
+mmsm_find_u32_by_key(mmsm_data_item_t *head, const char *key, uint32_t *val)
+{
+    mmsm_key_t k = { .type = MMSM_KEY_TYPE_STRING, .d.string = (char *)key };
+    mmsm_data_item_t *item = data_index_find(head, &k);
+
+    if (!item || !item->mmsm_value)
+        return false;
+
+    if (!mmsm_data_item_get_typed_u32(item, val))
+        *val = strtoul((const char *)item->mmsm_value, NULL, 10);
+
+    return true;
+}
+
+
 bool
 mmsm_is_flag_set_in(mmsm_data_item_t *result, const char *key, const char *flag)
 {
@@ -248,28 +285,176 @@ mmsm_is_flag_set_in(mmsm_data_item_t *result, const char *key, const char *flag)
 }
 
 
-void
-mmsm_data_item_free(mmsm_data_item_t *item)
+mmsm_data_item_t *
+mmsm_data_item_alloc(void)
+{
+    return pool_alloc(&data_item_pool);
+}
+
+
+/**
+ * Frees a list regardless of references, as the references are to the whole tree
+ */
+static void
+mmsm_data_item_free_list(mmsm_data_item_t *item)
 {
     mmsm_data_item_t *prev;
 
     while (item)
     {
+        /* The rest of an arena tree goes with the arena */
+        if (item->mmsm_arena)
+        {
+            mmsm_data_arena_item_free(item);
+            return;
+        }
+
         if (item->mmsm_sub_values)
         {
-            mmsm_data_item_free(item->mmsm_sub_values);
+            mmsm_data_item_free_list(item->mmsm_sub_values);
             item->mmsm_sub_values = NULL;
         }
-        if (item->mmsm_value) {
+        if (item->mmsm_value_buf) {
+            mmsm_data_buf_put(item->mmsm_value_buf);
+            item->mmsm_value_buf = NULL;
+        } else if (item->mmsm_value && !mmsm_data_item_value_is_inline(item)) {
             free(item->mmsm_value);
-            item->mmsm_value = NULL;
         }
+        item->mmsm_value = NULL;
         if (item->mmsm_key.type == MMSM_KEY_TYPE_STRING) {
-            free(item->mmsm_key.d.string);
+            if (!item->mmsm_key.interned)
+                free(item->mmsm_key.d.string);
             item->mmsm_key.d.string = NULL;
         }
+        data_index_free(item);
         prev = item;
         item = item->mmsm_next;
-        free(prev);
+        pool_free(&data_item_pool, prev);
+    }
+}
+
+
+void
+mmsm_data_item_free(mmsm_data_item_t *item)
+{
+    if (!item)
+        return;
+
+    /* Only the last reference frees, and an item nobody retained needs no atomic update */
+    if (__atomic_load_n(&item->mmsm_refs, __ATOMIC_ACQUIRE) &&
+        __atomic_fetch_sub(&item->mmsm_refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    mmsm_data_item_free_list(item);
+}
+
+
+mmsm_data_item_t *
+mmsm_data_item_retain(mmsm_data_item_t *item)
+{
+    if (item)
+        __atomic_add_fetch(&item->mmsm_refs, 1, __ATOMIC_RELAXED);
+
+    return item;
+}
+
+
+mmsm_data_item_t *
+mmsm_data_item_copy(const mmsm_data_item_t *item)
+{
+    mmsm_data_item_t *head = NULL;
+    mmsm_data_item_t **tail = &head;
+
+    for (; item; item = item->mmsm_next)
+    {
+        mmsm_data_item_t *copy = mmsm_data_item_alloc();
+
+        if (!copy)
+            goto err;
+        *tail = copy;
+        tail = &copy->mmsm_next;
+
+        copy->mmsm_key = item->mmsm_key;
+        if (item->mmsm_key.type == MMSM_KEY_TYPE_STRING && !item->mmsm_key.interned)
+        {
+            copy->mmsm_key.d.string = NULL;
+            if (item->mmsm_key.d.string)
+            {
+                copy->mmsm_key.d.string = strdup(item->mmsm_key.d.string);
+                if (!copy->mmsm_key.d.string)
+                    goto err;
+            }
+        }
+
+        if (item->mmsm_value_buf)
+        {
+            /* Referenced values are read only, so can be shared */
+            copy->mmsm_value_buf = mmsm_data_buf_get(item->mmsm_value_buf);
+            copy->mmsm_value = item->mmsm_value;
+            copy->mmsm_value_len = item->mmsm_value_len;
+        }
+        else if (item->mmsm_value)
+        {
+            copy->mmsm_value = mmsm_data_item_value_alloc(copy, item->mmsm_value_len ?: 1);
+            if (!copy->mmsm_value)
+                goto err;
+            memcpy(copy->mmsm_value, item->mmsm_value, item->mmsm_value_len);
+            copy->mmsm_value_len = item->mmsm_value_len;
+        }
+
+        copy->mmsm_typed = item->mmsm_typed;
+
+        if (item->mmsm_sub_values)
+        {
+            copy->mmsm_sub_values = mmsm_data_item_copy(item->mmsm_sub_values);
+            if (!copy->mmsm_sub_values)
+                goto err;
+        }
     }
+
+    return head;
+
+err:
+    mmsm_data_item_free(head);
+    return NULL;
+}
+
+
+bool
+mmsm_data_item_equal(const mmsm_data_item_t *a, const mmsm_data_item_t *b)
+{
+    for (; a && b; a = a->mmsm_next, b = b->mmsm_next)
+    {
+        if (a->mmsm_key.type != b->mmsm_key.type)
+            return false;
+
+        if (a->mmsm_key.type == MMSM_KEY_TYPE_STRING)
+        {
+            if (!a->mmsm_key.d.string || !b->mmsm_key.d.string)
+            {
+                if (a->mmsm_key.d.string != b->mmsm_key.d.string)
+                    return false;
+            }
+            else if (!mmsm_key_string_equal(&a->mmsm_key, &b->mmsm_key))
+            {
+                return false;
+            }
+        }
+        else if (a->mmsm_key.d.u32 != b->mmsm_key.d.u32)
+        {
+            return false;
+        }
+
+        if (a->mmsm_value_len != b->mmsm_value_len ||
+            !a->mmsm_value != !b->mmsm_value ||
+            (a->mmsm_value_len && memcmp(a->mmsm_value, b->mmsm_value, a->mmsm_value_len) != 0))
+        {
+            return false;
+        }
+
+        if (!mmsm_data_item_equal(a->mmsm_sub_values, b->mmsm_sub_values))
+            return false;
+    }
+
+    return a == b;
 }
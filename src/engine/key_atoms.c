@@ -0,0 +1,123 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmsm_data.h"
+#include "utils.h"
+
+/** Maximum number of atoms */
+#define KEY_ATOMS_MAX   (1024)
+
+/** Number of slots in the table. Kept at twice the maximum so probes stay short. */
+#define KEY_ATOMS_SLOTS (KEY_ATOMS_MAX * 2)
+
+/**
+ * An interned string
+ */
+typedef struct key_atom
+{
+    /** FNV-1a hash of str */
+    uint32_t hash;
+    /** The string */
+    char str[];
+} key_atom_t;
+
+/*
+ * Atoms are never freed, so the table is lock free: a slot is claimed with a compare-and-swap,
+ * and only ever goes from NULL to an atom.
+ */
+static key_atom_t *key_atoms[KEY_ATOMS_SLOTS];
+static unsigned int key_atoms_count;
+
+static uint32_t key_atoms_hash(const char *str)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *str; str++)
+        hash = (hash ^ (uint8_t)*str) * 16777619u;
+
+    return hash;
+}
+
+/**
+ * Finds the atom for a string, interning it first if insert is set
+ */
+static const char *key_atoms_get(const char *str, bool insert)
+{
+    uint32_t hash = key_atoms_hash(str);
+    key_atom_t *atom = NULL;
+    const char *found = NULL;
+    bool counted = false;
+    size_t slot;
+    size_t i;
+
+    for (i = 0, slot = hash % KEY_ATOMS_SLOTS; i < KEY_ATOMS_SLOTS;
+         i++, slot = (slot + 1) % KEY_ATOMS_SLOTS)
+    {
+        key_atom_t *existing = __atomic_load_n(&key_atoms[slot], __ATOMIC_ACQUIRE);
+
+        if (!existing)
+        {
+            if (!insert)
+                break;
+
+            if (!atom)
+            {
+                size_t len = strlen(str) + 1;
+
+                counted = true;
+                if (__atomic_add_fetch(&key_atoms_count, 1, __ATOMIC_RELAXED) > KEY_ATOMS_MAX)
+                    break;
+
+                atom = malloc(sizeof(*atom) + len);
+                if (!atom)
+                    break;
+                atom->hash = hash;
+                memcpy(atom->str, str, len);
+            }
+
+            if (__atomic_compare_exchange_n(&key_atoms[slot], &existing, atom, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return atom->str;
+
+            /* Lost the slot to another atom, which may be this string */
+        }
+
+        if (existing->hash == hash && strcmp(existing->str, str) == 0)
+        {
+            found = existing->str;
+            break;
+        }
+    }
+
+    /* Nothing was added, so give back what was taken for it */
+    free(atom);
+    if (counted)
+        __atomic_sub_fetch(&key_atoms_count, 1, __ATOMIC_RELAXED);
+
+    return found;
+}
+
+const char *mmsm_key_intern(const char *str)
+{
+    return key_atoms_get(str, true);
+}
+
+const char *mmsm_key_atom_find(const char *str)
+{
+    return key_atoms_get(str, false);
+}
+
+uint32_t mmsm_key_atom_hash(const char *atom)
+{
+    const key_atom_t *key_atom = (const key_atom_t *)(atom - offsetof(key_atom_t, str));
+
+    return key_atom->hash;
+}
@@ -6,13 +6,55 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/time.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "helpers.h"
 #include "logging.h"
+#include "utils.h"
+
+/** Longest log line built up in a thread's buffer. Longer ones are written out on their own. */
+#define LOG_LINE_LEN (1024)
+
+#define LOG_DEFAULT_QUEUE_KB (64)
 
 static uint64_t start_time = 0;
 
+/** The log line being built up by this thread */
+static __thread struct
+{
+    char text[LOG_LINE_LEN];
+    size_t len;
+} log_line;
+
+/*
+ * The writer thread, and the ring of log text queued for it, when "async" is set.
+ *
+ * The locking here doesn't use MMSM_ASSERT, as a failure would log, and so recurse.
+ */
+static struct
+{
+    pthread_mutex_t mutex;
+    /** Signalled when text is queued, or the thread is to stop */
+    pthread_cond_t wake;
+    /** Signalled when the thread has written text out, freeing space in the ring */
+    pthread_cond_t space;
+    char *ring;
+    size_t size;
+    /** Positions text is queued up to, and written out up to, each only ever increasing */
+    size_t head;
+    size_t tail;
+    /** Whether the thread is taking text. Read without the lock, to write directly if not. */
+    bool running;
+    bool stopping;
+    pthread_t thread;
+} log_writer = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .space = PTHREAD_COND_INITIALIZER,
+};
+
 unsigned int global_log_level = LOG_LEVEL;
 unsigned int log_colours_enabled = 0;
 
@@ -40,29 +82,248 @@ void mmsm_set_log_colours(bool colour)
     log_colours_enabled = colour ? 1 : 0;
 }
 
+static void log_write(const char *text, size_t len)
+{
+    fwrite(text, 1, len, stdout);
+    fflush(stdout);
+}
+
+static void *log_writer_fn(void *arg)
+{
+    pthread_mutex_lock(&log_writer.mutex);
+    while (true)
+    {
+        size_t head = log_writer.head;
+        size_t tail = log_writer.tail;
+        size_t start = tail % log_writer.size;
+        size_t first = MIN(head - tail, log_writer.size - start);
+
+        if (head == tail)
+        {
+            if (log_writer.stopping)
+                break;
+
+            pthread_cond_wait(&log_writer.wake, &log_writer.mutex);
+            continue;
+        }
+
+        /* Writers only add text after head, so what is queued can be written without the lock */
+        pthread_mutex_unlock(&log_writer.mutex);
+        fwrite(log_writer.ring + start, 1, first, stdout);
+        fwrite(log_writer.ring, 1, head - tail - first, stdout);
+        fflush(stdout);
+        pthread_mutex_lock(&log_writer.mutex);
+
+        log_writer.tail = head;
+        pthread_cond_broadcast(&log_writer.space);
+    }
+
+    /* Anything logged from now on is written directly */
+    __atomic_store_n(&log_writer.running, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&log_writer.space);
+    pthread_mutex_unlock(&log_writer.mutex);
+    return NULL;
+}
+
+/** Write out what is queued and stop the writer thread, when exiting */
+static void log_writer_stop(void)
+{
+    pthread_mutex_lock(&log_writer.mutex);
+    log_writer.stopping = true;
+    pthread_cond_signal(&log_writer.wake);
+    pthread_mutex_unlock(&log_writer.mutex);
+
+    pthread_join(log_writer.thread, NULL);
+}
+
+static void log_writer_start(size_t size)
+{
+    if (__atomic_load_n(&log_writer.running, __ATOMIC_ACQUIRE))
+        return;
+
+    log_writer.ring = malloc(size);
+    if (!log_writer.ring)
+        return;
+    log_writer.size = size;
+
+    __atomic_store_n(&log_writer.running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&log_writer.thread, NULL, log_writer_fn, NULL) != 0)
+    {
+        __atomic_store_n(&log_writer.running, false, __ATOMIC_RELEASE);
+        free(log_writer.ring);
+        log_writer.ring = NULL;
+        return;
+    }
+    atexit(log_writer_stop);
+}
+
+/**
+ * @brief Write out log text, queuing it for the writer thread if running
+ *
+ * Waits for space in the queue if it is full, so no logging is lost.
+ */
+static void log_emit(const char *text, size_t len)
+{
+    if (!__atomic_load_n(&log_writer.running, __ATOMIC_ACQUIRE))
+    {
+        log_write(text, len);
+        return;
+    }
+
+    pthread_mutex_lock(&log_writer.mutex);
+    while (len)
+    {
+        size_t start;
+        size_t n;
+
+        /* Whole, so other threads' lines don't end up in the middle, unless longer than the ring */
+        while (log_writer.running &&
+               log_writer.size - (log_writer.head - log_writer.tail) < MIN(len, log_writer.size))
+            pthread_cond_wait(&log_writer.space, &log_writer.mutex);
+
+        if (!log_writer.running)
+        {
+            pthread_mutex_unlock(&log_writer.mutex);
+            log_write(text, len);
+            return;
+        }
+
+        start = log_writer.head % log_writer.size;
+        n = MIN(len, log_writer.size - (log_writer.head - log_writer.tail));
+        if (n <= log_writer.size - start)
+        {
+            memcpy(log_writer.ring + start, text, n);
+        }
+        else
+        {
+            memcpy(log_writer.ring + start, text, log_writer.size - start);
+            memcpy(log_writer.ring, text + log_writer.size - start, n - (log_writer.size - start));
+        }
+
+        log_writer.head += n;
+        text += n;
+        len -= n;
+        pthread_cond_signal(&log_writer.wake);
+    }
+    pthread_mutex_unlock(&log_writer.mutex);
+}
+
+/** Write out this thread's log line */
+static void log_flush_line(void)
+{
+    if (log_line.len)
+        log_emit(log_line.text, log_line.len);
+    log_line.len = 0;
+}
+
+static void log_vappend(const char *fmt, va_list args)
+{
+    size_t room = sizeof(log_line.text) - log_line.len;
+    va_list copy;
+    char *text;
+    int len;
+
+    va_copy(copy, args);
+    len = vsnprintf(log_line.text + log_line.len, room, fmt, copy);
+    va_end(copy);
+
+    if (len < 0)
+        return;
+
+    if ((size_t)len < room)
+    {
+        log_line.len += len;
+        return;
+    }
+
+    /* Doesn't fit after the line so far, so write that out first */
+    log_flush_line();
+    if ((size_t)len < sizeof(log_line.text))
+    {
+        log_line.len = vsnprintf(log_line.text, sizeof(log_line.text), fmt, args);
+        return;
+    }
+
+    text = malloc(len + 1);
+    if (text)
+    {
+        vsnprintf(text, len + 1, fmt, args);
+        log_emit(text, len);
+        free(text);
+    }
+}
+
+static void log_append(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    log_vappend(fmt, args);
+    va_end(args);
+}
+
+void mmsm_log_prefix(unsigned int level, const char *file)
+{
+    timestamp_t ts;
+
+    timestamp_get_coarse(&ts);
+    log_append("%s  %4u-%02u-%02u %02u:%02u:%02u %s %s",
+        log_colours_start[log_colours_enabled][level],
+        ts.year, ts.month, ts.day, ts.hour, ts.minute, ts.second, file,
+        log_colours_end[log_colours_enabled]);
+}
+
+void mmsm_log_line(unsigned int level, const char *file, const char *fmt, ...)
+{
+    va_list args;
+
+    mmsm_log_prefix(level, file);
+
+    va_start(args, fmt);
+    log_vappend(fmt, args);
+    va_end(args);
+
+    log_flush_line();
+}
+
+void mmsm_log_printf(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    log_vappend(fmt, args);
+    va_end(args);
+
+    if (log_line.len && log_line.text[log_line.len - 1] == '\n')
+        log_flush_line();
+}
+
 void mmsm_set_log_config(config_setting_t *cfg)
 {
     mmsm_set_log_level(cfg_parse_int_with_default(cfg, "level", LOG_LEVEL));
 
     mmsm_set_log_colours(
             cfg_parse_bool_with_default(cfg, "colours", log_colours_enabled));
+
+    if (cfg_parse_bool_with_default(cfg, "async", false))
+    {
+        int queue_kb = cfg_parse_int_with_default(cfg, "queue_kb", LOG_DEFAULT_QUEUE_KB);
+
+        log_writer_start((size_t)MAX(queue_kb, 1) * 1024);
+    }
 }
 
 void
 mmsm_init_time(void)
 {
-    struct timeval te;
-    gettimeofday(&te, NULL);
-    start_time = te.tv_sec * 1000LL + te.tv_usec / 1000;
+    start_time = timestamp_monotonic_ms();
 }
 
 
 uint32_t
 mmsm_get_run_time_ms(void)
 {
-    struct timeval te;
-    gettimeofday(&te, NULL);
-    uint64_t current_time = te.tv_sec * 1000LL + te.tv_usec / 1000;
+    uint64_t current_time = timestamp_monotonic_ms();
     uint32_t run_time = 0;
 
     if (start_time > 0 && current_time > start_time)
@@ -76,20 +337,39 @@ mmsm_get_run_time_ms(void)
 void
 mmsm_dump_data(uint8_t *data, uint32_t size)
 {
+    static const char hex_digits[] = "0123456789abcdef";
+
     if (global_log_level < LOG_LEVEL_VERBOSE)
         return;
 
     for (int i = 0; i < size; i++)
     {
+        char *p;
+
         if (i % 16 == 0)
-            LOG_VERBOSE("\t");
+        {
+            mmsm_log_prefix(LOG_LEVEL_VERBOSE, LOG_FILENAME);
+            log_append("\t");
+        }
+
+        /* Room for the byte, the gap after the 8th and the newline after the 16th */
+        if (sizeof(log_line.text) - log_line.len < 5)
+            log_flush_line();
 
-        printf("%02x ", data[i]);
+        p = log_line.text + log_line.len;
+        *p++ = hex_digits[data[i] >> 4];
+        *p++ = hex_digits[data[i] & 0xf];
+        *p++ = ' ';
 
         if (i % 16 == 7)
-            printf(" ");
+            *p++ = ' ';
         else if (i % 16 == 15)
-            printf("\n");
+            *p++ = '\n';
+
+        log_line.len = p - log_line.text;
+        if (i % 16 == 15)
+            log_flush_line();
     }
-    printf("\n");
+    log_append("\n");
+    log_flush_line();
 }
@@ -0,0 +1,791 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "stats.h"
+#include "pool.h"
+#include "logging.h"
+#include "utils.h"
+
+/** How long a client gets to send its request, and to take the reply, in ms */
+#define METRICS_CLIENT_TIMEOUT_MS (1000)
+
+/** Longest HTTP request read, enough for the request line and a few headers */
+#define METRICS_REQUEST_MAX (4096)
+
+/** Most object pools written out */
+#define METRICS_MAX_POOLS (32)
+
+/** A module's metrics, see @ref metrics_register */
+typedef struct metrics_provider
+{
+    metrics_fn_t fn;
+    void *context;
+    struct metrics_provider *next;
+} metrics_provider_t;
+
+/** Protects @ref metrics_providers, and is held while they are written */
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static metrics_provider_t *metrics_providers;
+
+/** The engine's counters of one backend interface and of the monitors on it */
+typedef struct metrics_backend
+{
+    mmsm_backend_intf_t *intf;
+    /** Label identifying the backend, already escaped */
+    char label[160];
+    /** The backend's own entry, or NULL if it hasn't made any requests */
+    const mmsm_stats_entry_t *entry;
+    unsigned int polling_monitors;
+    unsigned int pattern_monitors;
+    uint64_t deadline_misses;
+    mmsm_histogram_t lag_us;
+    mmsm_histogram_t polling_callback_us;
+    mmsm_histogram_t pattern_callback_us;
+    /** The backend's own counters, if it keeps any */
+    bool has_counters;
+    mmsm_backend_counters_t counters;
+    /** Statistics of the notification queue, if notifications are queued */
+    bool has_queue;
+    mmsm_monitor_queue_stats_t queue;
+} metrics_backend_t;
+
+static struct
+{
+    pthread_t thread;
+    bool started;
+    /** eventfd used to wake the thread when stopping */
+    int wake_fd;
+    int unix_fd;
+    int tcp_fd;
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} metrics_server = {
+    .wake_fd = -1,
+    .unix_fd = -1,
+    .tcp_fd = -1,
+};
+
+int metrics_register(metrics_fn_t fn, void *context)
+{
+    metrics_provider_t *provider = calloc(1, sizeof(*provider));
+
+    if (!provider)
+        return -ENOMEM;
+
+    provider->fn = fn;
+    provider->context = context;
+
+    MMSM_ASSERT(pthread_mutex_lock(&metrics_mutex) == 0);
+    provider->next = metrics_providers;
+    metrics_providers = provider;
+    MMSM_ASSERT(pthread_mutex_unlock(&metrics_mutex) == 0);
+
+    return 0;
+}
+
+void metrics_unregister(metrics_fn_t fn, void *context)
+{
+    metrics_provider_t **link;
+
+    MMSM_ASSERT(pthread_mutex_lock(&metrics_mutex) == 0);
+    for (link = &metrics_providers; *link; link = &(*link)->next)
+    {
+        metrics_provider_t *provider = *link;
+
+        if (provider->fn == fn && provider->context == context)
+        {
+            *link = provider->next;
+            free(provider);
+            break;
+        }
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&metrics_mutex) == 0);
+}
+
+void metrics_write_family(FILE *out, const char *name, const char *type, const char *help)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_write_histogram(FILE *out, const char *name, const char *labels,
+                             const mmsm_histogram_t *histogram)
+{
+    const char *sep = labels[0] ? "," : "";
+    uint64_t cumulative = 0;
+    int i;
+
+    /* Bucket i counts durations under 2^i us, and the last one anything longer */
+    for (i = 0; i < MMSM_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        cumulative += histogram->buckets[i];
+        fprintf(out, "%s_bucket{%s%sle=\"%.9g\"} %" PRIu64 "\n", name, labels, sep,
+                (double)(1ull << i) / 1e6, cumulative);
+    }
+    cumulative += histogram->buckets[i];
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, sep, cumulative);
+    fprintf(out, "%s_sum{%s} %.6f\n", name, labels, (double)histogram->sum_us / 1e6);
+    fprintf(out, "%s_count{%s} %" PRIu64 "\n", name, labels, histogram->count);
+}
+
+static void metrics_histogram_add(mmsm_histogram_t *total, const mmsm_histogram_t *histogram)
+{
+    int i;
+
+    total->count += histogram->count;
+    total->sum_us += histogram->sum_us;
+    total->max_us = MAX(total->max_us, histogram->max_us);
+    for (i = 0; i < MMSM_HISTOGRAM_BUCKETS; i++)
+        total->buckets[i] += histogram->buckets[i];
+}
+
+/**
+ * @brief Set the label of a backend, by its name in the registry or else its position among
+ *        those the engine keeps counters for
+ */
+static void metrics_backend_label(metrics_backend_t *backend)
+{
+    char name[128];
+    size_t n = 0;
+    const char *c;
+
+    if (!mmsm_backend_get_name(backend->intf, name, sizeof(name)))
+        snprintf(name, sizeof(name), "%u", engine_backend_index(backend->intf));
+
+    n = snprintf(backend->label, sizeof(backend->label), "backend=\"");
+    for (c = name; *c && n < sizeof(backend->label) - 3; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            backend->label[n++] = '\\';
+        backend->label[n++] = *c;
+    }
+    backend->label[n++] = '"';
+    backend->label[n] = '\0';
+}
+
+static metrics_backend_t *metrics_backend_find(metrics_backend_t *backends, size_t *num_backends,
+                                               mmsm_backend_intf_t *intf)
+{
+    size_t i;
+
+    for (i = 0; i < *num_backends; i++)
+    {
+        if (backends[i].intf == intf)
+            return &backends[i];
+    }
+
+    backends[i].intf = intf;
+    metrics_backend_label(&backends[i]);
+    (*num_backends)++;
+    return &backends[i];
+}
+
+/**
+ * @brief Write the engine's counters, with the monitors' summed up per backend
+ */
+static void metrics_write_engine(FILE *out)
+{
+    mmsm_stats_t *stats = mmsm_get_stats();
+    metrics_backend_t *backends;
+    size_t num_backends = 0;
+    size_t i;
+
+    if (!stats)
+        return;
+
+    backends = calloc(MAX(stats->num_entries, 1), sizeof(*backends));
+    if (!backends)
+    {
+        mmsm_stats_free(stats);
+        return;
+    }
+
+    for (i = 0; i < stats->num_entries; i++)
+    {
+        const mmsm_stats_entry_t *entry = &stats->entries[i];
+        metrics_backend_t *backend = metrics_backend_find(backends, &num_backends, entry->intf);
+
+        switch (entry->type)
+        {
+        case MMSM_STATS_BACKEND:
+            backend->entry = entry;
+            break;
+        case MMSM_STATS_POLLING_MONITOR:
+            backend->polling_monitors++;
+            backend->deadline_misses += entry->counters.deadline_misses;
+            metrics_histogram_add(&backend->lag_us, &entry->counters.lag_us);
+            metrics_histogram_add(&backend->polling_callback_us, &entry->counters.callback_us);
+            break;
+        case MMSM_STATS_PATTERN_MONITOR:
+            backend->pattern_monitors++;
+            metrics_histogram_add(&backend->pattern_callback_us, &entry->counters.callback_us);
+            break;
+        }
+    }
+
+    for (i = 0; i < num_backends; i++)
+    {
+        metrics_backend_t *backend = &backends[i];
+
+        if (backend->intf->get_counters)
+        {
+            backend->intf->get_counters(backend->intf, &backend->counters);
+            backend->has_counters = true;
+        }
+        /* Only interfaces whose notifications are queued have queue statistics */
+        backend->has_queue = backend->pattern_monitors &&
+            mmsm_monitor_get_queue_stats(backend->intf, &backend->queue) == MMSM_SUCCESS;
+    }
+
+    metrics_write_family(out, "smart_manager_backend_requests_total", "counter",
+                         "Requests made to the backend");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].entry)
+            fprintf(out, "smart_manager_backend_requests_total{%s} %" PRIu64 "\n",
+                    backends[i].label, backends[i].entry->counters.request_us.count);
+    }
+
+    metrics_write_family(out, "smart_manager_backend_request_errors_total", "counter",
+                         "Requests to the backend that failed");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].entry)
+            fprintf(out, "smart_manager_backend_request_errors_total{%s} %" PRIu64 "\n",
+                    backends[i].label, backends[i].entry->counters.errors);
+    }
+
+    metrics_write_family(out, "smart_manager_backend_request_duration_seconds", "histogram",
+                         "Time spent in the backend per request");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].entry)
+            metrics_write_histogram(out, "smart_manager_backend_request_duration_seconds",
+                                    backends[i].label, &backends[i].entry->counters.request_us);
+    }
+
+    metrics_write_family(out, "smart_manager_backend_reconnects_total", "counter",
+                         "Connections to the backend closed after failing, to be reopened");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].has_counters)
+            fprintf(out, "smart_manager_backend_reconnects_total{%s} %" PRIu64 "\n",
+                    backends[i].label, backends[i].counters.reconnects);
+    }
+
+    metrics_write_family(out, "smart_manager_backend_transport_errors_total", "counter",
+                         "Messages that failed to be sent to or received from the backend");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].has_counters)
+            fprintf(out, "smart_manager_backend_transport_errors_total{%s} %" PRIu64 "\n",
+                    backends[i].label, backends[i].counters.errors);
+    }
+
+    metrics_write_family(out, "smart_manager_backend_events_lost_total", "counter",
+                         "Times notifications from the backend were lost");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].has_counters)
+            fprintf(out, "smart_manager_backend_events_lost_total{%s} %" PRIu64 "\n",
+                    backends[i].label, backends[i].counters.events_lost);
+    }
+
+    metrics_write_family(out, "smart_manager_monitors", "gauge", "Monitors registered");
+    for (i = 0; i < num_backends; i++)
+    {
+        fprintf(out, "smart_manager_monitors{%s,type=\"polling\"} %u\n",
+                backends[i].label, backends[i].polling_monitors);
+        fprintf(out, "smart_manager_monitors{%s,type=\"pattern\"} %u\n",
+                backends[i].label, backends[i].pattern_monitors);
+    }
+
+    metrics_write_family(out, "smart_manager_polling_lag_seconds", "histogram",
+                         "How late polling monitors fired compared with when they were due");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].polling_monitors)
+            metrics_write_histogram(out, "smart_manager_polling_lag_seconds",
+                                    backends[i].label, &backends[i].lag_us);
+    }
+
+    metrics_write_family(out, "smart_manager_polling_deadline_misses_total", "counter",
+                         "Times polling monitors fired a whole period late, or were skipped");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].polling_monitors)
+            fprintf(out, "smart_manager_polling_deadline_misses_total{%s} %" PRIu64 "\n",
+                    backends[i].label, backends[i].deadline_misses);
+    }
+
+    metrics_write_family(out, "smart_manager_monitor_callback_duration_seconds", "histogram",
+                         "Time taken by monitor callbacks");
+    for (i = 0; i < num_backends; i++)
+    {
+        char labels[sizeof(backends[i].label) + 32];
+
+        if (backends[i].polling_monitors)
+        {
+            snprintf(labels, sizeof(labels), "%s,type=\"polling\"", backends[i].label);
+            metrics_write_histogram(out, "smart_manager_monitor_callback_duration_seconds",
+                                    labels, &backends[i].polling_callback_us);
+        }
+        if (backends[i].pattern_monitors)
+        {
+            snprintf(labels, sizeof(labels), "%s,type=\"pattern\"", backends[i].label);
+            metrics_write_histogram(out, "smart_manager_monitor_callback_duration_seconds",
+                                    labels, &backends[i].pattern_callback_us);
+        }
+    }
+
+    metrics_write_family(out, "smart_manager_event_queue_depth", "gauge",
+                         "Notifications waiting to be dispatched to pattern monitors");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].has_queue)
+            fprintf(out, "smart_manager_event_queue_depth{%s} %u\n",
+                    backends[i].label, backends[i].queue.depth);
+    }
+
+    metrics_write_family(out, "smart_manager_event_queue_max_depth", "gauge",
+                         "Most notifications that have been waiting at once");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].has_queue)
+            fprintf(out, "smart_manager_event_queue_max_depth{%s} %u\n",
+                    backends[i].label, backends[i].queue.max_depth);
+    }
+
+    metrics_write_family(out, "smart_manager_event_queue_capacity", "gauge",
+                         "Notifications the queue can hold");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].has_queue)
+            fprintf(out, "smart_manager_event_queue_capacity{%s} %u\n",
+                    backends[i].label, backends[i].queue.capacity);
+    }
+
+    metrics_write_family(out, "smart_manager_event_queue_dropped_total", "counter",
+                         "Notifications dropped because the queue was full");
+    for (i = 0; i < num_backends; i++)
+    {
+        if (backends[i].has_queue)
+            fprintf(out, "smart_manager_event_queue_dropped_total{%s} %" PRIu64 "\n",
+                    backends[i].label, backends[i].queue.dropped);
+    }
+
+    free(backends);
+    mmsm_stats_free(stats);
+}
+
+/**
+ * @brief Write the object pools' stats, summing those of pools with the same name, such as one
+ *        per DCS interface
+ */
+static void metrics_write_pools(FILE *out)
+{
+    pool_stats_t stats[METRICS_MAX_POOLS];
+    size_t num = pool_read_stats(stats, ARRAY_SIZE(stats));
+    size_t merged = 0;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < num; i++)
+    {
+        for (j = 0; j < merged; j++)
+        {
+            if (strcmp(stats[j].name, stats[i].name) == 0)
+                break;
+        }
+
+        if (j == merged)
+        {
+            stats[merged++] = stats[i];
+            continue;
+        }
+
+        stats[j].capacity += stats[i].capacity;
+        stats[j].in_use += stats[i].in_use;
+        stats[j].high_water += stats[i].high_water;
+    }
+
+    metrics_write_family(out, "smart_manager_pool_objects_in_use", "gauge",
+                         "Objects allocated from the pool");
+    for (i = 0; i < merged; i++)
+        fprintf(out, "smart_manager_pool_objects_in_use{pool=\"%s\"} %zu\n",
+                stats[i].name, stats[i].in_use);
+
+    metrics_write_family(out, "smart_manager_pool_objects_high_water", "gauge",
+                         "Most objects that have been allocated from the pool at once");
+    for (i = 0; i < merged; i++)
+        fprintf(out, "smart_manager_pool_objects_high_water{pool=\"%s\"} %zu\n",
+                stats[i].name, stats[i].high_water);
+
+    metrics_write_family(out, "smart_manager_pool_objects_capacity", "gauge",
+                         "Objects the pool holds memory for");
+    for (i = 0; i < merged; i++)
+        fprintf(out, "smart_manager_pool_objects_capacity{pool=\"%s\"} %zu\n",
+                stats[i].name, stats[i].capacity);
+}
+
+void metrics_write(FILE *out)
+{
+    metrics_provider_t *provider;
+
+    metrics_write_engine(out);
+    metrics_write_pools(out);
+
+    MMSM_ASSERT(pthread_mutex_lock(&metrics_mutex) == 0);
+    for (provider = metrics_providers; provider; provider = provider->next)
+        provider->fn(provider->context, out);
+    MMSM_ASSERT(pthread_mutex_unlock(&metrics_mutex) == 0);
+}
+
+/**
+ * @brief Render the metrics into a buffer
+ *
+ * @param len Set to the length of the metrics
+ * @return the metrics, to be freed, or NULL on failure
+ */
+static char *metrics_render(size_t *len)
+{
+    char *buf = NULL;
+    FILE *out = open_memstream(&buf, len);
+
+    if (!out)
+        return NULL;
+
+    metrics_write(out);
+    if (fclose(out) != 0)
+    {
+        free(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Send all of a buffer to a non-blocking client, giving up if it stops taking it
+ *
+ * @return 0 on success, else -1
+ */
+static int metrics_send(int fd, const char *buf, size_t len)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+    while (len)
+    {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            if (poll(&pfd, 1, METRICS_CLIENT_TIMEOUT_MS) <= 0)
+                return -1;
+            continue;
+        }
+
+        buf += sent;
+        len -= sent;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read an HTTP request's head, up to the blank line that ends it
+ *
+ * @return the length of the request read, or -1 if it didn't arrive in time
+ */
+static ssize_t metrics_recv_request(int fd, char *buf, size_t size)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    size_t len = 0;
+
+    while (len < size - 1)
+    {
+        ssize_t n;
+        int ret = poll(&pfd, 1, METRICS_CLIENT_TIMEOUT_MS);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+
+        n = recv(fd, buf + len, size - 1 - len, 0);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0)
+            return -1;
+
+        len += n;
+        buf[len] = '\0';
+        if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n"))
+            break;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Answer an HTTP client, with the metrics for GET /metrics
+ */
+static void metrics_serve_http(int fd)
+{
+    char request[METRICS_REQUEST_MAX];
+    char header[256];
+    const char *status = "200 OK";
+    char *body = NULL;
+    size_t body_len = 0;
+    int header_len;
+
+    if (metrics_recv_request(fd, request, sizeof(request)) < 0)
+        return;
+
+    if (strncmp(request, "GET ", 4) != 0)
+        status = "405 Method Not Allowed";
+    else if (strncmp(request + 4, "/metrics", 8) != 0 ||
+             (request[12] != ' ' && request[12] != '?'))
+        status = "404 Not Found";
+    else if (!(body = metrics_render(&body_len)))
+        status = "500 Internal Server Error";
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.0 %s\r\n"
+                          "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n"
+                          "\r\n", status, body_len);
+
+    if (metrics_send(fd, header, header_len) == 0 && body)
+        metrics_send(fd, body, body_len);
+
+    free(body);
+}
+
+/**
+ * @brief Write the metrics to a UNIX socket client, which needn't send anything
+ */
+static void metrics_serve_unix(int fd)
+{
+    size_t len;
+    char *buf = metrics_render(&len);
+
+    if (buf)
+        metrics_send(fd, buf, len);
+
+    free(buf);
+}
+
+/**
+ * @brief Serve clients one at a time until stopped
+ */
+static void *metrics_thread_fn(void *arg)
+{
+    struct pollfd pfds[3] = {
+        { .fd = metrics_server.wake_fd, .events = POLLIN },
+        { .fd = metrics_server.unix_fd, .events = POLLIN },
+        { .fd = metrics_server.tcp_fd, .events = POLLIN },
+    };
+
+    UNUSED(arg);
+
+    while (true)
+    {
+        int i;
+
+        if (poll(pfds, ARRAY_SIZE(pfds), -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                LOG_ERROR("Metrics poll failed: %d\n", errno);
+                break;
+            }
+            continue;
+        }
+
+        if (pfds[0].revents)
+            break;
+
+        for (i = 1; i < (int)ARRAY_SIZE(pfds); i++)
+        {
+            int fd;
+
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+
+            fd = accept(pfds[i].fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+
+            /* So a client that stops reading can't hold up the thread */
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+
+            if (pfds[i].fd == metrics_server.unix_fd)
+                metrics_serve_unix(fd);
+            else
+                metrics_serve_http(fd);
+            close(fd);
+        }
+    }
+
+    return NULL;
+}
+
+static int metrics_listen_unix(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    strcpy(addr.sun_path, path);
+    /* Left behind by an earlier run that didn't stop cleanly */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        int err = -errno;
+
+        close(fd);
+        return err;
+    }
+
+    return fd;
+}
+
+static int metrics_listen_tcp(const char *address, unsigned int port)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    int one = 1;
+    int fd;
+
+    if (port > UINT16_MAX || inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+        return -EINVAL;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        int err = -errno;
+
+        close(fd);
+        return err;
+    }
+
+    return fd;
+}
+
+static void metrics_server_close(void)
+{
+    if (metrics_server.unix_fd >= 0)
+    {
+        close(metrics_server.unix_fd);
+        unlink(metrics_server.socket_path);
+    }
+    if (metrics_server.tcp_fd >= 0)
+        close(metrics_server.tcp_fd);
+    if (metrics_server.wake_fd >= 0)
+        close(metrics_server.wake_fd);
+
+    metrics_server.unix_fd = -1;
+    metrics_server.tcp_fd = -1;
+    metrics_server.wake_fd = -1;
+}
+
+int metrics_server_start(const char *socket_path, const char *address, unsigned int port)
+{
+    int ret;
+
+    if (metrics_server.started)
+        return -EALREADY;
+
+    if (socket_path)
+    {
+        ret = metrics_listen_unix(socket_path);
+        if (ret < 0)
+        {
+            LOG_ERROR("Failed to listen for metrics on %s: %d\n", socket_path, ret);
+            goto fail;
+        }
+        metrics_server.unix_fd = ret;
+        snprintf(metrics_server.socket_path, sizeof(metrics_server.socket_path), "%s",
+                 socket_path);
+        LOG_INFO("Serving metrics on %s\n", socket_path);
+    }
+
+    if (port)
+    {
+        ret = metrics_listen_tcp(address, port);
+        if (ret < 0)
+        {
+            LOG_ERROR("Failed to listen for metrics on %s:%u: %d\n", address, port, ret);
+            goto fail;
+        }
+        metrics_server.tcp_fd = ret;
+        LOG_INFO("Serving metrics on http://%s:%u/metrics\n", address, port);
+    }
+
+    metrics_server.wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (metrics_server.wake_fd < 0)
+    {
+        ret = -errno;
+        goto fail;
+    }
+
+    ret = -pthread_create(&metrics_server.thread, NULL, metrics_thread_fn, NULL);
+    if (ret)
+        goto fail;
+
+    metrics_server.started = true;
+    return 0;
+
+fail:
+    metrics_server_close();
+    return ret;
+}
+
+void metrics_server_stop(void)
+{
+    uint64_t one = 1;
+
+    if (!metrics_server.started)
+        return;
+
+    if (write(metrics_server.wake_fd, &one, sizeof(one)) < 0)
+        LOG_ERROR("Failed to wake the metrics thread: %d\n", errno);
+    MMSM_ASSERT(pthread_join(metrics_server.thread, NULL) == 0);
+    metrics_server.started = false;
+
+    metrics_server_close();
+}
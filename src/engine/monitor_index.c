@@ -0,0 +1,397 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+
+#include "monitor_index.h"
+#include "helpers.h"
+#include "utils.h"
+
+/** Number of buckets to make room for up front. Interfaces rarely have more than a handful of
+ *  monitors. */
+#define MONITOR_INDEX_NUM_BUCKETS (16)
+
+/**
+ * Identifies a bucket. Always zero-initialised as it is compared with memcmp.
+ */
+typedef struct monitor_index_key
+{
+    /** Type of the command key */
+    uint32_t key_type;
+    /** The command key if it is a u32, else a hash of the string */
+    uint32_t key;
+    /** Non-zero if the remaining fields are set */
+    uint32_t filtered;
+    /** Type of the first filter key */
+    uint32_t filter_key_type;
+    /** The first filter key if it is a u32, else a hash of the string */
+    uint32_t filter_key;
+    /** Hash of the first filter value */
+    uint32_t filter_value;
+} monitor_index_key_t;
+
+/**
+ * A group of monitors with the same index key.
+ *
+ * Unfiltered buckets also track which first-filter keys have filtered buckets under the same
+ * command key, so matching knows which sub-values to look up.
+ */
+typedef struct monitor_index_bucket
+{
+    /** The bucket key */
+    monitor_index_key_t key;
+    /** The monitors in this bucket */
+    list_head_t nodes;
+    /** Copy of the first filter key. Only used in filtered buckets. */
+    mmsm_key_t filter_key;
+    /** First-filter keys that have filtered buckets. Only used in unfiltered buckets. */
+    mmsm_key_t filter_keys[MONITOR_INDEX_MAX_FILTER_KEYS];
+    /** Number of filtered buckets using each entry of @ref filter_keys */
+    uint32_t filter_key_refs[MONITOR_INDEX_MAX_FILTER_KEYS];
+    /** Number of entries in use in @ref filter_keys */
+    size_t num_filter_keys;
+    /** The unfiltered bucket with the same command key. Only used in filtered buckets. */
+    struct monitor_index_bucket *parent;
+} monitor_index_bucket_t;
+
+static const void *monitor_index_bucket_get_key(const void *entry)
+{
+    const monitor_index_bucket_t *bucket = entry;
+
+    return &bucket->key;
+}
+
+static uint32_t monitor_index_hash_key(const mmsm_key_t *key)
+{
+    if (key->type == MMSM_KEY_TYPE_STRING)
+        return hashmap_calc_hash(key->d.string, strlen(key->d.string));
+
+    return key->d.u32;
+}
+
+static bool monitor_index_key_equal(const mmsm_key_t *lhs, const mmsm_key_t *rhs)
+{
+    if (lhs->type != rhs->type)
+        return false;
+
+    if (lhs->type == MMSM_KEY_TYPE_STRING)
+        return mmsm_key_string_equal(lhs, rhs);
+
+    return lhs->d.u32 == rhs->d.u32;
+}
+
+static int monitor_index_key_copy(mmsm_key_t *dst, const mmsm_key_t *src)
+{
+    *dst = *src;
+    if (src->type == MMSM_KEY_TYPE_STRING && !src->interned)
+    {
+        dst->d.string = strdup(src->d.string);
+        if (!dst->d.string)
+            return -ENOMEM;
+    }
+    return 0;
+}
+
+static void monitor_index_key_free(mmsm_key_t *key)
+{
+    if (key->type == MMSM_KEY_TYPE_STRING && !key->interned)
+        free(key->d.string);
+    memset(key, 0, sizeof(*key));
+}
+
+static void monitor_index_make_key(monitor_index_key_t *index_key, const mmsm_key_t *key,
+                                   const mmsm_key_t *filter_key, const uint8_t *filter_value,
+                                   uint32_t filter_value_len)
+{
+    memset(index_key, 0, sizeof(*index_key));
+    index_key->key_type = key->type;
+    index_key->key = monitor_index_hash_key(key);
+
+    if (filter_key)
+    {
+        index_key->filtered = 1;
+        index_key->filter_key_type = filter_key->type;
+        index_key->filter_key = monitor_index_hash_key(filter_key);
+        index_key->filter_value = hashmap_calc_hash(filter_value, filter_value_len);
+    }
+}
+
+static monitor_index_bucket_t *monitor_index_find(monitor_index_t *index,
+                                                  const monitor_index_key_t *key)
+{
+    return hashmap_find(&index->buckets, key);
+}
+
+static monitor_index_bucket_t *monitor_index_get(monitor_index_t *index,
+                                                 const monitor_index_key_t *key)
+{
+    monitor_index_bucket_t *bucket = monitor_index_find(index, key);
+
+    if (bucket)
+        return bucket;
+
+    bucket = calloc(1, sizeof(*bucket));
+    if (!bucket)
+        return NULL;
+
+    bucket->key = *key;
+    list_reset(&bucket->nodes);
+    if (hashmap_insert(&index->buckets, bucket) != 0)
+    {
+        free(bucket);
+        return NULL;
+    }
+
+    return bucket;
+}
+
+static void monitor_index_free_bucket(void *entry)
+{
+    monitor_index_bucket_t *bucket = entry;
+    size_t i;
+
+    monitor_index_key_free(&bucket->filter_key);
+    for (i = 0; i < bucket->num_filter_keys; i++)
+        monitor_index_key_free(&bucket->filter_keys[i]);
+
+    free(bucket);
+}
+
+/**
+ * Frees a bucket once nothing refers to it any more.
+ */
+static void monitor_index_put(monitor_index_t *index, monitor_index_bucket_t *bucket)
+{
+    if (!list_is_empty(&bucket->nodes) || bucket->num_filter_keys)
+        return;
+
+    hashmap_remove(&index->buckets, bucket);
+    monitor_index_free_bucket(bucket);
+}
+
+/**
+ * Checks every condition of a monitor against a received item.
+ */
+static bool monitor_index_node_matches(const monitor_index_node_t *node,
+                                       const mmsm_data_item_t *item)
+{
+    const mmsm_data_item_t *filter;
+
+    if (!monitor_index_key_equal(&node->command->mmsm_key, &item->mmsm_key))
+        return false;
+
+    for (filter = node->command->mmsm_next; filter; filter = filter->mmsm_next)
+    {
+        mmsm_data_item_t *attr = mmsm_find_key(item->mmsm_sub_values, &filter->mmsm_key);
+
+        if (!attr)
+            return false;
+
+        if (filter->mmsm_value_len &&
+            (attr->mmsm_value_len != filter->mmsm_value_len ||
+             memcmp(attr->mmsm_value, filter->mmsm_value, filter->mmsm_value_len) != 0))
+        {
+            return false;
+        }
+    }
+
+    if (node->pattern)
+    {
+        if (!item->mmsm_value_len || item->mmsm_value[item->mmsm_value_len - 1] != '\0')
+            return false;
+
+        if (fnmatch(node->pattern, (const char *)item->mmsm_value, 0) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Adds the matching nodes of a bucket to the match list.
+ */
+static void monitor_index_match_bucket(monitor_index_t *index, monitor_index_bucket_t *bucket,
+                                       const mmsm_data_item_t *item,
+                                       monitor_index_node_t ***tail)
+{
+    list_entry_t *entry;
+
+    list_for_each_entry(entry, &bucket->nodes)
+    {
+        monitor_index_node_t *node = list_get_item(node, entry, list);
+
+        if (node->match_gen == index->match_gen || !monitor_index_node_matches(node, item))
+            continue;
+
+        node->match_gen = index->match_gen;
+        node->match_next = NULL;
+        **tail = node;
+        *tail = &node->match_next;
+    }
+}
+
+int monitor_index_init(monitor_index_t *index)
+{
+    if (hashmap_init(&index->buckets, MONITOR_INDEX_NUM_BUCKETS, sizeof(monitor_index_key_t),
+                     monitor_index_bucket_get_key) != 0)
+        return -ENOMEM;
+
+    index->match_gen = 0;
+    return 0;
+}
+
+void monitor_index_cleanup(monitor_index_t *index)
+{
+    if (index->buckets.slots)
+        hashmap_cleanup(&index->buckets, monitor_index_free_bucket);
+}
+
+int monitor_index_add(monitor_index_t *index, monitor_index_node_t *node)
+{
+    const mmsm_data_item_t *filter = node->command->mmsm_next;
+    monitor_index_key_t key;
+    monitor_index_bucket_t *parent;
+    monitor_index_bucket_t *bucket;
+    size_t i;
+
+    monitor_index_make_key(&key, &node->command->mmsm_key, NULL, NULL, 0);
+    parent = monitor_index_get(index, &key);
+    if (!parent)
+        return -ENOMEM;
+
+    bucket = parent;
+    if (filter && filter->mmsm_value_len)
+    {
+        for (i = 0; i < parent->num_filter_keys; i++)
+        {
+            if (monitor_index_key_equal(&parent->filter_keys[i], &filter->mmsm_key))
+                break;
+        }
+
+        /* Too many different filter keys, so leave this one in the parent bucket */
+        if (i == MONITOR_INDEX_MAX_FILTER_KEYS)
+            goto add;
+
+        monitor_index_make_key(&key, &node->command->mmsm_key, &filter->mmsm_key,
+                               filter->mmsm_value, filter->mmsm_value_len);
+        bucket = monitor_index_get(index, &key);
+        if (!bucket)
+        {
+            monitor_index_put(index, parent);
+            return -ENOMEM;
+        }
+
+        if (bucket->parent && !monitor_index_key_equal(&bucket->filter_key, &filter->mmsm_key))
+        {
+            /* Hash collision with a different filter key, so fall back to the parent bucket */
+            bucket = parent;
+        }
+        else if (!bucket->parent)
+        {
+            /* New filtered bucket, so take a reference on its filter key in the parent */
+            if (monitor_index_key_copy(&bucket->filter_key, &filter->mmsm_key) != 0 ||
+                (i == parent->num_filter_keys &&
+                 monitor_index_key_copy(&parent->filter_keys[i], &filter->mmsm_key) != 0))
+            {
+                monitor_index_put(index, bucket);
+                monitor_index_put(index, parent);
+                return -ENOMEM;
+            }
+
+            if (i == parent->num_filter_keys)
+                parent->num_filter_keys++;
+            parent->filter_key_refs[i]++;
+            bucket->parent = parent;
+        }
+    }
+
+add:
+    node->bucket = bucket;
+    node->match_gen = index->match_gen;
+    list_add_tail(&bucket->nodes, &node->list);
+
+    return 0;
+}
+
+void monitor_index_remove(monitor_index_t *index, monitor_index_node_t *node)
+{
+    monitor_index_bucket_t *bucket = node->bucket;
+    monitor_index_bucket_t *parent = bucket->parent;
+    size_t i;
+
+    list_remove(&node->list);
+    node->bucket = NULL;
+
+    if (!parent || !list_is_empty(&bucket->nodes))
+    {
+        monitor_index_put(index, bucket);
+        return;
+    }
+
+    /* Last node of a filtered bucket, so drop its reference on the filter key */
+    for (i = 0; i < parent->num_filter_keys; i++)
+    {
+        if (monitor_index_key_equal(&bucket->filter_key, &parent->filter_keys[i]))
+            break;
+    }
+    MMSM_ASSERT(i < parent->num_filter_keys);
+
+    if (--parent->filter_key_refs[i] == 0)
+    {
+        monitor_index_key_free(&parent->filter_keys[i]);
+        parent->num_filter_keys--;
+        parent->filter_keys[i] = parent->filter_keys[parent->num_filter_keys];
+        parent->filter_key_refs[i] = parent->filter_key_refs[parent->num_filter_keys];
+    }
+
+    monitor_index_put(index, bucket);
+    monitor_index_put(index, parent);
+}
+
+monitor_index_node_t *monitor_index_match(monitor_index_t *index, mmsm_data_item_t *items)
+{
+    monitor_index_node_t *head = NULL;
+    monitor_index_node_t **tail = &head;
+    mmsm_data_item_t *item;
+
+    index->match_gen++;
+
+    for (item = items; item; item = item->mmsm_next)
+    {
+        monitor_index_key_t key;
+        monitor_index_bucket_t *parent;
+        size_t i;
+
+        monitor_index_make_key(&key, &item->mmsm_key, NULL, NULL, 0);
+        parent = monitor_index_find(index, &key);
+        if (!parent)
+            continue;
+
+        monitor_index_match_bucket(index, parent, item, &tail);
+
+        for (i = 0; i < parent->num_filter_keys; i++)
+        {
+            mmsm_data_item_t *attr = mmsm_find_key(item->mmsm_sub_values,
+                                                   &parent->filter_keys[i]);
+            monitor_index_bucket_t *bucket;
+
+            if (!attr)
+                continue;
+
+            monitor_index_make_key(&key, &item->mmsm_key, &parent->filter_keys[i],
+                                   attr->mmsm_value, attr->mmsm_value_len);
+            bucket = monitor_index_find(index, &key);
+            if (bucket)
+                monitor_index_match_bucket(index, bucket, item, &tail);
+        }
+    }
+
+    return head;
+}
@@ -0,0 +1,108 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "list.h"
+#include "hashmap.h"
+#include "mmsm_data.h"
+
+/**
+ * Engine-internal index of pattern monitors.
+ *
+ * A pattern monitor matches a received item when:
+ * - the item's key equals the key of the monitor's command,
+ * - every filter (the items chained after the command with mmsm_next) is found in the item's
+ *   sub-values by key, with an equal value if the filter has one, and
+ * - if the monitor has a pattern, the item's value is a string matching it (see fnmatch(3)).
+ *
+ * Monitors are bucketed by command key, and by the key and value of their first filter if they
+ * have one. For example nl80211 vendor event monitors with an NL80211_ATTR_VENDOR_SUBCMD filter
+ * each land in their own bucket. Matching an item only looks at the buckets that item can hit,
+ * so the cost doesn't grow with the number of unrelated monitors.
+ */
+
+/** Maximum number of different first-filter keys indexed for one command key */
+#define MONITOR_INDEX_MAX_FILTER_KEYS (4)
+
+struct monitor_index_bucket;
+
+/**
+ * A monitor's entry in the index. Embed this in the structure that owns the monitor.
+ */
+typedef struct monitor_index_node
+{
+    /** Bucket list link, owned by the index */
+    list_entry_t list;
+    /** The bucket the node is in, owned by the index */
+    struct monitor_index_bucket *bucket;
+    /** The command to match on. Must outlive the node's membership of the index. */
+    const mmsm_data_item_t *command;
+    /** The pattern to match the item's value against, or NULL to match any value */
+    const char *pattern;
+    /** Link in the list built by @ref monitor_index_match */
+    struct monitor_index_node *match_next;
+    /** Generation of the last match this node was added to, to avoid duplicates */
+    uint32_t match_gen;
+} monitor_index_node_t;
+
+/**
+ * The index
+ */
+typedef struct monitor_index
+{
+    /** Buckets of monitors, see @ref monitor_index_bucket_t in monitor_index.c */
+    hashmap_t buckets;
+    /** Incremented on every call to @ref monitor_index_match */
+    uint32_t match_gen;
+} monitor_index_t;
+
+/**
+ * @brief Initialise an index
+ *
+ * @param index Index to initialise
+ * @return 0 on success, or -ENOMEM
+ */
+int monitor_index_init(monitor_index_t *index);
+
+/**
+ * @brief Free the storage of the index. Nodes themselves are not freed.
+ *
+ * @param index Index to clean up
+ */
+void monitor_index_cleanup(monitor_index_t *index);
+
+/**
+ * @brief Add a monitor to the index
+ *
+ * @param index Index to add to
+ * @param node Node of the monitor, with command and pattern set
+ * @return 0 on success, or -ENOMEM
+ */
+int monitor_index_add(monitor_index_t *index, monitor_index_node_t *node);
+
+/**
+ * @brief Remove a monitor from the index
+ *
+ * @param index Index to remove from
+ * @param node Node previously added with @ref monitor_index_add
+ */
+void monitor_index_remove(monitor_index_t *index, monitor_index_node_t *node);
+
+/**
+ * @brief Find every monitor matching any of a list of received items
+ *
+ * Each matching monitor appears once in the returned list, even if it matches several items.
+ * The list is linked through @ref monitor_index_node_t::match_next and stays valid until the
+ * next call on the same index, or until the nodes are removed.
+ *
+ * @param index Index to search
+ * @param items Received items, chained with mmsm_next
+ * @return the first matching node, or NULL if none match
+ */
+monitor_index_node_t *monitor_index_match(monitor_index_t *index, mmsm_data_item_t *items);
@@ -0,0 +1,554 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "query.h"
+#include "logging.h"
+#include "utils.h"
+
+/** Most clients connected at once */
+#define QUERY_MAX_CLIENTS (16)
+
+/** Most topics a client can subscribe to */
+#define QUERY_MAX_SUBSCRIPTIONS (8)
+
+/** Longest topic name */
+#define QUERY_TOPIC_MAX (32)
+
+/** Longest query line, or notification text */
+#define QUERY_LINE_MAX (256)
+
+/** A module's topic, see @ref query_register */
+typedef struct query_provider
+{
+    const char *topic;
+    query_fn_t fn;
+    void *context;
+    struct query_provider *next;
+} query_provider_t;
+
+/** A connected client */
+typedef struct query_client
+{
+    /** Socket, or -1 if the slot is free */
+    int fd;
+    /** Set once it can't take what is sent to it, or sent something wrong, to be disconnected */
+    bool broken;
+    /** Topics subscribed to, "" if unused */
+    char subscriptions[QUERY_MAX_SUBSCRIPTIONS][QUERY_TOPIC_MAX];
+    /** What has been received of the next line */
+    char line[QUERY_LINE_MAX];
+    size_t line_len;
+} query_client_t;
+
+/**
+ * Protects @ref query_providers and @ref query_server's clients. Held while topics are written
+ * and while anything is sent to a client, so answers and notifications never interleave.
+ */
+static pthread_mutex_t query_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static query_provider_t *query_providers;
+
+static struct
+{
+    pthread_t thread;
+    bool started;
+    /** Set to stop the thread, with @ref query_mutex held */
+    bool stopping;
+    /** eventfd used to wake the thread, when stopping or a client is broken */
+    int wake_fd;
+    int listen_fd;
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    query_client_t clients[QUERY_MAX_CLIENTS];
+} query_server = {
+    .wake_fd = -1,
+    .listen_fd = -1,
+};
+
+static query_provider_t *query_provider_find(const char *topic)
+{
+    query_provider_t *provider;
+
+    for (provider = query_providers; provider; provider = provider->next)
+    {
+        if (strcmp(provider->topic, topic) == 0)
+            return provider;
+    }
+
+    return NULL;
+}
+
+int query_register(const char *topic, query_fn_t fn, void *context)
+{
+    query_provider_t *provider = calloc(1, sizeof(*provider));
+
+    if (!provider)
+        return -ENOMEM;
+
+    provider->topic = topic;
+    provider->fn = fn;
+    provider->context = context;
+
+    MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+    if (query_provider_find(topic))
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+        free(provider);
+        return -EEXIST;
+    }
+    provider->next = query_providers;
+    query_providers = provider;
+    MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+
+    return 0;
+}
+
+void query_unregister(const char *topic, query_fn_t fn, void *context)
+{
+    query_provider_t **link;
+
+    MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+    for (link = &query_providers; *link; link = &(*link)->next)
+    {
+        query_provider_t *provider = *link;
+
+        if (strcmp(provider->topic, topic) == 0 && provider->fn == fn &&
+            provider->context == context)
+        {
+            *link = provider->next;
+            free(provider);
+            break;
+        }
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+}
+
+/**
+ * @brief Wake the query thread
+ */
+static void query_wake(void)
+{
+    uint64_t one = 1;
+
+    if (write(query_server.wake_fd, &one, sizeof(one)) < 0)
+        LOG_ERROR("Failed to wake the query thread: %d\n", errno);
+}
+
+/**
+ * @brief Send to a client without blocking, marking it broken if it can't take all of it. Must be
+ * called with @ref query_mutex held.
+ */
+static void query_send(query_client_t *client, const char *buf, size_t len)
+{
+    ssize_t sent;
+
+    if (client->broken)
+        return;
+
+    sent = send(client->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent != (ssize_t)len)
+    {
+        if (sent >= 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+            LOG_WARN("Query client isn't keeping up, disconnecting it\n");
+        client->broken = true;
+        query_wake();
+    }
+}
+
+static bool query_is_subscribed(const query_client_t *client, const char *topic)
+{
+    for (int i = 0; i < QUERY_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (strcmp(client->subscriptions[i], topic) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+void query_notify(const char *topic, const char *fmt, ...)
+{
+    char buf[QUERY_LINE_MAX + QUERY_TOPIC_MAX + 8];
+    va_list args;
+    int cancel_state;
+    int len;
+    int ret;
+
+    if (strlen(topic) >= QUERY_TOPIC_MAX)
+    {
+        LOG_WARN("Query notification topic %s is too long, dropping it\n", topic);
+        return;
+    }
+
+    len = snprintf(buf, sizeof(buf), "EVENT %s ", topic);
+    va_start(args, fmt);
+    ret = vsnprintf(buf + len, QUERY_LINE_MAX, fmt, args);
+    va_end(args);
+    if (ret < 0 || ret >= QUERY_LINE_MAX)
+    {
+        LOG_WARN("Query notification on %s is too long, dropping it\n", topic);
+        return;
+    }
+    len += ret;
+    buf[len++] = '\n';
+
+    /* Not cancelled holding the lock, as modules' threads are when they are destroyed */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+    for (int i = 0; query_server.started && i < QUERY_MAX_CLIENTS; i++)
+    {
+        query_client_t *client = &query_server.clients[i];
+
+        if (client->fd >= 0 && query_is_subscribed(client, topic))
+            query_send(client, buf, len);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+    pthread_setcancelstate(cancel_state, NULL);
+}
+
+/**
+ * @brief Subscribe a client to a topic, or unsubscribe it
+ *
+ * @return NULL on success, else the error to answer with
+ */
+static const char *query_subscribe(query_client_t *client, const char *topic, bool subscribe)
+{
+    char *free_slot = NULL;
+
+    if (!topic[0] || strchr(topic, ' ') || strlen(topic) >= QUERY_TOPIC_MAX)
+        return "invalid topic";
+
+    for (int i = 0; i < QUERY_MAX_SUBSCRIPTIONS; i++)
+    {
+        char *slot = client->subscriptions[i];
+
+        if (strcmp(slot, topic) == 0)
+        {
+            if (!subscribe)
+                slot[0] = '\0';
+            return NULL;
+        }
+        if (!slot[0] && !free_slot)
+            free_slot = slot;
+    }
+
+    if (!subscribe)
+        return NULL;
+    if (!free_slot)
+        return "too many subscriptions";
+
+    strcpy(free_slot, topic);
+    return NULL;
+}
+
+/**
+ * @brief Answer a line from a client. Must be called with @ref query_mutex held.
+ */
+static void query_answer(query_client_t *client, char *line)
+{
+    char *space = strchr(line, ' ');
+    const char *args = "";
+    const char *error = NULL;
+    query_provider_t *provider;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out;
+
+    if (space)
+    {
+        *space = '\0';
+        args = space + 1;
+    }
+
+    out = open_memstream(&buf, &len);
+    if (!out)
+    {
+        client->broken = true;
+        return;
+    }
+
+    if (strcmp(line, "PING") == 0)
+    {
+        fprintf(out, "PONG\n");
+    }
+    else if (strcmp(line, "TOPICS") == 0)
+    {
+        for (provider = query_providers; provider; provider = provider->next)
+            fprintf(out, "%s\n", provider->topic);
+    }
+    else if (strcmp(line, "SUBSCRIBE") == 0 || strcmp(line, "UNSUBSCRIBE") == 0)
+    {
+        error = query_subscribe(client, args, line[0] == 'S');
+        if (!error)
+            fprintf(out, "OK\n");
+    }
+    else if ((provider = query_provider_find(line)) != NULL)
+    {
+        provider->fn(provider->context, args, out);
+    }
+    else
+    {
+        error = "unknown topic";
+    }
+
+    if (error)
+        fprintf(out, "ERROR %s\n", error);
+    fputc('\n', out);
+
+    if (fclose(out) == 0)
+        query_send(client, buf, len);
+    else
+        client->broken = true;
+
+    free(buf);
+}
+
+/**
+ * @brief Read what a client has sent, answering each whole line. Must be called with
+ * @ref query_mutex held.
+ */
+static void query_client_read(query_client_t *client)
+{
+    ssize_t n = recv(client->fd, client->line + client->line_len,
+                     sizeof(client->line) - client->line_len, MSG_DONTWAIT);
+    char *start = client->line;
+    char *end;
+
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (n <= 0)
+    {
+        client->broken = true;
+        return;
+    }
+    client->line_len += n;
+
+    while (!client->broken &&
+           (end = memchr(start, '\n', client->line_len - (start - client->line))) != NULL)
+    {
+        *end = '\0';
+        if (end > start && end[-1] == '\r')
+            end[-1] = '\0';
+        if (start[0])
+            query_answer(client, start);
+        start = end + 1;
+    }
+
+    client->line_len -= start - client->line;
+    memmove(client->line, start, client->line_len);
+
+    /* No room left for the rest of the line */
+    if (client->line_len == sizeof(client->line))
+        client->broken = true;
+}
+
+static void query_client_close(query_client_t *client)
+{
+    close(client->fd);
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+}
+
+/**
+ * @brief Take a new client, if there is room for it. Must be called with @ref query_mutex held.
+ */
+static void query_accept(void)
+{
+    int fd = accept(query_server.listen_fd, NULL, NULL);
+
+    if (fd < 0)
+        return;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    for (int i = 0; i < QUERY_MAX_CLIENTS; i++)
+    {
+        if (query_server.clients[i].fd < 0)
+        {
+            query_server.clients[i].fd = fd;
+            return;
+        }
+    }
+
+    LOG_WARN("Too many query clients, refusing another\n");
+    send(fd, "ERROR too many clients\n\n", 24, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+}
+
+/**
+ * @brief Answer clients until stopped
+ */
+static void *query_thread_fn(void *arg)
+{
+    struct pollfd pfds[2 + QUERY_MAX_CLIENTS];
+    int slots[QUERY_MAX_CLIENTS];
+
+    UNUSED(arg);
+
+    MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+
+    while (!query_server.stopping)
+    {
+        nfds_t nfds = 2;
+        uint64_t wakes;
+
+        pfds[0] = (struct pollfd){ .fd = query_server.wake_fd, .events = POLLIN };
+        pfds[1] = (struct pollfd){ .fd = query_server.listen_fd, .events = POLLIN };
+        for (int i = 0; i < QUERY_MAX_CLIENTS; i++)
+        {
+            query_client_t *client = &query_server.clients[i];
+
+            if (client->fd >= 0 && client->broken)
+                query_client_close(client);
+            if (client->fd < 0)
+                continue;
+
+            slots[nfds - 2] = i;
+            pfds[nfds++] = (struct pollfd){ .fd = client->fd, .events = POLLIN };
+        }
+
+        MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+        if (poll(pfds, nfds, -1) < 0 && errno != EINTR)
+        {
+            LOG_ERROR("Query poll failed: %d\n", errno);
+            MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+            break;
+        }
+        if ((pfds[0].revents & POLLIN) && read(query_server.wake_fd, &wakes, sizeof(wakes)) < 0)
+            LOG_ERROR("Failed to read the query thread's wakes: %d\n", errno);
+        MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+
+        if (pfds[1].revents & POLLIN)
+            query_accept();
+
+        for (nfds_t i = 2; i < nfds; i++)
+        {
+            if (pfds[i].revents)
+                query_client_read(&query_server.clients[slots[i - 2]]);
+        }
+    }
+
+    MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+
+    return NULL;
+}
+
+static int query_listen(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    strcpy(addr.sun_path, path);
+    /* Left behind by an earlier run that didn't stop cleanly */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        int err = -errno;
+
+        close(fd);
+        return err;
+    }
+
+    return fd;
+}
+
+static void query_server_close(void)
+{
+    for (int i = 0; i < QUERY_MAX_CLIENTS; i++)
+    {
+        if (query_server.clients[i].fd >= 0)
+            query_client_close(&query_server.clients[i]);
+    }
+
+    if (query_server.listen_fd >= 0)
+    {
+        close(query_server.listen_fd);
+        unlink(query_server.socket_path);
+    }
+    if (query_server.wake_fd >= 0)
+        close(query_server.wake_fd);
+
+    query_server.listen_fd = -1;
+    query_server.wake_fd = -1;
+}
+
+int query_server_start(const char *socket_path)
+{
+    int ret;
+
+    if (query_server.started)
+        return -EALREADY;
+
+    for (int i = 0; i < QUERY_MAX_CLIENTS; i++)
+        query_server.clients[i].fd = -1;
+
+    ret = query_listen(socket_path);
+    if (ret < 0)
+    {
+        LOG_ERROR("Failed to listen for queries on %s: %d\n", socket_path, ret);
+        goto fail;
+    }
+    query_server.listen_fd = ret;
+    snprintf(query_server.socket_path, sizeof(query_server.socket_path), "%s", socket_path);
+
+    query_server.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (query_server.wake_fd < 0)
+    {
+        ret = -errno;
+        goto fail;
+    }
+
+    query_server.stopping = false;
+    ret = -pthread_create(&query_server.thread, NULL, query_thread_fn, NULL);
+    if (ret)
+        goto fail;
+
+    MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+    query_server.started = true;
+    MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+
+    LOG_INFO("Answering queries on %s\n", socket_path);
+    return 0;
+
+fail:
+    query_server_close();
+    return ret;
+}
+
+void query_server_stop(void)
+{
+    if (!query_server.started)
+        return;
+
+    MMSM_ASSERT(pthread_mutex_lock(&query_mutex) == 0);
+    query_server.stopping = true;
+    query_server.started = false;
+    query_wake();
+    MMSM_ASSERT(pthread_mutex_unlock(&query_mutex) == 0);
+
+    MMSM_ASSERT(pthread_join(query_server.thread, NULL) == 0);
+
+    query_server_close();
+}
@@ -0,0 +1,269 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "request_cache.h"
+#include "helpers.h"
+#include "list.h"
+#include "utils.h"
+#include "logging.h"
+
+/**
+ * A registered command
+ */
+typedef struct request_cache_entry
+{
+    /** Link in @ref request_cache_entries */
+    list_entry_t list;
+    /** The interface the command is sent on */
+    mmsm_backend_intf_t *intf;
+    /** Copy of the command */
+    mmsm_data_item_t *command;
+    /** How long a response stays valid */
+    uint32_t ttl_ms;
+    /** Response of the last completed request, or NULL */
+    mmsm_data_item_t *result;
+    /** CLOCK_MONOTONIC time in nanoseconds after which @ref result is stale */
+    uint64_t expires_ns;
+    /** Set while a request is in flight */
+    bool in_flight;
+    /** Incremented whenever a request completes */
+    uint32_t flight_seq;
+    /** Incremented by @ref request_cache_invalidate */
+    uint32_t invalidate_gen;
+    /** Number of threads making or waiting on a request for this entry */
+    unsigned int users;
+    /** Cleared by @ref request_cache_unregister. The entry is freed once it has no users. */
+    bool registered;
+    /** Signalled when a request completes */
+    pthread_cond_t cond;
+} request_cache_entry_t;
+
+/** Registered commands. Protected by @ref request_cache_mutex. */
+static list_head_t request_cache_entries;
+static pthread_mutex_t request_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t request_cache_once = PTHREAD_ONCE_INIT;
+
+static void request_cache_init_once(void)
+{
+    list_reset(&request_cache_entries);
+}
+
+static void request_cache_lock(void)
+{
+    MMSM_ASSERT(pthread_once(&request_cache_once, request_cache_init_once) == 0);
+    MMSM_ASSERT(pthread_mutex_lock(&request_cache_mutex) == 0);
+}
+
+static uint64_t request_cache_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Finds the entry for a command. Must be called with @ref request_cache_mutex held.
+ */
+static request_cache_entry_t *request_cache_find(mmsm_backend_intf_t *intf,
+                                                 const mmsm_data_item_t *command)
+{
+    list_entry_t *entry;
+
+    list_for_each_entry(entry, &request_cache_entries)
+    {
+        request_cache_entry_t *cached = list_get_item(cached, entry, list);
+
+        if (cached->intf == intf && mmsm_data_item_equal(cached->command, command))
+            return cached;
+    }
+
+    return NULL;
+}
+
+static void request_cache_entry_free(request_cache_entry_t *cached)
+{
+    mmsm_data_item_free(cached->command);
+    mmsm_data_item_free(cached->result);
+    MMSM_ASSERT(pthread_cond_destroy(&cached->cond) == 0);
+    free(cached);
+}
+
+/**
+ * Drops a use of an entry, freeing it if it has been unregistered and this was the last use.
+ * Must be called with @ref request_cache_mutex held.
+ */
+static void request_cache_entry_put(request_cache_entry_t *cached)
+{
+    if (--cached->users == 0 && !cached->registered)
+        request_cache_entry_free(cached);
+}
+
+int request_cache_register(mmsm_backend_intf_t *intf, const mmsm_data_item_t *command,
+                           uint32_t ttl_ms)
+{
+    request_cache_entry_t *cached;
+
+    request_cache_lock();
+
+    cached = request_cache_find(intf, command);
+    if (cached)
+    {
+        cached->ttl_ms = ttl_ms;
+        MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+        return 0;
+    }
+
+    cached = calloc(1, sizeof(*cached));
+    if (!cached)
+        goto err;
+
+    cached->command = mmsm_data_item_copy(command);
+    if (!cached->command)
+    {
+        free(cached);
+        goto err;
+    }
+
+    cached->intf = intf;
+    cached->ttl_ms = ttl_ms;
+    cached->registered = true;
+    MMSM_ASSERT(pthread_cond_init(&cached->cond, NULL) == 0);
+    list_add_tail(&request_cache_entries, &cached->list);
+
+    MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+    return 0;
+
+err:
+    MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+    return -ENOMEM;
+}
+
+void request_cache_unregister(mmsm_backend_intf_t *intf)
+{
+    list_entry_t *entry;
+    list_entry_t *temp;
+
+    request_cache_lock();
+    list_for_each_entry_safe(entry, temp, &request_cache_entries)
+    {
+        request_cache_entry_t *cached = list_get_item(cached, entry, list);
+
+        if (cached->intf != intf)
+            continue;
+
+        list_remove(&cached->list);
+        cached->registered = false;
+        if (cached->users == 0)
+            request_cache_entry_free(cached);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+}
+
+void request_cache_invalidate(mmsm_backend_intf_t *intf)
+{
+    list_entry_t *entry;
+
+    request_cache_lock();
+    list_for_each_entry(entry, &request_cache_entries)
+    {
+        request_cache_entry_t *cached = list_get_item(cached, entry, list);
+
+        if (cached->intf != intf)
+            continue;
+
+        cached->invalidate_gen++;
+        /* Waiters on an in-flight request still need the result it leaves behind */
+        if (!cached->in_flight && cached->users == 0)
+        {
+            mmsm_data_item_free(cached->result);
+            cached->result = NULL;
+        }
+        cached->expires_ns = 0;
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+}
+
+bool request_cache_request(mmsm_backend_intf_t *intf, mmsm_data_item_t *command,
+                           request_cache_fetch_fn_t fetch, mmsm_data_item_t **rsp)
+{
+    request_cache_entry_t *cached;
+    mmsm_data_item_t *result;
+    uint32_t gen;
+
+    request_cache_lock();
+
+    cached = request_cache_find(intf, command);
+    if (!cached)
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+        return false;
+    }
+
+    cached->users++;
+
+    if (cached->in_flight)
+    {
+        uint32_t seq = cached->flight_seq;
+
+        while (cached->flight_seq == seq)
+            MMSM_ASSERT(pthread_cond_wait(&cached->cond, &request_cache_mutex) == 0);
+
+        *rsp = mmsm_data_item_retain(cached->result);
+        goto out;
+    }
+
+    if (cached->result && request_cache_now_ns() < cached->expires_ns)
+    {
+        *rsp = mmsm_data_item_retain(cached->result);
+        goto out;
+    }
+
+    /* Nothing fresh and nothing in flight, so make the request for everyone */
+    cached->in_flight = true;
+    gen = cached->invalidate_gen;
+    MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+
+    result = fetch(intf, command);
+
+    MMSM_ASSERT(pthread_mutex_lock(&request_cache_mutex) == 0);
+    mmsm_data_item_free(cached->result);
+    cached->result = result;
+    cached->expires_ns = 0;
+    if (result && cached->ttl_ms && gen == cached->invalidate_gen)
+        cached->expires_ns = request_cache_now_ns() + (uint64_t)cached->ttl_ms * 1000000ull;
+    cached->in_flight = false;
+    cached->flight_seq++;
+    MMSM_ASSERT(pthread_cond_broadcast(&cached->cond) == 0);
+
+    if (cached->users == 1 && cached->expires_ns == 0)
+    {
+        /* Nobody else wants the response, so hand it over rather than sharing it */
+        *rsp = result;
+        cached->result = NULL;
+    }
+    else
+    {
+        *rsp = mmsm_data_item_retain(result);
+    }
+
+out:
+    /* Don't hold on to responses nobody can use any more */
+    if (cached->users == 1 && cached->expires_ns == 0)
+    {
+        mmsm_data_item_free(cached->result);
+        cached->result = NULL;
+    }
+    request_cache_entry_put(cached);
+    MMSM_ASSERT(pthread_mutex_unlock(&request_cache_mutex) == 0);
+    return true;
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "backend/backend.h"
+#include "mmsm_data.h"
+
+/**
+ * Engine-internal cache of request responses.
+ *
+ * Commands are registered per backend interface with a time to live. While a registered command
+ * is in flight, identical requests wait for it and receive a shared reference to its response
+ * (see mmsm_data_item_retain) instead of making their own round-trip. With a non-zero time to
+ * live, the response is then reused for identical requests until it expires or is invalidated.
+ * Requests for commands that aren't registered are not touched.
+ */
+
+/**
+ * Function performing the backend request on a cache miss.
+ *
+ * @param intf The interface to send the request on
+ * @param command The command to send
+ * @return the response, or NULL on failure
+ */
+typedef mmsm_data_item_t *(*request_cache_fetch_fn_t)(mmsm_backend_intf_t *intf,
+                                                      mmsm_data_item_t *command);
+
+/**
+ * @brief Register a command for caching, or update its time to live if already registered
+ *
+ * @param intf The interface the command is sent on
+ * @param command The command. A copy is kept.
+ * @param ttl_ms How long a response stays valid in milliseconds. 0 only coalesces concurrent
+ *               requests.
+ * @return 0 on success, or -ENOMEM
+ */
+int request_cache_register(mmsm_backend_intf_t *intf, const mmsm_data_item_t *command,
+                           uint32_t ttl_ms);
+
+/**
+ * @brief Unregister every command of an interface and drop their responses
+ *
+ * Requests in flight for the interface keep their entries until they complete.
+ *
+ * @param intf The interface
+ */
+void request_cache_unregister(mmsm_backend_intf_t *intf);
+
+/**
+ * @brief Drop the cached responses of an interface
+ *
+ * Responses of requests that are in flight when this is called are still provided to the
+ * requests waiting on them, but are not cached.
+ *
+ * @param intf The interface
+ */
+void request_cache_invalidate(mmsm_backend_intf_t *intf);
+
+/**
+ * @brief Perform a request through the cache
+ *
+ * @param intf The interface to send the request on
+ * @param command The command to send
+ * @param fetch Function performing the request on a miss
+ * @param rsp Set to a reference to the response, freed by the caller, or NULL on failure
+ * @return true if the command is registered and rsp was set, false if the caller should perform
+ *         the request itself
+ */
+bool request_cache_request(mmsm_backend_intf_t *intf, mmsm_data_item_t *command,
+                           request_cache_fetch_fn_t fetch, mmsm_data_item_t **rsp);
@@ -0,0 +1,471 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sta_table.h"
+#include "rcu_hashmap.h"
+#include "helpers.h"
+#include "utils.h"
+#include "logging.h"
+
+/*
+ * Entries are read without locks, so are never modified once they are in the map. Changing a
+ * station's details means building a new entry and swapping it in with rcu_hashmap_replace.
+ * Entries replaced or removed are freed by rcu_reclaim, called once each change is made, outside
+ * the mutex and any read-side critical section. The notification callbacks run within one, so
+ * the engine reclaims after dispatching them instead.
+ */
+
+/** Number of stations the map makes room for up front */
+#define STA_TABLE_INITIAL_CAPACITY  (64)
+
+/** Most stations read from hostapd's station list, in case it never ends */
+#define STA_TABLE_MAX_LIST          (4096)
+
+/** Length of a MAC address */
+#define STA_TABLE_ADDR_LEN          (6)
+
+/** Length of a MAC address formatted as a string, without the terminator */
+#define STA_TABLE_ADDR_STR_LEN      (17)
+
+typedef struct sta_table_entry
+{
+    uint8_t addr[STA_TABLE_ADDR_LEN];
+    /** Value of @ref mmsm_sta_table::sync_gen when the station was last seen connected */
+    uint32_t sync_gen;
+    /** Reference to the station's details, or NULL if they haven't been requested */
+    mmsm_data_item_t *info;
+    /** CLOCK_MONOTONIC time in nanoseconds after which @ref info is stale, or 0 for never */
+    uint64_t info_expires_ns;
+    rcu_head_t rcu;
+} sta_table_entry_t;
+
+struct mmsm_sta_table
+{
+    mmsm_backend_intf_t *intf;
+    uint32_t info_ttl_ms;
+    /** Stations by MAC address */
+    rcu_hashmap_t stations;
+    /**
+     * Serialises changes to @ref stations, so an entry can be looked up and replaced without
+     * another change happening in between
+     */
+    pthread_mutex_t mutex;
+    /** Incremented by each resync. Protected by @ref mutex. */
+    uint32_t sync_gen;
+};
+
+static const void *sta_table_entry_get_key(const void *entry)
+{
+    return ((const sta_table_entry_t *)entry)->addr;
+}
+
+static uint64_t sta_table_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * Parses a MAC address at the start of a string, which must be followed by a space or the end.
+ */
+static bool sta_table_parse_addr(const char *str, uint8_t addr[6])
+{
+    int len = 0;
+
+    if (!str)
+        return false;
+
+    if (sscanf(str, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n",
+               &addr[0], &addr[1], &addr[2], &addr[3], &addr[4], &addr[5], &len) != 6)
+        return false;
+
+    return len == STA_TABLE_ADDR_STR_LEN && (str[len] == '\0' || str[len] == ' ');
+}
+
+/**
+ * Gets the address of the station a "STA", "STA-FIRST" or "STA-NEXT" response is for, which
+ * hostapd puts on the first line.
+ */
+static bool sta_table_info_addr(mmsm_data_item_t *info, uint8_t addr[6])
+{
+    if (!info || info->mmsm_key.type != MMSM_KEY_TYPE_STRING)
+        return false;
+
+    return sta_table_parse_addr(info->mmsm_key.d.string, addr);
+}
+
+static sta_table_entry_t *sta_table_entry_alloc(const uint8_t addr[6], uint32_t sync_gen)
+{
+    sta_table_entry_t *entry = calloc(1, sizeof(*entry));
+
+    if (!entry)
+        return NULL;
+
+    memcpy(entry->addr, addr, sizeof(entry->addr));
+    entry->sync_gen = sync_gen;
+
+    return entry;
+}
+
+/**
+ * Sets the details of a newly allocated entry.
+ *
+ * @param info The details, of which the entry takes a reference
+ */
+static void sta_table_entry_set_info(mmsm_sta_table_t *table, sta_table_entry_t *entry,
+                                     mmsm_data_item_t *info)
+{
+    entry->info = mmsm_data_item_retain(info);
+    if (table->info_ttl_ms)
+        entry->info_expires_ns = sta_table_now_ns() + table->info_ttl_ms * 1000000ull;
+}
+
+static void sta_table_entry_free(void *ptr)
+{
+    sta_table_entry_t *entry = ptr;
+
+    mmsm_data_item_release(entry->info);
+    free(entry);
+}
+
+static void sta_table_entry_free_rcu(rcu_head_t *head)
+{
+    sta_table_entry_free(container_of(head, sta_table_entry_t, rcu));
+}
+
+/**
+ * Adds an entry, or replaces the station's entry if it has one. Must be called with the table's
+ * mutex held.
+ */
+static void sta_table_put(mmsm_sta_table_t *table, sta_table_entry_t *entry)
+{
+    sta_table_entry_t *old = rcu_hashmap_replace(&table->stations, entry);
+
+    if (old)
+    {
+        rcu_call(&old->rcu, sta_table_entry_free_rcu);
+    }
+    else if (rcu_hashmap_insert(&table->stations, entry) != 0)
+    {
+        LOG_ERROR("Failed to add station " MACF "\n", MACSTR(entry->addr));
+        sta_table_entry_free(entry);
+    }
+}
+
+/**
+ * Removes a station's entry, if it has one. Must be called with the table's mutex held.
+ */
+static void sta_table_remove(mmsm_sta_table_t *table, const uint8_t addr[6])
+{
+    sta_table_entry_t *old = rcu_hashmap_remove(&table->stations, addr);
+
+    if (old)
+        rcu_call(&old->rcu, sta_table_entry_free_rcu);
+}
+
+static void sta_table_connected_callback(void *context, mmsm_backend_intf_t *intf,
+                                         mmsm_data_item_t *result)
+{
+    mmsm_sta_table_t *table = context;
+    sta_table_entry_t *entry;
+    uint8_t addr[6];
+
+    UNUSED(intf);
+
+    if (!sta_table_parse_addr((const char *)mmsm_find_value_by_key(result, "AP-STA-CONNECTED"),
+                              addr))
+        return;
+
+    MMSM_ASSERT(pthread_mutex_lock(&table->mutex) == 0);
+    /* Whether or not the station was already known, any details kept are out of date */
+    entry = sta_table_entry_alloc(addr, table->sync_gen);
+    if (entry)
+        sta_table_put(table, entry);
+    MMSM_ASSERT(pthread_mutex_unlock(&table->mutex) == 0);
+}
+
+static void sta_table_disconnected_callback(void *context, mmsm_backend_intf_t *intf,
+                                            mmsm_data_item_t *result)
+{
+    mmsm_sta_table_t *table = context;
+    uint8_t addr[6];
+
+    UNUSED(intf);
+
+    if (!sta_table_parse_addr((const char *)mmsm_find_value_by_key(result,
+                                                                   "AP-STA-DISCONNECTED"),
+                              addr))
+        return;
+
+    MMSM_ASSERT(pthread_mutex_lock(&table->mutex) == 0);
+    sta_table_remove(table, addr);
+    MMSM_ASSERT(pthread_mutex_unlock(&table->mutex) == 0);
+}
+
+mmsm_sta_table_t *mmsm_sta_table_create(mmsm_backend_intf_t *intf, uint32_t info_ttl_ms)
+{
+    mmsm_sta_table_t *table;
+
+    if (!intf)
+        return NULL;
+
+    table = calloc(1, sizeof(*table));
+    if (!table)
+        return NULL;
+
+    if (rcu_hashmap_init(&table->stations, STA_TABLE_INITIAL_CAPACITY, STA_TABLE_ADDR_LEN,
+                         sta_table_entry_get_key) != 0)
+    {
+        free(table);
+        return NULL;
+    }
+
+    table->intf = intf;
+    table->info_ttl_ms = info_ttl_ms;
+    MMSM_ASSERT(pthread_mutex_init(&table->mutex, NULL) == 0);
+
+    /* Monitor first, so that no station connecting while the list is read is missed */
+    if (mmsm_monitor_pattern(intf, "", sta_table_connected_callback, table,
+                             "AP-STA-CONNECTED") != MMSM_SUCCESS ||
+        mmsm_monitor_pattern(intf, "", sta_table_disconnected_callback, table,
+                             "AP-STA-DISCONNECTED") != MMSM_SUCCESS)
+    {
+        LOG_ERROR("Failed to monitor station events\n");
+        mmsm_sta_table_destroy(table);
+        return NULL;
+    }
+
+    if (mmsm_sta_table_resync(table) != 0)
+        LOG_WARN("Failed to read the station list, only stations connecting will be known\n");
+
+    return table;
+}
+
+void mmsm_sta_table_destroy(mmsm_sta_table_t *table)
+{
+    if (!table)
+        return;
+
+    mmsm_monitor_pattern_remove(table->intf, sta_table_connected_callback, table);
+    mmsm_monitor_pattern_remove(table->intf, sta_table_disconnected_callback, table);
+
+    /* Callbacks run in read-side critical sections, and entries replaced are freed after one */
+    rcu_synchronize();
+
+    rcu_hashmap_cleanup(&table->stations, sta_table_entry_free);
+    MMSM_ASSERT(pthread_mutex_destroy(&table->mutex) == 0);
+    free(table);
+}
+
+typedef struct sta_table_prune_ctx
+{
+    mmsm_sta_table_t *table;
+    uint32_t sync_gen;
+} sta_table_prune_ctx_t;
+
+static void sta_table_prune_entry(void *ptr, void *arg)
+{
+    sta_table_entry_t *entry = ptr;
+    sta_table_prune_ctx_t *ctx = arg;
+
+    if (entry->sync_gen != ctx->sync_gen)
+        sta_table_remove(ctx->table, entry->addr);
+}
+
+int mmsm_sta_table_resync(mmsm_sta_table_t *table)
+{
+    sta_table_prune_ctx_t prune = { .table = table };
+    mmsm_data_item_t *info;
+    char command[sizeof("STA-NEXT ") + STA_TABLE_ADDR_STR_LEN];
+    size_t i;
+
+    MMSM_ASSERT(pthread_mutex_lock(&table->mutex) == 0);
+    prune.sync_gen = ++table->sync_gen;
+    MMSM_ASSERT(pthread_mutex_unlock(&table->mutex) == 0);
+
+    /* The lock is only held between requests, so notifications are applied meanwhile */
+    info = mmsm_request(table->intf, "STA-FIRST");
+    for (i = 0; info && i < STA_TABLE_MAX_LIST; i++)
+    {
+        sta_table_entry_t *entry;
+        uint8_t addr[6];
+
+        /* Anything that isn't a station, e.g. FAIL, ends the list */
+        if (!sta_table_info_addr(info, addr))
+            break;
+
+        entry = sta_table_entry_alloc(addr, prune.sync_gen);
+        if (entry)
+        {
+            sta_table_entry_set_info(table, entry, info);
+            MMSM_ASSERT(pthread_mutex_lock(&table->mutex) == 0);
+            sta_table_put(table, entry);
+            MMSM_ASSERT(pthread_mutex_unlock(&table->mutex) == 0);
+        }
+        mmsm_data_item_release(info);
+
+        snprintf(command, sizeof(command), "STA-NEXT " MACF, MACSTR(addr));
+        info = mmsm_request(table->intf, command);
+    }
+
+    /*
+     * hostapd ends the list with an empty response, which leaves NULL just like a failed request,
+     * so make sure it is still answering before dropping the stations that weren't listed
+     */
+    if (!info)
+        info = mmsm_request(table->intf, "PING");
+    if (!info)
+    {
+        rcu_reclaim();
+        return -EIO;
+    }
+    mmsm_data_item_release(info);
+
+    MMSM_ASSERT(pthread_mutex_lock(&table->mutex) == 0);
+    rcu_hashmap_iterate(&table->stations, sta_table_prune_entry, &prune);
+    MMSM_ASSERT(pthread_mutex_unlock(&table->mutex) == 0);
+    rcu_reclaim();
+
+    return 0;
+}
+
+size_t mmsm_sta_table_count(mmsm_sta_table_t *table)
+{
+    return rcu_hashmap_count(&table->stations);
+}
+
+bool mmsm_sta_table_contains(mmsm_sta_table_t *table, const uint8_t addr[6])
+{
+    bool found;
+
+    rcu_read_lock();
+    found = rcu_hashmap_find(&table->stations, addr) != NULL;
+    rcu_read_unlock();
+
+    return found;
+}
+
+mmsm_data_item_t *mmsm_sta_table_get_info(mmsm_sta_table_t *table, const uint8_t addr[6])
+{
+    sta_table_entry_t *entry;
+    sta_table_entry_t *updated;
+    mmsm_data_item_t *info = NULL;
+    char command[sizeof("STA ") + STA_TABLE_ADDR_STR_LEN];
+    uint8_t info_addr[6];
+    bool connected;
+
+    rcu_read_lock();
+    entry = rcu_hashmap_find(&table->stations, addr);
+    connected = entry != NULL;
+    if (entry && entry->info &&
+        (!entry->info_expires_ns || sta_table_now_ns() < entry->info_expires_ns))
+    {
+        info = mmsm_data_item_retain(entry->info);
+    }
+    rcu_read_unlock();
+
+    if (info || !connected)
+        return info;
+
+    snprintf(command, sizeof(command), "STA " MACF, MACSTR(addr));
+    info = mmsm_request(table->intf, command);
+    if (!sta_table_info_addr(info, info_addr) || memcmp(info_addr, addr, sizeof(info_addr)))
+    {
+        mmsm_data_item_release(info);
+        return NULL;
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&table->mutex) == 0);
+    rcu_read_lock();
+    /* The station may have left while the request was made, in which case so have its details */
+    entry = rcu_hashmap_find(&table->stations, addr);
+    updated = entry ? sta_table_entry_alloc(addr, entry->sync_gen) : NULL;
+    if (updated)
+    {
+        sta_table_entry_set_info(table, updated, info);
+        sta_table_put(table, updated);
+    }
+    rcu_read_unlock();
+    MMSM_ASSERT(pthread_mutex_unlock(&table->mutex) == 0);
+    rcu_reclaim();
+
+    if (!entry)
+    {
+        mmsm_data_item_release(info);
+        return NULL;
+    }
+
+    return info;
+}
+
+static void sta_table_invalidate_entry(mmsm_sta_table_t *table, sta_table_entry_t *entry)
+{
+    sta_table_entry_t *updated;
+
+    if (!entry->info)
+        return;
+
+    updated = sta_table_entry_alloc(entry->addr, entry->sync_gen);
+    if (updated)
+        sta_table_put(table, updated);
+}
+
+static void sta_table_invalidate_one(void *ptr, void *arg)
+{
+    sta_table_invalidate_entry(arg, ptr);
+}
+
+void mmsm_sta_table_invalidate(mmsm_sta_table_t *table, const uint8_t addr[6])
+{
+    MMSM_ASSERT(pthread_mutex_lock(&table->mutex) == 0);
+    if (addr)
+    {
+        sta_table_entry_t *entry;
+
+        rcu_read_lock();
+        entry = rcu_hashmap_find(&table->stations, addr);
+        if (entry)
+            sta_table_invalidate_entry(table, entry);
+        rcu_read_unlock();
+    }
+    else
+    {
+        rcu_hashmap_iterate(&table->stations, sta_table_invalidate_one, table);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&table->mutex) == 0);
+    rcu_reclaim();
+}
+
+typedef struct sta_table_iterate_ctx
+{
+    mmsm_sta_table_fn_t fn;
+    void *context;
+} sta_table_iterate_ctx_t;
+
+static void sta_table_iterate_entry(void *ptr, void *arg)
+{
+    sta_table_entry_t *entry = ptr;
+    sta_table_iterate_ctx_t *ctx = arg;
+
+    ctx->fn(ctx->context, entry->addr);
+}
+
+void mmsm_sta_table_iterate(mmsm_sta_table_t *table, mmsm_sta_table_fn_t fn, void *context)
+{
+    sta_table_iterate_ctx_t ctx = { .fn = fn, .context = context };
+
+    rcu_hashmap_iterate(&table->stations, sta_table_iterate_entry, &ctx);
+}
@@ -0,0 +1,149 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "stats.h"
+#include "utils.h"
+
+/**
+ * Counters of a backend interface
+ */
+typedef struct backend_stats
+{
+    /** The interface, or NULL if the slot is free. Set once and never cleared. */
+    mmsm_backend_intf_t *intf;
+    /** The counters */
+    mmsm_stats_counters_t counters;
+} backend_stats_t;
+
+static backend_stats_t backend_stats[ENGINE_STATS_MAX_BACKENDS];
+
+void engine_histogram_record(mmsm_histogram_t *histogram, uint64_t us)
+{
+    unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    uint64_t max = __atomic_load_n(&histogram->max_us, __ATOMIC_RELAXED);
+
+    if (bucket >= MMSM_HISTOGRAM_BUCKETS)
+        bucket = MMSM_HISTOGRAM_BUCKETS - 1;
+
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum_us, us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    while (us > max &&
+           !__atomic_compare_exchange_n(&histogram->max_us, &max, us, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void engine_histogram_read(mmsm_histogram_t *dst, const mmsm_histogram_t *src)
+{
+    unsigned int i;
+
+    dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum_us = __atomic_load_n(&src->sum_us, __ATOMIC_RELAXED);
+    dst->max_us = __atomic_load_n(&src->max_us, __ATOMIC_RELAXED);
+    for (i = 0; i < MMSM_HISTOGRAM_BUCKETS; i++)
+        dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+}
+
+void engine_stats_counters_read(mmsm_stats_counters_t *dst, const mmsm_stats_counters_t *src)
+{
+    engine_histogram_read(&dst->request_us, &src->request_us);
+    engine_histogram_read(&dst->callback_us, &src->callback_us);
+    engine_histogram_read(&dst->lag_us, &src->lag_us);
+    dst->errors = __atomic_load_n(&src->errors, __ATOMIC_RELAXED);
+    dst->deadline_misses = __atomic_load_n(&src->deadline_misses, __ATOMIC_RELAXED);
+}
+
+mmsm_stats_counters_t *engine_backend_stats(mmsm_backend_intf_t *intf)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(backend_stats); i++)
+    {
+        mmsm_backend_intf_t *slot_intf = __atomic_load_n(&backend_stats[i].intf,
+                                                         __ATOMIC_ACQUIRE);
+
+        if (slot_intf == intf)
+            return &backend_stats[i].counters;
+
+        /* Claim the first free slot, unless another thread claims it first */
+        if (!slot_intf &&
+            (__atomic_compare_exchange_n(&backend_stats[i].intf, &slot_intf, intf, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+             slot_intf == intf))
+        {
+            return &backend_stats[i].counters;
+        }
+    }
+
+    return NULL;
+}
+
+unsigned int engine_backend_index(mmsm_backend_intf_t *intf)
+{
+    mmsm_stats_counters_t *counters = engine_backend_stats(intf);
+
+    if (!counters)
+        return ENGINE_STATS_MAX_BACKENDS;
+
+    return container_of(counters, backend_stats_t, counters) - backend_stats;
+}
+
+size_t engine_backend_stats_read(mmsm_stats_entry_t *entries, size_t max_entries)
+{
+    size_t n = 0;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(backend_stats) && n < max_entries; i++)
+    {
+        mmsm_backend_intf_t *intf = __atomic_load_n(&backend_stats[i].intf, __ATOMIC_ACQUIRE);
+
+        if (!intf)
+            break;
+
+        memset(&entries[n], 0, sizeof(entries[n]));
+        entries[n].type = MMSM_STATS_BACKEND;
+        entries[n].intf = intf;
+        engine_stats_counters_read(&entries[n].counters, &backend_stats[i].counters);
+        n++;
+    }
+
+    return n;
+}
+
+uint64_t mmsm_histogram_percentile_us(const mmsm_histogram_t *histogram, unsigned int percent)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    unsigned int i;
+
+    if (!histogram->count)
+        return 0;
+
+    if (percent > 100)
+        percent = 100;
+
+    /* The rank of the percentile, rounded up so that e.g. p50 of 1 sample is that sample */
+    target = (histogram->count * percent + 99) / 100;
+    if (!target)
+        target = 1;
+
+    for (i = 0; i < MMSM_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= target)
+            break;
+    }
+
+    if (i >= MMSM_HISTOGRAM_BUCKETS - 1)
+        return histogram->max_us;
+
+    return MIN((1ull << i) - 1, histogram->max_us);
+}
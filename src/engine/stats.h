@@ -0,0 +1,85 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "smart_manager.h"
+
+/**
+ * Engine-internal counters, see @ref mmsm_get_stats.
+ *
+ * Counters are updated with relaxed atomics from whichever thread makes the request or runs the
+ * callback, and read the same way, so a snapshot may be slightly inconsistent between fields but
+ * never needs a lock.
+ */
+
+/** Maximum number of backend interfaces counters are kept for */
+#define ENGINE_STATS_MAX_BACKENDS (32)
+
+/**
+ * @brief Get the current CLOCK_MONOTONIC time in microseconds
+ */
+static inline uint64_t engine_stats_now_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Increment a counter
+ */
+static inline void engine_stats_inc(uint64_t *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Record a duration in a histogram
+ *
+ * @param histogram The histogram
+ * @param us The duration in microseconds
+ */
+void engine_histogram_record(mmsm_histogram_t *histogram, uint64_t us);
+
+/**
+ * @brief Copy a set of counters that may be being updated
+ *
+ * @param dst Where to copy to
+ * @param src The counters
+ */
+void engine_stats_counters_read(mmsm_stats_counters_t *dst, const mmsm_stats_counters_t *src);
+
+/**
+ * @brief Get the counters of a backend interface, creating them on first use
+ *
+ * @param intf The interface
+ * @return the counters, or NULL if counters are already kept for
+ *         @ref ENGINE_STATS_MAX_BACKENDS other interfaces
+ */
+mmsm_stats_counters_t *engine_backend_stats(mmsm_backend_intf_t *intf);
+
+/**
+ * @brief Get the position of a backend interface among those counters are kept for, which is
+ *        the order they were first used in
+ *
+ * @param intf The interface
+ * @return the position, or @ref ENGINE_STATS_MAX_BACKENDS if no counters are kept for it
+ */
+unsigned int engine_backend_index(mmsm_backend_intf_t *intf);
+
+/**
+ * @brief Fill in entries for every backend interface counters are kept for
+ *
+ * @param entries Entries to fill in
+ * @param max_entries Number of entries there is space for
+ * @return the number of entries filled in
+ */
+size_t engine_backend_stats_read(mmsm_stats_entry_t *entries, size_t max_entries);
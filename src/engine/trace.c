@@ -0,0 +1,182 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "logging.h"
+
+#define TRACE_MASK (TRACE_RECORDS - 1)
+
+_Static_assert((TRACE_RECORDS & TRACE_MASK) == 0, "TRACE_RECORDS must be a power of 2");
+_Static_assert(sizeof(trace_record_t) == 32, "trace records must stay compact");
+
+/** The ring, and the number of records written to it so far */
+static trace_record_t trace_ring[TRACE_RECORDS];
+static uint64_t trace_head;
+
+/*
+ * Where the ring is dumped to, written through a temporary file so a dump never leaves a partial
+ * one behind. Set before the signal handler is installed and never changed after, so the handler
+ * can read them as they are.
+ */
+static char trace_path[256];
+static char trace_tmp_path[sizeof(trace_path) + 4];
+
+static __thread uint32_t trace_tid;
+
+static uint64_t trace_clock_us(clockid_t clock)
+{
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+void trace_record(uint8_t source, uint8_t type, uint16_t id, uint32_t arg, uint32_t value)
+{
+    uint64_t seq = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_record_t *record = &trace_ring[seq & TRACE_MASK];
+
+    if (!trace_tid)
+        trace_tid = (uint32_t)syscall(SYS_gettid);
+
+    /*
+     * Mark the slot as being written before overwriting it, so a dump taken meanwhile can tell
+     * the record is torn rather than mistaking it for the one it replaces.
+     */
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->time_us = trace_clock_us(CLOCK_MONOTONIC);
+    record->tid = trace_tid;
+    record->source = source;
+    record->type = type;
+    record->id = id;
+    record->arg = arg;
+    record->value = value;
+
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t trace_begin(uint8_t source, uint16_t id, uint32_t arg)
+{
+    trace_record(source, TRACE_REQUEST_START, id, arg, 0);
+    return trace_clock_us(CLOCK_MONOTONIC);
+}
+
+uint32_t trace_end(uint8_t source, uint16_t id, uint32_t err, uint64_t started_us)
+{
+    uint64_t latency_us = trace_clock_us(CLOCK_MONOTONIC) - started_us;
+    uint32_t value = latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_us;
+
+    trace_record(source, TRACE_REQUEST_END, id, err, value);
+    return value;
+}
+
+uint32_t trace_name(const char *name)
+{
+    uint32_t packed = 0;
+
+    for (int i = 0; i < 4 && name[i] && name[i] != ' '; i++)
+        packed |= (uint32_t)(uint8_t)name[i] << (8 * i);
+
+    return packed;
+}
+
+static void trace_signal_handler(int sig)
+{
+    int saved_errno = errno;
+
+    (void)sig;
+    trace_dump();
+    errno = saved_errno;
+}
+
+void trace_set_file(const char *path)
+{
+    struct sigaction action;
+
+    if (trace_path[0] || !path || !path[0])
+        return;
+
+    if (strlen(path) >= sizeof(trace_path))
+    {
+        LOG_WARN("Trace file path %s is too long, not dumping the trace\n", path);
+        return;
+    }
+
+    snprintf(trace_path, sizeof(trace_path), "%s", path);
+    snprintf(trace_tmp_path, sizeof(trace_tmp_path), "%s.tmp", path);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = trace_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR1, &action, NULL))
+        LOG_WARN("Failed to install the trace dump handler: %s\n", strerror(errno));
+}
+
+/*
+ * Only async-signal-safe calls from here on, as this runs from the signal handler and on failed
+ * assertions, with whatever locks held.
+ */
+void trace_dump(void)
+{
+    trace_header_t header;
+    const char *buf;
+    size_t left;
+    int fd;
+
+    if (!trace_path[0])
+        return;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(trace_record_t);
+    header.num_records = TRACE_RECORDS;
+    header.next_seq = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE) + 1;
+    header.monotonic_us = trace_clock_us(CLOCK_MONOTONIC);
+    header.realtime_us = trace_clock_us(CLOCK_REALTIME);
+
+    fd = open(trace_tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+        goto fail;
+
+    /* Records still being written are copied as they are, to be told apart by their seq */
+    buf = (const char *)trace_ring;
+    left = sizeof(trace_ring);
+    while (left)
+    {
+        ssize_t n = write(fd, buf, left);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            goto fail;
+        buf += n;
+        left -= n;
+    }
+
+    close(fd);
+    rename(trace_tmp_path, trace_path);
+    return;
+
+fail:
+    close(fd);
+    unlink(trace_tmp_path);
+}
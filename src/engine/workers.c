@@ -0,0 +1,186 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "workers.h"
+#include "utils.h"
+#include "logging.h"
+
+/**
+ * A FIFO of work items served by one or more threads.
+ */
+typedef struct worker_queue
+{
+    /** Protects the queue contents */
+    pthread_mutex_t mutex;
+    /** Signalled when work is added or the pool is stopping */
+    pthread_cond_t cond;
+    /** First item to run */
+    worker_item_t *head;
+    /** Last item queued */
+    worker_item_t *tail;
+    /** Set when the serving threads should exit once the queue is empty */
+    bool stopping;
+} worker_queue_t;
+
+/**
+ * A worker thread
+ */
+typedef struct worker_thread
+{
+    /** The thread */
+    pthread_t thread;
+    /** The queue this thread takes work from */
+    worker_queue_t *queue;
+} worker_thread_t;
+
+struct worker_pool
+{
+    /** Name used in logs */
+    const char *name;
+    /** Number of entries in @ref threads */
+    unsigned int num_threads;
+    /** Number of entries in @ref queues (either 1 or @ref num_threads) */
+    unsigned int num_queues;
+    /** The worker threads */
+    worker_thread_t *threads;
+    /** The work queues */
+    worker_queue_t *queues;
+};
+
+static void *
+worker_thread_fn(void *arg)
+{
+    worker_thread_t *worker = (worker_thread_t *)arg;
+    worker_queue_t *queue = worker->queue;
+
+    MMSM_ASSERT(pthread_mutex_lock(&queue->mutex) == 0);
+    while (1)
+    {
+        worker_item_t *item = queue->head;
+
+        if (!item)
+        {
+            if (queue->stopping)
+                break;
+
+            MMSM_ASSERT(pthread_cond_wait(&queue->cond, &queue->mutex) == 0);
+            continue;
+        }
+
+        queue->head = item->next;
+        if (!queue->head)
+            queue->tail = NULL;
+        item->next = NULL;
+
+        MMSM_ASSERT(pthread_mutex_unlock(&queue->mutex) == 0);
+        item->fn(item);
+        MMSM_ASSERT(pthread_mutex_lock(&queue->mutex) == 0);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&queue->mutex) == 0);
+
+    return NULL;
+}
+
+worker_pool_t *
+worker_pool_create(const char *name, unsigned int num_threads, bool per_thread_queues)
+{
+    worker_pool_t *pool;
+    unsigned int i;
+
+    MMSM_ASSERT(num_threads > 0);
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->name = name;
+    pool->num_threads = num_threads;
+    pool->num_queues = per_thread_queues ? num_threads : 1;
+    pool->threads = calloc(pool->num_threads, sizeof(*pool->threads));
+    pool->queues = calloc(pool->num_queues, sizeof(*pool->queues));
+    if (!pool->threads || !pool->queues)
+    {
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+
+    for (i = 0; i < pool->num_queues; i++)
+    {
+        MMSM_ASSERT(pthread_mutex_init(&pool->queues[i].mutex, NULL) == 0);
+        MMSM_ASSERT(pthread_cond_init(&pool->queues[i].cond, NULL) == 0);
+    }
+
+    for (i = 0; i < pool->num_threads; i++)
+    {
+        pool->threads[i].queue = &pool->queues[i % pool->num_queues];
+        MMSM_ASSERT(pthread_create(&pool->threads[i].thread, NULL,
+                                   worker_thread_fn, &pool->threads[i]) == 0);
+    }
+
+    LOG_DEBUG("Started %s pool with %u threads, %u queues\n",
+              name, pool->num_threads, pool->num_queues);
+
+    return pool;
+}
+
+void
+worker_pool_submit(worker_pool_t *pool, uintptr_t key, worker_item_t *item)
+{
+    worker_queue_t *queue;
+
+    /* Pointers used as keys are aligned, so mix the upper bits in before picking a queue */
+    key ^= key >> 7;
+    queue = &pool->queues[key % pool->num_queues];
+
+    item->next = NULL;
+
+    MMSM_ASSERT(pthread_mutex_lock(&queue->mutex) == 0);
+    if (queue->tail)
+        queue->tail->next = item;
+    else
+        queue->head = item;
+    queue->tail = item;
+    MMSM_ASSERT(pthread_cond_signal(&queue->cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&queue->mutex) == 0);
+}
+
+void
+worker_pool_destroy(worker_pool_t *pool)
+{
+    unsigned int i;
+
+    if (!pool)
+        return;
+
+    for (i = 0; i < pool->num_queues; i++)
+    {
+        MMSM_ASSERT(pthread_mutex_lock(&pool->queues[i].mutex) == 0);
+        pool->queues[i].stopping = true;
+        MMSM_ASSERT(pthread_cond_broadcast(&pool->queues[i].cond) == 0);
+        MMSM_ASSERT(pthread_mutex_unlock(&pool->queues[i].mutex) == 0);
+    }
+
+    for (i = 0; i < pool->num_threads; i++)
+    {
+        MMSM_ASSERT(pthread_join(pool->threads[i].thread, NULL) == 0);
+    }
+
+    for (i = 0; i < pool->num_queues; i++)
+    {
+        pthread_mutex_destroy(&pool->queues[i].mutex);
+        pthread_cond_destroy(&pool->queues[i].cond);
+    }
+
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
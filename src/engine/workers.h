@@ -0,0 +1,71 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Engine-internal worker thread pool.
+ *
+ * Work items are embedded in the structure that owns the work (e.g. a polling monitor) and are
+ * queued with @ref worker_pool_submit. A pool can be created with a single queue shared by every
+ * thread, or with one queue per thread so that work submitted with the same key always runs on the
+ * same thread, in order.
+ */
+
+struct worker_item;
+
+/**
+ * Function called on a worker thread to run a work item.
+ */
+typedef void (*worker_fn_t)(struct worker_item *item);
+
+/**
+ * A unit of work. Embed this in the structure that owns the work.
+ */
+typedef struct worker_item
+{
+    /** The function to run */
+    worker_fn_t fn;
+    /** Queue link, owned by the pool while queued */
+    struct worker_item *next;
+} worker_item_t;
+
+typedef struct worker_pool worker_pool_t;
+
+/**
+ * @brief Create and start a worker pool
+ *
+ * @param name Name of the pool, used for logging
+ * @param num_threads Number of worker threads to start
+ * @param per_thread_queues If true, each thread gets its own queue and work is assigned to a
+ *                          thread by the key passed to @ref worker_pool_submit. Otherwise all
+ *                          threads take work from one shared queue.
+ * @return the pool, or NULL on failure
+ */
+worker_pool_t *worker_pool_create(const char *name, unsigned int num_threads,
+                                  bool per_thread_queues);
+
+/**
+ * @brief Queue a work item on the pool
+ *
+ * @param pool Pool to queue on
+ * @param key Used to pick a queue when the pool has per-thread queues. Work submitted with the
+ *            same key runs on the same thread in submission order. Ignored otherwise.
+ * @param item Work item to queue. Must not already be queued.
+ */
+void worker_pool_submit(worker_pool_t *pool, uintptr_t key, worker_item_t *item);
+
+/**
+ * @brief Stop a worker pool and free it
+ *
+ * Work that has already been queued is run before the threads exit. Any work item that is running
+ * when this is called is allowed to complete.
+ *
+ * @param pool Pool to destroy. NULL is ignored.
+ */
+void worker_pool_destroy(worker_pool_t *pool);
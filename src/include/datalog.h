@@ -9,8 +9,46 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <libconfig.h>
 
+#include "list.h"
+
+/** Magic at the start of a binary datalog, see @ref datalog_init_columns */
+#define DATALOG_BINARY_MAGIC "MMSMDLOG"
+
+/** Version of the binary datalog format */
+#define DATALOG_BINARY_VERSION (1)
+
+/** Most columns a binary datalog may have */
+#define DATALOG_BINARY_MAX_FIELDS (32)
+
+/**
+ * Layout of a binary datalog, see @ref datalog_init_columns, and where to find it once read back
+ * with @ref datalog_binary_open
+ */
+struct datalog_binary
+{
+    /** Number of columns */
+    uint16_t n_fields;
+    /** Column types, n_fields long and not NUL terminated */
+    const char *fmt;
+    /** Column headings, NUL terminated */
+    const char *heading;
+    /** Time the first record's 't' columns are relative to, in ms since the epoch */
+    uint64_t base_ms;
+    /** Offset of each column within a record */
+    uint16_t offset[DATALOG_BINARY_MAX_FIELDS];
+    /** Length of each record */
+    uint32_t record_len;
+    /** The first 't' column, which marks rebase records, or -1 if there is none */
+    int rebase_field;
+    /** The first record */
+    const uint8_t *records;
+    /** Number of whole records, including rebase records */
+    size_t n_records;
+};
+
 /**
  * @brief Data log object
  *
@@ -28,6 +66,87 @@ struct datalog
         /** Number of fields in each CSV line */
         uint16_t n_fields;
     } csv;
+
+    /** Binary format specific params, see @ref datalog_init_columns */
+    struct
+    {
+        /** Whether the datalog's "format" is "binary" */
+        bool requested;
+        /** Whether records are written in the binary format */
+        bool enabled;
+        /** Column types, as given to @ref datalog_init_columns */
+        char fmt[DATALOG_BINARY_MAX_FIELDS + 1];
+        /** Layout of the records written */
+        struct datalog_binary layout;
+        /** Time of each 't' column in the last record, in ms since the epoch */
+        uint64_t last_ms[DATALOG_BINARY_MAX_FIELDS];
+        /** Serialises encoding records, so their deltas apply in the order they are written */
+        pthread_mutex_t mutex;
+    } binary;
+
+    /** Headings given when initialised, written again at the start of each segment */
+    char *heading;
+
+    /** Rotation of the file, see "max_size_kb" and "max_age_s" in the datalog config */
+    struct
+    {
+        /** Path of the file */
+        char path[256];
+        /** Size in bytes the file is rotated at, or 0 for no limit */
+        uint64_t max_size;
+        /** Time in ms after which the file is rotated, or 0 for no limit */
+        uint64_t max_age_ms;
+        /** Bytes written to the file, including those queued for the writer thread */
+        uint64_t size;
+        /** When the file was started, see @ref timestamp_monotonic_ms */
+        uint64_t started_ms;
+        /** Number of the next segment the file is rotated to, "<path>.<segment>" */
+        unsigned int segment;
+        /** Set while a thread queues a rotation for the writer thread */
+        bool rotating;
+    } rotate;
+
+    /**
+     * Which messages @ref datalog_sample lets through, see "sample_every", "max_rate",
+     * "commands" and "exclude_commands" in the datalog config
+     */
+    struct
+    {
+        /** Only every Nth message is let through, or all of them if 0 or 1 */
+        unsigned int every;
+        /** Messages counted towards sampling */
+        uint64_t count;
+        /** Messages let through per second, or 0 for no limit */
+        unsigned int max_rate;
+        /** Messages let through in a burst, above max_rate */
+        unsigned int burst;
+        /** Messages that can be let through now, in millionths of a message */
+        uint64_t tokens;
+        /** When tokens were last added, see @ref timestamp_monotonic_ms */
+        uint64_t refilled_ms;
+        /** The only commands let through, or NULL for any */
+        char **commands;
+        int n_commands;
+        /** Commands never let through */
+        char **exclude;
+        int n_exclude;
+        /** Messages not let through by sampling and the rate limit */
+        uint64_t skipped;
+        /** Serialises the rate limit */
+        pthread_mutex_t mutex;
+    } sample;
+
+    /** Whether records are written by the writer thread, see "async" in the datalog config */
+    bool async;
+
+    /** Records dropped because the writer thread's queue was full */
+    uint64_t dropped;
+
+    /** Set by the writer thread when it has written to the file since flushing it */
+    bool dirty;
+
+    /** Entry in the writer thread's list of datalogs */
+    list_entry_t list;
 };
 
 /**
@@ -38,6 +157,17 @@ struct datalog
  */
 struct datalog *datalog_create(char *name);
 
+/**
+ * Create data log file for one of several instances of the same datalog, eg. one per interface
+ *
+ * The datalog is enabled by name, like @ref datalog_create, and written to "<name>_<instance>.log"
+ *
+ * @param name Log file name
+ * @param instance Instance name, or NULL for the same file as @ref datalog_create
+ * @return datalog object
+ */
+struct datalog *datalog_create_instance(char *name, const char *instance);
+
 /**
  * Set the root directory for datalog files
  *
@@ -51,6 +181,25 @@ void datalog_set_root_dir(const char *path);
  * Config setting should be a config object with children in the form
  *      "<datalog name>/enabled = <bool>"
  *
+ * If "async" is set, datalogs created from then on are written by a background thread: writing
+ * a record only formats it and queues it, and the thread writes out every record queued each
+ * "flush_interval_ms", or sooner once the queue of "queue_size" records is half full. Records
+ * that don't fit in the queue are dropped, see @ref datalog_get_dropped.
+ *
+ * A datalog with "max_size_kb" or "max_age_s" set is rotated once its file reaches that size or
+ * age: the file is renamed to "<file>.<n>", numbered from 1, and a new one started, with the
+ * headings written again. A background thread then compresses the segments rotated out to
+ * "<file>.<n>.gz", unless "compress" is false, and applies "max_total_kb", a disk budget for
+ * everything under the root directory, by deleting the oldest segments and the datalogs of
+ * earlier runs.
+ *
+ * "sample_every", "max_rate", "burst", "commands" and "exclude_commands" limit the messages
+ * of a datalog written, see @ref datalog_sample.
+ *
+ * May be called again with a reloaded config. "flush_interval_ms", "max_total_kb" and
+ * "compress" then apply straight away, the rest only to the datalogs created after. The config
+ * must be kept until the last datalog has been created with it.
+ *
  * @param config pointer to config setting
  */
 void datalog_set_config_settings(config_setting_t *config);
@@ -90,6 +239,48 @@ bool datalog_write_string(struct datalog *dl, const char *str, ...);
  */
 bool datalog_init_csv(struct datalog* dl, const char *heading);
 
+/**
+ * @brief Initialise a datalog to output records of typed columns, as CSV values or, if the
+ * datalog's "format" is "binary" in the datalog config, in the binary format.
+ *
+ * Like @ref datalog_init_csv, but with the type of each column given up front, as the format
+ * string @ref datalog_write_csv is then called with. Only the fixed width types are allowed.
+ *
+ *      datalog_init_columns(datalog, "time,value_one,value_two", "tuu");
+ *      datalog_write_csv(datalog, "tuu", &now, 5, 3);
+ *
+ * A binary datalog, all little endian, starts with a header:
+ *
+ *      char magic[8]           DATALOG_BINARY_MAGIC
+ *      uint16_t version        DATALOG_BINARY_VERSION
+ *      uint16_t n_fields       Number of columns
+ *      uint32_t header_len     Bytes from the start of the file to the first record
+ *      uint64_t base_ms        Time the first record's 't' columns are relative to
+ *      char fmt[n_fields]      Column types
+ *      char heading[]          Column headings, NUL terminated, as given here
+ *
+ * padded with zeros to a multiple of 8 bytes. Then come the records, each column in turn:
+ *      u - uint32_t
+ *      d - int32_t
+ *      b - uint8_t, 0 or 1
+ *      t - int32_t, ms since the same column of the previous record, or since base_ms for the
+ *          first record
+ * Records with a 't' column are padded with zeros to at least 12 bytes. Empty fields, '0', are
+ * written as 0. A record left partly written at the end of the file is ignored, see
+ * @ref datalog_binary_open.
+ *
+ * When the clock steps by more than a delta can hold, eg. when it is first set, a rebase
+ * record is written before the next record. It holds INT32_MIN in the first 't' column, and the
+ * time every 't' column of the next record is then relative to as a uint64_t, in the bytes of
+ * the record before and after that column, see @ref datalog_binary_is_rebase.
+ *
+ * @param dl The datalogger
+ * @param heading csv field headings
+ * @param fmt Type of each field, one per heading, as for @ref datalog_write_csv
+ * @return true Successfully set, else false
+ */
+bool datalog_init_columns(struct datalog *dl, const char *heading, const char *fmt);
+
 /**
  * @brief Write a csv line to the datalogger.
  *
@@ -104,7 +295,9 @@ bool datalog_init_csv(struct datalog* dl, const char *heading);
  *      t - timestamp in ISO format (argument is pointer to timestamp_t)
  *      0 - this field is empty and is not included in the argument list
  *
- * Datalogger must have had its fields initialised prior to calling this function.
+ * Datalogger must have had its fields initialised prior to calling this function. If it was
+ * initialised with @ref datalog_init_columns, the format string must match the one given then,
+ * except for empty fields.
  *
  * @param dl The datalogger
  * @param fmt CSV format string
@@ -122,9 +315,69 @@ bool datalog_write_csv(struct datalog* dl, const char *fmt, ...);
  */
 bool datalog_write_data(struct datalog *dl, uint8_t *data, uint32_t size);
 
+/**
+ * @brief Decide whether to write a message of a high volume datalog, eg. a backend's requests
+ *
+ * Applies the datalog's "commands" and "exclude_commands" filters, then its 1 in "sample_every"
+ * sampling and "max_rate" rate limit. Call it once per message, and write all of the message's
+ * records, eg. a request and its reply, only if it returns true. Records written without
+ * calling it are always written.
+ *
+ * @param dl The datalogger
+ * @param key The message's command. Only its first word is matched against the filters.
+ * @return true if the message should be written, false if not or the datalog is disabled
+ */
+bool datalog_sample(struct datalog *dl, const char *key);
+
+/**
+ * Get the number of records dropped because the writer thread couldn't keep up
+ *
+ * @param dl The datalogger
+ * @return the number of records dropped, always 0 unless the datalog is async
+ */
+uint64_t datalog_get_dropped(struct datalog *dl);
+
+/**
+ * @brief Read the header of a binary datalog, eg. one mapped from a file. Records are then read
+ * in place, with @ref datalog_binary_get.
+ *
+ * @param bin Set to describe the datalog, pointing into @p data
+ * @param data The datalog
+ * @param len Length of @p data
+ * @return true if @p data is a binary datalog of a supported version, else false
+ */
+bool datalog_binary_open(struct datalog_binary *bin, const void *data, size_t len);
+
+/**
+ * @brief Check whether a record of a binary datalog is a rebase record, which isn't a record
+ * written but resets the times the next record is relative to.
+ *
+ * @param bin The datalog
+ * @param record The record
+ * @param time_ms If a rebase record, set to the time every 't' column of the next record is
+ *                relative to, in ms since the epoch
+ * @return true if a rebase record
+ */
+bool datalog_binary_is_rebase(const struct datalog_binary *bin, const uint8_t *record,
+                              uint64_t *time_ms);
+
+/**
+ * @brief Get a field of a binary datalog record
+ *
+ * @param bin The datalog
+ * @param record The record
+ * @param field Index of the column
+ * @return the field, sign extended for 'd' and 't' columns. For 't' columns, this is the time
+ *         since the same column of the previous record, in ms, or since the time of a rebase
+ *         record just before.
+ */
+int64_t datalog_binary_get(const struct datalog_binary *bin, const uint8_t *record, int field);
+
 /**
  * Close the datalog
  *
+ * Records written to an async datalog before closing it are written out first.
+ *
  * @param dl The datalogger
  */
 bool datalog_close(struct datalog *dl);
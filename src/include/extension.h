@@ -0,0 +1,48 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <libconfig.h>
+
+/**
+ * Extensions are shared objects named <name>.mmext, looked for in each of the directories of the
+ * "module_dirs" config setting in turn, then in the current working directory.
+ *
+ * Smart Manager loads its modules as extensions, and modules may load extensions of their own,
+ * such as DCS algorithms. Extensions are opened with RTLD_GLOBAL, so an extension can use the
+ * functions of the module that loaded it.
+ */
+
+/**
+ * @brief Find and open an extension
+ *
+ * @param module_dirs "module_dirs" config setting, an array of directories, or NULL to only look
+ *                    in the current working directory
+ * @param name Name of the extension, without the .mmext suffix
+ * @param symbol Name of a symbol the extension must export. Libraries that are named alike but
+ *               don't export it are skipped.
+ * @param value Set to the address of @p symbol
+ * @return Handle of the extension, to close with @ref mmsm_extension_close, or NULL if it wasn't
+ *         found
+ */
+void *mmsm_extension_open(config_setting_t *module_dirs, const char *name, const char *symbol,
+                          void **value);
+
+/**
+ * @brief Look up a symbol of an open extension
+ *
+ * @param handle Handle of the extension
+ * @param symbol Name of the symbol
+ * @return the address of the symbol, or NULL if the extension doesn't export it
+ */
+void *mmsm_extension_symbol(void *handle, const char *symbol);
+
+/**
+ * @brief Close an extension, once nothing it provides is used any more
+ *
+ * @param handle Handle of the extension, or NULL
+ */
+void mmsm_extension_close(void *handle);
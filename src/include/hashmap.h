@@ -3,11 +3,15 @@
  * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
  *
  * hashmap.h - Generic hashmap utility
- * Supports key size in bytes, built-in hash and compare functions.
+ * Open addressing with linear probing over a power-of-two table that grows as entries are
+ * added. The map holds pointers to caller-owned entries and reads their keys through a get_key
+ * function. Keys are a fixed number of bytes by default, hashed and compared as raw memory, but
+ * both functions can be replaced, e.g. for string keys.
  */
 
 #pragma once
 
+#include <errno.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
@@ -15,28 +19,159 @@
 #include <string.h>
 #include "utils.h"
 
-#define DEFAULT_HASH_VAL    0x12345
-#define DEFAULT_HASH_MUL    8
+/** Smallest number of slots a map has */
+#define HASHMAP_MIN_SLOTS   (8)
+
+/** The map grows once more than this many eighths of its slots are in use */
+#define HASHMAP_MAX_LOAD_8THS   (6)
+
+/**
+ * Gets the key of an entry
+ */
+typedef const void *(*hashmap_get_key_fn_t)(const void *entry);
+
+/**
+ * Hashes a key. key_size is the map's key size.
+ */
+typedef uint64_t (*hashmap_hash_fn_t)(const void *key, size_t key_size);
+
+/**
+ * Compares two keys. key_size is the map's key size.
+ */
+typedef bool (*hashmap_equal_fn_t)(const void *key, const void *entry_key, size_t key_size);
+
+/**
+ * A slot of the table
+ */
+typedef struct hashmap_slot
+{
+    /** The entry, or NULL if the slot is free */
+    void *entry;
+    /** The entry's hash, so most mismatches are rejected without comparing keys */
+    uint64_t hash;
+} hashmap_slot_t;
 
 typedef struct hashmap
 {
-    list_head_t *buckets;
-    size_t size;           /* Number of buckets */
-    size_t key_size;       /* Key size in bytes */
+    hashmap_slot_t *slots;
+    size_t mask;            /* Number of slots - 1 */
+    size_t count;           /* Number of entries */
+    size_t key_size;        /* Key size in bytes, passed to the key functions */
+    hashmap_get_key_fn_t get_key;
+    hashmap_hash_fn_t hash_fn;
+    hashmap_equal_fn_t equal_fn;
 } hashmap_t;
 
-/* Default hash function */
-static inline uint32_t hashmap_calc_hash(const void *key, size_t key_size)
+static inline uint64_t hashmap_mum(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hashmap_read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hashmap_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Hash bytes. A wyhash-style hash: every input byte affects every output bit, and short
+ *        keys take only a couple of multiplies.
+ *
+ * @param key Bytes to hash
+ * @param len Number of bytes
+ * @param seed Seed, to get independent hashes of the same bytes
+ * @return the hash
+ */
+static inline uint64_t hashmap_hash_bytes(const void *key, size_t len, uint64_t seed)
 {
-    uint32_t hash = DEFAULT_HASH_VAL;
-    const uint8_t *bytes = (const uint8_t *)key;
+    static const uint64_t s0 = 0xa0761d6478bd642full;
+    static const uint64_t s1 = 0xe7037ed1a0b428dbull;
+    static const uint64_t s2 = 0x8ebc6af09c88c6e3ull;
+    static const uint64_t s3 = 0x589965cc75374cc3ull;
+    const uint8_t *p = (const uint8_t *)key;
+    __uint128_t r;
+    uint64_t a;
+    uint64_t b;
 
-    for (size_t i = 0; i < key_size; i++)
+    seed ^= hashmap_mum(seed ^ s0, s1);
+
+    if (len <= 16)
     {
-        hash ^= bytes[i];
-        hash *= DEFAULT_HASH_MUL;
+        if (len >= 4)
+        {
+            a = (hashmap_read32(p) << 32) | hashmap_read32(p + ((len >> 3) << 2));
+            b = (hashmap_read32(p + len - 4) << 32) |
+                hashmap_read32(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
     }
-    return hash;
+    else
+    {
+        size_t i = len;
+
+        if (i > 48)
+        {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+
+            do
+            {
+                seed = hashmap_mum(hashmap_read64(p) ^ s1, hashmap_read64(p + 8) ^ seed);
+                see1 = hashmap_mum(hashmap_read64(p + 16) ^ s2, hashmap_read64(p + 24) ^ see1);
+                see2 = hashmap_mum(hashmap_read64(p + 32) ^ s3, hashmap_read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16)
+        {
+            seed = hashmap_mum(hashmap_read64(p) ^ s1, hashmap_read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        a = hashmap_read64(p + i - 16);
+        b = hashmap_read64(p + i - 8);
+    }
+
+    r = (__uint128_t)(a ^ s1) * (b ^ seed);
+    return hashmap_mum((uint64_t)r ^ s0 ^ len, (uint64_t)(r >> 64) ^ s1);
+}
+
+/* Default hash function */
+static inline uint64_t hashmap_hash_default(const void *key, size_t key_size)
+{
+    return hashmap_hash_bytes(key, key_size, 0);
+}
+
+/* 32-bit hash of bytes, for callers that store hashes in their keys */
+static inline uint32_t hashmap_calc_hash(const void *key, size_t key_size)
+{
+    uint64_t hash = hashmap_hash_bytes(key, key_size, 0);
+
+    return (uint32_t)(hash ^ (hash >> 32));
 }
 
 /* Default comparison: memory match */
@@ -46,35 +181,137 @@ static inline bool hashmap_key_equal(const void *key, const void *entry_key, siz
 }
 
 /**
- * @brief Initialize the hashmap.
+ * @brief Initialize the hashmap with custom key functions.
  *
  * @param map Pointer to hashmap struct
- * @param size Number of buckets
- * @param key_size Size of key in bytes
+ * @param capacity Number of entries to make room for up front. The map grows beyond this.
+ * @param key_size Size of key in bytes, passed to the key functions
+ * @param get_key Function to get the key of an entry
+ * @param hash_fn Function to hash a key
+ * @param equal_fn Function to compare keys
+ * @return 0 on success, or -ENOMEM
  */
-static inline void hashmap_init(hashmap_t *map, size_t size, size_t key_size)
+static inline int hashmap_init_custom(hashmap_t *map, size_t capacity, size_t key_size,
+                                      hashmap_get_key_fn_t get_key, hashmap_hash_fn_t hash_fn,
+                                      hashmap_equal_fn_t equal_fn)
 {
-    map->size = size;
+    size_t size = HASHMAP_MIN_SLOTS;
+
+    while (size * HASHMAP_MAX_LOAD_8THS / 8 < capacity)
+        size <<= 1;
+
+    map->slots = (hashmap_slot_t *)calloc(size, sizeof(*map->slots));
+    map->mask = size - 1;
+    map->count = 0;
     map->key_size = key_size;
-    map->buckets = (list_head_t *)calloc(size, sizeof(list_head_t));
-    for (size_t i = 0; i < size; ++i)
+    map->get_key = get_key;
+    map->hash_fn = hash_fn;
+    map->equal_fn = equal_fn;
+
+    return map->slots ? 0 : -ENOMEM;
+}
+
+/**
+ * @brief Initialize the hashmap with the default key functions, which hash and compare the
+ *        key_size bytes of each key.
+ *
+ * @param map Pointer to hashmap struct
+ * @param capacity Number of entries to make room for up front. The map grows beyond this.
+ * @param key_size Size of key in bytes
+ * @param get_key Function to get the key of an entry
+ * @return 0 on success, or -ENOMEM
+ */
+static inline int hashmap_init(hashmap_t *map, size_t capacity, size_t key_size,
+                               hashmap_get_key_fn_t get_key)
+{
+    return hashmap_init_custom(map, capacity, key_size, get_key, hashmap_hash_default,
+                               hashmap_key_equal);
+}
+
+/**
+ * Puts an entry in the first free slot of its probe sequence. The map must have a free slot.
+ */
+static inline void hashmap_place(hashmap_t *map, void *entry, uint64_t hash)
+{
+    size_t i = hash & map->mask;
+
+    while (map->slots[i].entry)
+        i = (i + 1) & map->mask;
+
+    map->slots[i].entry = entry;
+    map->slots[i].hash = hash;
+}
+
+/**
+ * @brief Double the number of slots of the map.
+ *
+ * @param map Pointer to hashmap
+ * @return 0 on success, or -ENOMEM
+ */
+static inline int hashmap_grow(hashmap_t *map)
+{
+    hashmap_slot_t *old = map->slots;
+    size_t old_size = map->mask + 1;
+    size_t i;
+
+    map->slots = (hashmap_slot_t *)calloc(old_size * 2, sizeof(*map->slots));
+    if (!map->slots)
     {
-        list_reset(&map->buckets[i]);
+        map->slots = old;
+        return -ENOMEM;
     }
+
+    map->mask = old_size * 2 - 1;
+    for (i = 0; i < old_size; i++)
+    {
+        if (old[i].entry)
+            hashmap_place(map, old[i].entry, old[i].hash);
+    }
+    free(old);
+
+    return 0;
 }
 
 /**
- * @brief Insert an entry into the hashmap.
+ * @brief Insert an entry into the hashmap. The map does not check for an existing entry with
+ *        the same key; if there is one, lookups find whichever was inserted first.
  *
  * @param map Pointer to hashmap
- * @param key Pointer to key data
- * @param entry Pointer to list_entry embedded in the item
+ * @param entry The entry
+ * @return 0 on success, or -ENOMEM
  */
-static inline void hashmap_insert(hashmap_t *map, const void *key, list_entry_t *entry)
+static inline int hashmap_insert(hashmap_t *map, void *entry)
 {
-    uint32_t index = hashmap_calc_hash(key, map->key_size) % map->size;
+    if ((map->count + 1) * 8 > (map->mask + 1) * HASHMAP_MAX_LOAD_8THS &&
+        hashmap_grow(map) != 0)
+        return -ENOMEM;
 
-    list_add_tail(&map->buckets[index], entry);
+    hashmap_place(map, entry, map->hash_fn(map->get_key(entry), map->key_size));
+    map->count++;
+
+    return 0;
+}
+
+/**
+ * @brief Find the slot holding an entry with a key.
+ *
+ * @return the slot's index, or the map's size if there is none
+ */
+static inline size_t hashmap_find_slot(hashmap_t *map, const void *key)
+{
+    uint64_t hash = map->hash_fn(key, map->key_size);
+    size_t i;
+
+    for (i = hash & map->mask; map->slots[i].entry; i = (i + 1) & map->mask)
+    {
+        if (map->slots[i].hash == hash &&
+            map->equal_fn(key, map->get_key(map->slots[i].entry), map->key_size))
+        {
+            return i;
+        }
+    }
+
+    return map->mask + 1;
 }
 
 /**
@@ -82,33 +319,61 @@ static inline void hashmap_insert(hashmap_t *map, const void *key, list_entry_t
  *
  * @param map Pointer to hashmap
  * @param key Key to search
- * @param get_key_fn Function to extract key from entry
- * @return Pointer to matching list_entry or NULL
+ * @return Pointer to the matching entry or NULL
+ */
+static inline void *hashmap_find(hashmap_t *map, const void *key)
+{
+    size_t i = hashmap_find_slot(map, key);
+
+    return i <= map->mask ? map->slots[i].entry : NULL;
+}
+
+/**
+ * @brief Remove an entry from the hashmap.
+ *
+ * Later entries of the same probe sequence are moved back into the gap, so lookups never need
+ * to skip over removed entries.
+ *
+ * @param map Pointer to hashmap
+ * @param entry Entry to remove
+ * @return true if the entry was in the map
  */
-static inline list_entry_t *hashmap_find(hashmap_t *map, const void *key,
-                        const void *(*get_key_fn)(list_entry_t *entry))
+static inline bool hashmap_remove(hashmap_t *map, void *entry)
 {
-    uint32_t index = hashmap_calc_hash(key, map->key_size) % map->size;
-    list_entry_t *entry;
-    list_for_each_entry(entry, &map->buckets[index])
+    uint64_t hash = map->hash_fn(map->get_key(entry), map->key_size);
+    size_t i;
+    size_t j;
+
+    for (i = hash & map->mask; map->slots[i].entry != entry; i = (i + 1) & map->mask)
     {
-        const void *entry_key = get_key_fn(entry);
-        if (hashmap_key_equal(key, entry_key, map->key_size))
+        if (!map->slots[i].entry)
+            return false;
+    }
+
+    for (j = (i + 1) & map->mask; map->slots[j].entry; j = (j + 1) & map->mask)
+    {
+        size_t home = map->slots[j].hash & map->mask;
+
+        /* Move the entry back unless its home slot lies after the gap, cyclically */
+        if (((j - home) & map->mask) >= ((j - i) & map->mask))
         {
-            return entry;
+            map->slots[i] = map->slots[j];
+            i = j;
         }
     }
-    return NULL;
+
+    map->slots[i].entry = NULL;
+    map->count--;
+
+    return true;
 }
 
 /**
- * @brief Remove an entry from hashmap (caller must call after finding).
- *
- * @param entry Entry to remove
+ * @brief Get the number of entries in the map.
  */
-static inline void hashmap_remove(list_entry_t *entry)
+static inline size_t hashmap_count(const hashmap_t *map)
 {
-    list_remove(entry);
+    return map->count;
 }
 
 /**
@@ -117,25 +382,19 @@ static inline void hashmap_remove(list_entry_t *entry)
  * @param map Pointer to hashmap
  * @param free_fn Optional function to free each item (can be NULL)
  */
-static inline void hashmap_cleanup(hashmap_t *map, void (*free_fn)(list_entry_t *entry))
+static inline void hashmap_cleanup(hashmap_t *map, void (*free_fn)(void *entry))
 {
-    for (size_t i = 0; i < map->size; ++i)
+    for (size_t i = 0; map->slots && i <= map->mask; ++i)
     {
-        list_entry_t *entry, *tmp;
-        list_for_each_entry_safe(entry, tmp, &map->buckets[i])
+        if (map->slots[i].entry && free_fn)
         {
-            list_remove(entry);
-            if (free_fn)
-            {
-                free_fn(entry);
-            }
+            free_fn(map->slots[i].entry);
         }
-        list_reset(&map->buckets[i]);
     }
-    free(map->buckets);
-    map->buckets = NULL;
-    map->size = 0;
-    map->key_size = 0;
+    free(map->slots);
+    map->slots = NULL;
+    map->mask = 0;
+    map->count = 0;
 }
 
 /**
@@ -146,18 +405,18 @@ static inline void hashmap_cleanup(hashmap_t *map, void (*free_fn)(list_entry_t
  * @param arg Optional user argument passed to fn
  *
  * The callback function should have the signature:
- *     void fn(list_entry_t *entry, void *arg);
+ *     void fn(void *entry, void *arg);
+ * and must not insert or remove entries.
  */
 static inline void hashmap_iterate(hashmap_t *map,
-            void (*fn)(list_entry_t *entry, void *arg),
+            void (*fn)(void *entry, void *arg),
             void *arg)
 {
-    for (size_t i = 0; i < map->size; ++i)
+    for (size_t i = 0; i <= map->mask; ++i)
     {
-        list_entry_t *entry, *tmp;
-        list_for_each_entry_safe(entry, tmp, &map->buckets[i])
+        if (map->slots[i].entry)
         {
-            fn(entry, arg);
+            fn(map->slots[i].entry, arg);
         }
     }
 }
@@ -0,0 +1,134 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Binary min-heap APIs.
+ *
+ * The heap stores pointers to user items and orders them with a user provided comparison
+ * function. The item at the top of the heap is the one for which @c less returned true against
+ * every other item.
+ *
+ * If the user wants to remove or re-order an arbitrary item (rather than just the top one), it
+ * must provide a @c set_index callback. The heap calls it every time an item moves so the item can
+ * remember its own position, which can then be passed to @ref heap_remove or @ref heap_update.
+ */
+
+/**
+ * @brief Comparison function. Returns true if @c lhs should be closer to the top than @c rhs.
+ */
+typedef bool (*heap_less_fn_t)(const void *lhs, const void *rhs);
+
+/**
+ * @brief Called whenever an item is placed at a new position in the heap.
+ */
+typedef void (*heap_set_index_fn_t)(void *item, size_t index);
+
+/** Index reported through @ref heap_set_index_fn_t when an item leaves the heap */
+#define HEAP_INDEX_NONE ((size_t)-1)
+
+/**
+ * @brief Heap object
+ */
+typedef struct heap
+{
+    /** Array of item pointers, in heap order */
+    void **items;
+    /** Number of items currently in the heap */
+    size_t count;
+    /** Number of items that fit in @ref items before it needs to grow */
+    size_t capacity;
+    /** Ordering function */
+    heap_less_fn_t less;
+    /** Optional position-tracking callback */
+    heap_set_index_fn_t set_index;
+} heap_t;
+
+/**
+ * @brief Initialise a heap
+ *
+ * @param heap Heap to initialise
+ * @param less Ordering function
+ * @param set_index Optional position-tracking callback (can be NULL)
+ */
+void heap_init(heap_t *heap, heap_less_fn_t less, heap_set_index_fn_t set_index);
+
+/**
+ * @brief Free the storage of the heap. Items themselves are not freed.
+ *
+ * @param heap Heap to clean up
+ */
+void heap_cleanup(heap_t *heap);
+
+/**
+ * @brief Add an item to the heap
+ *
+ * @param heap Heap to add to
+ * @param item Item to add
+ * @return 0 on success, or -ENOMEM if the heap could not grow
+ */
+int heap_push(heap_t *heap, void *item);
+
+/**
+ * @brief Remove and return the top item of the heap
+ *
+ * @param heap Heap to pop from
+ * @return The top item, or NULL if the heap is empty
+ */
+void *heap_pop(heap_t *heap);
+
+/**
+ * @brief Remove the item at the given position
+ *
+ * @param heap Heap to remove from
+ * @param index Position of the item, as reported through @ref heap_set_index_fn_t
+ * @return The removed item
+ */
+void *heap_remove(heap_t *heap, size_t index);
+
+/**
+ * @brief Restore ordering after the key of the item at the given position has changed
+ *
+ * @param heap Heap containing the item
+ * @param index Position of the item, as reported through @ref heap_set_index_fn_t
+ */
+void heap_update(heap_t *heap, size_t index);
+
+/**
+ * @brief Get the top item of the heap without removing it
+ *
+ * @param heap Heap to look at
+ * @return The top item, or NULL if the heap is empty
+ */
+static inline void *heap_peek(const heap_t *heap)
+{
+    return heap->count ? heap->items[0] : NULL;
+}
+
+/**
+ * @brief Check if a heap is empty
+ *
+ * @param heap Heap to check
+ * @return true if empty, else false
+ */
+static inline bool heap_is_empty(const heap_t *heap)
+{
+    return heap->count == 0;
+}
+
+/**
+ * @brief Get the number of items in the heap
+ *
+ * @param heap Heap to query
+ * @return Number of items
+ */
+static inline size_t heap_size(const heap_t *heap)
+{
+    return heap->count;
+}
@@ -52,6 +52,11 @@ mmsm_dump_nl80211_data_item(mmsm_data_item_t *result);
 /**
  * Finds a string key within the data item and returns the associated value
  *
+ * The first search of a long list builds an index over its keys, attached to
+ * head, so searching the same list again doesn't walk it. This applies to all
+ * the mmsm_find_* key lookups. Keys must not be changed once a list has been
+ * searched, though items may still be appended.
+ *
  * @param head The list to search
  * @param key The key to search for
  *
@@ -91,6 +96,39 @@ mmsm_data_item_t *
 mmsm_find_key(mmsm_data_item_t *head, const mmsm_key_t *key);
 
 
+/**
+ * Finds a string key and gets its value as an integer, using the typed value
+ * the backend filled in if there is one, otherwise parsing the value string
+ * (see @ref mmsm_typed_value_t)
+ *
+ * @param head The list to search
+ * @param key The key to search for
+ * @param val Set to the value if found
+ *
+ * @returns @c true if the key was found
+ */
+bool
+mmsm_find_i64_by_key(mmsm_data_item_t *head, const char *key, int64_t *val);
+
+
+/**
+ * As @ref mmsm_find_i64_by_key, for unsigned 32-bit values
+ */
+bool
+mmsm_find_u32_by_key(mmsm_data_item_t *head, const char *key, uint32_t *val);
+
+
+/**
+ * Fills in the typed value of an item from its string value: an integer if
+ * the whole string is a decimal number, or a MAC address if it is one in
+ * colon separated form. Otherwise the item is left without a typed value.
+ *
+ * @param item The item, whose value is a nul terminated string
+ */
+void
+mmsm_data_item_set_typed_from_string(mmsm_data_item_t *item);
+
+
 /**
  * Finds an integer key within the data item and returns the associated value
  *
@@ -153,13 +191,76 @@ mmsm_is_flag_set_in(mmsm_data_item_t *result, const char *key, const char *flag)
 /**
  * Frees the item and all children
  *
- * mmsm_data_item_free(NULL) returns with no action.
+ * mmsm_data_item_free(NULL) returns with no action. Freeing the root of an
+ * arena tree releases the whole arena, and freeing any other item allocated
+ * from an arena does nothing (see @ref mmsm_data_arena_t).
+ *
+ * If the item has been retained with @ref mmsm_data_item_retain, this drops
+ * one reference instead, and the tree is only freed along with the last.
  *
  * @param item The item to free
  */
 void
 mmsm_data_item_free(mmsm_data_item_t *item);
 
+
+/**
+ * Takes a reference to a result, so that it stays valid after whoever
+ * provided it frees it, for example to keep a monitor callback's result after
+ * the callback returns or to hand it to another thread. Drop the reference
+ * with @ref mmsm_data_item_release.
+ *
+ * The reference is to the whole tree, so only retain the item a result was
+ * provided as, not one of its sub-values or following items. A retained
+ * result is shared, so treat it as read only.
+ *
+ * @param item The result (may be NULL)
+ *
+ * @returns item
+ */
+mmsm_data_item_t *
+mmsm_data_item_retain(mmsm_data_item_t *item);
+
+
+/**
+ * Drops a reference taken with @ref mmsm_data_item_retain, freeing the result
+ * if it was the last. The same as @ref mmsm_data_item_free.
+ *
+ * @param item The result (may be NULL)
+ */
+static inline void
+mmsm_data_item_release(mmsm_data_item_t *item)
+{
+    mmsm_data_item_free(item);
+}
+
+
+/**
+ * Makes a deep copy of the item, its sub-values and every item chained after it
+ *
+ * The copy is always allocated on the heap, even if the item came from an arena.
+ * Values referencing a buffer are not copied; the copy references the same
+ * buffer.
+ *
+ * @param item The item to copy (may be NULL)
+ *
+ * @returns the copy, or @c NULL if item is NULL or on allocation failure
+ */
+mmsm_data_item_t *
+mmsm_data_item_copy(const mmsm_data_item_t *item);
+
+
+/**
+ * Compares two items, their sub-values and every item chained after them
+ *
+ * @param a The first item (may be NULL)
+ * @param b The second item (may be NULL)
+ *
+ * @returns @c true if the keys, values and structure are identical, or @c false
+ */
+bool
+mmsm_data_item_equal(const mmsm_data_item_t *a, const mmsm_data_item_t *b);
+
 /* config helpers */
 
 /**
@@ -232,3 +333,27 @@ const char *cfg_parse_string(
  */
 const char *cfg_parse_string_with_default(
         struct config_setting_t *cfg, const char *config_str, const char *on_fail);
+
+/**
+ * Config helper function to compare two settings, eg. of the config file as it was and as it
+ * has been reloaded. Groups are compared member by member, in any order.
+ *
+ * @param a - first setting (may be NULL)
+ * @param b - second setting (may be NULL)
+ * @return true if both have the same type and value, or are both NULL
+ */
+bool cfg_setting_equal(struct config_setting_t *a, struct config_setting_t *b);
+
+/**
+ * Config helper function to get the path of the hostapd control socket of a BSS, eg.
+ * "/var/run/hostapd_s1g/wlan0", from the hostapd backend settings: in the control_path of its
+ * entry in the "bss" list, for BSSes of other hostapd instances, else in control_path.
+ *
+ * @param hostapd_cfg - pointer to the "backends.hostapd" config_setting_t
+ * @param if_name - interface name of the BSS
+ * @param buff - buffer to write the path to
+ * @param buff_len - length of buff
+ * @return 0 on success, else a negative errno
+ */
+int cfg_hostapd_control_sock(
+        struct config_setting_t *hostapd_cfg, const char *if_name, char *buff, int buff_len);
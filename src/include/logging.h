@@ -31,6 +31,14 @@ enum log_levels {
 #define LOG_LEVEL LOG_LEVEL_ERROR
 #endif
 
+/*
+ * Highest level of logging compiled in, eg. LOG_LEVEL_INFO for release builds. Logging above it
+ * compiles to nothing, whatever the level set at run time. Set with scons --log-max-level.
+ */
+#ifndef LOG_LEVEL_COMPILED
+#define LOG_LEVEL_COMPILED LOG_LEVEL_VERBOSE
+#endif
+
 /* Use milliseconds for the log time. */
 #define LOG_TIME() (mmsm_get_run_time_ms())
 
@@ -63,41 +71,30 @@ static const char *log_colours_start[2][LOG_LEVEL_MAX] __attribute__((unused)) =
     }
 };
 
-#define LOG_PREFIX(level) \
-    do {\
-        timestamp_t _ts; \
-        timestamp_get(&_ts); \
-        printf("%s  %4u-%02u-%02u %02u:%02u:%02u %s %s", \
-            log_colours_start[mmsm_get_log_colours_enabled()][level], \
-            _ts.year, _ts.month, _ts.day, \
-            _ts.hour, _ts.minute, _ts.second, \
-            LOG_FILENAME, \
-            log_colours_end[mmsm_get_log_colours_enabled()]); \
-    } while (0)
+/*
+ * Log lines are built up in a buffer per thread and written out whole, by a writer thread if
+ * "async" is set in the logging config, see mmsm_log_line().
+ */
+#define LOG_PREFIX(level) mmsm_log_prefix(level, LOG_FILENAME)
 
 
-#define LOG(level, ...)                                     \
-    do {                                                    \
-        LOG_PREFIX(level);                                  \
-        printf(__VA_ARGS__);                                \
-        fflush(stdout);                                     \
-    } while (0)
+#define LOG(level, ...) mmsm_log_line(level, LOG_FILENAME, __VA_ARGS__)
 
 
-#define LOG_NP(level, ...) printf(__VA_ARGS__)
+#define LOG_NP(level, ...) mmsm_log_printf(__VA_ARGS__)
 
 
-#define LOG_VAR(level, debug_level, ...)                            \
-    do {                                                            \
-        if ((debug_level) >= (level))                               \
-            LOG(level, __VA_ARGS__);                                \
+#define LOG_VAR(level, debug_level, ...)                                       \
+    do {                                                                       \
+        if ((level) <= LOG_LEVEL_COMPILED && (debug_level) >= (level))         \
+            LOG(level, __VA_ARGS__);                                           \
     } while (0)
 
 
-#define LOG_VAR_NP(level, debug_level, ...)     \
-    do {                                        \
-        if ((debug_level) >= (level))           \
-            LOG_NP(__VA_ARGS__);                \
+#define LOG_VAR_NP(level, debug_level, ...)                                    \
+    do {                                                                       \
+        if ((level) <= LOG_LEVEL_COMPILED && (debug_level) >= (level))         \
+            LOG_NP(level, __VA_ARGS__);                                        \
     } while (0)
 
 
@@ -120,12 +117,10 @@ static const char *log_colours_start[2][LOG_LEVEL_MAX] __attribute__((unused)) =
 
 #define LOG_INFO_ALWAYS(...) LOG(LOG_LEVEL_INFO, __VA_ARGS__)
 
-#define LOG_DATA(level, data, size)                                   \
-    do {                                                              \
-        if (mmsm_get_log_level() >= (level)) {                            \
-            mmsm_dump_data(data, size);                               \
-            fflush(stdout);                                           \
-        }                                                             \
+#define LOG_DATA(level, data, size)                                            \
+    do {                                                                       \
+        if ((level) <= LOG_LEVEL_COMPILED && mmsm_get_log_level() >= (level))  \
+            mmsm_dump_data(data, size);                                        \
     } while (0)
 
 
@@ -135,15 +130,40 @@ static const char *log_colours_start[2][LOG_LEVEL_MAX] __attribute__((unused)) =
  * @param result The data to dump
  * @param level The log level to dump the data at
  */
-#define MMSM_DUMP_DATA_ITEM(result, level) do       \
-    {                                               \
-        if (mmsm_get_log_level() >= (level)) {          \
-            _mmsm_dump_data_item(result, level);    \
-            fflush(stdout);                         \
-        }                                           \
+#define MMSM_DUMP_DATA_ITEM(result, level) do                                  \
+    {                                                                          \
+        if ((level) <= LOG_LEVEL_COMPILED && mmsm_get_log_level() >= (level))  \
+            _mmsm_dump_data_item(result, level);                               \
     } while (0)
 
 
+/**
+ * @brief Write a log line: the prefix for its level and file, then the message
+ *
+ * Anything already in this thread's line, eg. from @ref mmsm_log_prefix, is written first.
+ *
+ * @param level Log level
+ * @param file Source file name
+ * @param fmt printf format of the message
+ */
+void mmsm_log_line(unsigned int level, const char *file, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Start a log line built up from several calls to @ref mmsm_log_printf
+ *
+ * @param level Log level
+ * @param file Source file name
+ */
+void mmsm_log_prefix(unsigned int level, const char *file);
+
+/**
+ * @brief Add to this thread's log line, which is written out once it ends in a newline
+ *
+ * @param fmt printf format
+ */
+void mmsm_log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
 /**
  * Initialize program running time. It is to be called at begginning of
  * the program starts.
@@ -154,6 +174,9 @@ mmsm_init_time(void);
 /**
  * @brief Set log settings from config file
  *
+ * May be called again with a reloaded config, though once started the writer thread of "async"
+ * keeps running.
+ *
  * @param cfg logging config setting
  */
 void mmsm_set_log_config(config_setting_t *cfg);
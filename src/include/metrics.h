@@ -0,0 +1,90 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "smart_manager.h"
+
+/**
+ * Metrics endpoint: serves the engine's counters (see @ref mmsm_get_stats), the backends' (see
+ * get_counters in @ref mmsm_backend_intf_t) and whatever modules register, as Prometheus text,
+ * on a UNIX socket and/or over HTTP. See metrics_socket and metrics_port in the engine config.
+ *
+ * Everything is written from counters and state already in memory, so a scrape never makes a
+ * request to a backend. Scrapes are served one at a time, from a thread of their own.
+ */
+
+/**
+ * @brief Write a module's metrics
+ *
+ * Called on the metrics thread for each scrape. Must not make requests to backends or wait on
+ * anything slow, only copy out what is already in memory.
+ *
+ * @param context As registered
+ * @param out Where to write the metrics, in the Prometheus text format
+ */
+typedef void (*metrics_fn_t)(void *context, FILE *out);
+
+/**
+ * @brief Register a module's metrics, written on every scrape after the engine's
+ *
+ * @param fn Writes the metrics
+ * @param context Passed to fn
+ * @return 0 on success, or -ENOMEM
+ */
+int metrics_register(metrics_fn_t fn, void *context);
+
+/**
+ * @brief Unregister a module's metrics. Once it returns, fn is not running and won't be called.
+ *
+ * @param fn As registered
+ * @param context As registered
+ */
+void metrics_unregister(metrics_fn_t fn, void *context);
+
+/**
+ * @brief Write the HELP and TYPE lines that start a metric family
+ *
+ * @param out Where to write
+ * @param name Name of the metric, e.g. "smart_manager_dcs_csa_total"
+ * @param type "counter", "gauge" or "histogram"
+ * @param help Description
+ */
+void metrics_write_family(FILE *out, const char *name, const char *type, const char *help);
+
+/**
+ * @brief Write the samples of a histogram of durations, in seconds
+ *
+ * @param out Where to write
+ * @param name Name of the metric family, without the _bucket, _sum and _count suffixes
+ * @param labels Labels of the histogram, e.g. "backend=\"nl80211\"", or ""
+ * @param histogram The histogram
+ */
+void metrics_write_histogram(FILE *out, const char *name, const char *labels,
+                             const mmsm_histogram_t *histogram);
+
+/**
+ * @brief Write the metrics of the engine, the backends and every registered module
+ *
+ * @param out Where to write
+ */
+void metrics_write(FILE *out);
+
+/**
+ * @brief Start serving the metrics
+ *
+ * @param socket_path UNIX socket to write the metrics to every connection on, or NULL
+ * @param address Address to serve HTTP on, e.g. "127.0.0.1"
+ * @param port TCP port to serve HTTP GET /metrics on, or 0
+ * @return 0 on success, else a negative errno
+ */
+int metrics_server_start(const char *socket_path, const char *address, unsigned int port);
+
+/**
+ * @brief Stop serving the metrics, if started
+ */
+void metrics_server_stop(void);
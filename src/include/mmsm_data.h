@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +28,8 @@ typedef struct mmsm_key_t
 {
     /** The type of the data stored in the below union */
     mmsm_key_type_t type;
+    /** Set if string is an atom from @ref mmsm_key_intern rather than owned by the key */
+    bool interned;
     union {
         /** The data as a string. Valid if type == MMSM_KEY_TYPE_STRING */
         char *string;
@@ -36,6 +39,118 @@ typedef struct mmsm_key_t
 } mmsm_key_t;
 
 
+/**
+ * Interns a string key, returning an atom: a copy of the string that lives until the process
+ * exits and is the same pointer for every caller interning an equal string. Keys holding atoms
+ * are compared by pointer, and the atom is shared rather than copied or freed with the key.
+ *
+ * Once a string is interned, @ref mmsm_data_item_set_key_str uses its atom too. The number of
+ * atoms is bounded, so only intern keys from a small, fixed vocabulary (such as the field names
+ * of hostapd responses), not arbitrary strings.
+ *
+ * @param str The string
+ *
+ * @returns the atom, or NULL if the table is full or allocation failed
+ */
+const char *mmsm_key_intern(const char *str);
+
+/**
+ * Finds the atom for a string if it has been interned, without interning it.
+ *
+ * @param str The string
+ *
+ * @returns the atom, or NULL if the string hasn't been interned
+ */
+const char *mmsm_key_atom_find(const char *str);
+
+/**
+ * Gets the hash of an atom returned by @ref mmsm_key_intern. This is the 32-bit FNV-1a hash of
+ * the string.
+ */
+uint32_t mmsm_key_atom_hash(const char *atom);
+
+/**
+ * Checks whether two string keys are equal, comparing atoms by pointer.
+ */
+static inline bool mmsm_key_string_equal(const mmsm_key_t *a, const mmsm_key_t *b)
+{
+    if (a->interned && b->interned)
+        return a->d.string == b->d.string;
+
+    return strcmp(a->d.string, b->d.string) == 0;
+}
+
+
+/**
+ * Identifies the type of the typed representation of a data item's value
+ */
+typedef enum mmsm_value_type_t
+{
+    /** The value has no typed representation */
+    MMSM_VALUE_TYPE_NONE,
+    /** A signed integer */
+    MMSM_VALUE_TYPE_I64,
+    /** A boolean */
+    MMSM_VALUE_TYPE_BOOL,
+    /** A MAC address */
+    MMSM_VALUE_TYPE_MAC,
+} mmsm_value_type_t;
+
+
+/**
+ * A typed representation of a data item's value, filled in by the backend once when it parses a
+ * response (for example the number a hostapd value string holds), so that consumers don't each
+ * parse the value again. The value itself is left as it was.
+ */
+typedef struct mmsm_typed_value_t
+{
+    /** The type of the data stored in the below union */
+    mmsm_value_type_t type;
+    union {
+        /** Valid if type == MMSM_VALUE_TYPE_I64 */
+        int64_t i64;
+        /** Valid if type == MMSM_VALUE_TYPE_BOOL */
+        bool b;
+        /** Valid if type == MMSM_VALUE_TYPE_MAC */
+        uint8_t mac[6];
+    } v;
+} mmsm_typed_value_t;
+
+
+/**
+ * An arena that a whole tree of data items, including their keys and values, can be allocated
+ * from, so that building the tree needs only a few allocations and freeing it needs not walk it.
+ *
+ * Create an arena with @ref mmsm_data_arena_create and allocate the first item of the tree (the
+ * root) with @ref mmsm_data_item_alloc_in. The existing helpers (mmsm_data_item_alloc_next,
+ * mmsm_data_item_set_key_str, mmsm_data_item_set_val_*, ...) then allocate from the arena of the
+ * item they are given. Drop the creator's reference with @ref mmsm_data_arena_put once the tree
+ * is built. Calling mmsm_data_item_free on the root releases the whole arena; calling it on any
+ * other item of the tree does nothing.
+ *
+ * Every item, key and value in the tree must come from the arena. Don't attach heap-allocated
+ * items or values to an arena item, and don't keep items of the tree after freeing the root.
+ */
+typedef struct mmsm_data_arena mmsm_data_arena_t;
+
+/**
+ * A reference counted buffer that item values can point into instead of holding a copy, such as
+ * a received netlink message. Each item referencing the buffer holds a reference, so the buffer
+ * is released when the last of them is freed.
+ *
+ * Referenced values are read only. Set them with @ref mmsm_data_item_set_val_ref.
+ */
+typedef struct mmsm_data_buf mmsm_data_buf_t;
+
+/**
+ * Function releasing the memory behind a @ref mmsm_data_buf_t
+ */
+typedef void (*mmsm_data_buf_release_fn_t)(void *ctx);
+
+
+/** Values of up to this many bytes are held inside their data item, see mmsm_value_inline */
+#define MMSM_DATA_INLINE_VALUE_LEN (16)
+
 /**
  * Contains data for a series of data items that can be passed around smart
  * manager.
@@ -64,49 +179,221 @@ typedef struct mmsm_data_item_t
      *  of strlen to set this up you must add 1. */
     uint32_t mmsm_value_len;
 
+    /** Holds a value of up to MMSM_DATA_INLINE_VALUE_LEN bytes, mmsm_value then pointing here,
+     *  so small values, such as u32 attributes and short strings, need no allocation of their
+     *  own and are read from the same cache lines as the item. */
+    union
+    {
+        uint8_t bytes[MMSM_DATA_INLINE_VALUE_LEN];
+        uint64_t align;
+    } mmsm_value_inline;
+
     /** Contains a sub-list of values for nested data items */
     struct mmsm_data_item_t *mmsm_sub_values;
 
     /** The next value in this list of data items */
     struct mmsm_data_item_t *mmsm_next;
+
+    /** The arena the item was allocated from, or NULL if allocated on the heap */
+    mmsm_data_arena_t *mmsm_arena;
+
+    /** The buffer mmsm_value points into, or NULL if the item owns mmsm_value. The reference
+     *  to it is held by the item, or by its arena. */
+    mmsm_data_buf_t *mmsm_value_buf;
+
+    /** Index over the keys of this item and those after it, built by the first lookup on a
+     *  long list. Internal to the engine. */
+    struct mmsm_data_index *mmsm_index;
+
+    /** Typed representation of mmsm_value, if the backend provided one. Should be accessed
+     *  using the mmsm_data_item_get_typed_* helpers. */
+    mmsm_typed_value_t mmsm_typed;
+
+    /** Number of references to the tree beyond the first, taken with mmsm_data_item_retain.
+     *  Only used on the item a result is provided as. */
+    unsigned int mmsm_refs;
 } mmsm_data_item_t;
 
-static inline mmsm_data_item_t *mmsm_data_item_alloc(void)
+/**
+ * Wraps memory in a reference counted buffer.
+ *
+ * @param release Called with ctx once the last reference is dropped
+ * @param ctx Passed to release
+ *
+ * @returns the buffer, holding one reference for the creator, or NULL on failure
+ */
+mmsm_data_buf_t *mmsm_data_buf_create(mmsm_data_buf_release_fn_t release, void *ctx);
+
+/**
+ * Allocates a reference counted buffer along with its memory.
+ *
+ * @param size Number of bytes to allocate. Get them with @ref mmsm_data_buf_data.
+ *
+ * @returns the buffer, holding one reference for the creator, or NULL on failure
+ */
+mmsm_data_buf_t *mmsm_data_buf_alloc(size_t size);
+
+/**
+ * Gets the memory of a buffer allocated with @ref mmsm_data_buf_alloc.
+ */
+void *mmsm_data_buf_data(mmsm_data_buf_t *buf);
+
+/**
+ * Takes a reference to a buffer.
+ *
+ * @returns buf
+ */
+mmsm_data_buf_t *mmsm_data_buf_get(mmsm_data_buf_t *buf);
+
+/**
+ * Drops a reference to a buffer, releasing it if it was the last.
+ *
+ * @param buf The buffer (may be NULL)
+ */
+void mmsm_data_buf_put(mmsm_data_buf_t *buf);
+
+/**
+ * Makes an arena hold a reference to a buffer until the arena is released. Used by
+ * @ref mmsm_data_item_set_val_ref.
+ *
+ * @returns 0 on success, or -ENOMEM
+ */
+int mmsm_data_arena_hold(mmsm_data_arena_t *arena, mmsm_data_buf_t *buf);
+
+/**
+ * Creates an arena to allocate a tree of data items from.
+ *
+ * @returns the arena, holding one reference for the creator, or NULL on failure
+ */
+mmsm_data_arena_t *mmsm_data_arena_create(void);
+
+/**
+ * Drops the creator's reference to an arena. The arena is released once this has been called
+ * and the root item has been freed, or straight away if no items were allocated.
+ *
+ * @param arena The arena (may be NULL)
+ */
+void mmsm_data_arena_put(mmsm_data_arena_t *arena);
+
+/**
+ * Allocates zeroed memory from an arena. It is released with the arena.
+ *
+ * @param arena The arena
+ * @param size Number of bytes to allocate
+ *
+ * @returns the memory, or NULL on failure
+ */
+void *mmsm_data_arena_alloc(mmsm_data_arena_t *arena, size_t size);
+
+/**
+ * Allocates a data item from an arena. The first item allocated is the root of the tree.
+ *
+ * @param arena The arena, or NULL to allocate from the heap
+ *
+ * @returns the item, or NULL on failure
+ */
+mmsm_data_item_t *mmsm_data_item_alloc_in(mmsm_data_arena_t *arena);
+
+/**
+ * Releases the arena of an item if it was its root. Used by mmsm_data_item_free.
+ *
+ * @param item An item allocated from an arena
+ */
+void mmsm_data_arena_item_free(mmsm_data_item_t *item);
+
+/**
+ * Allocates a zeroed data item, from a pool of them rather than straight from the heap, to be
+ * freed with mmsm_data_item_free.
+ */
+mmsm_data_item_t *mmsm_data_item_alloc(void);
+
+/**
+ * Allocates an item from the same place as an existing item, its arena or the heap.
+ */
+static inline mmsm_data_item_t *mmsm_data_item_alloc_like(mmsm_data_item_t *item)
+{
+    return item->mmsm_arena ? mmsm_data_item_alloc_in(item->mmsm_arena) : mmsm_data_item_alloc();
+}
+
+/**
+ * Allocates zeroed memory for an item's key or value, from the item's arena if it has one.
+ */
+static inline void *mmsm_data_item_buf_alloc(mmsm_data_item_t *item, size_t size)
+{
+    return item->mmsm_arena ? mmsm_data_arena_alloc(item->mmsm_arena, size) : calloc(1, size);
+}
+
+/**
+ * Allocates zeroed memory for an item's value: inside the item if it is small enough, else as
+ * @ref mmsm_data_item_buf_alloc does.
+ */
+static inline uint8_t *mmsm_data_item_value_alloc(mmsm_data_item_t *item, size_t size)
 {
-    mmsm_data_item_t *item = calloc(1, sizeof(*item));
-    return item;
+    if (size <= sizeof(item->mmsm_value_inline.bytes))
+    {
+        memset(item->mmsm_value_inline.bytes, 0, sizeof(item->mmsm_value_inline.bytes));
+        return item->mmsm_value_inline.bytes;
+    }
+
+    return (uint8_t *)mmsm_data_item_buf_alloc(item, size);
+}
+
+/**
+ * Whether an item's value is held inside the item, rather than owned or referenced by it.
+ */
+static inline bool mmsm_data_item_value_is_inline(const mmsm_data_item_t *item)
+{
+    return item->mmsm_value == item->mmsm_value_inline.bytes;
 }
 
 static inline mmsm_data_item_t *mmsm_data_item_alloc_next(mmsm_data_item_t *item)
 {
     MMSM_ASSERT(item->mmsm_next == NULL);
-    item->mmsm_next = mmsm_data_item_alloc();
+    item->mmsm_next = mmsm_data_item_alloc_like(item);
     return item->mmsm_next;
 }
 
 static inline mmsm_data_item_t *mmsm_data_item_alloc_sub_value(mmsm_data_item_t *item)
 {
     MMSM_ASSERT(item->mmsm_sub_values == NULL);
-    item->mmsm_sub_values = mmsm_data_item_alloc();
+    item->mmsm_sub_values = mmsm_data_item_alloc_like(item);
     return item->mmsm_sub_values;
 }
 
 static inline void mmsm_data_item_set_key_u32(mmsm_data_item_t *item, uint32_t key)
 {
     item->mmsm_key.type = MMSM_KEY_TYPE_U32;
+    item->mmsm_key.interned = false;
     item->mmsm_key.d.u32 = key;
 }
 
+/**
+ * Sets a string key. If the string has been interned (see @ref mmsm_key_intern), the key uses
+ * the atom rather than allocating a copy.
+ */
 static inline void mmsm_data_item_set_key_str(mmsm_data_item_t *item, const char *str)
 {
+    const char *atom = mmsm_key_atom_find(str);
+    size_t len;
+
     item->mmsm_key.type = MMSM_KEY_TYPE_STRING;
-    item->mmsm_key.d.string = strdup(str);
+    item->mmsm_key.interned = atom != NULL;
+    if (atom)
+    {
+        item->mmsm_key.d.string = (char *)atom;
+        return;
+    }
+
+    len = strlen(str) + 1;
+    item->mmsm_key.d.string = (char *)mmsm_data_item_buf_alloc(item, len);
+    if (item->mmsm_key.d.string)
+        memcpy(item->mmsm_key.d.string, str, len);
 }
 
 static inline void mmsm_data_item_set_val_u32(mmsm_data_item_t *item, uint32_t val)
 {
     item->mmsm_value_len = sizeof(val);
-    item->mmsm_value = calloc(1, item->mmsm_value_len);
+    item->mmsm_value = mmsm_data_item_value_alloc(item, item->mmsm_value_len);
     memcpy(item->mmsm_value, &val, item->mmsm_value_len);
 }
 
@@ -115,15 +402,59 @@ static inline void mmsm_data_item_set_val_bytes(mmsm_data_item_t *item, uint8_t
     item->mmsm_value_len = len;
     if (len)
     {
-        item->mmsm_value = calloc(1, item->mmsm_value_len);
-        memcpy(item->mmsm_value, buff, item->mmsm_value_len);
+        item->mmsm_value = mmsm_data_item_value_alloc(item, item->mmsm_value_len);
+        if (item->mmsm_value)
+            memcpy(item->mmsm_value, buff, item->mmsm_value_len);
     }
 }
 
 static inline void mmsm_data_item_set_val_string(mmsm_data_item_t *item, const char *str)
 {
-    item->mmsm_value = (uint8_t *)strdup(str);
-    item->mmsm_value_len = strlen(str) + 1;
+    size_t len = strlen(str) + 1;
+
+    item->mmsm_value = mmsm_data_item_value_alloc(item, len);
+    if (item->mmsm_value)
+        memcpy(item->mmsm_value, str, len);
+    item->mmsm_value_len = len;
+}
+
+/**
+ * Sets an item's value to point at bytes inside a buffer rather than a copy of them. The item
+ * holds a reference to the buffer (or its arena does) until it is freed. Values small enough to
+ * be held inside the item are copied there instead, which is cheaper than the reference.
+ *
+ * @param item The item
+ * @param buf The buffer the value lies in
+ * @param val The value, inside buf
+ * @param len Length of the value
+ */
+static inline void mmsm_data_item_set_val_ref(mmsm_data_item_t *item, mmsm_data_buf_t *buf,
+                                              const uint8_t *val, size_t len)
+{
+    if (len <= sizeof(item->mmsm_value_inline.bytes))
+    {
+        item->mmsm_value = mmsm_data_item_value_alloc(item, len);
+        memcpy(item->mmsm_value, val, len);
+        item->mmsm_value_len = len;
+        return;
+    }
+
+    if (item->mmsm_arena)
+    {
+        if (mmsm_data_arena_hold(item->mmsm_arena, buf) != 0)
+        {
+            mmsm_data_item_set_val_bytes(item, (uint8_t *)val, len);
+            return;
+        }
+        item->mmsm_value_buf = buf;
+    }
+    else
+    {
+        item->mmsm_value_buf = mmsm_data_buf_get(buf);
+    }
+
+    item->mmsm_value = (uint8_t *)val;
+    item->mmsm_value_len = len;
 }
 
 static inline uint32_t mmsm_data_item_get_val_u32(mmsm_data_item_t *item)
@@ -143,6 +474,85 @@ static inline uint32_t mmsm_data_item_get_val_len(mmsm_data_item_t *item)
     return item->mmsm_value_len;
 }
 
+static inline void mmsm_data_item_set_typed_i64(mmsm_data_item_t *item, int64_t val)
+{
+    item->mmsm_typed.type = MMSM_VALUE_TYPE_I64;
+    item->mmsm_typed.v.i64 = val;
+}
+
+static inline void mmsm_data_item_set_typed_bool(mmsm_data_item_t *item, bool val)
+{
+    item->mmsm_typed.type = MMSM_VALUE_TYPE_BOOL;
+    item->mmsm_typed.v.b = val;
+}
+
+static inline void mmsm_data_item_set_typed_mac(mmsm_data_item_t *item, const uint8_t mac[6])
+{
+    item->mmsm_typed.type = MMSM_VALUE_TYPE_MAC;
+    memcpy(item->mmsm_typed.v.mac, mac, sizeof(item->mmsm_typed.v.mac));
+}
+
+/**
+ * Gets the typed value of an item as a signed integer.
+ *
+ * @returns true if the item has an integer typed value, and sets val to it
+ */
+static inline bool mmsm_data_item_get_typed_i64(const mmsm_data_item_t *item, int64_t *val)
+{
+    if (item->mmsm_typed.type != MMSM_VALUE_TYPE_I64)
+        return false;
+
+    *val = item->mmsm_typed.v.i64;
+    return true;
+}
+
+/**
+ * Gets the typed value of an item as a uint32_t.
+ *
+ * @returns true if the item has an integer typed value that fits, and sets val to it
+ */
+static inline bool mmsm_data_item_get_typed_u32(const mmsm_data_item_t *item, uint32_t *val)
+{
+    int64_t i64;
+
+    if (!mmsm_data_item_get_typed_i64(item, &i64) || i64 < 0 || i64 > UINT32_MAX)
+        return false;
+
+    *val = i64;
+    return true;
+}
+
+/**
+ * Gets the typed value of an item as a boolean. Integers are true if non-zero.
+ *
+ * @returns true if the item has a boolean or integer typed value, and sets val to it
+ */
+static inline bool mmsm_data_item_get_typed_bool(const mmsm_data_item_t *item, bool *val)
+{
+    if (item->mmsm_typed.type == MMSM_VALUE_TYPE_BOOL)
+        *val = item->mmsm_typed.v.b;
+    else if (item->mmsm_typed.type == MMSM_VALUE_TYPE_I64)
+        *val = item->mmsm_typed.v.i64 != 0;
+    else
+        return false;
+
+    return true;
+}
+
+/**
+ * Gets the typed value of an item as a MAC address.
+ *
+ * @returns true if the item has a MAC address typed value, and copies it to mac
+ */
+static inline bool mmsm_data_item_get_typed_mac(const mmsm_data_item_t *item, uint8_t mac[6])
+{
+    if (item->mmsm_typed.type != MMSM_VALUE_TYPE_MAC)
+        return false;
+
+    memcpy(mac, item->mmsm_typed.v.mac, sizeof(item->mmsm_typed.v.mac));
+    return true;
+}
+
 /**
  *
  * @enum    mmsm_error_code
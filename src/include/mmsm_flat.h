@@ -0,0 +1,249 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mmsm_data.h"
+
+/**
+ * A flat encoding of a data item tree in a single contiguous buffer.
+ *
+ * Unlike a tree of mmsm_data_item_t, a flat tree holds no pointers, so it can be copied with
+ * memcpy, handed to another thread or process, stored in a queue or cache or written to a
+ * datalog as it is. It can be read in place with the iterators and mmsm_flat_find_* lookups
+ * below, which mirror those of helpers.h, or turned back into an item tree with
+ * @ref mmsm_flat_deserialize.
+ *
+ * The buffer starts with a header giving its total length, followed by one record per item in
+ * the order items are reached by walking the tree depth first. Each record holds the item's key,
+ * its value, and then the records of its sub-values, and gives its own total size so that its
+ * siblings can be reached without walking its sub-values. All fields are in host byte order and
+ * aligned to 4 bytes.
+ *
+ * The in-place readers trust the buffer. Check buffers from elsewhere, such as those read back
+ * from a file, with @ref mmsm_flat_validate first.
+ */
+
+/** Value of @ref mmsm_flat_t::magic */
+#define MMSM_FLAT_MAGIC (0x464d534d) /* "MSMF" */
+
+/**
+ * Header of a flat tree
+ */
+typedef struct mmsm_flat_t
+{
+    /** Always @ref MMSM_FLAT_MAGIC */
+    uint32_t magic;
+    /** Total length of the buffer in bytes, including this header */
+    uint32_t len;
+} mmsm_flat_t;
+
+/**
+ * An item of a flat tree, read in place with the mmsm_flat_item_* functions
+ */
+typedef struct mmsm_flat_item_t mmsm_flat_item_t;
+
+
+/**
+ * Gets the number of bytes needed to encode an item, its sub-values and every
+ * item chained after it
+ *
+ * @param item The item (may be NULL)
+ *
+ * @returns the number of bytes, or 0 if the tree is too big to encode
+ */
+size_t
+mmsm_flat_size(const mmsm_data_item_t *item);
+
+
+/**
+ * Encodes an item, its sub-values and every item chained after it into a
+ * caller provided buffer
+ *
+ * @param item The item (may be NULL)
+ * @param buf The buffer, at least 4 byte aligned
+ * @param len Length of buf
+ *
+ * @returns the number of bytes written, or 0 if buf is too small
+ */
+size_t
+mmsm_flat_encode(const mmsm_data_item_t *item, void *buf, size_t len);
+
+
+/**
+ * Encodes an item, its sub-values and every item chained after it into a new
+ * buffer
+ *
+ * @param item The item (may be NULL)
+ *
+ * @returns the buffer, to be freed with free(), or @c NULL on failure
+ */
+mmsm_flat_t *
+mmsm_flat_serialize(const mmsm_data_item_t *item);
+
+
+/**
+ * Checks that a buffer holds a well formed flat tree
+ *
+ * @param buf The buffer, at least 4 byte aligned
+ * @param len Length of buf
+ *
+ * @returns @c true if the tree can be read safely
+ */
+bool
+mmsm_flat_validate(const void *buf, size_t len);
+
+
+/**
+ * Decodes a flat tree into an item tree, allocated from a new arena (see
+ * @ref mmsm_data_arena_t). Free it with mmsm_data_item_free as usual.
+ *
+ * @param buf The buffer, at least 4 byte aligned
+ * @param len Length of buf
+ *
+ * @returns the first item, or @c NULL if the tree is empty, malformed or on
+ *          allocation failure
+ */
+mmsm_data_item_t *
+mmsm_flat_deserialize(const void *buf, size_t len);
+
+
+/**
+ * Gets the first item of a flat tree
+ *
+ * @returns the item, or @c NULL if the tree is empty
+ */
+const mmsm_flat_item_t *
+mmsm_flat_first(const mmsm_flat_t *flat);
+
+
+/**
+ * Gets the item after this one, the equivalent of mmsm_next
+ *
+ * @returns the item, or @c NULL if this is the last
+ */
+const mmsm_flat_item_t *
+mmsm_flat_item_next(const mmsm_flat_item_t *item);
+
+
+/**
+ * Gets the first sub-value of an item, the equivalent of mmsm_sub_values
+ *
+ * @returns the item, or @c NULL if there are no sub-values
+ */
+const mmsm_flat_item_t *
+mmsm_flat_item_sub_values(const mmsm_flat_item_t *item);
+
+
+/**
+ * Gets the key of an item. A string key points into the flat tree.
+ */
+mmsm_key_t
+mmsm_flat_item_key(const mmsm_flat_item_t *item);
+
+
+/**
+ * Gets the value of an item, pointing into the flat tree
+ *
+ * @returns the value, or @c NULL if the item has none
+ */
+const uint8_t *
+mmsm_flat_item_value(const mmsm_flat_item_t *item);
+
+
+/**
+ * Gets the length of the value of an item
+ */
+uint32_t
+mmsm_flat_item_value_len(const mmsm_flat_item_t *item);
+
+
+/** Iterate on the items of a flat list */
+#define for_each_flat_item(_iter, _head) \
+    for (_iter = _head; _iter != NULL; _iter = mmsm_flat_item_next(_iter))
+
+
+/**
+ * Finds a key within a flat list and returns the associated item, as
+ * mmsm_find_key does
+ */
+const mmsm_flat_item_t *
+mmsm_flat_find_key(const mmsm_flat_item_t *head, const mmsm_key_t *key);
+
+
+/**
+ * Finds a string key within a flat list and returns the associated value, as
+ * mmsm_find_value_by_key does
+ */
+const uint8_t *
+mmsm_flat_find_value_by_key(const mmsm_flat_item_t *head, const char *key);
+
+
+/**
+ * Finds an integer key within a flat list and returns the associated value, as
+ * mmsm_find_value_by_intkey does
+ */
+const uint8_t *
+mmsm_flat_find_value_by_intkey(const mmsm_flat_item_t *head, uint32_t key);
+
+
+/**
+ * Returns the nth value in a flat list, as mmsm_find_nth_value does
+ */
+const uint8_t *
+mmsm_flat_find_nth_value(const mmsm_flat_item_t *head, uint32_t n);
+
+
+/**
+ * Finds a value by nested integer keys, terminated by -1, as
+ * mmsm_find_by_nested_intkeys does
+ */
+const uint8_t *
+mmsm_flat_find_by_nested_intkeys(const mmsm_flat_item_t *head, ...);
+
+
+/**
+ * Checks if the given flag is set within the value of the given key, as
+ * mmsm_is_flag_set_in does
+ */
+bool
+mmsm_flat_is_flag_set_in(const mmsm_flat_item_t *head, const char *key, const char *flag);
+
+
+static inline uint32_t mmsm_flat_find_value_by_key_u32(const mmsm_flat_item_t *head,
+                                                       const char *key)
+{
+    const uint8_t *val = mmsm_flat_find_value_by_key(head, key);
+    uint32_t v;
+
+    if (!val)
+        return -1;
+    memcpy(&v, val, sizeof(v));
+    return v;
+}
+
+static inline uint16_t mmsm_flat_find_value_by_key_u16(const mmsm_flat_item_t *head,
+                                                       const char *key)
+{
+    const uint8_t *val = mmsm_flat_find_value_by_key(head, key);
+    uint16_t v;
+
+    if (!val)
+        return -1;
+    memcpy(&v, val, sizeof(v));
+    return v;
+}
+
+static inline uint8_t mmsm_flat_find_value_by_key_u8(const mmsm_flat_item_t *head,
+                                                     const char *key)
+{
+    const uint8_t *val = mmsm_flat_find_value_by_key(head, key);
+
+    return val ? *val : -1;
+}
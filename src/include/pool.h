@@ -0,0 +1,141 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Fixed size object pool APIs.
+ *
+ * A pool hands out objects of one size, carved out of slabs of several objects at a time. Freed
+ * objects go back on the pool's free list rather than to the heap, and slabs are only released
+ * when the pool is, so objects allocated and freed all the time don't fragment the heap over a
+ * long uptime. The pool only ever holds as many objects as were once in use at the same time.
+ *
+ * Pools are thread safe. A pool can be defined statically with @ref POOL_INITIALIZER, or set up
+ * with @ref pool_init. Every pool that has allocated anything can be listed with
+ * @ref pool_read_stats.
+ */
+
+/**
+ * A slab of objects
+ */
+typedef struct pool_slab pool_slab_t;
+
+/**
+ * @brief Pool object
+ */
+typedef struct pool
+{
+    /** Name, for the stats */
+    const char *name;
+    /** Size of the objects */
+    size_t object_size;
+    /** Number of objects each slab holds */
+    size_t objects_per_slab;
+    /** Protects everything below */
+    pthread_mutex_t mutex;
+    /** Objects free to hand out, each holding a pointer to the next */
+    void *free_list;
+    /** Slabs allocated, most recent first */
+    pool_slab_t *slabs;
+    /** Number of objects the slabs hold */
+    size_t capacity;
+    /** Number of objects handed out and not yet freed */
+    size_t in_use;
+    /** Most objects that have been in use at once */
+    size_t high_water;
+    /** Whether the pool is listed for @ref pool_read_stats */
+    bool registered;
+    /** Next pool listed */
+    struct pool *next;
+} pool_t;
+
+/**
+ * @brief Initialiser for a statically defined pool, e.g.
+ *
+ *   static pool_t item_pool = POOL_INITIALIZER("item", sizeof(item_t), 64);
+ *
+ * @param _name Name of the pool, for the stats
+ * @param _object_size Size of the objects
+ * @param _objects_per_slab Number of objects to allocate at a time
+ */
+#define POOL_INITIALIZER(_name, _object_size, _objects_per_slab)   \
+    {                                                               \
+        .name = (_name),                                            \
+        .object_size = (_object_size),                              \
+        .objects_per_slab = (_objects_per_slab),                    \
+        .mutex = PTHREAD_MUTEX_INITIALIZER,                         \
+    }
+
+/**
+ * @brief Stats of a pool
+ */
+typedef struct pool_stats
+{
+    /** Name of the pool */
+    const char *name;
+    /** Size of its objects */
+    size_t object_size;
+    /** Number of objects its slabs hold */
+    size_t capacity;
+    /** Number of objects in use */
+    size_t in_use;
+    /** Most objects that have been in use at once */
+    size_t high_water;
+} pool_stats_t;
+
+/**
+ * @brief Initialise a pool
+ *
+ * @param pool Pool to initialise
+ * @param name Name of the pool, for the stats. Must outlive the pool.
+ * @param object_size Size of the objects
+ * @param objects_per_slab Number of objects to allocate at a time
+ */
+void pool_init(pool_t *pool, const char *name, size_t object_size, size_t objects_per_slab);
+
+/**
+ * @brief Release a pool's slabs. Every object must have been freed.
+ *
+ * @param pool Pool to release
+ */
+void pool_deinit(pool_t *pool);
+
+/**
+ * @brief Allocate a zeroed object
+ *
+ * @param pool Pool to allocate from
+ * @return the object, or NULL on failure
+ */
+void *pool_alloc(pool_t *pool);
+
+/**
+ * @brief Free an object
+ *
+ * @param pool Pool it was allocated from
+ * @param object The object (may be NULL)
+ */
+void pool_free(pool_t *pool, void *object);
+
+/**
+ * @brief Get the stats of a pool
+ *
+ * @param pool The pool
+ * @param stats Filled in with its stats
+ */
+void pool_get_stats(pool_t *pool, pool_stats_t *stats);
+
+/**
+ * @brief Get the stats of every pool that has allocated anything
+ *
+ * @param stats Filled in with the stats of a pool each
+ * @param max_stats Number of entries stats holds
+ * @return the number of entries filled in
+ */
+size_t pool_read_stats(pool_stats_t *stats, size_t max_stats);
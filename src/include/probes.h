@@ -0,0 +1,63 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+/**
+ * Static tracepoints (USDT) of provider "smart_manager", for bpftrace, perf and systemtap to
+ * attach to on a running unit, e.g.
+ *
+ *   bpftrace -p $(pidof smart_manager) \
+ *       -e 'usdt:*:hostapd__request__done { @latency_us[arg0] = hist(arg2); }'
+ *
+ * They are built in when the build finds <sys/sdt.h> (systemtap-sdt-dev), unless built with
+ * --no-usdt. A probe is a single nop until a tracer attaches, so its arguments should be values
+ * already at hand rather than anything worked out just for it. Without <sys/sdt.h> they compile
+ * to nothing and their arguments aren't evaluated, so they mustn't have side effects.
+ *
+ * The probes, and their arguments:
+ *  - request__start(intf, key): the engine starts a request, key being the command's key, a
+ *    number or its first 4 characters, as in the flight recorder (see @ref trace_type)
+ *  - request__done(intf, key, ok): it finished, served by the backend or the request cache, ok
+ *    being 0 if it failed
+ *  - backend__request(intf, key, failed, latency_us): a request reached the backend
+ *  - event__receive(intf, key): a notification was received, before it is dispatched
+ *  - callback__done(intf, polling, duration_us): a pattern monitor's callback, or a polling
+ *    monitor's if polling is 1, returned
+ *  - hostapd__request__start(conn, cmd): a command string is sent on a control connection
+ *  - hostapd__request__done(conn, err, latency_us): its reply arrived, or it failed
+ *  - hostapd__event(msg): a notification string arrived
+ *  - nl80211__request__start(cmd): an NL80211_CMD_* is sent
+ *  - nl80211__request__done(cmd, err, latency_us): it finished
+ *  - nl80211__event(cmd): an NL80211_CMD_* notification arrived
+ *  - morsectrl__request__start(id, num): num morsectrl commands, the first being id, are sent
+ *  - morsectrl__request__done(id, err, latency_us): they finished
+ *  - dcs__scan__start(channel): DCS starts an off-channel scan of the S1G channel
+ *  - dcs__scan__done(failed, metric, noise): the scan's result arrived, or it failed. None
+ *    arrives if it timed out.
+ *  - dcs__csa__start(channel): DCS starts a channel switch to the S1G channel
+ *  - dcs__csa__done(channel, err): the switch finished, err being 0 or a negative errno
+ */
+
+#ifdef MMSM_USDT
+
+#include <sys/sdt.h>
+
+#define MMSM_PROBE1(name, a) DTRACE_PROBE1(smart_manager, name, a)
+#define MMSM_PROBE2(name, a, b) DTRACE_PROBE2(smart_manager, name, a, b)
+#define MMSM_PROBE3(name, a, b, c) DTRACE_PROBE3(smart_manager, name, a, b, c)
+#define MMSM_PROBE4(name, a, b, c, d) DTRACE_PROBE4(smart_manager, name, a, b, c, d)
+
+#else
+
+/* Not evaluated, but still a use of the arguments, so values kept just for a probe don't warn */
+#define MMSM_PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define MMSM_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define MMSM_PROBE3(name, a, b, c) \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define MMSM_PROBE4(name, a, b, c, d) \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while (0)
+
+#endif
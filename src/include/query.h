@@ -0,0 +1,83 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * Query endpoint: answers other processes on the box, such as management agents, from the state
+ * Smart Manager already holds in memory, so they needn't poll hostapd or the driver themselves.
+ * See query_socket in the engine config.
+ *
+ * Clients connect to the UNIX socket and send a line at a time, each answered with lines of
+ * text ending with an empty line:
+ *
+ *   PING                  answered with PONG
+ *   TOPICS                the topics that can be queried, one per line
+ *   <topic> [args]        the topic's state, as written by its module, e.g. "channel wlan0"
+ *   SUBSCRIBE <topic>     answered with OK, and from then on the topic's notifications are
+ *                         sent as they happen, each as a line "EVENT <topic> <text>"
+ *   UNSUBSCRIBE <topic>   answered with OK
+ *
+ * Anything else is answered with a line starting "ERROR". Notifications are sent between
+ * answers, never within one. A client that doesn't take what is sent to it without blocking is
+ * disconnected, so it can never hold up the thread notifying.
+ *
+ * Modules register the topics they answer with @ref query_register, and raise notifications
+ * with @ref query_notify. Notifications can be raised on topics that can't be queried too.
+ */
+
+/**
+ * @brief Write a topic's state
+ *
+ * Called on the query thread for each query of the topic. Must not make requests to backends,
+ * wait on anything slow or raise notifications, only copy out what is already in memory.
+ *
+ * @param context As registered
+ * @param args What followed the topic in the query, or ""
+ * @param out Where to write the state, as lines of text. Lines mustn't be empty.
+ */
+typedef void (*query_fn_t)(void *context, const char *args, FILE *out);
+
+/**
+ * @brief Register a topic a module answers queries on
+ *
+ * @param topic Name of the topic, without spaces, e.g. "channel". Must outlive the registration.
+ * @param fn Writes the topic's state
+ * @param context Passed to fn
+ * @return 0 on success, -EEXIST if the topic is already registered, or -ENOMEM
+ */
+int query_register(const char *topic, query_fn_t fn, void *context);
+
+/**
+ * @brief Unregister a topic. Once it returns, fn is not running and won't be called.
+ *
+ * @param topic As registered
+ * @param fn As registered
+ * @param context As registered
+ */
+void query_unregister(const char *topic, query_fn_t fn, void *context);
+
+/**
+ * @brief Send a notification to every client subscribed to a topic. Never blocks on clients.
+ *
+ * @param topic The topic
+ * @param fmt printf style format of the text, a single line
+ */
+void query_notify(const char *topic, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Start answering queries
+ *
+ * @param socket_path UNIX socket to listen on
+ * @return 0 on success, else a negative errno
+ */
+int query_server_start(const char *socket_path);
+
+/**
+ * @brief Stop answering queries, disconnecting every client, if started
+ */
+void query_server_stop(void);
@@ -0,0 +1,92 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Minimal read-copy-update APIs.
+ *
+ * Readers wrap their accesses to shared data in @ref rcu_read_lock and @ref rcu_read_unlock,
+ * which never block and don't take any locks once a thread has made its first call. Writers
+ * (serialised by their own lock) build a new copy of the data, publish it with
+ * @ref rcu_assign_pointer and then hand the old copy to @ref rcu_call. The old copy is freed
+ * once every reader that could have seen it has left its read-side critical section.
+ *
+ * Threads are registered as readers on their first @ref rcu_read_lock and unregistered when
+ * they exit.
+ */
+
+/**
+ * @brief Load an RCU-protected pointer. Must be used within a read-side critical section.
+ */
+#define rcu_dereference(_p) __atomic_load_n(&(_p), __ATOMIC_ACQUIRE)
+
+/**
+ * @brief Publish a new value of an RCU-protected pointer
+ */
+#define rcu_assign_pointer(_p, _v) __atomic_store_n(&(_p), (_v), __ATOMIC_RELEASE)
+
+struct rcu_head;
+
+/**
+ * @brief Function called once a grace period has elapsed after @ref rcu_call
+ */
+typedef void (*rcu_callback_fn_t)(struct rcu_head *head);
+
+/**
+ * @brief Deferred callback. Embed this in the structure to be reclaimed.
+ */
+typedef struct rcu_head
+{
+    /** Queue link, owned by RCU while queued */
+    struct rcu_head *next;
+    /** The function to call */
+    rcu_callback_fn_t fn;
+} rcu_head_t;
+
+/**
+ * @brief Enter a read-side critical section. May be nested.
+ */
+void rcu_read_lock(void);
+
+/**
+ * @brief Leave a read-side critical section
+ */
+void rcu_read_unlock(void);
+
+/**
+ * @brief Check if the calling thread is within a read-side critical section
+ *
+ * @return true if in a read-side critical section, else false
+ */
+bool rcu_read_lock_held(void);
+
+/**
+ * @brief Queue a callback to run once every current reader has finished
+ *
+ * The callback runs from a later call to @ref rcu_synchronize or @ref rcu_reclaim, on the thread
+ * that made that call.
+ *
+ * @param head Deferred callback to queue. Must not already be queued.
+ * @param fn The function to call
+ */
+void rcu_call(rcu_head_t *head, rcu_callback_fn_t fn);
+
+/**
+ * @brief Wait for every current reader to finish, then run the callbacks queued before the call
+ *
+ * Must not be called from within a read-side critical section.
+ */
+void rcu_synchronize(void);
+
+/**
+ * @brief Run queued callbacks if no reader is within a read-side critical section
+ *
+ * Never waits, so can be used where @ref rcu_synchronize would be too costly or could deadlock.
+ * Callbacks that can't be run yet are left queued.
+ */
+void rcu_reclaim(void);
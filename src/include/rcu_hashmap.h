@@ -0,0 +1,146 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "hashmap.h"
+#include "rcu.h"
+
+/**
+ * Concurrent hashmap APIs, for state shared between threads such as per-station or
+ * per-frequency tables.
+ *
+ * Like @ref hashmap_t the map holds pointers to user entries and reads their keys through a
+ * get_key function. Lookups and iteration run under @ref rcu_read_lock, take no locks and never
+ * wait for a writer. Writers are serialised by a mutex in the map.
+ *
+ * Readers may still be using an entry after it leaves the map, so an entry returned by
+ * @ref rcu_hashmap_remove or @ref rcu_hashmap_replace must only be freed once a grace period has
+ * elapsed, e.g. with @ref rcu_call. For the same reason, readers must not see an entry change:
+ * update one by building a copy and swapping it in with @ref rcu_hashmap_replace. The map's own
+ * storage is reclaimed the same way, so whatever runs @ref rcu_synchronize or @ref rcu_reclaim
+ * also frees it.
+ */
+
+struct rcu_hashmap_table;
+
+/**
+ * @brief Concurrent hashmap object
+ */
+typedef struct rcu_hashmap
+{
+    /** The current table, replaced when the map grows */
+    struct rcu_hashmap_table *table;
+    /** Number of entries */
+    size_t count;
+    /** Key size in bytes, passed to the key functions */
+    size_t key_size;
+    hashmap_get_key_fn_t get_key;
+    hashmap_hash_fn_t hash_fn;
+    hashmap_equal_fn_t equal_fn;
+    /** Serialises writers */
+    pthread_mutex_t mutex;
+} rcu_hashmap_t;
+
+/**
+ * @brief Initialise a map with custom key functions
+ *
+ * @param map Map to initialise
+ * @param capacity Number of entries to make room for up front. The map grows beyond this.
+ * @param key_size Size of key in bytes, passed to the key functions
+ * @param get_key Function to get the key of an entry
+ * @param hash_fn Function to hash a key
+ * @param equal_fn Function to compare keys
+ * @return 0 on success, or -ENOMEM
+ */
+int rcu_hashmap_init_custom(rcu_hashmap_t *map, size_t capacity, size_t key_size,
+                            hashmap_get_key_fn_t get_key, hashmap_hash_fn_t hash_fn,
+                            hashmap_equal_fn_t equal_fn);
+
+/**
+ * @brief Initialise a map that hashes and compares the key_size bytes of each key
+ *
+ * @param map Map to initialise
+ * @param capacity Number of entries to make room for up front. The map grows beyond this.
+ * @param key_size Size of key in bytes
+ * @param get_key Function to get the key of an entry
+ * @return 0 on success, or -ENOMEM
+ */
+int rcu_hashmap_init(rcu_hashmap_t *map, size_t capacity, size_t key_size,
+                     hashmap_get_key_fn_t get_key);
+
+/**
+ * @brief Free the map's storage, and optionally each entry
+ *
+ * Nothing else may be using the map. Entries are freed straight away, not after a grace period.
+ *
+ * @param map Map to clean up
+ * @param free_fn Function to free each entry (can be NULL)
+ */
+void rcu_hashmap_cleanup(rcu_hashmap_t *map, void (*free_fn)(void *entry));
+
+/**
+ * @brief Find an entry by key
+ *
+ * Must be called within a read-side critical section. The entry stays valid until the caller
+ * leaves it.
+ *
+ * @param map Map to search
+ * @param key Key to find
+ * @return the entry, or NULL if there is none
+ */
+void *rcu_hashmap_find(rcu_hashmap_t *map, const void *key);
+
+/**
+ * @brief Add an entry, unless one with the same key is already present
+ *
+ * @param map Map to add to
+ * @param entry Entry to add
+ * @return 0 on success, -EEXIST if the key is already present, or -ENOMEM
+ */
+int rcu_hashmap_insert(rcu_hashmap_t *map, void *entry);
+
+/**
+ * @brief Replace the entry with the same key as another
+ *
+ * Readers see either the old entry or the new one, never neither.
+ *
+ * @param map Map to update
+ * @param entry The new entry
+ * @return the old entry, to be freed after a grace period, or NULL if the key isn't present, in
+ *         which case nothing is added
+ */
+void *rcu_hashmap_replace(rcu_hashmap_t *map, void *entry);
+
+/**
+ * @brief Remove the entry with a key
+ *
+ * @param map Map to remove from
+ * @param key Key to remove
+ * @return the removed entry, to be freed after a grace period, or NULL if there was none
+ */
+void *rcu_hashmap_remove(rcu_hashmap_t *map, const void *key);
+
+/**
+ * @brief Call a function on every entry
+ *
+ * Runs in a read-side critical section, so the function must not wait for a grace period. It
+ * may add and remove entries. Entries present throughout are visited exactly once; entries
+ * added or removed meanwhile may or may not be.
+ *
+ * @param map Map to iterate
+ * @param fn Function to call with each entry and arg
+ * @param arg Passed to fn
+ */
+void rcu_hashmap_iterate(rcu_hashmap_t *map, void (*fn)(void *entry, void *arg), void *arg);
+
+/**
+ * @brief Get the number of entries
+ */
+size_t rcu_hashmap_count(rcu_hashmap_t *map);
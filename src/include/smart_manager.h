@@ -26,9 +26,64 @@ void
 mmsm_init(void);
 
 
+/**
+ * Applies the engine settings from the config file.
+ *
+ * Must be called before @ref mmsm_start for the settings to take effect. Settings
+ * that are missing keep their defaults. Recognised settings are:
+ *
+ *     engine: {
+ *         polling_workers = <number of threads running polling monitors, 0 = inline>
+ *         group_by_backend = <bool, run each backend's monitors on one worker>
+ *         request_workers = <number of threads running mmsm_request_async requests
+ *                            for backends without req_submit>
+ *         event_loop = <bool, receive the notifications of every backend that
+ *                       supports it on one epoll thread instead of a thread each>
+ *         request_cache = <bool, coalesce and cache the commands registered
+ *                          with mmsm_request_cache_command>
+ *         dispatch_queue = <number of notifications queued per interface
+ *                           between receiving and running the pattern monitor
+ *                           callbacks on a thread of their own, 0 = inline>
+ *         dispatch_overflow = <"drop_oldest", "block" or "count", what to do
+ *                              when a queue is full. "count" drops the new
+ *                              notification.>
+ *         stats_interval_s = <seconds between writes of the counters from
+ *                             mmsm_get_stats to the engine_stats datalog,
+ *                             0 = never>
+ *         polling_schedule = <"fixed_delay" or "fixed_rate". "fixed_delay"
+ *                             polls a monitor its frequency after its last poll
+ *                             finished, "fixed_rate" on a fixed grid from its
+ *                             first poll, skipping the polls it fell behind on.>
+ *         polling_spread = <bool, start each polling monitor at a phase of its
+ *                           own within its period, rather than as registered>
+ *         polling_jitter_ms = <up to this many milliseconds added at random to
+ *                              each poll, 0 = none>
+ *         trace_file = <file the flight recorder is dumped to, see trace.h>
+ *         metrics_socket = <UNIX socket the metrics are written to every
+ *                           connection on, see metrics.h, "" = not served>
+ *         metrics_port = <TCP port the metrics are served on over HTTP, as
+ *                         GET /metrics, 0 = not served>
+ *         metrics_address = <IPv4 address metrics_port is bound to,
+ *                            default "127.0.0.1">
+ *         query_socket = <UNIX socket other processes can query the state
+ *                         held in memory on, and subscribe to its changes,
+ *                         see query.h, "" = not served>
+ *     }
+ *
+ * @param cfg The engine config setting (may be NULL)
+ */
+void
+mmsm_set_engine_config(config_setting_t *cfg);
+
+
 /**
  * The callback function when data is passed back to the user application.
  *
+ * The result is shared by every callback it is provided to, and is freed once
+ * they have returned. To keep it for longer, for example to hand it to another
+ * thread, take a reference with mmsm_data_item_retain rather than copying it,
+ * and release it when done. Treat it as read only either way.
+ *
  * @param context The user context provided with the callback
  * @param intf The interface that generated the data in this callback
  * @param result The data
@@ -73,6 +128,158 @@ mmsm_data_item_t *
 mmsm_request(mmsm_backend_intf_t *intf, ...);
 
 
+/**
+ * Registers a command whose responses are shared between requests.
+ *
+ * The arguments after the time to live are the same as for @ref mmsm_request
+ * on the same interface. When the engine's request_cache setting is enabled,
+ * requests for the same command on the same interface (from @ref mmsm_request,
+ * @ref mmsm_request_async or polling monitors) that are made while one is in
+ * flight wait for it and receive the same response instead of making their
+ * own round-trip. The response is then reused until its time to live expires
+ * or @ref mmsm_request_cache_invalidate is called. Each requester receives a
+ * reference to the shared response (see mmsm_data_item_retain), which it
+ * frees as usual but must not modify.
+ *
+ * Registering a command again updates its time to live.
+ *
+ * @param intf The interface the command is sent on
+ * @param ttl_ms How long a response stays valid in milliseconds, or 0 to only
+ *               share the responses of concurrent requests
+ *
+ * @returns an appropriate status code
+ */
+mmsm_error_code
+mmsm_request_cache_command(mmsm_backend_intf_t *intf, uint32_t ttl_ms, ...);
+
+
+/**
+ * Drops the cached responses of the given interface.
+ *
+ * Use this when something is known to have changed what the commands would
+ * return, e.g. after a channel switch. Requests already in flight are not
+ * cached when they complete.
+ *
+ * @param intf The interface to drop the responses of
+ */
+void
+mmsm_request_cache_invalidate(mmsm_backend_intf_t *intf);
+
+
+/**
+ * Unregisters every cached command of the given interface.
+ *
+ * Must be called before destroying an interface that has registered commands.
+ *
+ * @param intf The interface to unregister the commands of
+ */
+void
+mmsm_request_cache_remove(mmsm_backend_intf_t *intf);
+
+
+/**
+ * Sends a request on the given interface without waiting for the response.
+ *
+ * The arguments after the context are the same as for @ref mmsm_request on the
+ * same interface. When the response arrives, it is provided on the callback. The
+ * result is freed once the callback returns. If the request fails after it has
+ * been accepted, the callback receives a @c NULL result.
+ *
+ * Backends that can keep requests in flight (see req_submit) have the response
+ * matched to the request inside the backend. For other backends the request is
+ * run on one of the engine's request worker threads.
+ *
+ * @note The callback may run on a backend or worker thread, possibly before this
+ *       function returns.
+ *
+ * @param intf The interface to send the request on
+ * @param callback The callback to provide the response on
+ * @param context Context to provide back to the application with the callback
+ *
+ * @returns MMSM_SUCCESS if the request was accepted, in which case the callback
+ *          will be called exactly once. Otherwise an appropriate error code.
+ */
+mmsm_error_code
+mmsm_request_async(mmsm_backend_intf_t *intf,
+                   mmsm_data_callback_fn_t callback,
+                   void *context,
+                   ...);
+
+
+/**
+ * A set of requests, possibly on different interfaces, sent together with
+ * @ref mmsm_request_batch.
+ */
+typedef struct mmsm_batch mmsm_batch_t;
+
+
+/**
+ * Creates an empty batch of requests.
+ *
+ * @returns the batch, or @c NULL on failure
+ */
+mmsm_batch_t *
+mmsm_batch_create(void);
+
+
+/**
+ * Adds a request to a batch.
+ *
+ * The arguments after the interface are the same as for @ref mmsm_request on the
+ * same interface. Results are indexed in the order requests are added,
+ * starting at 0.
+ *
+ * @param batch The batch to add to. Must not have been sent yet.
+ * @param intf The interface to send the request on
+ *
+ * @returns an appropriate status code
+ */
+mmsm_error_code
+mmsm_batch_add(mmsm_batch_t *batch, mmsm_backend_intf_t *intf, ...);
+
+
+/**
+ * Sends every request of a batch and waits for all of the responses.
+ *
+ * Requests on backends that can keep requests in flight (see req_submit) are
+ * all submitted before waiting on any of them. The others are run concurrently
+ * on the engine's request worker threads and the calling thread, so the batch
+ * takes roughly as long as its slowest request rather than the sum of them.
+ *
+ * A batch can only be sent once.
+ *
+ * @param batch The batch to send
+ *
+ * @returns MMSM_SUCCESS once every request has completed, whether or not they
+ *          succeeded (see @ref mmsm_batch_get_result). Otherwise an appropriate
+ *          error code.
+ */
+mmsm_error_code
+mmsm_request_batch(mmsm_batch_t *batch);
+
+
+/**
+ * Gets the response to one request of a sent batch.
+ *
+ * @param batch The batch
+ * @param index The index of the request, in the order it was added
+ *
+ * @returns the response, owned by the batch and valid until it is freed, or
+ *          @c NULL if the request failed
+ */
+mmsm_data_item_t *
+mmsm_batch_get_result(mmsm_batch_t *batch, size_t index);
+
+
+/**
+ * Frees a batch and all of its responses.
+ *
+ * @param batch The batch to free (may be NULL)
+ */
+void
+mmsm_batch_free(mmsm_batch_t *batch);
+
+
 /**
  * Registers a polling monitor on the given interface.
  *
@@ -95,14 +302,66 @@ mmsm_monitor_polling(mmsm_backend_intf_t *intf,
                      ...);
 
 
+/**
+ * Removes polling monitors from the given interface.
+ *
+ * Removes every polling monitor on the interface that was registered with the
+ * given callback and context. May be called at any time, including from within
+ * a monitor callback.
+ *
+ * Unless called from within a polling monitor callback, the callback is not
+ * running and will not be called again once this returns.
+ *
+ * @param intf The interface the monitors were registered on
+ * @param callback The callback the monitors were registered with
+ * @param context The context the monitors were registered with
+ *
+ * @returns MMSM_SUCCESS if any monitors were removed, else an appropriate error code
+ */
+mmsm_error_code
+mmsm_monitor_polling_remove(mmsm_backend_intf_t *intf,
+                            mmsm_data_callback_fn_t callback,
+                            void *context);
+
+
+/**
+ * Gets how late the currently running polling monitor fired.
+ *
+ * Polling monitors are scheduled on CLOCK_MONOTONIC. When a monitor's callback is
+ * running, this returns the number of microseconds between the time the monitor
+ * was due and the time it was actually fired.
+ *
+ * @note Only meaningful when called from within a polling monitor callback.
+ *
+ * @returns the lag in microseconds, or -1 if not called from a polling monitor
+ *          callback
+ */
+int64_t
+mmsm_monitor_polling_get_lag_us(void);
+
+
 /**
  * Registers a pattern monitor on the given interface.
  *
  * The pattern monitor scans incoming notifications on the interface and reports
  * any matches up to the application on the provided callback.
  *
+ * The arguments after the context are formatted as for @ref mmsm_request on the
+ * same interface. A notification matches when one of its top level items has the
+ * same key as the command, and every further item of the command (e.g. nl80211
+ * attributes) is present in that item's sub-values, with the same value if one
+ * was given. If pattern is not empty, the matching item's value must also be a
+ * string matching it as a shell wildcard pattern (see fnmatch(3)), e.g.
+ * "02:00:00:*" for the station address of a hostapd AP-STA-CONNECTED event.
+ *
+ * Monitors are indexed by command key and by the first further item, so a
+ * notification is only checked against monitors it can match.
+ *
+ * Monitors can be registered before or after @ref mmsm_start, including from
+ * within a monitor callback.
+ *
  * @param intf The interface to send the request on
- * @param pattern The pattern to search for
+ * @param pattern The pattern to match the value against, or "" to match any value
  * @param callback The callback to provide the response on
  * @param context Context to provide back to the application wit the callback
  */
@@ -113,6 +372,175 @@ mmsm_monitor_pattern(mmsm_backend_intf_t *intf,
                      void *context,
                      ...);
 
+
+/**
+ * Removes pattern monitors from the given interface.
+ *
+ * Removes every pattern monitor on the interface that was registered with the
+ * given callback and context. May be called at any time, including from within
+ * a monitor callback.
+ *
+ * Unless called from within a pattern monitor callback, the callback is not
+ * running and will not be called again once this returns.
+ *
+ * @param intf The interface the monitors were registered on
+ * @param callback The callback the monitors were registered with
+ * @param context The context the monitors were registered with
+ *
+ * @returns MMSM_SUCCESS if any monitors were removed, else an appropriate error code
+ */
+mmsm_error_code
+mmsm_monitor_pattern_remove(mmsm_backend_intf_t *intf,
+                            mmsm_data_callback_fn_t callback,
+                            void *context);
+
+/**
+ * Statistics of an interface's notification queue, see dispatch_queue in
+ * @ref mmsm_set_engine_config.
+ */
+typedef struct mmsm_monitor_queue_stats_t
+{
+    /** Number of notifications the queue can hold */
+    uint32_t capacity;
+    /** Number of notifications currently waiting to be dispatched */
+    uint32_t depth;
+    /** Highest number of notifications that have been waiting at once */
+    uint32_t max_depth;
+    /** Number of notifications dropped because the queue was full */
+    uint64_t dropped;
+} mmsm_monitor_queue_stats_t;
+
+
+/**
+ * Gets the statistics of the notification queue of the given interface.
+ *
+ * @param intf The interface
+ * @param stats Filled in with the statistics
+ *
+ * @returns MMSM_SUCCESS, or an appropriate error code if the interface has no
+ *          pattern monitors running or its notifications aren't queued
+ */
+mmsm_error_code
+mmsm_monitor_get_queue_stats(mmsm_backend_intf_t *intf, mmsm_monitor_queue_stats_t *stats);
+
+/** Number of buckets in a @ref mmsm_histogram_t */
+#define MMSM_HISTOGRAM_BUCKETS (32)
+
+
+/**
+ * A histogram of durations, in log2 buckets of microseconds.
+ *
+ * Bucket 0 counts durations under 1us, and bucket n counts durations from
+ * 2^(n-1) up to 2^n - 1 us. The last bucket also counts anything longer.
+ */
+typedef struct mmsm_histogram_t
+{
+    /** Number of durations recorded */
+    uint64_t count;
+    /** Sum of the durations recorded, in microseconds */
+    uint64_t sum_us;
+    /** Longest duration recorded, in microseconds */
+    uint64_t max_us;
+    /** Number of durations recorded in each bucket */
+    uint64_t buckets[MMSM_HISTOGRAM_BUCKETS];
+} mmsm_histogram_t;
+
+
+/**
+ * Counters kept by the engine for a backend interface or a monitor.
+ */
+typedef struct mmsm_stats_counters_t
+{
+    /** Time taken by requests. For backends this is the time spent in the backend. */
+    mmsm_histogram_t request_us;
+    /** Time taken by the callback */
+    mmsm_histogram_t callback_us;
+    /** How late polling monitors fired compared with when they were due */
+    mmsm_histogram_t lag_us;
+    /** Number of requests that failed */
+    uint64_t errors;
+    /** Number of times a polling monitor fired a whole period late, or was skipped */
+    uint64_t deadline_misses;
+} mmsm_stats_counters_t;
+
+
+/**
+ * What a @ref mmsm_stats_entry_t describes
+ */
+typedef enum mmsm_stats_type_t
+{
+    MMSM_STATS_BACKEND,
+    MMSM_STATS_POLLING_MONITOR,
+    MMSM_STATS_PATTERN_MONITOR,
+} mmsm_stats_type_t;
+
+
+/**
+ * The counters of one backend interface or monitor.
+ */
+typedef struct mmsm_stats_entry_t
+{
+    /** What the entry describes */
+    mmsm_stats_type_t type;
+    /** The interface */
+    mmsm_backend_intf_t *intf;
+    /** The monitor's callback, or NULL for a backend */
+    mmsm_data_callback_fn_t callback;
+    /** The monitor's context, or NULL for a backend */
+    void *context;
+    /** The polling monitor's period, or 0 */
+    uint32_t frequency_ms;
+    /** The counters */
+    mmsm_stats_counters_t counters;
+} mmsm_stats_entry_t;
+
+
+/**
+ * A snapshot of the engine's counters.
+ */
+typedef struct mmsm_stats_t
+{
+    /** Number of entries */
+    size_t num_entries;
+    /** One entry per backend interface that has made requests, then one per monitor */
+    mmsm_stats_entry_t entries[];
+} mmsm_stats_t;
+
+
+/**
+ * Takes a snapshot of the engine's counters.
+ *
+ * The counters are always collected. Counters of monitors that have been
+ * removed are not included.
+ *
+ * @returns the snapshot, to be freed with @ref mmsm_stats_free, or @c NULL on
+ *          failure
+ */
+mmsm_stats_t *
+mmsm_get_stats(void);
+
+
+/**
+ * Frees a snapshot returned by @ref mmsm_get_stats.
+ *
+ * @param stats The snapshot (may be NULL)
+ */
+void
+mmsm_stats_free(mmsm_stats_t *stats);
+
+
+/**
+ * Estimates a percentile of the durations in a histogram.
+ *
+ * @param histogram The histogram
+ * @param percent The percentile, from 0 to 100
+ *
+ * @returns the upper bound in microseconds of the bucket containing the
+ *          percentile, capped to the longest duration recorded
+ */
+uint64_t
+mmsm_histogram_percentile_us(const mmsm_histogram_t *histogram, unsigned int percent);
+
 /**
  * @brief Halt the smart manager by unblocking the root thread, and allowing it to return from main.
  *
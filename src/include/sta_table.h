@@ -0,0 +1,124 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "smart_manager.h"
+
+/**
+ * Station table APIs, which keep the stations associated with a hostapd interface in memory.
+ *
+ * The table is filled from hostapd's station list when created, then kept up to date from
+ * AP-STA-CONNECTED and AP-STA-DISCONNECTED notifications, so checking which stations are
+ * connected never needs a round-trip to hostapd. The details hostapd reports for a station (the
+ * response to "STA <addr>") are only requested when first asked for, and are then reused until
+ * their time to live expires or they are invalidated.
+ *
+ * Lookups don't take locks and may be made from any thread, including monitor callbacks.
+ *
+ * Notifications can be missed, e.g. while hostapd restarts or when a dispatch_queue overflows
+ * (see @ref mmsm_set_engine_config), so @ref mmsm_sta_table_resync is provided to start again
+ * from hostapd's station list.
+ */
+
+typedef struct mmsm_sta_table mmsm_sta_table_t;
+
+/**
+ * @brief Function called with each station by @ref mmsm_sta_table_iterate
+ *
+ * @param context The context provided to @ref mmsm_sta_table_iterate
+ * @param addr The station's MAC address
+ */
+typedef void (*mmsm_sta_table_fn_t)(void *context, const uint8_t addr[6]);
+
+/**
+ * @brief Create a station table for a hostapd interface
+ *
+ * Registers pattern monitors on the interface, then requests hostapd's station list. Can be
+ * called before or after @ref mmsm_start.
+ *
+ * @param intf A hostapd control interface
+ * @param info_ttl_ms How long the details of a station are reused for, or 0 to reuse them until
+ *                    the station reconnects or @ref mmsm_sta_table_invalidate is called
+ * @return the table, or NULL on failure
+ */
+mmsm_sta_table_t *mmsm_sta_table_create(mmsm_backend_intf_t *intf, uint32_t info_ttl_ms);
+
+/**
+ * @brief Destroy a station table
+ *
+ * Waits for any of the table's monitor callbacks that are running to return, so must not be
+ * called from a monitor callback. Nothing else may be using the table.
+ *
+ * @param table The table (may be NULL)
+ */
+void mmsm_sta_table_destroy(mmsm_sta_table_t *table);
+
+/**
+ * @brief Rebuild the table from hostapd's station list
+ *
+ * Stations that have left are removed and the details of every station are refreshed.
+ * Notifications keep being applied meanwhile, though a station that leaves while the list is
+ * being read may be kept until the next notification or resync for it.
+ *
+ * @param table The table
+ * @return 0 on success, or -EIO if the list couldn't be read, in which case the table is
+ *         unchanged apart from the stations already read
+ */
+int mmsm_sta_table_resync(mmsm_sta_table_t *table);
+
+/**
+ * @brief Get the number of stations connected
+ */
+size_t mmsm_sta_table_count(mmsm_sta_table_t *table);
+
+/**
+ * @brief Check if a station is connected
+ *
+ * @param table The table
+ * @param addr The station's MAC address
+ * @return true if the station is connected
+ */
+bool mmsm_sta_table_contains(mmsm_sta_table_t *table, const uint8_t addr[6]);
+
+/**
+ * @brief Get the details of a connected station
+ *
+ * Reuses the last details received for the station if they are still valid, otherwise
+ * requests them from hostapd and blocks until they are received.
+ *
+ * @param table The table
+ * @param addr The station's MAC address
+ * @return a reference to the station's details as reported by hostapd, to be released with
+ *         @ref mmsm_data_item_release and treated as read only, or NULL if the station isn't
+ *         connected or its details couldn't be received
+ */
+mmsm_data_item_t *mmsm_sta_table_get_info(mmsm_sta_table_t *table, const uint8_t addr[6]);
+
+/**
+ * @brief Discard the details kept for a station, so the next call to @ref mmsm_sta_table_get_info
+ *        requests them again
+ *
+ * @param table The table
+ * @param addr The station's MAC address, or NULL for every station
+ */
+void mmsm_sta_table_invalidate(mmsm_sta_table_t *table, const uint8_t addr[6]);
+
+/**
+ * @brief Call a function with every connected station
+ *
+ * Doesn't block notifications from being applied. Stations connected throughout are visited
+ * exactly once; stations that connect or leave meanwhile may or may not be. The function runs
+ * in a read-side critical section (see rcu.h), so must not destroy a table.
+ *
+ * @param table The table
+ * @param fn Function to call with each station
+ * @param context Passed to fn
+ */
+void mmsm_sta_table_iterate(mmsm_sta_table_t *table, mmsm_sta_table_fn_t fn, void *context);
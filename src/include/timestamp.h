@@ -37,6 +37,24 @@ bool timestamp_from_iso_string(const char *str, timestamp_t *timestamp);
  */
 void timestamp_write_to_file_as_iso(FILE* file, timestamp_t *timestamp);
 
+/**
+ * @brief Convert a timestamp in local time, as filled by @ref timestamp_get, to msecs since the
+ * epoch
+ *
+ * @param timestamp Timestamp to convert
+ * @return msecs since the epoch, or 0 if the timestamp is invalid
+ */
+uint64_t timestamp_to_ms(const timestamp_t *timestamp);
+
+/**
+ * @brief Convert msecs since the epoch to a timestamp in local time, the reverse of
+ * @ref timestamp_to_ms
+ *
+ * @param ms msecs since the epoch
+ * @param timestamp Timestamp to fill
+ */
+void timestamp_from_ms(uint64_t ms, timestamp_t *timestamp);
+
 /**
  * @brief Fill the timestamp structure with the current system time
  *
@@ -44,6 +62,16 @@ void timestamp_write_to_file_as_iso(FILE* file, timestamp_t *timestamp);
  */
 void timestamp_get(timestamp_t *timestamp);
 
+/**
+ * @brief Fill the timestamp structure with the current system time, as of the last clock tick
+ *
+ * Cheaper than @ref timestamp_get, but the milliseconds are only as fine as the tick, a few ms.
+ * Enough for log lines, which only show the second.
+ *
+ * @param timestamp Timestamp to fill
+ */
+void timestamp_get_coarse(timestamp_t *timestamp);
+
 /**
  * @brief Get the current system time in usecs
  *
@@ -57,3 +85,13 @@ uint64_t get_timestamp_us();
  * @return current timestamp in msecs
  */
 uint64_t get_timestamp_ms();
+
+/**
+ * @brief Get the time on the monotonic clock, as of the last clock tick, in msecs
+ *
+ * Cheap, and unaffected by the system time being set, so suited to timing intervals of more
+ * than a few ms.
+ *
+ * @return msecs since an arbitrary point
+ */
+uint64_t timestamp_monotonic_ms(void);
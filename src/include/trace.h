@@ -0,0 +1,180 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Flight recorder: a fixed size ring of compact binary records of what the engine, backends and
+ * modules have recently done, always on, so there is something to go on after a field unit
+ * misbehaves without VERBOSE logging.
+ *
+ * Writing a record claims a slot with a single atomic add, so it never takes a lock. The ring is
+ * dumped to the engine's "trace_file" on SIGUSR1, and when an MMSM_ASSERT fails. Convert a dump
+ * to text with trace_export.
+ */
+
+/** Magic at the start of a dump, see @ref trace_dump */
+#define TRACE_MAGIC "MMSMTRCE"
+
+/** Version of the dump format */
+#define TRACE_VERSION (1)
+
+/** Number of records the ring holds, a power of 2 */
+#define TRACE_RECORDS (4096)
+
+/** Where a record comes from */
+enum trace_source
+{
+    TRACE_ENGINE = 1,
+    TRACE_HOSTAPD,
+    TRACE_NL80211,
+    TRACE_MORSECTRL,
+    TRACE_DCS,
+};
+
+/**
+ * What a record is of. What its id, arg and value hold depends on it, and for requests, on the
+ * source:
+ *  - engine requests and events: id is the backend, by the order it was first used in, and arg
+ *    the command's or notification's key, a number or its first 4 characters
+ *  - nl80211 requests and events: id is the NL80211_CMD_*
+ *  - hostapd requests: id is the connection the request was sent on, and arg the first 4
+ *    characters of it, see @ref trace_name
+ *  - morsectrl requests: id is the id of the first command, and arg the number of commands
+ */
+enum trace_type
+{
+    /** A request was started */
+    TRACE_REQUEST_START = 1,
+    /** A request finished: arg is 0 on success, else nonzero, and value the latency in us */
+    TRACE_REQUEST_END,
+    /** A notification was received */
+    TRACE_EVENT,
+    /** A monitor callback ran: id is @ref trace_callback, value the duration in us */
+    TRACE_CALLBACK,
+    /** DCS scan state: id is @ref trace_dcs_scan */
+    TRACE_DCS_SCAN,
+    /** DCS channel switch state: id is @ref trace_dcs_csa */
+    TRACE_DCS_CSA,
+};
+
+/** Kind of callback of a @ref TRACE_CALLBACK record, whose arg is the backend */
+enum trace_callback
+{
+    TRACE_CALLBACK_PATTERN = 1,
+    TRACE_CALLBACK_POLLING,
+};
+
+/** States of @ref TRACE_DCS_SCAN records */
+enum trace_dcs_scan
+{
+    /** A scan round starts, arg is the operating channel */
+    TRACE_DCS_ROUND_START = 1,
+    /** An off-channel scan is requested, arg is the channel */
+    TRACE_DCS_SCAN_START,
+    /** The scan's result arrived, arg is the channel and value the latency in ms */
+    TRACE_DCS_SCAN_DONE,
+    /** The scan failed or timed out, arg is the channel */
+    TRACE_DCS_SCAN_FAILED,
+};
+
+/** States of @ref TRACE_DCS_CSA records */
+enum trace_dcs_csa
+{
+    /** A channel switch is requested, arg is the channel switched to */
+    TRACE_DCS_CSA_START = 1,
+    /** The kernel reports a switch, arg is the 5 GHz frequency it reports in MHz, or 0 */
+    TRACE_DCS_CSA_KERNEL_SWITCHED,
+    /** hostapd reports a switch finishing */
+    TRACE_DCS_CSA_HOSTAPD_SWITCHED,
+    /** The switch succeeded, arg is the channel switched to */
+    TRACE_DCS_CSA_DONE,
+    /** The switch failed, arg is the channel and value the error */
+    TRACE_DCS_CSA_FAILED,
+};
+
+/** A record, as kept in the ring and dumped */
+typedef struct trace_record
+{
+    /** When it was written, on CLOCK_MONOTONIC, in us */
+    uint64_t time_us;
+    /** Its position in the ring's history plus 1, or 0 while being written */
+    uint64_t seq;
+    /** Thread that wrote it */
+    uint32_t tid;
+    /** @ref trace_source */
+    uint8_t source;
+    /** @ref trace_type */
+    uint8_t type;
+    uint16_t id;
+    uint32_t arg;
+    uint32_t value;
+} trace_record_t;
+
+/** Start of a dump, followed by the @ref TRACE_RECORDS records of the ring, in native byte order */
+typedef struct trace_header
+{
+    /** @ref TRACE_MAGIC, not NUL terminated */
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t num_records;
+    uint32_t reserved;
+    /** seq of the next record to be written when dumped */
+    uint64_t next_seq;
+    /** When dumped, on CLOCK_MONOTONIC and since the epoch, in us, to place the records in time */
+    uint64_t monotonic_us;
+    uint64_t realtime_us;
+} trace_header_t;
+
+/**
+ * @brief Write a record
+ *
+ * @param source @ref trace_source
+ * @param type @ref trace_type
+ * @param id See @ref trace_type
+ * @param arg See @ref trace_type
+ * @param value See @ref trace_type
+ */
+void trace_record(uint8_t source, uint8_t type, uint16_t id, uint32_t arg, uint32_t value);
+
+/**
+ * @brief Write a @ref TRACE_REQUEST_START record
+ *
+ * @return its time, to pass to @ref trace_end
+ */
+uint64_t trace_begin(uint8_t source, uint16_t id, uint32_t arg);
+
+/**
+ * @brief Write a @ref TRACE_REQUEST_END record
+ *
+ * @param source @ref trace_source
+ * @param id As passed to @ref trace_begin
+ * @param err 0 on success, else an error
+ * @param started_us As returned by @ref trace_begin
+ * @return the latency recorded, in us
+ */
+uint32_t trace_end(uint8_t source, uint16_t id, uint32_t err, uint64_t started_us);
+
+/**
+ * @brief Pack the first word of a request, up to 4 characters, into a record's arg
+ */
+uint32_t trace_name(const char *name);
+
+/**
+ * @brief Set the file the ring is dumped to, and dump it there on SIGUSR1
+ *
+ * @param path Path of the file
+ */
+void trace_set_file(const char *path);
+
+/**
+ * @brief Dump the ring to the file set with @ref trace_set_file, if any
+ *
+ * Async-signal-safe.
+ */
+void trace_dump(void);
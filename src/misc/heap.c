@@ -0,0 +1,137 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "heap.h"
+#include "utils.h"
+
+/** Number of items to allocate space for on the first push */
+#define HEAP_INITIAL_CAPACITY (16)
+
+static inline void heap_place(heap_t *heap, size_t index, void *item)
+{
+    heap->items[index] = item;
+    if (heap->set_index)
+        heap->set_index(item, index);
+}
+
+static void heap_sift_up(heap_t *heap, size_t index)
+{
+    void *item = heap->items[index];
+
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / 2;
+
+        if (!heap->less(item, heap->items[parent]))
+            break;
+
+        heap_place(heap, index, heap->items[parent]);
+        index = parent;
+    }
+    heap_place(heap, index, item);
+}
+
+static void heap_sift_down(heap_t *heap, size_t index)
+{
+    void *item = heap->items[index];
+
+    while (1)
+    {
+        size_t child = (index * 2) + 1;
+
+        if (child >= heap->count)
+            break;
+
+        if (child + 1 < heap->count && heap->less(heap->items[child + 1], heap->items[child]))
+            child++;
+
+        if (!heap->less(heap->items[child], item))
+            break;
+
+        heap_place(heap, index, heap->items[child]);
+        index = child;
+    }
+    heap_place(heap, index, item);
+}
+
+void heap_init(heap_t *heap, heap_less_fn_t less, heap_set_index_fn_t set_index)
+{
+    MMSM_ASSERT(less != NULL);
+
+    heap->items = NULL;
+    heap->count = 0;
+    heap->capacity = 0;
+    heap->less = less;
+    heap->set_index = set_index;
+}
+
+void heap_cleanup(heap_t *heap)
+{
+    free(heap->items);
+    heap->items = NULL;
+    heap->count = 0;
+    heap->capacity = 0;
+}
+
+int heap_push(heap_t *heap, void *item)
+{
+    if (heap->count == heap->capacity)
+    {
+        size_t capacity = heap->capacity ? heap->capacity * 2 : HEAP_INITIAL_CAPACITY;
+        void **items = realloc(heap->items, capacity * sizeof(*items));
+
+        if (!items)
+            return -ENOMEM;
+
+        heap->items = items;
+        heap->capacity = capacity;
+    }
+
+    heap->items[heap->count] = item;
+    heap_sift_up(heap, heap->count++);
+    return 0;
+}
+
+void *heap_remove(heap_t *heap, size_t index)
+{
+    void *item;
+
+    MMSM_ASSERT(index < heap->count);
+
+    item = heap->items[index];
+    heap->count--;
+
+    if (index != heap->count)
+    {
+        heap->items[index] = heap->items[heap->count];
+        heap_update(heap, index);
+    }
+
+    if (heap->set_index)
+        heap->set_index(item, HEAP_INDEX_NONE);
+
+    return item;
+}
+
+void *heap_pop(heap_t *heap)
+{
+    if (heap->count == 0)
+        return NULL;
+
+    return heap_remove(heap, 0);
+}
+
+void heap_update(heap_t *heap, size_t index)
+{
+    MMSM_ASSERT(index < heap->count);
+
+    if (index > 0 && heap->less(heap->items[index], heap->items[(index - 1) / 2]))
+        heap_sift_up(heap, index);
+    else
+        heap_sift_down(heap, index);
+}
@@ -0,0 +1,183 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "utils.h"
+
+/** Alignment of every object */
+#define POOL_ALIGN (16)
+
+#define POOL_ALIGN_UP(_x) (((_x) + POOL_ALIGN - 1) & ~((size_t)POOL_ALIGN - 1))
+
+struct pool_slab
+{
+    /** The previously allocated slab */
+    struct pool_slab *next;
+    /** The objects */
+    uint8_t data[] __attribute__((aligned(POOL_ALIGN)));
+};
+
+/** Protects @ref pool_head. Taken before a pool's mutex, never while holding one. */
+static pthread_mutex_t pool_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Every pool that has allocated anything, most recent first */
+static pool_t *pool_head;
+
+/** Distance between objects in a slab, leaving room for the free list link */
+static size_t pool_stride(const pool_t *pool)
+{
+    return POOL_ALIGN_UP(MAX(pool->object_size, sizeof(void *)));
+}
+
+/** Adds a slab's objects to the free list. Must be called with the pool's mutex held. */
+static bool pool_grow(pool_t *pool)
+{
+    size_t stride = pool_stride(pool);
+    size_t num = MAX(pool->objects_per_slab, 1);
+    pool_slab_t *slab = malloc(sizeof(*slab) + stride * num);
+    size_t i;
+
+    if (!slab)
+        return false;
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    /* Threaded in reverse, so the first object is handed out first */
+    for (i = num; i > 0; i--)
+    {
+        void **object = (void **)(slab->data + (i - 1) * stride);
+
+        *object = pool->free_list;
+        pool->free_list = object;
+    }
+    pool->capacity += num;
+
+    return true;
+}
+
+static void pool_register(pool_t *pool)
+{
+    MMSM_ASSERT(pthread_mutex_lock(&pool_list_mutex) == 0);
+    pool->next = pool_head;
+    pool_head = pool;
+    MMSM_ASSERT(pthread_mutex_unlock(&pool_list_mutex) == 0);
+}
+
+static void pool_unregister(pool_t *pool)
+{
+    pool_t **link;
+
+    MMSM_ASSERT(pthread_mutex_lock(&pool_list_mutex) == 0);
+    for (link = &pool_head; *link; link = &(*link)->next)
+    {
+        if (*link == pool)
+        {
+            *link = pool->next;
+            break;
+        }
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&pool_list_mutex) == 0);
+}
+
+void pool_init(pool_t *pool, const char *name, size_t object_size, size_t objects_per_slab)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->object_size = object_size;
+    pool->objects_per_slab = objects_per_slab;
+    MMSM_ASSERT(pthread_mutex_init(&pool->mutex, NULL) == 0);
+}
+
+void pool_deinit(pool_t *pool)
+{
+    pool_slab_t *slab = pool->slabs;
+
+    if (pool->registered)
+        pool_unregister(pool);
+
+    while (slab)
+    {
+        pool_slab_t *next = slab->next;
+
+        free(slab);
+        slab = next;
+    }
+
+    MMSM_ASSERT(pthread_mutex_destroy(&pool->mutex) == 0);
+}
+
+void *pool_alloc(pool_t *pool)
+{
+    bool first = false;
+    void **object;
+
+    MMSM_ASSERT(pthread_mutex_lock(&pool->mutex) == 0);
+    if (!pool->free_list && !pool_grow(pool))
+    {
+        MMSM_ASSERT(pthread_mutex_unlock(&pool->mutex) == 0);
+        return NULL;
+    }
+
+    object = pool->free_list;
+    pool->free_list = *object;
+    pool->in_use++;
+    pool->high_water = MAX(pool->high_water, pool->in_use);
+    if (!pool->registered)
+    {
+        pool->registered = true;
+        first = true;
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&pool->mutex) == 0);
+
+    /* Not under the pool's mutex, as pool_read_stats takes the list's mutex first */
+    if (first)
+        pool_register(pool);
+
+    memset(object, 0, pool->object_size);
+    return object;
+}
+
+void pool_free(pool_t *pool, void *object)
+{
+    if (!object)
+        return;
+
+    MMSM_ASSERT(pthread_mutex_lock(&pool->mutex) == 0);
+    *(void **)object = pool->free_list;
+    pool->free_list = object;
+    pool->in_use--;
+    MMSM_ASSERT(pthread_mutex_unlock(&pool->mutex) == 0);
+}
+
+void pool_get_stats(pool_t *pool, pool_stats_t *stats)
+{
+    MMSM_ASSERT(pthread_mutex_lock(&pool->mutex) == 0);
+    stats->name = pool->name;
+    stats->object_size = pool->object_size;
+    stats->capacity = pool->capacity;
+    stats->in_use = pool->in_use;
+    stats->high_water = pool->high_water;
+    MMSM_ASSERT(pthread_mutex_unlock(&pool->mutex) == 0);
+}
+
+size_t pool_read_stats(pool_stats_t *stats, size_t max_stats)
+{
+    size_t n = 0;
+    pool_t *pool;
+
+    MMSM_ASSERT(pthread_mutex_lock(&pool_list_mutex) == 0);
+    for (pool = pool_head; pool && n < max_stats; pool = pool->next)
+        pool_get_stats(pool, &stats[n++]);
+    MMSM_ASSERT(pthread_mutex_unlock(&pool_list_mutex) == 0);
+
+    return n;
+}
@@ -0,0 +1,269 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rcu.h"
+#include "list.h"
+#include "utils.h"
+
+/**
+ * The grace period counter. Readers take a copy of it when entering a critical section, and
+ * @ref rcu_synchronize flips the phase bit and waits for every reader holding a copy of the old
+ * phase to leave. The active bit is always set so that a copy is never 0, which is reserved for
+ * readers that aren't in a critical section.
+ */
+#define RCU_GP_ACTIVE   (1ul << 0)
+#define RCU_GP_PHASE    (1ul << 1)
+
+/**
+ * Per-thread reader state
+ */
+typedef struct rcu_reader
+{
+    /** Link in @ref rcu_readers */
+    list_entry_t list;
+    /** Copy of @ref rcu_gp_ctr taken on entry to the critical section, or 0 if not in one */
+    unsigned long ctr;
+    /** Critical section nesting depth */
+    unsigned int nesting;
+    /** Whether this reader is in @ref rcu_readers */
+    bool registered;
+} rcu_reader_t;
+
+static unsigned long rcu_gp_ctr = RCU_GP_ACTIVE;
+
+static __thread rcu_reader_t rcu_reader;
+
+/** Every registered reader. Protected by @ref rcu_registry_mutex. */
+static list_head_t rcu_readers;
+static pthread_mutex_t rcu_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Serialises grace periods */
+static pthread_mutex_t rcu_gp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Queued callbacks, oldest first. Protected by @ref rcu_queue_mutex, though the head is also read
+ * without it to check for an empty queue.
+ */
+static rcu_head_t *rcu_queue_head;
+static rcu_head_t **rcu_queue_tail = &rcu_queue_head;
+static pthread_mutex_t rcu_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Used to unregister readers when their thread exits */
+static pthread_key_t rcu_reader_key;
+static pthread_once_t rcu_once = PTHREAD_ONCE_INIT;
+
+static void rcu_reader_exit(void *arg)
+{
+    rcu_reader_t *reader = (rcu_reader_t *)arg;
+
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_registry_mutex) == 0);
+    list_remove(&reader->list);
+    reader->registered = false;
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_registry_mutex) == 0);
+}
+
+static void rcu_init_once(void)
+{
+    list_reset(&rcu_readers);
+    MMSM_ASSERT(pthread_key_create(&rcu_reader_key, rcu_reader_exit) == 0);
+}
+
+static void rcu_reader_register(void)
+{
+    MMSM_ASSERT(pthread_once(&rcu_once, rcu_init_once) == 0);
+
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_registry_mutex) == 0);
+    list_add_tail(&rcu_readers, &rcu_reader.list);
+    rcu_reader.registered = true;
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_registry_mutex) == 0);
+
+    MMSM_ASSERT(pthread_setspecific(rcu_reader_key, &rcu_reader) == 0);
+}
+
+void rcu_read_lock(void)
+{
+    if (!rcu_reader.registered)
+        rcu_reader_register();
+
+    if (rcu_reader.nesting++ == 0)
+    {
+        __atomic_store_n(&rcu_reader.ctr, __atomic_load_n(&rcu_gp_ctr, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+        /* Order the store above before any loads of protected data */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+void rcu_read_unlock(void)
+{
+    MMSM_ASSERT(rcu_reader.nesting > 0);
+
+    if (--rcu_reader.nesting == 0)
+        __atomic_store_n(&rcu_reader.ctr, 0, __ATOMIC_RELEASE);
+}
+
+bool rcu_read_lock_held(void)
+{
+    return rcu_reader.nesting > 0;
+}
+
+void rcu_call(rcu_head_t *head, rcu_callback_fn_t fn)
+{
+    head->fn = fn;
+    head->next = NULL;
+
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_queue_mutex) == 0);
+    __atomic_store_n(rcu_queue_tail, head, __ATOMIC_RELAXED);
+    rcu_queue_tail = &head->next;
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_queue_mutex) == 0);
+}
+
+/**
+ * Takes every callback queued so far off the queue.
+ */
+static rcu_head_t *rcu_take_queue(void)
+{
+    rcu_head_t *head;
+
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_queue_mutex) == 0);
+    head = rcu_queue_head;
+    __atomic_store_n(&rcu_queue_head, NULL, __ATOMIC_RELAXED);
+    rcu_queue_tail = &rcu_queue_head;
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_queue_mutex) == 0);
+
+    return head;
+}
+
+static void rcu_run_callbacks(rcu_head_t *head)
+{
+    while (head)
+    {
+        rcu_head_t *next = head->next;
+
+        head->fn(head);
+        head = next;
+    }
+}
+
+/**
+ * Checks if a reader is in a critical section that started before the last phase flip.
+ * Must be called with @ref rcu_registry_mutex held.
+ */
+static bool rcu_reader_is_old(rcu_reader_t *reader)
+{
+    unsigned long ctr = __atomic_load_n(&reader->ctr, __ATOMIC_ACQUIRE);
+
+    return ctr && ((ctr ^ __atomic_load_n(&rcu_gp_ctr, __ATOMIC_RELAXED)) & RCU_GP_PHASE);
+}
+
+/**
+ * Flips the grace period phase and waits for every reader still in the old phase.
+ * Must be called with @ref rcu_registry_mutex held.
+ */
+static void rcu_flip_and_wait(void)
+{
+    list_entry_t *entry;
+
+    __atomic_store_n(&rcu_gp_ctr, rcu_gp_ctr ^ RCU_GP_PHASE, __ATOMIC_SEQ_CST);
+
+    list_for_each_entry(entry, &rcu_readers)
+    {
+        rcu_reader_t *reader = list_get_item(reader, entry, list);
+
+        while (rcu_reader_is_old(reader))
+            sched_yield();
+    }
+}
+
+void rcu_synchronize(void)
+{
+    rcu_head_t *head;
+
+    MMSM_ASSERT(!rcu_read_lock_held());
+    MMSM_ASSERT(pthread_once(&rcu_once, rcu_init_once) == 0);
+
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_gp_mutex) == 0);
+    head = rcu_take_queue();
+
+    /* Order the unpublishing of the queued data before looking at the readers */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /*
+     * Two flips are needed, as a reader may have read the counter just before the first flip
+     * but not yet stored its copy.
+     */
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_registry_mutex) == 0);
+    rcu_flip_and_wait();
+    rcu_flip_and_wait();
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_registry_mutex) == 0);
+
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_gp_mutex) == 0);
+
+    rcu_run_callbacks(head);
+}
+
+/**
+ * Puts callbacks taken with @ref rcu_take_queue back at the front of the queue.
+ */
+static void rcu_requeue(rcu_head_t *head)
+{
+    rcu_head_t *tail = head;
+
+    if (!head)
+        return;
+
+    while (tail->next)
+        tail = tail->next;
+
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_queue_mutex) == 0);
+    tail->next = rcu_queue_head;
+    if (!rcu_queue_head)
+        rcu_queue_tail = &tail->next;
+    __atomic_store_n(&rcu_queue_head, head, __ATOMIC_RELAXED);
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_queue_mutex) == 0);
+}
+
+void rcu_reclaim(void)
+{
+    rcu_head_t *head;
+    list_entry_t *entry;
+    bool idle = true;
+
+    /* Cheap enough to call after every change, or every read-side critical section */
+    if (!__atomic_load_n(&rcu_queue_head, __ATOMIC_RELAXED))
+        return;
+
+    MMSM_ASSERT(pthread_once(&rcu_once, rcu_init_once) == 0);
+
+    head = rcu_take_queue();
+    if (!head)
+        return;
+
+    /* Order the unpublishing of the queued data before looking at the readers */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    MMSM_ASSERT(pthread_mutex_lock(&rcu_registry_mutex) == 0);
+    list_for_each_entry(entry, &rcu_readers)
+    {
+        rcu_reader_t *reader = list_get_item(reader, entry, list);
+
+        if (__atomic_load_n(&reader->ctr, __ATOMIC_ACQUIRE))
+        {
+            idle = false;
+            break;
+        }
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&rcu_registry_mutex) == 0);
+
+    if (idle)
+        rcu_run_callbacks(head);
+    else
+        rcu_requeue(head);
+}
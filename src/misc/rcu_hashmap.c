@@ -0,0 +1,319 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "rcu_hashmap.h"
+#include "utils.h"
+
+/*
+ * The table is an array of singly linked chains. Writers only ever publish a node once it is
+ * fully set up, and unlinking a node leaves its next pointer intact, so a reader walking a chain
+ * always reaches its end, whatever writers do meanwhile.
+ *
+ * Nodes belong to one table. Growing builds a new table with its own nodes and publishes it
+ * whole; the old one isn't modified again and is freed, nodes and all, after a grace period.
+ */
+
+/** Smallest number of chains a map has */
+#define RCU_HASHMAP_MIN_CHAINS  (8)
+
+typedef struct rcu_hashmap_node
+{
+    struct rcu_hashmap_node *next;
+    uint64_t hash;
+    void *entry;
+    rcu_head_t rcu;
+} rcu_hashmap_node_t;
+
+struct rcu_hashmap_table
+{
+    rcu_head_t rcu;
+    /** Number of chains - 1 */
+    size_t mask;
+    rcu_hashmap_node_t *chains[];
+};
+
+static struct rcu_hashmap_table *rcu_hashmap_table_alloc(size_t num_chains)
+{
+    struct rcu_hashmap_table *table;
+
+    table = calloc(1, sizeof(*table) + num_chains * sizeof(table->chains[0]));
+    if (table)
+        table->mask = num_chains - 1;
+
+    return table;
+}
+
+static void rcu_hashmap_table_free(struct rcu_hashmap_table *table)
+{
+    size_t i;
+
+    for (i = 0; i <= table->mask; i++)
+    {
+        rcu_hashmap_node_t *node = table->chains[i];
+
+        while (node)
+        {
+            rcu_hashmap_node_t *next = node->next;
+
+            free(node);
+            node = next;
+        }
+    }
+    free(table);
+}
+
+static void rcu_hashmap_table_free_rcu(rcu_head_t *head)
+{
+    rcu_hashmap_table_free(container_of(head, struct rcu_hashmap_table, rcu));
+}
+
+static void rcu_hashmap_node_free_rcu(rcu_head_t *head)
+{
+    free(container_of(head, rcu_hashmap_node_t, rcu));
+}
+
+int rcu_hashmap_init_custom(rcu_hashmap_t *map, size_t capacity, size_t key_size,
+                            hashmap_get_key_fn_t get_key, hashmap_hash_fn_t hash_fn,
+                            hashmap_equal_fn_t equal_fn)
+{
+    size_t size = RCU_HASHMAP_MIN_CHAINS;
+
+    while (size < capacity)
+        size <<= 1;
+
+    map->table = rcu_hashmap_table_alloc(size);
+    if (!map->table)
+        return -ENOMEM;
+
+    map->count = 0;
+    map->key_size = key_size;
+    map->get_key = get_key;
+    map->hash_fn = hash_fn;
+    map->equal_fn = equal_fn;
+    MMSM_ASSERT(pthread_mutex_init(&map->mutex, NULL) == 0);
+
+    return 0;
+}
+
+int rcu_hashmap_init(rcu_hashmap_t *map, size_t capacity, size_t key_size,
+                     hashmap_get_key_fn_t get_key)
+{
+    return rcu_hashmap_init_custom(map, capacity, key_size, get_key, hashmap_hash_default,
+                                   hashmap_key_equal);
+}
+
+void rcu_hashmap_cleanup(rcu_hashmap_t *map, void (*free_fn)(void *entry))
+{
+    size_t i;
+
+    if (!map->table)
+        return;
+
+    for (i = 0; free_fn && i <= map->table->mask; i++)
+    {
+        rcu_hashmap_node_t *node;
+
+        for (node = map->table->chains[i]; node; node = node->next)
+            free_fn(node->entry);
+    }
+
+    rcu_hashmap_table_free(map->table);
+    map->table = NULL;
+    map->count = 0;
+    MMSM_ASSERT(pthread_mutex_destroy(&map->mutex) == 0);
+}
+
+/**
+ * Finds the link pointing at the node of a key in a table, for writers.
+ *
+ * @return the link, which points at NULL if the key isn't present
+ */
+static rcu_hashmap_node_t **rcu_hashmap_find_link(rcu_hashmap_t *map,
+                                                  struct rcu_hashmap_table *table,
+                                                  const void *key, uint64_t hash)
+{
+    rcu_hashmap_node_t **link = &table->chains[hash & table->mask];
+
+    for (; *link; link = &(*link)->next)
+    {
+        if ((*link)->hash == hash && map->equal_fn(key, map->get_key((*link)->entry),
+                                                   map->key_size))
+            break;
+    }
+
+    return link;
+}
+
+void *rcu_hashmap_find(rcu_hashmap_t *map, const void *key)
+{
+    uint64_t hash = map->hash_fn(key, map->key_size);
+    struct rcu_hashmap_table *table = rcu_dereference(map->table);
+    rcu_hashmap_node_t *node;
+
+    MMSM_ASSERT(rcu_read_lock_held());
+
+    for (node = rcu_dereference(table->chains[hash & table->mask]); node;
+         node = rcu_dereference(node->next))
+    {
+        void *entry = rcu_dereference(node->entry);
+
+        if (node->hash == hash && map->equal_fn(key, map->get_key(entry), map->key_size))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/**
+ * Replaces the table with one twice the size. Must be called with the map's mutex held.
+ *
+ * @return 0 on success, or -ENOMEM
+ */
+static int rcu_hashmap_grow(rcu_hashmap_t *map)
+{
+    struct rcu_hashmap_table *old = map->table;
+    struct rcu_hashmap_table *table = rcu_hashmap_table_alloc((old->mask + 1) * 2);
+    size_t i;
+
+    if (!table)
+        return -ENOMEM;
+
+    for (i = 0; i <= old->mask; i++)
+    {
+        rcu_hashmap_node_t *node;
+
+        for (node = old->chains[i]; node; node = node->next)
+        {
+            rcu_hashmap_node_t *copy = malloc(sizeof(*copy));
+            rcu_hashmap_node_t **chain;
+
+            if (!copy)
+            {
+                rcu_hashmap_table_free(table);
+                return -ENOMEM;
+            }
+
+            chain = &table->chains[node->hash & table->mask];
+            copy->hash = node->hash;
+            copy->entry = node->entry;
+            copy->next = *chain;
+            *chain = copy;
+        }
+    }
+
+    rcu_assign_pointer(map->table, table);
+    rcu_call(&old->rcu, rcu_hashmap_table_free_rcu);
+
+    return 0;
+}
+
+int rcu_hashmap_insert(rcu_hashmap_t *map, void *entry)
+{
+    const void *key = map->get_key(entry);
+    uint64_t hash = map->hash_fn(key, map->key_size);
+    rcu_hashmap_node_t **chain;
+    rcu_hashmap_node_t *node;
+    int ret = 0;
+
+    MMSM_ASSERT(pthread_mutex_lock(&map->mutex) == 0);
+
+    if (*rcu_hashmap_find_link(map, map->table, key, hash))
+    {
+        ret = -EEXIST;
+        goto exit;
+    }
+
+    /* Growing is only an optimisation, so carry on with the current table if it fails */
+    if (map->count > map->table->mask)
+        rcu_hashmap_grow(map);
+
+    node = malloc(sizeof(*node));
+    if (!node)
+    {
+        ret = -ENOMEM;
+        goto exit;
+    }
+
+    chain = &map->table->chains[hash & map->table->mask];
+    node->hash = hash;
+    node->entry = entry;
+    node->next = *chain;
+    rcu_assign_pointer(*chain, node);
+    __atomic_store_n(&map->count, map->count + 1, __ATOMIC_RELAXED);
+
+exit:
+    MMSM_ASSERT(pthread_mutex_unlock(&map->mutex) == 0);
+    return ret;
+}
+
+void *rcu_hashmap_replace(rcu_hashmap_t *map, void *entry)
+{
+    const void *key = map->get_key(entry);
+    uint64_t hash = map->hash_fn(key, map->key_size);
+    rcu_hashmap_node_t *node;
+    void *old = NULL;
+
+    MMSM_ASSERT(pthread_mutex_lock(&map->mutex) == 0);
+
+    node = *rcu_hashmap_find_link(map, map->table, key, hash);
+    if (node)
+    {
+        old = node->entry;
+        rcu_assign_pointer(node->entry, entry);
+    }
+
+    MMSM_ASSERT(pthread_mutex_unlock(&map->mutex) == 0);
+    return old;
+}
+
+void *rcu_hashmap_remove(rcu_hashmap_t *map, const void *key)
+{
+    uint64_t hash = map->hash_fn(key, map->key_size);
+    rcu_hashmap_node_t **link;
+    rcu_hashmap_node_t *node;
+    void *entry = NULL;
+
+    MMSM_ASSERT(pthread_mutex_lock(&map->mutex) == 0);
+
+    link = rcu_hashmap_find_link(map, map->table, key, hash);
+    node = *link;
+    if (node)
+    {
+        entry = node->entry;
+        rcu_assign_pointer(*link, node->next);
+        __atomic_store_n(&map->count, map->count - 1, __ATOMIC_RELAXED);
+        rcu_call(&node->rcu, rcu_hashmap_node_free_rcu);
+    }
+
+    MMSM_ASSERT(pthread_mutex_unlock(&map->mutex) == 0);
+    return entry;
+}
+
+void rcu_hashmap_iterate(rcu_hashmap_t *map, void (*fn)(void *entry, void *arg), void *arg)
+{
+    struct rcu_hashmap_table *table;
+    size_t i;
+
+    rcu_read_lock();
+    table = rcu_dereference(map->table);
+    for (i = 0; i <= table->mask; i++)
+    {
+        rcu_hashmap_node_t *node;
+
+        for (node = rcu_dereference(table->chains[i]); node; node = rcu_dereference(node->next))
+            fn(rcu_dereference(node->entry), arg);
+    }
+    rcu_read_unlock();
+}
+
+size_t rcu_hashmap_count(rcu_hashmap_t *map)
+{
+    return __atomic_load_n(&map->count, __ATOMIC_RELAXED);
+}
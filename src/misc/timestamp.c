@@ -3,7 +3,6 @@
  * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
  */
 
-#include <sys/time.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
@@ -12,27 +11,80 @@
 #include "smart_manager.h"
 #include "timestamp.h"
 
+/*
+ * The calendar time of the last second converted by this thread. Timestamps are taken many
+ * times a second, so most are converted without calling localtime_r() or mktime().
+ */
+static __thread struct
+{
+    bool valid;
+    time_t rawtime;
+    timestamp_t timestamp;
+} calendar_cache;
+
+/** Remember the calendar time of a second, as broken down by localtime_r() or mktime() */
+static void calendar_store(time_t rawtime, const struct tm *tm_time)
+{
+    calendar_cache.timestamp.year = tm_time->tm_year + 1900;
+    calendar_cache.timestamp.month = tm_time->tm_mon + 1; /* Looks odd but Jan is month zero */
+    calendar_cache.timestamp.day = tm_time->tm_mday;
+    calendar_cache.timestamp.hour = tm_time->tm_hour;
+    calendar_cache.timestamp.minute = tm_time->tm_min;
+    calendar_cache.timestamp.second = tm_time->tm_sec;
+    calendar_cache.rawtime = rawtime;
+    calendar_cache.valid = true;
+}
+
+/** Fill the calendar fields of a timestamp, leaving the milliseconds alone */
+static void calendar_from_time(time_t rawtime, timestamp_t *timestamp)
+{
+    if (!calendar_cache.valid || calendar_cache.rawtime != rawtime)
+    {
+        struct tm tm_time;
+
+        (void)localtime_r(&rawtime, &tm_time);
+        calendar_store(rawtime, &tm_time);
+    }
+
+    timestamp->year = calendar_cache.timestamp.year;
+    timestamp->month = calendar_cache.timestamp.month;
+    timestamp->day = calendar_cache.timestamp.day;
+    timestamp->hour = calendar_cache.timestamp.hour;
+    timestamp->minute = calendar_cache.timestamp.minute;
+    timestamp->second = calendar_cache.timestamp.second;
+}
+
+/** Whether a timestamp is in the second last converted */
+static bool calendar_cached(const timestamp_t *timestamp)
+{
+    return calendar_cache.valid &&
+        timestamp->second == calendar_cache.timestamp.second &&
+        timestamp->minute == calendar_cache.timestamp.minute &&
+        timestamp->hour == calendar_cache.timestamp.hour &&
+        timestamp->day == calendar_cache.timestamp.day &&
+        timestamp->month == calendar_cache.timestamp.month &&
+        timestamp->year == calendar_cache.timestamp.year;
+}
+
 /**
  * Get the current timestamp structure.
  */
 void timestamp_get(timestamp_t *timestamp)
 {
-    time_t rawtime;
-    struct tm tm_time;
+    struct timespec ts;
 
-    time(&rawtime);
-    (void)localtime_r(&rawtime, &tm_time);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    calendar_from_time(ts.tv_sec, timestamp);
+    timestamp->millisecond = ts.tv_nsec / 1000000;
+}
 
-    timestamp->year = tm_time.tm_year + 1900;
-    timestamp->month = tm_time.tm_mon + 1; /* Looks odd but Jan is month zero */
-    timestamp->day = tm_time.tm_mday;
-    timestamp->hour = tm_time.tm_hour;
-    timestamp->minute = tm_time.tm_min;
-    timestamp->second = tm_time.tm_sec;
+void timestamp_get_coarse(timestamp_t *timestamp)
+{
+    struct timespec ts;
 
-    struct timeval te;
-    gettimeofday(&te, NULL);
-    timestamp->millisecond = (te.tv_usec / 1000) % 1000;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    calendar_from_time(ts.tv_sec, timestamp);
+    timestamp->millisecond = ts.tv_nsec / 1000000;
 }
 
 /**
@@ -40,11 +92,11 @@ void timestamp_get(timestamp_t *timestamp)
  */
 uint64_t get_timestamp_us()
 {
-    struct timeval tv;
+    struct timespec ts;
 
-    gettimeofday(&tv, NULL);
+    clock_gettime(CLOCK_REALTIME, &ts);
 
-    return (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec;
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
 }
 
 /**
@@ -52,11 +104,20 @@ uint64_t get_timestamp_us()
  */
 uint64_t get_timestamp_ms()
 {
-    struct timeval tv;
+    struct timespec ts;
 
-    gettimeofday(&tv, NULL);
+    clock_gettime(CLOCK_REALTIME, &ts);
 
-    return (uint64_t)tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+    return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+uint64_t timestamp_monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
 }
 
 bool
@@ -81,6 +142,39 @@ timestamp_from_iso_string(const char *str, timestamp_t *timestamp)
     return true;
 }
 
+uint64_t timestamp_to_ms(const timestamp_t *timestamp)
+{
+    struct tm tm_time = {
+        .tm_year = timestamp->year - 1900,
+        .tm_mon = timestamp->month - 1,
+        .tm_mday = timestamp->day,
+        .tm_hour = timestamp->hour,
+        .tm_min = timestamp->minute,
+        .tm_sec = timestamp->second,
+        /* Let mktime work out whether daylight saving applies */
+        .tm_isdst = -1,
+    };
+    time_t rawtime;
+
+    if (calendar_cached(timestamp))
+        return (uint64_t)calendar_cache.rawtime * 1000ULL + timestamp->millisecond;
+
+    rawtime = mktime(&tm_time);
+    if (rawtime == (time_t)-1)
+        return 0;
+
+    /* mktime has normalised the fields, so they are the calendar time of rawtime */
+    calendar_store(rawtime, &tm_time);
+
+    return (uint64_t)rawtime * 1000ULL + timestamp->millisecond;
+}
+
+void timestamp_from_ms(uint64_t ms, timestamp_t *timestamp)
+{
+    calendar_from_time(ms / 1000, timestamp);
+    timestamp->millisecond = ms % 1000;
+}
+
 void timestamp_write_to_file_as_iso(FILE* file, timestamp_t *timestamp)
 {
     fprintf(file, "%04u-%02u-%02uT%02u:%02u:%02u.%03u",
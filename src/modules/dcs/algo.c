@@ -6,18 +6,23 @@
 /*
  * DCS Algorithm common file.
  *
- * All supported / enabled algorithms should have a corresponding entry in algo_table
+ * All supported / enabled algorithms should have a corresponding entry in algo_table. Others
+ * are loaded from plugins, see DCS_ALGO_PLUGIN.
  */
+#include <stdio.h>
 #include <libconfig.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "utils.h"
+#include "extension.h"
 #include "dcs.h"
 #include "algo.h"
 
 
 extern struct algo_ops ewma_ops;
 extern struct algo_ops sample_and_hold_ops;
+extern struct algo_ops airtime_ops;
 
 /** Table of supported algorithms */
 static struct algo algo_table[] = {
@@ -28,9 +33,55 @@ static struct algo algo_table[] = {
     {
         .name = "sample_and_hold",
         .ops = &sample_and_hold_ops
+    },
+    {
+        .name = "airtime",
+        .ops = &airtime_ops
     }
 };
 
+/**
+ * Loads the plugin of an algorithm that isn't built in, from the module_dirs of the config file
+ * cfg belongs to.
+ */
+static struct algo_ops *load_plugin(struct dcs *context, config_setting_t *cfg,
+        const char *algo_name)
+{
+    config_setting_t *root = cfg;
+    const struct dcs_algo_plugin *plugin;
+    char name[128];
+    void *handle;
+
+    while (config_setting_parent(root))
+        root = config_setting_parent(root);
+
+    snprintf(name, sizeof(name), "dcs_algo_%s", algo_name);
+    handle = mmsm_extension_open(config_setting_get_member(root, "module_dirs"), name, name,
+                                 (void **)&plugin);
+    if (!handle)
+        return NULL;
+
+    if (plugin->version != DCS_ALGO_PLUGIN_VERSION)
+    {
+        LOG_ERROR("Algorithm plugin %s is version %d, expected %d\n", name, plugin->version,
+                  DCS_ALGO_PLUGIN_VERSION);
+        goto err;
+    }
+
+    if (!plugin->algo.name || strcmp(plugin->algo.name, algo_name) != 0 || !plugin->algo.ops)
+    {
+        LOG_ERROR("Algorithm plugin %s doesn't define algorithm %s\n", name, algo_name);
+        goto err;
+    }
+
+    context->algo.plugin = handle;
+    return plugin->algo.ops;
+
+err:
+    mmsm_extension_close(handle);
+    return NULL;
+}
+
 int dcs_algo_initialise(struct dcs *context, config_setting_t *cfg)
 {
     const char *algo_name;
@@ -48,19 +99,94 @@ int dcs_algo_initialise(struct dcs *context, config_setting_t *cfg)
     {
         if (strcmp(algo_table[i].name, algo_name) == 0)
         {
-            LOG_INFO("Using algorithm: %s\n", algo_name);
             context->algo.ops = algo_table[i].ops;
+            break;
+        }
+    }
 
-            if (context->algo.ops->init)
-            {
-                return context->algo.ops->init(context, config_setting_get_member(cfg, algo_name));
-            }
-            return 0;
+    if (!context->algo.ops)
+    {
+        context->algo.ops = load_plugin(context, cfg, algo_name);
+        if (!context->algo.ops)
+        {
+            LOG_ERROR("No matching algorithm for %s\n", algo_name);
+            return -EINVAL;
         }
     }
 
-    LOG_ERROR("No matching algorithm for %s\n", algo_name);
-    return -EINVAL;
+    LOG_INFO("Using algorithm: %s%s\n", algo_name, context->algo.plugin ? " (plugin)" : "");
+
+    if (context->algo.ops->init)
+    {
+        return context->algo.ops->init(context, config_setting_get_member(cfg, algo_name));
+    }
+    return 0;
+}
+
+int dcs_algo_reconfigure(struct dcs *context, config_setting_t *cfg)
+{
+    __typeof__(context->algo) prev = context->algo;
+    struct timespec sec_per_scan = context->config.sec_per_scan;
+    struct timespec sec_per_round = context->config.sec_per_round;
+    size_t num_chans = context->num_chans;
+    uint32_t *scores = malloc(num_chans * sizeof(*scores));
+    int *n_samples = malloc(num_chans * sizeof(*n_samples));
+    int *rounds_as_best = malloc(num_chans * sizeof(*rounds_as_best));
+    /* As much as a checkpoint has room for */
+    uint8_t state[32];
+    size_t state_len;
+    int ret;
+
+    if (!scores || !n_samples || !rounds_as_best)
+    {
+        ret = -ENOMEM;
+        goto exit;
+    }
+
+    /* Initialising resets the scores, and an algorithm may reset the rounds as best too */
+    memcpy(scores, context->metrics.accumulated_score, num_chans * sizeof(*scores));
+    memcpy(n_samples, context->metrics.n_samples, num_chans * sizeof(*n_samples));
+    memcpy(rounds_as_best, context->metrics.rounds_as_best, num_chans * sizeof(*rounds_as_best));
+    state_len = dcs_algo_ops_save_state(context, state, sizeof(state));
+
+    memset(&context->algo, 0, sizeof(context->algo));
+    ret = dcs_algo_initialise(context, cfg);
+    if (!ret)
+        ret = dcs_algo_ops_load_state(context, state, state_len);
+
+    if (ret)
+    {
+        dcs_algo_deinitialise(context);
+        context->algo = prev;
+        context->config.sec_per_scan = sec_per_scan;
+        context->config.sec_per_round = sec_per_round;
+    }
+    else
+    {
+        __typeof__(context->algo) next = context->algo;
+
+        context->algo = prev;
+        dcs_algo_deinitialise(context);
+        context->algo = next;
+    }
+
+    memcpy(context->metrics.accumulated_score, scores, num_chans * sizeof(*scores));
+    memcpy(context->metrics.n_samples, n_samples, num_chans * sizeof(*n_samples));
+    memcpy(context->metrics.rounds_as_best, rounds_as_best, num_chans * sizeof(*rounds_as_best));
+
+exit:
+    free(scores);
+    free(n_samples);
+    free(rounds_as_best);
+    return ret;
+}
+
+const struct algo *dcs_algo_get(int index)
+{
+    if (index < 0 || index >= ARRAY_SIZE(algo_table))
+        return NULL;
+
+    return &algo_table[index];
 }
 
 void dcs_algo_deinitialise(struct dcs *context)
@@ -69,6 +195,14 @@ void dcs_algo_deinitialise(struct dcs *context)
     {
         context->algo.ops->deinit(context);
     }
+
+    /* The ops go with the plugin */
+    if (context->algo.plugin)
+    {
+        mmsm_extension_close(context->algo.plugin);
+        context->algo.plugin = NULL;
+        context->algo.ops = NULL;
+    }
 }
 
 struct dcs_channel *dcs_algo_ops_evaluate_channels(struct dcs *context)
@@ -97,29 +231,58 @@ void dcs_algo_ops_post_csa_hook(struct dcs *context, struct dcs_channel *chan)
     }
 }
 
+size_t dcs_algo_ops_save_state(struct dcs *context, void *buf, size_t size)
+{
+    if (context->algo.ops->save_state)
+    {
+        return context->algo.ops->save_state(context, buf, size);
+    }
+    return 0;
+}
+
+int dcs_algo_ops_load_state(struct dcs *context, const void *buf, size_t len)
+{
+    if (context->algo.ops->load_state)
+    {
+        return context->algo.ops->load_state(context, buf, len);
+    }
+    return len ? -EINVAL : 0;
+}
+
 struct dcs_channel *dcs_algo_get_channel_with_highest_score(struct dcs *context)
 {
+    const uint32_t *scores = context->metrics.accumulated_score;
+    const uint8_t *in_scan_list = context->metrics.in_scan_list;
+    int num_chans = context->num_chans;
     struct dcs_channel *best = NULL;
     struct dcs_channel *next;
-    list_entry_t *pos;
+    uint32_t best_score = 0;
+
+    /* Find the highest score first, in a branchless loop the compiler can vectorise */
+    for (int i = 0; i < num_chans; i++)
+    {
+        uint32_t score = scores[i] & -(uint32_t)(in_scan_list[i] != 0);
+
+        best_score = score > best_score ? score : best_score;
+    }
 
-    list_for_each_entry(pos, &context->scan.list) {
-        next = list_get_item(next, pos, list);
+    for (int i = 0; i < num_chans; i++)
+    {
+        if (!in_scan_list[i] || scores[i] != best_score)
+            continue;
+
+        next = &context->all_channels[i];
         if (!best)
         {
             best = next;
         }
-        else if (next->metric.accumulated_score > best->metric.accumulated_score)
-        {
-            best = next;
-        }
         /*
          * In the case were there are mulitple channels with the same score, in the real world
          * it makes no difference which channel we choose. For testing however, as we know that
          * typically the inteferers are close to our current channel, it makes specifying allowed
          * switch channels simpler if we always move to the furthest away.
          */
-        else if (next->metric.accumulated_score == best->metric.accumulated_score)
+        else
         {
             /* See how far away the next and best channels are from the current chan */
             int32_t diff_next = context->current_channel->ch.frequency_khz - next->ch.frequency_khz;
@@ -139,14 +302,14 @@ struct dcs_channel *dcs_algo_get_channel_with_highest_score(struct dcs *context)
 
 void dcs_algo_reset_accumulated_scores(struct dcs *context, int reset_val)
 {
-    struct dcs_channel *next;
-    list_entry_t *pos;
+    uint32_t *scores = context->metrics.accumulated_score;
+    int *n_samples = context->metrics.n_samples;
 
-    list_for_each_entry(pos, &context->scan.list) {
-        next = list_get_item(next, pos, list);
-
-        next->metric.accumulated_score = reset_val;
-        next->metric.n_samples = 0;
+    /* Channels outside the scan list are never evaluated, so reset them too */
+    for (int i = 0; i < context->num_chans; i++)
+    {
+        scores[i] = reset_val;
+        n_samples[i] = 0;
     }
 }
 
@@ -40,6 +40,20 @@ struct algo_ops {
      * into.
      */
     void (*post_csa_hook)(struct dcs *, struct dcs_channel *);
+
+    /**
+     * Optional. Copies the algorithm state to be restored after a restart (see state.h), or once
+     * reconfigured (see @ref dcs_algo_reconfigure), into the buffer passed, of the size passed.
+     * Returns the number of bytes written.
+     */
+    size_t (*save_state)(struct dcs *, void *, size_t);
+
+    /**
+     * Optional. Restores the algorithm state, passed the bytes written by save_state. Called once
+     * init has succeeded, before any measurement is processed with it. Returns 0 on success, else
+     * error code, in which case none of the saved state is used.
+     */
+    int (*load_state)(struct dcs *, const void *, size_t);
 };
 
 
@@ -51,9 +65,48 @@ struct algo {
     struct algo_ops *ops;
 };
 
+/**
+ * Algorithms can also be built outside the DCS module, as a plugin: a shared object named
+ * dcs_algo_<name>.mmext, in one of the module_dirs (see extension.h). It is loaded when algo_type
+ * isn't one of the built in algorithms, and must define its algorithm with DCS_ALGO_PLUGIN, eg.
+ *
+ *   static struct algo_ops fast_ops = { ... };
+ *   DCS_ALGO_PLUGIN(fast, fast_ops);
+ *
+ * built against this header and dcs.h, with the same compiler flags as the DCS module.
+ */
+
+/**
+ * Version of the plugin interface. Bumped whenever struct algo_ops or struct dcs change in a way
+ * that breaks plugins built before, so they are refused rather than misbehaving.
+ */
+#define DCS_ALGO_PLUGIN_VERSION (1)
+
+/** What a plugin exports, as dcs_algo_<name> */
+struct dcs_algo_plugin {
+    /** DCS_ALGO_PLUGIN_VERSION the plugin was built with */
+    int version;
+    /** The algorithm, whose name must be the name the plugin was loaded by */
+    struct algo algo;
+};
+
+/**
+ * Define the algorithm of a plugin
+ *
+ * @param _name Name of the algorithm, not quoted
+ * @param _ops Its struct algo_ops
+ */
+#define DCS_ALGO_PLUGIN(_name, _ops) \
+    const struct dcs_algo_plugin dcs_algo_##_name = { \
+        .version = DCS_ALGO_PLUGIN_VERSION, \
+        .algo = { .name = #_name, .ops = &(_ops) } \
+    }
+
 /**
  * @brief Assign a DCS algorithm and initialise it
  *
+ * Looks for a plugin if algo_type isn't one of the built in algorithms.
+ *
  * @param dcs DCS context
  * @param cfg root config setting
  *            must contain 'algo_type' and a child setting with a matching name
@@ -62,7 +115,29 @@ struct algo {
 int dcs_algo_initialise(struct dcs *dcs, config_setting_t *cfg);
 
 /**
- * @brief Call the deinit op to clean up the algorithm context.
+ * @brief Initialise the algorithm again with changed settings, carrying on with the channel
+ * metrics and algorithm state it has built up
+ *
+ * algo_type must not have changed, as the state is only understood by the same algorithm. No
+ * measurement may be processed meanwhile.
+ *
+ * @param dcs DCS context
+ * @param cfg root config setting, as for @ref dcs_algo_initialise
+ * @return 0 if successful, else error code, in which case the algorithm carries on with its
+ *         previous settings
+ */
+int dcs_algo_reconfigure(struct dcs *dcs, config_setting_t *cfg);
+
+/**
+ * @brief Get one of the built in algorithms, eg. to try each in turn
+ *
+ * @param index Index of the algorithm, from 0
+ * @return The algorithm, or NULL if index is past the last one
+ */
+const struct algo *dcs_algo_get(int index);
+
+/**
+ * @brief Call the deinit op to clean up the algorithm context, and unload its plugin if any.
  *
  * @param dcs DCS context
  */
@@ -97,6 +172,26 @@ void dcs_algo_ops_process_measurement(struct dcs *dcs, struct channel_measuremen
  */
 void dcs_algo_ops_post_csa_hook(struct dcs *dcs, struct dcs_channel *chan);
 
+/**
+ * @brief Call the save state op for the assigned algorithm.
+ *
+ * @param dcs DCS context
+ * @param buf Buffer to write the state to
+ * @param size Size of buf
+ * @return The number of bytes written, 0 if the algorithm has no state to save
+ */
+size_t dcs_algo_ops_save_state(struct dcs *dcs, void *buf, size_t size);
+
+/**
+ * @brief Call the load state op for the assigned algorithm.
+ *
+ * @param dcs DCS context
+ * @param buf State written by @ref dcs_algo_ops_save_state
+ * @param len Length of the state
+ * @return 0 if successful, else error code
+ */
+int dcs_algo_ops_load_state(struct dcs *dcs, const void *buf, size_t len);
+
 /**
  * @brief Utility function to get the channel currently with the highest accumulated score.
  *
@@ -0,0 +1,361 @@
+/*
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+/**
+ * Airtime DCS algorithm
+ *
+ * Scores each channel by the throughput we could expect on it, rather than by the phy's metric:
+ *
+ *          throughput = (1 - time_rx / time_listen) * rate(link_rssi_dbm - noise)
+ *
+ * The first term is the share of airtime left by other networks. On the operating channel,
+ * @ref own_traffic_percent of the time in rx is taken to be our own stations, which would move
+ * with us, and isn't counted against it. The second is the relative phy rate of the highest MCS
+ * our stations could use given the channel's noise, assuming they are received at
+ * @ref link_rssi_dbm. Measurements without listen time, such as test samples, are scored by their
+ * metric instead, and measurements without a noise reading give the top rate.
+ *
+ * Throughputs are filtered with a fixed point EWMA, weighted by @ref ewma_alpha, and kept in the
+ * channel's accumulated score as a fraction of the top rate on an idle channel, scaled by
+ * @ref AIRTIME_ONE.
+ *
+ * A switch costs about @ref switch_cost_ms of traffic, so a channel is only worth switching to if
+ * what it gains over @ref payback_s makes up for that:
+ *
+ *          (candidate - current) * payback_s > current * switch_cost_ms
+ *
+ * Channels are switched once the best channel has been worth it for @ref rounds_for_csa scan
+ * rounds in a row.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "helpers.h"
+#include "dcs.h"
+#include "algo.h"
+
+/* Fixed point scale of throughputs: the top rate on an idle channel */
+#define AIRTIME_SHIFT           (16)
+#define AIRTIME_ONE             (1U << AIRTIME_SHIFT)
+
+#define EWMA_ALPHA_MIN          (1)
+#define EWMA_ALPHA_MAX          (100)
+
+/** A modulation and coding scheme our stations could use */
+struct airtime_mcs
+{
+    /** Minimum SNR to use it, in dB */
+    int8_t min_snr_db;
+    /** Rate relative to the top MCS, scaled by AIRTIME_ONE */
+    uint32_t rate;
+};
+
+/* 802.11ah MCS10 and MCS0-7, with typical minimum SNRs, slowest first */
+#define MCS_RATE(_r) ((_r) * AIRTIME_ONE / 20)
+static const struct airtime_mcs airtime_mcs_table[] = {
+    { -1, MCS_RATE(1) },
+    { 2, MCS_RATE(2) },
+    { 5, MCS_RATE(4) },
+    { 9, MCS_RATE(6) },
+    { 11, MCS_RATE(8) },
+    { 15, MCS_RATE(12) },
+    { 18, MCS_RATE(16) },
+    { 20, MCS_RATE(18) },
+    { 25, MCS_RATE(20) },
+};
+
+/** Context for airtime algorithm */
+struct airtime_context
+{
+    struct {
+        /** Alpha, or smoothing co-efficent, of the EWMA of each channel's throughput */
+        uint8_t ewma_alpha;
+        /** Signal strength our stations are assumed to be received at, in dBm */
+        int link_rssi_dbm;
+        /** Share of the operating channel's rx time taken to be our own traffic */
+        int own_traffic_percent;
+        /** Traffic lost to a channel switch, in ms at the current channel's throughput */
+        int switch_cost_ms;
+        /** Time a switch has to pay for itself over, in s */
+        int payback_s;
+        /** Number of consecutive scan rounds a switch must be worth it to trigger it */
+        int rounds_for_csa;
+    } config;
+
+    /** EWMA alpha, scaled by AIRTIME_ONE */
+    uint32_t alpha;
+    /** Number of consecutive scan rounds a switch has been worth it */
+    int rounds_with_a_better_channel;
+};
+
+/**
+ * @brief Get the relative rate of the fastest MCS a channel's noise leaves our stations
+ *
+ * @param airtime Airtime context
+ * @param noise Noise of the channel in dBm, or 0 if unknown
+ * @return the rate, scaled by AIRTIME_ONE, or 0 if no MCS would get through
+ */
+static uint32_t expected_rate(struct airtime_context *airtime, int8_t noise)
+{
+    int snr_db = airtime->config.link_rssi_dbm - noise;
+    uint32_t rate = 0;
+
+    if (noise >= 0)
+        return AIRTIME_ONE;
+
+    for (int i = 0; i < ARRAY_SIZE(airtime_mcs_table); i++)
+    {
+        if (snr_db < airtime_mcs_table[i].min_snr_db)
+            break;
+        rate = airtime_mcs_table[i].rate;
+    }
+    return rate;
+}
+
+/**
+ * @brief Estimate the throughput we could expect on a channel from a measurement of it
+ *
+ * @param context DCS context
+ * @param meas Measurement of the channel
+ * @param channel Channel measured
+ * @return the throughput, scaled by AIRTIME_ONE
+ */
+static uint32_t expected_throughput(struct dcs *context, const struct channel_measurement *meas,
+        struct dcs_channel *channel)
+{
+    struct airtime_context *airtime = context->algo.context;
+    uint64_t rx_us = MIN(meas->time_rx_us, meas->time_listen_us);
+    uint32_t available;
+
+    if (meas->time_listen_us == 0)
+        return MIN(meas->metric, 100) * AIRTIME_ONE / 100;
+
+    /* Our own stations are heard on the channel we operate on */
+    if (channel == context->current_channel)
+        rx_us -= rx_us * airtime->config.own_traffic_percent / 100;
+
+    available = AIRTIME_ONE - (uint32_t)((rx_us << AIRTIME_SHIFT) / meas->time_listen_us);
+
+    return ((uint64_t)available * expected_rate(airtime, meas->noise)) >> AIRTIME_SHIFT;
+}
+
+/**
+ * @brief Function called by DCS to evaluate channels
+ *
+ * @param context DCS context
+ * @return channel to switch to, or NULL
+ */
+static struct dcs_channel *airtime_op_evaluate_channels(struct dcs *context)
+{
+    struct dcs_channel *candidate_chan = dcs_algo_get_channel_with_highest_score(context);
+    struct airtime_context *airtime = context->algo.context;
+    struct channel_metrics *metrics = &context->metrics;
+    int candidate = dcs_channel_slot(context, candidate_chan);
+    uint64_t current = metrics->accumulated_score[dcs_channel_slot(context,
+        context->current_channel)];
+    uint64_t best = metrics->accumulated_score[candidate];
+
+    LOG_INFO("Candidate chan (ch %d): throughput %" PRIu64 "%%, current %" PRIu64 "%%\n",
+            candidate_chan->ch.channel_s1g, best * 100 >> AIRTIME_SHIFT,
+            current * 100 >> AIRTIME_SHIFT);
+
+    if (candidate_chan == context->current_channel)
+    {
+        LOG_INFO("Candidate is current channel\n");
+        airtime->rounds_with_a_better_channel = 0;
+    }
+    else if ((best - current) * airtime->config.payback_s * 1000 >
+             current * airtime->config.switch_cost_ms)
+    {
+        airtime->rounds_with_a_better_channel++;
+        LOG_INFO("Candidate is a different channel worth switching to (%d time(s) in a row)\n",
+                airtime->rounds_with_a_better_channel);
+    }
+    else
+    {
+        LOG_INFO("Candidate is a different channel, but not worth the cost of switching\n");
+        airtime->rounds_with_a_better_channel = 0;
+    }
+
+    /* increment the channels lifetime counter as best channel */
+    metrics->rounds_as_best[candidate]++;
+
+    if (airtime->rounds_with_a_better_channel >= airtime->config.rounds_for_csa)
+    {
+        return candidate_chan;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Called after a channel switch has completed by DCS
+ *
+ * @param context DCS context
+ * @param channel Channel that was switched into
+ */
+static void airtime_op_post_csa_hook(struct dcs *context, struct dcs_channel *channel)
+{
+    UNUSED(channel);
+    struct airtime_context *airtime = context->algo.context;
+
+    airtime->rounds_with_a_better_channel = 0;
+}
+
+/**
+ * @brief Function called by DCS to process a measurement
+ *
+ * @param context DCS context
+ * @param meas Measurement to process
+ * @param channel Channel this measurement was performed on
+ */
+static void airtime_op_process_measurement(struct dcs *context, struct channel_measurement *meas,
+        struct dcs_channel *channel)
+{
+    struct airtime_context *airtime = context->algo.context;
+    int slot = dcs_channel_slot(context, channel);
+    uint32_t *score = &context->metrics.accumulated_score[slot];
+    uint64_t throughput = expected_throughput(context, meas, channel);
+
+    context->metrics.n_samples[slot]++;
+
+    /* S[t] = a*X[t] + (1-a)*S[t-1] */
+    *score = (airtime->alpha * throughput +
+              (uint64_t)(AIRTIME_ONE - airtime->alpha) * *score) >> AIRTIME_SHIFT;
+}
+
+/**
+ * @brief Called by DCS to save the algorithm state to restore after a restart
+ *
+ * @param context DCS context
+ * @param buf Buffer to write the state to
+ * @param size Size of buf
+ * @return number of bytes written
+ */
+static size_t airtime_op_save_state(struct dcs *context, void *buf, size_t size)
+{
+    struct airtime_context *airtime = context->algo.context;
+    int32_t rounds = airtime->rounds_with_a_better_channel;
+
+    if (size < sizeof(rounds))
+        return 0;
+
+    memcpy(buf, &rounds, sizeof(rounds));
+    return sizeof(rounds);
+}
+
+/**
+ * @brief Called by DCS to restore the algorithm state saved by @ref airtime_op_save_state
+ *
+ * @param context DCS context
+ * @param buf Saved state
+ * @param len Length of the saved state
+ * @return 0 on success, else error code
+ */
+static int airtime_op_load_state(struct dcs *context, const void *buf, size_t len)
+{
+    struct airtime_context *airtime = context->algo.context;
+    int32_t rounds;
+
+    if (len != sizeof(rounds))
+        return -EINVAL;
+
+    memcpy(&rounds, buf, sizeof(rounds));
+    if (rounds < 0)
+        return -EINVAL;
+
+    airtime->rounds_with_a_better_channel = rounds;
+    return 0;
+}
+
+/**
+ * @brief Called to initialise airtime algorithm
+ *
+ * @param dcs DCS context
+ * @param config Airtime configuration
+ * @return 0 on success, else error code
+ */
+static int airtime_op_init(struct dcs *context, config_setting_t *cfg)
+{
+    int val;
+    int errors = 0;
+    struct airtime_context *airtime = calloc(1, sizeof(*airtime));
+
+    if (!airtime)
+    {
+        LOG_ERROR("Failed to allocate airtime context\n");
+        return -ENOMEM;
+    }
+
+    if (!cfg)
+    {
+        LOG_ERROR("Could not find config settings for airtime\n");
+        free(airtime);
+        return -EINVAL;
+    }
+
+    context->algo.context = airtime;
+
+    val = cfg_parse_int(cfg, "ewma_alpha", &errors);
+    if ((val > EWMA_ALPHA_MAX) || (val < EWMA_ALPHA_MIN))
+    {
+        LOG_ERROR("EWMA alpha out of bounds (min: %d, max: %d, actual: %d)\n",
+                EWMA_ALPHA_MIN, EWMA_ALPHA_MAX, val);
+        errors++;
+    }
+    airtime->config.ewma_alpha = val;
+    airtime->alpha = airtime->config.ewma_alpha * AIRTIME_ONE / 100;
+
+    airtime->config.link_rssi_dbm = cfg_parse_int_with_default(cfg, "link_rssi_dbm", -85);
+
+    val = cfg_parse_int_with_default(cfg, "own_traffic_percent", 0);
+    if (val < 0 || val > 100)
+    {
+        LOG_ERROR("Own traffic percentage must be between 0 and 100\n");
+        errors++;
+    }
+    airtime->config.own_traffic_percent = val;
+
+    airtime->config.switch_cost_ms = cfg_parse_int(cfg, "switch_cost_ms", &errors);
+    if (airtime->config.switch_cost_ms < 0)
+    {
+        LOG_ERROR("Switch cost must not be negative\n");
+        errors++;
+    }
+
+    airtime->config.payback_s = cfg_parse_int(cfg, "payback_s", &errors);
+    if (airtime->config.payback_s <= 0)
+    {
+        LOG_ERROR("Payback time must be greater than 0\n");
+        errors++;
+    }
+
+    val = cfg_parse_int(cfg, "rounds_for_csa", &errors);
+    if (val <= 0)
+    {
+        LOG_ERROR("Rounds as best must be greater than 0\n");
+        errors++;
+    }
+    airtime->config.rounds_for_csa = val;
+
+    context->config.sec_per_scan.tv_sec = cfg_parse_int(cfg, "sec_per_scan", &errors);
+    context->config.sec_per_round.tv_sec = cfg_parse_int(cfg, "sec_per_round", &errors);
+
+    /* Start from an idle channel at the top rate, as ewma starts from the top metric */
+    dcs_algo_reset_accumulated_scores(context, AIRTIME_ONE);
+    return errors ? -EINVAL : 0;
+}
+
+/**
+ * @brief op table for airtime algorithm
+ */
+struct algo_ops airtime_ops = {
+    .init = airtime_op_init,
+    .deinit = dcs_algo_free_context,
+    .evaluate_channels = airtime_op_evaluate_channels,
+    .process_measurement = airtime_op_process_measurement,
+    .post_csa_hook = airtime_op_post_csa_hook,
+    .save_state = airtime_op_save_state,
+    .load_state = airtime_op_load_state,
+};
@@ -16,8 +16,12 @@
  * @ref ewma_alpha is the 'smoothing' coefficent, and represents how heavily we bias the current
  * measurement, vs the last sum. It takes a range of 1 - 100, with 1 being the most smooth
  * (99% history), and 100 being the least smooth (no history)
+ *
+ * Survey measurements of the operating channel, taken between scans when survey_interval_ms is
+ * set, are averaged into its score in the same way, so it follows changes in occupancy sooner.
  */
 #include <stdlib.h>
+#include <string.h>
 #include "helpers.h"
 #include "dcs.h"
 #include "algo.h"
@@ -81,20 +85,22 @@ static struct dcs_channel *ewma_op_evaluate_channels(struct dcs *context)
 {
     struct dcs_channel *candidate_chan = dcs_algo_get_channel_with_highest_score(context);
     struct ewma_context *ewma = context->algo.context;
+    struct channel_metrics *metrics = &context->metrics;
+    int candidate = dcs_channel_slot(context, candidate_chan);
 
     uint32_t threshold = dcs_algo_calculate_threshold(
-            context->current_channel->metric.accumulated_score,
+            metrics->accumulated_score[dcs_channel_slot(context, context->current_channel)],
             ewma->config.threshold_percentage);
 
     LOG_INFO("Candidate chan (ch %d): score %d, threshold %d\n",
-            candidate_chan->ch.channel_s1g, candidate_chan->metric.accumulated_score, threshold);
+            candidate_chan->ch.channel_s1g, metrics->accumulated_score[candidate], threshold);
 
     if (candidate_chan == context->current_channel)
     {
         LOG_INFO("Candidate is current channel\n");
         ewma->rounds_with_a_better_channel = 0;
     }
-    else if (candidate_chan->metric.accumulated_score > threshold)
+    else if (metrics->accumulated_score[candidate] > threshold)
     {
         ewma->rounds_with_a_better_channel++;
         LOG_INFO("Candidate is a different channel (%d time(s) in a row)\n",
@@ -106,7 +112,7 @@ static struct dcs_channel *ewma_op_evaluate_channels(struct dcs *context)
     }
 
     /* increment the channels lifetime counter as best channel */
-    candidate_chan->metric.rounds_as_best++;
+    metrics->rounds_as_best[candidate]++;
 
     /* switch if current num rounds as best is past threshold */
     if (ewma->config.rounds_for_csa != 0 &&
@@ -142,13 +148,58 @@ static void ewma_op_process_measurement(struct dcs *context, struct channel_meas
         struct dcs_channel *channel)
 {
     struct ewma_context *ewma = context->algo.context;
+    int slot = dcs_channel_slot(context, channel);
+    uint32_t *score = &context->metrics.accumulated_score[slot];
 
     /* Save timestamp and score */
-    channel->metric.n_samples++;
+    context->metrics.n_samples[slot]++;
 
     /* Update current score using EWMA function */
-    channel->metric.accumulated_score = apply_ewma(ewma->config.ewma_alpha,
-            meas->metric, channel->metric.accumulated_score);
+    *score = apply_ewma(ewma->config.ewma_alpha, meas->metric, *score);
+}
+
+/**
+ * @brief Called by DCS to save the algorithm state to restore after a restart
+ *
+ * @param context DCS context
+ * @param buf Buffer to write the state to
+ * @param size Size of buf
+ * @return number of bytes written
+ */
+static size_t ewma_op_save_state(struct dcs *context, void *buf, size_t size)
+{
+    struct ewma_context *ewma = context->algo.context;
+    int32_t rounds = ewma->rounds_with_a_better_channel;
+
+    if (size < sizeof(rounds))
+        return 0;
+
+    memcpy(buf, &rounds, sizeof(rounds));
+    return sizeof(rounds);
+}
+
+/**
+ * @brief Called by DCS to restore the algorithm state saved by @ref ewma_op_save_state
+ *
+ * @param context DCS context
+ * @param buf Saved state
+ * @param len Length of the saved state
+ * @return 0 on success, else error code
+ */
+static int ewma_op_load_state(struct dcs *context, const void *buf, size_t len)
+{
+    struct ewma_context *ewma = context->algo.context;
+    int32_t rounds;
+
+    if (len != sizeof(rounds))
+        return -EINVAL;
+
+    memcpy(&rounds, buf, sizeof(rounds));
+    if (rounds < 0)
+        return -EINVAL;
+
+    ewma->rounds_with_a_better_channel = rounds;
+    return 0;
 }
 
 /**
@@ -214,4 +265,6 @@ struct algo_ops ewma_ops = {
     .evaluate_channels = ewma_op_evaluate_channels,
     .process_measurement = ewma_op_process_measurement,
     .post_csa_hook = ewma_op_post_csa_hook,
+    .save_state = ewma_op_save_state,
+    .load_state = ewma_op_load_state,
 };
@@ -12,6 +12,8 @@
  *
  * After each evaluation round, scores are reset.
  */
+#include <string.h>
+
 #include "dcs.h"
 #include "algo.h"
 
@@ -77,24 +79,27 @@ struct dcs_channel *sample_hold_op_evaluate_channels(struct dcs * context)
 {
     struct sample_and_hold *sh_ctx = context->algo.context;
     struct dcs_channel *best = dcs_algo_get_channel_with_highest_score(context);
+    struct channel_metrics *metrics = &context->metrics;
+    int best_slot = dcs_channel_slot(context, best);
 
     /* increment the channels lifetime counter as best channel */
-    best->metric.rounds_as_best++;
+    metrics->rounds_as_best[best_slot]++;
     sh_ctx->num_full_scans++;
 
     /* switch if current num rounds as best is past threshold */
     if (sh_ctx->num_full_scans % sh_ctx->config.rounds_for_eval == 0)
     {
         uint32_t threshold = dcs_algo_calculate_threshold(
-            context->current_channel->metric.accumulated_score,
+            metrics->accumulated_score[dcs_channel_slot(context, context->current_channel)],
             sh_ctx->config.threshold_percentage);
 
         LOG_INFO("Channel eval - best: %d, avg metric: %u, accum metric: %u, accum threshold: %u\n",
-            best->ch.channel_s1g, best->metric.accumulated_score / best->metric.n_samples,
-            best->metric.accumulated_score, threshold);
+            best->ch.channel_s1g,
+            metrics->accumulated_score[best_slot] / metrics->n_samples[best_slot],
+            metrics->accumulated_score[best_slot], threshold);
 
         /** to ponder - current best or chan with highest rounds as best ? */
-        if (best->metric.accumulated_score > threshold)
+        if (metrics->accumulated_score[best_slot] > threshold)
         {
             return best;
         }
@@ -117,9 +122,14 @@ struct dcs_channel *sample_hold_op_evaluate_channels(struct dcs * context)
 static void sample_hold_op_process_measurement(struct dcs *context,
         struct channel_measurement *meas, struct dcs_channel *channel)
 {
-    UNUSED(context);
-    channel->metric.accumulated_score += meas->metric;
-    channel->metric.n_samples++;
+    int slot = dcs_channel_slot(context, channel);
+
+    /* Scores are compared as sums, so extra samples of the operating channel would skew them */
+    if (meas->source == CHANNEL_MEASUREMENT_SOURCE_SURVEY)
+        return;
+
+    context->metrics.accumulated_score[slot] += meas->metric;
+    context->metrics.n_samples[slot]++;
 }
 
 /**
@@ -134,6 +144,50 @@ static void sample_hold_op_post_csa_hook(struct dcs *context, struct dcs_channel
     dcs_algo_reset_accumulated_scores(context, 0);
 }
 
+/**
+ * @brief Called by DCS to save the algorithm state to restore after a restart
+ *
+ * @param context DCS context
+ * @param buf Buffer to write the state to
+ * @param size Size of buf
+ * @return number of bytes written
+ */
+static size_t sample_hold_op_save_state(struct dcs *context, void *buf, size_t size)
+{
+    struct sample_and_hold *sh_ctx = context->algo.context;
+    int32_t num_full_scans = sh_ctx->num_full_scans;
+
+    if (size < sizeof(num_full_scans))
+        return 0;
+
+    memcpy(buf, &num_full_scans, sizeof(num_full_scans));
+    return sizeof(num_full_scans);
+}
+
+/**
+ * @brief Called by DCS to restore the algorithm state saved by @ref sample_hold_op_save_state
+ *
+ * @param context DCS context
+ * @param buf Saved state
+ * @param len Length of the saved state
+ * @return 0 on success, else error code
+ */
+static int sample_hold_op_load_state(struct dcs *context, const void *buf, size_t len)
+{
+    struct sample_and_hold *sh_ctx = context->algo.context;
+    int32_t num_full_scans;
+
+    if (len != sizeof(num_full_scans))
+        return -EINVAL;
+
+    memcpy(&num_full_scans, buf, sizeof(num_full_scans));
+    if (num_full_scans < 0)
+        return -EINVAL;
+
+    sh_ctx->num_full_scans = num_full_scans;
+    return 0;
+}
+
 /**
  * @brief op table for sample and hold DCS algorithm
  */
@@ -143,4 +197,6 @@ struct algo_ops sample_and_hold_ops = {
     .evaluate_channels = sample_hold_op_evaluate_channels,
     .process_measurement = sample_hold_op_process_measurement,
     .post_csa_hook = sample_hold_op_post_csa_hook,
+    .save_state = sample_hold_op_save_state,
+    .load_state = sample_hold_op_load_state,
 };
@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <inttypes.h>
+#include <net/if.h>
 #include <netlink/genl/genl.h>
 #include <linux/nl80211.h>
 
@@ -26,15 +27,30 @@
 #include "utils.h"
 #include "logging.h"
 #include "list.h"
+#include "trace.h"
+#include "probes.h"
+#include "metrics.h"
+#include "query.h"
 #include "backend/morsectrl/command.h"
 #include "backend/morsectrl/vendor.h"
 
 #include "dcs.h"
 #include "algo.h"
+#include "scheduler.h"
+#include "state.h"
 
-/** Number of seconds to wait for OCS / CSA before timing out */
+/**
+ * Number of seconds to wait for a CSA, and at most for an OCS, before timing out. Also how long
+ * after an OCS was requested its event may still arrive.
+ */
 #define WAIT_TIMEOUT_SEC         (10)
 
+/** Shortest time to wait for an off-channel scan to complete */
+#define OCS_MIN_TIMEOUT_MS       (500)
+
+/** Off-channel scans time out after this many times the average time they take */
+#define OCS_TIMEOUT_FACTOR       (4)
+
 /** Number of times to wait on hostapd to come up before giving up */
 #define MAX_RETRIES               (10)
 
@@ -50,11 +66,24 @@
  */
 #define DCS_CHAN_SWITCH_GRACE_SECS (5)
 
+/*
+ * Seconds to wait for hostapd to report a channel switch once the kernel has, before asking it
+ * for the new channel regardless.
+ */
+#define HOSTAPD_CSA_EVENT_TIMEOUT_SECS (1)
+
+/*
+ * How long a hostapd STATUS response is shared between requests. Kept short, as the channel
+ * and state it reports can change under us.
+ */
+#define HOSTAPD_STATUS_CACHE_TTL_MS (200)
+
 /** Test-mode specific functions */
 extern struct channel_measurement *get_channel_measurement_for_test(struct dcs *context,
         struct dcs_channel *channel);
 extern int initialise_channels_for_test(struct dcs *context);
 extern void dcs_test_free_all_samples(struct dcs *context);
+extern void dcs_test_count_stats(struct dcs *context);
 
 /* Forward declarations */
 static uint32_t calculate_new_prim_ch_center_freq(struct dcs *context, struct dcs_channel *channel);
@@ -71,6 +100,28 @@ static inline void set_timespec_for_future(struct timespec *ts, time_t sec)
     ts->tv_sec += sec;
 }
 
+/**
+ * @brief Publish the operating channel straight away, rather than at the end of the scan round,
+ * notifying the query clients subscribed to "channel" if it changed
+ *
+ * @param context DCS context object
+ */
+static void publish_channel(struct dcs *context)
+{
+    const struct dcs_channel *channel = context->current_channel;
+    bool changed;
+
+    MMSM_ASSERT(pthread_mutex_lock(&context->published.mutex) == 0);
+    changed = context->published.channel != channel;
+    context->published.channel = channel;
+    MMSM_ASSERT(pthread_mutex_unlock(&context->published.mutex) == 0);
+
+    if (changed && channel)
+        query_notify("channel", "interface=%s channel=%u frequency_khz=%u bandwidth_mhz=%u",
+                     context->if_name, channel->ch.channel_s1g, channel->ch.frequency_khz,
+                     channel->ch.bandwidth_mhz);
+}
+
 /**
  * @brief Update the current channel in the DCS context
  *
@@ -80,7 +131,8 @@ static int update_current_channel(struct dcs *dcs_context)
 {
     /* Get current channel, and its BW */
     mmsm_data_item_t *item;
-    char *val;
+    struct dcs_channel *channel;
+    int64_t val;
     int32_t s1g_freq;
     int32_t s1g_bw;
 
@@ -92,94 +144,87 @@ static int update_current_channel(struct dcs *dcs_context)
         goto err;
     }
 
-    val = (char *)mmsm_find_value_by_key(item, "s1g_freq");
-    if (!val)
+    if (!mmsm_find_i64_by_key(item, "s1g_freq", &val))
     {
         LOG_ERROR("No S1G frequency\n");
         goto err;
     }
-    s1g_freq = strtol(val, NULL, 10);
+    s1g_freq = val;
 
     /* Hostapd does not have a valid channel yet, try again.. */
     if (s1g_freq == -1)
+    {
+        mmsm_data_item_free(item);
         return -EAGAIN;
+    }
 
-    val = (char *)mmsm_find_value_by_key(item, "freq");
-    if (!val)
+    if (!mmsm_find_i64_by_key(item, "freq", &val))
     {
         LOG_ERROR("No 5g frequency\n");
         goto err;
     }
 
-    dcs_context->current_5g_freq = strtoul(val, NULL, 10);
+    dcs_context->current_5g_freq = val;
 
-    val = (char *)mmsm_find_value_by_key(item, "s1g_bw");
-    if (!val)
+    if (!mmsm_find_i64_by_key(item, "s1g_bw", &val))
     {
         LOG_ERROR("No op bandwidth\n");
         goto err;
     }
 
-    s1g_bw = strtol(val, NULL, 10);
+    s1g_bw = val;
 
-    val = (char *)mmsm_find_value_by_key(item, "s1g_prim_chwidth");
-    if (!val)
+    if (!mmsm_find_i64_by_key(item, "s1g_prim_chwidth", &val))
     {
         LOG_ERROR("No primary channel width\n");
         goto err;
     }
 
-    dcs_context->current_primary_ch_width = strtoul(val, NULL, 10);
+    dcs_context->current_primary_ch_width = val;
 
-    val = (char *)mmsm_find_value_by_key(item, "s1g_prim_1mhz_chan_index");
-    if (!val)
+    if (!mmsm_find_i64_by_key(item, "s1g_prim_1mhz_chan_index", &val))
     {
         LOG_ERROR("No primary channel index\n");
         goto err;
     }
 
-    dcs_context->current_prim_1mhz_ch_index = strtoul(val, NULL, 10);
+    dcs_context->current_prim_1mhz_ch_index = val;
 
-    val = (char *)mmsm_find_value_by_key(item, "beacon_int");
-    if (!val)
+    if (!mmsm_find_i64_by_key(item, "beacon_int", &val))
     {
         LOG_ERROR("No beacon interval\n");
         goto err;
     }
 
-    dcs_context->beacon_interval = strtol(val, NULL, 10);
+    dcs_context->beacon_interval = val;
     if (!dcs_context->beacon_interval)
     {
         LOG_ERROR("Invalid beacon interval\n");
         goto err;
     }
 
-    val = (char *)mmsm_find_value_by_key(item, "dtim_period");
-    if (!val)
+    if (!mmsm_find_i64_by_key(item, "dtim_period", &val))
     {
         LOG_ERROR("No DTIM period\n");
         goto err;
     }
 
-    dcs_context->dtim_period = strtol(val, NULL, 10);
+    dcs_context->dtim_period = val;
     if (!dcs_context->dtim_period)
     {
         LOG_ERROR("Invalid DTIM period\n");
         goto err;
     }
 
-    for (int i = 0; i < dcs_context->num_chans; i++)
+    channel = dcs_find_channel(dcs_context, s1g_freq, s1g_bw);
+    if (channel)
     {
-        if (dcs_context->all_channels[i].ch.frequency_khz == s1g_freq &&
-                dcs_context->all_channels[i].ch.bandwidth_mhz == s1g_bw)
-        {
-            LOG_INFO("Current channel is ch %u (freq: %u kHz)\n",
-                dcs_context->all_channels[i].ch.channel_s1g,
-                dcs_context->all_channels[i].ch.frequency_khz);
-            dcs_context->current_channel = &dcs_context->all_channels[i];
-            mmsm_data_item_free(item);
-            return 0;
-        }
+        LOG_INFO("Current channel is ch %u (freq: %u kHz)\n",
+            channel->ch.channel_s1g, channel->ch.frequency_khz);
+        dcs_context->current_channel = channel;
+        publish_channel(dcs_context);
+        mmsm_data_item_free(item);
+        return 0;
     }
 
     LOG_ERROR(
@@ -236,6 +281,86 @@ static bool wait_for_hostapd_state(mmsm_backend_intf_t *hostapd_intf, const char
     return false;
 }
 
+/**
+ * @brief Order channels by frequency, then bandwidth, for the lookup index
+ */
+static int compare_channels_by_freq(const void *a, const void *b)
+{
+    const struct dcs_channel *x = *(struct dcs_channel * const *)a;
+    const struct dcs_channel *y = *(struct dcs_channel * const *)b;
+
+    if (x->ch.frequency_khz != y->ch.frequency_khz)
+        return x->ch.frequency_khz < y->ch.frequency_khz ? -1 : 1;
+
+    return (int)x->ch.bandwidth_mhz - (int)y->ch.bandwidth_mhz;
+}
+
+/**
+ * @brief Free the channels' metrics
+ */
+static void free_channel_metrics(struct channel_metrics *metrics)
+{
+    free(metrics->accumulated_score);
+    free(metrics->n_samples);
+    free(metrics->rounds_as_best);
+    free(metrics->in_scan_list);
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+int dcs_init_channel_tables(struct dcs *context)
+{
+    struct channel_metrics *metrics = &context->metrics;
+    struct dcs_channel **by_freq = calloc(context->num_chans, sizeof(*by_freq));
+
+    free_channel_metrics(metrics);
+    metrics->accumulated_score = calloc(context->num_chans, sizeof(*metrics->accumulated_score));
+    metrics->n_samples = calloc(context->num_chans, sizeof(*metrics->n_samples));
+    metrics->rounds_as_best = calloc(context->num_chans, sizeof(*metrics->rounds_as_best));
+    metrics->in_scan_list = calloc(context->num_chans, sizeof(*metrics->in_scan_list));
+    if (!by_freq || !metrics->accumulated_score || !metrics->n_samples ||
+        !metrics->rounds_as_best || !metrics->in_scan_list)
+    {
+        LOG_ERROR("Failed to allocate channel tables\n");
+        free(by_freq);
+        free_channel_metrics(metrics);
+        return -ENOMEM;
+    }
+
+    memset(context->index.by_s1g, 0, sizeof(context->index.by_s1g));
+    for (int i = 0; i < context->num_chans; i++)
+    {
+        struct dcs_channel *channel = &context->all_channels[i];
+
+        by_freq[i] = channel;
+        if (!context->index.by_s1g[channel->ch.channel_s1g])
+            context->index.by_s1g[channel->ch.channel_s1g] = channel;
+    }
+    qsort(by_freq, context->num_chans, sizeof(*by_freq), compare_channels_by_freq);
+
+    free(context->index.by_freq);
+    context->index.by_freq = by_freq;
+    return 0;
+}
+
+struct dcs_channel *dcs_find_channel(struct dcs *context, uint32_t freq_khz, uint8_t bw_mhz)
+{
+    struct dcs_channel key = {
+        .ch = {
+            .frequency_khz = freq_khz,
+            .bandwidth_mhz = bw_mhz,
+        }
+    };
+    struct dcs_channel *key_ptr = &key;
+    struct dcs_channel **found;
+
+    if (!context->index.by_freq)
+        return NULL;
+
+    found = bsearch(&key_ptr, context->index.by_freq, context->num_chans,
+                    sizeof(*context->index.by_freq), compare_channels_by_freq);
+    return found ? *found : NULL;
+}
+
 /**
  * @brief Initialise the list of all available channels, and the current channel from a running chip
  *
@@ -275,6 +400,9 @@ static int initialise_channels_from_driver(struct dcs *dcs_context)
 
     mmsm_data_item_free(resp);
 
+    if (dcs_init_channel_tables(dcs_context))
+        return -ENOMEM;
+
     if (update_current_channel(dcs_context))
     {
         LOG_ERROR("Couldn't find current channel\n");
@@ -293,18 +421,12 @@ static int initialise_channels_from_driver(struct dcs *dcs_context)
 static bool primary_channel_is_available(struct dcs *context, struct dcs_channel channel)
 {
     /* List of channels from driver contains all channels that are not disabled in the BCF */
-    struct dcs_channel *all_channels = context->all_channels;
     uint32_t primary_freq_khz = calculate_new_prim_ch_center_freq(context, &channel);
     uint8_t primary_bw_mhz = context->current_primary_ch_width;
 
-    for (int i = 0; i < context->num_chans; i++)
-    {
-        if (all_channels[i].ch.frequency_khz == primary_freq_khz &&
-            all_channels[i].ch.bandwidth_mhz == primary_bw_mhz)
-        {
-            return true;
-        }
-    }
+    if (dcs_find_channel(context, primary_freq_khz, primary_bw_mhz))
+        return true;
+
     LOG_INFO("Could not find available primary channel, skipping.\n"
              "Channel %u, primary BW %u MHz, primary channel index %u\n",
              channel.ch.channel_s1g,
@@ -325,6 +447,7 @@ static void init_scan_list(struct dcs *context)
     struct dcs_channel *chans = context->all_channels;
 
     list_reset(&context->scan.list);
+    memset(context->metrics.in_scan_list, 0, context->num_chans);
     for (int i = 0; i < context->num_chans; i++)
     {
         LOG_DEBUG("Channel %u: %u kHz %u MHz BW loaded\n",
@@ -338,7 +461,7 @@ static void init_scan_list(struct dcs *context)
                 context->all_channels[i].ch.channel_s1g,
                 context->all_channels[i].ch.frequency_khz,
                 context->all_channels[i].ch.bandwidth_mhz);
-            list_add_tail(&context->scan.list, &chans[i].list);
+            dcs_scan_list_add(context, &chans[i]);
         }
     }
 }
@@ -424,9 +547,47 @@ static int8_t calculate_sec_channel_offset(struct dcs *context, struct dcs_chann
     return ((context->current_prim_1mhz_ch_index & 0x1) == 0) ? 1 : -1;
 }
 
+/**
+ * @brief Update the current channel after a channel switch
+ *
+ * Called with the CSA mutex held, which is released while waiting to retry if hostapd doesn't
+ * report a channel yet.
+ *
+ * @param context DCS context
+ * @return 0 if successful, else error code
+ */
+static int update_current_channel_after_csa(struct dcs *context)
+{
+    const struct timespec retry_sleep = {
+        .tv_sec = 1,
+        .tv_nsec = 0
+    };
+    int retries = 0;
+    int ret;
+
+    while ((ret = update_current_channel(context)) == -EAGAIN &&
+           retries < MAX_CHANNEL_UPDATE_RETRIES)
+    {
+        retries++;
+
+        /* have to release mutex before going to sleep*/
+        MMSM_ASSERT(pthread_mutex_unlock(&context->csa.mutex) == 0);
+        nanosleep(&retry_sleep, NULL);
+        MMSM_ASSERT(pthread_mutex_lock(&context->csa.mutex) == 0);
+    }
+
+    if (retries)
+        LOG_DEBUG("Took %d tries to retrieve channel\n", retries);
+
+    return ret;
+}
+
 /**
  * @brief Callback function on ECSA done event
  *
+ * The kernel reports the switch before hostapd has necessarily caught up, so the current channel
+ * is only read once hostapd reports it too, see @ref csa_finished_callback.
+ *
  * @param param context parameter
  * @param intf nl80211 backend interface
  * @param result data item containing ECSA done event
@@ -435,21 +596,17 @@ static void ecsa_done_callback(void *param, mmsm_backend_intf_t *intf, mmsm_data
 {
     struct dcs *context = (struct dcs *)param;
     mmsm_data_item_t *item;
-    int ret;
-    int retries = 0;
     const mmsm_key_t key = {
         .d.u32 = NL80211_ATTR_WIPHY_FREQ,
         .type = MMSM_KEY_TYPE_U32
     };
-    struct timespec retry_sleep = {
-        .tv_sec = 1,
-        .tv_nsec = 0
-    };
 
     MMSM_ASSERT(result->mmsm_key.d.u32 == NL80211_CMD_CH_SWITCH_NOTIFY);
     MMSM_ASSERT(pthread_mutex_lock(&context->csa.mutex) == 0);
 
     item = mmsm_find_key(result->mmsm_sub_values, &key);
+    trace_record(TRACE_DCS, TRACE_DCS_CSA, TRACE_DCS_CSA_KERNEL_SWITCHED,
+                 item ? mmsm_data_item_get_val_u32(item) : 0, 0);
 
     if (item)
     {
@@ -463,43 +620,120 @@ static void ecsa_done_callback(void *param, mmsm_backend_intf_t *intf, mmsm_data
         context->csa.freq_5g = 0;
     }
 
-    /* Hostapd might not be updated by the time we process the netlink event and ask for the new
-     * channel. Retry if we get an invalid frequency
-     */
-    while (retries < MAX_CHANNEL_UPDATE_RETRIES)
-    {
-        ret = update_current_channel(context);
-        if (ret != -EAGAIN)
-            break;
-        retries++;
+    /* Any STATUS response from before the switch reports the old channel */
+    mmsm_request_cache_invalidate(context->hostapd_intf);
+    context->csa.kernel_switched = true;
 
-        /* have to release mutex before going to sleep*/
-        MMSM_ASSERT(pthread_mutex_unlock(&context->csa.mutex) == 0);
-        nanosleep(&retry_sleep, NULL);
-        MMSM_ASSERT(pthread_mutex_lock(&context->csa.mutex) == 0);
+    if (context->csa.in_progress == false)
+    {
+        LOG_WARN("CSA was not in progress, but completed\n");
     }
-
-    if (retries)
-        LOG_DEBUG("Took %d tries to retrieve channel\n", retries);
-
-    if (ret)
+    else
     {
-        LOG_ERROR("Could not retrieve new channel\n");
-        context->csa.freq_5g = 0;
+        pthread_cond_signal(&context->csa.done);
     }
 
-    if (context->csa.in_progress == false)
+    MMSM_ASSERT(pthread_mutex_unlock(&context->csa.mutex) == 0);
+}
+
+/**
+ * @brief Callback function on hostapd CTRL-EVENT-CHANNEL-SWITCH events
+ *
+ * Hostapd has moved to a new channel, by a CSA or otherwise. Switches DCS didn't ask for are
+ * picked up here.
+ *
+ * @param param context parameter
+ * @param intf hostapd backend interface
+ * @param result data item containing the event
+ */
+static void hostapd_channel_switch_callback(void *param, mmsm_backend_intf_t *intf,
+        mmsm_data_item_t *result)
+{
+    struct dcs *context = (struct dcs *)param;
+    int ret;
+
+    UNUSED(intf);
+    UNUSED(result);
+
+    MMSM_ASSERT(pthread_mutex_lock(&context->csa.mutex) == 0);
+
+    mmsm_request_cache_invalidate(context->hostapd_intf);
+
+    if (context->csa.in_progress)
     {
-        LOG_WARN("CSA was not in progress, but completed\n");
+        LOG_DEBUG("Hostapd switched channel, waiting for the CSA to finish\n");
     }
     else
     {
-        pthread_cond_signal(&context->csa.done);
+        LOG_INFO("Hostapd switched channel, resyncing current channel\n");
+        ret = update_current_channel_after_csa(context);
+        if (ret)
+            LOG_ERROR("Could not resync current channel: %d\n", ret);
     }
 
     MMSM_ASSERT(pthread_mutex_unlock(&context->csa.mutex) == 0);
 }
 
+/**
+ * @brief Callback function on hostapd AP-CSA-FINISHED events
+ *
+ * Hostapd reports this once it has updated its own state, so STATUS reports the new channel.
+ *
+ * @param param context parameter
+ * @param intf hostapd backend interface
+ * @param result data item containing the event
+ */
+static void csa_finished_callback(void *param, mmsm_backend_intf_t *intf,
+        mmsm_data_item_t *result)
+{
+    struct dcs *context = (struct dcs *)param;
+
+    UNUSED(intf);
+    UNUSED(result);
+
+    trace_record(TRACE_DCS, TRACE_DCS_CSA, TRACE_DCS_CSA_HOSTAPD_SWITCHED, 0, 0);
+    MMSM_ASSERT(pthread_mutex_lock(&context->csa.mutex) == 0);
+
+    mmsm_request_cache_invalidate(context->hostapd_intf);
+    context->csa.hostapd_switched = true;
+
+    if (context->csa.in_progress)
+        pthread_cond_signal(&context->csa.done);
+
+    MMSM_ASSERT(pthread_mutex_unlock(&context->csa.mutex) == 0);
+}
+
+/**
+ * @brief Callback function on nl80211 notifications being lost
+ *
+ * A channel switch notification may have been among them, so the current channel is queried
+ * again rather than trusted.
+ *
+ * @param param context parameter
+ * @param intf nl80211 backend interface
+ * @param result data item containing the events lost notification
+ */
+static void events_lost_callback(void *param, mmsm_backend_intf_t *intf, mmsm_data_item_t *result)
+{
+    struct dcs *context = (struct dcs *)param;
+    int ret;
+
+    MMSM_ASSERT(result->mmsm_key.d.u32 == MMSM_BACKEND_NL80211_EVENTS_LOST);
+    MMSM_ASSERT(pthread_mutex_lock(&context->csa.mutex) == 0);
+
+    LOG_WARN("nl80211 events lost, resyncing current channel\n");
+
+    mmsm_request_cache_invalidate(context->hostapd_intf);
+    ret = update_current_channel(context);
+    if (ret)
+        LOG_ERROR("Could not resync current channel: %d\n", ret);
+
+    if (context->csa.in_progress)
+        LOG_WARN("CSA in progress, its completion may have been lost\n");
+
+    MMSM_ASSERT(pthread_mutex_unlock(&context->csa.mutex) == 0);
+}
+
 /**
  * @brief Trigger a ECSA to switch to a new channel - returns when channel has switched
  *
@@ -513,6 +747,7 @@ static int do_channel_switch(struct dcs *context, struct dcs_channel *channel)
     char ecsa_cmd[512];
     struct timespec wait_timeout;
     uint32_t chan_switch_time;
+    bool waiting_for_hostapd = false;
 
     MMSM_ASSERT(context);
     MMSM_ASSERT(channel);
@@ -522,8 +757,22 @@ static int do_channel_switch(struct dcs *context, struct dcs_channel *channel)
         return ret;
     }
 
+    if (context->test.replay)
+    {
+        LOG_INFO("Simulating channel switch - new operating frequency: %u kHz, s1g chan: %u\n",
+            channel->ch.frequency_khz, channel->ch.channel_s1g);
+        context->current_channel = channel;
+        if (context->test.stats)
+            context->test.stats->csas++;
+        return ret;
+    }
+
     MMSM_ASSERT(pthread_mutex_lock(&context->csa.mutex) == 0);
 
+    /* Anything reported before now is about another switch */
+    context->csa.kernel_switched = false;
+    context->csa.hostapd_switched = false;
+
     LOG_INFO("Triggering channel switch - new operating frequency: %u kHz, s1g chan: %u\n",
         channel->ch.frequency_khz, channel->ch.channel_s1g);
 
@@ -533,6 +782,8 @@ static int do_channel_switch(struct dcs *context, struct dcs_channel *channel)
         context->current_primary_ch_width, calculate_sec_channel_offset(context, channel),
         channel->ch.frequency_khz, channel->ch.bandwidth_mhz);
 
+    trace_record(TRACE_DCS, TRACE_DCS_CSA, TRACE_DCS_CSA_START, channel->ch.channel_s1g, 0);
+    MMSM_PROBE1(dcs__csa__start, channel->ch.channel_s1g);
     result = mmsm_request(context->hostapd_intf, ecsa_cmd);
     if (!result)
     {
@@ -563,14 +814,37 @@ static int do_channel_switch(struct dcs *context, struct dcs_channel *channel)
     context->csa.in_progress = true;
     set_timespec_for_future(&wait_timeout, chan_switch_time);
 
-    if (pthread_cond_timedwait(&context->csa.done, &context->csa.mutex, &wait_timeout)
-        == ETIMEDOUT)
+    /* Wait for the kernel to switch, then for hostapd to report that it has too */
+    while (!context->csa.kernel_switched || !context->csa.hostapd_switched)
+    {
+        if (context->csa.kernel_switched && !waiting_for_hostapd)
+        {
+            set_timespec_for_future(&wait_timeout, HOSTAPD_CSA_EVENT_TIMEOUT_SECS);
+            waiting_for_hostapd = true;
+        }
+
+        if (pthread_cond_timedwait(&context->csa.done, &context->csa.mutex, &wait_timeout)
+            == ETIMEDOUT)
+            break;
+    }
+
+    if (!context->csa.kernel_switched)
     {
         LOG_WARN("CSA has timed out\n");
         ret = -ETIMEDOUT;
         goto exit;
     }
 
+    if (!context->csa.hostapd_switched)
+        LOG_WARN("Hostapd did not report the CSA finishing, asking for the channel anyway\n");
+
+    ret = update_current_channel_after_csa(context);
+    if (ret)
+    {
+        LOG_ERROR("Could not retrieve new channel\n");
+        goto exit;
+    }
+
     /* Sanity check have ended up where we were supposed to */
     if (context->csa.freq_5g == context->current_5g_freq)
     {
@@ -584,6 +858,9 @@ static int do_channel_switch(struct dcs *context, struct dcs_channel *channel)
     }
 
 exit:
+    trace_record(TRACE_DCS, TRACE_DCS_CSA, ret ? TRACE_DCS_CSA_FAILED : TRACE_DCS_CSA_DONE,
+                 channel->ch.channel_s1g, -ret);
+    MMSM_PROBE2(dcs__csa__done, channel->ch.channel_s1g, ret);
     context->csa.in_progress = false;
     context->csa.freq_5g = 0;
     mmsm_data_item_free(result);
@@ -593,299 +870,1290 @@ exit:
 }
 
 /**
- * @brief Perform a channel measurement on the chip.
+ * @brief Get the ocs done from vendor event object
  *
- * @param context DCS context object
- * @param channel The channel to scan
- * @return Pointer to channel measurement or NULL if measurement failed.
- *      The caller is responsible for freeing this object.
+ * @param result data item containing the vendor event
+ * @return OCS done event or NULL if no data
  */
-static struct channel_measurement *get_channel_measurement_from_chip(
-        struct dcs *context, struct dcs_channel *channel)
+static struct morse_cmd_evt_ocs_done* get_ocs_done_from_vendor_event(mmsm_data_item_t *result)
 {
-    mmsm_data_item_t *result;
-    struct timespec wait_timeout;
-    struct channel_measurement *meas = calloc(1, sizeof(*meas));
-
-    if (!meas)
-    {
-        LOG_ERROR("Failed to allocate measurement\n");
-        return NULL;
-    }
-
-    struct morse_cmd_req_ocs_driver req = {
-        .subcmd = htole32(1),
-        .config = {
-            .op_channel_freq_hz = htole32(channel->ch.frequency_khz * 1000),
-            .op_channel_bw_mhz = channel->ch.bandwidth_mhz,
-            .pri_channel_bw_mhz = context->current_primary_ch_width,
-            .pri_1mhz_channel_index = context->current_prim_1mhz_ch_index,
-        }
-    };
+    return (struct morse_cmd_evt_ocs_done*) mmsm_find_by_nested_intkeys(result,
+            NL80211_CMD_VENDOR, NL80211_ATTR_VENDOR_DATA, MORSE_VENDOR_ATTR_DATA, -1);
+}
 
-    /* Pass the allocated measurement object to the done callback (or NULL if error) */
-    context->scan.result = meas;
+/**
+ * @brief Check an OCS done vendor event could be for the off-channel scan waiting for one
+ *
+ * The event doesn't identify the scan it is for, so the event of a scan that timed out may
+ * arrive while a later scan is waiting. Each scan that times out is owed an event, and the next
+ * event to arrive is dropped as its, until @ref WAIT_TIMEOUT_SEC after the scan was requested,
+ * when it is taken as lost. Otherwise, the chip can only have listened for as long as the event
+ * reports since the scan was requested, so an event reporting longer belongs to an earlier scan.
+ *
+ * @param arg context argument
+ * @param event The OCS done vendor event
+ * @param age_us Time since the off-channel scan was requested
+ * @return false if the event must be for an earlier scan
+ */
+static bool is_ocs_done_for_request(void *arg, mmsm_data_item_t *event, uint64_t age_us)
+{
+    struct dcs *context = (struct dcs *)arg;
+    struct morse_cmd_evt_ocs_done *ocs_done = get_ocs_done_from_vendor_event(event);
+    bool stale = false;
 
-    result = mmsm_request(context->mctrl_intf, MORSE_CMD_ID_OCS_DRIVER, sizeof(req), &req, -1);
-    if (!result)
+    MMSM_ASSERT(pthread_mutex_lock(&context->scan.slot.mutex) == 0);
+    if (context->scan.stale_events && get_timestamp_ms() >= context->scan.stale_deadline_ms)
+        context->scan.stale_events = 0;
+    if (context->scan.stale_events)
     {
-        LOG_ERROR("No result\n");
-        free(meas);
-        meas = NULL;
-        goto exit;
+        context->scan.stale_events--;
+        context->scan.stale_dropped = true;
+        stale = true;
     }
+    MMSM_ASSERT(pthread_mutex_unlock(&context->scan.slot.mutex) == 0);
 
-    LOG_DEBUG("Measurement scheduled %u\n", context->scan.channel->ch.frequency_khz);
-
-    mmsm_data_item_free(result);
+    if (stale)
+        return false;
 
-    set_timespec_for_future(&wait_timeout, WAIT_TIMEOUT_SEC);
+    /* Let the callback fail the scan if the event is malformed */
+    if (!ocs_done)
+        return true;
 
-    /* Wait for the scan to complete (this will unlock the mutex while asleep) */
-    if (pthread_cond_timedwait(&context->scan.done, &context->scan.mutex, &wait_timeout)
-        == ETIMEDOUT)
-    {
-        LOG_ERROR("Measurement timed out\n");
-        free(meas);
-        meas = NULL;
-    }
+    return le64toh(ocs_done->time_listen) <= age_us;
+}
 
-exit:
+/**
+ * @brief Get how long to wait for an off-channel scan to complete
+ *
+ * A lost event then costs a few times the usual scan time, rather than @ref WAIT_TIMEOUT_SEC.
+ *
+ * @param context DCS context object
+ * @return the timeout in ms
+ */
+static uint32_t get_ocs_timeout_ms(struct dcs *context)
+{
+    if (!context->scan.latency_ms)
+        return WAIT_TIMEOUT_SEC * 1000;
 
-    return meas;
+    return MIN(MAX(context->scan.latency_ms * OCS_TIMEOUT_FACTOR, OCS_MIN_TIMEOUT_MS),
+               WAIT_TIMEOUT_SEC * 1000);
 }
 
 /**
- * @brief Get a channel measurement, depending on mode
+ * @brief Update the average time off-channel scans take to complete
  *
  * @param context DCS context object
- * @param channel The channel to scan
- * @return Pointer to channel measurement, or NULL if measurement failed.
- *          The caller is responsible for freeing this object if not NULL
+ * @param elapsed_ms How long the scan took, or 0 if it failed, which doubles the average so
+ *                   scans slower than usual don't keep timing out
  */
-static struct channel_measurement *get_channel_measurement(
-        struct dcs *context, struct dcs_channel *channel)
+static void update_ocs_latency(struct dcs *context, uint64_t elapsed_ms)
 {
-    struct channel_measurement *result;
+    uint32_t *latency_ms = &context->scan.latency_ms;
 
-    MMSM_ASSERT(pthread_mutex_lock(&context->scan.mutex) == 0);
+    if (!elapsed_ms)
+        *latency_ms = MIN(*latency_ms * 2, WAIT_TIMEOUT_SEC * 1000);
+    else if (!*latency_ms)
+        *latency_ms = MAX(elapsed_ms, 1);
+    else
+        *latency_ms = (*latency_ms * 3 + MIN(elapsed_ms, WAIT_TIMEOUT_SEC * 1000)) / 4;
+}
 
-    /* Make sure no scan is currently in progress. */
-    MMSM_ASSERT(context->scan.result == NULL);
+/**
+ * @brief Completion callback of an off-channel scan request, called once the OCS done vendor
+ * event has arrived or the request has failed
+ *
+ * @param arg context argument
+ * @param err MMSM_SUCCESS if the event arrived
+ * @param confirm The response to the OCS command
+ * @param event The OCS done vendor event, or NULL
+ */
+static void measurement_done_callback(void *arg, mmsm_error_code err, mmsm_data_item_t *confirm,
+                                      mmsm_data_item_t *event)
+{
+    struct dcs *context = (struct dcs *)arg;
+    struct channel_measurement meas = { 0 };
+    struct morse_cmd_evt_ocs_done *ocs_done;
 
-    context->scan.channel = channel;
+    ocs_done = (err == MMSM_SUCCESS) ? get_ocs_done_from_vendor_event(event) : NULL;
+    if (ocs_done)
+    {
+        timestamp_get(&meas.sample_time);
+        meas.metric = ocs_done->metric;
+        meas.noise = ocs_done->noise;
+        meas.time_listen_us = le64toh(ocs_done->time_listen);
+        meas.time_rx_us = le64toh(ocs_done->time_rx);
+    }
+    MMSM_PROBE3(dcs__scan__done, ocs_done ? 0 : 1, meas.metric, meas.noise);
+
+    /* Publish the result, and signal our scan has finished */
+    MMSM_ASSERT(pthread_mutex_lock(&context->scan.slot.mutex) == 0);
+    context->scan.slot.meas = meas;
+    context->scan.slot.succeeded = (ocs_done != NULL);
+    /* Rather than rejected by the chip, in which case no event will follow */
+    context->scan.slot.timed_out = (err != MMSM_SUCCESS && err != MMSM_COMMAND_FAILED);
+    context->scan.slot.completed = true;
+    pthread_cond_signal(&context->scan.slot.done);
+    MMSM_ASSERT(pthread_mutex_unlock(&context->scan.slot.mutex) == 0);
+}
 
-    if (context->test.enabled)
+/**
+ * @brief Cancel the off-channel scan in progress when the scan thread is cancelled
+ *
+ * @param arg DCS context object
+ */
+static void measurement_cancelled(void *arg)
+{
+    struct dcs *context = (struct dcs *)arg;
+    bool completed = context->scan.slot.completed;
+
+    /* The callback may be waiting for the mutex, so release it before cancelling */
+    MMSM_ASSERT(pthread_mutex_unlock(&context->scan.slot.mutex) == 0);
+
+    if (!completed)
+        mmsm_backend_morsectrl_cancel(context->mctrl_intf, context->scan.request);
+    context->scan.request = NULL;
+}
+
+/**
+ * @brief Perform a channel measurement on the chip.
+ *
+ * @param context DCS context object
+ * @param channel The channel to scan
+ * @return Pointer to channel measurement or NULL if measurement failed.
+ *      The caller is responsible for freeing this object to @ref dcs::measurement_pool.
+ */
+static struct channel_measurement *get_channel_measurement_from_chip(
+        struct dcs *context, struct dcs_channel *channel)
+{
+    struct channel_measurement *meas = NULL;
+    struct channel_measurement result;
+    uint32_t timeout_ms;
+    uint64_t start_ms;
+    uint64_t elapsed_ms;
+    bool succeeded;
+
+    struct morse_cmd_req_ocs_driver req = {
+        .subcmd = htole32(1),
+        .config = {
+            .op_channel_freq_hz = htole32(channel->ch.frequency_khz * 1000),
+            .op_channel_bw_mhz = channel->ch.bandwidth_mhz,
+            .pri_channel_bw_mhz = context->current_primary_ch_width,
+            .pri_1mhz_channel_index = context->current_prim_1mhz_ch_index,
+        }
+    };
+
+    timeout_ms = get_ocs_timeout_ms(context);
+    start_ms = get_timestamp_ms();
+    trace_record(TRACE_DCS, TRACE_DCS_SCAN, TRACE_DCS_SCAN_START, channel->ch.channel_s1g, 0);
+    MMSM_PROBE1(dcs__scan__start, channel->ch.channel_s1g);
+    context->scan.request = mmsm_backend_morsectrl_request_async_match(context->mctrl_intf,
+            MORSE_VENDOR_EVENT_OCS_DONE, is_ocs_done_for_request, timeout_ms,
+            measurement_done_callback, context, MORSE_CMD_ID_OCS_DRIVER, sizeof(req), &req);
+    if (!context->scan.request)
+    {
+        LOG_ERROR("No result\n");
+        trace_record(TRACE_DCS, TRACE_DCS_SCAN, TRACE_DCS_SCAN_FAILED, channel->ch.channel_s1g, 0);
+        return NULL;
+    }
+
+    LOG_DEBUG("Measurement scheduled %u (timeout %ums)\n",
+              context->scan.channel->ch.frequency_khz, timeout_ms);
+
+    /*
+     * Wait for the scan to complete (this will unlock the mutex while asleep). The request times
+     * out by itself, so the callback is always called.
+     */
+    MMSM_ASSERT(pthread_mutex_lock(&context->scan.slot.mutex) == 0);
+    pthread_cleanup_push(measurement_cancelled, context);
+    while (!context->scan.slot.completed)
+        MMSM_ASSERT(pthread_cond_wait(&context->scan.slot.done, &context->scan.slot.mutex) == 0);
+    pthread_cleanup_pop(0);
+
+    /* Claim the result, emptying the slot for the next request */
+    succeeded = context->scan.slot.succeeded;
+    result = context->scan.slot.meas;
+    context->scan.slot.completed = false;
+
+    /*
+     * The event of a scan that timed out may still arrive, and must not complete a later scan.
+     * Unless an event was already dropped while this scan waited: the one owed before must have
+     * been lost and the one dropped this scan's, so owing another would drop every scan's event.
+     */
+    if (context->scan.slot.timed_out && !context->scan.stale_dropped)
+    {
+        context->scan.stale_events++;
+        context->scan.stale_deadline_ms = start_ms + WAIT_TIMEOUT_SEC * 1000;
+    }
+    context->scan.stale_dropped = false;
+    MMSM_ASSERT(pthread_mutex_unlock(&context->scan.slot.mutex) == 0);
+
+    context->scan.request = NULL;
+    if (succeeded)
     {
-        result = get_channel_measurement_for_test(context, channel);
+        meas = pool_alloc(&context->measurement_pool);
+        if (meas)
+            *meas = result;
+        else
+            LOG_ERROR("Failed to allocate measurement\n");
     }
     else
     {
-        result = get_channel_measurement_from_chip(context, channel);
+        LOG_ERROR("Measurement failed or timed out\n");
     }
 
-    context->scan.result = NULL;
-    MMSM_ASSERT(pthread_mutex_unlock(&context->scan.mutex) == 0);
+    elapsed_ms = succeeded ? MAX(get_timestamp_ms() - start_ms, 1) : 0;
+    trace_record(TRACE_DCS, TRACE_DCS_SCAN, succeeded ? TRACE_DCS_SCAN_DONE : TRACE_DCS_SCAN_FAILED,
+                 channel->ch.channel_s1g, elapsed_ms);
+    update_ocs_latency(context, elapsed_ms);
 
-    return result;
+    return meas;
 }
 
 /**
- * @brief Validate that the vendor event is a morse OCS done event
+ * @brief Get a channel measurement, depending on mode
  *
- * @param result data item containing the vendor event
- * @return true if OCS done event, else false
+ * @param context DCS context object
+ * @param channel The channel to scan
+ * @return Pointer to channel measurement, or NULL if measurement failed.
+ *          The caller is responsible for freeing this object to @ref dcs::measurement_pool
+ *          if not NULL
  */
-static bool is_morse_ocs_done_vendor_event(mmsm_data_item_t *result)
+static struct channel_measurement *get_channel_measurement(
+        struct dcs *context, struct dcs_channel *channel)
 {
-    uint8_t *data;
-    data = mmsm_find_by_nested_intkeys(result, NL80211_CMD_VENDOR, NL80211_ATTR_VENDOR_ID, -1);
-    if (!data || *((uint32_t*)data) != MORSE_OUI)
-        return false;
+    /* Make sure no scan is currently in progress. */
+    MMSM_ASSERT(context->scan.request == NULL);
+
+    context->scan.channel = channel;
 
-    data = mmsm_find_by_nested_intkeys(result, NL80211_CMD_VENDOR, NL80211_ATTR_VENDOR_SUBCMD, -1);
-    if (!data || *((uint32_t*)data) != MORSE_VENDOR_EVENT_OCS_DONE)
+    if (context->test.enabled)
+        return get_channel_measurement_for_test(context, channel);
+
+    return get_channel_measurement_from_chip(context, channel);
+}
+
+/**
+ * @brief Read a u64 survey counter
+ *
+ * @param info The NL80211_ATTR_SURVEY_INFO attributes
+ * @param attr The counter's attribute
+ * @param val Set to the counter
+ * @return true if the counter is present, else false
+ */
+static bool get_survey_u64(mmsm_data_item_t *info, uint32_t attr, uint64_t *val)
+{
+    const mmsm_key_t key = {
+        .d.u32 = attr,
+        .type = MMSM_KEY_TYPE_U32
+    };
+    mmsm_data_item_t *item = mmsm_find_key(info, &key);
+
+    if (!item || item->mmsm_value_len != sizeof(*val))
         return false;
 
+    memcpy(val, item->mmsm_value, sizeof(*val));
     return true;
 }
 
 /**
- * @brief Get the ocs done from vendor event object
+ * @brief Measure the operating channel from its survey counters
  *
- * @param result data item containing the vendor event
- * @return OCS done event or NULL if no data
+ * The counters are cumulative, so the measurement covers the time since the last call. The
+ * metric is the percentage of that time the channel was neither busy nor used by our own
+ * transmissions, on the same 0 - 100 scale as the off-channel scan metric.
+ *
+ * @param context DCS context object
+ * @param meas Filled with the measurement
+ * @return 0 on success, -EAGAIN if this is the first reading of the channel's counters, or
+ *         another error code if the survey couldn't be read
  */
-static struct morse_cmd_evt_ocs_done* get_ocs_done_from_vendor_event(mmsm_data_item_t *result)
+static int get_channel_measurement_from_survey(struct dcs *context,
+        struct channel_measurement *meas)
 {
-    return (struct morse_cmd_evt_ocs_done*) mmsm_find_by_nested_intkeys(result,
-            NL80211_CMD_VENDOR, NL80211_ATTR_VENDOR_DATA, MORSE_VENDOR_ATTR_DATA, -1);
+    mmsm_data_item_t *result;
+    mmsm_data_item_t *iter;
+    mmsm_data_item_t *info = NULL;
+    const mmsm_key_t info_key = {
+        .d.u32 = NL80211_ATTR_SURVEY_INFO,
+        .type = MMSM_KEY_TYPE_U32
+    };
+    const mmsm_key_t in_use_key = {
+        .d.u32 = NL80211_SURVEY_INFO_IN_USE,
+        .type = MMSM_KEY_TYPE_U32
+    };
+    uint8_t *val;
+    uint32_t freq;
+    uint64_t time_ms, busy_ms, rx_ms = 0, tx_ms = 0;
+    uint64_t time_delta, busy_delta, idle_delta;
+    int ret = 0;
+
+    result = mmsm_request(context->nl80211_intf, NL80211_CMD_GET_SURVEY, NLM_F_DUMP,
+                          NL80211_ATTR_IFINDEX, NLA_U32, context->if_index, -1);
+    if (!result)
+        return -ENODATA;
+
+    /* One message per channel, the operating channel is flagged as in use */
+    for (iter = result; iter; iter = iter->mmsm_next)
+    {
+        mmsm_data_item_t *item = mmsm_find_key(iter->mmsm_sub_values, &info_key);
+
+        if (item && mmsm_find_key(item->mmsm_sub_values, &in_use_key))
+        {
+            info = item->mmsm_sub_values;
+            break;
+        }
+    }
+
+    if (!info)
+    {
+        LOG_DEBUG("No survey of the operating channel\n");
+        ret = -ENODATA;
+        goto exit;
+    }
+
+    val = mmsm_find_value_by_intkey(info, NL80211_SURVEY_INFO_FREQUENCY);
+    if (!val || !get_survey_u64(info, NL80211_SURVEY_INFO_TIME, &time_ms) ||
+        !get_survey_u64(info, NL80211_SURVEY_INFO_TIME_BUSY, &busy_ms))
+    {
+        LOG_DEBUG("Survey of the operating channel has no channel time\n");
+        ret = -ENODATA;
+        goto exit;
+    }
+    memcpy(&freq, val, sizeof(freq));
+    get_survey_u64(info, NL80211_SURVEY_INFO_TIME_RX, &rx_ms);
+    get_survey_u64(info, NL80211_SURVEY_INFO_TIME_TX, &tx_ms);
+
+    /* Start again from these counters after a channel switch, or if they have been reset */
+    if (!context->survey.valid || context->survey.freq != freq ||
+        time_ms <= context->survey.time_ms || busy_ms < context->survey.busy_ms ||
+        rx_ms < context->survey.rx_ms || tx_ms < context->survey.tx_ms)
+    {
+        ret = -EAGAIN;
+        goto save;
+    }
+
+    time_delta = time_ms - context->survey.time_ms;
+    busy_delta = busy_ms - context->survey.busy_ms;
+    /* Busy time includes our own transmissions, which aren't occupancy by others */
+    busy_delta -= MIN(busy_delta, tx_ms - context->survey.tx_ms);
+    idle_delta = time_delta - MIN(time_delta, busy_delta);
+
+    timestamp_get(&meas->sample_time);
+    meas->metric = (uint8_t)((idle_delta * 100) / time_delta);
+    val = mmsm_find_value_by_intkey(info, NL80211_SURVEY_INFO_NOISE);
+    meas->noise = val ? *(int8_t *)val : 0;
+    meas->time_listen_us = time_delta * 1000;
+    meas->time_rx_us = (rx_ms - context->survey.rx_ms) * 1000;
+    meas->source = CHANNEL_MEASUREMENT_SOURCE_SURVEY;
+
+save:
+    context->survey.valid = true;
+    context->survey.freq = freq;
+    context->survey.time_ms = time_ms;
+    context->survey.busy_ms = busy_ms;
+    context->survey.rx_ms = rx_ms;
+    context->survey.tx_ms = tx_ms;
+
+exit:
+    mmsm_data_item_free(result);
+    return ret;
 }
 
+/** A measurement queued for the processing thread */
+struct queued_measurement
+{
+    list_entry_t list;
+    /** The channel measured */
+    struct dcs_channel *channel;
+    struct channel_measurement meas;
+};
+
 /**
- * @brief Callback on vendor event for when a channel scan is complete
+ * @brief Pass a measurement to the algorithm and log it
  *
- * @param arg context argument
- * @param intf backend interface vendor event was received on
- * @param result The vendor event
+ * @param context DCS context object
+ * @param meas The measurement
+ * @param channel The channel measured
+ */
+static void process_measurement(struct dcs *context, struct channel_measurement *meas,
+                                struct dcs_channel *channel)
+{
+    int slot = dcs_channel_slot(context, channel);
+
+    dcs_algo_ops_process_measurement(context, meas, channel);
+
+    if (meas->source == CHANNEL_MEASUREMENT_SOURCE_SURVEY)
+    {
+        LOG_VERBOSE("Survey measurement (ch %u) - listen time: %"PRIu64", rx time: %"PRIu64", "
+                    "noise: %d, metric: %u, accumulated score: %u\n",
+                channel->ch.channel_s1g, meas->time_listen_us, meas->time_rx_us, meas->noise,
+                meas->metric, context->metrics.accumulated_score[slot]);
+        return;
+    }
+
+    LOG_DEBUG("Measurement done (ch %u) - listen time: %"PRIu64", rx time: %"PRIu64", "
+                "noise: %d, metric: %u, accumulated score: %u\n",
+            channel->ch.channel_s1g, meas->time_listen_us, meas->time_rx_us, meas->noise,
+            meas->metric, context->metrics.accumulated_score[slot]);
+
+    datalog_write_csv(context->datalog, "tuuuuuuu", &meas->sample_time,
+        channel->ch.frequency_khz, channel->ch.bandwidth_mhz, channel->ch.channel_s1g,
+        meas->metric, context->metrics.accumulated_score[slot],
+        context->metrics.rounds_as_best[slot],
+        context->current_channel->ch.channel_s1g);
+}
+
+/**
+ * @brief Thread function to process queued measurements
+ *
+ * @param arg context variable
+ * @return void* ignored
  */
-static void measurement_done_callback(void *arg, mmsm_backend_intf_t *intf, mmsm_data_item_t
-                    *result)
+static void *measurement_process_thread_fn(void *arg)
 {
     struct dcs *context = (struct dcs *)arg;
-    struct channel_measurement *meas;
-    struct morse_cmd_evt_ocs_done *ocs_done;
+    struct queued_measurement *queued;
 
-    if (!is_morse_ocs_done_vendor_event(result))
+    MMSM_ASSERT(pthread_mutex_lock(&context->process.mutex) == 0);
+    while (!context->process.stopping)
     {
-        /* Not our event */
+        if (list_is_empty(&context->process.queue))
+        {
+            MMSM_ASSERT(pthread_cond_wait(&context->process.cond,
+                                          &context->process.mutex) == 0);
+            continue;
+        }
+
+        queued = list_get_first_item(queued, &context->process.queue, list);
+        list_remove(&queued->list);
+        context->process.busy = true;
+        MMSM_ASSERT(pthread_mutex_unlock(&context->process.mutex) == 0);
+
+        process_measurement(context, &queued->meas, queued->channel);
+        pool_free(&context->queued_pool, queued);
+
+        MMSM_ASSERT(pthread_mutex_lock(&context->process.mutex) == 0);
+        context->process.busy = false;
+        MMSM_ASSERT(pthread_cond_broadcast(&context->process.cond) == 0);
+    }
+    MMSM_ASSERT(pthread_mutex_unlock(&context->process.mutex) == 0);
+
+    return NULL;
+}
+
+/**
+ * @brief Queue a measurement for the processing thread
+ *
+ * @param context DCS context object
+ * @param meas The measurement, which is copied
+ * @param channel The channel measured
+ */
+static void queue_measurement(struct dcs *context, const struct channel_measurement *meas,
+                              struct dcs_channel *channel)
+{
+    struct queued_measurement *queued = pool_alloc(&context->queued_pool);
+
+    if (!queued)
+    {
+        LOG_ERROR("Failed to allocate measurement\n");
         return;
     }
 
-    /* Grab the scan mutex */
-    MMSM_ASSERT(pthread_mutex_lock(&context->scan.mutex) == 0);
+    queued->channel = channel;
+    queued->meas = *meas;
+
+    MMSM_ASSERT(pthread_mutex_lock(&context->process.mutex) == 0);
+    list_add_tail(&context->process.queue, &queued->list);
+    MMSM_ASSERT(pthread_cond_broadcast(&context->process.cond) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&context->process.mutex) == 0);
+}
+
+static void unlock_process_mutex(void *arg)
+{
+    struct dcs *context = (struct dcs *)arg;
+
+    MMSM_ASSERT(pthread_mutex_unlock(&context->process.mutex) == 0);
+}
+
+/**
+ * @brief Wait for every queued measurement to be processed, so the algorithm has seen them all
+ *
+ * @param context DCS context object
+ */
+static void drain_measurements(struct dcs *context)
+{
+    MMSM_ASSERT(pthread_mutex_lock(&context->process.mutex) == 0);
+    pthread_cleanup_push(unlock_process_mutex, context);
+    while (!list_is_empty(&context->process.queue) || context->process.busy)
+        MMSM_ASSERT(pthread_cond_wait(&context->process.cond, &context->process.mutex) == 0);
+    pthread_cleanup_pop(1);
+}
 
-    meas = context->scan.result;
+/**
+ * @brief Take a survey measurement of the operating channel and queue it for the algorithm
+ *
+ * @param context DCS context object
+ */
+static void take_survey_measurement(struct dcs *context)
+{
+    struct channel_measurement meas = { 0 };
+    int ret;
 
-    if (meas == NULL)
+    ret = get_channel_measurement_from_survey(context, &meas);
+    if (ret)
     {
-        LOG_ERROR("Measurement completed after it timed out\n");
-        MMSM_ASSERT(pthread_mutex_unlock(&context->scan.mutex) == 0);
+        if (ret != -EAGAIN)
+            LOG_DEBUG("Survey measurement failed - %d\n", ret);
         return;
     }
 
-    ocs_done = get_ocs_done_from_vendor_event(result);
-    if (!ocs_done)
+    queue_measurement(context, &meas, context->current_channel);
+}
+
+/**
+ * @brief Get the time on the monotonic clock, in ms
+ */
+static uint64_t get_monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t dcs_now_ms(struct dcs *context)
+{
+    return context->test.replay ? context->test.clock_ms : get_monotonic_ms();
+}
+
+static uint64_t timespec_to_ms(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
+
+/**
+ * @brief Check if survey measurements of an interface's operating channel are enabled
+ *
+ * @param context DCS context object
+ */
+static bool survey_enabled(struct dcs *context)
+{
+    return context->config.survey_interval_ms && !context->test.enabled &&
+        context->current_channel;
+}
+
+/**
+ * @brief Wait for the last of the replayed measurements to be processed
+ *
+ * @param context DCS context object
+ */
+static void finish_replay(struct dcs *context)
+{
+    /* So the datalog and algorithm have every measurement replayed */
+    drain_measurements(context);
+    LOG_INFO("Replayed %" PRIu64 " s of samples in %" PRIu64 " ms\n",
+        (context->test.clock_ms - context->test.replay_started_clock_ms) / 1000,
+        get_timestamp_ms() - context->test.replay_started_ms);
+}
+
+static void unlock_reconfig_mutex(void *arg)
+{
+    struct dcs_module *module = (struct dcs_module *)arg;
+
+    MMSM_ASSERT(pthread_mutex_unlock(&module->reconfig.mutex) == 0);
+}
+
+/**
+ * @brief Sleep until a time, unless woken to apply a reloaded config
+ *
+ * @param module DCS module
+ * @param wake_ms When to wake, see @ref get_monotonic_ms
+ * @return true if woken to apply a reloaded config
+ */
+static bool sleep_until(struct dcs_module *module, uint64_t wake_ms)
+{
+    struct timespec wake = {
+        .tv_sec = wake_ms / 1000,
+        .tv_nsec = (wake_ms % 1000) * 1000000,
+    };
+    bool pending;
+    int ret = 0;
+
+    MMSM_ASSERT(pthread_mutex_lock(&module->reconfig.mutex) == 0);
+    pthread_cleanup_push(unlock_reconfig_mutex, module);
+    while (!module->reconfig.pending && ret == 0)
+        ret = pthread_cond_timedwait(&module->reconfig.wake, &module->reconfig.mutex, &wake);
+    MMSM_ASSERT(ret == 0 || ret == ETIMEDOUT);
+    pending = module->reconfig.pending != NULL;
+    pthread_cleanup_pop(1);
+
+    return pending;
+}
+
+/**
+ * @brief Wait until the next measurement is due, taking survey measurements of every
+ * interface's operating channel meanwhile where enabled
+ *
+ * @param module DCS module
+ * @param deadline_ms When to stop waiting, see @ref get_monotonic_ms
+ * @return false if woken early to apply a reloaded config, else true
+ */
+static bool wait_between_measurements(struct dcs_module *module, uint64_t deadline_ms)
+{
+    uint64_t now_ms;
+
+    /* Replaying a single interface, with no surveys to take meanwhile */
+    if (module->radios[0]->test.replay)
     {
-        /* Invalidate the result pointer to signal that the measurement failed */
-        free(context->scan.result);
-        context->scan.result = NULL;
-        goto exit;
+        struct dcs *context = module->radios[0];
+
+        if (context->test.finished)
+        {
+            finish_replay(context);
+            mmsm_halt();
+
+            /* Wait to be stopped */
+            while (1)
+                pause();
+        }
+
+        context->test.clock_ms = MAX(context->test.clock_ms, deadline_ms);
+        return true;
+    }
+
+    while ((now_ms = get_monotonic_ms()) < deadline_ms)
+    {
+        uint64_t wake_ms = deadline_ms;
+
+        for (int i = 0; i < module->num_radios; i++)
+        {
+            if (survey_enabled(module->radios[i]))
+                wake_ms = MIN(wake_ms, module->radios[i]->survey.next_ms);
+        }
+
+        if (wake_ms > now_ms && sleep_until(module, wake_ms))
+            return false;
+
+        for (int i = 0; i < module->num_radios; i++)
+        {
+            struct dcs *context = module->radios[i];
+
+            if (!survey_enabled(context) || context->survey.next_ms > get_monotonic_ms())
+                continue;
+
+            take_survey_measurement(context);
+            context->survey.next_ms = get_monotonic_ms() + context->config.survey_interval_ms;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Evaluate the channels, counting the replay's stats if wanted
+ *
+ * @param context DCS context object
+ * @return The channel to switch to, or NULL if no switch is required
+ */
+static struct dcs_channel *evaluate_channels(struct dcs *context)
+{
+    struct dcs_replay_stats *stats = context->test.stats;
+    struct dcs_channel *candidate_chan;
+    struct timespec start, end;
+
+    if (!stats)
+        return dcs_algo_ops_evaluate_channels(context);
+
+    dcs_test_count_stats(context);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    candidate_chan = dcs_algo_ops_evaluate_channels(context);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+    stats->evaluations++;
+    stats->evaluate_cpu_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL +
+        end.tv_nsec - start.tv_nsec;
+    return candidate_chan;
+}
+
+/**
+ * @brief Reconfigure the scheduler from a reloaded config, see @ref dcs_reconfigure
+ *
+ * @param context DCS context object
+ */
+static void reconfigure_scheduler(struct dcs *context)
+{
+    int ret = dcs_scheduler_reconfigure(context, context->scan.scheduler_settings);
+
+    context->scan.scheduler_settings = NULL;
+    if (ret)
+        LOG_ERROR("Failed to reconfigure the scan scheduler on %s - %d, keeping its previous "
+                  "settings\n", context->if_name, ret);
+    else
+        LOG_INFO("Reconfigured the scan scheduler on %s\n", context->if_name);
+}
+
+/**
+ * @brief Copy out the state the metrics and query endpoints report, at the end of a scan round,
+ * notifying the query clients subscribed to "dcs"
+ *
+ * @param context DCS context object
+ * @param switched Whether the round ended in a channel switch
+ * @param switch_failed Whether the round ended in a channel switch that failed
+ */
+static void publish_round(struct dcs *context, bool switched, bool switch_failed)
+{
+    uint64_t round_ms = dcs_now_ms(context) - context->scan.round_start_ms;
+    uint64_t rounds;
+
+    MMSM_ASSERT(pthread_mutex_lock(&context->published.mutex) == 0);
+
+    if (!context->published.scores && context->num_chans)
+    {
+        context->published.scores = calloc(context->num_chans,
+                                           sizeof(*context->published.scores));
+        context->published.n_samples = calloc(context->num_chans,
+                                              sizeof(*context->published.n_samples));
+        context->published.in_scan_list = calloc(context->num_chans,
+                                                 sizeof(*context->published.in_scan_list));
+        if (!context->published.scores || !context->published.n_samples ||
+            !context->published.in_scan_list)
+        {
+            free(context->published.scores);
+            free(context->published.n_samples);
+            free(context->published.in_scan_list);
+            context->published.scores = NULL;
+            context->published.n_samples = NULL;
+            context->published.in_scan_list = NULL;
+        }
+    }
+
+    /* The processing thread has been drained, so the metrics aren't changing */
+    if (context->published.scores)
+    {
+        memcpy(context->published.scores, context->metrics.accumulated_score,
+               context->num_chans * sizeof(*context->published.scores));
+        memcpy(context->published.n_samples, context->metrics.n_samples,
+               context->num_chans * sizeof(*context->published.n_samples));
+        memcpy(context->published.in_scan_list, context->metrics.in_scan_list,
+               context->num_chans * sizeof(*context->published.in_scan_list));
+    }
+
+    context->published.channel = context->current_channel;
+    context->published.rounds++;
+    context->published.round_ms = round_ms;
+    if (switched)
+        context->published.csas++;
+    if (switch_failed)
+        context->published.csa_failures++;
+    rounds = context->published.rounds;
+
+    MMSM_ASSERT(pthread_mutex_unlock(&context->published.mutex) == 0);
+
+    query_notify("dcs", "interface=%s rounds=%" PRIu64 " switched=%d switch_failed=%d",
+                 context->if_name, rounds, switched, switch_failed);
+}
+
+/** What @ref write_metric writes of each interface */
+enum dcs_metric
+{
+    DCS_METRIC_CHANNEL,
+    DCS_METRIC_CHANNEL_SCORE,
+    DCS_METRIC_CHANNEL_SAMPLES,
+    DCS_METRIC_ROUNDS,
+    DCS_METRIC_ROUND_DURATION,
+    DCS_METRIC_CSAS,
+};
+
+/**
+ * @brief Write the samples of one metric family for every interface, as published at the end of
+ * its last scan round
+ *
+ * @param module DCS module
+ * @param out Where to write the metrics
+ * @param metric What to write
+ * @param name Name of the metric family
+ */
+static void write_metric(struct dcs_module *module, FILE *out, enum dcs_metric metric,
+    const char *name)
+{
+    for (int i = 0; i < module->num_radios; i++)
+    {
+        struct dcs *context = module->radios[i];
+        const char *ifname = context->if_name;
+
+        MMSM_ASSERT(pthread_mutex_lock(&context->published.mutex) == 0);
+        switch (metric)
+        {
+        case DCS_METRIC_CHANNEL:
+            if (context->published.channel)
+                fprintf(out, "%s{interface=\"%s\"} %u\n", name, ifname,
+                        context->published.channel->ch.channel_s1g);
+            break;
+        case DCS_METRIC_CHANNEL_SCORE:
+        case DCS_METRIC_CHANNEL_SAMPLES:
+            for (int j = 0; context->published.scores && j < context->num_chans; j++)
+            {
+                const struct morse_cmd_channel_info *ch = &context->all_channels[j].ch;
+
+                if (!context->published.in_scan_list[j])
+                    continue;
+
+                fprintf(out, "%s{interface=\"%s\",channel=\"%u\",frequency_khz=\"%u\","
+                        "bandwidth_mhz=\"%u\"} %" PRId64 "\n", name, ifname, ch->channel_s1g,
+                        ch->frequency_khz, ch->bandwidth_mhz,
+                        metric == DCS_METRIC_CHANNEL_SCORE ?
+                            (int64_t)context->published.scores[j] :
+                            (int64_t)context->published.n_samples[j]);
+            }
+            break;
+        case DCS_METRIC_ROUNDS:
+            fprintf(out, "%s{interface=\"%s\"} %" PRIu64 "\n", name, ifname,
+                    context->published.rounds);
+            break;
+        case DCS_METRIC_ROUND_DURATION:
+            fprintf(out, "%s{interface=\"%s\"} %.3f\n", name, ifname,
+                    context->published.round_ms / 1000.0);
+            break;
+        case DCS_METRIC_CSAS:
+            fprintf(out, "%s{interface=\"%s\",result=\"ok\"} %" PRIu64 "\n", name, ifname,
+                    context->published.csas);
+            fprintf(out, "%s{interface=\"%s\",result=\"failed\"} %" PRIu64 "\n", name, ifname,
+                    context->published.csa_failures);
+            break;
+        }
+        MMSM_ASSERT(pthread_mutex_unlock(&context->published.mutex) == 0);
+    }
+}
+
+/**
+ * @brief Write the DCS metrics of every interface, see metrics.h
+ *
+ * @param arg DCS module
+ * @param out Where to write the metrics
+ */
+static void dcs_write_metrics(void *arg, FILE *out)
+{
+    static const struct
+    {
+        enum dcs_metric metric;
+        const char *name;
+        const char *type;
+        const char *help;
+    } families[] = {
+        { DCS_METRIC_CHANNEL, "smart_manager_dcs_channel", "gauge",
+          "S1G operating channel number" },
+        { DCS_METRIC_CHANNEL_SCORE, "smart_manager_dcs_channel_score", "gauge",
+          "Accumulated score of each channel scanned, as of the last scan round" },
+        { DCS_METRIC_CHANNEL_SAMPLES, "smart_manager_dcs_channel_samples", "counter",
+          "Measurements of each channel scanned" },
+        { DCS_METRIC_ROUNDS, "smart_manager_dcs_scan_rounds_total", "counter",
+          "Scan rounds completed" },
+        { DCS_METRIC_ROUND_DURATION, "smart_manager_dcs_scan_round_duration_seconds", "gauge",
+          "How long the last scan round took" },
+        { DCS_METRIC_CSAS, "smart_manager_dcs_csa_total", "counter",
+          "Channel switches triggered, by whether they completed" },
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(families); i++)
+    {
+        metrics_write_family(out, families[i].name, families[i].type, families[i].help);
+        write_metric(arg, out, families[i].metric, families[i].name);
+    }
+}
+
+/**
+ * @brief Answer a query about every interface, or the one named, with the state published at the
+ * end of its last scan round, see query.h
+ *
+ * @param module DCS module
+ * @param args What followed the topic, the interface name or ""
+ * @param out Where to write the answer
+ * @param scores Whether to write the state of the scan and the score of each channel scanned,
+ *               rather than only the operating channel
+ */
+static void query_radios(struct dcs_module *module, const char *args, FILE *out, bool scores)
+{
+    bool found = false;
+
+    for (int i = 0; i < module->num_radios; i++)
+    {
+        struct dcs *context = module->radios[i];
+        const struct dcs_channel *channel;
+
+        if (args[0] && strcmp(args, context->if_name) != 0)
+            continue;
+        found = true;
+
+        MMSM_ASSERT(pthread_mutex_lock(&context->published.mutex) == 0);
+        channel = context->published.channel;
+        fprintf(out, "interface=%s", context->if_name);
+        if (channel)
+            fprintf(out, " channel=%u frequency_khz=%u bandwidth_mhz=%u",
+                    channel->ch.channel_s1g, channel->ch.frequency_khz,
+                    channel->ch.bandwidth_mhz);
+        if (scores)
+            fprintf(out, " rounds=%" PRIu64 " round_ms=%" PRIu64 " csas=%" PRIu64
+                    " csa_failures=%" PRIu64, context->published.rounds,
+                    context->published.round_ms, context->published.csas,
+                    context->published.csa_failures);
+        fputc('\n', out);
+
+        for (int j = 0; scores && context->published.scores && j < context->num_chans; j++)
+        {
+            const struct morse_cmd_channel_info *ch = &context->all_channels[j].ch;
+
+            if (!context->published.in_scan_list[j])
+                continue;
+
+            fprintf(out, "interface=%s scan_channel=%u frequency_khz=%u bandwidth_mhz=%u "
+                    "score=%u samples=%d\n", context->if_name, ch->channel_s1g,
+                    ch->frequency_khz, ch->bandwidth_mhz, context->published.scores[j],
+                    context->published.n_samples[j]);
+        }
+        MMSM_ASSERT(pthread_mutex_unlock(&context->published.mutex) == 0);
+    }
+
+    if (!found)
+        fprintf(out, "ERROR unknown interface %s\n", args);
+}
+
+/**
+ * @brief Answer a query of "channel", the operating channel of each interface, a line each as
+ * in the notifications of it changing
+ */
+static void dcs_query_channel(void *arg, const char *args, FILE *out)
+{
+    query_radios(arg, args, out, false);
+}
+
+/**
+ * @brief Answer a query of "dcs", the operating channel and scan rounds of each interface and
+ * the score of each channel it scanned
+ */
+static void dcs_query_scores(void *arg, const char *args, FILE *out)
+{
+    query_radios(arg, args, out, true);
+}
+
+/**
+ * @brief Take an interface's next measurement, evaluating its channels at the end of each scan
+ * round, and schedule the step after
+ *
+ * @param context DCS context object
+ */
+static void take_next_measurement(struct dcs *context)
+{
+    struct channel_measurement *meas;
+    struct dcs_channel *channel = context->scan.pending;
+    struct dcs_channel *candidate_chan;
+    bool switched = false;
+    bool switch_failed = false;
+
+    if (context->scan.new_round)
+    {
+        if (context->scan.scheduler_settings)
+            reconfigure_scheduler(context);
+
+        trace_record(TRACE_DCS, TRACE_DCS_SCAN, TRACE_DCS_ROUND_START,
+                     context->current_channel ? context->current_channel->ch.channel_s1g : 0, 0);
+        context->scan.new_round = false;
+        context->scan.round_start_ms = dcs_now_ms(context);
+        context->scan.pending = dcs_scheduler_ops_next_channel(context, NULL);
+    }
+    else
+    {
+        meas = get_channel_measurement(context, channel);
+        dcs_scheduler_ops_measurement_done(context, channel, meas);
+
+        if (meas)
+        {
+            /* Processed meanwhile, so the next measurement isn't held up by it */
+            queue_measurement(context, meas, channel);
+            pool_free(&context->measurement_pool, meas);
+
+            /* Get the next channel to scan */
+            context->scan.pending = dcs_scheduler_ops_next_channel(context, channel);
+            context->scan.attempts = 0;
+        }
+        else
+        {
+            context->scan.attempts++;
+            LOG_WARN("Measurement failed on channel %u (attempt %d)\n",
+                channel->ch.channel_s1g, context->scan.attempts);
+
+            if (context->scan.attempts >= MAX_CHANNEL_MEASURE_RETRIES) {
+                LOG_WARN("Removing channel %u from scan list\n", channel->ch.channel_s1g);
+
+                /* Continue to next channel and remove old channel */
+                context->scan.pending = dcs_scheduler_ops_next_channel(context, channel);
+                context->scan.attempts = 0;
+                dcs_scan_list_remove(context, channel);
+            }
+        }
+    }
+
+    if (context->scan.pending)
+    {
+        context->scan.next_ms = dcs_now_ms(context) +
+            timespec_to_ms(&context->config.sec_per_scan);
+        return;
+    }
+
+    /*
+     * Full scan round completed. Evaluate the current best one. Rounds the scheduler skips
+     * every channel in are evaluated too, as the operating channel may have been surveyed.
+     */
+
+    /* Make sure the algorithm has seen the whole round */
+    drain_measurements(context);
+
+    LOG_DEBUG("Evaluating channels on %s... \n", context->if_name);
+
+    candidate_chan = evaluate_channels(context);
+
+    if (candidate_chan && candidate_chan != context->current_channel)
+    {
+        if (!do_channel_switch(context, candidate_chan))
+        {
+            dcs_algo_ops_post_csa_hook(context, candidate_chan);
+            /* Unless switching is disabled */
+            switched = context->current_channel == candidate_chan;
+        }
+        else
+        {
+            switch_failed = true;
+        }
+    }
+
+    dcs_state_round_done(context);
+    publish_round(context, switched, switch_failed);
+
+    context->scan.new_round = true;
+    context->scan.next_ms = dcs_now_ms(context) + timespec_to_ms(&context->config.sec_per_round);
+}
+
+/**
+ * @brief Get ready to take an interface's measurements
+ *
+ * @param context DCS context object
+ * @param start_ms Time to start the first scan round, see @ref dcs_now_ms
+ */
+static void start_scanning(struct dcs *context, uint64_t start_ms)
+{
+    datalog_init_columns(context->datalog,
+        "time,frequency_khz,bandwidth_mhz,channel_s1g,metric,accumulated_score,"
+        "rounds_as_best_for_channel,current_channel", "tuuuuuuu");
+
+    /* The first round starts straight away */
+    context->scan.new_round = true;
+    context->scan.next_ms = start_ms;
+    context->survey.next_ms = start_ms + context->config.survey_interval_ms;
+}
+
+/**
+ * @brief Apply the config values that aren't the algorithm's or the scheduler's
+ *
+ * @param config libconfig struct
+ * @param dcs DCS context object
+ * @return 0 on success, else error code, in which case none are applied
+ */
+static int apply_configs(config_setting_t *config, struct dcs *dcs)
+{
+    int errors = 0;
+    bool csa_enabled;
+    int dtims_for_csa;
+    int survey_interval_ms;
+
+    /* Only disable if explicitly set to false, otherwise default to true */
+    csa_enabled = cfg_parse_bool_with_default(config, "trigger_csa", true);
+    dtims_for_csa = cfg_parse_int(config, "dtims_for_csa", &errors);
+    survey_interval_ms = cfg_parse_int_with_default(config, "survey_interval_ms", 0);
+    if (survey_interval_ms < 0)
+    {
+        LOG_ERROR("Survey interval must not be negative\n");
+        errors++;
+    }
+
+    if (errors)
+        return -EINVAL;
+
+    dcs->config.csa_enabled = csa_enabled;
+    dcs->config.dtims_for_csa = dtims_for_csa;
+    dcs->config.survey_interval_ms = survey_interval_ms;
+    return 0;
+}
+
+/**
+ * @brief Apply a reloaded config to an interface's DCS instance, see @ref dcs_reconfigure
+ *
+ * @param context DCS context object
+ * @param prev "dcs" config setting applied so far
+ * @param next "dcs" config setting to apply
+ */
+static void reconfigure_radio(struct dcs *context, config_setting_t *prev, config_setting_t *next)
+{
+    uint64_t sec_per_scan_ms = timespec_to_ms(&context->config.sec_per_scan);
+    uint64_t sec_per_round_ms = timespec_to_ms(&context->config.sec_per_round);
+    int survey_interval_ms = context->config.survey_interval_ms;
+    const char *algo_name = NULL;
+    int ret;
+
+    config_setting_lookup_string(next, "algo_type", &algo_name);
+
+    if (!cfg_setting_equal(config_setting_get_member(prev, "algo_type"),
+                           config_setting_get_member(next, "algo_type")))
+    {
+        LOG_WARN("algo_type can't be changed until restarted, keeping the algorithm on %s\n",
+                 context->if_name);
+    }
+    else if (algo_name && !cfg_setting_equal(config_setting_get_member(prev, algo_name),
+                                             config_setting_get_member(next, algo_name)))
+    {
+        /* Once the processing thread is idle, and kept so, as it uses the algorithm too */
+        MMSM_ASSERT(pthread_mutex_lock(&context->process.mutex) == 0);
+        while (!list_is_empty(&context->process.queue) || context->process.busy)
+            MMSM_ASSERT(pthread_cond_wait(&context->process.cond, &context->process.mutex) == 0);
+        ret = dcs_algo_reconfigure(context, next);
+        MMSM_ASSERT(pthread_mutex_unlock(&context->process.mutex) == 0);
+
+        if (ret)
+        {
+            LOG_ERROR("Failed to reconfigure the %s algorithm on %s - %d, keeping its previous "
+                      "settings\n", algo_name, context->if_name, ret);
+        }
+        else
+        {
+            LOG_INFO("Reconfigured the %s algorithm on %s\n", algo_name, context->if_name);
+
+            /* Have the measurement or round being waited for use the new time too */
+            if (context->scan.new_round)
+                context->scan.next_ms += timespec_to_ms(&context->config.sec_per_round) -
+                    sec_per_round_ms;
+            else
+                context->scan.next_ms += timespec_to_ms(&context->config.sec_per_scan) -
+                    sec_per_scan_ms;
+        }
+    }
+
+    /* Straight away if between rounds, as what it has planned for this one is lost */
+    context->scan.scheduler_settings = dcs_scheduler_settings_changed(context, next) ? next : NULL;
+    if (context->scan.scheduler_settings && context->scan.new_round)
+        reconfigure_scheduler(context);
+
+    if (apply_configs(next, context))
+    {
+        LOG_ERROR("Invalid DCS settings, keeping the previous ones on %s\n", context->if_name);
+    }
+    else if (context->config.survey_interval_ms != survey_interval_ms)
+    {
+        context->survey.next_ms = get_monotonic_ms() + context->config.survey_interval_ms;
+    }
+}
+
+/**
+ * @brief Apply the reloaded config waiting, if any, on the scan thread
+ *
+ * @param module DCS module
+ */
+static void apply_pending_config(struct dcs_module *module)
+{
+    static const char *const restart_settings[] = {
+        "interface_name", "backends", "dcs.interfaces", "dcs.test", "dcs.state",
+    };
+    config_t *config;
+    int cancel_state;
+
+    MMSM_ASSERT(pthread_mutex_lock(&module->reconfig.mutex) == 0);
+    config = module->reconfig.pending;
+    module->reconfig.pending = NULL;
+    MMSM_ASSERT(pthread_mutex_unlock(&module->reconfig.mutex) == 0);
+
+    if (!config)
+        return;
+
+    for (int i = 0; i < ARRAY_SIZE(restart_settings); i++)
+    {
+        if (!cfg_setting_equal(config_lookup(module->config, restart_settings[i]),
+                               config_lookup(config, restart_settings[i])))
+            LOG_WARN("DCS keeps its %s settings until restarted\n", restart_settings[i]);
     }
 
-    timestamp_get(&meas->sample_time);
-    meas->metric = ocs_done->metric;
-    meas->noise = ocs_done->noise;
-    meas->time_listen_us = ocs_done->time_listen;
-    meas->time_rx_us = ocs_done->time_rx;
+    /* Not stopped half way through swapping an algorithm */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    for (int i = 0; i < module->num_radios; i++)
+    {
+        reconfigure_radio(module->radios[i], config_lookup(module->config, "dcs"),
+                          config_lookup(config, "dcs"));
+    }
+    pthread_setcancelstate(cancel_state, NULL);
 
-exit:
-    /* Signal our scan has finished */
-    pthread_cond_signal(&context->scan.done);
-    MMSM_ASSERT(pthread_mutex_unlock(&context->scan.mutex) == 0);
+    module->config = config;
 }
 
 /**
  * @brief Thread function to trigger and evaluate channel measurements
  *
- * @param arg context variable
+ * Measurements of every interface are taken one at a time, earliest due first, so only one
+ * interface is ever off its operating channel.
+ *
+ * @param arg DCS module
  * @return void* ignored
  */
 static void *measurement_schedule_thread_fn(void *arg)
 {
-    struct dcs *context = (struct dcs *)arg;
-    struct channel_measurement *meas;
-    struct dcs_channel *channel = list_get_first_item(channel, &context->scan.list, list);
-    int attempt_count = 0;
+    struct dcs_module *module = (struct dcs_module *)arg;
+    /* Replay needs a single interface, so its clock is the only one */
+    uint64_t start_ms = dcs_now_ms(module->radios[0]);
 
-    datalog_init_csv(context->datalog,
-        "time,frequency_khz,bandwidth_mhz,channel_s1g,metric,accumulated_score,"
-        "rounds_as_best_for_channel,current_channel");
+    for (int i = 0; i < module->num_radios; i++)
+        start_scanning(module->radios[i], start_ms);
 
     while (1)
     {
-        /* Wait for scan period */
-        nanosleep(&context->config.sec_per_scan, NULL);
-
-        meas = get_channel_measurement(context, channel);
-
-        if (meas)
-        {
-            dcs_algo_ops_process_measurement(context, meas, channel);
-
-            LOG_DEBUG("Measurement done (ch %u) - listen time: %"PRIu64", rx time: %"PRIu64", "
-                        "noise: %d, metric: %u, accumulated score: %u\n",
-                    channel->ch.channel_s1g, meas->time_listen_us, meas->time_rx_us, meas->noise,
-                    meas->metric, channel->metric.accumulated_score);
-
-            datalog_write_csv(context->datalog, "tuuuuuuu", &meas->sample_time,
-                channel->ch.frequency_khz, channel->ch.bandwidth_mhz, channel->ch.channel_s1g,
-                meas->metric, channel->metric.accumulated_score,
-                channel->metric.rounds_as_best,
-                context->current_channel->ch.channel_s1g);
+        struct dcs *next = module->radios[0];
 
-            /* Free the measurement */
-            free(meas);
+        apply_pending_config(module);
 
-            /* Get the next channel to scan */
-            channel = list_get_next_item_or_null(channel, &context->scan.list, list);
-            attempt_count = 0;
-        }
-        else
+        for (int i = 1; i < module->num_radios; i++)
         {
-            attempt_count++;
-            LOG_WARN("Measurement failed on channel %u (attempt %d)\n",
-                channel->ch.channel_s1g, attempt_count);
-
-            if (attempt_count >= MAX_CHANNEL_MEASURE_RETRIES) {
-                LOG_WARN("Removing channel %u from scan list\n", channel->ch.channel_s1g);
-                struct dcs_channel *failing_channel = channel;
-
-                /* Continue to next channel and remove old channel */
-                channel = list_get_next_item_or_null(channel, &context->scan.list, list);
-                attempt_count = 0;
-                list_remove(&failing_channel->list);
-            }
+            if (module->radios[i]->scan.next_ms < next->scan.next_ms)
+                next = module->radios[i];
         }
 
-        /* Full scan round completed. Evaluate the current best one. */
-        if (channel == NULL)
-        {
-            struct dcs_channel *candidate_chan;
-
-            LOG_DEBUG("Evaluating channels... \n");
-
-            candidate_chan = dcs_algo_ops_evaluate_channels(context);
-
-            if (candidate_chan && candidate_chan != context->current_channel)
-            {
-                if (!do_channel_switch(context, candidate_chan))
-                {
-                    dcs_algo_ops_post_csa_hook(context, candidate_chan);
-                }
-            }
-
-            nanosleep(&context->config.sec_per_round, NULL);
-            channel = list_get_first_item(channel, &context->scan.list, list);
-        }
+        /* Wait for scan period, picking again if reconfigured meanwhile */
+        if (wait_between_measurements(module, next->scan.next_ms))
+            take_next_measurement(next);
     }
     return NULL;
 }
 
 /**
- * @brief Initialise the thread responsible for scheduling and evaluating the channel measurements
+ * @brief Initialise the thread responsible for processing an interface's measurements
  *
  * @param context DCS context object
  */
-static void init_scan_thread(struct dcs *context)
+static void init_process_thread(struct dcs *context)
 {
     MMSM_ASSERT(context != NULL);
     MMSM_ASSERT(!list_is_empty(&context->scan.list));
 
-    pthread_mutex_init(&context->scan.mutex, NULL);
-    pthread_cond_init(&context->scan.done, NULL);
+    pthread_mutex_init(&context->scan.slot.mutex, NULL);
+    pthread_cond_init(&context->scan.slot.done, NULL);
 
+    pthread_mutex_init(&context->process.mutex, NULL);
+    pthread_cond_init(&context->process.cond, NULL);
+    list_reset(&context->process.queue);
+    pool_init(&context->measurement_pool, "dcs_measurement",
+              sizeof(struct channel_measurement), 4);
+    pool_init(&context->queued_pool, "dcs_queued_measurement",
+              sizeof(struct queued_measurement), 4);
     MMSM_ASSERT(pthread_create(
-            &context->scan.thread,
+            &context->process.thread,
             NULL,
-            measurement_schedule_thread_fn,
+            measurement_process_thread_fn,
             context) == 0);
-
-    if (!context->test.enabled)
-    {
-        mmsm_monitor_pattern(context->nl80211_intf, "", measurement_done_callback, context,
-                NL80211_CMD_VENDOR, 0, -1);
-    }
+    context->process.started = true;
 }
 
 /**
@@ -897,7 +2165,6 @@ static void init_scan_thread(struct dcs *context)
  */
 static int apply_configs_and_init_algo(config_setting_t *config, struct dcs *dcs)
 {
-    int errors = 0;
     int ret;
 
     MMSM_ASSERT(config != NULL);
@@ -911,29 +2178,109 @@ static int apply_configs_and_init_algo(config_setting_t *config, struct dcs *dcs
         return -EINVAL;
     }
 
-    /* Only disable if explicitly set to false, otherwise default to true */
-    dcs->config.csa_enabled = cfg_parse_bool_with_default(config, "trigger_csa", true);
-    dcs->config.dtims_for_csa = cfg_parse_int(config, "dtims_for_csa", &errors);
+    ret = dcs_scheduler_initialise(dcs, config);
+
+    if (ret)
+    {
+        LOG_ERROR("Failed to initalise scan scheduler - %d\n", ret);
+        dcs_scheduler_deinitialise(dcs);
+        dcs_algo_deinitialise(dcs);
+        return -EINVAL;
+    }
+
+    return apply_configs(config, dcs);
+}
+
+/**
+ * @brief Destroy the DCS instance of an interface
+ *
+ * The scan thread must have been stopped. The shared nl80211 backend is left to the module.
+ *
+ * @param context DCS context to destroy
+ */
+static void dcs_radio_destroy(struct dcs *context)
+{
+    if (!context)
+        return;
+
+    if (context->process.started)
+    {
+        struct queued_measurement *queued;
+
+        MMSM_ASSERT(pthread_mutex_lock(&context->process.mutex) == 0);
+        context->process.stopping = true;
+        MMSM_ASSERT(pthread_cond_broadcast(&context->process.cond) == 0);
+        MMSM_ASSERT(pthread_mutex_unlock(&context->process.mutex) == 0);
+        pthread_join(context->process.thread, NULL);
+
+        while (!list_is_empty(&context->process.queue))
+        {
+            queued = list_get_first_item(queued, &context->process.queue, list);
+            list_remove(&queued->list);
+            pool_free(&context->queued_pool, queued);
+        }
+        pool_deinit(&context->queued_pool);
+        pool_deinit(&context->measurement_pool);
+
+        /* Monitors were registered alongside the process thread, unless replaying standalone */
+        if (context->nl80211_intf)
+        {
+            mmsm_monitor_pattern_remove(context->nl80211_intf, ecsa_done_callback, context);
+            mmsm_monitor_pattern_remove(context->nl80211_intf, events_lost_callback, context);
+            mmsm_monitor_pattern_remove(context->hostapd_intf, hostapd_channel_switch_callback,
+                                        context);
+            mmsm_monitor_pattern_remove(context->hostapd_intf, csa_finished_callback, context);
+        }
 
-    return errors ? -EINVAL : 0;
+        dcs_state_close(context);
+        dcs_scheduler_deinitialise(context);
+        dcs_algo_deinitialise(context);
+    }
+
+    if (context->test.enabled)
+    {
+        LOG_INFO("freeing samples\n");
+        dcs_test_free_all_samples(context);
+    }
+
+    mmsm_backend_put(context->hostapd_intf);
+    mmsm_backend_put(context->mctrl_intf);
+
+    datalog_close(context->datalog);
+
+    if (context->all_channels)
+        free(context->all_channels);
+    free(context->index.by_freq);
+    free_channel_metrics(&context->metrics);
+    free(context->published.scores);
+    free(context->published.n_samples);
+    free(context->published.in_scan_list);
+
+    free(context);
 }
 
-struct dcs *dcs_create(config_t *config)
+/**
+ * @brief Create the DCS instance of an interface
+ *
+ * @param module DCS module, whose nl80211 backend the instance shares
+ * @param config config object
+ * @param if_name Name of the interface
+ * @param hostapd_settings Settings of the hostapd backend, giving the interface's control socket
+ * @return Initialised DCS context structure, or NULL on failure
+ */
+static struct dcs *dcs_radio_create(struct dcs_module *module, config_t *config,
+    const char *if_name, config_setting_t *hostapd_settings)
 {
     int ret;
     struct dcs *context;
     char buff[128];
-    const char *if_name;
-    const char *hostapd_ctrl_path;
     int errors = 0;
-    config_setting_t *cfg_root = config_root_setting(config);
     config_setting_t *test_settings;
-    config_setting_t *hostapd_settings;
     config_setting_t *dcs_settings;
 
     context = calloc(1, sizeof(*context));
 
-    LOG_INFO_ALWAYS("Initialising DCS\n");
+    LOG_INFO_ALWAYS("Initialising DCS on %s\n", if_name);
 
     if (!context)
     {
@@ -941,48 +2288,33 @@ struct dcs *dcs_create(config_t *config)
         return NULL;
     }
 
-    if (!cfg_root)
-    {
-        LOG_ERROR("Can't find config root\n");
-        goto err;
-    }
-
-    if_name = cfg_parse_string(cfg_root, "interface_name", &errors);
-
-    hostapd_settings = config_lookup(config, "backends.hostapd");
-    if (!hostapd_settings)
-    {
-        LOG_ERROR("Cant find settings for hostapd backend\n");
-        goto err;
-    }
-    hostapd_ctrl_path = cfg_parse_string(hostapd_settings, "control_path", &errors);
-
-    if (errors)
-    {
+    snprintf(context->if_name, sizeof(context->if_name), "%s", if_name);
+    /* Published to from the start, by learning the operating channel */
+    pthread_mutex_init(&context->published.mutex, NULL);
+    if (cfg_hostapd_control_sock(hostapd_settings, if_name, buff, sizeof(buff)))
         goto err;
-    }
 
-    snprintf(buff, sizeof(buff), "%s/%s", hostapd_ctrl_path, if_name);
+    context->if_index = if_nametoindex(if_name);
+    context->nl80211_intf = module->nl80211_intf;
 
-    context->mctrl_intf = mmsm_backend_morsectrl_create(if_name);
+    context->mctrl_intf = mmsm_backend_get_morsectrl(if_name);
     if (context->mctrl_intf == NULL)
     {
         LOG_ERROR("Failed to initialise morsectrl backend\n");
         goto err;
     }
 
-    context->nl80211_intf = mmsm_backend_nl80211_create();
-    if (context->nl80211_intf == NULL)
+    context->hostapd_intf = mmsm_backend_get_hostapd(buff);
+    if (context->hostapd_intf == NULL)
     {
-        LOG_ERROR("Failed to initialise nl80211 backend\n");
+        LOG_ERROR("Failed to initialise hostapd backend\n");
         goto err;
     }
 
-    context->hostapd_intf = mmsm_backend_hostapd_ctrl_create(buff);
-    if (context->hostapd_intf == NULL)
+    if (mmsm_request_cache_command(context->hostapd_intf, HOSTAPD_STATUS_CACHE_TTL_MS,
+                                   "STATUS") != MMSM_SUCCESS)
     {
-        LOG_ERROR("Failed to initialise hostapd backend\n");
-        goto err;
+        LOG_WARN("Failed to register STATUS for caching\n");
     }
 
     test_settings = config_lookup(config, "dcs.test");
@@ -993,6 +2325,9 @@ struct dcs *dcs_create(config_t *config)
         if (context->test.enabled)
         {
             context->test.samples_filepath = cfg_parse_string(test_settings, "filepath", &errors);
+            if (errors)
+                goto err;
+            context->test.replay = cfg_parse_bool_with_default(test_settings, "replay", false);
         }
     }
     else
@@ -1029,9 +2364,21 @@ struct dcs *dcs_create(config_t *config)
         goto err;
     }
 
-    context->datalog = datalog_create("dcs");
+    ret = dcs_state_open(context, dcs_settings, module->num_radios > 1 ? if_name : NULL);
+    if (ret)
+    {
+        LOG_ERROR("Failed to open persistent state - %d\n", ret);
+        dcs_scheduler_deinitialise(context);
+        dcs_algo_deinitialise(context);
+        goto err;
+    }
+
+    if (module->num_radios > 1)
+        context->datalog = datalog_create_instance("dcs", if_name);
+    else
+        context->datalog = datalog_create("dcs");
 
-    init_scan_thread(context);
+    init_process_thread(context);
 
     /* CSA in progress condition */
     pthread_mutex_init(&context->csa.mutex, NULL);
@@ -1039,46 +2386,284 @@ struct dcs *dcs_create(config_t *config)
 
     /* Start a monitor to detect when the CSA completes */
     mmsm_monitor_pattern(context->nl80211_intf, "",
-            ecsa_done_callback, context, NL80211_CMD_CH_SWITCH_NOTIFY, 0, -1);
+            ecsa_done_callback, context, NL80211_CMD_CH_SWITCH_NOTIFY, 0,
+            NL80211_ATTR_IFINDEX, NLA_U32, context->if_index, -1);
+
+    /* Resync if notifications such as the CSA completing are lost */
+    mmsm_monitor_pattern(context->nl80211_intf, "",
+            events_lost_callback, context, MMSM_BACKEND_NL80211_EVENTS_LOST, 0, -1);
+
+    /* Hostapd reports switches once its STATUS is up to date, so it needn't be polled */
+    mmsm_monitor_pattern(context->hostapd_intf, "",
+            hostapd_channel_switch_callback, context, "CTRL-EVENT-CHANNEL-SWITCH");
+    mmsm_monitor_pattern(context->hostapd_intf, "",
+            csa_finished_callback, context, "AP-CSA-FINISHED");
 
     return context;
 
 err:
-    mmsm_backend_morsectrl_destroy(context->mctrl_intf);
-    mmsm_backend_nl80211_destroy(context->nl80211_intf);
-    mmsm_backend_hostapd_ctrl_destroy(context->hostapd_intf);
-    free(context);
+    dcs_radio_destroy(context);
+    return NULL;
+}
+
+/**
+ * @brief Get the name of one of the interfaces DCS runs on
+ *
+ * @param config config object
+ * @param interfaces "dcs.interfaces" list, or NULL to use "interface_name"
+ * @param i Index into interfaces
+ * @return the interface name, or NULL if it isn't set
+ */
+static const char *get_interface_name(config_t *config, config_setting_t *interfaces, int i)
+{
+    int errors = 0;
+
+    if (interfaces)
+        return config_setting_get_string_elem(interfaces, i);
+
+    return cfg_parse_string(config_root_setting(config), "interface_name", &errors);
+}
+
+/**
+ * @brief Initialise what a reloaded config is handed to the scan thread with
+ *
+ * @param module DCS module
+ */
+static void init_reconfig(struct dcs_module *module)
+{
+    pthread_condattr_t attr;
+
+    /* Sleeps until a time on the monotonic clock, see @ref sleep_until */
+    MMSM_ASSERT(pthread_condattr_init(&attr) == 0);
+    MMSM_ASSERT(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+    MMSM_ASSERT(pthread_cond_init(&module->reconfig.wake, &attr) == 0);
+    MMSM_ASSERT(pthread_condattr_destroy(&attr) == 0);
+    MMSM_ASSERT(pthread_mutex_init(&module->reconfig.mutex, NULL) == 0);
+}
+
+struct dcs_module *dcs_create(config_t *config)
+{
+    struct dcs_module *module;
+    const char *if_name;
+    int num_interfaces = 1;
+    config_setting_t *interfaces;
+    config_setting_t *hostapd_settings;
+    config_setting_t *nl80211_settings;
+
+    LOG_INFO_ALWAYS("Initialising DCS\n");
+
+    if (!config_root_setting(config))
+    {
+        LOG_ERROR("Can't find config root\n");
+        return NULL;
+    }
+
+    interfaces = config_lookup(config, "dcs.interfaces");
+    if (interfaces)
+    {
+        num_interfaces = config_setting_length(interfaces);
+        if (!config_setting_is_array(interfaces) || num_interfaces == 0)
+        {
+            LOG_ERROR("DCS interfaces must be a non-empty array of interface names\n");
+            return NULL;
+        }
+    }
+
+    if (num_interfaces > 1 &&
+        cfg_parse_bool_with_default(config_lookup(config, "dcs.test"), "enabled", false))
+    {
+        LOG_ERROR("Test mode is only supported on a single interface\n");
+        return NULL;
+    }
+
+    hostapd_settings = config_lookup(config, "backends.hostapd");
+    if (!hostapd_settings)
+    {
+        LOG_ERROR("Cant find settings for hostapd backend\n");
+        return NULL;
+    }
+
+    module = calloc(1, sizeof(*module));
+    if (module)
+        module->radios = calloc(num_interfaces, sizeof(*module->radios));
+
+    if (!module || !module->radios)
+    {
+        LOG_ERROR("Failed to allocate DCS module\n");
+        free(module);
+        return NULL;
+    }
+
+    module->config = config;
+    init_reconfig(module);
+
+    /* One nl80211 backend, and so one notification socket, serves every interface and module */
+    module->nl80211_intf = mmsm_backend_get("nl80211");
+    if (module->nl80211_intf == NULL)
+    {
+        LOG_ERROR("Failed to initialise nl80211 backend\n");
+        goto err;
+    }
+
+    nl80211_settings = config_lookup(config, "backends.nl80211");
+    if (nl80211_settings)
+    {
+        mmsm_backend_nl80211_set_rx_buffers(module->nl80211_intf,
+            cfg_parse_int_with_default(nl80211_settings, "monitor_rx_buffer", 0),
+            cfg_parse_int_with_default(nl80211_settings, "request_rx_buffer", 0));
+    }
+
+    /* Set before creating the instances, which name their datalogs by it */
+    module->num_radios = num_interfaces;
+
+    for (int i = 0; i < num_interfaces; i++)
+    {
+        if_name = get_interface_name(config, interfaces, i);
+        if (!if_name)
+        {
+            LOG_ERROR("Invalid DCS interface name\n");
+            goto err;
+        }
+
+        module->radios[i] = dcs_radio_create(module, config, if_name, hostapd_settings);
+        if (!module->radios[i])
+            goto err;
+    }
+
+    MMSM_ASSERT(pthread_create(
+            &module->scan_thread,
+            NULL,
+            measurement_schedule_thread_fn,
+            module) == 0);
+    module->scan_started = true;
+
+    if (metrics_register(dcs_write_metrics, module))
+        LOG_WARN("Failed to register the DCS metrics\n");
+    if (query_register("channel", dcs_query_channel, module) ||
+        query_register("dcs", dcs_query_scores, module))
+        LOG_WARN("Failed to register the DCS queries\n");
+
+    return module;
+
+err:
+    dcs_destroy(module);
     return NULL;
 }
 
-void dcs_destroy(struct dcs *context)
+int dcs_replay(config_t *config, struct dcs_replay_stats *stats)
 {
+    struct dcs *context;
+    config_setting_t *dcs_settings;
+    int errors = 0;
+    int ret;
+
+    dcs_settings = config_lookup(config, "dcs");
+    if (!dcs_settings)
+    {
+        LOG_ERROR("Could not find DCS settings\n");
+        return -EINVAL;
+    }
+
+    context = calloc(1, sizeof(*context));
     if (!context)
-        return;
+    {
+        LOG_ERROR("Failed to allocate DCS context\n");
+        return -ENOMEM;
+    }
 
-    pthread_cancel(context->scan.thread);
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_init(&context->published.mutex, NULL);
+    snprintf(context->if_name, sizeof(context->if_name), "replay");
+    context->test.enabled = true;
+    context->test.replay = true;
+    context->test.stats = stats;
+    context->test.samples_filepath = cfg_parse_string(config_lookup(config, "dcs.test"),
+        "filepath", &errors);
+    if (errors)
+    {
+        ret = -EINVAL;
+        goto exit;
+    }
 
-    /* wait for the thread to stop */
-    pthread_join(context->scan.thread, NULL);
+    ret = initialise_channels(context);
+    if (ret)
+    {
+        LOG_ERROR("Failed to initialise channels - %d\n", ret);
+        goto exit;
+    }
 
-    if (context->test.enabled)
+    ret = apply_configs_and_init_algo(dcs_settings, context);
+    if (ret)
     {
-        LOG_INFO("freeing samples\n");
-        dcs_test_free_all_samples(context);
+        LOG_ERROR("Failed to apply configs - %d\n", ret);
+        goto exit;
     }
 
-    dcs_algo_deinitialise(context);
+    init_process_thread(context);
+    pthread_mutex_init(&context->csa.mutex, NULL);
+    pthread_cond_init(&context->csa.done, NULL);
 
-    mmsm_backend_hostapd_ctrl_destroy(context->hostapd_intf);
-    mmsm_backend_nl80211_destroy(context->nl80211_intf);
-    mmsm_backend_morsectrl_destroy(context->mctrl_intf);
+    start_scanning(context, dcs_now_ms(context));
+    while (!context->test.finished)
+    {
+        context->test.clock_ms = MAX(context->test.clock_ms, context->scan.next_ms);
+        take_next_measurement(context);
+    }
+    finish_replay(context);
 
-    datalog_close(context->datalog);
+    stats->replayed_ms = context->test.clock_ms - context->test.replay_started_clock_ms;
 
-    if (context->all_channels)
-        free(context->all_channels);
+exit:
+    dcs_radio_destroy(context);
+    return ret;
+}
 
-    free(context);
+void dcs_destroy(struct dcs_module *module)
+{
+    if (!module)
+        return;
+
+    metrics_unregister(dcs_write_metrics, module);
+    query_unregister("channel", dcs_query_channel, module);
+    query_unregister("dcs", dcs_query_scores, module);
+
+    if (module->scan_started)
+    {
+        pthread_cancel(module->scan_thread);
+
+        /* wait for the thread to stop */
+        pthread_join(module->scan_thread, NULL);
+    }
+
+    for (int i = 0; i < module->num_radios; i++)
+        dcs_radio_destroy(module->radios[i]);
+
+    /* Only once nothing is monitoring or requesting on it */
+    mmsm_backend_put(module->nl80211_intf);
+
+    MMSM_ASSERT(pthread_cond_destroy(&module->reconfig.wake) == 0);
+    MMSM_ASSERT(pthread_mutex_destroy(&module->reconfig.mutex) == 0);
+    free(module->radios);
+    free(module);
+}
+
+int dcs_reconfigure(struct dcs_module *module, config_t *config)
+{
+    if (!module || !module->scan_started)
+        return -EINVAL;
+
+    if (module->radios[0]->test.replay)
+    {
+        LOG_WARN("DCS can't be reconfigured while replaying test samples\n");
+        return -EBUSY;
+    }
+
+    MMSM_ASSERT(pthread_mutex_lock(&module->reconfig.mutex) == 0);
+    module->reconfig.pending = config;
+    MMSM_ASSERT(pthread_cond_signal(&module->reconfig.wake) == 0);
+    MMSM_ASSERT(pthread_mutex_unlock(&module->reconfig.mutex) == 0);
+
+    return 0;
 }
 
 const char * dcs_get_version(void)
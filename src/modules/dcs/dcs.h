@@ -7,13 +7,30 @@
 
 #include <errno.h>
 #include <libconfig.h>
+#include <net/if.h>
 #include <pthread.h>
 
 #include "backend/backend.h"
 #include "smart_manager.h"
 #include "backend/morsectrl/command.h"
 #include "list.h"
+#include "pool.h"
 #include "timestamp.h"
+#include "datalog.h"
+
+/**
+ * @brief Where a channel measurement came from
+ */
+enum channel_measurement_source
+{
+    /** An off-channel scan on the chip (MORSE_CMD_ID_OCS_DRIVER), or a test sample */
+    CHANNEL_MEASUREMENT_SOURCE_OCS = 0,
+    /**
+     * The operating channel's survey (NL80211_CMD_GET_SURVEY), read between off-channel scans.
+     * Much cheaper and more frequent, so algorithms may prefer to weight these differently.
+     */
+    CHANNEL_MEASUREMENT_SOURCE_SURVEY,
+};
 
 /**
  * @brief A single instance of a channel measurement. Captures the instantaneous quality of a
@@ -33,20 +50,26 @@ struct channel_measurement
     uint64_t time_listen_us;
     /** Time in RX in us*/
     uint64_t time_rx_us;
+    /** Where the measurement came from */
+    enum channel_measurement_source source;
 };
 
 /**
- * @brief Per channel accumulated metric. Stores the information over time which defines the quality
- * of a channel
+ * @brief Per channel accumulated metrics, which define the quality of each channel over time.
+ *
+ * Each is an array indexed by the channel's slot in @ref dcs::all_channels (see
+ * @ref dcs_channel_slot), so evaluating every channel is a loop over contiguous memory.
  */
-struct channel_metric
+struct channel_metrics
 {
     /** Accumulated score for the channel */
-    uint32_t accumulated_score;
+    uint32_t *accumulated_score;
     /** Total number of samples taken so far */
-    int n_samples;
+    int *n_samples;
     /** Number of scan rounds this channel has been considered the best */
-    int rounds_as_best;
+    int *rounds_as_best;
+    /** Non-zero if the channel is in @ref dcs::scan list */
+    uint8_t *in_scan_list;
 };
 
 /**
@@ -58,10 +81,10 @@ struct dcs_channel
     list_entry_t list;
     /** Parameters of the channel (freq, bw etc.) */
     struct morse_cmd_channel_info ch;
-    /** Current channel metric. Defines the quality of the channel over time*/
-    struct channel_metric metric;
 };
 
+struct dcs_state;
+
 /** DCS context structure */
 struct dcs
 {
@@ -77,6 +100,15 @@ struct dcs
     uint8_t num_chans;
     /** Array of all available channels for current country code */
     struct dcs_channel *all_channels;
+    /** Metrics of each of @ref all_channels */
+    struct channel_metrics metrics;
+    /** Lookup index of @ref all_channels, see @ref dcs_init_channel_tables */
+    struct {
+        /** @ref all_channels sorted by frequency, then bandwidth */
+        struct dcs_channel **by_freq;
+        /** @ref all_channels by S1G channel number, NULL where there is no such channel */
+        struct dcs_channel *by_s1g[UINT8_MAX + 1];
+    } index;
     /** Points to the current operating channel*/
     struct dcs_channel *current_channel;
     /** Primary channel width */
@@ -85,6 +117,10 @@ struct dcs
     int current_prim_1mhz_ch_index;
     /** Current 5g frequency, used to validate CSA. This is required until we get S1G Linux */
     uint32_t current_5g_freq;
+    /** Name of the interface */
+    char if_name[IF_NAMESIZE];
+    /** Index of the interface, for nl80211 requests */
+    unsigned int if_index;
     /** AP DTIM period */
     uint8_t dtim_period;
     /**
@@ -99,24 +135,104 @@ struct dcs
         list_head_t list;
         /** Current channel being scanned */
         struct dcs_channel *channel;
-        /** Scan thread reference */
-        pthread_t thread;
-        /** Mutex used to syncronise the scan thread and measurement done callback */
-        pthread_mutex_t mutex;
-        /** Condition used to syncronise the scan thread and measurement done callback */
-        pthread_cond_t done;
+        /** Next channel to scan, or NULL once the round has been scanned */
+        struct dcs_channel *pending;
+        /** Set when the next step starts a scan round, rather than measuring @ref pending */
+        bool new_round;
+        /** Failed attempts in a row to measure @ref pending */
+        int attempts;
+        /** When the next measurement is due, on the monotonic clock in ms */
+        uint64_t next_ms;
+        /** When the scan round in progress started, see @ref dcs_now_ms */
+        uint64_t round_start_ms;
         /**
-         * Internal result pointer used to pass the scan result back
-         * If NULL, no scan is in progress
+         * Where the measurement done callback publishes the result of an off-channel scan, for
+         * the scan thread to claim. The mutex is only held to do either, never across a request.
          */
-        struct channel_measurement *result;
+        struct {
+            /** Mutex used to syncronise the scan thread and measurement done callback */
+            pthread_mutex_t mutex;
+            /** Condition used to syncronise the scan thread and measurement done callback */
+            pthread_cond_t done;
+            /** Set by the measurement done callback once the scan request has completed */
+            bool completed;
+            /** Set along with @ref completed if the scan succeeded, with its result in meas */
+            bool succeeded;
+            /** Set along with @ref completed if the scan timed out, so its event may yet arrive */
+            bool timed_out;
+            struct channel_measurement meas;
+        } slot;
+        /** The off-channel scan request in progress, only used by the scan thread */
+        mmsm_morsectrl_async_t *request;
+        /**
+         * Number of OCS done events owed to scans that timed out, which the next events to
+         * arrive are dropped as, see is_ocs_done_for_request(). Protected by slot.mutex, as are
+         * the fields below.
+         */
+        unsigned int stale_events;
+        /** get_timestamp_ms() time after which the events owed are taken as lost */
+        uint64_t stale_deadline_ms;
+        /** Set if an event was dropped as owed while the current scan waited */
+        bool stale_dropped;
+        /**
+         * Average time off-channel scans have taken to complete, in ms, which their timeout is
+         * based on, or 0 until one has completed
+         */
+        uint32_t latency_ms;
+        /**
+         * "dcs" config setting to reconfigure the scheduler from at the start of the next scan
+         * round, see @ref dcs_reconfigure, or NULL
+         */
+        config_setting_t *scheduler_settings;
     } scan;
 
+    /**
+     * Measurements waiting to be passed to the algorithm and written to the datalog, which is
+     * done on a thread of its own so the scan thread can schedule the next measurement straight
+     * away
+     */
+    struct {
+        /** Processing thread reference */
+        pthread_t thread;
+        /** Protects the fields below */
+        pthread_mutex_t mutex;
+        /** Signalled when a measurement is queued, and when the queue has drained */
+        pthread_cond_t cond;
+        /** Queued measurements, oldest first */
+        list_head_t queue;
+        /** Set while a measurement is being processed */
+        bool busy;
+        /** Set to stop the processing thread */
+        bool stopping;
+        /** Whether the processing thread was started */
+        bool started;
+    } process;
+
+    /**
+     * Where the measurements taken, and the copies queued for processing, are allocated from,
+     * set up with the processing thread
+     */
+    pool_t measurement_pool;
+    pool_t queued_pool;
+
     struct {
         struct algo_ops *ops;
         void *context;
+        /** Extension the algorithm was loaded from, NULL if built in */
+        void *plugin;
     } algo;
 
+    /** Scan scheduler, which picks the channels measured in each scan round */
+    struct {
+        struct scheduler_ops *ops;
+        void *context;
+        /** The "dcs" config setting it was initialised from */
+        config_setting_t *settings;
+    } scheduler;
+
+    /** State persisted across restarts, see state.h, or NULL if it isn't */
+    struct dcs_state *state;
+
     struct {
         /** Mutex used to syncronise the channel switch and its callback */
         pthread_mutex_t mutex;
@@ -124,6 +240,10 @@ struct dcs
         pthread_cond_t done;
         /** Flag if CSA is in progress */
         bool in_progress;
+        /** Set once the kernel reports the switch, with NL80211_CMD_CH_SWITCH_NOTIFY */
+        bool kernel_switched;
+        /** Set once hostapd reports the switch finished, after which STATUS reports it */
+        bool hostapd_switched;
         /** 5g frequency of the switched to channel */
         uint32_t freq_5g;
     } csa;
@@ -138,33 +258,265 @@ struct dcs
         int dtims_for_csa;
         /** Trigger a CSA if we find a better channel */
         bool csa_enabled;
+        /**
+         * Milliseconds between survey measurements of the operating channel while waiting
+         * between off-channel scans, or 0 to only use off-channel scans
+         */
+        int survey_interval_ms;
     } config;
 
+    /**
+     * What the metrics and query endpoints report, copied out by the scan thread at the end of
+     * each scan round so scrapes never read the algorithm's state while it is being updated
+     */
+    struct {
+        /** Protects the fields below */
+        pthread_mutex_t mutex;
+        /** Operating channel, or NULL if unknown. Updated as soon as it is learned. */
+        const struct dcs_channel *channel;
+        /** Number of scan rounds completed */
+        uint64_t rounds;
+        /** How long the last scan round took, in ms */
+        uint64_t round_ms;
+        /** Channel switches completed, and failed */
+        uint64_t csas;
+        uint64_t csa_failures;
+        /**
+         * Accumulated score and number of samples of each of @ref all_channels, indexed alike,
+         * allocated on first use, or NULL
+         */
+        uint32_t *scores;
+        int *n_samples;
+        /** Non-zero if the channel was in @ref dcs::scan list */
+        uint8_t *in_scan_list;
+    } published;
+
+    /** Survey counters of the operating channel at the last survey measurement */
+    struct {
+        /** Whether the counters below have been read */
+        bool valid;
+        /** Frequency of the channel the counters are for */
+        uint32_t freq;
+        /** Time the radio was on the channel, and busy, receiving or transmitting on it, in ms */
+        uint64_t time_ms;
+        uint64_t busy_ms;
+        uint64_t rx_ms;
+        uint64_t tx_ms;
+        /** When the next survey measurement is due, on the monotonic clock in ms */
+        uint64_t next_ms;
+    } survey;
+
     /** Test mode parameters */
     struct {
         /** Test mode is enabled */
         bool enabled;
-        /** The path to the CSV file containing the channel measurement samples to use */
+        /** The path to the CSV or binary file containing the channel measurement samples to use */
         const char *samples_filepath;
         /**
-         * List of frequencies, containing lists of samples for each frequency.
-         * See dcs_test.c for more info
+         * Replay the samples on a virtual clock rather than in real time, never waiting between
+         * measurements, and complete channel switches straight away without hostapd
          */
-        list_head_t per_ch_sample_list;
+        bool replay;
+        /** Virtual time while replaying, in ms since the epoch, see @ref dcs_now_ms */
+        uint64_t clock_ms;
+        /** Set once every sample has been replayed */
+        bool finished;
+        /** Virtual and real time the replay started, in ms since the epoch */
+        uint64_t replay_started_clock_ms;
+        uint64_t replay_started_ms;
+        /** The samples file, mapped read only. See dcs_test.c for more info */
+        const char *map;
+        /** Length of @ref map */
+        size_t map_len;
+        /** The samples file read as a binary datalog, or with no records if it is CSV */
+        struct datalog_binary binary;
+        /**
+         * Line of @ref map holding the next sample of each of @ref all_channels, indexed alike,
+         * or NULL once the channel has no samples left
+         */
+        const char **next_sample;
+        /**
+         * For a binary samples file, the time of the record before each of @ref next_sample,
+         * which its time is relative to, in ms since the epoch
+         */
+        uint64_t *next_sample_ms;
+        /** Number of channels with samples left */
+        int channels_left;
+        /**
+         * Metric of the latest sample replayed of each of @ref all_channels, indexed alike, or -1
+         * if there hasn't been one yet
+         */
+        int16_t *latest_metric;
+        /** Where to count the outcome of the replay, or NULL. See @ref dcs_replay */
+        struct dcs_replay_stats *stats;
+        /** Virtual time up to which @ref stats has been counted */
+        uint64_t stats_clock_ms;
     } test;
 };
 
 /**
- * @brief Create a Dynamic Channel Selection instance
+ * Outcome of replaying a samples file with @ref dcs_replay, to compare algorithms offline.
+ *
+ * The best channel at any time is the one whose latest sample has the highest metric. Time is
+ * counted on the virtual clock, once the operating channel has had a sample.
+ */
+struct dcs_replay_stats
+{
+    /** Virtual time covered by the replay, in ms */
+    uint64_t replayed_ms;
+    /** Number of times the channels were evaluated, ie. scan rounds */
+    uint32_t evaluations;
+    /** Number of channel switches */
+    uint32_t csas;
+    /** Time counted, which the other times and metric_ms are out of, in ms */
+    uint64_t scored_ms;
+    /** Time spent on a channel with a lower metric than the best channel, in ms */
+    uint64_t suboptimal_ms;
+    /** Metric of the operating channel integrated over the time counted, in metric x ms */
+    uint64_t metric_ms;
+    /** CPU time spent evaluating the channels, in ns */
+    uint64_t evaluate_cpu_ns;
+};
+
+/**
+ * DCS module, running DCS on each of its interfaces from a single scan thread and nl80211
+ * backend
+ */
+struct dcs_module
+{
+    /** nl80211 backend shared by all interfaces */
+    mmsm_backend_intf_t *nl80211_intf;
+    /** DCS context of each interface */
+    struct dcs **radios;
+    /** Number of entries in @ref radios */
+    int num_radios;
+    /** Scan thread reference, taking the measurements of every interface in turn */
+    pthread_t scan_thread;
+    /** Whether the scan thread was started */
+    bool scan_started;
+    /** Config the module was created or last reconfigured from, only used by the scan thread */
+    config_t *config;
+    /** Reloaded configs waiting for the scan thread to apply, see @ref dcs_reconfigure */
+    struct {
+        /** Protects @ref pending, and the scan thread waiting between measurements */
+        pthread_mutex_t mutex;
+        /** Signalled to wake the scan thread to apply @ref pending */
+        pthread_cond_t wake;
+        /** Config to apply, or NULL */
+        config_t *pending;
+    } reconfig;
+};
+
+/**
+ * @brief Create a Dynamic Channel Selection instance for each of the configured interfaces
+ *
+ * @param config config object
+ * @return Initialised DCS module, or NULL on failure
+ */
+struct dcs_module *dcs_create(config_t *config);
+
+/**
+ * @brief Apply a reloaded config, keeping the channel scores, the algorithm state and the scan
+ * thread as they are
+ *
+ * The settings of the algorithm and the scheduler, trigger_csa, dtims_for_csa and
+ * survey_interval_ms are applied on the scan thread, between measurements: the algorithm's
+ * straight away, the scheduler's from the next scan round. The interfaces, test mode, state and
+ * backends settings are kept until restarted, as is algo_type. Not supported while replaying
+ * test samples.
+ *
+ * @param module DCS module
+ * @param config Reloaded config object, which must be kept until the module is destroyed
+ * @return 0 if the config will be applied, else error code
+ */
+int dcs_reconfigure(struct dcs_module *module, config_t *config);
+
+/**
+ * @brief Replay a samples file through the configured algorithm and scheduler, as fast as
+ * possible and without any backend, and count the outcome
+ *
+ * Runs on the calling thread, returning once every sample has been replayed. The config is read
+ * as by @ref dcs_create, with the samples file taken from "dcs.test.filepath" whether or not test
+ * mode is enabled. Persistent state isn't used, so each replay starts from scratch.
  *
  * @param config config object
- * @return Initialised DCS context structure
+ * @param stats Set to the outcome of the replay
+ * @return 0 if successful, else error code
+ */
+int dcs_replay(config_t *config, struct dcs_replay_stats *stats);
+
+/**
+ * @brief Get the time DCS schedules measurements by, in ms
+ *
+ * This is the monotonic clock, or the virtual clock when replaying test samples
+ * (see @ref dcs::test) on which no time passes unless DCS moves it on.
+ *
+ * @param context DCS context
+ * @return the time, in ms
+ */
+uint64_t dcs_now_ms(struct dcs *context);
+
+/**
+ * @brief Build the lookup index of @ref dcs::all_channels once it has been filled in, and
+ * allocate the channels' metrics
+ *
+ * @param context DCS context
+ * @return 0 on success, else error code
+ */
+int dcs_init_channel_tables(struct dcs *context);
+
+/**
+ * @brief Get a channel's slot in @ref dcs::all_channels, which indexes @ref dcs::metrics
+ */
+static inline int dcs_channel_slot(struct dcs *context, const struct dcs_channel *channel)
+{
+    return channel - context->all_channels;
+}
+
+/**
+ * @brief Add a channel to the end of the scan list
+ */
+static inline void dcs_scan_list_add(struct dcs *context, struct dcs_channel *channel)
+{
+    list_add_tail(&context->scan.list, &channel->list);
+    context->metrics.in_scan_list[dcs_channel_slot(context, channel)] = 1;
+}
+
+/**
+ * @brief Remove a channel from the scan list
  */
-struct dcs *dcs_create(config_t *config);
+static inline void dcs_scan_list_remove(struct dcs *context, struct dcs_channel *channel)
+{
+    list_remove(&channel->list);
+    context->metrics.in_scan_list[dcs_channel_slot(context, channel)] = 0;
+}
+
+/**
+ * @brief Find an available channel by its centre frequency and bandwidth
+ *
+ * @param context DCS context
+ * @param freq_khz Centre frequency in kHz
+ * @param bw_mhz Bandwidth in MHz
+ * @return the channel, or NULL if there is no such channel
+ */
+struct dcs_channel *dcs_find_channel(struct dcs *context, uint32_t freq_khz, uint8_t bw_mhz);
+
+/**
+ * @brief Find an available channel by its S1G channel number
+ *
+ * @param context DCS context
+ * @param channel_s1g S1G channel number
+ * @return the channel, or NULL if there is no such channel
+ */
+static inline struct dcs_channel *dcs_find_channel_by_s1g(struct dcs *context,
+        uint8_t channel_s1g)
+{
+    return context->index.by_s1g[channel_s1g];
+}
 
 /**
- * @brief Destroy a Dynamic channel selection instance
+ * @brief Destroy a Dynamic channel selection module and the instance of each interface
  *
- * @param context DCS context to destroy
+ * @param module DCS module to destroy
  */
-void dcs_destroy(struct dcs *context);
+void dcs_destroy(struct dcs_module *module);
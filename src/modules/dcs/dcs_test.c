@@ -11,7 +11,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netlink/genl/genl.h>
 #include <linux/nl80211.h>
 
@@ -20,185 +23,526 @@
 #include "datalog.h"
 #include "utils.h"
 #include "logging.h"
-#include "list.h"
 #include "backend/morsectrl/command.h"
 #include "timestamp.h"
 
 #include "dcs.h"
 
 /**
+ * In order to cope with captures of millions of samples, the samples file is mapped rather than
+ * read into memory, and each sample is only parsed when it is replayed.
  *
- * In order to have decent performance with ~100s to 1000s of samples,
- * channel measurements are stored in per channel lists.
+ * Loading makes a single pass over the file, finding the channels that have samples and the
+ * first sample of each. Each channel then keeps a pointer to the line of its next sample, which
+ * is moved on to the next line for the same channel as each sample is replayed. As DCS measures
+ * the channels in turn, that is normally only a few lines further on.
  *
- * ch_meas_per_ch_head
- *            |
- *            v
- *         ch1_list -> ch1_sample1 -> ch1_sample2 -> ch1_sample3 -> ...
- *            |
- *            v
- *         ch2_list -> ch2_sample1 -> ch2_sample2 -> ch2_sample3 -> ...
- *            |
- *            v
- *           ...
+ *   map: hdr | ch1 s1 | ch2 s1 | ch3 s1 | ch1 s2 | ch2 s2 | ch3 s2 | ...
+ *                         ^                 ^
+ *          next_sample[ch2]               next_sample[ch1]
+ *
+ * Lines are looked up by S1G channel number, through a direct index, while loading, and by
+ * channel slot when replaying.
+ *
+ * The samples file may also be the binary format of the DCS datalog, see
+ * datalog_init_columns(), whose fixed length records stand in for the lines. As their times are
+ * each relative to the record before, each channel also keeps the time of the record before its
+ * next sample, adding on the times of the records skipped as it moves on, and taking the time of
+ * any rebase record skipped.
  */
-struct channel_measurement_list_item
+
+/** Column types of a binary samples file, as written by the DCS datalog */
+#define SAMPLES_BINARY_FMT "tuuuuuuu"
+
+/** Fields of a sample line, in the CSV format written by the DCS datalog */
+struct sample_line
 {
-    list_entry_t list;
-    struct channel_measurement *meas;
+    timestamp_t time;
+    uint32_t frequency_khz;
+    uint32_t bandwidth_mhz;
+    uint32_t channel_s1g;
+    uint32_t metric;
+    uint32_t current_channel;
 };
 
-struct channel_measurement_list_per_ch
+/**
+ * @brief Check whether the samples file is a binary datalog rather than CSV
+ *
+ * @param context DCS context object
+ * @return true if binary
+ */
+static bool samples_are_binary(struct dcs *context)
 {
-    list_entry_t list;
-    struct morse_cmd_channel_info ch;
-    list_head_t channel_sample_list;
-};
+    return context->test.binary.records != NULL;
+}
+
+/**
+ * @brief Find the end of the samples, ignoring any partly written record of a binary file
+ *
+ * @param context DCS context object
+ * @return the end of the samples
+ */
+static const char *samples_end(struct dcs *context)
+{
+    const struct datalog_binary *bin = &context->test.binary;
+
+    if (samples_are_binary(context))
+        return (const char *)bin->records + bin->n_records * bin->record_len;
+
+    return context->test.map + context->test.map_len;
+}
+
+/**
+ * @brief Find the end of a line
+ *
+ * @param context DCS context object
+ * @param line Start of the line
+ * @return the newline ending the line, or the end of the file
+ */
+static const char *line_end(struct dcs *context, const char *line)
+{
+    const char *end = context->test.map + context->test.map_len;
+    const char *nl = memchr(line, '\n', end - line);
+
+    return nl ? nl : end;
+}
 
 /**
- * @brief Add a channel measurement item to the corresponding sample list
+ * @brief Parse an unsigned decimal field
  *
- * @param list sample root list head
- * @param item individual channel measurement list item to add
- * @param ch The channel this measurement corresponds to
+ * @param p Position to parse from, moved on past the digits
+ * @param end End of the line
+ * @param val Set to the value
+ * @return true if there was at least one digit
  */
-static void add_channel_measurement_item(
-        list_head_t *list, struct channel_measurement_list_item *item,
-        struct morse_cmd_channel_info *ch)
+static bool parse_uint(const char **p, const char *end, uint32_t *val)
 {
-    list_entry_t *pos;
-    struct channel_measurement_list_per_ch *per_freq;
+    const char *start = *p;
+    uint32_t out = 0;
 
-    list_for_each_entry(pos, list)
+    while (*p < end && **p >= '0' && **p <= '9')
     {
-        per_freq = list_get_item(per_freq, pos, list);
+        out = out * 10 + (**p - '0');
+        (*p)++;
+    }
 
-        if (per_freq->ch.frequency_khz == ch->frequency_khz)
-        {
-            list_add_tail(&per_freq->channel_sample_list, &item->list);
-            return;
-        }
+    *val = out;
+    return *p != start;
+}
+
+/**
+ * @brief Parse an unsigned decimal field followed by a separator
+ *
+ * @param p Position to parse from, moved on past the separator
+ * @param end End of the line
+ * @param sep Separator expected after the field, or 0 if the field ends the line
+ * @param val Set to the value
+ * @return true if the field was parsed
+ */
+static bool parse_field(const char **p, const char *end, char sep, uint32_t *val)
+{
+    if (!parse_uint(p, end, val))
+        return false;
+
+    if (!sep)
+        return true;
+
+    if (*p == end || **p != sep)
+        return false;
+
+    (*p)++;
+    return true;
+}
+
+/**
+ * @brief Parse an ISO timestamp, "YYYY-MM-DDThh:mm:ss.SSS", followed by a comma
+ *
+ * @param p Position to parse from, moved on past the comma
+ * @param end End of the line
+ * @param time Set to the timestamp
+ * @return true if the timestamp was parsed
+ */
+static bool parse_timestamp(const char **p, const char *end, timestamp_t *time)
+{
+    static const char seps[] = { '-', '-', 'T', ':', ':', '.' };
+    uint32_t vals[ARRAY_SIZE(seps) + 1];
+    const char *frac;
+
+    for (int i = 0; i < ARRAY_SIZE(seps); i++)
+    {
+        if (!parse_field(p, end, seps[i], &vals[i]))
+            return false;
     }
 
-    /* No list for this frequency, make a new one */
-    per_freq = calloc(1, sizeof(*per_freq));
-    MMSM_ASSERT(per_freq);
-    list_reset(&per_freq->channel_sample_list);
-    list_add_tail(&per_freq->channel_sample_list, &item->list);
-    list_add_tail(list, &per_freq->list);
-    memcpy(&per_freq->ch, ch, sizeof(*ch));
+    /* Only the milliseconds of a finer fraction are used */
+    frac = *p;
+    if (!parse_field(p, end, ',', &vals[6]))
+        return false;
+    for (int digits = *p - frac - 1; digits > 3; digits--)
+        vals[6] /= 10;
+
+    time->year = vals[0];
+    time->month = vals[1];
+    time->day = vals[2];
+    time->hour = vals[3];
+    time->minute = vals[4];
+    time->second = vals[5];
+    time->millisecond = vals[6];
+    return true;
 }
 
 /**
- * @brief Pop a channel measurement from the sample lists
+ * @brief Parse a sample line
  *
- * @param per_ch_list sample root list head
- * @param freq_khz frequency to pop a measurement from
- * @return Channel measurement for @ref freq_khz. Caller is responsible for freeing this.
+ * time,frequency_khz,bandwidth_mhz,channel_s1g,metric,accumulated_score,
+ * rounds_as_best_for_channel,current_channel
+ *
+ * @param line Start of the line
+ * @param end End of the line
+ * @param sample Set to the fields of the line
+ * @return true if the line was parsed
  */
-struct channel_measurement *pop_channel_measurement(list_head_t *per_ch_list, uint32_t freq_khz)
+static bool parse_sample_line(const char *line, const char *end, struct sample_line *sample)
 {
-    list_entry_t *pos;
-    struct channel_measurement_list_per_ch *per_ch;
-    struct channel_measurement_list_item *sample = NULL;
-    struct channel_measurement *meas = NULL;
+    const char *p = line;
+    uint32_t dummy;
+
+    return parse_timestamp(&p, end, &sample->time) &&
+        parse_field(&p, end, ',', &sample->frequency_khz) &&
+        parse_field(&p, end, ',', &sample->bandwidth_mhz) &&
+        parse_field(&p, end, ',', &sample->channel_s1g) &&
+        parse_field(&p, end, ',', &sample->metric) &&
+        parse_field(&p, end, ',', &dummy) &&
+        parse_field(&p, end, ',', &dummy) &&
+        parse_field(&p, end, 0, &sample->current_channel);
+}
+
+/**
+ * @brief Find the line after a line, or the record after a record of a binary file
+ *
+ * @param context DCS context object
+ * @param line Start of the line
+ * @return the start of the next line
+ */
+static const char *next_line(struct dcs *context, const char *line)
+{
+    if (samples_are_binary(context))
+        return line + context->test.binary.record_len;
+
+    return line_end(context, line) + 1;
+}
+
+/**
+ * @brief Parse a sample, from a line or from a record of a binary file
+ *
+ * @param context DCS context object
+ * @param line Start of the line
+ * @param time_ms For a binary file, the time of the record before, set to the time of this one
+ * @param sample Set to the fields of the line
+ * @return true if the line was parsed
+ */
+static bool parse_sample(struct dcs *context, const char *line, uint64_t *time_ms,
+                         struct sample_line *sample)
+{
+    const struct datalog_binary *bin = &context->test.binary;
+    const uint8_t *record = (const uint8_t *)line;
+
+    if (!samples_are_binary(context))
+        return parse_sample_line(line, line_end(context, line), sample);
+
+    *time_ms += datalog_binary_get(bin, record, 0);
+    timestamp_from_ms(*time_ms, &sample->time);
+    sample->frequency_khz = datalog_binary_get(bin, record, 1);
+    sample->bandwidth_mhz = datalog_binary_get(bin, record, 2);
+    sample->channel_s1g = datalog_binary_get(bin, record, 3);
+    sample->metric = datalog_binary_get(bin, record, 4);
+    sample->current_channel = datalog_binary_get(bin, record, 7);
+    return true;
+}
+
+/**
+ * @brief Get the S1G channel number of a sample line, without parsing the rest of it
+ *
+ * @param line Start of the line
+ * @param end End of the line
+ * @return the channel number, or -1 if the line can't be parsed
+ */
+static int sample_line_channel(const char *line, const char *end)
+{
+    const char *p = line;
+    uint32_t channel_s1g;
 
-    list_for_each_entry(pos, per_ch_list)
+    /* Skip the time, frequency and bandwidth */
+    for (int i = 0; i < 3; i++)
     {
-        per_ch = list_get_item(per_ch, pos, list);
+        p = memchr(p, ',', end - p);
+        if (!p)
+            return -1;
+        p++;
+    }
+
+    if (!parse_field(&p, end, ',', &channel_s1g) || channel_s1g > UINT8_MAX)
+        return -1;
+
+    return channel_s1g;
+}
+
+/**
+ * @brief Find the next sample line of a channel
+ *
+ * @param context DCS context object
+ * @param line Line to start looking from
+ * @param channel_s1g S1G channel number of the channel
+ * @param time_ms For a binary file, the time of the record before @p line, set to the time of
+ *                the record before the one found
+ * @return the line, or NULL if the channel has no more samples
+ */
+static const char *find_sample_line(struct dcs *context, const char *line, uint8_t channel_s1g,
+                                    uint64_t *time_ms)
+{
+    const struct datalog_binary *bin = &context->test.binary;
+    const char *map_end = samples_end(context);
 
-        if (per_ch->ch.frequency_khz == freq_khz)
+    if (samples_are_binary(context))
+    {
+        for (; line < map_end; line += bin->record_len)
         {
-            sample = list_get_first_item(sample, &per_ch->channel_sample_list, list);
+            const uint8_t *record = (const uint8_t *)line;
 
-            list_remove(&sample->list);
-            meas = sample->meas;
-            free(sample);
+            if (datalog_binary_is_rebase(bin, record, time_ms))
+                continue;
 
-            /* Frequency has no more samples, so remove it from the list */
-            if (list_is_empty(&per_ch->channel_sample_list))
-            {
-                list_remove(&per_ch->list);
-                free(per_ch);
-            }
+            if (datalog_binary_get(bin, record, 3) == channel_s1g)
+                return line;
 
-            break;
+            *time_ms += datalog_binary_get(bin, record, 0);
         }
+        return NULL;
+    }
+
+    while (line < map_end)
+    {
+        const char *end = line_end(context, line);
+
+        if (sample_line_channel(line, end) == channel_s1g)
+            return line;
+
+        line = end + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Pop a channel measurement from the samples
+ *
+ * @param context DCS context object
+ * @param channel Channel to pop a measurement for
+ * @return Channel measurement for @ref channel, or NULL if it has no samples left. Caller is
+ *         responsible for freeing this to @ref dcs::measurement_pool.
+ */
+static struct channel_measurement *pop_channel_measurement(struct dcs *context,
+        struct dcs_channel *channel)
+{
+    const char **next = &context->test.next_sample[channel - context->all_channels];
+    uint64_t *time_ms = &context->test.next_sample_ms[channel - context->all_channels];
+    struct channel_measurement *meas = NULL;
+    struct sample_line sample;
+
+    if (*next)
+    {
+        /* Every sample line was parsed once while loading */
+        MMSM_ASSERT(parse_sample(context, *next, time_ms, &sample));
+
+        meas = pool_alloc(&context->measurement_pool);
+        MMSM_ASSERT(meas);
+        meas->sample_time = sample.time;
+        meas->metric = sample.metric;
+        context->test.latest_metric[channel - context->all_channels] = sample.metric;
+
+        *next = find_sample_line(context, next_line(context, *next), channel->ch.channel_s1g,
+                                 time_ms);
+
+        /* Channel has no more samples */
+        if (!*next)
+            context->test.channels_left--;
     }
 
-    if (list_is_empty(per_ch_list))
-        mmsm_halt();
+    /* The virtual clock follows the recorded time, so the replay covers as long a period */
+    if (meas && context->test.replay)
+        context->test.clock_ms = MAX(context->test.clock_ms, timestamp_to_ms(&meas->sample_time));
+
+    /* When replaying, the scan thread halts once the last measurements have been processed */
+    if (context->test.channels_left == 0)
+    {
+        if (context->test.replay)
+            context->test.finished = true;
+        else
+            mmsm_halt();
+    }
 
     return meas;
 }
 
 /**
- * @brief Load channel samples from a CSV file.
- * CSV format is the same that is outputted by DCS module.
+ * @brief Map the samples file
+ *
+ * @param context DCS context object
+ * @return 0 if successful, else error code
+ */
+static int map_samples_file(struct dcs *context)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(context->test.samples_filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_ERROR("Could not open file\n");
+        return -ENFILE;
+    }
+
+    if (fstat(fd, &st) || st.st_size == 0)
+    {
+        LOG_ERROR("Could not read file\n");
+        close(fd);
+        return -EIO;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("Could not map file\n");
+        return -ENOMEM;
+    }
+
+    /* Read once from start to end */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    context->test.map = map;
+    context->test.map_len = st.st_size;
+
+    memset(&context->test.binary, 0, sizeof(context->test.binary));
+    if (datalog_binary_open(&context->test.binary, map, st.st_size) &&
+        (context->test.binary.n_fields != strlen(SAMPLES_BINARY_FMT) ||
+         memcmp(context->test.binary.fmt, SAMPLES_BINARY_FMT, strlen(SAMPLES_BINARY_FMT))))
+    {
+        LOG_ERROR("Binary samples file isn't a DCS datalog\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find the channels in the samples file, and the first sample of each.
+ * CSV or binary format is the same that is outputted by DCS module.
+ *
+ * Fills in @ref all_channels and @ref test.next_sample, in the order the channels first appear.
  *
  * @param context DCS context object
- * @param file Open file object to read from
- * @return initial S1G channel number
+ * @return initial S1G channel number, or error code
  */
-static int load_channel_measurement_samples_from_file(struct dcs *context, FILE *file)
+static int index_channel_measurement_samples(struct dcs *context)
 {
-    char *buff = NULL;
-    size_t buff_len = 0;
-    ssize_t n_read;
-    int score, bw_mhz, s1g_chan;
-    list_head_t *per_ch_sample_list = &context->test.per_ch_sample_list;
-    struct channel_measurement_list_item *item;
-    struct morse_cmd_channel_info ch = {0};
-    int dummy, tmp;
+    const char *map_end = samples_end(context);
+    /* Slot of each channel found, by S1G channel number */
+    int slot_by_s1g[UINT8_MAX + 1];
+    const char *first_line[UINT8_MAX + 1];
+    uint64_t first_ms[UINT8_MAX + 1];
+    uint64_t time_ms = context->test.binary.base_ms;
+    uint64_t prev_ms;
+    struct morse_cmd_channel_info chans[UINT8_MAX + 1];
+    struct sample_line sample;
+    const char *line;
+    const char *end = NULL;
+    const char *next;
+    int num_chans = 0;
     int initial_chan = 0;
-    char *ret;
-    timestamp_t sample_time;
+    size_t n_samples = 0;
 
-    list_reset(per_ch_sample_list);
+    memset(slot_by_s1g, -1, sizeof(slot_by_s1g));
+    memset(chans, 0, sizeof(chans));
 
-    /* Consume first line */
-    n_read = getline(&buff, &buff_len, file);
+    /* Consume first line, the headings of a CSV file */
+    if (samples_are_binary(context))
+        line = (const char *)context->test.binary.records;
+    else
+        line = line_end(context, context->test.map) + 1;
 
-    while ((n_read = getline(&buff, &buff_len, file)) > 0)
+    for (; line < map_end; line = next)
     {
-        /*
-         * time,frequency_khz,bandwidth_mhz,channel_s1g,metric,accumulated_score,
-         * rounds_as_best_for_channel,current_channel
-         */
-        if (!timestamp_from_iso_string(buff, &sample_time))
+        if (samples_are_binary(context))
         {
-            LOG_ERROR("Invalid ISO time in samples %s\n", buff);
-            return -1;
-        }
+            next = line + context->test.binary.record_len;
 
-        ret = strchr(buff, ',');
-        if (ret == NULL)
-        {
-            LOG_WARN("Could not find first occurrence in buffer\n");
-            continue;
+            /* Not a sample, but the time the next one is relative to */
+            if (datalog_binary_is_rebase(&context->test.binary, (const uint8_t *)line, &time_ms))
+                continue;
         }
+        else
+        {
+            end = line_end(context, line);
+            next = end + 1;
 
-        item = malloc(sizeof(*item));
-        MMSM_ASSERT(item);
-        item->meas = calloc(1, sizeof(*(item->meas)));
-        MMSM_ASSERT(item->meas);
-        item->meas->sample_time = sample_time;
+            /* Allow a blank line, eg. at the end */
+            if (end == line || (end == line + 1 && *line == '\r'))
+                continue;
+        }
 
-        sscanf(ret, ",%d,%d,%d,%d,%d,%d,%d",
-            &ch.frequency_khz, &bw_mhz, &s1g_chan, &score, &dummy, &dummy, &tmp);
+        prev_ms = time_ms;
+        if (!parse_sample(context, line, &time_ms, &sample) || sample.channel_s1g > UINT8_MAX)
+        {
+            if (samples_are_binary(context))
+                LOG_ERROR("Invalid sample %zu\n", n_samples);
+            else
+                LOG_ERROR("Invalid sample %.*s\n", (int)(end - line), line);
+            return -EINVAL;
+        }
 
         if (initial_chan == 0)
         {
-            initial_chan = tmp;
+            initial_chan = sample.current_channel;
         }
 
-        ch.bandwidth_mhz = bw_mhz;
-        ch.channel_s1g = s1g_chan;
-        item->meas->metric = score;
-        add_channel_measurement_item(per_ch_sample_list, item, &ch);
+        n_samples++;
+        if (slot_by_s1g[sample.channel_s1g] >= 0)
+            continue;
+
+        slot_by_s1g[sample.channel_s1g] = num_chans;
+        first_line[num_chans] = line;
+        first_ms[num_chans] = prev_ms;
+        chans[num_chans].frequency_khz = sample.frequency_khz;
+        chans[num_chans].bandwidth_mhz = sample.bandwidth_mhz;
+        chans[num_chans].channel_s1g = sample.channel_s1g;
+        num_chans++;
+    }
+
+    if (num_chans == 0)
+        return initial_chan;
+
+    context->num_chans = num_chans;
+    context->test.channels_left = num_chans;
+    context->all_channels = calloc(num_chans, sizeof(*context->all_channels));
+    context->test.next_sample = calloc(num_chans, sizeof(*context->test.next_sample));
+    context->test.next_sample_ms = calloc(num_chans, sizeof(*context->test.next_sample_ms));
+    context->test.latest_metric = calloc(num_chans, sizeof(*context->test.latest_metric));
+    if (!context->all_channels || !context->test.next_sample || !context->test.next_sample_ms ||
+        !context->test.latest_metric)
+    {
+        LOG_ERROR("Failed to allocate channels\n");
+        return -ENOMEM;
+    }
+
+    for (int i = 0; i < num_chans; i++)
+    {
+        memcpy(&context->all_channels[i].ch, &chans[i], sizeof(chans[i]));
+        context->test.next_sample[i] = first_line[i];
+        context->test.next_sample_ms[i] = first_ms[i];
+        context->test.latest_metric[i] = -1;
     }
 
-    free(buff);
+    LOG_INFO("Indexed %zu samples of %d channels\n", n_samples, num_chans);
     return initial_chan;
 }
 
@@ -210,45 +554,32 @@ static int load_channel_measurement_samples_from_file(struct dcs *context, FILE
  */
 int initialise_channels_for_test(struct dcs *context)
 {
-    list_entry_t *pos;
-    struct channel_measurement_list_per_ch *entry;
-    int i = 0;
+    int i;
     int initial_chan;
+    int ret;
 
-    FILE *file = fopen(context->test.samples_filepath, "r");
-    if (file == NULL)
-    {
-        LOG_ERROR("Could not open file\n");
-        return -ENFILE;
-    }
+    ret = map_samples_file(context);
+    if (ret)
+        return ret;
 
-    initial_chan = load_channel_measurement_samples_from_file(context, file);
-    fclose(file);
+    initial_chan = index_channel_measurement_samples(context);
 
     if (initial_chan <= 0)
     {
         LOG_ERROR("Failed loading samples\n");
-        return -EINVAL;
+        return initial_chan == -ENOMEM ? -ENOMEM : -EINVAL;
     }
 
     list_reset(&context->scan.list);
 
-    context->num_chans = list_size(&context->test.per_ch_sample_list);
-    context->all_channels = calloc(context->num_chans, sizeof(*context->all_channels));
-    list_for_each_entry(pos, &context->test.per_ch_sample_list)
-    {
-        entry = list_get_item(entry, pos, list);
-        memcpy(&context->all_channels[i].ch, &entry->ch, sizeof(entry->ch));
-        context->all_channels[i].metric.accumulated_score = 100;
-        list_add_tail(&context->scan.list, &context->all_channels[i].list);
+    if (dcs_init_channel_tables(context))
+        return -ENOMEM;
 
-        if (entry->ch.channel_s1g == initial_chan)
-        {
-            context->current_channel = &context->all_channels[i];
-        }
+    for (i = 0; i < context->num_chans; i++)
+        dcs_scan_list_add(context, &context->all_channels[i]);
 
-        i++;
-    }
+    if (initial_chan <= UINT8_MAX)
+        context->current_channel = dcs_find_channel_by_s1g(context, initial_chan);
 
     if (!context->current_channel)
     {
@@ -258,6 +589,24 @@ int initialise_channels_for_test(struct dcs *context)
     LOG_INFO("Loaded samples. Initial channel %d\n", context->current_channel->ch.channel_s1g);
     context->current_primary_ch_width = 1;
     context->current_prim_1mhz_ch_index = 0;
+
+    if (context->test.replay)
+    {
+        struct sample_line sample;
+        uint64_t time_ms;
+
+        /* Start the virtual clock at the earliest sample */
+        context->test.clock_ms = UINT64_MAX;
+        for (i = 0; i < context->num_chans; i++)
+        {
+            time_ms = context->test.next_sample_ms[i];
+            MMSM_ASSERT(parse_sample(context, context->test.next_sample[i], &time_ms, &sample));
+            context->test.clock_ms = MIN(context->test.clock_ms, timestamp_to_ms(&sample.time));
+        }
+        context->test.replay_started_clock_ms = context->test.clock_ms;
+        context->test.stats_clock_ms = context->test.clock_ms;
+        context->test.replay_started_ms = get_timestamp_ms();
+    }
     return 0;
 }
 
@@ -265,31 +614,55 @@ int initialise_channels_for_test(struct dcs *context)
  * @brief Get a channel measurement for a corresponding frequency
  *
  * @param context dcs context object
- * @param freq_khz Centre frequency to measure
- * @param bw_mhz Bandwidth to measure
- * @return Measurement of channel. Caller is responsible for freeing this
+ * @param channel Channel to measure
+ * @return Measurement of channel, or NULL if it has no samples left. Caller is responsible for
+ *         freeing this to @ref dcs::measurement_pool
  */
 struct channel_measurement *get_channel_measurement_for_test(
         struct dcs *context, struct dcs_channel *channel)
 {
-    return pop_channel_measurement(&context->test.per_ch_sample_list, channel->ch.frequency_khz);
+    return pop_channel_measurement(context, channel);
+}
+
+/**
+ * @brief Count the time since the last call towards @ref test.stats, as spent on the operating
+ * channel. Called at the end of each scan round, before the channels are evaluated.
+ *
+ * @param context dcs context object
+ */
+void dcs_test_count_stats(struct dcs *context)
+{
+    struct dcs_replay_stats *stats = context->test.stats;
+    int current = context->test.latest_metric[dcs_channel_slot(context, context->current_channel)];
+    uint64_t elapsed_ms = context->test.clock_ms - context->test.stats_clock_ms;
+    int best = -1;
+
+    context->test.stats_clock_ms = context->test.clock_ms;
+
+    /* Nothing is known of the operating channel yet */
+    if (current < 0)
+        return;
+
+    for (int i = 0; i < context->num_chans; i++)
+        best = MAX(best, context->test.latest_metric[i]);
+
+    stats->scored_ms += elapsed_ms;
+    stats->metric_ms += elapsed_ms * current;
+    if (current < best)
+        stats->suboptimal_ms += elapsed_ms;
 }
 
 void dcs_test_free_all_samples(struct dcs *context)
 {
-    list_entry_t *entry, *temp;
-    list_for_each_entry_safe(entry, temp, &context->test.per_ch_sample_list)
-    {
-        struct channel_measurement_list_per_ch *per_ch = list_get_item(per_ch, entry, list);
-        list_entry_t *entry2, *temp2;
-        list_for_each_entry_safe(entry2, temp2, &per_ch->channel_sample_list)
-        {
-            struct channel_measurement_list_item *sample = list_get_item(sample, entry2, list);
-            list_remove(entry2);
-            free(sample->meas);
-            free(sample);
-        }
-        list_remove(entry);
-        free(per_ch);
-    }
+    free(context->test.next_sample);
+    context->test.next_sample = NULL;
+    free(context->test.next_sample_ms);
+    context->test.next_sample_ms = NULL;
+    free(context->test.latest_metric);
+    context->test.latest_metric = NULL;
+
+    if (context->test.map)
+        munmap((void *)context->test.map, context->test.map_len);
+    context->test.map = NULL;
+    context->test.binary.records = NULL;
 }
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+/*
+ * DCS scan scheduler common file.
+ *
+ * All supported / enabled schedulers should have a corresponding entry in scheduler_table
+ */
+#include <libconfig.h>
+#include <string.h>
+
+#include "utils.h"
+#include "dcs.h"
+#include "scheduler.h"
+
+#define DEFAULT_SCHEDULER       "round_robin"
+
+extern struct scheduler_ops round_robin_ops;
+extern struct scheduler_ops adaptive_ops;
+
+/** Table of supported schedulers */
+static struct scheduler scheduler_table[] = {
+    {
+        .name = "round_robin",
+        .ops = &round_robin_ops
+    },
+    {
+        .name = "adaptive",
+        .ops = &adaptive_ops
+    }
+};
+
+int dcs_scheduler_initialise(struct dcs *context, config_setting_t *cfg)
+{
+    const char *scheduler_name;
+
+    scheduler_name = cfg_parse_string_with_default(cfg, "scheduler_type", DEFAULT_SCHEDULER);
+
+    for (int i = 0; i < ARRAY_SIZE(scheduler_table); i++)
+    {
+        if (strcmp(scheduler_table[i].name, scheduler_name) == 0)
+        {
+            LOG_INFO("Using scan scheduler: %s\n", scheduler_name);
+            context->scheduler.ops = scheduler_table[i].ops;
+            context->scheduler.settings = cfg;
+
+            if (context->scheduler.ops->init)
+            {
+                return context->scheduler.ops->init(context,
+                        config_setting_get_member(cfg, scheduler_name));
+            }
+            return 0;
+        }
+    }
+
+    LOG_ERROR("No matching scan scheduler for %s\n", scheduler_name);
+    return -EINVAL;
+}
+
+/** Gets the settings of the scheduler a config selects */
+static config_setting_t *get_scheduler_settings(config_setting_t *cfg)
+{
+    const char *scheduler_name = DEFAULT_SCHEDULER;
+
+    config_setting_lookup_string(cfg, "scheduler_type", &scheduler_name);
+    return config_setting_get_member(cfg, scheduler_name);
+}
+
+bool dcs_scheduler_settings_changed(struct dcs *context, config_setting_t *cfg)
+{
+    config_setting_t *prev = context->scheduler.settings;
+
+    return !cfg_setting_equal(config_setting_get_member(prev, "scheduler_type"),
+                              config_setting_get_member(cfg, "scheduler_type")) ||
+        !cfg_setting_equal(get_scheduler_settings(prev), get_scheduler_settings(cfg));
+}
+
+int dcs_scheduler_reconfigure(struct dcs *context, config_setting_t *cfg)
+{
+    config_setting_t *prev = context->scheduler.settings;
+    int ret;
+
+    dcs_scheduler_deinitialise(context);
+    ret = dcs_scheduler_initialise(context, cfg);
+    if (ret)
+    {
+        dcs_scheduler_deinitialise(context);
+        MMSM_ASSERT(dcs_scheduler_initialise(context, prev) == 0);
+    }
+    return ret;
+}
+
+void dcs_scheduler_deinitialise(struct dcs *context)
+{
+    if (context->scheduler.ops && context->scheduler.ops->deinit)
+    {
+        context->scheduler.ops->deinit(context);
+    }
+}
+
+struct dcs_channel *dcs_scheduler_ops_next_channel(struct dcs *context, struct dcs_channel *prev)
+{
+    return context->scheduler.ops->next_channel(context, prev);
+}
+
+void dcs_scheduler_ops_measurement_done(struct dcs *context, struct dcs_channel *chan,
+        const struct channel_measurement *meas)
+{
+    if (context->scheduler.ops->measurement_done)
+    {
+        context->scheduler.ops->measurement_done(context, chan, meas);
+    }
+}
+
+void dcs_scheduler_free_context(struct dcs *context)
+{
+    free(context->scheduler.context);
+    context->scheduler.context = NULL;
+}
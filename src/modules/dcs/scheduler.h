@@ -0,0 +1,115 @@
+/*
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+#pragma once
+
+#include <libconfig.h>
+
+#include "dcs.h"
+
+/**
+ * Scan scheduler operation table.
+ *
+ * A scheduler decides which channels in the scan list are measured in each scan round, and in
+ * what order. All ops are called from the scan thread.
+ */
+struct scheduler_ops {
+    /**
+     * Passed DCS context, and the config setting that matches the scheduler's name (NULL if there
+     * isn't one). Returns 0 on success, else error code.
+     */
+    int (*init)(struct dcs *, config_setting_t *);
+
+    /**
+     * Uninitalise and clean up scheduler specific context. Called in DCS destroy, or if init
+     * fails.
+     */
+    void (*deinit)(struct dcs *);
+
+    /**
+     * Returns the next channel to measure. Passed the channel just measured, or NULL to start a
+     * scan round. Returns NULL once the round is over. The channel passed may be removed from the
+     * scan list straight after this returns.
+     */
+    struct dcs_channel* (*next_channel)(struct dcs *, struct dcs_channel *);
+
+    /**
+     * Called after each off-channel measurement, with the channel and the measurement taken, or
+     * NULL if the measurement failed.
+     */
+    void (*measurement_done)(struct dcs *, struct dcs_channel *,
+            const struct channel_measurement *);
+};
+
+/** Scheduler definition */
+struct scheduler {
+    /** Name of scheduler. Must match config file section, if it has one. */
+    const char *name;
+    /** Operation table with callbacks for the particular scheduler. */
+    struct scheduler_ops *ops;
+};
+
+/**
+ * @brief Assign a DCS scan scheduler and initialise it
+ *
+ * @param dcs DCS context
+ * @param cfg root config setting
+ *            may contain 'scheduler_type' (default "round_robin") and a child setting with a
+ *            matching name
+ * @return 0 if successful, else error code
+ */
+int dcs_scheduler_initialise(struct dcs *dcs, config_setting_t *cfg);
+
+/**
+ * @brief Check whether a reloaded config changes the scheduler or its settings
+ *
+ * @param dcs DCS context
+ * @param cfg root config setting, as for @ref dcs_scheduler_initialise
+ * @return true if the scheduler should be reconfigured
+ */
+bool dcs_scheduler_settings_changed(struct dcs *dcs, config_setting_t *cfg);
+
+/**
+ * @brief Initialise the scheduler again, from a reloaded config. What it has learnt of the
+ * channels is lost, so this is best done between scan rounds.
+ *
+ * @param dcs DCS context
+ * @param cfg root config setting, as for @ref dcs_scheduler_initialise
+ * @return 0 if successful, else error code, in which case the previous scheduler and settings
+ *         are used again
+ */
+int dcs_scheduler_reconfigure(struct dcs *dcs, config_setting_t *cfg);
+
+/**
+ * @brief Call the deinit op to clean up the scheduler context.
+ *
+ * @param dcs DCS context
+ */
+void dcs_scheduler_deinitialise(struct dcs *dcs);
+
+/**
+ * @brief Call the next channel op for the assigned scheduler.
+ *
+ * @param dcs DCS context
+ * @param prev The channel just measured, or NULL to start a scan round
+ * @return The next channel to measure, or NULL if the scan round is over
+ */
+struct dcs_channel *dcs_scheduler_ops_next_channel(struct dcs *dcs, struct dcs_channel *prev);
+
+/**
+ * @brief Call the measurement done op for the assigned scheduler.
+ *
+ * @param dcs DCS context
+ * @param chan The channel measured
+ * @param meas The measurement taken, or NULL if it failed
+ */
+void dcs_scheduler_ops_measurement_done(struct dcs *dcs, struct dcs_channel *chan,
+        const struct channel_measurement *meas);
+
+/**
+ * @brief Generic deinit function to free the opaque scheduler context
+ *
+ * @param context DCS context
+ */
+void dcs_scheduler_free_context(struct dcs *context);
@@ -0,0 +1,291 @@
+/*
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+/**
+ * Adaptive DCS scan scheduler
+ *
+ * Keeps, for each channel, an EWMA of its measured metric and of how far measurements stray from
+ * it, and gives each channel an optimistic estimate of what it could score:
+ *
+ *          estimate = mean + (confidence_percent / 100) * deviation
+ *                     + exploration_bonus * rounds_skipped
+ *
+ * At the start of each scan round, only channels whose estimate reaches the best mean of any
+ * channel are measured, so channels that are consistently poor are sampled less and less time
+ * is spent off the operating channel. The operating channel, channels with fewer than
+ * @ref min_samples measurements and channels skipped for @ref max_skip_rounds rounds in a row are
+ * always measured. Channels are measured in order of their estimate, best first.
+ *
+ * Channels that are skipped keep their last score, so this is best paired with the "ewma"
+ * algorithm. "sample_and_hold" compares the sum of each channel's samples, which penalises the
+ * channels measured less.
+ */
+#include <stdlib.h>
+#include "helpers.h"
+#include "dcs.h"
+#include "scheduler.h"
+
+/* Fixed point scale of the per channel mean and deviation */
+#define ADAPTIVE_SCALE              (16)
+
+#define ADAPTIVE_ALPHA_MIN          (1)
+#define ADAPTIVE_ALPHA_MAX          (100)
+
+/* Deviation assumed after the first measurement of a channel, in metric units */
+#define INITIAL_DEVIATION           (10)
+
+/** What the scheduler has learnt about a channel */
+struct adaptive_channel_state
+{
+    /** EWMA of the channel's metric, scaled by @ref ADAPTIVE_SCALE */
+    uint32_t mean;
+    /** EWMA of the absolute difference between measurements and the mean, scaled likewise */
+    uint32_t deviation;
+    /** Number of measurements taken */
+    int n_samples;
+    /** Number of scan rounds in a row the channel hasn't been measured in */
+    int rounds_skipped;
+};
+
+/** Context for adaptive scheduler */
+struct adaptive_context
+{
+    struct {
+        /** Weight of each new measurement, between 1 and 100 */
+        int alpha;
+        /** How many deviations above its mean a channel is assumed to be able to score */
+        int confidence_percent;
+        /** Metric units added to a channel's estimate for each round it's skipped */
+        int exploration_bonus;
+        /** Number of measurements of a channel before it may be skipped */
+        int min_samples;
+        /** Maximum number of scan rounds in a row a channel may be skipped */
+        int max_skip_rounds;
+    } config;
+
+    /** Per channel state, indexed like @ref dcs::all_channels */
+    struct adaptive_channel_state *state;
+    /** Channels to measure in the current round, for @ref n_planned entries */
+    struct dcs_channel **plan;
+    /** Estimate of each channel in @ref plan */
+    uint32_t *priority;
+    int n_planned;
+    /** Index in @ref plan of the next channel to measure */
+    int next;
+};
+
+static struct adaptive_channel_state *get_state(struct dcs *context, struct adaptive_context *ad,
+        struct dcs_channel *channel)
+{
+    return &ad->state[dcs_channel_slot(context, channel)];
+}
+
+/**
+ * @brief Get the optimistic estimate of what a channel could score
+ *
+ * @param ad Adaptive context
+ * @param state The channel's state
+ * @return the estimate, scaled by @ref ADAPTIVE_SCALE, or UINT32_MAX if the channel hasn't been
+ *         measured enough to be skipped
+ */
+static uint32_t get_estimate(struct adaptive_context *ad, struct adaptive_channel_state *state)
+{
+    if (state->n_samples < ad->config.min_samples)
+        return UINT32_MAX;
+
+    return state->mean +
+            (state->deviation * (uint32_t)ad->config.confidence_percent) / 100 +
+            (uint32_t)(ad->config.exploration_bonus * state->rounds_skipped) * ADAPTIVE_SCALE;
+}
+
+/**
+ * @brief Plan which channels to measure in a new scan round
+ *
+ * @param context DCS context
+ * @param ad Adaptive context
+ */
+static void plan_round(struct dcs *context, struct adaptive_context *ad)
+{
+    struct adaptive_channel_state *state;
+    struct dcs_channel *channel;
+    list_entry_t *pos;
+    uint32_t best_mean = 0;
+    int n_skipped = 0;
+
+    list_for_each_entry(pos, &context->scan.list) {
+        channel = list_get_item(channel, pos, list);
+        state = get_state(context, ad, channel);
+
+        if (state->n_samples >= ad->config.min_samples && state->mean > best_mean)
+            best_mean = state->mean;
+    }
+
+    ad->n_planned = 0;
+    ad->next = 0;
+
+    list_for_each_entry(pos, &context->scan.list) {
+        uint32_t estimate;
+        int i;
+
+        channel = list_get_item(channel, pos, list);
+        state = get_state(context, ad, channel);
+        estimate = get_estimate(ad, state);
+
+        if (channel != context->current_channel && estimate < best_mean &&
+            state->rounds_skipped < ad->config.max_skip_rounds)
+        {
+            state->rounds_skipped++;
+            n_skipped++;
+            continue;
+        }
+        state->rounds_skipped = 0;
+
+        /* Insert by estimate, best first, keeping list order for equal estimates */
+        for (i = ad->n_planned; i > 0 && ad->priority[i - 1] < estimate; i--)
+        {
+            ad->plan[i] = ad->plan[i - 1];
+            ad->priority[i] = ad->priority[i - 1];
+        }
+        ad->plan[i] = channel;
+        ad->priority[i] = estimate;
+        ad->n_planned++;
+    }
+
+    LOG_DEBUG("Scanning %d channel(s), skipping %d\n", ad->n_planned, n_skipped);
+}
+
+/**
+ * @brief Function called by DCS to get the next channel to measure
+ *
+ * @param context DCS context
+ * @param prev Channel just measured, or NULL to start a round
+ * @return the channel with the next best estimate, or NULL at the end of the round
+ */
+static struct dcs_channel *adaptive_op_next_channel(struct dcs *context,
+        struct dcs_channel *prev)
+{
+    struct adaptive_context *ad = context->scheduler.context;
+
+    if (!prev)
+        plan_round(context, ad);
+
+    if (ad->next >= ad->n_planned)
+        return NULL;
+
+    return ad->plan[ad->next++];
+}
+
+/**
+ * @brief Function called by DCS after each off-channel measurement
+ *
+ * @param context DCS context
+ * @param channel Channel measured
+ * @param meas Measurement taken, or NULL if it failed
+ */
+static void adaptive_op_measurement_done(struct dcs *context, struct dcs_channel *channel,
+        const struct channel_measurement *meas)
+{
+    struct adaptive_context *ad = context->scheduler.context;
+    struct adaptive_channel_state *state = get_state(context, ad, channel);
+    uint32_t sample;
+    uint32_t diff;
+
+    if (!meas)
+        return;
+
+    sample = (uint32_t)meas->metric * ADAPTIVE_SCALE;
+
+    if (state->n_samples++ == 0)
+    {
+        state->mean = sample;
+        state->deviation = INITIAL_DEVIATION * ADAPTIVE_SCALE;
+        return;
+    }
+
+    diff = sample > state->mean ? sample - state->mean : state->mean - sample;
+    state->deviation = (ad->config.alpha * diff +
+            (ADAPTIVE_ALPHA_MAX - ad->config.alpha) * state->deviation) / 100;
+    state->mean = (ad->config.alpha * sample +
+            (ADAPTIVE_ALPHA_MAX - ad->config.alpha) * state->mean) / 100;
+}
+
+/**
+ * @brief Called to clean up the adaptive scheduler
+ *
+ * @param context DCS context
+ */
+static void adaptive_op_deinit(struct dcs *context)
+{
+    struct adaptive_context *ad = context->scheduler.context;
+
+    if (ad)
+    {
+        free(ad->state);
+        free(ad->plan);
+        free(ad->priority);
+    }
+    dcs_scheduler_free_context(context);
+}
+
+/**
+ * @brief Called to initialise the adaptive scheduler
+ *
+ * @param context DCS context
+ * @param cfg Config setting for the scheduler, or NULL to use the defaults
+ * @return 0 on success, else error code
+ */
+static int adaptive_op_init(struct dcs *context, config_setting_t *cfg)
+{
+    int errors = 0;
+    struct adaptive_context *ad = calloc(1, sizeof(*ad));
+
+    if (!ad)
+    {
+        LOG_ERROR("Failed to allocate adaptive scheduler context\n");
+        return -ENOMEM;
+    }
+
+    context->scheduler.context = ad;
+
+    ad->config.alpha = cfg_parse_int_with_default(cfg, "alpha", 30);
+    if (ad->config.alpha > ADAPTIVE_ALPHA_MAX || ad->config.alpha < ADAPTIVE_ALPHA_MIN)
+    {
+        LOG_ERROR("Adaptive scheduler alpha out of bounds (min: %d, max: %d, actual: %d)\n",
+                ADAPTIVE_ALPHA_MIN, ADAPTIVE_ALPHA_MAX, ad->config.alpha);
+        errors++;
+    }
+
+    ad->config.confidence_percent = cfg_parse_int_with_default(cfg, "confidence_percent", 200);
+    ad->config.exploration_bonus = cfg_parse_int_with_default(cfg, "exploration_bonus", 2);
+    ad->config.min_samples = cfg_parse_int_with_default(cfg, "min_samples", 3);
+    ad->config.max_skip_rounds = cfg_parse_int_with_default(cfg, "max_skip_rounds", 5);
+    if (ad->config.confidence_percent < 0 || ad->config.exploration_bonus < 0 ||
+        ad->config.min_samples < 0 || ad->config.max_skip_rounds < 0)
+    {
+        LOG_ERROR("Adaptive scheduler settings must not be negative\n");
+        errors++;
+    }
+
+    ad->state = calloc(context->num_chans, sizeof(*ad->state));
+    ad->plan = calloc(context->num_chans, sizeof(*ad->plan));
+    ad->priority = calloc(context->num_chans, sizeof(*ad->priority));
+    if (!ad->state || !ad->plan || !ad->priority)
+    {
+        LOG_ERROR("Failed to allocate adaptive scheduler state\n");
+        return -ENOMEM;
+    }
+
+    return errors ? -EINVAL : 0;
+}
+
+/**
+ * @brief op table for adaptive scheduler
+ */
+struct scheduler_ops adaptive_ops = {
+    .init = adaptive_op_init,
+    .deinit = adaptive_op_deinit,
+    .next_channel = adaptive_op_next_channel,
+    .measurement_done = adaptive_op_measurement_done,
+};
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+/**
+ * Round robin DCS scan scheduler
+ *
+ * Measures every channel in the scan list once per scan round, in list order.
+ */
+#include "dcs.h"
+#include "scheduler.h"
+
+/**
+ * @brief Function called by DCS to get the next channel to measure
+ *
+ * @param context DCS context
+ * @param prev Channel just measured, or NULL to start a round
+ * @return the next channel in the scan list, or NULL at the end of the list
+ */
+static struct dcs_channel *round_robin_op_next_channel(struct dcs *context,
+        struct dcs_channel *prev)
+{
+    if (!prev)
+        return list_get_first_item(prev, &context->scan.list, list);
+
+    return list_get_next_item_or_null(prev, &context->scan.list, list);
+}
+
+/**
+ * @brief op table for round robin scheduler
+ */
+struct scheduler_ops round_robin_ops = {
+    .next_channel = round_robin_op_next_channel,
+};
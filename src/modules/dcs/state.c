@@ -0,0 +1,428 @@
+/*
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+
+/*
+ * Persistent DCS state, see state.h.
+ *
+ * The file is two snapshots of the same size, each a header followed by the metrics of every
+ * channel, indexed by channel slot. The header tags the snapshot so it is only reloaded for the
+ * same country, channel list and algorithm, and carries a checksum of the whole snapshot so a
+ * checkpoint torn by a crash or power cut is recognised and the other snapshot used instead.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/nl80211.h>
+
+#include "helpers.h"
+#include "hashmap.h"
+#include "logging.h"
+#include "mmsm_data.h"
+#include "utils.h"
+#include "dcs.h"
+#include "algo.h"
+#include "state.h"
+
+/* "DCSS" */
+#define DCS_STATE_MAGIC                 (0x53534344)
+#define DCS_STATE_VERSION               (1)
+
+/* Room for the algorithm state in each snapshot */
+#define DCS_STATE_ALGO_STATE_MAX        (32)
+
+#define DEFAULT_CHECKPOINT_ROUNDS       (10)
+#define DEFAULT_MAX_AGE_S               (24 * 60 * 60)
+
+/** Metrics of a channel in a snapshot */
+struct dcs_state_channel
+{
+    uint32_t accumulated_score;
+    int32_t n_samples;
+    int32_t rounds_as_best;
+};
+
+/** Snapshot of the state, as laid out in the file */
+struct dcs_state_snapshot
+{
+    uint32_t magic;
+    uint16_t version;
+    /** Number of entries in @ref channels */
+    uint16_t num_chans;
+    /** Regulatory country the channels were available in (ISO 3166 alpha2, NUL terminated) */
+    char country[4];
+    /** Name of the algorithm the state is for (NUL terminated) */
+    char algo[16];
+    /** Hash of the available channels, in slot order */
+    uint64_t channels_hash;
+    /** Incremented with each checkpoint, the latest of the two snapshots is reloaded */
+    uint32_t generation;
+    /** Length of @ref algo_state */
+    uint32_t algo_state_len;
+    /** When the snapshot was written, in seconds since the epoch */
+    uint64_t saved_at_s;
+    /** State written by @ref dcs_algo_ops_save_state */
+    uint8_t algo_state[DCS_STATE_ALGO_STATE_MAX];
+    /** Hash of the fields above and the channels */
+    uint64_t checksum;
+    struct dcs_state_channel channels[];
+};
+
+/** Persistent state context */
+struct dcs_state
+{
+    /** The mapped file, holding two snapshots */
+    uint8_t *map;
+    /** Length of map */
+    size_t map_len;
+    /** Offset of the second snapshot in map, rounded up to a page so each is synced by itself */
+    size_t snapshot_len;
+    /** Tags written to every snapshot, and compared with those of the snapshots reloaded */
+    char country[4];
+    char algo[16];
+    uint64_t channels_hash;
+    /** Generation of the last snapshot written or reloaded */
+    uint32_t generation;
+    /** Scan rounds between checkpoints */
+    int checkpoint_rounds;
+    /** Scan rounds since the last checkpoint */
+    int rounds;
+    /** Snapshots older than this many seconds aren't reloaded, or 0 for no limit */
+    int max_age_s;
+};
+
+/**
+ * @brief Get a snapshot in the mapped file
+ *
+ * @param state Persistent state context
+ * @param i Index of the snapshot, 0 or 1
+ */
+static struct dcs_state_snapshot *get_snapshot(struct dcs_state *state, uint32_t i)
+{
+    return (struct dcs_state_snapshot *)(state->map + (i & 1) * state->snapshot_len);
+}
+
+/**
+ * @brief Hash a snapshot, as stored in its checksum field
+ */
+static uint64_t snapshot_checksum(const struct dcs_state_snapshot *snap)
+{
+    uint64_t checksum = hashmap_hash_bytes(snap, offsetof(struct dcs_state_snapshot, checksum),
+        DCS_STATE_MAGIC);
+
+    return hashmap_hash_bytes(snap->channels, snap->num_chans * sizeof(snap->channels[0]),
+        checksum);
+}
+
+/**
+ * @brief Hash the available channels, so a snapshot taken with a different channel list (eg.
+ * after a BCF or firmware change) isn't reloaded with its metrics against the wrong channels
+ */
+static uint64_t hash_channels(struct dcs *context)
+{
+    uint64_t hash = context->num_chans;
+
+    for (int i = 0; i < context->num_chans; i++)
+        hash = hashmap_hash_bytes(&context->all_channels[i].ch,
+            sizeof(context->all_channels[i].ch), hash);
+
+    return hash;
+}
+
+/**
+ * @brief Get the regulatory country from nl80211
+ *
+ * @param context DCS context
+ * @param country Set to the country, or an empty string if it couldn't be read
+ */
+static void get_country(struct dcs *context, char country[4])
+{
+    mmsm_data_item_t *result;
+    const mmsm_key_t key = {
+        .d.u32 = NL80211_ATTR_REG_ALPHA2,
+        .type = MMSM_KEY_TYPE_U32
+    };
+    mmsm_data_item_t *item;
+
+    memset(country, 0, 4);
+
+    /* There is no regulatory domain to tag test samples with */
+    if (context->test.enabled)
+        return;
+
+    result = mmsm_request(context->nl80211_intf, NL80211_CMD_GET_REG, 0, -1);
+    if (!result)
+    {
+        LOG_WARN("Couldn't read the regulatory country\n");
+        return;
+    }
+
+    item = mmsm_find_key(result->mmsm_sub_values, &key);
+    if (item)
+        memcpy(country, item->mmsm_value, MIN(item->mmsm_value_len, 3));
+    else
+        LOG_WARN("No regulatory country reported\n");
+
+    mmsm_data_item_free(result);
+}
+
+/**
+ * @brief Check a snapshot was written intact, for the same country, channels and algorithm
+ *
+ * @param state Persistent state context
+ * @param snap Snapshot to check
+ * @param num_chans Number of available channels
+ * @param now_s Current time, in seconds since the epoch
+ * @return true if the snapshot may be reloaded
+ */
+static bool snapshot_is_valid(struct dcs_state *state, struct dcs_state_snapshot *snap,
+    int num_chans, uint64_t now_s)
+{
+    if (snap->magic != DCS_STATE_MAGIC || snap->version != DCS_STATE_VERSION ||
+        snap->num_chans != num_chans || snap->algo_state_len > DCS_STATE_ALGO_STATE_MAX ||
+        snap->checksum != snapshot_checksum(snap))
+        return false;
+
+    if (memcmp(snap->country, state->country, sizeof(snap->country)) != 0)
+    {
+        LOG_INFO("Saved DCS state is for country \"%.3s\", not \"%.3s\"\n",
+            snap->country, state->country);
+        return false;
+    }
+
+    if (snap->channels_hash != state->channels_hash)
+    {
+        LOG_INFO("Saved DCS state is for a different channel list\n");
+        return false;
+    }
+
+    if (strncmp(snap->algo, state->algo, sizeof(snap->algo)) != 0)
+    {
+        LOG_INFO("Saved DCS state is for algorithm %.16s\n", snap->algo);
+        return false;
+    }
+
+    if (state->max_age_s && (snap->saved_at_s > now_s ||
+                             now_s - snap->saved_at_s > (uint64_t)state->max_age_s))
+    {
+        LOG_INFO("Saved DCS state is out of date\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Restore the state from the latest valid snapshot, if there is one
+ *
+ * @param context DCS context
+ */
+static void restore_state(struct dcs *context)
+{
+    struct dcs_state *state = context->state;
+    struct dcs_state_snapshot *snap = NULL;
+    uint64_t now_s = time(NULL);
+
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        struct dcs_state_snapshot *candidate = get_snapshot(state, i);
+
+        if (!snapshot_is_valid(state, candidate, context->num_chans, now_s))
+            continue;
+
+        /* Generations wrap, the later one is at most one ahead */
+        if (!snap || (int32_t)(candidate->generation - snap->generation) > 0)
+            snap = candidate;
+    }
+
+    if (!snap)
+    {
+        LOG_INFO("No saved DCS state to restore\n");
+        return;
+    }
+
+    if (dcs_algo_ops_load_state(context, snap->algo_state, snap->algo_state_len))
+    {
+        LOG_WARN("Couldn't restore the saved algorithm state, starting afresh\n");
+        return;
+    }
+
+    for (int i = 0; i < context->num_chans; i++)
+    {
+        context->metrics.accumulated_score[i] = snap->channels[i].accumulated_score;
+        context->metrics.n_samples[i] = snap->channels[i].n_samples;
+        context->metrics.rounds_as_best[i] = snap->channels[i].rounds_as_best;
+    }
+
+    state->generation = snap->generation;
+    LOG_INFO("Restored DCS state saved %" PRIu64 "s ago\n", now_s - snap->saved_at_s);
+}
+
+/**
+ * @brief Write the state to the older of the two snapshots
+ *
+ * @param context DCS context
+ */
+static void checkpoint(struct dcs *context)
+{
+    struct dcs_state *state = context->state;
+    struct dcs_state_snapshot *snap = get_snapshot(state, state->generation + 1);
+
+    /* Torn until the checksum is written, so the other snapshot is reloaded meanwhile */
+    snap->magic = DCS_STATE_MAGIC;
+    snap->version = DCS_STATE_VERSION;
+    snap->num_chans = context->num_chans;
+    memcpy(snap->country, state->country, sizeof(snap->country));
+    memcpy(snap->algo, state->algo, sizeof(snap->algo));
+    snap->channels_hash = state->channels_hash;
+    snap->generation = state->generation + 1;
+    snap->saved_at_s = time(NULL);
+    memset(snap->algo_state, 0, sizeof(snap->algo_state));
+    snap->algo_state_len = dcs_algo_ops_save_state(context, snap->algo_state,
+        sizeof(snap->algo_state));
+
+    for (int i = 0; i < context->num_chans; i++)
+    {
+        snap->channels[i].accumulated_score = context->metrics.accumulated_score[i];
+        snap->channels[i].n_samples = context->metrics.n_samples[i];
+        snap->channels[i].rounds_as_best = context->metrics.rounds_as_best[i];
+    }
+
+    snap->checksum = snapshot_checksum(snap);
+
+    /* Written back in the background, only the snapshot just changed */
+    if (msync(snap, state->snapshot_len, MS_ASYNC))
+        LOG_WARN("Failed to sync DCS state - %s\n", strerror(errno));
+
+    state->generation++;
+    state->rounds = 0;
+}
+
+/**
+ * @brief Open and map the state file, creating it if needed
+ *
+ * @param state Persistent state context, with map_len set
+ * @param path Path of the file
+ * @return 0 if successful, else error code
+ */
+static int map_state_file(struct dcs_state *state, const char *path)
+{
+    struct stat st;
+    int fd;
+    int ret = 0;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -errno;
+
+    /* A file of a different size holds no snapshot that could match, so it starts zeroed */
+    if (fstat(fd, &st) || (st.st_size != (off_t)state->map_len &&
+                           (ftruncate(fd, 0) || ftruncate(fd, state->map_len))))
+    {
+        ret = -errno;
+        goto exit;
+    }
+
+    state->map = mmap(NULL, state->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (state->map == MAP_FAILED)
+    {
+        state->map = NULL;
+        ret = -errno;
+    }
+
+exit:
+    close(fd);
+    return ret;
+}
+
+int dcs_state_open(struct dcs *context, config_setting_t *cfg, const char *instance)
+{
+    config_setting_t *state_cfg = config_setting_get_member(cfg, "state");
+    struct dcs_state *state;
+    const char *dir;
+    char path[256];
+    long page_size = sysconf(_SC_PAGESIZE);
+    int ret;
+
+    dir = cfg_parse_string_with_default(state_cfg, "dir", NULL);
+    if (!dir)
+        return 0;
+
+    state = calloc(1, sizeof(*state));
+    if (!state)
+        return -ENOMEM;
+
+    state->checkpoint_rounds = cfg_parse_int_with_default(state_cfg, "checkpoint_rounds",
+        DEFAULT_CHECKPOINT_ROUNDS);
+    state->max_age_s = cfg_parse_int_with_default(state_cfg, "max_age_s", DEFAULT_MAX_AGE_S);
+    if (state->checkpoint_rounds <= 0 || state->max_age_s < 0)
+    {
+        LOG_ERROR("DCS state checkpoint_rounds must be positive and max_age_s not negative\n");
+        free(state);
+        return -EINVAL;
+    }
+
+    snprintf(state->algo, sizeof(state->algo), "%s",
+        cfg_parse_string_with_default(cfg, "algo_type", ""));
+    get_country(context, state->country);
+    state->channels_hash = hash_channels(context);
+
+    state->snapshot_len = sizeof(struct dcs_state_snapshot) +
+        context->num_chans * sizeof(struct dcs_state_channel);
+    state->snapshot_len = (state->snapshot_len + page_size - 1) / page_size * page_size;
+    state->map_len = 2 * state->snapshot_len;
+
+    if (mkdir(dir, 0700) && errno != EEXIST)
+        LOG_WARN("Cannot create directory %s (%s)\n", dir, strerror(errno));
+
+    if (instance)
+        snprintf(path, sizeof(path), "%s/dcs_%s.state", dir, instance);
+    else
+        snprintf(path, sizeof(path), "%s/dcs.state", dir);
+
+    ret = map_state_file(state, path);
+    if (ret)
+    {
+        LOG_WARN("Can't open DCS state file %s, running without it - %s\n", path,
+            strerror(-ret));
+        free(state);
+        return 0;
+    }
+
+    context->state = state;
+    restore_state(context);
+    return 0;
+}
+
+void dcs_state_round_done(struct dcs *context)
+{
+    struct dcs_state *state = context->state;
+
+    if (!state)
+        return;
+
+    if (++state->rounds >= state->checkpoint_rounds)
+        checkpoint(context);
+}
+
+void dcs_state_close(struct dcs *context)
+{
+    struct dcs_state *state = context->state;
+
+    if (!state)
+        return;
+
+    checkpoint(context);
+    munmap(state->map, state->map_len);
+    free(state);
+    context->state = NULL;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ */
+#pragma once
+
+#include <libconfig.h>
+
+#include "dcs.h"
+
+/**
+ * Persistent DCS state.
+ *
+ * The channel metrics and the algorithm state (see @ref algo_ops::save_state) are checkpointed to
+ * a memory-mapped file every few scan rounds, and reloaded on startup, so DCS carries on from
+ * where it left off rather than from scores that take many rounds to settle.
+ *
+ * The file holds two snapshots, written alternately, so one is always intact. A snapshot is tagged
+ * with the regulatory country, the list of available channels and the algorithm, and is only
+ * reloaded if all three still match and it isn't older than the configured maximum age.
+ *
+ * All functions are called from the thread doing the scans, or before it starts.
+ */
+
+/** Opaque persistent state context */
+struct dcs_state;
+
+/**
+ * @brief Open the state file, and restore the state saved in it if it is still valid
+ *
+ * Must be called once the algorithm has been initialised and the channels are known, before any
+ * measurement is processed. Does nothing unless a state directory is configured. Failing to open
+ * the file isn't fatal, DCS just runs without persistence.
+ *
+ * @param dcs DCS context
+ * @param cfg DCS config setting, which may contain a 'state' group
+ * @param instance Name of the instance, eg. the interface, to tell the files of different
+ *                 instances apart, or NULL if there is only one
+ * @return 0 if successful, else error code if the config is invalid
+ */
+int dcs_state_open(struct dcs *dcs, config_setting_t *cfg, const char *instance);
+
+/**
+ * @brief Called once the channels have been evaluated at the end of a scan round, to checkpoint
+ * the state when due
+ *
+ * @param dcs DCS context
+ */
+void dcs_state_round_done(struct dcs *dcs);
+
+/**
+ * @brief Checkpoint the state one last time and close the state file
+ *
+ * Must be called before the algorithm is deinitialised, once no measurement is being processed.
+ *
+ * @param dcs DCS context
+ */
+void dcs_state_close(struct dcs *dcs);
@@ -4,23 +4,24 @@
  */
 
 #include <stdio.h>
-#include <dlfcn.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <signal.h>
 #include <pthread.h>
-#include <limits.h>
 #include <netlink/genl/genl.h>
 #include <linux/nl80211.h>
 #include <libconfig.h>
 
 #include "smart_manager.h"
+#include "helpers.h"
 #include "datalog.h"
 #include "backend/backend.h"
 #include "utils.h"
 #include "logging.h"
+#include "extension.h"
 #include "backend/morsectrl/command.h"
 
 #ifndef MORSE_VERSION
@@ -39,36 +40,75 @@ typedef struct
     void *(*create_func)(const config_t *);
     void (*destroy_func)(void *);
     const char *(*get_version_func)(void);
+    /* Optional, applies a reloaded config, see reload_config() */
+    int (*reconfigure_func)(void *, const config_t *);
+    /* Set once created, so it isn't reconfigured before */
+    bool created;
+    /* Created once the engine has started, see create_deferred_modules() */
+    bool deferred;
+    /* Thread creating the module, if created in parallel */
+    pthread_t create_thread;
+    bool has_create_thread;
 } module_info_t;
 
-/* Load a module and find its create/destroy functions */
-int load_module(const char *libname, const char *module_name, module_info_t *module)
+/* Settings of how modules are created, see load_modules_from_config() */
+static const config_t *modules_config;
+static bool modules_parallel;
+
+/* Thread creating the deferred modules, see create_deferred_modules() */
+static pthread_t deferred_thread;
+static bool has_deferred_thread;
+
+/* A config reloaded from the config file, see reload_config() */
+typedef struct reloaded_config
+{
+    config_t config;
+    struct reloaded_config *prev;
+} reloaded_config_t;
+
+/*
+ * The configs reloaded, latest first. Earlier ones are kept until exit, as modules may still use
+ * their settings.
+ */
+static reloaded_config_t *reloaded_configs;
+
+/* The config the settings are applied from, the one started with until first reloaded */
+static const config_t *running_config;
+
+/* Thread reloading the config file on SIGHUP, see reload_thread_fn() */
+static pthread_t reload_thread;
+static bool has_reload_thread;
+
+/* Top level settings only applied on startup */
+static const char *const startup_settings[] = {
+    "engine", "module_dirs", "modules", "modules_parallel", "modules_deferred",
+};
+
+/* Find a module and load it, with its create/destroy functions */
+int load_module(config_setting_t *module_dirs, const char *module_name, module_info_t *module)
 {
-    const char *error;
     char *create_func_name = NULL, *destroy_func_name = NULL, *get_version_func_name = NULL;
-    int create_func_len, destroy_func_len, get_version_func_len;
+    char *reconfigure_func_name = NULL;
+    int create_func_len, destroy_func_len, get_version_func_len, reconfigure_func_len;
+    void *create_func;
     int ret = 0;
 
-    /* Open the shared library */
-    module->handle = dlopen(libname, RTLD_LAZY | RTLD_GLOBAL);
-    if (!module->handle)
-    {
-        LOG_VERBOSE("Error: %s\n", dlerror());
-        return 1;
-    }
-
+    module->handle = NULL;
     module->module_name = module_name;
 
     /* Get the required length for the function names (including the null terminator) */
     create_func_len = snprintf(NULL, 0, "%s_create", module_name) + 1;
     destroy_func_len = snprintf(NULL, 0, "%s_destroy", module_name) + 1;
     get_version_func_len = snprintf(NULL, 0, "%s_get_version", module_name) + 1;
+    reconfigure_func_len = snprintf(NULL, 0, "%s_reconfigure", module_name) + 1;
 
     create_func_name = malloc(create_func_len);
     destroy_func_name = malloc(destroy_func_len);
     get_version_func_name = malloc(get_version_func_len);
+    reconfigure_func_name = malloc(reconfigure_func_len);
 
-    if (!create_func_name || !destroy_func_name || !get_version_func_name)
+    if (!create_func_name || !destroy_func_name || !get_version_func_name ||
+        !reconfigure_func_name)
     {
         LOG_ERROR("Memory allocation error for function names\n");
         ret = 1;
@@ -79,48 +119,53 @@ int load_module(const char *libname, const char *module_name, module_info_t *mod
     snprintf(create_func_name, create_func_len, "%s_create", module_name);
     snprintf(destroy_func_name, destroy_func_len, "%s_destroy", module_name);
     snprintf(get_version_func_name, get_version_func_len, "%s_get_version", module_name);
+    snprintf(reconfigure_func_name, reconfigure_func_len, "%s_reconfigure", module_name);
 
-    /* Clear any existing error */
-    dlerror();
-
-    /* Find the _create function */
-    module->create_func = (void *(*)(const config_t *))dlsym(module->handle, create_func_name);
-    error = dlerror();
-    if (error)
+    /* Find the library, by its _create function */
+    module->handle = mmsm_extension_open(module_dirs, module_name, create_func_name,
+                                         &create_func);
+    if (!module->handle)
     {
-        LOG_ERROR("Error loading function %s: %s\n", create_func_name, error);
+        LOG_VERBOSE("Failed to find module %s\n", module_name);
         ret = 1;
         goto cleanup;
     }
+    module->create_func = (void *(*)(const config_t *))create_func;
 
     /* Find the _destroy function */
-    module->destroy_func = (void (*)(void *))dlsym(module->handle, destroy_func_name);
-    error = dlerror();
-    if (error)
+    module->destroy_func = (void (*)(void *))mmsm_extension_symbol(module->handle,
+                                                                   destroy_func_name);
+    if (!module->destroy_func)
     {
-        LOG_ERROR("Error loading function %s: %s\n", destroy_func_name, error);
+        LOG_ERROR("Error loading function %s\n", destroy_func_name);
         ret = 1;
         goto cleanup;
     }
 
     /* Find the _get_version function */
-    module->get_version_func = (const char *(*)(void))dlsym(module->handle, get_version_func_name);
-    error = dlerror();
-    if (error)
+    module->get_version_func = (const char *(*)(void))mmsm_extension_symbol(module->handle,
+                                                                            get_version_func_name);
+    if (!module->get_version_func)
     {
-        LOG_ERROR("Error loading function %s: %s\n", get_version_func_name, error);
+        LOG_ERROR("Error loading function %s\n", get_version_func_name);
         ret = 1;
         goto cleanup;
     }
 
+    /* The _reconfigure function is optional */
+    module->reconfigure_func = (int (*)(void *, const config_t *))mmsm_extension_symbol(
+        module->handle, reconfigure_func_name);
+
 cleanup:
     if (ret)
     {
-        dlclose(module->handle);
+        mmsm_extension_close(module->handle);
+        module->handle = NULL;
     }
     free(create_func_name);
     free(destroy_func_name);
     free(get_version_func_name);
+    free(reconfigure_func_name);
 
     return ret;
 }
@@ -136,58 +181,138 @@ void unload_module(module_info_t *module)
             module->destroy_func(module->context); /* Call destroy function */
             module->context = NULL;
         }
-        dlclose(module->handle);
+        mmsm_extension_close(module->handle);
         module->handle = NULL;
     }
 }
 
-#define MMEXT_STR "%s/%s.mmext"
+/* Create a loaded module, from the config file */
+static void create_module(module_info_t *module)
+{
+    LOG_DEBUG("Creating module: %s. Version: %s\n", module->module_name,
+              module->get_version_func());
+    module->context = module->create_func(__atomic_load_n(&modules_config, __ATOMIC_ACQUIRE));
+    __atomic_store_n(&module->created, true, __ATOMIC_RELEASE);
+    LOG_DEBUG("Created module: %s\n", module->module_name);
+}
 
-/* Helper function to create the full library path and load the module */
-int load_module_from_directory(const char *dir, const char *module_name, const config_t *cfg,
-                               module_info_t *module)
+static void *create_module_thread_fn(void *arg)
 {
-    char *libname;
-    int libname_len;
+    create_module((module_info_t *)arg);
+    return NULL;
+}
 
-    /* Construct the full path of the library (e.g., <dir>/<module_name>.mmext) */
-    libname_len = snprintf(NULL, 0, MMEXT_STR, dir, module_name) + 1;
-    libname = malloc(libname_len);
-    if (!libname)
+/*
+ * Create either the deferred modules or the others. In parallel, each module is created on a
+ * thread of its own, so this takes as long as the slowest module rather than all of them in
+ * turn. Returns once they have all been created.
+ */
+static void create_modules(module_info_t *modules, int num_modules, bool deferred)
+{
+    for (int i = 0; i < num_modules; i++)
     {
-        LOG_ERROR("Memory allocation error for libname\n");
-        return 1;
+        module_info_t *module = &modules[i];
+
+        if (module->deferred != deferred)
+            continue;
+
+        module->has_create_thread = modules_parallel &&
+            pthread_create(&module->create_thread, NULL, create_module_thread_fn, module) == 0;
+        if (!module->has_create_thread)
+            create_module(module);
     }
 
-    snprintf(libname, libname_len, MMEXT_STR, dir, module_name);
+    for (int i = 0; i < num_modules; i++)
+    {
+        if (modules[i].has_create_thread)
+        {
+            MMSM_ASSERT(pthread_join(modules[i].create_thread, NULL) == 0);
+            modules[i].has_create_thread = false;
+        }
+    }
+}
 
-    /* Try loading the module */
-    if (load_module(libname, module_name, module) == 0)
+typedef struct
+{
+    module_info_t *modules;
+    int num_modules;
+} deferred_modules_t;
+
+static void *create_deferred_modules_thread_fn(void *arg)
+{
+    deferred_modules_t *deferred = (deferred_modules_t *)arg;
+
+    create_modules(deferred->modules, deferred->num_modules, true);
+    LOG_INFO_ALWAYS("Deferred modules created\n");
+    free(deferred);
+    return NULL;
+}
+
+/* Create the deferred modules in the background, once the engine has started */
+void create_deferred_modules(module_info_t *modules, int num_modules)
+{
+    deferred_modules_t *deferred;
+    int i;
+
+    for (i = 0; i < num_modules && !modules[i].deferred; i++)
+        ;
+    if (i == num_modules)
+        return;
+
+    deferred = malloc(sizeof(*deferred));
+    if (deferred)
     {
-        LOG_DEBUG("Loaded module: %s from library: %s. Version: %s\n", module_name, libname,
-                  module->get_version_func());
-        module->context = module->create_func(cfg);
-        free(libname);
-        return 0;
+        deferred->modules = modules;
+        deferred->num_modules = num_modules;
+        has_deferred_thread =
+            pthread_create(&deferred_thread, NULL, create_deferred_modules_thread_fn,
+                           deferred) == 0;
     }
-    else
+
+    if (!has_deferred_thread)
     {
-        LOG_VERBOSE("Failed to load module %s from library %s\n", module_name, libname);
-        free(libname);
-        return 1;
+        LOG_WARN("Failed to start creating deferred modules in the background\n");
+        free(deferred);
+        create_modules(modules, num_modules, true);
+    }
+}
+
+/* Wait for the deferred modules to have been created, before unloading them */
+void wait_for_deferred_modules(void)
+{
+    if (has_deferred_thread)
+    {
+        MMSM_ASSERT(pthread_join(deferred_thread, NULL) == 0);
+        has_deferred_thread = false;
     }
 }
 
-/* Load module list from config file */
+/* Whether a module is in the modules_deferred list of the config file */
+static bool module_is_deferred(const config_t *cfg, const char *module_name)
+{
+    config_setting_t *deferred = config_lookup(cfg, "modules_deferred");
+
+    for (int i = 0; deferred && i < config_setting_length(deferred); i++)
+    {
+        const char *name = config_setting_get_string_elem(deferred, i);
+
+        if (name && strcmp(name, module_name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Load module list from config file, and create the modules that aren't deferred. The deferred
+ * ones are created by create_deferred_modules().
+ */
 module_info_t *load_modules_from_config(const config_t *cfg, int *num_modules)
 {
     config_setting_t *setting;
     module_info_t *modules = NULL;
     config_setting_t *module_dirs = NULL;
-    char *cwd = NULL;
     const char *module_name;
-    int dir_count = 0;
-    int found_module = 0;
     int count = 0;
 
     /* Get the 'module_dirs' section if available (it could be an array) */
@@ -214,60 +339,203 @@ module_info_t *load_modules_from_config(const config_t *cfg, int *num_modules)
     for (int i = 0; i < count; i++)
     {
         module_name = config_setting_get_string_elem(setting, i);
-        found_module = 0;
 
-        /* Try to find the module in the module_dirs if provided */
-        if (module_dirs != NULL && config_setting_is_array(module_dirs))
+        if (load_module(module_dirs, module_name, &modules[*num_modules]) == 0)
+        {
+            module_info_t *module = &modules[*num_modules];
+
+            LOG_DEBUG("Loaded module: %s\n", module_name);
+            module->context = NULL;
+            module->deferred = module_is_deferred(cfg, module_name);
+            module->has_create_thread = false;
+            module->created = false;
+            (*num_modules)++;
+        }
+    }
+
+    modules_config = cfg;
+    modules_parallel = cfg_parse_bool_with_default(config_root_setting(cfg), "modules_parallel",
+                                                   false);
+    create_modules(modules, *num_modules, false);
+
+    return modules;
+}
+
+/*
+ * Reread the config file, and apply the settings that changed: the logging and datalog ones, and
+ * each module's through its _reconfigure function. Modules without one keep their settings until
+ * restarted, as do the engine and which modules are loaded. If the file can't be read, the
+ * running config is kept.
+ */
+static void reload_config(const char *path, module_info_t *modules, int num_modules)
+{
+    reloaded_config_t *reloaded;
+    config_setting_t *prev_root = config_root_setting(running_config);
+    config_setting_t *next_root;
+    int changes = 0;
+
+    LOG_INFO_ALWAYS("Reloading config file %s\n", path);
+
+    reloaded = calloc(1, sizeof(*reloaded));
+    if (!reloaded)
+    {
+        LOG_ERROR("Error: memory allocation failed\n");
+        return;
+    }
+
+    config_init(&reloaded->config);
+    if (!config_read_file(&reloaded->config, path))
+    {
+        LOG_ERROR("Error in reading config file %s, keeping the running config\n",
+                  config_error_file(&reloaded->config));
+        LOG_ERROR("Failed at line %d: %s\n", config_error_line(&reloaded->config),
+                  config_error_text(&reloaded->config));
+        config_destroy(&reloaded->config);
+        free(reloaded);
+        return;
+    }
+    next_root = config_root_setting(&reloaded->config);
+
+    for (int i = 0; i < config_setting_length(next_root); i++)
+    {
+        config_setting_t *setting = config_setting_get_elem(next_root, i);
+        const char *name = config_setting_name(setting);
+
+        if (!cfg_setting_equal(setting, config_setting_get_member(prev_root, name)))
         {
-            dir_count = config_setting_length(module_dirs);
-            for (int j = 0; j < dir_count; j++)
-            {
-                const char *dir = config_setting_get_string_elem(module_dirs, j);
-                if (dir == NULL)
-                {
-                    LOG_ERROR("Invalid directory in module_dirs\n");
-                    continue;
-                }
-
-                LOG_VERBOSE("Trying to find module %s in directory: %s\n", module_name, dir);
-
-                /* Try to load the module from this directory */
-                if (load_module_from_directory(dir, module_name, cfg, &modules[*num_modules]) == 0)
-                {
-                    (*num_modules)++;
-                    found_module = 1;
-                    break;
-                }
-            }
+            LOG_INFO("Config setting %s changed\n", name);
+            changes++;
         }
+    }
+
+    for (int i = 0; i < config_setting_length(prev_root); i++)
+    {
+        const char *name = config_setting_name(config_setting_get_elem(prev_root, i));
 
-        /* If not found in any provided directory, try the current working directory */
-        if (!found_module)
+        if (!config_setting_get_member(next_root, name))
         {
-            /* Allocate memory for the current working directory dynamically */
-            cwd = getcwd(NULL, 0);
-
-            if (cwd != NULL)
-            {
-                LOG_VERBOSE("Trying to find module %s in current working directory: %s\n",
-                            module_name, cwd);
-
-                /* Try to load the module from the current working directory */
-                if (load_module_from_directory(cwd, module_name, cfg, &modules[*num_modules]) == 0)
-                {
-                    (*num_modules)++;
-                }
-
-                free(cwd);
-            }
-            else
-            {
-                LOG_ERROR("Error: could not determine current working directory\n");
-            }
+            LOG_INFO("Config setting %s removed\n", name);
+            changes++;
         }
     }
 
-    return modules;
+    if (!changes)
+    {
+        LOG_INFO_ALWAYS("Config file unchanged\n");
+        config_destroy(&reloaded->config);
+        free(reloaded);
+        return;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(startup_settings); i++)
+    {
+        if (!cfg_setting_equal(config_lookup(running_config, startup_settings[i]),
+                               config_lookup(&reloaded->config, startup_settings[i])))
+            LOG_WARN("%s settings are kept until restarted\n", startup_settings[i]);
+    }
+
+    if (!cfg_setting_equal(config_lookup(running_config, "logging"),
+                           config_lookup(&reloaded->config, "logging")))
+        mmsm_set_log_config(config_lookup(&reloaded->config, "logging"));
+
+    if (!cfg_setting_equal(config_lookup(running_config, "datalog"),
+                           config_lookup(&reloaded->config, "datalog")))
+        datalog_set_config_settings(config_lookup(&reloaded->config, "datalog"));
+
+    /* Modules created from now on get the reloaded config, the others are reconfigured */
+    __atomic_store_n(&modules_config, &reloaded->config, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < num_modules; i++)
+    {
+        module_info_t *module = &modules[i];
+        int ret;
+
+        if (!__atomic_load_n(&module->created, __ATOMIC_ACQUIRE) || !module->context)
+            continue;
+
+        if (!module->reconfigure_func)
+        {
+            LOG_INFO("Module %s can't be reconfigured, keeping its settings until restarted\n",
+                     module->module_name);
+            continue;
+        }
+
+        ret = module->reconfigure_func(module->context, &reloaded->config);
+        if (ret)
+            LOG_WARN("Failed to reconfigure module %s (%d)\n", module->module_name, ret);
+    }
+
+    reloaded->prev = reloaded_configs;
+    reloaded_configs = reloaded;
+    running_config = &reloaded->config;
+    LOG_INFO_ALWAYS("Config file reloaded\n");
+}
+
+typedef struct
+{
+    const char *path;
+    module_info_t *modules;
+    int num_modules;
+} reload_args_t;
+
+/* Reload the config file each time SIGHUP is received, which every other thread blocks */
+static void *reload_thread_fn(void *arg)
+{
+    reload_args_t *args = (reload_args_t *)arg;
+    sigset_t set;
+    int cancel_state;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+
+    while (sigwait(&set, &sig) == 0)
+    {
+        /* Not stopped half way through, see stop_reloading() */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+        reload_config(args->path, args->modules, args->num_modules);
+        pthread_setcancelstate(cancel_state, NULL);
+    }
+
+    return NULL;
+}
+
+/* Start reloading the config file on SIGHUP */
+void start_reloading(const char *path, module_info_t *modules, int num_modules)
+{
+    static reload_args_t args;
+
+    args.path = path;
+    args.modules = modules;
+    args.num_modules = num_modules;
+
+    has_reload_thread = pthread_create(&reload_thread, NULL, reload_thread_fn, &args) == 0;
+    if (!has_reload_thread)
+        LOG_WARN("Failed to start the config reload thread, SIGHUP is ignored\n");
+}
+
+/* Stop reloading the config file, before unloading the modules */
+void stop_reloading(void)
+{
+    if (has_reload_thread)
+    {
+        pthread_cancel(reload_thread);
+        MMSM_ASSERT(pthread_join(reload_thread, NULL) == 0);
+        has_reload_thread = false;
+    }
+}
+
+/* Destroy the configs reloaded, once nothing uses them */
+static void destroy_reloaded_configs(void)
+{
+    while (reloaded_configs)
+    {
+        reloaded_config_t *prev = reloaded_configs->prev;
+
+        config_destroy(&reloaded_configs->config);
+        free(reloaded_configs);
+        reloaded_configs = prev;
+    }
 }
 
 /**
@@ -288,6 +556,7 @@ int main(int argc, char **argv)
     config_t config;
     int num_modules = 0;
     module_info_t *modules = NULL;
+    sigset_t reload_set;
 
     if (argc < 2)
     {
@@ -301,6 +570,11 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    /* Before any thread is started, so only the reload thread receives it */
+    sigemptyset(&reload_set);
+    sigaddset(&reload_set, SIGHUP);
+    MMSM_ASSERT(pthread_sigmask(SIG_BLOCK, &reload_set, NULL) == 0);
+
     config_init(&config);
 
     if (!config_read_file(&config, argv[1]))
@@ -312,11 +586,14 @@ int main(int argc, char **argv)
     }
 
     LOG_INFO_ALWAYS("Smart Manager starting... (config file: %s)\n", argv[1]);
+    running_config = &config;
 
     mmsm_set_log_config(config_lookup(&config, "logging"));
 
     mmsm_init();
 
+    mmsm_set_engine_config(config_lookup(&config, "engine"));
+
     datalog_set_config_settings(config_lookup(&config, "datalog"));
 
     /* Load modules from the config file */
@@ -330,6 +607,10 @@ int main(int argc, char **argv)
     LOG_INFO_ALWAYS("Starting monitors\n");
     mmsm_start();
 
+    create_deferred_modules(modules, num_modules);
+
+    start_reloading(argv[1], modules, num_modules);
+
     /* Suspend the main thread until a child thread signals that SM should halt.
      * In normal applications this should not happen, and modules should be self sufficent / error
      * tolerant
@@ -339,6 +620,9 @@ int main(int argc, char **argv)
     pthread_cond_wait(&halt_condition, &halt_mutex);
     MMSM_ASSERT(pthread_mutex_unlock(&halt_mutex) == 0);
 
+    stop_reloading();
+    wait_for_deferred_modules();
+
     for (int i = 0; i < num_modules; i++)
     {
         unload_module(&modules[i]);
@@ -346,6 +630,7 @@ int main(int argc, char **argv)
 
     free(modules);
 
+    destroy_reloaded_configs();
     config_destroy(&config);
 
     return 0;
@@ -0,0 +1,138 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ *
+ * datalog_export.c - Converts a binary datalog, see datalog_init_columns(), to CSV
+ *
+ * The CSV is the same as the datalog would have been written as, had its format been "csv", so
+ * the tools reading CSV datalogs can read it. Build with `scons tools`, then eg.
+ *
+ *   datalog_export dcs.log > dcs.csv
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "smart_manager.h"
+#include "datalog.h"
+#include "timestamp.h"
+
+static void export_usage(void)
+{
+    fprintf(stderr,
+        "Usage: datalog_export <datalog> [<output.csv>]\n"
+        "  Writes the CSV to stdout unless an output file is given\n");
+}
+
+/** Writes every record of a binary datalog, after the headings */
+static void export_csv(const struct datalog_binary *bin, FILE *out)
+{
+    uint64_t time_ms[DATALOG_BINARY_MAX_FIELDS];
+    const uint8_t *record = bin->records;
+    timestamp_t timestamp;
+
+    for (int i = 0; i < bin->n_fields; i++)
+        time_ms[i] = bin->base_ms;
+
+    fprintf(out, "%s\n", bin->heading);
+
+    for (size_t r = 0; r < bin->n_records; r++, record += bin->record_len)
+    {
+        uint64_t rebase_ms;
+
+        if (datalog_binary_is_rebase(bin, record, &rebase_ms))
+        {
+            for (int i = 0; i < bin->n_fields; i++)
+                time_ms[i] = rebase_ms;
+            continue;
+        }
+
+        for (int i = 0; i < bin->n_fields; i++)
+        {
+            int64_t val = datalog_binary_get(bin, record, i);
+
+            if (i)
+                fputc(',', out);
+
+            switch (bin->fmt[i])
+            {
+                case 'u':
+                case 'd':
+                    fprintf(out, "%" PRId64, val);
+                    break;
+                case 'b':
+                    fputs(val ? "True" : "False", out);
+                    break;
+                case 't':
+                    time_ms[i] += val;
+                    timestamp_from_ms(time_ms[i], &timestamp);
+                    timestamp_write_to_file_as_iso(out, &timestamp);
+                    break;
+            }
+        }
+        fputc('\n', out);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct datalog_binary bin;
+    struct stat st;
+    FILE *out = stdout;
+    void *map;
+    int fd;
+
+    if (argc < 2 || argc > 3)
+    {
+        export_usage();
+        return 1;
+    }
+
+    fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) || st.st_size == 0)
+    {
+        fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s\n", argv[1]);
+        return 1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if (!datalog_binary_open(&bin, map, st.st_size))
+    {
+        fprintf(stderr, "%s is not a binary datalog\n", argv[1]);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    if (argc == 3)
+    {
+        out = fopen(argv[2], "w");
+        if (!out)
+        {
+            fprintf(stderr, "Could not open %s\n", argv[2]);
+            munmap(map, st.st_size);
+            return 1;
+        }
+    }
+
+    export_csv(&bin, out);
+
+    if (out != stdout)
+        fclose(out);
+    munmap(map, st.st_size);
+    return 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * Copyright 2025 Morse Micro
+ * SPDX-License-Identifier: GPL-2.0-or-later OR LicenseRef-MorseMicroCommercial
+ *
+ * trace_export.c - Converts a flight recorder dump, see trace.h, to CSV
+ *
+ * Writes the records oldest first, with their wall clock time, naming their source and type.
+ * Records that were being written when the dump was taken are left out. Build with
+ * `scons tools`, then eg.
+ *
+ *   kill -USR1 $(pidof smart_manager)
+ *   trace_export /var/log/smart_manager/smart_manager.trace > trace.csv
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "smart_manager.h"
+#include "timestamp.h"
+#include "trace.h"
+#include "utils.h"
+
+static const char *const source_names[] = {
+    [TRACE_ENGINE] = "engine",
+    [TRACE_HOSTAPD] = "hostapd",
+    [TRACE_NL80211] = "nl80211",
+    [TRACE_MORSECTRL] = "morsectrl",
+    [TRACE_DCS] = "dcs",
+};
+
+static const char *const type_names[] = {
+    [TRACE_REQUEST_START] = "request_start",
+    [TRACE_REQUEST_END] = "request_end",
+    [TRACE_EVENT] = "event",
+    [TRACE_CALLBACK] = "callback",
+    [TRACE_DCS_SCAN] = "dcs_scan",
+    [TRACE_DCS_CSA] = "dcs_csa",
+};
+
+static const char *const callback_names[] = {
+    [TRACE_CALLBACK_PATTERN] = "pattern",
+    [TRACE_CALLBACK_POLLING] = "polling",
+};
+
+static const char *const dcs_scan_names[] = {
+    [TRACE_DCS_ROUND_START] = "round_start",
+    [TRACE_DCS_SCAN_START] = "scan_start",
+    [TRACE_DCS_SCAN_DONE] = "scan_done",
+    [TRACE_DCS_SCAN_FAILED] = "scan_failed",
+};
+
+static const char *const dcs_csa_names[] = {
+    [TRACE_DCS_CSA_START] = "start",
+    [TRACE_DCS_CSA_KERNEL_SWITCHED] = "kernel_switched",
+    [TRACE_DCS_CSA_HOSTAPD_SWITCHED] = "hostapd_switched",
+    [TRACE_DCS_CSA_DONE] = "done",
+    [TRACE_DCS_CSA_FAILED] = "failed",
+};
+
+static void export_usage(void)
+{
+    fprintf(stderr,
+        "Usage: trace_export <trace> [<output.csv>]\n"
+        "  Writes the CSV to stdout unless an output file is given\n");
+}
+
+/** Writes a name from a table, or the number if it has none */
+static void export_name(FILE *out, const char *const *names, size_t n_names, unsigned int value)
+{
+    if (value < n_names && names[value])
+        fputs(names[value], out);
+    else
+        fprintf(out, "%u", value);
+}
+
+/** Writes an arg packed by trace_name() as text, or as a number if it isn't */
+static void export_packed_name(FILE *out, uint32_t arg)
+{
+    char name[5] = { 0 };
+
+    for (int i = 0; i < 4; i++)
+        name[i] = (arg >> (8 * i)) & 0xff;
+
+    if (name[0] >= 'A' && name[0] <= 'Z')
+        fputs(name, out);
+    else
+        fprintf(out, "%" PRIu32, arg);
+}
+
+static void export_record(FILE *out, const trace_header_t *header, const trace_record_t *record)
+{
+    uint64_t age_us = header->monotonic_us - record->time_us;
+    timestamp_t timestamp;
+
+    timestamp_from_ms((header->realtime_us - age_us) / 1000, &timestamp);
+    timestamp_write_to_file_as_iso(out, &timestamp);
+
+    fprintf(out, ",%" PRIu64 ",%" PRIu32 ",", record->time_us, record->tid);
+    export_name(out, source_names, ARRAY_SIZE(source_names), record->source);
+    fputc(',', out);
+    export_name(out, type_names, ARRAY_SIZE(type_names), record->type);
+    fputc(',', out);
+
+    switch (record->type)
+    {
+        case TRACE_CALLBACK:
+            export_name(out, callback_names, ARRAY_SIZE(callback_names), record->id);
+            break;
+        case TRACE_DCS_SCAN:
+            export_name(out, dcs_scan_names, ARRAY_SIZE(dcs_scan_names), record->id);
+            break;
+        case TRACE_DCS_CSA:
+            export_name(out, dcs_csa_names, ARRAY_SIZE(dcs_csa_names), record->id);
+            break;
+        default:
+            fprintf(out, "%u", record->id);
+            break;
+    }
+    fputc(',', out);
+
+    if ((record->source == TRACE_HOSTAPD || record->source == TRACE_ENGINE) &&
+        (record->type == TRACE_REQUEST_START || record->type == TRACE_EVENT))
+        export_packed_name(out, record->arg);
+    else
+        fprintf(out, "%" PRIu32, record->arg);
+
+    fprintf(out, ",%" PRIu32 "\n", record->value);
+}
+
+/** Writes every complete record still in the ring, oldest first */
+static void export_csv(const trace_header_t *header, const trace_record_t *ring, FILE *out)
+{
+    uint64_t first = header->next_seq > header->num_records ?
+                     header->next_seq - header->num_records : 1;
+
+    fprintf(out, "time,monotonic_us,tid,source,type,id,arg,value\n");
+
+    for (uint64_t seq = first; seq < header->next_seq; seq++)
+    {
+        const trace_record_t *record = &ring[(seq - 1) % header->num_records];
+
+        /* Being written, or already overwritten by a newer record, when dumped */
+        if (record->seq != seq)
+            continue;
+
+        export_record(out, header, record);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const trace_header_t *header;
+    struct stat st;
+    FILE *out = stdout;
+    void *map;
+    int fd;
+
+    if (argc < 2 || argc > 3)
+    {
+        export_usage();
+        return 1;
+    }
+
+    fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) || st.st_size == 0)
+    {
+        fprintf(stderr, "Could not read %s\n", argv[1]);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s\n", argv[1]);
+        return 1;
+    }
+
+    header = map;
+    if ((size_t)st.st_size < sizeof(*header) ||
+        memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TRACE_VERSION || header->record_size != sizeof(trace_record_t) ||
+        header->num_records == 0 ||
+        (size_t)st.st_size < sizeof(*header) + (size_t)header->num_records * sizeof(trace_record_t))
+    {
+        fprintf(stderr, "%s is not a trace from this build\n", argv[1]);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    if (argc == 3)
+    {
+        out = fopen(argv[2], "w");
+        if (!out)
+        {
+            fprintf(stderr, "Could not open %s\n", argv[2]);
+            munmap(map, st.st_size);
+            return 1;
+        }
+    }
+
+    export_csv(header, (const trace_record_t *)(header + 1), out);
+
+    if (out != stdout)
+        fclose(out);
+    munmap(map, st.st_size);
+    return 0;
+}